@@ -0,0 +1,167 @@
+#include "fun/base/async/frame_pool.h"
+
+namespace fun {
+namespace async {
+
+namespace {
+
+thread_local FramePool* current_pool_ = nullptr;
+
+// Marks the remote free list of a released pool.
+FUN_ALWAYS_INLINE void* ClosedMarker() {
+  return reinterpret_cast<void*>(uintptr_t(1));
+}
+
+}  // namespace
+
+FramePool* FramePool::Create() { return new FramePool(); }
+
+// One reference for the owner plus one per frame handed out.
+FramePool::FramePool()
+    : remote_frees_(nullptr), live_count_(1), released_(false) {
+  for (int32 i = 0; i < NUM_SIZE_CLASSES; ++i) {
+    free_lists_[i] = nullptr;
+  }
+}
+
+FramePool::~FramePool() {
+  fun_check(live_count_.load() == 0);
+}
+
+FramePool* FramePool::GetCurrent() { return current_pool_; }
+
+void FramePool::SetCurrent(FramePool* pool) { current_pool_ = pool; }
+
+void* FramePool::AllocateFrame(size_t size) {
+  FramePool* pool = current_pool_;
+  if (pool && size <= MAX_POOLED_SIZE) {
+    const uint32 size_class =
+        uint32((size + SIZE_CLASS_GRANULARITY - 1) / SIZE_CLASS_GRANULARITY) -
+        1;
+    return pool->Allocate(size_class);
+  }
+
+  Header* header =
+      static_cast<Header*>(UnsafeMemory::Malloc(sizeof(Header) + size, 16));
+  if (header == nullptr) {
+    throw OutOfMemoryException("cannot allocate coroutine frame");
+  }
+  header->owner = nullptr;
+  header->size_class = 0;
+  return header + 1;
+}
+
+void FramePool::FreeFrame(void* frame) {
+  Header* header = static_cast<Header*>(frame) - 1;
+  if (header->owner) {
+    header->owner->Free(header);
+  } else {
+    UnsafeMemory::Free(header);
+  }
+}
+
+void* FramePool::Allocate(uint32 size_class) {
+  fun_check(size_class < NUM_SIZE_CLASSES);
+
+  if (free_lists_[size_class] == nullptr &&
+      remote_frees_.load(std::memory_order_relaxed) != nullptr) {
+    DrainRemoteFrees();
+  }
+
+  Header* header;
+  if (FreeNode* node = free_lists_[size_class]) {
+    free_lists_[size_class] = node->next;
+    header = reinterpret_cast<Header*>(node);
+  } else {
+    const size_t block_size =
+        sizeof(Header) + (size_class + 1) * SIZE_CLASS_GRANULARITY;
+    header = static_cast<Header*>(UnsafeMemory::Malloc(block_size, 16));
+    if (header == nullptr) {
+      throw OutOfMemoryException("cannot allocate coroutine frame");
+    }
+    header->size_class = size_class;
+  }
+
+  header->owner = this;
+  live_count_.fetch_add(1, std::memory_order_relaxed);
+  return header + 1;
+}
+
+void FramePool::Free(Header* header) {
+  FreeNode* node = reinterpret_cast<FreeNode*>(header);
+
+  if (current_pool_ == this) {
+    node->next = free_lists_[header->size_class];
+    free_lists_[header->size_class] = node;
+    live_count_.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Freed on a foreign thread: give it back to the owner.
+  FreeNode* head = remote_frees_.load(std::memory_order_relaxed);
+  do {
+    if (head == ClosedMarker()) {
+      UnsafeMemory::Free(header);
+      DropLive();
+      return;
+    }
+    node->next = head;
+  } while (!remote_frees_.compare_exchange_weak(
+      head, node, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void FramePool::DrainRemoteFrees() {
+  FreeNode* node = remote_frees_.exchange(nullptr, std::memory_order_acquire);
+  int32 count = 0;
+  while (node) {
+    FreeNode* next = node->next;
+    const uint32 size_class = reinterpret_cast<Header*>(node)->size_class;
+    node->next = free_lists_[size_class];
+    free_lists_[size_class] = node;
+    node = next;
+    ++count;
+  }
+  live_count_.fetch_sub(count, std::memory_order_relaxed);
+}
+
+void FramePool::ReleaseCachedBlocks() {
+  for (int32 i = 0; i < NUM_SIZE_CLASSES; ++i) {
+    FreeNode* node = free_lists_[i];
+    while (node) {
+      FreeNode* next = node->next;
+      UnsafeMemory::Free(node);
+      node = next;
+    }
+    free_lists_[i] = nullptr;
+  }
+}
+
+void FramePool::Release() {
+  fun_check(!released_.exchange(true));
+
+  if (current_pool_ == this) {
+    current_pool_ = nullptr;
+  }
+
+  // From now on foreign frees go straight to the allocator.
+  FreeNode* node = remote_frees_.exchange(
+      static_cast<FreeNode*>(ClosedMarker()), std::memory_order_acquire);
+  while (node) {
+    FreeNode* next = node->next;
+    UnsafeMemory::Free(node);
+    live_count_.fetch_sub(1, std::memory_order_relaxed);
+    node = next;
+  }
+
+  ReleaseCachedBlocks();
+  DropLive();
+}
+
+void FramePool::DropLive() {
+  if (live_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+}  // namespace async
+}  // namespace fun
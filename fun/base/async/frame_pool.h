@@ -0,0 +1,83 @@
+#pragma once
+
+#include "fun/base/base.h"
+
+#include <atomic>
+
+namespace fun {
+namespace async {
+
+/**
+ * Size-class free lists for coroutine frames.
+ *
+ * Every Task<T> frame is allocated through FramePool::AllocateFrame().
+ * When the calling thread has a current pool (EventLoop installs one for
+ * its thread), frames are recycled through the pool's free lists, so a
+ * request path that creates a handful of tasks per request stops
+ * allocating once it is warm. Without a current pool, or for frames
+ * larger than MAX_POOLED_SIZE, the regular allocator is used.
+ *
+ * A frame freed on another thread is handed back to its owning pool
+ * through a lock-free list and recycled on the owner's next allocation.
+ * A pool is destroyed by Release(); it lingers until the last frame it
+ * handed out is freed.
+ */
+class FUN_BASE_API FramePool : Noncopyable {
+ public:
+  enum {
+    SIZE_CLASS_GRANULARITY = 64,
+    MAX_POOLED_SIZE = 4096,
+    NUM_SIZE_CLASSES = MAX_POOLED_SIZE / SIZE_CLASS_GRANULARITY,
+  };
+
+  static FramePool* Create();
+
+  /**
+   * Drops the owner's reference. Cached blocks are freed immediately, the
+   * pool itself once no frame from it is alive.
+   */
+  void Release();
+
+  static FramePool* GetCurrent();
+  static void SetCurrent(FramePool* pool);
+
+  static void* AllocateFrame(size_t size);
+  static void FreeFrame(void* frame);
+
+  /**
+   * Frames currently handed out by this pool. Only meaningful before
+   * Release().
+   */
+  int32 GetLiveCount() const { return live_count_.load() - 1; }
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  /**
+   * Precedes every frame; 16 bytes so frames stay 16-byte aligned.
+   */
+  struct Header {
+    FramePool* owner;
+    uint32 size_class;
+    uint32 unused;
+  };
+
+  FramePool();
+  ~FramePool();
+
+  void* Allocate(uint32 size_class);
+  void Free(Header* header);
+  void DrainRemoteFrees();
+  void ReleaseCachedBlocks();
+  void DropLive();
+
+  FreeNode* free_lists_[NUM_SIZE_CLASSES];
+  std::atomic<FreeNode*> remote_frees_;
+  std::atomic<int32> live_count_;
+  std::atomic<bool> released_;
+};
+
+}  // namespace async
+}  // namespace fun
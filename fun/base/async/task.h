@@ -0,0 +1,233 @@
+#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/async/frame_pool.h"
+
+#if FUN_WITH_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace fun {
+namespace async {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+class TaskPromiseBase {
+ public:
+  static void* operator new(size_t size) {
+    return FramePool::AllocateFrame(size);
+  }
+
+  static void operator delete(void* frame) { FramePool::FreeFrame(frame); }
+
+  // Tasks are lazy: nothing runs until the task is awaited or spawned.
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept {
+      TaskPromiseBase& promise = handle.promise();
+      if (promise.continuation_) {
+        // Symmetric transfer back to the awaiting coroutine; no stack
+        // growth however long the chain of awaits is.
+        return promise.continuation_;
+      }
+      if (promise.detached_) {
+        handle.destroy();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() noexcept {
+    if (detached_) {
+      // Nobody is left to observe it, like an exception escaping a thread.
+      std::terminate();
+    }
+    exception_ = std::current_exception();
+  }
+
+  void SetContinuation(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+  }
+
+  void SetDetached() { detached_ = true; }
+
+ protected:
+  void RethrowIfFailed() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+ private:
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+  bool detached_ = false;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+ public:
+  Task<T> get_return_object() noexcept;
+
+  template <typename U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T TakeResult() {
+    RethrowIfFailed();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+ public:
+  Task<void> get_return_object() noexcept;
+
+  void return_void() noexcept {}
+
+  void TakeResult() { RethrowIfFailed(); }
+};
+
+}  // namespace detail
+
+/**
+ * Lazily started coroutine producing a T.
+ *
+ *   Task<size_t> LoadInventory(TcpConnectionPtr conn, int64 user_id) {
+ *     co_await Sleep(0.01);
+ *     Reply reply = co_await RedisCommand(redis, {"GET", key});
+ *     ...
+ *     co_return count;
+ *   }
+ *
+ *   size_t count = co_await LoadInventory(conn, 42);
+ *
+ * A task runs when it is awaited; the awaiting coroutine is resumed by
+ * symmetric transfer when it finishes, and exceptions propagate through
+ * co_await. Top-level tasks are started with Spawn().
+ *
+ * Frames come from the FramePool of the current thread, so tasks created
+ * on an EventLoop thread reuse frames instead of hitting the allocator.
+ * A Task owns its frame and is move-only.
+ */
+template <typename T>
+class Task {
+ public:
+  using promise_type = detail::TaskPromise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  Task() noexcept : handle_(nullptr) {}
+
+  explicit Task(Handle handle) noexcept : handle_(handle) {}
+
+  Task(Task&& other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = other.handle_;
+      other.handle_ = nullptr;
+    }
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool IsValid() const { return handle_ != nullptr; }
+
+  bool IsDone() const { return handle_ && handle_.done(); }
+
+  // Awaitable interface.
+
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> awaiting) noexcept {
+    handle_.promise().SetContinuation(awaiting);
+    return handle_;
+  }
+
+  T await_resume() {
+    fun_check_msg(handle_, "awaiting an empty Task");
+    return handle_.promise().TakeResult();
+  }
+
+  /**
+   * Starts the task without an awaiting coroutine. The frame frees
+   * itself when the task finishes.
+   */
+  void Detach() {
+    fun_check(handle_ && !handle_.done());
+    Handle handle = handle_;
+    handle_ = nullptr;
+    handle.promise().SetDetached();
+    handle.resume();
+  }
+
+ private:
+  Handle handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+/**
+ * Runs a task to its first suspension point right away and lets it
+ * finish on its own, e.g. from a message callback:
+ *
+ *   conn->SetMessageCallback([](const TcpConnectionPtr& conn, Buffer*,
+ *                               const Timestamp&) {
+ *     Spawn(HandleSession(conn));
+ *   });
+ */
+template <typename T>
+void Spawn(Task<T>&& task) {
+  task.Detach();
+}
+
+}  // namespace async
+}  // namespace fun
+
+#endif  // FUN_WITH_COROUTINES
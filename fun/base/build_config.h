@@ -22,3 +22,14 @@
 // Macro enabling FUN Exceptions and assertions
 // to append stack backtrace (if available)
 #define FUN_EXCEPTION_BACKTRACE  1
+
+
+// C++20 coroutines (fun/base/async/task.h and the awaitables built on it).
+// Detected from the compiler; define to 0 to leave them out.
+#ifndef FUN_WITH_COROUTINES
+  #if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+    #define FUN_WITH_COROUTINES  1
+  #else
+    #define FUN_WITH_COROUTINES  0
+  #endif
+#endif
@@ -0,0 +1,423 @@
+﻿#include "fun/base/caching_memory_pool.h"
+#include "fun/base/container/map.h"
+#include "fun/base/exception.h"
+#include "fun/base/scoped_lock.h"
+
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fun {
+
+namespace internal {
+namespace pool {
+
+namespace {
+
+struct ThreadCacheEntry {
+  uint64 serial;
+  void* cache;
+};
+
+/**
+ * Live owners. Never destroyed, since threads may exit during static
+ * destruction.
+ */
+struct OwnerRegistry {
+  FastMutex mutex;
+  Map<uint64, ThreadCacheOwner*> owners;
+  Array<int32> free_slots;
+  int32 slot_count;
+  uint64 next_serial;
+
+  OwnerRegistry() : slot_count(0), next_serial(1) {}
+
+  static OwnerRegistry& Get() {
+    static OwnerRegistry* registry = new OwnerRegistry;
+    return *registry;
+  }
+};
+
+/**
+ * The calling thread's caches, indexed by slot. Hands them back to their
+ * owners when the thread exits.
+ */
+struct ThreadCacheTable {
+  Array<ThreadCacheEntry> entries;
+
+  ~ThreadCacheTable() {
+    OwnerRegistry& registry = OwnerRegistry::Get();
+    ScopedLock<FastMutex> guard(registry.mutex);
+
+    for (int32 i = 0; i < entries.Count(); ++i) {
+      if (entries[i].cache == nullptr) {
+        continue;
+      }
+      ThreadCacheOwner** owner = registry.owners.Find(entries[i].serial);
+      if (owner) {
+        (*owner)->ReleaseThreadCache(entries[i].cache);
+      }
+    }
+  }
+};
+
+thread_local ThreadCacheTable thread_caches;
+
+}  // namespace
+
+ThreadCacheKey RegisterThreadCacheOwner(ThreadCacheOwner* owner) {
+  OwnerRegistry& registry = OwnerRegistry::Get();
+  ScopedLock<FastMutex> guard(registry.mutex);
+
+  ThreadCacheKey key;
+  if (registry.free_slots.Count() > 0) {
+    key.slot = registry.free_slots.Last();
+    registry.free_slots.RemoveAt(registry.free_slots.Count() - 1);
+  } else {
+    key.slot = registry.slot_count++;
+  }
+  key.serial = registry.next_serial++;
+  registry.owners.Add(key.serial, owner);
+  return key;
+}
+
+void UnregisterThreadCacheOwner(const ThreadCacheKey& key) {
+  OwnerRegistry& registry = OwnerRegistry::Get();
+  ScopedLock<FastMutex> guard(registry.mutex);
+
+  registry.owners.Remove(key.serial);
+  registry.free_slots.Add(key.slot);
+}
+
+void* FindThreadCache(const ThreadCacheKey& key) {
+  Array<ThreadCacheEntry>& entries = thread_caches.entries;
+  if (key.slot < entries.Count() && entries[key.slot].serial == key.serial) {
+    return entries[key.slot].cache;
+  }
+  return nullptr;
+}
+
+void SetThreadCache(const ThreadCacheKey& key, void* cache) {
+  Array<ThreadCacheEntry>& entries = thread_caches.entries;
+  if (entries.Count() <= key.slot) {
+    entries.AddZeroed(key.slot + 1 - entries.Count());
+  }
+  entries[key.slot].serial = key.serial;
+  entries[key.slot].cache = cache;
+}
+
+int32 GetNumaNodeCount() {
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  static const int32 node_count = []() {
+    // e.g. "0-3" or "0,2"; the highest node number is the last number.
+    int32 count = 1;
+    FILE* file = ::fopen("/sys/devices/system/node/online", "r");
+    if (file) {
+      char line[256];
+      if (::fgets(line, sizeof(line), file)) {
+        int32 last = -1;
+        int32 number = -1;
+        for (const char* p = line; *p; ++p) {
+          if (*p >= '0' && *p <= '9') {
+            number = (number < 0 ? 0 : number * 10) + (*p - '0');
+          } else {
+            if (number >= 0) {
+              last = number;
+            }
+            number = -1;
+          }
+        }
+        if (number >= 0) {
+          last = number;
+        }
+        count = MathBase::Max(1, last + 1);
+      }
+      ::fclose(file);
+    }
+    return count;
+  }();
+  return node_count;
+#else
+  return 1;
+#endif
+}
+
+int32 GetCurrentNumaNode() {
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+    return (int32)node;
+  }
+#endif
+  return 0;
+}
+
+}  // namespace pool
+}  // namespace internal
+
+using namespace internal::pool;
+
+namespace {
+
+// Slabs are at least this large.
+const size_t SLAB_SIZE = 64 * 1024;
+
+}  // namespace
+
+/**
+ * A free block in the depot. Blocks of a batch are chained through next;
+ * the first block of a batch is on the depot stack, and its
+ * rest_of_batch points to the second.
+ */
+struct CachingMemoryPool::FreeBlock {
+  FreeBlock* next;
+  FreeBlock* rest_of_batch;
+};
+
+struct alignas(FUN_PLATFORM_CACHE_LINE_SIZE) CachingMemoryPool::Magazine {
+  // Written by the owning thread only; read by AvailableCount().
+  std::atomic<int32> count;
+  int32 depot_index;
+  void* blocks[2 * BATCH_SIZE];
+};
+
+struct alignas(FUN_PLATFORM_CACHE_LINE_SIZE) CachingMemoryPool::Depot {
+  TaggedStack<FreeBlock> batches;
+  std::atomic<int32> block_count;
+};
+
+CachingMemoryPool::CachingMemoryPool(size_t block_size, int32 pre_alloc,
+                                     int32 max_alloc, bool numa_local)
+    : block_size_(block_size),
+      max_alloc_(max_alloc),
+      allocated_count_(0),
+      depots_(nullptr),
+      depot_count_(numa_local ? GetNumaNodeCount() : 1) {
+  fun_check(max_alloc == 0 || max_alloc >= pre_alloc);
+  fun_check(pre_alloc >= 0 && max_alloc >= 0);
+
+  // Room for the free list links; blocks of a cache line or more get
+  // lines of their own.
+  stride_ = MathBase::Max(block_size, sizeof(FreeBlock));
+  stride_ = stride_ >= FUN_PLATFORM_CACHE_LINE_SIZE
+                ? Align(stride_, FUN_PLATFORM_CACHE_LINE_SIZE)
+                : Align(stride_, 16);
+  slab_block_count_ =
+      MathBase::Max<int32>(2 * BATCH_SIZE, (int32)(SLAB_SIZE / stride_));
+
+  depots_ = static_cast<Depot*>(UnsafeMemory::Malloc(
+      sizeof(Depot) * depot_count_, alignof(Depot)));
+  for (int32 i = 0; i < depot_count_; ++i) {
+    new (&depots_[i]) Depot();
+    depots_[i].block_count = 0;
+  }
+
+  key_ = RegisterThreadCacheOwner(this);
+
+  if (pre_alloc > 0) {
+    Magazine* magazine = GetMagazine();
+    while (allocated_count_.load() < pre_alloc) {
+      // Grow() fills the magazine; move those to the depot as well.
+      Grow(magazine);
+      Flush(magazine, magazine->count.load(std::memory_order_relaxed));
+    }
+  }
+}
+
+CachingMemoryPool::~CachingMemoryPool() {
+  UnregisterThreadCacheOwner(key_);
+
+  for (int32 i = 0; i < slabs_.Count(); ++i) {
+    UnsafeMemory::Free(slabs_[i]);
+  }
+  for (int32 i = 0; i < magazines_.Count(); ++i) {
+    magazines_[i]->~Magazine();
+    UnsafeMemory::Free(magazines_[i]);
+  }
+  for (int32 i = 0; i < depot_count_; ++i) {
+    depots_[i].~Depot();
+  }
+  UnsafeMemory::Free(depots_);
+}
+
+void* CachingMemoryPool::Get() {
+  Magazine* magazine = GetMagazine();
+
+  int32 count = magazine->count.load(std::memory_order_relaxed);
+  if (count == 0) {
+    Refill(magazine);
+    count = magazine->count.load(std::memory_order_relaxed);
+  }
+  magazine->count.store(--count, std::memory_order_relaxed);
+  return magazine->blocks[count];
+}
+
+void CachingMemoryPool::Release(void* ptr) {
+  Magazine* magazine = GetMagazine();
+
+  int32 count = magazine->count.load(std::memory_order_relaxed);
+  if (count == 2 * BATCH_SIZE) {
+    Flush(magazine, BATCH_SIZE);
+    count -= BATCH_SIZE;
+  }
+  magazine->blocks[count] = ptr;
+  magazine->count.store(count + 1, std::memory_order_relaxed);
+}
+
+int32 CachingMemoryPool::AvailableCount() const {
+  int32 count = 0;
+  for (int32 i = 0; i < depot_count_; ++i) {
+    count += depots_[i].block_count.load(std::memory_order_relaxed);
+  }
+
+  ScopedLock<FastMutex> guard(mutex_);
+  for (int32 i = 0; i < magazines_.Count(); ++i) {
+    count += magazines_[i]->count.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+CachingMemoryPool::Magazine* CachingMemoryPool::GetMagazine() {
+  void* cache = FindThreadCache(key_);
+  return cache ? static_cast<Magazine*>(cache) : CreateMagazine();
+}
+
+CachingMemoryPool::Magazine* CachingMemoryPool::CreateMagazine() {
+  Magazine* magazine;
+  {
+    ScopedLock<FastMutex> guard(mutex_);
+
+    if (free_magazines_.Count() > 0) {
+      magazine = free_magazines_.Last();
+      free_magazines_.RemoveAt(free_magazines_.Count() - 1);
+    } else {
+      magazine = static_cast<Magazine*>(
+          UnsafeMemory::Malloc(sizeof(Magazine), alignof(Magazine)));
+      if (magazine == nullptr) {
+        throw OutOfMemoryException("cannot allocate pool magazine");
+      }
+      new (magazine) Magazine();
+      magazine->count = 0;
+      magazines_.Add(magazine);
+    }
+  }
+
+  magazine->depot_index = GetCurrentNumaNode() % depot_count_;
+  SetThreadCache(key_, magazine);
+  return magazine;
+}
+
+void CachingMemoryPool::Refill(Magazine* magazine) {
+  // The own depot first, then the others.
+  for (int32 i = 0; i < depot_count_; ++i) {
+    Depot& depot = depots_[(magazine->depot_index + i) % depot_count_];
+    FreeBlock* batch = depot.batches.Pop();
+    if (batch == nullptr) {
+      continue;
+    }
+
+    int32 count = 0;
+    magazine->blocks[count++] = batch;
+    for (FreeBlock* block = batch->rest_of_batch; block; block = block->next) {
+      magazine->blocks[count++] = block;
+    }
+    depot.block_count.fetch_sub(count, std::memory_order_relaxed);
+    magazine->count.store(count, std::memory_order_relaxed);
+    return;
+  }
+
+  if (!Grow(magazine)) {
+    throw OutOfMemoryException("MemoryPool exhausted");
+  }
+}
+
+void CachingMemoryPool::Flush(Magazine* magazine, int32 count) {
+  const int32 remaining = magazine->count.load(std::memory_order_relaxed);
+  fun_check(count <= remaining);
+
+  Depot& depot = depots_[magazine->depot_index];
+  for (int32 done = 0; done < count; done += BATCH_SIZE) {
+    const int32 batch_size = MathBase::Min(BATCH_SIZE, count - done);
+    PushBatch(depot, magazine->blocks + remaining - done - batch_size,
+              batch_size);
+  }
+  magazine->count.store(remaining - count, std::memory_order_relaxed);
+}
+
+void CachingMemoryPool::PushBatch(Depot& depot, void** blocks, int32 count) {
+  FreeBlock* batch = static_cast<FreeBlock*>(blocks[0]);
+  FreeBlock* rest = nullptr;
+  for (int32 i = count - 1; i >= 1; --i) {
+    FreeBlock* block = static_cast<FreeBlock*>(blocks[i]);
+    block->next = rest;
+    rest = block;
+  }
+  batch->rest_of_batch = rest;
+
+  depot.block_count.fetch_add(count, std::memory_order_relaxed);
+  depot.batches.Push(batch);
+}
+
+bool CachingMemoryPool::Grow(Magazine* magazine) {
+  int32 block_count = slab_block_count_;
+  if (max_alloc_ > 0) {
+    // Reserve the blocks, so that concurrent growth stays within max_alloc.
+    int32 allocated = allocated_count_.load();
+    do {
+      block_count = MathBase::Min(slab_block_count_, max_alloc_ - allocated);
+      if (block_count <= 0) {
+        return false;
+      }
+    } while (!allocated_count_.compare_exchange_weak(allocated,
+                                                     allocated + block_count));
+  } else {
+    allocated_count_.fetch_add(block_count);
+  }
+
+  char* slab = static_cast<char*>(UnsafeMemory::Malloc(
+      stride_ * block_count, FUN_PLATFORM_CACHE_LINE_SIZE));
+  if (slab == nullptr) {
+    allocated_count_.fetch_sub(block_count);
+    throw OutOfMemoryException("cannot allocate pool slab");
+  }
+  {
+    ScopedLock<FastMutex> guard(mutex_);
+    slabs_.Add(slab);
+  }
+
+  // Touched by this thread first, so that its pages are placed on this
+  // thread's node. One batch goes to the magazine, the rest to the depot.
+  Depot& depot = depots_[magazine->depot_index];
+  void* blocks[BATCH_SIZE];
+  int32 index = 0;
+  while (index < block_count) {
+    const int32 batch_size = MathBase::Min(BATCH_SIZE, block_count - index);
+    for (int32 i = 0; i < batch_size; ++i) {
+      blocks[i] = slab + (size_t)(index + i) * stride_;
+    }
+    index += batch_size;
+    if (index < block_count) {
+      PushBatch(depot, blocks, batch_size);
+    } else {
+      const int32 count = magazine->count.load(std::memory_order_relaxed);
+      for (int32 i = 0; i < batch_size; ++i) {
+        magazine->blocks[count + i] = blocks[i];
+      }
+      magazine->count.store(count + batch_size, std::memory_order_relaxed);
+    }
+  }
+  return true;
+}
+
+void CachingMemoryPool::ReleaseThreadCache(void* cache) {
+  Magazine* magazine = static_cast<Magazine*>(cache);
+  Flush(magazine, magazine->count.load(std::memory_order_relaxed));
+
+  ScopedLock<FastMutex> guard(mutex_);
+  free_magazines_.Add(magazine);
+}
+
+}  // namespace fun
@@ -0,0 +1,227 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/mutex.h"
+
+#include <atomic>
+
+namespace fun {
+
+namespace internal {
+namespace pool {
+
+// Number of blocks or objects moved between a thread cache and the depot
+// at a time. A thread cache holds up to twice as many.
+const int32 BATCH_SIZE = 32;
+
+/**
+ * Treiber stack of nodes with a `next` member. The top 16 bits of the
+ * head word hold a version tag against ABA, which assumes user-space
+ * addresses fit in 48 bits (true on x86-64 and on arm64 with the default
+ * 48-bit address space).
+ *
+ * Popped nodes may still be read by a concurrent Pop() that lost the
+ * race, so nodes must stay mapped while the stack is in use.
+ */
+template <typename Node>
+class TaggedStack {
+ public:
+  TaggedStack() : head_(0) {}
+
+  void Push(Node* node) {
+    uint64 old_head = head_.load(std::memory_order_relaxed);
+    uint64 new_head;
+    do {
+      node->next = ToNode(old_head);
+      new_head = Pack(node, old_head);
+    } while (!head_.compare_exchange_weak(old_head, new_head,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  Node* Pop() {
+    uint64 old_head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      Node* node = ToNode(old_head);
+      if (node == nullptr) {
+        return nullptr;
+      }
+      // May read a node that another thread has already popped; the tag
+      // then makes the exchange fail.
+      Node* next = *static_cast<Node* volatile*>(&node->next);
+      if (head_.compare_exchange_weak(old_head, Pack(next, old_head),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return node;
+      }
+    }
+  }
+
+  bool IsEmpty() const {
+    return ToNode(head_.load(std::memory_order_relaxed)) == nullptr;
+  }
+
+ private:
+  static const uint64 POINTER_MASK = (uint64(1) << 48) - 1;
+
+  static Node* ToNode(uint64 head) {
+    return reinterpret_cast<Node*>(static_cast<UPTRINT>(head & POINTER_MASK));
+  }
+
+  static uint64 Pack(Node* node, uint64 old_head) {
+    return (reinterpret_cast<UPTRINT>(node) & POINTER_MASK) |
+           ((old_head & ~POINTER_MASK) + (uint64(1) << 48));
+  }
+
+  std::atomic<uint64> head_;
+};
+
+/**
+ * Owner of per-thread caches, e.g. a pool.
+ */
+class FUN_BASE_API ThreadCacheOwner {
+ public:
+  virtual ~ThreadCacheOwner() {}
+
+  /**
+   * Called when a thread that has a cache of this owner exits, on that
+   * thread. The owner cannot be destroyed during the call.
+   */
+  virtual void ReleaseThreadCache(void* cache) = 0;
+};
+
+/**
+ * Identifies an owner in the per-thread cache tables. Slots are reused
+ * after an owner is unregistered; serials never are, so a stale entry of
+ * a destroyed owner is never mistaken for a cache of a new one.
+ */
+struct ThreadCacheKey {
+  int32 slot;
+  uint64 serial;
+};
+
+FUN_BASE_API ThreadCacheKey RegisterThreadCacheOwner(ThreadCacheOwner* owner);
+
+/**
+ * After this returns, ReleaseThreadCache() is not called for the owner
+ * any more.
+ */
+FUN_BASE_API void UnregisterThreadCacheOwner(const ThreadCacheKey& key);
+
+/**
+ * Returns the calling thread's cache for key, or nullptr.
+ */
+FUN_BASE_API void* FindThreadCache(const ThreadCacheKey& key);
+
+FUN_BASE_API void SetThreadCache(const ThreadCacheKey& key, void* cache);
+
+/**
+ * Number of NUMA nodes of the host, 1 where unknown.
+ */
+FUN_BASE_API int32 GetNumaNodeCount();
+
+/**
+ * NUMA node of the CPU the calling thread runs on, 0 where unknown.
+ */
+FUN_BASE_API int32 GetCurrentNumaNode();
+
+}  // namespace pool
+}  // namespace internal
+
+/**
+ * A pool for fixed-size memory blocks with the interface of MemoryPool,
+ * for pools that many threads use concurrently.
+ *
+ * Every thread keeps a small cache ("magazine") of free blocks, so Get()
+ * and Release() usually touch no shared state at all. Magazines are
+ * refilled from and flushed to a shared depot in batches of
+ * internal::pool::BATCH_SIZE blocks through a lock-free stack; a lock is
+ * taken only when the pool grows.
+ *
+ * Blocks are carved from large cache-line aligned slabs, so they are
+ * contiguous; blocks of a cache line or more start on a cache line of
+ * their own so that blocks used by different threads never share one.
+ *
+ * With numa_local, there is a depot per NUMA node; threads use the depot
+ * of the node they first ran the pool on, and new slabs are first touched
+ * by that thread so that the kernel places them on its node.
+ *
+ * Differences to MemoryPool: up to 2 * BATCH_SIZE free blocks per thread
+ * are invisible to other threads, so with max_alloc a Get() may throw
+ * while other threads still cache free blocks; and the counts are
+ * approximate while other threads use the pool. A block may be released
+ * by another thread than the one that got it.
+ */
+class FUN_BASE_API CachingMemoryPool
+    : private internal::pool::ThreadCacheOwner {
+ public:
+  /**
+   * Creates a pool for blocks with the given block_size. The number of
+   * blocks given in pre_alloc are preallocated.
+   */
+  CachingMemoryPool(size_t block_size, int32 pre_alloc = 0,
+                    int32 max_alloc = 0, bool numa_local = false);
+  ~CachingMemoryPool();
+
+  CachingMemoryPool(const CachingMemoryPool&) = delete;
+  CachingMemoryPool& operator=(const CachingMemoryPool&) = delete;
+
+  /**
+   * Returns a memory block. If max_alloc blocks are already allocated
+   * and none is free, an OutOfMemoryException is thrown.
+   */
+  void* Get();
+
+  /**
+   * Releases a memory block and returns it to the pool.
+   */
+  void Release(void* ptr);
+
+  size_t GetBlockSize() const { return block_size_; }
+
+  /**
+   * Returns the number of allocated blocks.
+   */
+  int32 AllocatedCount() const { return allocated_count_.load(); }
+
+  /**
+   * Returns the number of free blocks, in the depot and in the thread
+   * caches.
+   */
+  int32 AvailableCount() const;
+
+ private:
+  struct FreeBlock;
+  struct Magazine;
+  struct Depot;
+
+  Magazine* GetMagazine();
+  Magazine* CreateMagazine();
+  void Refill(Magazine* magazine);
+  void Flush(Magazine* magazine, int32 count);
+  bool Grow(Magazine* magazine);
+  void PushBatch(Depot& depot, void** blocks, int32 count);
+
+  void ReleaseThreadCache(void* cache) override;
+
+  size_t block_size_;
+  size_t stride_;
+  int32 slab_block_count_;
+  int32 max_alloc_;
+  std::atomic<int32> allocated_count_;
+
+  Depot* depots_;
+  int32 depot_count_;
+
+  internal::pool::ThreadCacheKey key_;
+
+  // Guards the lists below; taken only when the pool grows or a thread
+  // first uses the pool.
+  mutable FastMutex mutex_;
+  Array<void*> slabs_;
+  Array<Magazine*> magazines_;
+  Array<Magazine*> free_magazines_;
+};
+
+}  // namespace fun
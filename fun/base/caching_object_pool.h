@@ -0,0 +1,389 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/caching_memory_pool.h"
+#include "fun/base/condition.h"
+#include "fun/base/container/array.h"
+#include "fun/base/mutex.h"
+#include "fun/base/object_pool.h"
+
+#include <atomic>
+
+namespace fun {
+
+/**
+ * An object pool with the interface and policies of ObjectPool, for pools
+ * that many threads borrow from and return to concurrently.
+ *
+ * Like CachingMemoryPool, every thread keeps a small cache of idle
+ * objects, and moves them to and from a shared lock-free depot in batches.
+ * Each thread cache has its own lock, which only its thread takes unless
+ * the peak capacity has been reached: a borrower then takes idle objects
+ * out of the caches of other threads before it fails or waits, so an
+ * object is never out of reach while it is idle.
+ *
+ * The capacity is kept exactly: an object that is returned while
+ * capacity objects are idle (in the depot or in thread caches) is
+ * destroyed. Thread caches hold at most a sixteenth of the capacity each,
+ * so a small pool is shared mostly through the depot. While a borrower
+ * waits, returned objects go to the depot directly.
+ *
+ * Unlike with ObjectPool, the factory is called without a lock held and
+ * must be thread-safe.
+ */
+template <typename C, typename P = C*, typename F = PoolableObjectFactory<C, P>>
+class CachingObjectPool : private internal::pool::ThreadCacheOwner {
+ public:
+  CachingObjectPool(size_t capacity, size_t peak_capacity)
+      : capacity_(capacity), peak_capacity_(peak_capacity) {
+    Init();
+  }
+
+  CachingObjectPool(const F& factory, size_t capacity, size_t peak_capacity)
+      : factory_(factory), capacity_(capacity), peak_capacity_(peak_capacity) {
+    Init();
+  }
+
+  ~CachingObjectPool() {
+    internal::pool::UnregisterThreadCacheOwner(key_);
+
+    try {
+      while (Batch* batch = depot_.Pop()) {
+        for (int32 i = 0; i < batch->count; ++i) {
+          factory_.DestroyObject(batch->objects[i]);
+        }
+      }
+      for (int32 i = 0; i < magazines_.Count(); ++i) {
+        Magazine* magazine = magazines_[i];
+        for (int32 j = 0; j < magazine->count; ++j) {
+          factory_.DestroyObject(magazine->objects[j]);
+        }
+      }
+    } catch (...) {
+      fun_unexpected();
+    }
+
+    for (int32 i = 0; i < magazines_.Count(); ++i) {
+      delete magazines_[i];
+    }
+    for (int32 i = 0; i < batches_.Count(); ++i) {
+      delete batches_[i];
+    }
+  }
+
+  // Disable default constructor and copy.
+  CachingObjectPool() = delete;
+  CachingObjectPool(const CachingObjectPool&) = delete;
+  CachingObjectPool& operator=(const CachingObjectPool&) = delete;
+
+  P BorrowObject(long timeout_msecs = 0) {
+    Magazine* magazine = GetMagazine();
+
+    P object;
+    if (TakeCached(magazine, object)) {
+      return ActivateObject(object);
+    }
+
+    if (TryBorrow(magazine, object)) {
+      return object;
+    }
+
+    if (timeout_msecs == 0) {
+      return nullptr;
+    }
+
+    ScopedLock<FastMutex> guard(wait_mutex_);
+    waiter_count_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool borrowed;
+    try {
+      while (!(borrowed = TryBorrow(magazine, object))) {
+        if (!available_cond_.TryWait(wait_mutex_, (int32)timeout_msecs)) {
+          // timeout
+          break;
+        }
+      }
+    } catch (...) {
+      waiter_count_.fetch_sub(1);
+      throw;
+    }
+    waiter_count_.fetch_sub(1);
+    return borrowed ? object : P();
+  }
+
+  void ReturnObject(P object) {
+    if (factory_.ValidateObject(object)) {
+      factory_.DeactivateObject(object);
+
+      if (idle_count_.fetch_add(1, std::memory_order_relaxed) <
+          (int32)capacity_) {
+        if (waiter_count_.load(std::memory_order_relaxed) == 0) {
+          Magazine* magazine = GetMagazine();
+          if (batch_size_ > 0) {
+            bool flushed = false;
+            {
+              ScopedLock<FastMutex> guard(magazine->mutex);
+              if (magazine->count >= 2 * batch_size_) {
+                Flush(magazine, batch_size_);
+                flushed = true;
+              }
+              magazine->objects[magazine->count++] = object;
+              // A waiter may have arrived in between; it must not miss the
+              // object.
+              std::atomic_thread_fence(std::memory_order_seq_cst);
+              if (waiter_count_.load(std::memory_order_relaxed) > 0) {
+                Flush(magazine, magazine->count);
+                flushed = true;
+              }
+            }
+            if (flushed) {
+              NotifyWaiter();
+            }
+            return;
+          }
+        }
+
+        Batch* batch = GetEmptyBatch();
+        batch->objects[0] = object;
+        batch->count = 1;
+        depot_.Push(batch);
+        NotifyWaiter();
+        return;
+      }
+      idle_count_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    factory_.DestroyObject(object);
+    used_count_.fetch_sub(1);
+    NotifyWaiter();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  size_t PeakCapacity() const { return peak_capacity_; }
+
+  size_t UsedCount() const { return used_count_.load(); }
+
+  size_t AvailableCount() const {
+    return idle_count_.load() + peak_capacity_ - used_count_.load();
+  }
+
+ protected:
+  P ActivateObject(P object) {
+    try {
+      factory_.ActivateObject(object);
+    } catch (...) {
+      factory_.DestroyObject(object);
+      used_count_.fetch_sub(1);
+      throw;
+    }
+    return object;
+  }
+
+ private:
+  struct Magazine {
+    // Taken by the owning thread, and tried by borrowers that found the
+    // depot empty at peak capacity.
+    FastMutex mutex;
+    int32 count;
+    P objects[2 * internal::pool::BATCH_SIZE];
+  };
+
+  struct Batch {
+    Batch* next;
+    int32 count;
+    P objects[internal::pool::BATCH_SIZE];
+  };
+
+  void Init() {
+    fun_check(capacity_ <= peak_capacity_);
+
+    batch_size_ = MathBase::Min<int32>(internal::pool::BATCH_SIZE,
+                                       (int32)(capacity_ / 16));
+    used_count_ = 0;
+    idle_count_ = 0;
+    waiter_count_ = 0;
+    key_ = internal::pool::RegisterThreadCacheOwner(this);
+  }
+
+  /**
+   * Takes the most recently returned object of the thread cache, which is
+   * the most likely to still be in the CPU cache.
+   */
+  bool TakeCached(Magazine* magazine, P& object) {
+    ScopedLock<FastMutex> guard(magazine->mutex);
+    if (magazine->count == 0) {
+      return false;
+    }
+    object = magazine->objects[--magazine->count];
+    magazine->objects[magazine->count] = P();
+    idle_count_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * Takes an object from the depot, or creates one if the peak capacity
+   * allows, or else takes one from the cache of another thread.
+   */
+  bool TryBorrow(Magazine* magazine, P& object) {
+    if (Batch* batch = depot_.Pop()) {
+      object = batch->objects[--batch->count];
+      batch->objects[batch->count] = P();
+      {
+        // The rest of the batch refills the (empty) thread cache.
+        ScopedLock<FastMutex> guard(magazine->mutex);
+        for (int32 i = 0; i < batch->count; ++i) {
+          magazine->objects[magazine->count++] = batch->objects[i];
+          batch->objects[i] = P();
+        }
+      }
+      batch->count = 0;
+      empty_batches_.Push(batch);
+
+      idle_count_.fetch_sub(1, std::memory_order_relaxed);
+      object = ActivateObject(object);
+      return true;
+    }
+
+    size_t used_count = used_count_.load();
+    do {
+      if (used_count >= peak_capacity_) {
+        if (!Steal(magazine, object)) {
+          return false;
+        }
+        object = ActivateObject(object);
+        return true;
+      }
+    } while (!used_count_.compare_exchange_weak(used_count, used_count + 1));
+
+    try {
+      object = factory_.CreateObject();
+    } catch (...) {
+      used_count_.fetch_sub(1);
+      throw;
+    }
+    object = ActivateObject(object);
+    return true;
+  }
+
+  /**
+   * Takes an idle object from the cache of another thread. Caches that are
+   * in use right now are skipped.
+   */
+  bool Steal(Magazine* magazine, P& object) {
+    ScopedLock<FastMutex> guard(mutex_);
+    for (int32 i = 0; i < magazines_.Count(); ++i) {
+      Magazine* other = magazines_[i];
+      if (other == magazine || !other->mutex.TryLock()) {
+        continue;
+      }
+      const bool found = other->count > 0;
+      if (found) {
+        object = other->objects[--other->count];
+        other->objects[other->count] = P();
+        idle_count_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      other->mutex.Unlock();
+      if (found) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Moves count objects of the thread cache to the depot. The cache must be
+   * locked.
+   */
+  void Flush(Magazine* magazine, int32 count) {
+    while (count > 0) {
+      Batch* batch = GetEmptyBatch();
+      batch->count = MathBase::Min(count, internal::pool::BATCH_SIZE);
+      for (int32 i = 0; i < batch->count; ++i) {
+        P& object = magazine->objects[--magazine->count];
+        batch->objects[i] = object;
+        object = P();
+      }
+      count -= batch->count;
+      depot_.Push(batch);
+    }
+  }
+
+  Batch* GetEmptyBatch() {
+    Batch* batch = empty_batches_.Pop();
+    if (batch == nullptr) {
+      batch = new Batch();
+      ScopedLock<FastMutex> guard(mutex_);
+      batches_.Add(batch);
+    }
+    return batch;
+  }
+
+  void NotifyWaiter() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiter_count_.load(std::memory_order_relaxed) > 0) {
+      ScopedLock<FastMutex> guard(wait_mutex_);
+      available_cond_.NotifyOne();
+    }
+  }
+
+  Magazine* GetMagazine() {
+    void* cache = internal::pool::FindThreadCache(key_);
+    if (cache) {
+      return static_cast<Magazine*>(cache);
+    }
+
+    Magazine* magazine;
+    {
+      ScopedLock<FastMutex> guard(mutex_);
+
+      if (free_magazines_.Count() > 0) {
+        magazine = free_magazines_.Last();
+        free_magazines_.PopBack();
+      } else {
+        magazine = new Magazine();
+        magazine->count = 0;
+        magazines_.Add(magazine);
+      }
+    }
+    internal::pool::SetThreadCache(key_, magazine);
+    return magazine;
+  }
+
+  void ReleaseThreadCache(void* cache) override {
+    Magazine* magazine = static_cast<Magazine*>(cache);
+    {
+      ScopedLock<FastMutex> guard(magazine->mutex);
+      Flush(magazine, magazine->count);
+    }
+    NotifyWaiter();
+
+    ScopedLock<FastMutex> guard(mutex_);
+    free_magazines_.Add(magazine);
+  }
+
+  F factory_;
+  size_t capacity_;
+  size_t peak_capacity_;
+  int32 batch_size_;
+
+  std::atomic<size_t> used_count_;
+  // Objects in the depot and in thread caches.
+  std::atomic<int32> idle_count_;
+  std::atomic<int32> waiter_count_;
+
+  internal::pool::TaggedStack<Batch> depot_;
+  internal::pool::TaggedStack<Batch> empty_batches_;
+  internal::pool::ThreadCacheKey key_;
+
+  // Guards the lists below; batches and magazines are kept until the pool
+  // is destroyed.
+  FastMutex mutex_;
+  Array<Batch*> batches_;
+  Array<Magazine*> magazines_;
+  Array<Magazine*> free_magazines_;
+
+  FastMutex wait_mutex_;
+  Condition available_cond_;
+};
+
+}  // namespace fun
@@ -0,0 +1,285 @@
+﻿#pragma once
+
+#include <initializer_list>
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/flat_hash_table.h"
+#include "fun/base/container/map.h"
+
+namespace fun {
+
+namespace internal {
+namespace flat_hash {
+
+template <typename K, typename V>
+struct MapTraits {
+  typedef TPair<K, V> ElementType;
+  typedef K KeyType;
+
+  static FUN_ALWAYS_INLINE const K& GetKey(const ElementType& element) {
+    return element.key;
+  }
+};
+
+}  // namespace flat_hash
+}  // namespace internal
+
+/**
+ * Unordered map stored in one flat, open addressed table (a Swiss table).
+ * See FlatHashSet for how it differs from Map.
+ *
+ * Pairs are stored in place, so keep large values behind a pointer: they
+ * are moved whenever the table grows, and the empty slots of the table
+ * cost sizeof(TPair<K, V>) each.
+ *
+ * Lookups take any type that KeyFuncs can hash and compare against K, so
+ * a FlatHashMap<String, V> can be searched with a StringView or a
+ * const char* without creating a String.
+ */
+template <typename K, typename V, typename KeyFuncs = FlatHashKeyFuncs<K>>
+class FlatHashMap {
+  typedef internal::flat_hash::FlatHashTable<internal::flat_hash::MapTraits<K, V>,
+                                             KeyFuncs>
+      TableType;
+
+ public:
+  typedef K KeyType;
+  typedef V ValueType;
+  typedef TPair<K, V> ElementType;
+
+  FlatHashMap() {}
+
+  FlatHashMap(std::initializer_list<TPair<K, V>> list) {
+    Reserve((int32)list.size());
+    for (const TPair<K, V>& pair : list) {
+      Add(pair.key, pair.value);
+    }
+  }
+
+  FUN_ALWAYS_INLINE int32 Count() const { return table_.Count(); }
+
+  FUN_ALWAYS_INLINE bool IsEmpty() const { return table_.Count() == 0; }
+
+  /**
+   * Sets the value associated with a key, adding the key if needed.
+   *
+   * \return The value in the map.
+   */
+  template <typename KeyArgType, typename ValueArgType>
+  V& Add(KeyArgType&& key, ValueArgType&& value) {
+    bool inserted;
+    const int32 index = table_.FindOrPrepareInsert(key, inserted);
+    ElementType& pair = table_.GetSlot(index);
+    if (inserted) {
+      new (&pair) ElementType(PairInitializer<KeyArgType&&, ValueArgType&&>(
+          Forward<KeyArgType>(key), Forward<ValueArgType>(value)));
+    } else {
+      pair.value = Forward<ValueArgType>(value);
+    }
+    return pair.value;
+  }
+
+  /**
+   * Returns the value associated with a key, adding the key with a default
+   * constructed value if it is not in the map.
+   */
+  template <typename KeyArgType>
+  V& FindOrAdd(KeyArgType&& key) {
+    bool inserted;
+    const int32 index = table_.FindOrPrepareInsert(key, inserted);
+    ElementType& pair = table_.GetSlot(index);
+    if (inserted) {
+      new (&pair)
+          ElementType(KeyInitializer<KeyArgType&&>(Forward<KeyArgType>(key)));
+    }
+    return pair.value;
+  }
+
+  template <typename KeyArgType>
+  FUN_ALWAYS_INLINE bool Contains(const KeyArgType& key) const {
+    return table_.Find(key) != INVALID_INDEX;
+  }
+
+  /**
+   * Returns the value associated with a key, or nullptr.
+   */
+  template <typename KeyArgType>
+  FUN_ALWAYS_INLINE V* Find(const KeyArgType& key) {
+    const int32 index = table_.Find(key);
+    return index != INVALID_INDEX ? &table_.GetSlot(index).value : nullptr;
+  }
+
+  template <typename KeyArgType>
+  FUN_ALWAYS_INLINE const V* Find(const KeyArgType& key) const {
+    const int32 index = table_.Find(key);
+    return index != INVALID_INDEX ? &table_.GetSlot(index).value : nullptr;
+  }
+
+  /**
+   * Returns a copy of the value associated with a key, or a default
+   * constructed value.
+   */
+  template <typename KeyArgType>
+  FUN_ALWAYS_INLINE V FindRef(const KeyArgType& key) const {
+    const int32 index = table_.Find(key);
+    return index != INVALID_INDEX ? table_.GetSlot(index).value : V();
+  }
+
+  /**
+   * Removes the pair with the given key.
+   *
+   * \return The number of pairs removed, 0 or 1.
+   */
+  template <typename KeyArgType>
+  int32 Remove(const KeyArgType& key) {
+    const int32 index = table_.Find(key);
+    if (index == INVALID_INDEX) {
+      return 0;
+    }
+    table_.EraseAt(index);
+    return 1;
+  }
+
+  /**
+   * Removes the pair with the given key and moves its value to out_value.
+   *
+   * \return True if the key was in the map.
+   */
+  template <typename KeyArgType>
+  bool RemoveAndCopyValue(const KeyArgType& key, V& out_value) {
+    const int32 index = table_.Find(key);
+    if (index == INVALID_INDEX) {
+      return false;
+    }
+    out_value = MoveTemp(table_.GetSlot(index).value);
+    table_.EraseAt(index);
+    return true;
+  }
+
+  /**
+   * Makes room for count pairs, so adding up to that many does not rehash.
+   */
+  void Reserve(int32 count) { table_.Reserve(count); }
+
+  /**
+   * Removes all pairs, keeping the table for reuse.
+   */
+  void Clear() { table_.Clear(); }
+
+  /**
+   * Removes all pairs and frees the table.
+   */
+  void Reset() { table_.Reset(); }
+
+  uint32 GetAllocatedSize() const { return table_.GetAllocatedSize(); }
+
+  void GenerateKeyArray(Array<K>& out_keys) const {
+    out_keys.Reset();
+    out_keys.Reserve(Count());
+    for (const ElementType& pair : *this) {
+      out_keys.Add(pair.key);
+    }
+  }
+
+  void GenerateValueArray(Array<V>& out_values) const {
+    out_values.Reset();
+    out_values.Reserve(Count());
+    for (const ElementType& pair : *this) {
+      out_values.Add(pair.value);
+    }
+  }
+
+  template <bool IsConst>
+  class BaseIterator {
+   public:
+    typedef typename Conditional<IsConst, const TableType, TableType>::Type
+        TableRefType;
+    typedef typename Conditional<IsConst, const ElementType, ElementType>::Type
+        ItElementType;
+
+    FUN_ALWAYS_INLINE BaseIterator(TableRefType& table, int32 index)
+        : table_(&table), index_(table.FindNextFull(index)) {}
+
+    FUN_ALWAYS_INLINE BaseIterator& operator++() {
+      index_ = table_->FindNextFull(index_ + 1);
+      return *this;
+    }
+
+    FUN_ALWAYS_INLINE explicit operator bool() const {
+      return index_ < table_->GetCapacity();
+    }
+
+    FUN_ALWAYS_INLINE bool operator!() const { return !(bool)*this; }
+
+    FUN_ALWAYS_INLINE const K& Key() const { return table_->GetSlot(index_).key; }
+
+    FUN_ALWAYS_INLINE typename Conditional<IsConst, const V, V>::Type& Value()
+        const {
+      return table_->GetSlot(index_).value;
+    }
+
+    FUN_ALWAYS_INLINE ItElementType& operator*() const {
+      return table_->GetSlot(index_);
+    }
+
+    FUN_ALWAYS_INLINE ItElementType* operator->() const {
+      return &table_->GetSlot(index_);
+    }
+
+    FUN_ALWAYS_INLINE friend bool operator==(const BaseIterator& lhs,
+                                             const BaseIterator& rhs) {
+      return lhs.index_ == rhs.index_;
+    }
+
+    FUN_ALWAYS_INLINE friend bool operator!=(const BaseIterator& lhs,
+                                             const BaseIterator& rhs) {
+      return lhs.index_ != rhs.index_;
+    }
+
+   protected:
+    TableRefType* table_;
+    int32 index_;
+  };
+
+  class ConstIterator : public BaseIterator<true> {
+   public:
+    FUN_ALWAYS_INLINE ConstIterator(const FlatHashMap& map, int32 index = 0)
+        : BaseIterator<true>(map.table_, index) {}
+  };
+
+  class Iterator : public BaseIterator<false> {
+   public:
+    FUN_ALWAYS_INLINE Iterator(FlatHashMap& map, int32 index = 0)
+        : BaseIterator<false>(map.table_, index) {}
+
+    /**
+     * Removes the current pair. The iterator stays valid and may be
+     * advanced to the next pair.
+     */
+    FUN_ALWAYS_INLINE void RemoveCurrent() {
+      this->table_->EraseAt(this->index_);
+    }
+  };
+
+  FUN_ALWAYS_INLINE Iterator CreateIterator() { return Iterator(*this); }
+
+  FUN_ALWAYS_INLINE ConstIterator CreateConstIterator() const {
+    return ConstIterator(*this);
+  }
+
+  // Range-for support. Do not use directly.
+  FUN_ALWAYS_INLINE Iterator begin() { return Iterator(*this); }
+  FUN_ALWAYS_INLINE ConstIterator begin() const { return ConstIterator(*this); }
+  FUN_ALWAYS_INLINE Iterator end() {
+    return Iterator(*this, table_.GetCapacity());
+  }
+  FUN_ALWAYS_INLINE ConstIterator end() const {
+    return ConstIterator(*this, table_.GetCapacity());
+  }
+
+ private:
+  TableType table_;
+};
+
+}  // namespace fun
@@ -0,0 +1,232 @@
+﻿#pragma once
+
+#include <initializer_list>
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/flat_hash_table.h"
+
+namespace fun {
+
+namespace internal {
+namespace flat_hash {
+
+template <typename T>
+struct SetTraits {
+  typedef T ElementType;
+  typedef T KeyType;
+
+  static FUN_ALWAYS_INLINE const T& GetKey(const T& element) { return element; }
+};
+
+}  // namespace flat_hash
+}  // namespace internal
+
+/**
+ * Unordered set stored in one flat, open addressed table (a Swiss table).
+ *
+ * Faster than Set for lookups, inserts and erases, especially misses, and
+ * without a per-element index or hash chain, at the cost of:
+ *
+ * - no stable element order and no sparse array, so there are no
+ *   persistent element ids;
+ * - elements move when the table grows, so pointers to elements are only
+ *   valid until the next Add();
+ * - up to 1/8 of the slots are always left unused.
+ *
+ * Lookups take any type that KeyFuncs can hash and compare against T, so
+ * a FlatHashSet<String> can be searched with a StringView.
+ */
+template <typename T, typename KeyFuncs = FlatHashKeyFuncs<T>>
+class FlatHashSet {
+  typedef internal::flat_hash::FlatHashTable<internal::flat_hash::SetTraits<T>,
+                                             KeyFuncs>
+      TableType;
+
+ public:
+  typedef T ElementType;
+
+  class Iterator;
+  class ConstIterator;
+
+  FlatHashSet() {}
+
+  FlatHashSet(std::initializer_list<T> list) {
+    Reserve((int32)list.size());
+    for (const T& element : list) {
+      Add(element);
+    }
+  }
+
+  FUN_ALWAYS_INLINE int32 Count() const { return table_.Count(); }
+
+  FUN_ALWAYS_INLINE bool IsEmpty() const { return table_.Count() == 0; }
+
+  /**
+   * Adds an element unless an equal one is already in the set.
+   *
+   * \param out_already_in_set - set to true if the element was already in
+   * the set.
+   *
+   * \return The element in the set.
+   */
+  template <typename ArgType>
+  T& Add(ArgType&& element, bool* out_already_in_set = nullptr) {
+    bool inserted;
+    const int32 index = table_.FindOrPrepareInsert(element, inserted);
+    if (inserted) {
+      new (&table_.GetSlot(index)) T(Forward<ArgType>(element));
+    }
+    if (out_already_in_set) {
+      *out_already_in_set = !inserted;
+    }
+    return table_.GetSlot(index);
+  }
+
+  template <typename K>
+  FUN_ALWAYS_INLINE bool Contains(const K& key) const {
+    return table_.Find(key) != INVALID_INDEX;
+  }
+
+  /**
+   * Returns the element equal to key, or nullptr.
+   */
+  template <typename K>
+  FUN_ALWAYS_INLINE T* Find(const K& key) {
+    const int32 index = table_.Find(key);
+    return index != INVALID_INDEX ? &table_.GetSlot(index) : nullptr;
+  }
+
+  template <typename K>
+  FUN_ALWAYS_INLINE const T* Find(const K& key) const {
+    const int32 index = table_.Find(key);
+    return index != INVALID_INDEX ? &table_.GetSlot(index) : nullptr;
+  }
+
+  /**
+   * Removes the element equal to key.
+   *
+   * \return The number of elements removed, 0 or 1.
+   */
+  template <typename K>
+  int32 Remove(const K& key) {
+    const int32 index = table_.Find(key);
+    if (index == INVALID_INDEX) {
+      return 0;
+    }
+    table_.EraseAt(index);
+    return 1;
+  }
+
+  /**
+   * Makes room for count elements, so adding up to that many does not
+   * rehash.
+   */
+  void Reserve(int32 count) { table_.Reserve(count); }
+
+  /**
+   * Removes all elements, keeping the table for reuse.
+   */
+  void Clear() { table_.Clear(); }
+
+  /**
+   * Removes all elements and frees the table.
+   */
+  void Reset() { table_.Reset(); }
+
+  uint32 GetAllocatedSize() const { return table_.GetAllocatedSize(); }
+
+  Array<T> ToArray() const {
+    Array<T> result;
+    result.Reserve(Count());
+    for (const T& element : *this) {
+      result.Add(element);
+    }
+    return result;
+  }
+
+  template <bool IsConst>
+  class BaseIterator {
+   public:
+    typedef typename Conditional<IsConst, const TableType, TableType>::Type
+        TableRefType;
+    typedef typename Conditional<IsConst, const T, T>::Type ItElementType;
+
+    FUN_ALWAYS_INLINE BaseIterator(TableRefType& table, int32 index)
+        : table_(&table), index_(table.FindNextFull(index)) {}
+
+    FUN_ALWAYS_INLINE BaseIterator& operator++() {
+      index_ = table_->FindNextFull(index_ + 1);
+      return *this;
+    }
+
+    FUN_ALWAYS_INLINE explicit operator bool() const {
+      return index_ < table_->GetCapacity();
+    }
+
+    FUN_ALWAYS_INLINE bool operator!() const { return !(bool)*this; }
+
+    FUN_ALWAYS_INLINE ItElementType& operator*() const {
+      return table_->GetSlot(index_);
+    }
+
+    FUN_ALWAYS_INLINE ItElementType* operator->() const {
+      return &table_->GetSlot(index_);
+    }
+
+    FUN_ALWAYS_INLINE friend bool operator==(const BaseIterator& lhs,
+                                             const BaseIterator& rhs) {
+      return lhs.index_ == rhs.index_;
+    }
+
+    FUN_ALWAYS_INLINE friend bool operator!=(const BaseIterator& lhs,
+                                             const BaseIterator& rhs) {
+      return lhs.index_ != rhs.index_;
+    }
+
+   protected:
+    TableRefType* table_;
+    int32 index_;
+  };
+
+  class ConstIterator : public BaseIterator<true> {
+   public:
+    FUN_ALWAYS_INLINE ConstIterator(const FlatHashSet& set, int32 index = 0)
+        : BaseIterator<true>(set.table_, index) {}
+  };
+
+  class Iterator : public BaseIterator<false> {
+   public:
+    FUN_ALWAYS_INLINE Iterator(FlatHashSet& set, int32 index = 0)
+        : BaseIterator<false>(set.table_, index) {}
+
+    /**
+     * Removes the current element. The iterator stays valid and may be
+     * advanced to the next element.
+     */
+    FUN_ALWAYS_INLINE void RemoveCurrent() {
+      this->table_->EraseAt(this->index_);
+    }
+  };
+
+  FUN_ALWAYS_INLINE Iterator CreateIterator() { return Iterator(*this); }
+
+  FUN_ALWAYS_INLINE ConstIterator CreateConstIterator() const {
+    return ConstIterator(*this);
+  }
+
+  // Range-for support. Do not use directly.
+  FUN_ALWAYS_INLINE Iterator begin() { return Iterator(*this); }
+  FUN_ALWAYS_INLINE ConstIterator begin() const { return ConstIterator(*this); }
+  FUN_ALWAYS_INLINE Iterator end() {
+    return Iterator(*this, table_.GetCapacity());
+  }
+  FUN_ALWAYS_INLINE ConstIterator end() const {
+    return ConstIterator(*this, table_.GetCapacity());
+  }
+
+ private:
+  TableType table_;
+};
+
+}  // namespace fun
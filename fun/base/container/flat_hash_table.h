@@ -0,0 +1,636 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/crc.h"
+#include "fun/base/ftl/functional.h"
+#include "fun/base/ftl/memory_ops.h"
+#include "fun/base/string/string.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FUN_FLAT_HASH_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define FUN_FLAT_HASH_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace fun {
+
+/**
+ * Default hashing for FlatHashSet and FlatHashMap.
+ *
+ * Lookups by another type convert the argument to KeyType first, since
+ * HashOf() of a type that merely compares equal to the key need not
+ * hash the same. A specialization may overload GetKeyHash() and Matches()
+ * for other types, which can then be looked up without the conversion
+ * (heterogeneous lookup), as long as equal values hash equally.
+ */
+template <typename KeyType>
+struct FlatHashKeyFuncs {
+  static FUN_ALWAYS_INLINE uint32 GetKeyHash(const KeyType& key) {
+    return HashOf(key);
+  }
+
+  static FUN_ALWAYS_INLINE bool Matches(const KeyType& a, const KeyType& b) {
+    return a == b;
+  }
+};
+
+/**
+ * String keys can be looked up by StringView or const char* without
+ * creating a String.
+ */
+template <>
+struct FlatHashKeyFuncs<String> {
+  // Same as HashOf(const String&).
+  static FUN_ALWAYS_INLINE uint32 GetKeyHash(const String& key) {
+    return Crc::Crc32(key.ConstData(), key.Len());
+  }
+
+  static FUN_ALWAYS_INLINE uint32 GetKeyHash(const StringView& key) {
+    return Crc::Crc32(key.ConstData(), key.Len());
+  }
+
+  static FUN_ALWAYS_INLINE uint32 GetKeyHash(const char* key) {
+    return Crc::Crc32(key, (int32)::strlen(key));
+  }
+
+  static FUN_ALWAYS_INLINE bool Matches(const String& a, const String& b) {
+    return Equals(a, b.ConstData(), b.Len());
+  }
+
+  static FUN_ALWAYS_INLINE bool Matches(const String& a, const StringView& b) {
+    return Equals(a, b.ConstData(), b.Len());
+  }
+
+  static FUN_ALWAYS_INLINE bool Matches(const String& a, const char* b) {
+    return Equals(a, b, (int32)::strlen(b));
+  }
+
+ private:
+  static FUN_ALWAYS_INLINE bool Equals(const String& a, const char* data,
+                                       int32 len) {
+    return a.Len() == len && ::memcmp(a.ConstData(), data, len) == 0;
+  }
+};
+
+namespace internal {
+namespace flat_hash {
+
+/**
+ * One control byte per slot: the top 7 bits of the hash ("H2") of the
+ * element in the slot, or one of the negative values below.
+ */
+typedef int8 ControlByte;
+
+const ControlByte CTRL_EMPTY = -128;
+const ControlByte CTRL_DELETED = -2;
+
+/** Slots probed at once. */
+const int32 GROUP_WIDTH = 16;
+
+/** Tables never shrink below this; a power of two >= GROUP_WIDTH. */
+const int32 MIN_CAPACITY = 16;
+
+FUN_ALWAYS_INLINE int32 CountTrailingZeros64(uint64 x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return (int32)index;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+FUN_ALWAYS_INLINE int32 CountLeadingZeros64(uint64 x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, x);
+  return 63 - (int32)index;
+#else
+  return __builtin_clzll(x);
+#endif
+}
+
+/**
+ * Set of slots within a group, 1 << SHIFT bits per slot of which only the
+ * highest may be set.
+ */
+template <int32 SHIFT>
+class BitMask {
+ public:
+  explicit BitMask(uint64 mask) : mask_(mask) {}
+
+  explicit operator bool() const { return mask_ != 0; }
+
+  int32 LowestBit() const { return CountTrailingZeros64(mask_) >> SHIFT; }
+
+  void ClearLowestBit() { mask_ &= mask_ - 1; }
+
+  /** Free slots before the first set one. Requires a non-empty mask. */
+  int32 TrailingZeros() const { return CountTrailingZeros64(mask_) >> SHIFT; }
+
+  /** Free slots after the last set one. Requires a non-empty mask. */
+  int32 LeadingZeros() const {
+    const int32 unused_bits = 64 - (GROUP_WIDTH << SHIFT);
+    return (CountLeadingZeros64(mask_) - unused_bits) >> SHIFT;
+  }
+
+ private:
+  uint64 mask_;
+};
+
+#if FUN_FLAT_HASH_SSE2
+
+/**
+ * The control bytes of GROUP_WIDTH consecutive slots, compared at once.
+ */
+class Group {
+ public:
+  typedef BitMask<0> Mask;
+
+  explicit FUN_ALWAYS_INLINE Group(const ControlByte* pos)
+      : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+  FUN_ALWAYS_INLINE Mask Match(ControlByte h2) const {
+    return Mask((uint32)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_)));
+  }
+
+  FUN_ALWAYS_INLINE Mask MatchEmpty() const { return Match(CTRL_EMPTY); }
+
+  /** Empty and deleted bytes are the negative ones. */
+  FUN_ALWAYS_INLINE Mask MatchEmptyOrDeleted() const {
+    return Mask((uint32)_mm_movemask_epi8(ctrl_));
+  }
+
+ private:
+  __m128i ctrl_;
+};
+
+#elif FUN_FLAT_HASH_NEON
+
+class Group {
+ public:
+  // NEON has no movemask; narrowing the comparison gives 4 bits per slot.
+  typedef BitMask<2> Mask;
+
+  explicit FUN_ALWAYS_INLINE Group(const ControlByte* pos)
+      : ctrl_(vld1q_s8(pos)) {}
+
+  FUN_ALWAYS_INLINE Mask Match(ControlByte h2) const {
+    return ToMask(vceqq_s8(vdupq_n_s8(h2), ctrl_));
+  }
+
+  FUN_ALWAYS_INLINE Mask MatchEmpty() const { return Match(CTRL_EMPTY); }
+
+  FUN_ALWAYS_INLINE Mask MatchEmptyOrDeleted() const {
+    return ToMask(vcltzq_s8(ctrl_));
+  }
+
+ private:
+  static FUN_ALWAYS_INLINE Mask ToMask(uint8x16_t cmp) {
+    const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return Mask(vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) &
+                0x8888888888888888ULL);
+  }
+
+  int8x16_t ctrl_;
+};
+
+#else
+
+class Group {
+ public:
+  typedef BitMask<0> Mask;
+
+  explicit FUN_ALWAYS_INLINE Group(const ControlByte* pos) : pos_(pos) {}
+
+  FUN_ALWAYS_INLINE Mask Match(ControlByte h2) const {
+    uint32 mask = 0;
+    for (int32 i = 0; i < GROUP_WIDTH; ++i) {
+      mask |= uint32(pos_[i] == h2) << i;
+    }
+    return Mask(mask);
+  }
+
+  FUN_ALWAYS_INLINE Mask MatchEmpty() const { return Match(CTRL_EMPTY); }
+
+  FUN_ALWAYS_INLINE Mask MatchEmptyOrDeleted() const {
+    uint32 mask = 0;
+    for (int32 i = 0; i < GROUP_WIDTH; ++i) {
+      mask |= uint32(pos_[i] < 0) << i;
+    }
+    return Mask(mask);
+  }
+
+ private:
+  const ControlByte* pos_;
+};
+
+#endif
+
+/**
+ * Spreads the 32-bit HashOf() value over 64 bits: the top 32 bits select
+ * the first group to probe ("H1") and the 7 bits below them are stored in
+ * the control byte ("H2").
+ */
+FUN_ALWAYS_INLINE uint64 MixHash(uint32 hash) {
+  return uint64(hash) * 0x9E3779B97F4A7C15ULL;
+}
+
+FUN_ALWAYS_INLINE uint32 H1(uint64 mixed) { return uint32(mixed >> 32); }
+
+FUN_ALWAYS_INLINE ControlByte H2(uint64 mixed) {
+  return ControlByte((mixed >> 25) & 0x7F);
+}
+
+/**
+ * Triangular probing over groups, which visits every group of a power of
+ * two sized table.
+ */
+class ProbeSequence {
+ public:
+  FUN_ALWAYS_INLINE ProbeSequence(uint32 h1, uint32 mask)
+      : mask_(mask), offset_(h1 & mask), step_(0) {}
+
+  FUN_ALWAYS_INLINE uint32 GetOffset() const { return offset_; }
+
+  FUN_ALWAYS_INLINE uint32 GetOffset(int32 i) const {
+    return (offset_ + i) & mask_;
+  }
+
+  FUN_ALWAYS_INLINE void Next() {
+    step_ += GROUP_WIDTH;
+    offset_ = (offset_ + step_) & mask_;
+  }
+
+ private:
+  uint32 mask_;
+  uint32 offset_;
+  uint32 step_;
+};
+
+/**
+ * Open addressing hash table in the style of Swiss tables, the storage of
+ * FlatHashSet and FlatHashMap.
+ *
+ * Elements are stored in place in a flat slot array, next to an array of
+ * control bytes. A lookup compares the H2 bits of the key against a group
+ * of 16 control bytes with one SIMD comparison and only touches the slots
+ * that match, so a miss rarely touches a slot at all. The first
+ * GROUP_WIDTH - 1 control bytes are mirrored after the last one, so a
+ * group can be loaded at any slot.
+ *
+ * The table grows by doubling when 7/8 of the slots are used. Erasing
+ * leaves a tombstone only where a probe sequence may have passed over the
+ * slot; tombstones are dropped when the table is rehashed.
+ *
+ * Traits provides ElementType, KeyType and GetKey(element).
+ */
+template <typename Traits, typename KeyFuncs>
+class FlatHashTable {
+ public:
+  typedef typename Traits::ElementType ElementType;
+  typedef typename Traits::KeyType KeyType;
+
+  FlatHashTable()
+      : ctrl_(nullptr),
+        slots_(nullptr),
+        capacity_(0),
+        count_(0),
+        growth_left_(0) {}
+
+  FlatHashTable(const FlatHashTable& other) : FlatHashTable() {
+    *this = other;
+  }
+
+  FlatHashTable(FlatHashTable&& other)
+      : ctrl_(other.ctrl_),
+        slots_(other.slots_),
+        capacity_(other.capacity_),
+        count_(other.count_),
+        growth_left_(other.growth_left_) {
+    other.ctrl_ = nullptr;
+    other.slots_ = nullptr;
+    other.capacity_ = 0;
+    other.count_ = 0;
+    other.growth_left_ = 0;
+  }
+
+  ~FlatHashTable() { Reset(); }
+
+  FlatHashTable& operator=(const FlatHashTable& other) {
+    if (this != &other) {
+      Clear();
+      Reserve(other.count_);
+      for (int32 i = other.FindNextFull(0); i < other.capacity_;
+           i = other.FindNextFull(i + 1)) {
+        const ElementType& element = other.slots_[i];
+        const int32 index = PrepareInsert(
+            KeyFuncs::GetKeyHash(Traits::GetKey(element)));
+        new (slots_ + index) ElementType(element);
+      }
+    }
+    return *this;
+  }
+
+  FlatHashTable& operator=(FlatHashTable&& other) {
+    if (this != &other) {
+      Reset();
+      Swap(other);
+    }
+    return *this;
+  }
+
+  void Swap(FlatHashTable& other) {
+    fun::Swap(ctrl_, other.ctrl_);
+    fun::Swap(slots_, other.slots_);
+    fun::Swap(capacity_, other.capacity_);
+    fun::Swap(count_, other.count_);
+    fun::Swap(growth_left_, other.growth_left_);
+  }
+
+  FUN_ALWAYS_INLINE int32 Count() const { return count_; }
+
+  FUN_ALWAYS_INLINE int32 GetCapacity() const { return capacity_; }
+
+  FUN_ALWAYS_INLINE ElementType& GetSlot(int32 index) {
+    return slots_[index];
+  }
+
+  FUN_ALWAYS_INLINE const ElementType& GetSlot(int32 index) const {
+    return slots_[index];
+  }
+
+  /**
+   * Returns the slot index of the element with the given key, or
+   * INVALID_INDEX.
+   */
+  template <typename K>
+  FUN_ALWAYS_INLINE int32 Find(const K& key) const {
+    if (count_ == 0) {
+      return INVALID_INDEX;
+    }
+
+    const uint64 mixed = MixHash(KeyFuncs::GetKeyHash(key));
+    const ControlByte h2 = H2(mixed);
+    ProbeSequence seq(H1(mixed), capacity_ - 1);
+    for (;;) {
+      const Group group(ctrl_ + seq.GetOffset());
+      for (typename Group::Mask match = group.Match(h2); match;
+           match.ClearLowestBit()) {
+        const uint32 index = seq.GetOffset(match.LowestBit());
+        if (FUN_LIKELY(KeyFuncs::Matches(Traits::GetKey(slots_[index]), key))) {
+          return (int32)index;
+        }
+      }
+      if (group.MatchEmpty()) {
+        return INVALID_INDEX;
+      }
+      seq.Next();
+    }
+  }
+
+  /**
+   * Returns the slot index of the element with the given key. If there is
+   * none, a slot is reserved for it and out_inserted set; the caller must
+   * then construct the element in GetSlot(index).
+   */
+  template <typename K>
+  int32 FindOrPrepareInsert(const K& key, bool& out_inserted) {
+    const uint32 hash = KeyFuncs::GetKeyHash(key);
+    if (count_ > 0) {
+      const uint64 mixed = MixHash(hash);
+      const ControlByte h2 = H2(mixed);
+      ProbeSequence seq(H1(mixed), capacity_ - 1);
+      for (;;) {
+        const Group group(ctrl_ + seq.GetOffset());
+        for (typename Group::Mask match = group.Match(h2); match;
+             match.ClearLowestBit()) {
+          const uint32 index = seq.GetOffset(match.LowestBit());
+          if (KeyFuncs::Matches(Traits::GetKey(slots_[index]), key)) {
+            out_inserted = false;
+            return (int32)index;
+          }
+        }
+        if (group.MatchEmpty()) {
+          break;
+        }
+        seq.Next();
+      }
+    }
+
+    out_inserted = true;
+    return PrepareInsert(hash);
+  }
+
+  /**
+   * Destroys the element in the slot. Other elements do not move, so
+   * iteration can go on after the slot.
+   */
+  void EraseAt(int32 index) {
+    fun_check(IsFull(ctrl_[index]));
+    DestructItem(slots_ + index);
+    --count_;
+
+    // If a group around the slot has never been full, no probe sequence
+    // has gone past the slot, and it can be marked empty again.
+    const uint32 mask = capacity_ - 1;
+    const uint32 index_before = (index - GROUP_WIDTH) & mask;
+    const typename Group::Mask empty_after = Group(ctrl_ + index).MatchEmpty();
+    const typename Group::Mask empty_before =
+        Group(ctrl_ + index_before).MatchEmpty();
+    const bool was_never_full =
+        empty_before && empty_after &&
+        empty_after.TrailingZeros() + empty_before.LeadingZeros() <
+            GROUP_WIDTH;
+
+    SetCtrl(index, was_never_full ? CTRL_EMPTY : CTRL_DELETED);
+    if (was_never_full) {
+      ++growth_left_;
+    }
+  }
+
+  /**
+   * Returns the first slot at or after index that holds an element, or
+   * GetCapacity().
+   */
+  FUN_ALWAYS_INLINE int32 FindNextFull(int32 index) const {
+    while (index < capacity_ && !IsFull(ctrl_[index])) {
+      ++index;
+    }
+    return index;
+  }
+
+  /**
+   * Makes room for count elements without growing.
+   */
+  void Reserve(int32 count) {
+    if (count > count_ + growth_left_) {
+      Resize(CapacityForCount(count));
+    }
+  }
+
+  /**
+   * Destroys all elements and keeps the slots.
+   */
+  void Clear() {
+    if (capacity_ == 0) {
+      return;
+    }
+    DestroyElements();
+    ::memset(ctrl_, CTRL_EMPTY, capacity_ + GROUP_WIDTH - 1);
+    count_ = 0;
+    growth_left_ = MaxLoad(capacity_);
+  }
+
+  /**
+   * Destroys all elements and frees the slots.
+   */
+  void Reset() {
+    if (capacity_ == 0) {
+      return;
+    }
+    DestroyElements();
+    UnsafeMemory::Free(ctrl_);
+    ctrl_ = nullptr;
+    slots_ = nullptr;
+    capacity_ = 0;
+    count_ = 0;
+    growth_left_ = 0;
+  }
+
+  uint32 GetAllocatedSize() const {
+    return capacity_ == 0 ? 0 : (uint32)GetAllocationSize(capacity_);
+  }
+
+ private:
+  static FUN_ALWAYS_INLINE bool IsFull(ControlByte ctrl) { return ctrl >= 0; }
+
+  /** Number of elements a table of the given capacity holds, 7/8 of it. */
+  static FUN_ALWAYS_INLINE int32 MaxLoad(int32 capacity) {
+    return capacity - capacity / 8;
+  }
+
+  static int32 CapacityForCount(int32 count) {
+    int32 capacity = MIN_CAPACITY;
+    while (MaxLoad(capacity) < count) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  static size_t GetSlotsOffset(int32 capacity) {
+    const size_t alignment =
+        alignof(ElementType) > 16 ? alignof(ElementType) : 16;
+    return Align(size_t(capacity + GROUP_WIDTH - 1), (uint32)alignment);
+  }
+
+  static size_t GetAllocationSize(int32 capacity) {
+    return GetSlotsOffset(capacity) + capacity * sizeof(ElementType);
+  }
+
+  FUN_ALWAYS_INLINE void SetCtrl(uint32 index, ControlByte ctrl) {
+    ctrl_[index] = ctrl;
+    // The mirrored bytes after the last slot.
+    if (index < uint32(GROUP_WIDTH - 1)) {
+      ctrl_[capacity_ + index] = ctrl;
+    }
+  }
+
+  /**
+   * Returns the first empty or deleted slot in the probe sequence of hash.
+   */
+  FUN_ALWAYS_INLINE uint32 FindFirstNonFull(uint64 mixed) const {
+    ProbeSequence seq(H1(mixed), capacity_ - 1);
+    for (;;) {
+      const typename Group::Mask free = Group(ctrl_ + seq.GetOffset())
+                                            .MatchEmptyOrDeleted();
+      if (free) {
+        return seq.GetOffset(free.LowestBit());
+      }
+      seq.Next();
+    }
+  }
+
+  int32 PrepareInsert(uint32 hash) {
+    const uint64 mixed = MixHash(hash);
+    uint32 index = capacity_ > 0 ? FindFirstNonFull(mixed) : 0;
+    if (growth_left_ == 0 && (capacity_ == 0 || ctrl_[index] != CTRL_DELETED)) {
+      // Out of empty slots. Mostly tombstones: rehash at the same size to
+      // drop them; otherwise grow.
+      if (capacity_ > 0 && int64(count_) * 32 <= int64(capacity_) * 25) {
+        Resize(capacity_);
+      } else {
+        Resize(capacity_ == 0 ? MIN_CAPACITY : capacity_ * 2);
+      }
+      index = FindFirstNonFull(mixed);
+    }
+
+    if (ctrl_[index] == CTRL_EMPTY) {
+      --growth_left_;
+    }
+    SetCtrl(index, H2(mixed));
+    ++count_;
+    return (int32)index;
+  }
+
+  void Resize(int32 new_capacity) {
+    ControlByte* old_ctrl = ctrl_;
+    ElementType* old_slots = slots_;
+    const int32 old_capacity = capacity_;
+
+    uint8* allocation = (uint8*)UnsafeMemory::Malloc(
+        GetAllocationSize(new_capacity),
+        alignof(ElementType) > 16 ? alignof(ElementType) : 16);
+    ctrl_ = (ControlByte*)allocation;
+    slots_ = (ElementType*)(allocation + GetSlotsOffset(new_capacity));
+    capacity_ = new_capacity;
+    growth_left_ = MaxLoad(new_capacity) - count_;
+    ::memset(ctrl_, CTRL_EMPTY, new_capacity + GROUP_WIDTH - 1);
+
+    for (int32 i = 0; i < old_capacity; ++i) {
+      if (IsFull(old_ctrl[i])) {
+        ElementType& element = old_slots[i];
+        const uint64 mixed =
+            MixHash(KeyFuncs::GetKeyHash(Traits::GetKey(element)));
+        const uint32 index = FindFirstNonFull(mixed);
+        SetCtrl(index, H2(mixed));
+        new (slots_ + index) ElementType(MoveTemp(element));
+        DestructItem(&element);
+      }
+    }
+
+    if (old_ctrl) {
+      UnsafeMemory::Free(old_ctrl);
+    }
+  }
+
+  void DestroyElements() {
+    if (!IsTriviallyDestructible<ElementType>::Value) {
+      for (int32 i = FindNextFull(0); i < capacity_; i = FindNextFull(i + 1)) {
+        DestructItem(slots_ + i);
+      }
+    }
+  }
+
+  ControlByte* ctrl_;
+  ElementType* slots_;
+  int32 capacity_;
+  int32 count_;
+  // Elements that can be added before an empty slot has to be reused.
+  int32 growth_left_;
+};
+
+}  // namespace flat_hash
+}  // namespace internal
+
+}  // namespace fun
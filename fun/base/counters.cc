@@ -1,5 +1,8 @@
-﻿#include "fun/base/base.h"
-#include "fun/http/status_code.h"
+﻿#include "fun/base/counters.h"
+#include "fun/base/metrics.h"
+#include "fun/json/value.h"
+
+#include <limits>
 
 namespace fun {
 
@@ -36,76 +39,119 @@ namespace fun {
 */
 
 
-//TODO Counter 클래스로 묶어준다면 좀더 깔끔해지지 않을까??
+namespace {
 
-typedef Function<http::StatusCode(const String&,const String&,json::JValue*) CounterCallback;
+String GetMetricName(const String& counter_group, const String& counter_id) {
+  return counter_group + "_" + counter_id;
+}
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const int32 value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, value);
+Gauge GetCounterGauge(const String& counter_group, const String& counter_id,
+                      const String& description = String()) {
+  return MetricsRegistry::Default().GetGauge(
+      GetMetricName(counter_group, counter_id), description);
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const int64 value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, value);
+// String values cannot be exported; they are only kept for
+// ReadCounterAsString().
+FastMutex string_counters_mutex;
+Map<String, String> string_counters;
+
+void SetStringCounter(const String& counter_group, const String& counter_id,
+                      const String& value) {
+  ScopedLock<FastMutex> guard(string_counters_mutex);
+  string_counters.Add(GetMetricName(counter_group, counter_id), value);
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const double value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, value);
+}  // namespace
+
+void UpdateCounter(const String& counter_group, const String& counter_id, const int32 value) {
+  GetCounterGauge(counter_group, counter_id).Set(value);
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const String& value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, value);
+void UpdateCounter(const String& counter_group, const String& counter_id, const int64 value) {
+  GetCounterGauge(counter_group, counter_id).Set(static_cast<double>(value));
 }
 
+void UpdateCounter(const String& counter_group, const String& counter_id, const double value) {
+  GetCounterGauge(counter_group, counter_id).Set(value);
+}
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const String& description, const int32 value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, description, value);
+void UpdateCounter(const String& counter_group, const String& counter_id, const String& value) {
+  SetStringCounter(counter_group, counter_id, value);
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const String& description, const int64 value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, description, value);
+void UpdateCounter(const String& counter_group, const String& counter_id, const String& description, const int32 value) {
+  GetCounterGauge(counter_group, counter_id, description).Set(value);
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const String& description, const double value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, description, value);
+void UpdateCounter(const String& counter_group, const String& counter_id, const String& description, const int64 value) {
+  GetCounterGauge(counter_group, counter_id, description).Set(static_cast<double>(value));
 }
 
-void UpdateCounter(const String& counter_type, const String& counter_id, const String& description, const String& value) {
-  ScopedLock guard(mutex_);
-  CounterGroup* group = FindOrAddGroup(counter_type);
-  group->SetValue(counter_id, description, value);
+void UpdateCounter(const String& counter_group, const String& counter_id, const String& description, const double value) {
+  GetCounterGauge(counter_group, counter_id, description).Set(value);
 }
 
+void UpdateCounter(const String& counter_group, const String& counter_id, const String& description, const String& value) {
+  SetStringCounter(counter_group, counter_id, value);
+}
 
+void IncreaseCounterBy(const String& counter_group, const String& counter_id, const int32 value) {
+  GetCounterGauge(counter_group, counter_id).Add(value);
+}
 
-// 아래 함수는 카운터가 등록되어야함.
+void DecreaseCounterBy(const String& counter_group, const String& counter_id, const int32 value) {
+  GetCounterGauge(counter_group, counter_id).Add(-value);
+}
 
-void IncreaseCounterBy(const String& counter_type, const String& counter_id, const int32 value);
-void DecreaseCounterBy(const String& counter_type, const String& counter_id, const int32 value);
-void IncreaseCounterBy(const String& counter_type, const String& counter_id, const int64 value);
-void DecreaseCounterBy(const String& counter_type, const String& counter_id, const int64 value);
-void IncreaseCounterBy(const String& counter_type, const String& counter_id, const double value);
-void DecreaseCounterBy(const String& counter_type, const String& counter_id, const double value);
+void IncreaseCounterBy(const String& counter_group, const String& counter_id, const int64 value) {
+  GetCounterGauge(counter_group, counter_id).Add(static_cast<double>(value));
+}
 
-int64 ReadCounterAsInteger(const String& counter_type, const String& counter_id);
-double ReadCounterAsDouble(const String& counter_type, const String& counter_id);
-String ReadCounterAsString(const String& counter_type, const String& counter_id);
+void DecreaseCounterBy(const String& counter_group, const String& counter_id, const int64 value) {
+  GetCounterGauge(counter_group, counter_id).Add(-static_cast<double>(value));
+}
 
-void RegisterCallableCounter(const String& counter_type, const String& counter_id, const String& desc, const CounterCallback& value_cb);
+void IncreaseCounterBy(const String& counter_group, const String& counter_id, const double value) {
+  GetCounterGauge(counter_group, counter_id).Add(value);
+}
 
-void MonitorCounter(const String& counter_type, const String& counter_id, double threshold);
+void DecreaseCounterBy(const String& counter_group, const String& counter_id, const double value) {
+  GetCounterGauge(counter_group, counter_id).Add(-value);
+}
+
+int64 ReadCounterAsInteger(const String& counter_group, const String& counter_id) {
+  return static_cast<int64>(GetCounterGauge(counter_group, counter_id).Read());
+}
+
+double ReadCounterAsDouble(const String& counter_group, const String& counter_id) {
+  return GetCounterGauge(counter_group, counter_id).Read();
+}
+
+String ReadCounterAsString(const String& counter_group, const String& counter_id) {
+  {
+    ScopedLock<FastMutex> guard(string_counters_mutex);
+    if (const String* value = string_counters.Find(GetMetricName(counter_group, counter_id))) {
+      return *value;
+    }
+  }
+
+  String result;
+  result.AppendNumber(GetCounterGauge(counter_group, counter_id).Read(), 'g', 15);
+  return result;
+}
+
+void RegisterCallableCounter(const String& counter_group, const String& counter_id, const String& desc, const CounterCallback& value_cb) {
+  MetricsRegistry::Default().RegisterCallable(
+      GetMetricName(counter_group, counter_id), desc,
+      [counter_group, counter_id, value_cb]() {
+        json::JValue value;
+        if (value_cb(counter_group, counter_id, &value) != http::StatusCode::OK ||
+            !value.IsNumeric()) {
+          return std::numeric_limits<double>::quiet_NaN();
+        }
+        return value.AsDouble();
+      });
+}
 
 } // namespace fun
@@ -47,7 +47,17 @@ namespace fun {
 */
 
 
-typedef Function<http::StatusCode(const String&,const String&,json::JValue*) CounterCallback;
+// String keyed convenience API on top of MetricsRegistry::Default(). Every
+// call looks the counter up by name under a lock; hot paths should keep a
+// Counter, Gauge or Histogram handle from metrics.h instead.
+//
+// Numeric counters are exported as gauges named "<group>_<id>".
+
+namespace json {
+class JValue;
+}  // namespace json
+
+typedef Function<http::StatusCode(const String&,const String&,json::JValue*)> CounterCallback;
 
 void UpdateCounter(const String& counter_group, const String& counter_id, const int32 value);
 void UpdateCounter(const String& counter_group, const String& counter_id, const int64 value);
@@ -70,6 +80,9 @@ int64 ReadCounterAsInteger(const String& counter_group, const String& counter_id
 double ReadCounterAsDouble(const String& counter_group, const String& counter_id);
 String ReadCounterAsString(const String& counter_group, const String& counter_id);
 
+// value_cb is called each time the metrics are exported. A numeric value
+// returned with StatusCode::OK becomes the sample; anything else is
+// exported as NaN.
 void RegisterCallableCounter(const String& counter_group, const String& counter_id, const String& desc, const CounterCallback& value_cb);
 
 void MonitorCounter(const String& counter_group, const String& counter_id, double threshold);
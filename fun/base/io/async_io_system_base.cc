@@ -4,6 +4,10 @@
 #include "Serialization/AsyncIoSystemBase.h"
 #include "Version/ObjectVersion.h"
 
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+#include "fun/base/io/async_io_system_linux.h"
+#endif
+
 FUN_BEGIN_NAMESPACE
 
 DECLARE_STATS_GROUP_VERBOSE("AsyncIoSystem", STATGROUP_AsyncIO_Verbose,
@@ -785,6 +789,12 @@ IoSystem& IoSystem::Get() {
     g_config->GetFloat("Core.System", "AsyncIOBandwidthLimit",
                        g_async_io_bandwidth_limit, GEngineIni);
     g_async_io_system = CPlatformMisc::GetPlatformSpecificAsyncIoSystem();
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+    if (!g_async_io_system) {
+      g_async_io_system = new AsyncIoSystemLinux(
+          CPlatformFSManager::Get().GetPlatformFS());
+    }
+#endif
     if (!g_async_io_system) {
       // the platform didn't have a specific need, so we just use
       // the base class with the normal file system.
@@ -0,0 +1,756 @@
+﻿#include "fun/base/io/async_io_system_linux.h"
+#include "fun/base/byte_order.h"
+#include "fun/base/exception.h"
+#include "fun/base/io/linux_read_engine.h"
+#include "fun/base/scoped_lock.h"
+#include "fun/base/serialization/archive.h"
+#include "fun/base/serialization/compression.h"
+#include "fun/base/thread.h"
+#include "fun/base/work_stealing_scheduler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace fun {
+
+namespace {
+
+// Largest single read, also the limit for coalescing.
+const int64 MAX_READ_SIZE = 8 * 1024 * 1024;
+
+// How far ahead in a priority queue to look for adjacent requests.
+const int32 COALESCE_WINDOW = 64;
+
+// Reads with an offset, buffers and lengths aligned to this, and at least
+// DIRECT_IO_MIN_SIZE long, use O_DIRECT.
+const int64 DIRECT_IO_ALIGNMENT = 4096;
+const int64 DIRECT_IO_MIN_SIZE = 256 * 1024;
+
+const int32 PREAD_POOL_THREAD_COUNT = 8;
+
+const int32 MAX_COMPLETION_COUNT = 64;
+
+enum CompressedStage {
+  STAGE_PLAIN,
+  STAGE_HEADER,
+  STAGE_CHUNK_TABLE,
+  STAGE_DATA,
+};
+
+}  // namespace
+
+struct AsyncIoSystemLinux::ReadRequest {
+  IoRequest request;
+  int32 stage;
+  // Plain requests only: reads still in flight.
+  int32 pending_op_count;
+  std::atomic<bool> failed;
+
+  // Compressed requests only.
+  int64 header[2];
+  bool is_byte_swapped;
+  int32 chunk_size;
+  int32 chunk_count;
+  CompressedChunkInfo* chunks;
+  uint8* compressed_data;
+  std::atomic<int32> remaining_chunk_count;
+
+  explicit ReadRequest(const IoRequest& request)
+      : request(request),
+        stage(STAGE_PLAIN),
+        pending_op_count(0),
+        failed(false),
+        is_byte_swapped(false),
+        chunk_size(0),
+        chunk_count(0),
+        chunks(nullptr),
+        compressed_data(nullptr),
+        remaining_chunk_count(0) {}
+
+  ~ReadRequest() {
+    UnsafeMemory::Free(chunks);
+    UnsafeMemory::Free(compressed_data);
+  }
+};
+
+/**
+ * One vectored read. Plain requests get a buffer each, so coalesced
+ * requests share an op; compressed requests read into buffers of their
+ * own, and data ops remember which chunks they cover.
+ */
+struct AsyncIoSystemLinux::ReadOp {
+  uint32 filename_hash;
+  int64 offset;
+  struct iovec iov[internal::LinuxReadEngine::MAX_IOV_COUNT];
+  int32 iov_count;
+  // Requests served by the op, in the order of their buffers.
+  ReadRequest* reads[internal::LinuxReadEngine::MAX_IOV_COUNT];
+  int32 read_count;
+  int32 first_chunk;
+  int32 chunk_count;
+
+  ReadOp(uint32 filename_hash, int64 offset)
+      : filename_hash(filename_hash),
+        offset(offset),
+        iov_count(0),
+        read_count(0),
+        first_chunk(0),
+        chunk_count(0) {}
+
+  void AddBuffer(ReadRequest* read, void* dst, int64 size) {
+    iov[iov_count].iov_base = dst;
+    iov[iov_count].iov_len = (size_t)size;
+    ++iov_count;
+    reads[read_count++] = read;
+  }
+
+  int64 GetSize() const {
+    int64 size = 0;
+    for (int32 i = 0; i < iov_count; ++i) {
+      size += iov[i].iov_len;
+    }
+    return size;
+  }
+
+  bool IsDirectIoCapable() const {
+    if ((offset % DIRECT_IO_ALIGNMENT) != 0) {
+      return false;
+    }
+    for (int32 i = 0; i < iov_count; ++i) {
+      if (((UPTRINT)iov[i].iov_base % DIRECT_IO_ALIGNMENT) != 0 ||
+          (iov[i].iov_len % DIRECT_IO_ALIGNMENT) != 0) {
+        return false;
+      }
+    }
+    return GetSize() >= DIRECT_IO_MIN_SIZE;
+  }
+
+  /**
+   * Drops the first bytes_read bytes after a short read.
+   */
+  void Advance(int64 bytes_read) {
+    offset += bytes_read;
+    int32 first = 0;
+    while (bytes_read >= (int64)iov[first].iov_len) {
+      bytes_read -= iov[first].iov_len;
+      ++first;
+    }
+    iov[first].iov_base = (uint8*)iov[first].iov_base + bytes_read;
+    iov[first].iov_len -= bytes_read;
+    for (int32 i = first; i < iov_count; ++i) {
+      iov[i - first] = iov[i];
+    }
+    iov_count -= first;
+  }
+};
+
+AsyncIoSystemLinux::AsyncIoSystemLinux(IPlatformFS& low_level,
+                                       Backend backend, int32 queue_depth)
+    : AsyncIoSystemBase(low_level),
+      engine_(nullptr),
+      queue_depth_(queue_depth),
+      in_flight_count_(0),
+      failed_read_count_(0) {
+  fun_check(queue_depth > 0);
+
+  if (backend != BACKEND_PREAD_POOL) {
+    engine_ = internal::LinuxReadEngine::CreateIoUring(queue_depth);
+    if (!engine_ && backend == BACKEND_IO_URING) {
+      throw IoException("io_uring is not available");
+    }
+  }
+  if (!engine_) {
+    engine_ = internal::LinuxReadEngine::CreatePreadPool(
+        MathBase::Min(queue_depth, PREAD_POOL_THREAD_COUNT));
+  }
+
+  for (int32 i = 0; i < PRIORITY_COUNT; ++i) {
+    bucket_heads_[i] = 0;
+  }
+
+  next_request_index_ = 1;
+  min_priority_ = AsyncIoPriority::Min;
+  ++is_running_;
+}
+
+AsyncIoSystemLinux::~AsyncIoSystemLinux() {
+  fun_check(in_flight_count_ == 0);
+
+  CloseAllFiles();
+  delete engine_;
+}
+
+void AsyncIoSystemLinux::Stop() {
+  --is_running_;
+  engine_->Wake();
+}
+
+const char* AsyncIoSystemLinux::GetBackendName() const {
+  return engine_->GetName();
+}
+
+uint64 AsyncIoSystemLinux::LoadData(const String& filename, int64 offset,
+                                    int64 size, void* dst,
+                                    AtomicCounter32* counter,
+                                    AsyncIoPriority priority) {
+  const uint64 request_index = AsyncIoSystemBase::LoadData(
+      filename, offset, size, dst, counter, priority);
+  engine_->Wake();
+  return request_index;
+}
+
+uint64 AsyncIoSystemLinux::LoadCompressedData(
+    const String& filename, int64 offset, int64 compressed_size,
+    int64 uncompressed_size, void* dst, CompressionFlags compression_flags,
+    AtomicCounter32* counter, AsyncIoPriority priority) {
+  const uint64 request_index = AsyncIoSystemBase::LoadCompressedData(
+      filename, offset, compressed_size, uncompressed_size, dst,
+      compression_flags, counter, priority);
+  engine_->Wake();
+  return request_index;
+}
+
+int32 AsyncIoSystemLinux::CancelRequests(uint64* request_indices,
+                                         int32 index_count) {
+  int32 requests_canceled =
+      AsyncIoSystemBase::CancelRequests(request_indices, index_count);
+
+  ScopedLock<Mutex> guard(mutex_);
+
+  for (int32 bucket_index = 0;
+       bucket_index < PRIORITY_COUNT && requests_canceled < index_count;
+       ++bucket_index) {
+    Array<QueuedRequest>& bucket = buckets_[bucket_index];
+    for (int32 i = bucket_heads_[bucket_index]; i < bucket.Count(); ++i) {
+      QueuedRequest& queued = bucket[i];
+      if (queued.taken) {
+        continue;
+      }
+      for (int32 j = 0; j < index_count; ++j) {
+        if (queued.request.request_index == request_indices[j]) {
+          queued.taken = true;
+          if (queued.request.counter) {
+            --*queued.request.counter;
+          }
+          --busy_with_request_;
+          ++requests_canceled;
+          break;
+        }
+      }
+    }
+  }
+  return requests_canceled;
+}
+
+void AsyncIoSystemLinux::CancelAllOutstandingRequests() {
+  AsyncIoSystemBase::CancelAllOutstandingRequests();
+
+  ScopedLock<Mutex> guard(mutex_);
+
+  // Like the base implementation, simply toss the queued requests.
+  for (int32 bucket_index = 0; bucket_index < PRIORITY_COUNT; ++bucket_index) {
+    Array<QueuedRequest>& bucket = buckets_[bucket_index];
+    for (int32 i = bucket_heads_[bucket_index]; i < bucket.Count(); ++i) {
+      if (!bucket[i].taken) {
+        --busy_with_request_;
+      }
+    }
+    bucket.Reset();
+    bucket_heads_[bucket_index] = 0;
+  }
+}
+
+void AsyncIoSystemLinux::BlockTillAllRequestsFinishedAndFlushHandles() {
+  AsyncIoSystemBase::BlockTillAllRequestsFinishedAndFlushHandles();
+
+  CloseAllFiles();
+}
+
+void AsyncIoSystemLinux::TickSingleThreaded() { Tick(false); }
+
+void AsyncIoSystemLinux::SetMinPriority(AsyncIoPriority min_priority) {
+  AsyncIoSystemBase::SetMinPriority(min_priority);
+  engine_->Wake();
+}
+
+void AsyncIoSystemLinux::HintDoneWithFile(const String& filename) {
+  AsyncIoSystemBase::HintDoneWithFile(filename);
+  engine_->Wake();
+}
+
+void AsyncIoSystemLinux::Run() {
+  // is_running_ gets decremented by Stop.
+  while (is_running_.Value() > 0) {
+    // Sit and spin if requested, unless we are shutting down.
+    while (suspend_count_.Value() > 0 && is_running_.Value() > 0) {
+      Thread::Sleep(5);
+    }
+
+    Tick(true);
+  }
+
+  // Let the reads in flight finish; their buffers belong to the callers.
+  while (in_flight_count_ > 0) {
+    Tick(true);
+  }
+}
+
+void AsyncIoSystemLinux::Tick(bool may_block) {
+  DrainNewRequests();
+
+  while (in_flight_count_ < queue_depth_) {
+    if (ready_ops_.Count() > 0) {
+      ReadOp* op = ready_ops_[0];
+      ready_ops_.RemoveAt(0);
+      SubmitOp(op);
+    } else if (!TakeNextRequest()) {
+      break;
+    }
+  }
+
+  if (in_flight_count_ == 0 && !may_block) {
+    return;
+  }
+
+  // Submits the new reads and, if there is nothing in flight, sleeps until
+  // new requests are woken in. Without may_block only the reads that have
+  // already completed are handled.
+  internal::LinuxReadEngine::Completion completions[MAX_COMPLETION_COUNT];
+  const int32 count =
+      engine_->Wait(completions, MAX_COMPLETION_COUNT, may_block);
+  for (int32 i = 0; i < count; ++i) {
+    if (completions[i].tag) {
+      --in_flight_count_;
+      OnOpCompleted(static_cast<ReadOp*>(completions[i].tag),
+                    completions[i].result);
+    }
+  }
+}
+
+void AsyncIoSystemLinux::DrainNewRequests() {
+  ScopedLock<Mutex> guard(mutex_);
+
+  for (int32 i = 0; i < outstanding_requests_.Count(); ++i) {
+    const IoRequest& request = outstanding_requests_[i];
+
+    if (request.destroy_handle_request) {
+      ScopedLock<FastMutex> files_guard(files_mutex_);
+      OpenFile* file = files_.Find(request.filename_hash);
+      if (file) {
+        if (file->in_flight == 0) {
+          CloseFile(*file);
+          files_.Remove(request.filename_hash);
+        } else {
+          file->close_requested = true;
+        }
+      }
+      continue;
+    }
+
+    QueuedRequest queued;
+    queued.request = request;
+    queued.taken = false;
+    buckets_[(int32)request.priority].Add(queued);
+
+    // Updated inside the lock so that BlockTillAllRequestsFinished never
+    // sees the request neither queued nor busy.
+    ++busy_with_request_;
+  }
+  outstanding_requests_.Reset();
+}
+
+bool AsyncIoSystemLinux::TakeNextRequest() {
+  ReadRequest* read = nullptr;
+  {
+    ScopedLock<Mutex> guard(mutex_);
+
+    // FIFO per priority, highest priority first.
+    for (int32 bucket_index = PRIORITY_COUNT - 1;
+         bucket_index >= (int32)min_priority_ && !read; --bucket_index) {
+      Array<QueuedRequest>& bucket = buckets_[bucket_index];
+      int32& head = bucket_heads_[bucket_index];
+      while (head < bucket.Count() && bucket[head].taken) {
+        ++head;
+      }
+      if (head == bucket.Count()) {
+        bucket.Reset();
+        head = 0;
+        continue;
+      }
+
+      read = new ReadRequest(bucket[head].request);
+      bucket[head].taken = true;
+      if (read->request.uncompressed_size <= 0) {
+        // Takes adjacent requests from the bucket as well.
+        StartPlainRead(read, bucket_index, head);
+        return true;
+      }
+    }
+  }
+
+  if (!read) {
+    return false;
+  }
+  StartCompressedRead(read);
+  return true;
+}
+
+void AsyncIoSystemLinux::StartPlainRead(ReadRequest* read, int32 bucket_index,
+                                        int32 index) {
+  const IoRequest& request = read->request;
+
+  if (request.size > MAX_READ_SIZE) {
+    for (int64 done = 0; done < request.size; done += MAX_READ_SIZE) {
+      ReadOp* op = new ReadOp(request.filename_hash, request.offset + done);
+      op->AddBuffer(read, (uint8*)request.dst + done,
+                    MathBase::Min(MAX_READ_SIZE, request.size - done));
+      ++read->pending_op_count;
+      ready_ops_.Add(op);
+    }
+    return;
+  }
+
+  ReadOp* op = new ReadOp(request.filename_hash, request.offset);
+  op->AddBuffer(read, request.dst, request.size);
+  read->pending_op_count = 1;
+
+  // Extends the read with queued requests for the bytes that follow, in
+  // any order within the window.
+  Array<QueuedRequest>& bucket = buckets_[bucket_index];
+  const int32 window_end =
+      MathBase::Min(bucket.Count(), index + 1 + COALESCE_WINDOW);
+  int64 end = request.offset + request.size;
+  int64 size = request.size;
+  bool extended = true;
+  while (extended &&
+         op->iov_count < internal::LinuxReadEngine::MAX_IOV_COUNT) {
+    extended = false;
+    for (int32 i = index + 1; i < window_end; ++i) {
+      QueuedRequest& queued = bucket[i];
+      const IoRequest& candidate = queued.request;
+      if (!queued.taken && candidate.uncompressed_size <= 0 &&
+          candidate.filename_hash == request.filename_hash &&
+          candidate.offset == end && size + candidate.size <= MAX_READ_SIZE) {
+        queued.taken = true;
+        ReadRequest* next = new ReadRequest(candidate);
+        next->pending_op_count = 1;
+        op->AddBuffer(next, candidate.dst, candidate.size);
+        end += candidate.size;
+        size += candidate.size;
+        extended = true;
+        break;
+      }
+    }
+  }
+
+  ready_ops_.Add(op);
+}
+
+void AsyncIoSystemLinux::StartCompressedRead(ReadRequest* read) {
+  // Reads the first two ints: the magic bytes (to detect byteswapping) and
+  // the size the chunks were compressed from.
+  read->stage = STAGE_HEADER;
+  ReadOp* op = new ReadOp(read->request.filename_hash, read->request.offset);
+  op->AddBuffer(read, read->header, sizeof(read->header));
+  ready_ops_.Add(op);
+}
+
+void AsyncIoSystemLinux::SubmitOp(ReadOp* op) {
+  int fd = -1;
+  {
+    ScopedLock<FastMutex> guard(files_mutex_);
+    OpenFile* file = FindOrOpenFile(op->reads[0]->request);
+    if (file) {
+      if (file->direct_fd == -1 && op->IsDirectIoCapable()) {
+        file->direct_fd = ::open(op->reads[0]->request.filename.c_str(),
+                                 O_RDONLY | O_DIRECT | O_CLOEXEC);
+        if (file->direct_fd < 0) {
+          // e.g. tmpfs.
+          file->direct_fd = -2;
+        }
+      }
+      fd = file->direct_fd >= 0 && op->IsDirectIoCapable() ? file->direct_fd
+                                                           : file->fd;
+      ++file->in_flight;
+    }
+  }
+
+  if (fd < 0) {
+    ++failed_read_count_;
+    FinishOp(op, false);
+    return;
+  }
+
+  engine_->Submit(fd, op->offset, op->iov, op->iov_count, op);
+  ++in_flight_count_;
+}
+
+void AsyncIoSystemLinux::OnOpCompleted(ReadOp* op, int64 result) {
+  ReleaseFile(op->filename_hash);
+
+  const int64 size = op->GetSize();
+  if (result > 0 && result < size) {
+    // Short read; queue the rest.
+    op->Advance(result);
+    ready_ops_.Add(op);
+    return;
+  }
+
+  // 0 is the end of the file.
+  const bool ok = result == size;
+  if (!ok) {
+    ++failed_read_count_;
+  }
+  FinishOp(op, ok);
+}
+
+void AsyncIoSystemLinux::FinishOp(ReadOp* op, bool ok) {
+  if (op->reads[0]->stage == STAGE_PLAIN) {
+    OnPlainOpCompleted(op, ok);
+  } else {
+    OnCompressedOpCompleted(op, ok);
+  }
+}
+
+void AsyncIoSystemLinux::OnPlainOpCompleted(ReadOp* op, bool ok) {
+  for (int32 i = 0; i < op->read_count; ++i) {
+    ReadRequest* read = op->reads[i];
+    if (!ok) {
+      read->failed = true;
+    }
+    // Requests larger than MAX_READ_SIZE are split into several ops.
+    if (--read->pending_op_count == 0) {
+      CompleteRequest(read);
+    }
+  }
+  delete op;
+}
+
+void AsyncIoSystemLinux::OnCompressedOpCompleted(ReadOp* op, bool ok) {
+  ReadRequest* read = op->reads[0];
+  const int32 first_chunk = op->first_chunk;
+  const int32 chunk_count = op->chunk_count;
+  delete op;
+
+  if (read->stage == STAGE_DATA) {
+    if (!ok) {
+      read->failed = true;
+      ReleaseChunks(read, chunk_count);
+      return;
+    }
+
+    int64 src_offset = 0;
+    for (int32 chunk_index = 1; chunk_index < first_chunk; ++chunk_index) {
+      src_offset += read->chunks[chunk_index].compressed_size;
+    }
+    for (int32 chunk_index = first_chunk;
+         chunk_index < first_chunk + chunk_count; ++chunk_index) {
+      const CompressedChunkInfo& chunk = read->chunks[chunk_index];
+      uint8* dst = (uint8*)read->request.dst +
+                   (int64)(chunk_index - 1) * read->chunk_size;
+      const uint8* src = read->compressed_data + src_offset;
+      src_offset += chunk.compressed_size;
+
+      // The last task to finish completes the request, so read must not
+      // be touched after the last submit.
+      WorkStealingScheduler::Default().Submit([this, read, chunk, dst, src]() {
+        if (!Compression::Uncompress(read->request.compression_flags, dst,
+                                     (int32)chunk.uncompressed_size, src,
+                                     (int32)chunk.compressed_size)) {
+          read->failed = true;
+        }
+        ReleaseChunks(read, 1);
+      });
+    }
+    return;
+  }
+
+  if (!ok) {
+    read->failed = true;
+    CompleteRequest(read);
+  } else if (read->stage == STAGE_HEADER) {
+    OnCompressedHeaderRead(read);
+  } else {
+    OnCompressedChunkTableRead(read);
+  }
+}
+
+void AsyncIoSystemLinux::OnCompressedHeaderRead(ReadRequest* read) {
+  // If the magic bytes don't match, then we are byteswapped (or corrupted).
+  read->is_byte_swapped = read->header[0] != PACKAGE_FILE_TAG;
+  if (read->is_byte_swapped) {
+    if (read->header[0] != PACKAGE_FILE_TAG_SWAPPED) {
+      fun_check_msg(0, "Detected data corruption [header] reading '%s'",
+                    read->request.filename.c_str());
+      read->failed = true;
+      CompleteRequest(read);
+      return;
+    }
+    read->header[1] = ByteOrder::Flip(read->header[1]);
+  }
+
+  // Old packages don't have the chunk size in the header.
+  read->chunk_size = read->header[1] == PACKAGE_FILE_TAG
+                         ? CompressionConstants::LOADING_COMPRESSION_CHUNK_SIZE
+                         : (int32)read->header[1];
+  if (read->chunk_size <= 0) {
+    read->failed = true;
+    CompleteRequest(read);
+    return;
+  }
+
+  // The first chunk holds the total sizes.
+  read->chunk_count = (int32)((read->request.uncompressed_size +
+                               read->chunk_size - 1) /
+                                  read->chunk_size +
+                              1);
+  const int64 table_size = read->chunk_count * sizeof(CompressedChunkInfo);
+  read->chunks = (CompressedChunkInfo*)UnsafeMemory::Malloc(table_size);
+
+  read->stage = STAGE_CHUNK_TABLE;
+  ReadOp* op = new ReadOp(read->request.filename_hash,
+                          read->request.offset + sizeof(read->header));
+  op->AddBuffer(read, read->chunks, table_size);
+  ready_ops_.Add(op);
+}
+
+void AsyncIoSystemLinux::OnCompressedChunkTableRead(ReadRequest* read) {
+  CompressedChunkInfo* chunks = read->chunks;
+
+  if (read->is_byte_swapped) {
+    for (int32 i = 0; i < read->chunk_count; ++i) {
+      chunks[i].compressed_size = ByteOrder::Flip(chunks[i].compressed_size);
+      chunks[i].uncompressed_size =
+          ByteOrder::Flip(chunks[i].uncompressed_size);
+    }
+  }
+
+  int64 calculated_uncompressed_size = 0;
+  int64 compressed_data_size = 0;
+  bool is_valid = true;
+  for (int32 i = 1; i < read->chunk_count; ++i) {
+    calculated_uncompressed_size += chunks[i].uncompressed_size;
+    compressed_data_size += chunks[i].compressed_size;
+    // All chunks are 'full size' until the last one.
+    if (chunks[i].compressed_size < 0 ||
+        chunks[i].uncompressed_size > read->chunk_size ||
+        (chunks[i].uncompressed_size < read->chunk_size &&
+         i != read->chunk_count - 1)) {
+      is_valid = false;
+    }
+  }
+
+  const int64 data_offset = sizeof(read->header) +
+                            read->chunk_count * sizeof(CompressedChunkInfo);
+  if (chunks[0].uncompressed_size != calculated_uncompressed_size ||
+      read->request.uncompressed_size != calculated_uncompressed_size ||
+      data_offset + chunks[0].compressed_size > read->request.size ||
+      data_offset + compressed_data_size > read->request.size) {
+    is_valid = false;
+  }
+
+  if (!is_valid) {
+    fun_check_msg(0, "Detected data corruption [chunk table] reading '%s'",
+                  read->request.filename.c_str());
+    read->failed = true;
+    CompleteRequest(read);
+    return;
+  }
+
+  // Reads all compressed data at once, in ops of whole chunks.
+  read->compressed_data = (uint8*)UnsafeMemory::Malloc(
+      MathBase::Max<int64>(compressed_data_size, 1));
+  read->remaining_chunk_count = read->chunk_count - 1;
+  read->stage = STAGE_DATA;
+
+  int64 src_offset = 0;
+  for (int32 chunk_index = 1; chunk_index < read->chunk_count;) {
+    ReadOp* op = new ReadOp(read->request.filename_hash,
+                            read->request.offset + data_offset + src_offset);
+    op->first_chunk = chunk_index;
+    int64 op_size = 0;
+    do {
+      op_size += chunks[chunk_index].compressed_size;
+      ++chunk_index;
+      ++op->chunk_count;
+    } while (chunk_index < read->chunk_count &&
+             op_size + chunks[chunk_index].compressed_size <= MAX_READ_SIZE);
+    op->AddBuffer(read, read->compressed_data + src_offset, op_size);
+    src_offset += op_size;
+    ready_ops_.Add(op);
+  }
+}
+
+void AsyncIoSystemLinux::ReleaseChunks(ReadRequest* read, int32 count) {
+  if (read->remaining_chunk_count.fetch_sub(count) == count) {
+    CompleteRequest(read);
+  }
+}
+
+void AsyncIoSystemLinux::CompleteRequest(ReadRequest* read) {
+  AtomicCounter32* counter = read->request.counter;
+  delete read;
+
+  // Request fulfilled, or failed; either way the caller stops waiting.
+  if (counter) {
+    --*counter;
+  }
+  --busy_with_request_;
+}
+
+AsyncIoSystemLinux::OpenFile* AsyncIoSystemLinux::FindOrOpenFile(
+    const IoRequest& request) {
+  OpenFile* file = files_.Find(request.filename_hash);
+  if (file) {
+    file->close_requested = false;
+    return file;
+  }
+
+  const int fd = ::open(request.filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  OpenFile new_file;
+  new_file.fd = fd;
+  new_file.direct_fd = -1;
+  new_file.in_flight = 0;
+  new_file.close_requested = false;
+  return &files_.Add(request.filename_hash, new_file);
+}
+
+void AsyncIoSystemLinux::ReleaseFile(uint32 filename_hash) {
+  ScopedLock<FastMutex> guard(files_mutex_);
+
+  OpenFile* file = files_.Find(filename_hash);
+  fun_check(file && file->in_flight > 0);
+  if (--file->in_flight == 0 && file->close_requested) {
+    CloseFile(*file);
+    files_.Remove(filename_hash);
+  }
+}
+
+void AsyncIoSystemLinux::CloseFile(OpenFile& file) {
+  ::close(file.fd);
+  if (file.direct_fd >= 0) {
+    ::close(file.direct_fd);
+  }
+}
+
+void AsyncIoSystemLinux::CloseAllFiles() {
+  ScopedLock<FastMutex> guard(files_mutex_);
+
+  for (Map<uint32, OpenFile>::Iterator it(files_); it; ++it) {
+    if (it.Value().in_flight == 0) {
+      CloseFile(it.Value());
+      it.RemoveCurrent();
+    } else {
+      // Closed when the reads complete.
+      it.Value().close_requested = true;
+    }
+  }
+}
+
+}  // namespace fun
@@ -0,0 +1,150 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/map.h"
+#include "fun/base/io/async_io_system_base.h"
+#include "fun/base/mutex.h"
+
+#include <atomic>
+
+namespace fun {
+
+namespace internal {
+class LinuxReadEngine;
+}  // namespace internal
+
+/**
+ * Async IO system for Linux that keeps many reads in flight instead of
+ * issuing one blocking read at a time.
+ *
+ * Requests are queued per priority and taken highest priority first;
+ * requests below the minimum priority stay queued. Requests for adjacent
+ * ranges of the same file are coalesced into one vectored read that lands
+ * directly in the destination buffers. Reads of whole 4K-aligned blocks of
+ * at least 256KB bypass the page cache with O_DIRECT.
+ *
+ * Compressed requests read the chunk table first and then all compressed
+ * data at once; every chunk is decompressed on the work-stealing scheduler
+ * as soon as the read covering it has completed.
+ *
+ * Reads go through io_uring where the kernel allows it, otherwise through
+ * preadv() on a small thread pool.
+ */
+class FUN_BASE_API AsyncIoSystemLinux : public AsyncIoSystemBase {
+ public:
+  enum Backend {
+    BACKEND_AUTO,
+    BACKEND_IO_URING,
+    BACKEND_PREAD_POOL,
+  };
+
+  /**
+   * queue_depth is the maximum number of reads in flight. Throws
+   * IoException if BACKEND_IO_URING is requested but not available.
+   */
+  AsyncIoSystemLinux(IPlatformFS& low_level, Backend backend = BACKEND_AUTO,
+                     int32 queue_depth = 64);
+  ~AsyncIoSystemLinux();
+
+  /**
+   * Makes Run() return.
+   */
+  void Stop();
+
+  /**
+   * Name of the backend in use, "io_uring" or "pread".
+   */
+  const char* GetBackendName() const;
+
+  /**
+   * Number of reads that failed or hit the end of the file. Their
+   * requests are completed anyway, as in the base implementation.
+   */
+  int32 GetFailedReadCount() const { return failed_read_count_.load(); }
+
+  //
+  // IoSystem interface
+  //
+
+  uint64 LoadData(const String& filename, int64 offset, int64 size, void* dst,
+                  AtomicCounter32* counter, AsyncIoPriority priority) override;
+
+  uint64 LoadCompressedData(const String& filename, int64 offset,
+                            int64 compressed_size, int64 uncompressed_size,
+                            void* dst, CompressionFlags compression_flags,
+                            AtomicCounter32* counter,
+                            AsyncIoPriority priority) override;
+
+  int32 CancelRequests(uint64* request_indices, int32 index_count) override;
+
+  void CancelAllOutstandingRequests() override;
+
+  void BlockTillAllRequestsFinishedAndFlushHandles() override;
+
+  void TickSingleThreaded() override;
+
+  void SetMinPriority(AsyncIoPriority min_priority) override;
+
+  void HintDoneWithFile(const String& filename) override;
+
+  void Run() override;
+
+ private:
+  struct ReadRequest;
+  struct ReadOp;
+
+  struct QueuedRequest {
+    IoRequest request;
+    bool taken;
+  };
+
+  struct OpenFile {
+    int fd;
+    // -1 if not opened yet, -2 if O_DIRECT is not supported for the file.
+    int direct_fd;
+    int32 in_flight;
+    bool close_requested;
+  };
+
+  enum { PRIORITY_COUNT = (int32)AsyncIoPriority::Max + 1 };
+
+  void Tick(bool may_block);
+  void DrainNewRequests();
+  bool TakeNextRequest();
+  void StartPlainRead(ReadRequest* read, int32 bucket_index, int32 index);
+  void StartCompressedRead(ReadRequest* read);
+  void SubmitOp(ReadOp* op);
+  void OnOpCompleted(ReadOp* op, int64 result);
+  void FinishOp(ReadOp* op, bool ok);
+  void OnPlainOpCompleted(ReadOp* op, bool ok);
+  void OnCompressedOpCompleted(ReadOp* op, bool ok);
+  void OnCompressedHeaderRead(ReadRequest* read);
+  void OnCompressedChunkTableRead(ReadRequest* read);
+  void ReleaseChunks(ReadRequest* read, int32 count);
+  void CompleteRequest(ReadRequest* read);
+  OpenFile* FindOrOpenFile(const IoRequest& request);
+  void ReleaseFile(uint32 filename_hash);
+  void CloseFile(OpenFile& file);
+  void CloseAllFiles();
+
+  internal::LinuxReadEngine* engine_;
+  int32 queue_depth_;
+  int32 in_flight_count_;
+
+  // Requests taken from outstanding_requests_, guarded by mutex_ so that
+  // they can be canceled.
+  Array<QueuedRequest> buckets_[PRIORITY_COUNT];
+  int32 bucket_heads_[PRIORITY_COUNT];
+
+  // Reads waiting for a free slot: follow-ups of compressed requests and
+  // the rest of short reads. IO thread only.
+  Array<ReadOp*> ready_ops_;
+
+  FastMutex files_mutex_;
+  Map<uint32, OpenFile> files_;
+
+  std::atomic<int32> failed_read_count_;
+};
+
+}  // namespace fun
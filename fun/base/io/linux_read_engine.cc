@@ -0,0 +1,413 @@
+﻿#include "fun/base/io/linux_read_engine.h"
+#include "fun/base/condition.h"
+#include "fun/base/container/array.h"
+#include "fun/base/exception.h"
+#include "fun/base/mutex.h"
+#include "fun/base/thread.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+
+namespace fun {
+namespace internal {
+
+namespace {
+
+//
+// IoUringReadEngine
+//
+
+/**
+ * io_uring through the raw system calls, so that no liburing is needed.
+ * One submission queue entry per read; a poll on an eventfd is kept armed
+ * so that Wake() can interrupt a wait for completions.
+ */
+class IoUringReadEngine : public LinuxReadEngine {
+ public:
+  IoUringReadEngine()
+      : ring_fd_(-1),
+        wake_fd_(-1),
+        sq_ring_(MAP_FAILED),
+        cq_ring_(MAP_FAILED),
+        sqes_(MAP_FAILED),
+        sq_ring_size_(0),
+        cq_ring_size_(0),
+        sqes_size_(0),
+        sq_tail_local_(0),
+        unsubmitted_count_(0) {}
+
+  ~IoUringReadEngine() {
+    if (sqes_ != MAP_FAILED) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if (ring_fd_ >= 0) {
+      ::close(ring_fd_);
+    }
+    if (wake_fd_ >= 0) {
+      ::close(wake_fd_);
+    }
+  }
+
+  bool Init(int32 queue_depth) {
+    struct io_uring_params params;
+    UnsafeMemory::Memzero(&params, sizeof(params));
+
+    // One extra entry for the wake-up poll.
+    ring_fd_ = static_cast<int>(
+        ::syscall(__NR_io_uring_setup, queue_depth + 1, &params));
+    if (ring_fd_ < 0) {
+      return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ =
+          MathBase::Max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      return false;
+    }
+
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ =
+          ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) {
+        return false;
+      }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<std::atomic<uint32>*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<uint32*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<uint32*>(sq + params.sq_off.array);
+    sq_tail_local_ = sq_tail_->load(std::memory_order_relaxed);
+
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<std::atomic<uint32>*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<std::atomic<uint32>*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<uint32*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    wake_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0) {
+      return false;
+    }
+    ArmWakePoll();
+    return true;
+  }
+
+  void Submit(int fd, int64 offset, const struct iovec* iov, int32 iov_count,
+              void* tag) override {
+    fun_check(iov_count <= MAX_IOV_COUNT);
+
+    struct io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = static_cast<uint64>(offset);
+    sqe->addr = reinterpret_cast<uint64>(iov);
+    sqe->len = static_cast<uint32>(iov_count);
+    sqe->user_data = reinterpret_cast<uint64>(tag);
+  }
+
+  int32 Wait(Completion* completions, int32 max_count,
+             bool may_block) override {
+    int32 count = Reap(completions, max_count);
+    if ((count > 0 || !may_block) && unsubmitted_count_ == 0) {
+      return count;
+    }
+
+    // Submits the new entries and, unless there already are completions
+    // or the caller polls, waits for one, in a single system call.
+    const uint32 min_complete = count == 0 && may_block ? 1 : 0;
+    sq_tail_->store(sq_tail_local_, std::memory_order_release);
+    for (;;) {
+      const int result = static_cast<int>(
+          ::syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_count_,
+                    min_complete, IORING_ENTER_GETEVENTS, nullptr, 0));
+      if (result >= 0) {
+        unsubmitted_count_ -= result;
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EBUSY) {
+        // Completion queue full; reaping below makes room.
+        break;
+      }
+      throw IoException("io_uring_enter failed");
+    }
+
+    return count + Reap(completions + count, max_count - count);
+  }
+
+  void Wake() override {
+    const uint64 one = 1;
+    ssize_t unused = ::write(wake_fd_, &one, sizeof(one));
+    (void)unused;
+  }
+
+  const char* GetName() const override { return "io_uring"; }
+
+ private:
+  struct io_uring_sqe* NextSqe() {
+    const uint32 index = sq_tail_local_ & sq_mask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    UnsafeMemory::Memzero(sqe, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_tail_local_;
+    ++unsubmitted_count_;
+    return sqe;
+  }
+
+  void ArmWakePoll() {
+    struct io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd_;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = 0;
+  }
+
+  int32 Reap(Completion* completions, int32 max_count) {
+    uint32 head = cq_head_->load(std::memory_order_relaxed);
+    const uint32 tail = cq_tail_->load(std::memory_order_acquire);
+
+    int32 count = 0;
+    while (head != tail && count < max_count) {
+      const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      Completion& completion = completions[count++];
+      completion.tag = reinterpret_cast<void*>(cqe.user_data);
+      completion.result = cqe.res;
+      ++head;
+
+      if (completion.tag == nullptr) {
+        uint64 value;
+        ssize_t unused = ::read(wake_fd_, &value, sizeof(value));
+        (void)unused;
+        ArmWakePoll();
+      }
+    }
+
+    cq_head_->store(head, std::memory_order_release);
+    return count;
+  }
+
+  int ring_fd_;
+  int wake_fd_;
+  void* sq_ring_;
+  void* cq_ring_;
+  void* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  std::atomic<uint32>* sq_tail_;
+  uint32 sq_mask_;
+  uint32* sq_array_;
+  uint32 sq_tail_local_;
+  uint32 unsubmitted_count_;
+
+  std::atomic<uint32>* cq_head_;
+  std::atomic<uint32>* cq_tail_;
+  uint32 cq_mask_;
+  struct io_uring_cqe* cqes_;
+};
+
+//
+// PreadPoolReadEngine
+//
+
+/**
+ * Fallback for kernels without io_uring: blocking preadv() calls on a few
+ * threads, which gives the device the same queue depth.
+ */
+class PreadPoolReadEngine : public LinuxReadEngine {
+ public:
+  PreadPoolReadEngine() : job_head_(0), woken_(false), stopping_(false) {}
+
+  ~PreadPoolReadEngine() {
+    {
+      ScopedLock<FastMutex> guard(mutex_);
+      stopping_ = true;
+      job_cond_.NotifyAll();
+    }
+    for (int32 i = 0; i < threads_.Count(); ++i) {
+      threads_[i]->Join();
+      delete threads_[i];
+    }
+  }
+
+  void Start(int32 thread_count) {
+    for (int32 i = 0; i < thread_count; ++i) {
+      Thread* thread = new Thread("AsyncIoRead");
+      threads_.Add(thread);
+      thread->StartFunc([this]() { WorkerLoop(); });
+    }
+  }
+
+  void Submit(int fd, int64 offset, const struct iovec* iov, int32 iov_count,
+              void* tag) override {
+    fun_check(iov_count <= MAX_IOV_COUNT);
+
+    Job job;
+    job.fd = fd;
+    job.offset = offset;
+    job.iov = iov;
+    job.iov_count = iov_count;
+    job.tag = tag;
+    staged_jobs_.Add(job);
+  }
+
+  int32 Wait(Completion* completions, int32 max_count,
+             bool may_block) override {
+    ScopedLock<FastMutex> guard(mutex_);
+
+    if (staged_jobs_.Count() > 0) {
+      for (int32 i = 0; i < staged_jobs_.Count(); ++i) {
+        jobs_.Add(staged_jobs_[i]);
+      }
+      staged_jobs_.Reset();
+      job_cond_.NotifyAll();
+    }
+
+    while (may_block && completions_.Count() == 0 && !woken_) {
+      done_cond_.Wait(mutex_);
+    }
+
+    int32 count = 0;
+    if (woken_ && count < max_count) {
+      woken_ = false;
+      completions[count].tag = nullptr;
+      completions[count].result = 0;
+      ++count;
+    }
+
+    const int32 taken = MathBase::Min(completions_.Count(), max_count - count);
+    for (int32 i = 0; i < taken; ++i) {
+      completions[count++] = completions_[i];
+    }
+    completions_.RemoveAt(0, taken);
+    return count;
+  }
+
+  void Wake() override {
+    ScopedLock<FastMutex> guard(mutex_);
+    woken_ = true;
+    done_cond_.NotifyAll();
+  }
+
+  const char* GetName() const override { return "pread"; }
+
+ private:
+  struct Job {
+    int fd;
+    int64 offset;
+    const struct iovec* iov;
+    int32 iov_count;
+    void* tag;
+  };
+
+  void WorkerLoop() {
+    for (;;) {
+      Job job;
+      {
+        ScopedLock<FastMutex> guard(mutex_);
+        while (job_head_ == jobs_.Count() && !stopping_) {
+          job_cond_.Wait(mutex_);
+        }
+        if (job_head_ == jobs_.Count()) {
+          return;
+        }
+        job = jobs_[job_head_++];
+        if (job_head_ == jobs_.Count()) {
+          jobs_.Reset();
+          job_head_ = 0;
+        }
+      }
+
+      Completion completion;
+      completion.tag = job.tag;
+      completion.result = Read(job);
+
+      ScopedLock<FastMutex> guard(mutex_);
+      completions_.Add(completion);
+      done_cond_.NotifyOne();
+    }
+  }
+
+  static int64 Read(const Job& job) {
+    for (;;) {
+      const ssize_t result =
+          ::preadv(job.fd, job.iov, job.iov_count, job.offset);
+      if (result >= 0) {
+        return result;
+      }
+      if (errno != EINTR) {
+        return -errno;
+      }
+    }
+  }
+
+  // Only touched by the submitting thread.
+  Array<Job> staged_jobs_;
+
+  FastMutex mutex_;
+  Condition job_cond_;
+  Condition done_cond_;
+  Array<Job> jobs_;
+  int32 job_head_;
+  Array<Completion> completions_;
+  bool woken_;
+  bool stopping_;
+  Array<Thread*> threads_;
+};
+
+}  // namespace
+
+LinuxReadEngine* LinuxReadEngine::CreateIoUring(int32 queue_depth) {
+  IoUringReadEngine* engine = new IoUringReadEngine;
+  if (!engine->Init(queue_depth)) {
+    delete engine;
+    return nullptr;
+  }
+  return engine;
+}
+
+LinuxReadEngine* LinuxReadEngine::CreatePreadPool(int32 thread_count) {
+  PreadPoolReadEngine* engine = new PreadPoolReadEngine;
+  engine->Start(thread_count);
+  return engine;
+}
+
+}  // namespace internal
+}  // namespace fun
@@ -0,0 +1,65 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+
+struct iovec;
+
+namespace fun {
+namespace internal {
+
+/**
+ * Keeps many file reads in flight on Linux. Used by AsyncIoSystemLinux.
+ *
+ * All methods except Wake() must be called from one thread.
+ */
+class LinuxReadEngine {
+ public:
+  enum { MAX_IOV_COUNT = 16 };
+
+  struct Completion {
+    // Tag passed to Submit(), or nullptr for a Wake().
+    void* tag;
+    // Bytes read, or -errno.
+    int64 result;
+  };
+
+  /**
+   * Returns an io_uring engine, or nullptr if the kernel does not support
+   * io_uring (or it is disabled, as in many containers).
+   */
+  static LinuxReadEngine* CreateIoUring(int32 queue_depth);
+
+  /**
+   * Returns an engine that runs preadv() on thread_count threads.
+   */
+  static LinuxReadEngine* CreatePreadPool(int32 thread_count);
+
+  virtual ~LinuxReadEngine() {}
+
+  /**
+   * Queues a vectored read of iov_count (at most MAX_IOV_COUNT) buffers at
+   * offset. iov must stay valid until the read has completed. The read
+   * may be short.
+   */
+  virtual void Submit(int fd, int64 offset, const struct iovec* iov,
+                      int32 iov_count, void* tag) = 0;
+
+  /**
+   * Starts the queued reads and, if may_block is true, waits until at
+   * least one read has completed or Wake() is called. Otherwise only the
+   * completions already available are taken. Returns the number of
+   * completions stored in completions.
+   */
+  virtual int32 Wait(Completion* completions, int32 max_count,
+                     bool may_block) = 0;
+
+  /**
+   * Makes a concurrent or the next Wait() return. Any thread.
+   */
+  virtual void Wake() = 0;
+
+  virtual const char* GetName() const = 0;
+};
+
+}  // namespace internal
+}  // namespace fun
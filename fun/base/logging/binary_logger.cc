@@ -0,0 +1,484 @@
+#include "fun/base/logging/binary_logger.h"
+#include "fun/base/exception.h"
+
+#include <cstdio>
+
+namespace fun {
+
+using internal::binary_log::RecordHeader;
+
+namespace {
+
+// Records handed to the sink per ring before moving to the next ring, so
+// one chatty thread does not starve the others.
+const int32 MAX_RECORDS_PER_PASS = 256;
+
+// How long the background thread sleeps when all rings are empty.
+const int32 IDLE_WAIT_MSECS = 2;
+
+std::atomic<uint64> next_logger_serial_(1);
+
+/**
+ * The rings of the current thread, one per BinaryLogger it logged to.
+ * Gives up the thread's reference on each ring when the thread exits.
+ */
+class ThreadRings {
+ public:
+  struct Entry {
+    uint64 logger_serial;
+    BinaryLogRing* ring;
+  };
+
+  ~ThreadRings() {
+    for (int32 i = 0; i < entries.Count(); ++i) {
+      if (entries[i].ring->Unref()) {
+        delete entries[i].ring;
+      }
+    }
+  }
+
+  Array<Entry> entries;
+};
+
+thread_local ThreadRings thread_rings_;
+
+uint32 RoundUpToPowerOfTwo(uint32 value) {
+  uint32 result = 4096;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+template <typename T>
+T ReadPayload(const char*& in) {
+  T value;
+  UnsafeMemory::Memcpy(&value, in, sizeof(value));
+  in += sizeof(value);
+  return value;
+}
+
+}  // namespace
+
+//
+// BinaryLogRing
+//
+
+BinaryLogRing::BinaryLogRing(uint32 capacity)
+    : capacity_(capacity),
+      mask_(capacity - 1),
+      tid_(0),
+      ref_count_(2),
+      dropped_count_(0),
+      write_pos_(0),
+      cached_read_pos_(0),
+      reserved_end_(0),
+      read_pos_(0),
+      flush_target_(0) {
+  fun_check((capacity & mask_) == 0);
+
+  buffer_ = static_cast<char*>(UnsafeMemory::Malloc(capacity, 64));
+  if (buffer_ == nullptr) {
+    throw OutOfMemoryException("cannot allocate log ring");
+  }
+  // Fault the pages in now rather than on the logging hot path.
+  UnsafeMemory::Memzero(buffer_, capacity);
+
+  if (Thread* current_thread = Thread::Current()) {
+    tid_ = current_thread->GetId();
+    thread_name_ = current_thread->GetName();
+  }
+}
+
+BinaryLogRing::~BinaryLogRing() { UnsafeMemory::Free(buffer_); }
+
+//
+// BinaryLogger::RecordFormatter
+//
+
+/**
+ * Turns binary records into LogMessages for the sink. Runs on the
+ * background thread only, and reuses its message and text buffer.
+ */
+class BinaryLogger::RecordFormatter {
+ public:
+  explicit RecordFormatter(BinaryLogger* logger)
+      : logger_(logger), ring_(nullptr) {
+    msg_.SetSource(logger_->source_);
+  }
+
+  void SetRing(BinaryLogRing* ring) { ring_ = ring; }
+
+  void operator()(const RecordHeader& header) {
+    const LogFormatDescriptor& descriptor = *header.descriptor;
+
+    text_.Truncate(0);
+    FormatText(descriptor.format,
+               reinterpret_cast<const char*>(&header + 1), header.arg_count,
+               text_);
+
+    msg_.SetText(text_);
+    msg_.SetLevel(descriptor.level);
+    msg_.SetTime(Timestamp(header.time));
+    msg_.SetThread(ring_->GetThreadName());
+    msg_.SetTid(ring_->GetTid());
+    msg_.SetSourceFile(descriptor.file);
+    msg_.SetSourceLine(descriptor.line);
+    logger_->sink_->Log(msg_);
+  }
+
+  static void FormatText(const char* format, const char* args,
+                         uint32 arg_count, String& out);
+
+ private:
+  static void AppendPadded(const char* str, int32 len, int32 width,
+                           bool left_align, String& out);
+
+  BinaryLogger* logger_;
+  BinaryLogRing* ring_;
+  LogMessage msg_;
+  String text_;
+};
+
+void BinaryLogger::RecordFormatter::AppendPadded(const char* str, int32 len,
+                                                 int32 width, bool left_align,
+                                                 String& out) {
+  const int32 padding = width > len ? width - len : 0;
+  if (padding > 0 && !left_align) {
+    out.Append(padding, ' ');
+  }
+  out.Append(str, len);
+  if (padding > 0 && left_align) {
+    out.Append(padding, ' ');
+  }
+}
+
+void BinaryLogger::RecordFormatter::FormatText(const char* format,
+                                               const char* args,
+                                               uint32 arg_count,
+                                               String& out) {
+  using namespace internal::binary_log;
+
+  const char* p = format;
+  uint32 arg_index = 0;
+  while (*p) {
+    const char* run = p;
+    while (*p && *p != '%') {
+      ++p;
+    }
+    if (p > run) {
+      out.Append(run, int32(p - run));
+    }
+    if (*p == 0) {
+      break;
+    }
+
+    if (p[1] == '%') {
+      out.Append('%');
+      p += 2;
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion
+    char spec[32];
+    int32 spec_len = 0;
+    spec[spec_len++] = *p++;
+
+    bool left_align = false;
+    while (*p && ::strchr("-+ #0", *p) && spec_len < 8) {
+      left_align |= *p == '-';
+      spec[spec_len++] = *p++;
+    }
+    int32 width = 0;
+    while (*p >= '0' && *p <= '9') {
+      width = width * 10 + (*p - '0');
+      if (spec_len < 16) {
+        spec[spec_len++] = *p;
+      }
+      ++p;
+    }
+    int32 precision = -1;
+    if (*p == '.') {
+      precision = 0;
+      spec[spec_len++] = *p++;
+      while (*p >= '0' && *p <= '9') {
+        precision = precision * 10 + (*p - '0');
+        if (spec_len < 24) {
+          spec[spec_len++] = *p;
+        }
+        ++p;
+      }
+    }
+    while (*p && ::strchr("hlLqjzt", *p)) {
+      ++p;
+    }
+    const char conversion = *p;
+    if (conversion) {
+      ++p;
+    }
+
+    if (arg_index >= arg_count) {
+      out.Append("<?>", 3);
+      continue;
+    }
+    ++arg_index;
+
+    char buffer[128];
+    int len = 0;
+    const ArgType type = ArgType(*args++);
+    switch (type) {
+      case ARG_INT64:
+      case ARG_UINT64: {
+        const uint64 value = ReadPayload<uint64>(args);
+        if (conversion == 'c') {
+          const char ch = char(value);
+          AppendPadded(&ch, 1, width, left_align, out);
+          break;
+        }
+        const bool is_unsigned_conversion =
+            conversion && ::strchr("uxXo", conversion);
+        char final_conversion = conversion;
+        if (!is_unsigned_conversion) {
+          final_conversion = type == ARG_INT64 ? 'd' : 'u';
+        }
+        spec[spec_len] = 'l';
+        spec[spec_len + 1] = 'l';
+        spec[spec_len + 2] = final_conversion;
+        spec[spec_len + 3] = 0;
+        if (type == ARG_INT64 && final_conversion == 'd') {
+          len = snprintf(buffer, sizeof(buffer), spec, (long long)value);
+        } else {
+          len = snprintf(buffer, sizeof(buffer), spec,
+                         (unsigned long long)value);
+        }
+        break;
+      }
+
+      case ARG_DOUBLE: {
+        const double value = ReadPayload<double>(args);
+        const bool is_float_conversion =
+            conversion && ::strchr("fFeEgGaA", conversion);
+        spec[spec_len] = is_float_conversion ? conversion : 'g';
+        spec[spec_len + 1] = 0;
+        len = snprintf(buffer, sizeof(buffer), spec, value);
+        break;
+      }
+
+      case ARG_BOOL: {
+        if (ReadPayload<uint8>(args)) {
+          AppendPadded("true", 4, width, left_align, out);
+        } else {
+          AppendPadded("false", 5, width, left_align, out);
+        }
+        break;
+      }
+
+      case ARG_CHAR: {
+        const char ch = ReadPayload<char>(args);
+        AppendPadded(&ch, 1, width, left_align, out);
+        break;
+      }
+
+      case ARG_POINTER: {
+        const uintptr_t value = ReadPayload<uintptr_t>(args);
+        len = snprintf(buffer, sizeof(buffer), "%p",
+                       reinterpret_cast<void*>(value));
+        break;
+      }
+
+      case ARG_STRING: {
+        const uint32 str_len = ReadPayload<uint32>(args);
+        int32 shown = int32(str_len);
+        if (precision >= 0 && precision < shown) {
+          shown = precision;
+        }
+        AppendPadded(args, shown, width, left_align, out);
+        args += str_len;
+        break;
+      }
+
+      default:
+        // Corrupt record; show what we have.
+        out.Append("<?>", 3);
+        return;
+    }
+
+    if (len > 0) {
+      out.Append(buffer, MathBase::Min(len, int(sizeof(buffer)) - 1));
+    }
+  }
+}
+
+//
+// BinaryLogger
+//
+
+BinaryLogger::BinaryLogger(const String& source, LogSink::Ptr sink,
+                           uint32 ring_capacity, FullPolicy full_policy)
+    : source_(source),
+      sink_(sink),
+      level_(LogLevel::Information),
+      ring_capacity_(RoundUpToPowerOfTwo(ring_capacity)),
+      full_policy_(full_policy),
+      serial_(next_logger_serial_.fetch_add(1)),
+      thread_("BinaryLogger"),
+      stopping_(false),
+      total_dropped_count_(0),
+      flush_requests_(0),
+      flushes_done_(0) {
+  if (!sink_) {
+    throw InvalidArgumentException("BinaryLogger requires a sink");
+  }
+  thread_.Start(*this);
+}
+
+BinaryLogger::~BinaryLogger() {
+  try {
+    stopping_.store(true);
+    wake_up_.Set();
+    thread_.Join();
+  } catch (...) {
+    fun_unexpected();
+  }
+
+  for (int32 i = 0; i < rings_.Count(); ++i) {
+    if (rings_[i]->Unref()) {
+      delete rings_[i];
+    }
+  }
+}
+
+BinaryLogRing* BinaryLogger::GetThreadRing() {
+  Array<ThreadRings::Entry>& entries = thread_rings_.entries;
+  for (int32 i = 0; i < entries.Count(); ++i) {
+    if (entries[i].logger_serial == serial_) {
+      return entries[i].ring;
+    }
+  }
+  return CreateThreadRing();
+}
+
+BinaryLogRing* BinaryLogger::CreateThreadRing() {
+  BinaryLogRing* ring = new BinaryLogRing(ring_capacity_);
+  {
+    ScopedLock<FastMutex> guard(rings_mutex_);
+    rings_.Add(ring);
+  }
+  thread_rings_.entries.Add(ThreadRings::Entry{serial_, ring});
+  return ring;
+}
+
+char* BinaryLogger::ReserveSlow(BinaryLogRing* ring, uint32 size) {
+  // A record over half the ring may never fit next to the wrap-around
+  // padding, so it is dropped rather than waited for.
+  if (full_policy_ == DROP_WHEN_FULL || size > ring->GetCapacity() / 2) {
+    ring->AddDropped();
+    return nullptr;
+  }
+
+  wake_up_.Set();
+  for (;;) {
+    Thread::Yield();
+    if (char* out = ring->TryReserve(size)) {
+      return out;
+    }
+  }
+}
+
+void BinaryLogger::Flush() {
+  const uint64 request = flush_requests_.fetch_add(1) + 1;
+  while (flushes_done_.load() < request) {
+    wake_up_.Set();
+    Thread::Sleep(1);
+  }
+}
+
+void BinaryLogger::ReportDropped(BinaryLogRing* ring) {
+  const int64 dropped = ring->TakeDroppedCount();
+  if (dropped == 0) {
+    return;
+  }
+  total_dropped_count_.fetch_add(dropped);
+
+  String text;
+  text << dropped << " log message(s) dropped, ring of "
+       << ring->GetThreadName() << " was full";
+  LogMessage msg(source_, text, LogLevel::Warning);
+  msg.SetThread(ring->GetThreadName());
+  msg.SetTid(ring->GetTid());
+  sink_->Log(msg);
+}
+
+int32 BinaryLogger::DrainRings(RecordFormatter& formatter) {
+  // Producers only take the lock to register a new ring.
+  ScopedLock<FastMutex> guard(rings_mutex_);
+
+  int32 count = 0;
+  for (int32 i = 0; i < rings_.Count(); ++i) {
+    BinaryLogRing* ring = rings_[i];
+    formatter.SetRing(ring);
+    count += ring->Consume(formatter, MAX_RECORDS_PER_PASS);
+    ReportDropped(ring);
+
+    // The writing thread is gone; nothing can be added any more.
+    if (ring->IsAbandoned() && ring->IsEmpty()) {
+      rings_.RemoveAt(i--);
+      if (ring->Unref()) {
+        delete ring;
+      }
+    }
+  }
+  return count;
+}
+
+void BinaryLogger::MarkFlushTargets() {
+  ScopedLock<FastMutex> guard(rings_mutex_);
+  for (int32 i = 0; i < rings_.Count(); ++i) {
+    rings_[i]->MarkFlushTarget();
+  }
+}
+
+bool BinaryLogger::ReachedFlushTargets() {
+  ScopedLock<FastMutex> guard(rings_mutex_);
+  for (int32 i = 0; i < rings_.Count(); ++i) {
+    if (!rings_[i]->ReachedFlushTarget()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BinaryLogger::Run() {
+  RecordFormatter formatter(this);
+  // The flush request the ring targets were marked for.
+  uint64 marked_request = 0;
+
+  while (!stopping_.load()) {
+    // The targets are taken after the request, so they cover everything
+    // committed before Flush() was called. Records written later do not
+    // hold the flush up.
+    if (marked_request == flushes_done_.load()) {
+      const uint64 flush_request = flush_requests_.load();
+      if (flush_request > marked_request) {
+        MarkFlushTargets();
+        marked_request = flush_request;
+      }
+    }
+
+    const int32 count = DrainRings(formatter);
+
+    if (marked_request > flushes_done_.load() && ReachedFlushTargets()) {
+      flushes_done_.store(marked_request);
+    }
+
+    if (count == 0) {
+      wake_up_.TryWait(IDLE_WAIT_MSECS);
+    }
+  }
+
+  while (DrainRings(formatter) > 0) {
+  }
+  flushes_done_.store(flush_requests_.load());
+}
+
+}  // namespace fun
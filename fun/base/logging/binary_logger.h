@@ -0,0 +1,462 @@
+#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/event.h"
+#include "fun/base/logging/log_level.h"
+#include "fun/base/logging/log_message.h"
+#include "fun/base/logging/log_sink.h"
+#include "fun/base/mutex.h"
+#include "fun/base/runnable.h"
+#include "fun/base/string/string.h"
+#include "fun/base/thread.h"
+#include "fun/base/timestamp.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace fun {
+
+/**
+ * Static part of a binary log statement, one per call site.
+ *
+ * Created by the fun_fast_* macros; its address is what identifies the
+ * statement in the binary record.
+ */
+struct LogFormatDescriptor {
+  LogLevel::Type level;
+  const char* format;
+  const char* file;
+  int32 line;
+};
+
+namespace internal {
+namespace binary_log {
+
+enum ArgType : uint8 {
+  ARG_INT64,
+  ARG_UINT64,
+  ARG_DOUBLE,
+  ARG_BOOL,
+  ARG_CHAR,
+  ARG_POINTER,
+  ARG_STRING,
+};
+
+/**
+ * Record layout in the ring (8-byte aligned):
+ *
+ *   RecordHeader | (ArgType tag, payload)* | padding
+ *
+ * A header whose size has PADDING_FLAG set only skips to the ring start.
+ */
+struct RecordHeader {
+  uint32 size;
+  uint32 arg_count;
+  const LogFormatDescriptor* descriptor;
+  Timestamp::TimeVal time;
+};
+
+const uint32 PADDING_FLAG = 0x80000000u;
+
+//
+// Encoded size and encoding of one argument.
+//
+
+#define FUN_BINARY_LOG_SCALAR_ARG(Type, Tag, Stored)                 \
+  FUN_ALWAYS_INLINE size_t ArgSize(Type) { return 1 + sizeof(Stored); } \
+  FUN_ALWAYS_INLINE char* PutArg(char* out, Type value) {             \
+    *out++ = char(Tag);                                               \
+    const Stored stored = Stored(value);                              \
+    UnsafeMemory::Memcpy(out, &stored, sizeof(stored));               \
+    return out + sizeof(stored);                                      \
+  }
+
+FUN_BINARY_LOG_SCALAR_ARG(signed char, ARG_INT64, int64)
+FUN_BINARY_LOG_SCALAR_ARG(short, ARG_INT64, int64)
+FUN_BINARY_LOG_SCALAR_ARG(int, ARG_INT64, int64)
+FUN_BINARY_LOG_SCALAR_ARG(long, ARG_INT64, int64)
+FUN_BINARY_LOG_SCALAR_ARG(long long, ARG_INT64, int64)
+FUN_BINARY_LOG_SCALAR_ARG(unsigned char, ARG_UINT64, uint64)
+FUN_BINARY_LOG_SCALAR_ARG(unsigned short, ARG_UINT64, uint64)
+FUN_BINARY_LOG_SCALAR_ARG(unsigned int, ARG_UINT64, uint64)
+FUN_BINARY_LOG_SCALAR_ARG(unsigned long, ARG_UINT64, uint64)
+FUN_BINARY_LOG_SCALAR_ARG(unsigned long long, ARG_UINT64, uint64)
+FUN_BINARY_LOG_SCALAR_ARG(float, ARG_DOUBLE, double)
+FUN_BINARY_LOG_SCALAR_ARG(double, ARG_DOUBLE, double)
+FUN_BINARY_LOG_SCALAR_ARG(bool, ARG_BOOL, uint8)
+FUN_BINARY_LOG_SCALAR_ARG(char, ARG_CHAR, char)
+FUN_BINARY_LOG_SCALAR_ARG(const void*, ARG_POINTER, uintptr_t)
+
+#undef FUN_BINARY_LOG_SCALAR_ARG
+
+FUN_ALWAYS_INLINE size_t StringArgSize(size_t len) {
+  return 1 + sizeof(uint32) + len;
+}
+
+FUN_ALWAYS_INLINE char* PutStringArg(char* out, const char* str,
+                                     uint32 len) {
+  *out++ = char(ARG_STRING);
+  UnsafeMemory::Memcpy(out, &len, sizeof(len));
+  out += sizeof(len);
+  UnsafeMemory::Memcpy(out, str, len);
+  return out + len;
+}
+
+// Strings are copied, the caller's buffer may be gone by the time the
+// record is formatted.
+
+FUN_ALWAYS_INLINE size_t ArgSize(const char* str) {
+  return StringArgSize(str ? ::strlen(str) : 0);
+}
+
+FUN_ALWAYS_INLINE char* PutArg(char* out, const char* str) {
+  return PutStringArg(out, str, str ? uint32(::strlen(str)) : 0);
+}
+
+FUN_ALWAYS_INLINE size_t ArgSize(const String& str) {
+  return StringArgSize(size_t(str.Len()));
+}
+
+FUN_ALWAYS_INLINE char* PutArg(char* out, const String& str) {
+  return PutStringArg(out, str.ConstData(), uint32(str.Len()));
+}
+
+FUN_ALWAYS_INLINE size_t ArgSize(const StringView& str) {
+  return StringArgSize(size_t(str.Len()));
+}
+
+FUN_ALWAYS_INLINE char* PutArg(char* out, const StringView& str) {
+  return PutStringArg(out, str.ConstData(), uint32(str.Len()));
+}
+
+FUN_ALWAYS_INLINE size_t ArgsSize() { return 0; }
+
+template <typename Arg, typename... Rest>
+FUN_ALWAYS_INLINE size_t ArgsSize(const Arg& arg, const Rest&... rest) {
+  return ArgSize(arg) + ArgsSize(rest...);
+}
+
+FUN_ALWAYS_INLINE char* PutArgs(char* out) { return out; }
+
+template <typename Arg, typename... Rest>
+FUN_ALWAYS_INLINE char* PutArgs(char* out, const Arg& arg,
+                                const Rest&... rest) {
+  return PutArgs(PutArg(out, arg), rest...);
+}
+
+}  // namespace binary_log
+}  // namespace internal
+
+/**
+ * Single-producer single-consumer byte ring holding the binary records of
+ * one thread.
+ *
+ * The producer reserves a contiguous span, fills it and commits it; a
+ * record never wraps around the end of the ring. Positions are
+ * monotonically increasing 64-bit counters, masked on access.
+ */
+class FUN_BASE_API BinaryLogRing : Noncopyable {
+ public:
+  explicit BinaryLogRing(uint32 capacity);
+  ~BinaryLogRing();
+
+  /**
+   * Producer only. Returns nullptr if size bytes are not free.
+   */
+  FUN_ALWAYS_INLINE char* TryReserve(uint32 size) {
+    const uint64 write_pos = write_pos_.load(std::memory_order_relaxed);
+    const uint32 offset = uint32(write_pos) & mask_;
+    const uint32 to_end = capacity_ - offset;
+    const uint32 needed = size <= to_end ? size : to_end + size;
+
+    if (write_pos + needed - cached_read_pos_ > capacity_) {
+      cached_read_pos_ = read_pos_.load(std::memory_order_acquire);
+      if (write_pos + needed - cached_read_pos_ > capacity_) {
+        return nullptr;
+      }
+    }
+
+    if (size > to_end) {
+      // Skip the tail; the consumer jumps over it.
+      reinterpret_cast<internal::binary_log::RecordHeader*>(buffer_ + offset)
+          ->size = to_end | internal::binary_log::PADDING_FLAG;
+      reserved_end_ = write_pos + to_end + size;
+      return buffer_;
+    }
+    reserved_end_ = write_pos + size;
+    return buffer_ + offset;
+  }
+
+  /**
+   * Producer only. Publishes the span returned by the last TryReserve().
+   */
+  FUN_ALWAYS_INLINE void Commit() {
+    write_pos_.store(reserved_end_, std::memory_order_release);
+  }
+
+  /**
+   * Consumer only. Calls handler(const RecordHeader&) for every committed
+   * record and frees its space. Returns the number of records handled.
+   */
+  template <typename Handler>
+  int32 Consume(Handler& handler, int32 max_records) {
+    using internal::binary_log::PADDING_FLAG;
+    using internal::binary_log::RecordHeader;
+
+    uint64 read_pos = read_pos_.load(std::memory_order_relaxed);
+    const uint64 write_pos = write_pos_.load(std::memory_order_acquire);
+    int32 count = 0;
+    while (read_pos < write_pos && count < max_records) {
+      const RecordHeader* header = reinterpret_cast<const RecordHeader*>(
+          buffer_ + (uint32(read_pos) & mask_));
+      if (header->size & PADDING_FLAG) {
+        read_pos += header->size & ~PADDING_FLAG;
+        continue;
+      }
+      handler(*header);
+      read_pos += header->size;
+      read_pos_.store(read_pos, std::memory_order_release);
+      ++count;
+    }
+    read_pos_.store(read_pos, std::memory_order_release);
+    return count;
+  }
+
+  bool IsEmpty() const {
+    return read_pos_.load(std::memory_order_acquire) ==
+           write_pos_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Consumer only. Remembers how far the producer has committed.
+   */
+  void MarkFlushTarget() {
+    flush_target_ = write_pos_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Consumer only. Returns true once everything committed before the last
+   * MarkFlushTarget() has been consumed.
+   */
+  bool ReachedFlushTarget() const {
+    return read_pos_.load(std::memory_order_relaxed) >= flush_target_;
+  }
+
+  uint32 GetCapacity() const { return capacity_; }
+
+  /**
+   * Writing-thread identity, captured when the ring is created.
+   */
+  const String& GetThreadName() const { return thread_name_; }
+  long GetTid() const { return tid_; }
+
+  void AddDropped() { dropped_count_.fetch_add(1, std::memory_order_relaxed); }
+
+  int64 TakeDroppedCount() {
+    return dropped_count_.exchange(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * One reference for the writing thread and one for the logger.
+   * Returns true if this was the last one.
+   */
+  bool Unref() { return ref_count_.fetch_sub(1) == 1; }
+
+  bool IsAbandoned() const { return ref_count_.load() == 1; }
+
+ private:
+  char* buffer_;
+  uint32 capacity_;
+  uint32 mask_;
+  String thread_name_;
+  long tid_;
+  std::atomic<int32> ref_count_;
+  std::atomic<int64> dropped_count_;
+
+  // Producer side.
+  alignas(64) std::atomic<uint64> write_pos_;
+  uint64 cached_read_pos_;
+  uint64 reserved_end_;
+
+  // Consumer side.
+  alignas(64) std::atomic<uint64> read_pos_;
+  uint64 flush_target_;
+};
+
+/**
+ * Low-latency logger that defers all formatting to a background thread.
+ *
+ * A log statement writes only a pointer to its static LogFormatDescriptor,
+ * a timestamp and the raw bytes of its arguments into a lock-free ring
+ * owned by the calling thread; no String, LogMessage or heap block is
+ * created on the hot path. The background thread turns each record into a
+ * LogMessage, expanding the printf-style format with the recorded
+ * arguments, and passes it to the sink. Use a FormattingSink with a
+ * PatternFormatter to lay out the lines:
+ *
+ *   BinaryLogger::Ptr log = new BinaryLogger("Game",
+ *       new FormattingSink(new PatternFormatter("%H:%M:%S.%i %p %s: %t"),
+ *                          new FileSink("game.log")));
+ *
+ *   fun_fast_information(*log, "player %lld moved to (%.1f, %.1f)",
+ *                        player_id, x, y);
+ *
+ * Conversions are applied by argument type, not by the conversion
+ * character: any integer conversion works for any integer type, strings
+ * need %s. Strings are copied into the record.
+ *
+ * When a thread's ring is full the policy decides: DROP discards the
+ * message and counts it (the count is reported to the sink as a warning),
+ * BLOCK waits until the background thread has made room. A record larger
+ * than half the ring capacity is always dropped and counted, whatever the
+ * policy; size the ring for the longest string arguments.
+ */
+class FUN_BASE_API BinaryLogger : public RefCountedObject, public Runnable {
+ public:
+  using Ptr = RefCountedPtr<BinaryLogger>;
+
+  enum FullPolicy {
+    DROP_WHEN_FULL,
+    BLOCK_WHEN_FULL,
+  };
+
+  enum { DEFAULT_RING_CAPACITY = 256 * 1024 };
+
+  /**
+   * Starts the background thread. ring_capacity is per writing thread and
+   * rounded up to a power of two.
+   */
+  BinaryLogger(const String& source, LogSink::Ptr sink,
+               uint32 ring_capacity = DEFAULT_RING_CAPACITY,
+               FullPolicy full_policy = DROP_WHEN_FULL);
+
+  const String& GetSource() const { return source_; }
+
+  void SetLevel(LogLevel::Type level) { level_ = level; }
+  LogLevel::Type GetLevel() const { return level_; }
+  bool IsEnabledFor(LogLevel::Type level) const { return level_ >= level; }
+
+  /**
+   * Writes one record. Normally called through the fun_fast_* macros.
+   */
+  template <typename... Args>
+  void Log(const LogFormatDescriptor& descriptor, const Args&... args);
+
+  /**
+   * Waits until everything logged before the call by any thread has been
+   * handed to the sink. Messages logged meanwhile do not delay it.
+   */
+  void Flush();
+
+  /**
+   * Messages dropped because a ring was full, since creation.
+   */
+  int64 GetDroppedCount() const { return total_dropped_count_.load(); }
+
+ protected:
+  /**
+   * Drains all rings and stops the background thread.
+   */
+  ~BinaryLogger();
+
+  // Runnable interface.
+  void Run() override;
+
+ private:
+  class RecordFormatter;
+
+  BinaryLogRing* GetThreadRing();
+  BinaryLogRing* CreateThreadRing();
+  char* ReserveSlow(BinaryLogRing* ring, uint32 size);
+  int32 DrainRings(RecordFormatter& formatter);
+  void MarkFlushTargets();
+  bool ReachedFlushTargets();
+  void ReportDropped(BinaryLogRing* ring);
+
+  String source_;
+  LogSink::Ptr sink_;
+  LogLevel::Type level_;
+  uint32 ring_capacity_;
+  FullPolicy full_policy_;
+  uint64 serial_;
+
+  FastMutex rings_mutex_;
+  Array<BinaryLogRing*> rings_;
+
+  Thread thread_;
+  Event wake_up_;
+  std::atomic<bool> stopping_;
+  std::atomic<int64> total_dropped_count_;
+  std::atomic<uint64> flush_requests_;
+  std::atomic<uint64> flushes_done_;
+};
+
+//
+// inlines
+//
+
+template <typename... Args>
+void BinaryLogger::Log(const LogFormatDescriptor& descriptor,
+                       const Args&... args) {
+  using internal::binary_log::RecordHeader;
+
+  const size_t payload_size = internal::binary_log::ArgsSize(args...);
+  const uint32 size =
+      uint32((sizeof(RecordHeader) + payload_size + 7) & ~size_t(7));
+
+  BinaryLogRing* ring = GetThreadRing();
+  char* out = ring->TryReserve(size);
+  if (out == nullptr) {
+    out = ReserveSlow(ring, size);
+    if (out == nullptr) {
+      return;
+    }
+  }
+
+  RecordHeader* header = reinterpret_cast<RecordHeader*>(out);
+  header->size = size;
+  header->arg_count = uint32(sizeof...(Args));
+  header->descriptor = &descriptor;
+  header->time = Timestamp().Raw();
+  internal::binary_log::PutArgs(out + sizeof(RecordHeader), args...);
+  ring->Commit();
+}
+
+//
+// Macros. The format must be a string literal or otherwise outlive the
+// logger; arguments are only evaluated if the level is enabled.
+//
+
+#define fun_fast_log(logger, lvl, fmt, ...)                              \
+  if ((logger).IsEnabledFor(lvl)) {                                      \
+    static const ::fun::LogFormatDescriptor fun_log_descriptor_ = {      \
+        (lvl), (fmt), __FILE__, __LINE__};                               \
+    (logger).Log(fun_log_descriptor_, ##__VA_ARGS__);                    \
+  } else                                                                 \
+    (void)0
+
+#define fun_fast_fatal(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Fatal, fmt, ##__VA_ARGS__)
+#define fun_fast_critical(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Critical, fmt, ##__VA_ARGS__)
+#define fun_fast_error(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Error, fmt, ##__VA_ARGS__)
+#define fun_fast_warning(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Warning, fmt, ##__VA_ARGS__)
+#define fun_fast_notice(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Notice, fmt, ##__VA_ARGS__)
+#define fun_fast_information(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Information, fmt, ##__VA_ARGS__)
+
+#if defined(_DEBUG) || defined(FUN_LOG_DEBUG)
+#define fun_fast_debug(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Debug, fmt, ##__VA_ARGS__)
+#define fun_fast_trace(logger, fmt, ...) \
+  fun_fast_log(logger, ::fun::LogLevel::Trace, fmt, ##__VA_ARGS__)
+#else
+#define fun_fast_debug(logger, fmt, ...)
+#define fun_fast_trace(logger, fmt, ...)
+#endif
+
+}  // namespace fun
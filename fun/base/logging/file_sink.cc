@@ -11,6 +11,7 @@
 //#include "fun/base/datetime_formatter.h"
 #include "fun/base/date_time.h"
 //#include "fun/base/local_datetime.h"
+#include "fun/base/error_handler.h"
 #include "fun/base/exception.h"
 
 namespace fun {
@@ -23,28 +24,37 @@ const String FileSink::PROP_COMPRESS = "Compress";
 const String FileSink::PROP_PURGE_AGE = "PurgeAge";
 const String FileSink::PROP_PURGE_COUNT = "PurgeCount";
 const String FileSink::PROP_FLUSH = "Flush";
+const String FileSink::PROP_FLUSH_INTERVAL = "FlushInterval";
 const String FileSink::PROP_ROTATE_ON_OPEN = "RotateOnOpen";
 
 FileSink::FileSink()
     : times_("utc"),
       compress_(false),
       flush_(true),
+      flush_interval_(1000),
       rotate_on_open_(false),
       log_file_(nullptr),
       rotate_strategy_(nullptr),
       archive_strategy_(new ArchiveByNumberStrategy),
-      purge_strategy_(nullptr) {}
+      purge_strategy_(nullptr),
+      thread_("FileSink"),
+      stopping_(false),
+      rotating_(false) {}
 
 FileSink::FileSink(const String& path)
     : path_(path),
       times_("utc"),
       compress_(false),
       flush_(true),
+      flush_interval_(1000),
       rotate_on_open_(false),
       log_file_(nullptr),
       rotate_strategy_(nullptr),
       archive_strategy_(new ArchiveByNumberStrategy),
-      purge_strategy_(nullptr) {}
+      purge_strategy_(nullptr),
+      thread_("FileSink"),
+      stopping_(false),
+      rotating_(false) {}
 
 FileSink::~FileSink() {
   try {
@@ -72,12 +82,28 @@ void FileSink::Open() {
         log_file_ = new LogFile(path_);
       }
     }
+
+    if (!thread_.IsRunning()) {
+      thread_.Start(*this);
+    }
   }
 }
 
 void FileSink::Close() {
+  {
+    ScopedLock<FastMutex> guard(mutex_);
+    stopping_ = true;
+  }
+
+  // The thread finishes a pending rotation before it exits.
+  if (thread_.IsRunning()) {
+    wakeup_.Set();
+    thread_.Join();
+  }
+
   ScopedLock<FastMutex> guard(mutex_);
 
+  stopping_ = false;
   delete log_file_;
   log_file_ = nullptr;
 }
@@ -87,26 +113,95 @@ void FileSink::Log(const LogMessage& msg) {
 
   ScopedLock<FastMutex> guard(mutex_);
 
+  if (rotating_) {
+    pending_lines_.Add(msg.GetText());
+    return;
+  }
+
   if (rotate_strategy_ && archive_strategy_ &&
       rotate_strategy_->MustRotate(log_file_)) {
+    // Hand the file over to the background thread.
+    rotating_ = true;
+    pending_lines_.Add(msg.GetText());
+    wakeup_.Set();
+    return;
+  }
+
+  log_file_->Write(msg.GetText(), flush_);
+}
+
+void FileSink::Run() {
+  bool stopping = false;
+  while (!stopping) {
+    wakeup_.TryWait(flush_interval_);
+
+    LogFile* file_to_rotate = nullptr;
+    {
+      ScopedLock<FastMutex> guard(mutex_);
+
+      stopping = stopping_;
+      if (rotating_) {
+        file_to_rotate = log_file_;
+      } else if (log_file_ && !flush_) {
+        try {
+          log_file_->Flush();
+        } catch (Exception& e) {
+          ErrorHandler::Handle(e);
+        }
+      }
+    }
+
+    if (file_to_rotate) {
+      Rotate(file_to_rotate);
+    }
+  }
+}
+
+void FileSink::Rotate(LogFile* file) {
+  // Log() leaves log_file_ alone while rotating_ is set, so the file can
+  // be archived without holding mutex_.
+  LogFile* new_file = nullptr;
+  {
+    ScopedLock<FastMutex> guard(archive_mutex_);
+
     try {
-      log_file_ = archive_strategy_->Archive(log_file_);
+      new_file = archive_strategy_->Archive(file);
       Purge();
     } catch (...) {
-      log_file_ = new LogFile(path_);
+      new_file = nullptr;
+    }
+  }
+
+  ScopedLock<FastMutex> guard(mutex_);
+
+  try {
+    if (!new_file) {
+      new_file = new LogFile(path_);
     }
+    log_file_ = new_file;
 
     // we must call MustRotate() again to give the
     // RotateByIntervalStrategy a chance to write its timestamp
     // to the new file.
     rotate_strategy_->MustRotate(log_file_);
+
+    for (int32 i = 0; i < pending_lines_.Count(); ++i) {
+      log_file_->Write(pending_lines_[i], false);
+    }
+    if (flush_) {
+      log_file_->Flush();
+    }
+  } catch (Exception& e) {
+    ErrorHandler::Handle(e);
   }
 
-  log_file_->Write(msg.GetText(), flush_);
+  pending_lines_.Clear();
+  rotating_ = false;
 }
 
 void FileSink::SetProperty(const String& name, const String& value) {
   ScopedLock<FastMutex> guard(mutex_);
+  ScopedLock<FastMutex> archive_guard(archive_mutex_);
 
   if (icompare(name, PROP_TIMES) == 0) {
     times_ = value;
@@ -132,6 +227,8 @@ void FileSink::SetProperty(const String& name, const String& value) {
     SetPurgeCount(value);
   } else if (icompare(name, PROP_FLUSH) == 0) {
     SetFlush(value);
+  } else if (icompare(name, PROP_FLUSH_INTERVAL) == 0) {
+    SetFlushInterval(value);
   } else if (icompare(name, PROP_ROTATE_ON_OPEN) == 0) {
     SetRotateOnOpen(value);
   } else {
@@ -156,6 +253,8 @@ String FileSink::GetProperty(const String& name) const {
     return purge_count_;
   } else if (icompare(name, PROP_FLUSH) == 0) {
     return String(flush_ ? "True" : "False");
+  } else if (icompare(name, PROP_FLUSH_INTERVAL) == 0) {
+    return String() << flush_interval_;
   } else if (icompare(name, PROP_ROTATE_ON_OPEN) == 0) {
     return String(rotate_on_open_ ? "True" : "False");
   } else {
@@ -292,6 +391,15 @@ void FileSink::SetFlush(const String& flush) {
   flush_ = icompare(flush, "True") == 0;
 }
 
+void FileSink::SetFlushInterval(const String& interval) {
+  bool ok = false;
+  const int32 milliseconds = interval.ToInt32(&ok);
+  if (!ok || milliseconds <= 0) {
+    throw InvalidArgumentException("FlushInterval", interval);
+  }
+  flush_interval_ = milliseconds;
+}
+
 void FileSink::SetRotateOnOpen(const String& rotate_on_open) {
   rotate_on_open_ = icompare(rotate_on_open, "True") == 0;
 }
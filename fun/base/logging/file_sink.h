@@ -3,7 +3,11 @@
 #include "fun/base/base.h"
 #include "fun/base/date_time.h"
 #include "fun/base/logging/log_sink.h"
+#include "fun/base/container/array.h"
+#include "fun/base/event.h"
 #include "fun/base/mutex.h"
+#include "fun/base/runnable.h"
+#include "fun/base/thread.h"
 #include "fun/base/timespan.h"
 
 #define FUN_WITH_FILE_SINK 1
@@ -17,7 +21,21 @@ class RotateStrategy;
 class ArchiveStrategy;
 class PurgeStrategy;
 
-class FUN_BASE_API FileSink : public LogSink {
+/**
+ * A sink that writes to a file, with optional rotation, archiving and
+ * purging of old files.
+ *
+ * With Flush set to "false", lines are collected in the write buffer of
+ * the file and written in large chunks when the buffer is full, and at
+ * least every FlushInterval milliseconds (default 1000) by a background
+ * thread.
+ *
+ * Rotation runs on the same background thread: the message that triggers
+ * it and any that arrive meanwhile are held in memory until the archived
+ * file has been replaced, so renaming, compressing and purging never
+ * stall the logging threads.
+ */
+class FUN_BASE_API FileSink : public LogSink, public Runnable {
   // FUN_DECLARE_RTCLASS(FileSink, LogSink)
 
  public:
@@ -44,6 +62,7 @@ class FUN_BASE_API FileSink : public LogSink {
   static const String PROP_PURGE_AGE;
   static const String PROP_PURGE_COUNT;
   static const String PROP_FLUSH;
+  static const String PROP_FLUSH_INTERVAL;
   static const String PROP_ROTATE_ON_OPEN;
 
  protected:
@@ -55,10 +74,18 @@ class FUN_BASE_API FileSink : public LogSink {
   void SetPurgeAge(const String& age);
   void SetPurgeCount(const String& count);
   void SetFlush(const String& flush);
+  void SetFlushInterval(const String& interval);
   void SetRotateOnOpen(const String& rotate_on_open);
   void Purge();
 
+  /**
+   * Background thread: flushes the file periodically and performs
+   * rotations requested by Log().
+   */
+  void Run() override;
+
  private:
+  void Rotate(LogFile* file);
   bool SetNoPurge(const String& value);
   int32 ExtractDigit(const String& value,
                      const char* next_to_digit = nullptr) const;
@@ -73,12 +100,23 @@ class FUN_BASE_API FileSink : public LogSink {
   String purge_age_;
   String purge_count_;
   bool flush_;
+  int32 flush_interval_;
   bool rotate_on_open_;
   LogFile* log_file_;
   RotateStrategy* rotate_strategy_;
   ArchiveStrategy* archive_strategy_;
   PurgeStrategy* purge_strategy_;
   FastMutex mutex_;
+
+  // Held while archiving and purging, and while the strategies change.
+  FastMutex archive_mutex_;
+  Thread thread_;
+  Event wakeup_;
+  bool stopping_;
+  // Set while the background thread archives log_file_. Lines logged in
+  // the meantime are kept in pending_lines_.
+  bool rotating_;
+  Array<String> pending_lines_;
 };
 
 }  // namespace fun
@@ -26,10 +26,31 @@ void FormattingSink::SetSink(LogSink::Ptr sink) { sink_ = sink; }
 
 LogSink::Ptr FormattingSink::GetSink() const { return sink_; }
 
+namespace {
+
+// Formatting buffer reused by every message logged on this thread. The
+// formatted message shares it only until the sink returns, so the buffer
+// keeps its capacity and formatting does not allocate in the steady state.
+thread_local String formatted_text;
+
+/**
+ * Empties the buffer without releasing its memory. Truncate() only keeps
+ * the allocation of a string with reserved capacity.
+ */
+FUN_ALWAYS_INLINE void ResetBuffer(String& buffer) {
+  if (buffer.Capacity() == 0) {
+    buffer.Reserve(256);
+  } else {
+    buffer.Truncate(0);
+  }
+}
+
+}  // namespace
+
 void FormattingSink::Log(const LogMessage& msg) {
   if (sink_) {
     if (formatter_) {
-      String formatted_text;
+      ResetBuffer(formatted_text);
       formatter_->Format(msg, formatted_text);
       sink_->Log(LogMessage(msg, formatted_text));
     } else {
@@ -19,7 +19,17 @@ class FUN_BASE_API LogFile : public LogFileImpl {
   LogFile(const String& path);
   ~LogFile();
 
+  /**
+   * Writes text and a line break. The line may stay in the write buffer
+   * until the next Flush() unless flush is true.
+   */
   void Write(const String& text, bool flush);
+
+  /**
+   * Hands all buffered lines to the operating system.
+   */
+  void Flush();
+
   uint64 GetSize() const;
   Timestamp GetCreationDate() const;
   const String GetPath() const;
@@ -33,6 +43,8 @@ FUN_ALWAYS_INLINE void LogFile::Write(const String& text, bool flush) {
   WriteImpl(text, flush);
 }
 
+FUN_ALWAYS_INLINE void LogFile::Flush() { FlushImpl(); }
+
 FUN_ALWAYS_INLINE uint64 LogFile::GetSize() const { return GetSizeImpl(); }
 
 FUN_ALWAYS_INLINE Timestamp LogFile::GetCreationDate() const {
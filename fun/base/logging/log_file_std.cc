@@ -3,14 +3,32 @@
 #include "fun/base/exception.h"
 #include "fun/base/file.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 namespace fun {
 
 LogFileImpl::LogFileImpl(const String& path)
-    : path_(path)
-// TODO
-//, str_(path_, std::ios::app)
-//, size_((uint64)str_.tellp())
-{
+    : path_(path), fd_(-1), buffer_(nullptr), buffer_length_(0), size_(0) {
+  fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw OpenFileException(path_);
+  }
+
+  struct stat st;
+  if (::fstat(fd_, &st) == 0) {
+    size_ = static_cast<uint64>(st.st_size);
+  }
+
+  buffer_ = static_cast<char*>(UnsafeMemory::Malloc(BUFFER_CAPACITY));
+  if (buffer_ == nullptr) {
+    ::close(fd_);
+    throw OutOfMemoryException("cannot allocate log file buffer");
+  }
+
   if (size_ == 0) {
     creation_date_ = File(path).GetLastModified();
   } else {
@@ -19,33 +37,75 @@ LogFileImpl::LogFileImpl(const String& path)
 }
 
 LogFileImpl::~LogFileImpl() {
-  // NOOP
+  try {
+    FlushImpl();
+  } catch (...) {
+    fun_unexpected();
+  }
+
+  ::close(fd_);
+  UnsafeMemory::Free(buffer_);
 }
 
 void LogFileImpl::WriteImpl(const String& text, bool flush) {
-  // TODO
-  // if (!str_.good()) {
-  //  str_.close();
-  //  str_.open(path_, std::ios::app);
-  //}
-  //
-  // if (!str_.good()) {
-  //  throw WriteFileException(path_);
-  //}
-  //
-  // str_ << text;
-  //
-  // if (flush) {
-  //  str_ << std::endl;
-  //} else {
-  //  str_ << "\n";
-  //}
-  //
-  // if (!str_.good()) {
-  //  throw WriteFileException(path_);
-  //}
-  //
-  // size_ = (uint64)str_.tellp();
+  const int32 line_length = text.Len() + 1;
+
+  if (buffer_length_ + line_length > BUFFER_CAPACITY) {
+    struct iovec iov[3];
+    iov[0].iov_base = buffer_;
+    iov[0].iov_len = buffer_length_;
+    iov[1].iov_base = const_cast<char*>(text.ConstData());
+    iov[1].iov_len = text.Len();
+    iov[2].iov_base = const_cast<char*>("\n");
+    iov[2].iov_len = 1;
+    buffer_length_ = 0;
+    WriteVector(iov, 3);
+  } else {
+    UnsafeMemory::Memcpy(buffer_ + buffer_length_, text.ConstData(),
+                         text.Len());
+    buffer_length_ += text.Len();
+    buffer_[buffer_length_++] = '\n';
+
+    if (flush) {
+      FlushImpl();
+    }
+  }
+
+  size_ += line_length;
+}
+
+void LogFileImpl::FlushImpl() {
+  if (buffer_length_ > 0) {
+    struct iovec iov;
+    iov.iov_base = buffer_;
+    iov.iov_len = buffer_length_;
+    buffer_length_ = 0;
+    WriteVector(&iov, 1);
+  }
+}
+
+void LogFileImpl::WriteVector(struct iovec* iov, int32 count) {
+  while (count > 0) {
+    const ssize_t written = ::writev(fd_, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw WriteFileException(path_);
+    }
+
+    // Skip what went out; a short write continues with the rest.
+    size_t remaining = static_cast<size_t>(written);
+    while (count > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
 }
 
 uint64 LogFileImpl::GetSizeImpl() const { return size_; }
@@ -4,8 +4,7 @@
 #include "fun/base/string/string.h"
 #include "fun/base/timestamp.h"
 
-// TODO 생짜로 하나 만들어보자!!
-//#include "fun/base/file_stream.h"
+struct iovec;
 
 namespace fun {
 
@@ -13,6 +12,11 @@ namespace fun {
  * The implementation of LogFile for non-Windows platforms.
  * The native filesystem APIs are used for
  * total control over locking behavior.
+ *
+ * Lines are collected in a write buffer and handed to the kernel in one
+ * write() when the buffer is full or a flush is requested. A line that
+ * does not fit goes out together with the buffered lines in a single
+ * writev(), so it is never copied.
  */
 class FUN_BASE_API LogFileImpl {
  public:
@@ -20,14 +24,21 @@ class FUN_BASE_API LogFileImpl {
   ~LogFileImpl();
 
   void WriteImpl(const String& text, bool flush);
+  void FlushImpl();
   uint64 GetSizeImpl() const;
   Timestamp GetCreationDateImpl() const;
   const String& GetPathImpl() const;
 
  private:
+  enum { BUFFER_CAPACITY = 64 * 1024 };
+
+  void WriteVector(struct iovec* iov, int32 count);
+
   String path_;
-  // TODO
-  // mutable FileOutputStream str_;
+  int fd_;
+  char* buffer_;
+  int32 buffer_length_;
+  // Includes buffered lines, so size based rotation sees them.
   uint64 size_;
   Timestamp creation_date_;
 };
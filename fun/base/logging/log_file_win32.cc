@@ -49,6 +49,10 @@ void LogFileImpl::WriteImpl(const String& text, bool flush) {
   }
 }
 
+void LogFileImpl::FlushImpl() {
+  // Lines are written unbuffered with WriteFile().
+}
+
 uint64 LogFileImpl::GetSizeImpl() const {
   if (INVALID_HANDLE_VALUE == file_handle_) {
     File file(path_);
@@ -19,6 +19,7 @@ class FUN_BASE_API LogFileImpl {
 
  public:
   void WriteImpl(const String& text, bool flush);
+  void FlushImpl();
   uint64 GetSizeImpl() const;
   Timestamp GetCreationDateImpl() const;
   const String& GetPathImpl() const;
@@ -16,207 +16,351 @@
 #include "fun/base/exception.h"
 #include "fun/base/str.h"
 
+#include <atomic>
+
 namespace fun {
 
 const String PatternFormatter::PROP_PATTERN = "Pattern";
 const String PatternFormatter::PROP_TIMES = "Times";
 const String PatternFormatter::PROP_LEVEL_NAMES = "LevelNames";
 
-PatternFormatter::PatternFormatter() : local_time_(false) {
+PatternFormatter::PatternFormatter()
+    : pattern_generation_(0), local_time_(false) {
   ParsePriorityNames();
 }
 
 PatternFormatter::PatternFormatter(const String& pattern)
-    : local_time_(false), pattern_(pattern) {
+    : pattern_generation_(0), local_time_(false), pattern_(pattern) {
   ParsePriorityNames();
   ParsePattern();
 }
 
 PatternFormatter::~PatternFormatter() {}
 
-void PatternFormatter::Format(const LogMessage& msg, String& text) {
-  Timestamp timestamp = msg.GetTime();
-  bool local_time = local_time_;
+namespace {
 
-  // TODO
-  // if (local_time) {
-  //  timestamp += Timezone::utcOffset()  * Timestamp::resolution();
-  //  timestamp += Timezone::dst()        * Timestamp::resolution();
-  //}
+/**
+ * Appends value right-aligned in a field of width characters.
+ */
+void AppendPadded(String& text, int32 value, int32 width, char pad) {
+  char digits[16];
+  int32 len = 0;
+  uint32 v = static_cast<uint32>(value < 0 ? 0 : value);
+  do {
+    digits[len++] = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  while (len < width) {
+    digits[len++] = pad;
+  }
+  while (len > 0) {
+    text.Append(digits[--len]);
+  }
+}
 
-  DateTime date_time(timestamp);
+/**
+ * Microseconds within the current second.
+ */
+FUN_ALWAYS_INLINE int32 GetSubsecondMicros(const LogMessage& msg) {
+  return static_cast<int32>(msg.GetTime().EpochMicroseconds() % 1000000);
+}
 
-  for (const auto& action : pattern_actions_) {
-    text.Append(action.prepend);
+// Source of the generation numbers, which tell the per-thread time caches
+// of different (or recompiled) patterns apart.
+std::atomic<uint64> next_pattern_generation(1);
 
-    switch (action.key) {
-      // message source
-      case 's':
-        text.Append(msg.GetSource());
-        break;
+struct TimeRunCache {
+  uint64 generation;
+  int32 first;
+  std::time_t second;
+  bool local_time;
+  String text;
 
-      // message text
-      case 't':
-        text.Append(msg.GetText());
-        break;
+  TimeRunCache() : generation(0), first(-1), second(0), local_time(false) {}
+};
 
-      // message priority level
-      case 'l':
-        text.AppendNumber(msg.GetLevel());
-        break;
+// A few slots, so that a thread alternating between two formatters (or a
+// pattern with two time runs) does not re-render on every message.
+const int32 TIME_RUN_CACHE_SLOTS = 4;
 
-      // message priority name
-      // (Fatal, Critical, Error, Warning, Notice, Information, Debug, Trace)
-      case 'p':
-        text.Append(GetLevelName(msg.GetLevel()));
-        break;
+thread_local TimeRunCache time_run_caches[TIME_RUN_CACHE_SLOTS];
 
-      // abbreviated message priority name
-      // (F, C, E, W, N, I, D, T)
-      case 'q':
-        text.Append(GetLevelName(msg.GetLevel()).First());
-        break;
+}  // namespace
 
-      // message process identifier (PID)
-      case 'P':
-        text.AppendNumber(static_cast<int64>(msg.GetPid()));
-        break;
+/**
+ * Emitters for the individual pattern keys. Message emitters read the
+ * LogMessage; time emitters only depend on the second of the message time
+ * and are run through the per-second cache.
+ */
+struct PatternEmitters {
+  typedef PatternFormatter::PatternAction PatternAction;
+
+  //
+  // Message emitters
+  //
+
+  // message source
+  static void Source(const PatternFormatter&, const PatternAction&,
+                     const LogMessage& msg, String& text) {
+    text.Append(msg.GetSource());
+  }
 
-      // message thread identifier (TID)
-      case 'I':
-        text.AppendNumber(static_cast<int64>(msg.GetTid()));
-        break;
+  // message text
+  static void Text(const PatternFormatter&, const PatternAction&,
+                   const LogMessage& msg, String& text) {
+    text.Append(msg.GetText());
+  }
 
-      // message thread name
-      case 'T':
-        text.Append(msg.GetThread());
-        break;
+  // message priority level
+  static void Level(const PatternFormatter&, const PatternAction&,
+                    const LogMessage& msg, String& text) {
+    text.AppendNumber(msg.GetLevel());
+  }
 
-      // message thread identifier (TID)
-      case 'O':
-        text.AppendNumber(msg.GetOsTid());
-        break;
+  // message priority name
+  // (Fatal, Critical, Error, Warning, Notice, Information, Debug, Trace)
+  static void LevelName(const PatternFormatter& formatter,
+                        const PatternAction&, const LogMessage& msg,
+                        String& text) {
+    fun_check(1 <= msg.GetLevel() && msg.GetLevel() < 9);
+    text.Append(formatter.levels_[msg.GetLevel()]);
+  }
 
-      // node or host name
-      case 'N':
-        text.Append(Environment::GetNodeName());
-        break;
+  // abbreviated message priority name
+  // (F, C, E, W, N, I, D, T)
+  static void ShortLevelName(const PatternFormatter& formatter,
+                             const PatternAction&, const LogMessage& msg,
+                             String& text) {
+    fun_check(1 <= msg.GetLevel() && msg.GetLevel() < 9);
+    text.Append(formatter.levels_[msg.GetLevel()].First());
+  }
 
-      // message source file path (empty string if not set)
-      case 'U':
-        text.Append(msg.GetSourceFile() ? msg.GetSourceFile() : "");
-        break;
+  // message process identifier (PID)
+  static void Pid(const PatternFormatter&, const PatternAction&,
+                  const LogMessage& msg, String& text) {
+    text.AppendNumber(static_cast<int64>(msg.GetPid()));
+  }
 
-      // message source line number (0 if not set)
-      case 'u':
-        text.AppendNumber(msg.GetSourceLine());
-        break;
+  // message thread identifier (TID)
+  static void Tid(const PatternFormatter&, const PatternAction&,
+                  const LogMessage& msg, String& text) {
+    text.AppendNumber(static_cast<int64>(msg.GetTid()));
+  }
 
-      // message date/time abbreviated weekday (Mon, Tue, ...)
-      case 'w':
-        text.Append(Date::GetShortDayName(date_time.DayOfWeek()));
-        break;
+  // message thread name
+  static void ThreadName(const PatternFormatter&, const PatternAction&,
+                         const LogMessage& msg, String& text) {
+    text.Append(msg.GetThread());
+  }
 
-      // message date/time full weekday (Monday, Tuesday, ...)
-      case 'W':
-        text.Append(Date::GetLongDayName(date_time.DayOfWeek()));
-        break;
+  // message thread OS identifier
+  static void OsTid(const PatternFormatter&, const PatternAction&,
+                    const LogMessage& msg, String& text) {
+    text.AppendNumber(msg.GetOsTid());
+  }
 
-      // message date/time abbreviated month (Jan, Feb, ...)
-      case 'b':
-        text.Append(Date::GetShortMonthName(date_time.Month()));
-        break;
+  // text resolved when the pattern was compiled (node name)
+  static void Resolved(const PatternFormatter&, const PatternAction& action,
+                       const LogMessage&, String& text) {
+    text.Append(action.property);
+  }
 
-      // message date/time full month (January, February, ...)
-      case 'B':
-        text.Append(Date::GetLongMonthName(date_time.Month()));
-        break;
+  // message source file path (empty string if not set)
+  static void SourceFile(const PatternFormatter&, const PatternAction&,
+                         const LogMessage& msg, String& text) {
+    text.Append(msg.GetSourceFile() ? msg.GetSourceFile() : "");
+  }
 
-      // message date/time zero-padded day of month (01 .. 31)
-      case 'd':
-        text.Appendf("{0:02d}", date_time.Day());
-        break;
+  // message source line number (0 if not set)
+  static void SourceLine(const PatternFormatter&, const PatternAction&,
+                         const LogMessage& msg, String& text) {
+    text.AppendNumber(msg.GetSourceLine());
+  }
 
-      // message date/time day of month (1 .. 31)
-      case 'e':
-        text.AppendNumber(date_time.Day());
-        break;
+  // message date/time millisecond (000 .. 999)
+  static void Millisecond(const PatternFormatter&, const PatternAction&,
+                          const LogMessage& msg, String& text) {
+    AppendPadded(text, GetSubsecondMicros(msg) / 1000, 3, '0');
+  }
 
-      // message date/time space-padded day of month ( 1 .. 31)
-      case 'f':
-        text.Appendf("{0:2d}", date_time.Day());
-        break;
+  // message date/time centisecond (0 .. 9)
+  static void Centisecond(const PatternFormatter&, const PatternAction&,
+                          const LogMessage& msg, String& text) {
+    AppendPadded(text, GetSubsecondMicros(msg) / 100000, 1, '0');
+  }
 
-      // message date/time zero-padded month (01 .. 12)
-      case 'm':
-        text.Appendf("{0:02d}", date_time.Month());
-        break;
+  // message date/time fractional seconds/microseconds (000000 - 999999)
+  static void Microsecond(const PatternFormatter&, const PatternAction&,
+                          const LogMessage& msg, String& text) {
+    AppendPadded(text, GetSubsecondMicros(msg), 6, '0');
+  }
 
-      // message date/time month (1 .. 12)
-      case 'n':
-        text.Appendf("{0:d}", date_time.Month());
-        break;
+  // epoch time (UTC, seconds since midnight, January 1, 1970)
+  static void EpochTime(const PatternFormatter&, const PatternAction&,
+                        const LogMessage& msg, String& text) {
+    text.AppendNumber(static_cast<int64>(msg.GetTime().EpochTime()));
+  }
 
-      // message date/time space-padded month ( 1 .. 12)
-      case 'o':
-        text.Appendf("{0:2d}", date_time.Month());
-        break;
+  // the message source (%s) but text length is padded/cropped to 'width'
+  static void PaddedSource(const PatternFormatter&,
+                           const PatternAction& action, const LogMessage& msg,
+                           String& text) {
+    const String& source = msg.GetSource();
+    if (action.length > source.Len()) {  // Append spaces
+      text.Append(source).Append(action.length - source.Len(), ' ');
+    } else if (action.length && action.length < source.Len()) {  // crop
+      text.Append(source.ConstData() + source.Len() - action.length,
+                  action.length);
+    } else {
+      text.Append(source);
+    }
+  }
 
-      // message date/time year without century (70)
-      case 'y':
-        text.Appendf("{0:02d}", date_time.Year() % 100);
-        break;
+  // %[property]
+  static void Property(const PatternFormatter&, const PatternAction& action,
+                       const LogMessage& msg, String& text) {
+    try {
+      text.Append(msg[action.property]);
+    } catch (...) {
+    }
+  }
 
-      // message date/time year with century (1970)
-      case 'Y':
-        text.Appendf("{0:4d}", date_time.Year());
-        break;
+  //
+  // Time emitters
+  //
 
-      // message date/time hour (00 .. 23)
-      case 'H':
-        text.Appendf("{0:02d}", date_time.Hour());
-        break;
+  // message date/time abbreviated weekday (Mon, Tue, ...)
+  static void ShortWeekday(const DateTime& date_time, String& text) {
+    text.Append(Date::GetShortDayName(date_time.DayOfWeek()));
+  }
 
-      // message date/time hour (00 .. 12)
-      case 'h':
-        text.Appendf("{0:02d}", date_time.HourAMPM());
-        break;
+  // message date/time full weekday (Monday, Tuesday, ...)
+  static void LongWeekday(const DateTime& date_time, String& text) {
+    text.Append(Date::GetLongDayName(date_time.DayOfWeek()));
+  }
 
-      // message date/time am/pm
-      case 'a':
-        text.Append(date_time.IsAM() ? "am" : "pm");
-        break;
+  // message date/time abbreviated month (Jan, Feb, ...)
+  static void ShortMonthName(const DateTime& date_time, String& text) {
+    text.Append(Date::GetShortMonthName(date_time.Month()));
+  }
 
-      // message date/time AM/PM
-      case 'A':
-        text.Append(date_time.IsAM() ? "AM" : "PM");
-        break;
+  // message date/time full month (January, February, ...)
+  static void LongMonthName(const DateTime& date_time, String& text) {
+    text.Append(Date::GetLongMonthName(date_time.Month()));
+  }
 
-      // message date/time minute (00 .. 59)
-      case 'M':
-        text.Appendf("{0:02d}", date_time.Minute());
-        break;
+  // message date/time zero-padded day of month (01 .. 31)
+  static void Day(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Day(), 2, '0');
+  }
 
-      // message date/time second (00 .. 59)
-      case 'S':
-        text.Appendf("{0:02d}", date_time.Second());
-        break;
+  // message date/time day of month (1 .. 31)
+  static void UnpaddedDay(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Day(), 1, ' ');
+  }
 
-      // message date/time millisecond (000 .. 999)
-      case 'i':
-        text.Appendf("{0:03d}", date_time.Millisecond());
-        break;
+  // message date/time space-padded day of month ( 1 .. 31)
+  static void SpacePaddedDay(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Day(), 2, ' ');
+  }
 
-      // message date/time centisecond (0 .. 9)
-      case 'c':
-        text.Appendf("{0}", date_time.Millisecond() / 100);
-        break;
+  // message date/time zero-padded month (01 .. 12)
+  static void Month(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Month(), 2, '0');
+  }
 
-      // message date/time fractional seconds/microseconds (000000 - 999999)
-      case 'F':
-        text.Appendf("{0:06d}",
-                     date_time.Millisecond() * 1000 + date_time.Microsecond());
-        break;
+  // message date/time month (1 .. 12)
+  static void UnpaddedMonth(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Month(), 1, ' ');
+  }
+
+  // message date/time space-padded month ( 1 .. 12)
+  static void SpacePaddedMonth(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Month(), 2, ' ');
+  }
+
+  // message date/time year without century (70)
+  static void ShortYear(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Year() % 100, 2, '0');
+  }
+
+  // message date/time year with century (1970)
+  static void Year(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Year(), 4, ' ');
+  }
+
+  // message date/time hour (00 .. 23)
+  static void Hour(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Hour(), 2, '0');
+  }
+
+  // message date/time hour (00 .. 12)
+  static void HourAMPM(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.HourAMPM(), 2, '0');
+  }
+
+  // message date/time am/pm
+  static void LowerAMPM(const DateTime& date_time, String& text) {
+    text.Append(date_time.IsAM() ? "am" : "pm");
+  }
+
+  // message date/time AM/PM
+  static void UpperAMPM(const DateTime& date_time, String& text) {
+    text.Append(date_time.IsAM() ? "AM" : "PM");
+  }
+
+  // message date/time minute (00 .. 59)
+  static void Minute(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Minute(), 2, '0');
+  }
+
+  // message date/time second (00 .. 59)
+  static void Second(const DateTime& date_time, String& text) {
+    AppendPadded(text, date_time.Second(), 2, '0');
+  }
+
+  static void Resolve(PatternAction& action) {
+    switch (action.key) {
+      case 's': action.emit_message = &Source; break;
+      case 't': action.emit_message = &Text; break;
+      case 'l': action.emit_message = &Level; break;
+      case 'p': action.emit_message = &LevelName; break;
+      case 'q': action.emit_message = &ShortLevelName; break;
+      case 'P': action.emit_message = &Pid; break;
+      case 'I': action.emit_message = &Tid; break;
+      case 'T': action.emit_message = &ThreadName; break;
+      case 'O': action.emit_message = &OsTid; break;
+      case 'N':
+        action.property = Environment::GetNodeName();
+        action.emit_message = &Resolved;
+        break;
+      case 'U': action.emit_message = &SourceFile; break;
+      case 'u': action.emit_message = &SourceLine; break;
+      case 'i': action.emit_message = &Millisecond; break;
+      case 'c': action.emit_message = &Centisecond; break;
+      case 'F': action.emit_message = &Microsecond; break;
+      case 'E': action.emit_message = &EpochTime; break;
+      case 'v': action.emit_message = &PaddedSource; break;
+      case 'x': action.emit_message = &Property; break;
+
+      case 'w': action.emit_time = &ShortWeekday; break;
+      case 'W': action.emit_time = &LongWeekday; break;
+      case 'b': action.emit_time = &ShortMonthName; break;
+      case 'B': action.emit_time = &LongMonthName; break;
+      case 'd': action.emit_time = &Day; break;
+      case 'e': action.emit_time = &UnpaddedDay; break;
+      case 'f': action.emit_time = &SpacePaddedDay; break;
+      case 'm': action.emit_time = &Month; break;
+      case 'n': action.emit_time = &UnpaddedMonth; break;
+      case 'o': action.emit_time = &SpacePaddedMonth; break;
+      case 'y': action.emit_time = &ShortYear; break;
+      case 'Y': action.emit_time = &Year; break;
+      case 'H': action.emit_time = &Hour; break;
+      case 'h': action.emit_time = &HourAMPM; break;
+      case 'a': action.emit_time = &LowerAMPM; break;
+      case 'A': action.emit_time = &UpperAMPM; break;
+      case 'M': action.emit_time = &Minute; break;
+      case 'S': action.emit_time = &Second; break;
 
       // TODO
       // time zone differential in ISO 8601 format (Z or +NN.NN)
@@ -232,46 +376,97 @@ void PatternFormatter::Format(const LogMessage& msg, String& text) {
 
       // convert time to local time
       // (must be specified before any date/time specifier;
-      //  does not itself output anything)
-      case 'L':
-        // TODO
-        // if (!local_time) {
-        //  local_time = true;
-        //  timestamp += Timezone::utcOffset() * Timestamp::resolution();
-        //  timestamp += Timezone::dst()       * Timestamp::resolution();
-        //  date_time = timestamp;
-        //}
-        break;
+      //  does not itself output anything, see CompilePattern())
+      case 'L': break;
 
-      // epoch time (UTC, seconds since midnight, January 1, 1970)
-      case 'E':
-        text.AppendNumber(static_cast<int64>(msg.GetTime().EpochTime()));
+      default:
+        // Literal text only.
         break;
+    }
+  }
+};
 
-      // the message source (%s) but text length is padded/cropped to 'width'
-      case 'v':
-        if (action.length > msg.GetSource().Len()) {  // Append spaces
-          text.Append(msg.GetSource())
-              .Append(action.length - msg.GetSource().Len(), ' ');
-        } else if (action.length &&
-                   action.length < msg.GetSource().Len()) {  // crop
-          // TODO
-          // text.Append(msg.GetSource(), msg.GetSource().Len() - action.length,
-          // action.length);
-        } else {
-          text.Append(msg.GetSource());
-        }
-        break;
+void PatternFormatter::Format(const LogMessage& msg, String& text) {
+  for (const auto& step : pattern_steps_) {
+    if (step.time_run) {
+      AppendTimeRun(step, msg.GetTime(), text);
+    } else {
+      const PatternAction& action = pattern_actions_[step.first];
+      text.Append(action.prepend);
+      if (action.emit_message) {
+        action.emit_message(*this, action, msg, text);
+      }
+    }
+  }
+}
 
-      // %[property]
-      case 'x':
-        try {
-          text.Append(msg[action.property]);
-        } catch (...) {
-        }
-        break;
+void PatternFormatter::AppendTimeRun(const PatternStep& step,
+                                     const Timestamp& timestamp,
+                                     String& text) const {
+  const std::time_t second = timestamp.EpochTime();
+  TimeRunCache& cache =
+      time_run_caches[(pattern_generation_ + step.first) %
+                      TIME_RUN_CACHE_SLOTS];
+
+  if (cache.generation != pattern_generation_ || cache.first != step.first ||
+      cache.second != second || cache.local_time != step.local_time) {
+    // Time runs only print whole seconds.
+    const DateTime date_time = DateTime::FromUtcTicksSinceEpoch(
+        static_cast<int64>(second) * DateTimeConstants::TICKS_PER_SECOND,
+        step.local_time ? TimeSpec::Local : TimeSpec::UTC);
+
+    if (cache.text.Capacity() == 0) {
+      // Reserved capacity survives Truncate().
+      cache.text.Reserve(64);
+    } else {
+      cache.text.Truncate(0);
+    }
+    for (int32 i = step.first; i < step.last; ++i) {
+      const PatternAction& action = pattern_actions_[i];
+      cache.text.Append(action.prepend);
+      action.emit_time(date_time, cache.text);
     }
+    cache.generation = pattern_generation_;
+    cache.first = step.first;
+    cache.second = second;
+    cache.local_time = step.local_time;
   }
+
+  // Copy rather than share, so the cache never has to detach.
+  text.Append(cache.text.ConstData(), cache.text.Len());
+}
+
+void PatternFormatter::CompilePattern() {
+  pattern_steps_.Clear();
+
+  for (int32 i = 0; i < pattern_actions_.Count(); ++i) {
+    PatternEmitters::Resolve(pattern_actions_[i]);
+  }
+
+  // %L switches every time run after it to local time.
+  bool local_time = local_time_;
+  for (int32 i = 0; i < pattern_actions_.Count();) {
+    if (pattern_actions_[i].key == 'L') {
+      local_time = true;
+    }
+
+    PatternStep step;
+    step.first = i;
+    step.time_run = pattern_actions_[i].emit_time != nullptr;
+    step.local_time = local_time;
+    if (step.time_run) {
+      while (i < pattern_actions_.Count() &&
+             pattern_actions_[i].emit_time != nullptr) {
+        ++i;
+      }
+    } else {
+      ++i;
+    }
+    step.last = i;
+    pattern_steps_.Add(step);
+  }
+
+  pattern_generation_ = next_pattern_generation.fetch_add(1);
 }
 
 void PatternFormatter::ParsePattern() {
@@ -332,6 +527,8 @@ void PatternFormatter::ParsePattern() {
   if (end_act.prepend.Len()) {
     pattern_actions_.Add(end_act);
   }
+
+  CompilePattern();
 }
 
 void PatternFormatter::SetProperty(const String& name, const String& value) {
@@ -340,6 +537,8 @@ void PatternFormatter::SetProperty(const String& name, const String& value) {
     ParsePattern();
   } else if (name == PROP_TIMES) {
     local_time_ = icompare(value, "Local") == 0;
+    // The time zone is resolved per step when the pattern is compiled.
+    CompilePattern();
   } else if (name == PROP_LEVEL_NAMES) {
     level_names_ = value;
     ParsePriorityNames();
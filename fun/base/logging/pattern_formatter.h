@@ -2,9 +2,12 @@
 #include "fun/base/container/array.h"
 #include "fun/base/logging/log_formatter.h"
 #include "fun/base/logging/log_message.h"
+#include "fun/base/timestamp.h"
 
 namespace fun {
 
+class DateTime;
+
 /**
  * This LogFormatter allows for custom formatting of
  * log messages based on format patterns.
@@ -57,6 +60,13 @@ namespace fun {
  * 'width'
  *   - %[name] : the value of the message parameter with the given name
  *   - %% : percent sign
+ *
+ * The pattern is compiled once, when it is set, into a list of emitters,
+ * so Format() does no parsing and no per-key dispatch. Consecutive fields
+ * that only change once a second (date, hour, minute, second, weekday...)
+ * together with the literal text between them are rendered once per second
+ * and per thread, and copied from that cache for every other message
+ * logged within the same second.
  */
 class FUN_BASE_API PatternFormatter : public LogFormatter {
  public:
@@ -121,13 +131,36 @@ class FUN_BASE_API PatternFormatter : public LogFormatter {
   const String& GetLevelName(LogLevel::Type level);
 
  private:
+  friend struct PatternEmitters;
+
+  struct PatternAction;
+
+  typedef void (*MessageEmitter)(const PatternFormatter& formatter,
+                                 const PatternAction& action,
+                                 const LogMessage& msg, String& text);
+  typedef void (*TimeEmitter)(const DateTime& date_time, String& text);
+
   struct PatternAction {
     char key;
     int32 length;
     String property;
     String prepend;
+    MessageEmitter emit_message;
+    TimeEmitter emit_time;
 
-    PatternAction() : key(0), length(0) {}
+    PatternAction()
+        : key(0), length(0), emit_message(nullptr), emit_time(nullptr) {}
+  };
+
+  /**
+   * One compiled step of the pattern: either a single action or a run of
+   * actions [first, last) whose output only changes once a second.
+   */
+  struct PatternStep {
+    int32 first;
+    int32 last;
+    bool time_run;
+    bool local_time;
   };
 
   /**
@@ -137,9 +170,24 @@ class FUN_BASE_API PatternFormatter : public LogFormatter {
    */
   void ParsePattern();
 
+  /**
+   * Resolves the emitter of every action and groups the actions into steps.
+   */
+  void CompilePattern();
+
+  /**
+   * Appends the output of a time run, rendering it only if the second of
+   * timestamp (or the time zone of the step) differs from the one cached
+   * for this thread.
+   */
+  void AppendTimeRun(const PatternStep& step, const Timestamp& timestamp,
+                     String& text) const;
+
   void ParsePriorityNames();
 
   Array<PatternAction> pattern_actions_;
+  Array<PatternStep> pattern_steps_;
+  uint64 pattern_generation_;
   bool local_time_;
   String pattern_;
   String level_names_;
@@ -1,5 +1,6 @@
 ﻿#include "fun/base/malloc_binned2.h"
 #include "HAL/MemoryMisc.h"
+#include "fun/base/caching_memory_pool.h"  // GetCurrentNumaNode
 //#include "HAL/PlatformAtomics.h"
 
 // TODO?
@@ -77,6 +78,13 @@ MemoryAllocatorBinned2::CPoolList::CPoolList() : front(nullptr) {}
 
 MemoryAllocatorBinned2::CPoolTable::CPoolTable() : block_size(0) {}
 
+MemoryAllocatorBinned2::CArena::CArena()
+    : free_pool_pages(nullptr),
+      numa_node(-1),
+      chunk_bytes(0),
+      used_pool_page_count(0),
+      free_pool_page_count(0) {}
+
 struct MemoryAllocatorBinned2::CPoolInfo {
   enum class ECanary : uint16 {
     Unassigned = 0x3941,
@@ -87,7 +95,10 @@ struct MemoryAllocatorBinned2::CPoolInfo {
   uint16 taken;  // Number of allocated elements in this pool, when counts down
                  // to zero can free the entire pool
   ECanary canary;                // See ECanary
-  uint32 alloc_size;             // Number of bytes allocated
+  union {
+    uint32 alloc_size;   // Number of bytes allocated, for OS allocations
+    uint32 arena_index;  // Arena of the pool, for pooled allocations
+  };
   CFreeBlock* first_free_block;  // Pointer to first free memory in this pool or
                                  // the OS Allocation size in bytes if this
                                  // allocation is not binned
@@ -358,8 +369,12 @@ struct MemoryAllocatorBinned2::Private {
     return nullptr;
   }
 
+  // Keyed by arena too: thread caches only hold blocks of their own
+  // arena, so a bundle never mixes arenas.
   struct CGlobalRecycler {
-    bool PushBundle(uint32 pool_index, CBundleNode* bundle) {
+    bool PushBundle(uint32 arena_index, uint32 pool_index,
+                    CBundleNode* bundle) {
+      CPaddedBundlePointer* Bundles = Arenas[arena_index];
       uint32 cahced_bundle_count = MathBase::Min<uint32>(
           GMallocBinned2MaxBundlesBeforeRecycle,
           BINNED2_MAX_GMallocBinned2MaxBundlesBeforeRecycle);
@@ -375,7 +390,8 @@ struct MemoryAllocatorBinned2::Private {
       return false;
     }
 
-    CBundleNode* PopBundle(uint32 pool_index) {
+    CBundleNode* PopBundle(uint32 arena_index, uint32 pool_index) {
+      CPaddedBundlePointer* Bundles = Arenas[arena_index];
       uint32 cahced_bundle_count = MathBase::Min<uint32>(
           GMallocBinned2MaxBundlesBeforeRecycle,
           BINNED2_MAX_GMallocBinned2MaxBundlesBeforeRecycle);
@@ -413,8 +429,9 @@ struct MemoryAllocatorBinned2::Private {
         sizeof(CPaddedBundlePointer) == PLATFORM_CACHE_LINE_SIZE,
         "CPaddedBundlePointer should be the same size as a cache line");
     MS_ALIGN(PLATFORM_CACHE_LINE_SIZE)
-    CPaddedBundlePointer Bundles[BINNED2_SMALL_POOL_COUNT] GCC_ALIGN(
-        PLATFORM_CACHE_LINE_SIZE);
+    CPaddedBundlePointer Arenas[BINNED2_MAX_ARENA_COUNT]
+                               [BINNED2_SMALL_POOL_COUNT] GCC_ALIGN(
+                                   PLATFORM_CACHE_LINE_SIZE);
   };
 
   static CGlobalRecycler GGlobalRecycler;
@@ -422,8 +439,6 @@ struct MemoryAllocatorBinned2::Private {
   static void free_bundles(MemoryAllocatorBinned2& allocator,
                            CBundleNode* bundles_to_recycle, uint32 block_size,
                            uint32 pool_index) {
-    CPoolTable& table = allocator.SmallPoolTables[pool_index];
-
     CBundleNode* bundle = bundles_to_recycle;
     while (bundle) {
       CBundleNode* next_bundle = bundle->next_bundle;
@@ -440,6 +455,12 @@ struct MemoryAllocatorBinned2::Private {
         }
         node_pool->CheckCanary(CPoolInfo::ECanary::FirstFreeBlockIsPtr);
 
+        // Blocks go back to the arena they came from, whichever thread
+        // frees them.
+        const int32 arena_index = node_pool->arena_index;
+        CPoolTable& table =
+            allocator.arenas_[arena_index].SmallPoolTables[pool_index];
+
         // If this pool was exhausted, move to available list.
         if (!node_pool->first_free_block) {
           table.ActivePools.LinkToFront(node_pool);
@@ -460,8 +481,7 @@ struct MemoryAllocatorBinned2::Private {
 
           // Free the OS memory.
           node_pool->Unlink();
-          allocator.CachedOSPageAllocator.Free(base_ptr_of_node,
-                                               allocator.PAGE_SIZE);
+          allocator.FreePoolPage(arena_index, base_ptr_of_node);
         }
 
         node = next_node;
@@ -498,29 +518,34 @@ void MemoryAllocatorBinned2::CPoolList::LinkToFront(CPoolInfo* pool) {
 
 MemoryAllocatorBinned2::CPoolInfo&
 MemoryAllocatorBinned2::CPoolList::PushNewPoolToFront(
-    MemoryAllocatorBinned2& allocator, uint32 block_size, uint32 pool_index) {
+    MemoryAllocatorBinned2& allocator, uint32 block_size, uint32 pool_index,
+    int32 arena_index) {
   const uint32 LocalPageSize = allocator.PAGE_SIZE;
 
   // Allocate memory.
-  CFreeBlock* free =
-      new (allocator.CachedOSPageAllocator.Allocate(LocalPageSize))
-          CFreeBlock(LocalPageSize, block_size, pool_index);
-  if (!free) {
+  void* page = allocator.AllocPoolPage(arena_index);
+  if (!page) {
     Private::OutOCMemory(LocalPageSize);
   }
+  CFreeBlock* free =
+      new (page) CFreeBlock(LocalPageSize, block_size, pool_index, arena_index);
   fun_check(IsAligned(free, LocalPageSize));
   // Create pool
   CPoolInfo* result = Private::GetOrCreatePoolInfo(
       allocator, free, CPoolInfo::ECanary::FirstFreeBlockIsPtr, false);
   result->Link(front);
   result->taken = 0;
+  result->arena_index = arena_index;
   result->first_free_block = free;
 
   return *result;
 }
 
-MemoryAllocatorBinned2::MemoryAllocatorBinned2()
-    : hash_bucket_free_list_(nullptr) {
+MemoryAllocatorBinned2::MemoryAllocatorBinned2(const Options& options)
+    : arena_count_(1),
+      options_(options),
+      use_chunks_(false),
+      hash_bucket_free_list_(nullptr) {
   static bool bOnce = false;
   fun_check(!bOnce);  // this is now a singleton-like thing and you cannot make
                       // multiple copies
@@ -573,7 +598,22 @@ MemoryAllocatorBinned2::MemoryAllocatorBinned2()
            TEXT("Small block size must be a multiple of "
                 "BINNED2_MINIMUM_ALIGNMENT"));
 
-    SmallPoolTables[index].BlockSize = SmallBlockSizes[index];
+    for (CArena& arena : arenas_) {
+      arena.SmallPoolTables[index].BlockSize = SmallBlockSizes[index];
+    }
+  }
+
+  // Set up arenas
+  use_chunks_ = options_.huge_pages != PlatformMemory::HugePageMode::None ||
+                options_.numa_arenas;
+  CHECKF(!use_chunks_ || BINNED2_ARENA_CHUNK_SIZE % PAGE_SIZE == 0,
+         TEXT("BINNED2_ARENA_CHUNK_SIZE must be a multiple of the page size"));
+  if (options_.numa_arenas) {
+    arena_count_ = MathBase::Min<int32>(internal::pool::GetNumaNodeCount(),
+                                        BINNED2_MAX_ARENA_COUNT);
+    for (int32 arena_index = 0; arena_index < arena_count_; ++arena_index) {
+      arenas_[arena_index].numa_node = arena_index;
+    }
   }
 
   // Set up pool mappings
@@ -637,17 +677,21 @@ void* MemoryAllocatorBinned2::MallocExternal(size_t size, uint32 alignment) {
       }
     }
 
+    // A thread cache is fed from its own arena only.
+    const int32 arena_index =
+        Lists ? (int32)Lists->arena_index : GetCurrentArenaIndex();
+
     CScopedLock guard(Mutex);
 
     // Allocate from small object pool.
-    CPoolTable& table = SmallPoolTables[pool_index];
+    CPoolTable& table = arenas_[arena_index].SmallPoolTables[pool_index];
 
     CPoolInfo* pool;
     if (!table.ActivePools.IsEmpty()) {
       pool = &table.ActivePools.GetFrontPool();
     } else {
       pool = &table.ActivePools.PushNewPoolToFront(*this, table.BlockSize,
-                                                   pool_index);
+                                                   pool_index, arena_index);
     }
 
     void* result = pool->AllocateRegularBlock();
@@ -776,11 +820,13 @@ void MemoryAllocatorBinned2::FreeExternal(void* ptr) {
     CPerThreadFreeBlockLists* Lists = GMallocBinned2PerThreadCaches
                                           ? CPerThreadFreeBlockLists::Get()
                                           : nullptr;
-    if (Lists) {
+    if (Lists && Lists->IsOwnArena(base_ptr)) {
       bundles_to_recycle = Lists->RecycleFullBundle(base_ptr->pool_index);
       bool bPushed = Lists->Free(ptr, pool_index, BlockSize);
       fun_check(bPushed);
     } else {
+      // No cache, or the block belongs to another arena: straight back to
+      // its pool.
       bundles_to_recycle = (CBundleNode*)ptr;
       bundles_to_recycle->next_node_in_current_bundle = nullptr;
     }
@@ -864,14 +910,91 @@ void MemoryAllocatorBinned2::CPoolList::ValidateExhaustedPools() {
 bool MemoryAllocatorBinned2::ValidateHeap() {
   CScopedLock guard(mutex_);
 
-  for (CPoolTable& table : SmallPoolTables) {
-    table.ActivePools.ValidateActivePools();
-    table.ExhaustedPools.ValidateExhaustedPools();
+  for (int32 arena_index = 0; arena_index < arena_count_; ++arena_index) {
+    for (CPoolTable& table : arenas_[arena_index].SmallPoolTables) {
+      table.ActivePools.ValidateActivePools();
+      table.ExhaustedPools.ValidateExhaustedPools();
+    }
   }
 
   return true;
 }
 
+int32 MemoryAllocatorBinned2::GetCurrentArenaIndex() const {
+  if (arena_count_ == 1) {
+    return 0;
+  }
+  return internal::pool::GetCurrentNumaNode() % arena_count_;
+}
+
+void* MemoryAllocatorBinned2::AllocPoolPage(int32 arena_index) {
+  CArena& arena = arenas_[arena_index];
+  if (!use_chunks_) {
+    void* page = CachedOSPageAllocator.Allocate(PAGE_SIZE);
+    if (page) {
+      ++arena.used_pool_page_count;
+    }
+    return page;
+  }
+
+  if (!arena.free_pool_pages) {
+    uint8* chunk = (uint8*)PlatformMemory::BinnedAllocHugeFromOS(
+        BINNED2_ARENA_CHUNK_SIZE, options_.huge_pages, arena.numa_node);
+    if (!chunk) {
+      return nullptr;
+    }
+    arena.chunk_bytes += BINNED2_ARENA_CHUNK_SIZE;
+
+    // Push in reverse so that pages are handed out in address order.
+    for (uint32 offset = BINNED2_ARENA_CHUNK_SIZE; offset != 0;) {
+      offset -= PAGE_SIZE;
+      void* page = chunk + offset;
+      *(void**)page = arena.free_pool_pages;
+      arena.free_pool_pages = page;
+      ++arena.free_pool_page_count;
+    }
+  }
+
+  void* page = arena.free_pool_pages;
+  arena.free_pool_pages = *(void**)page;
+  --arena.free_pool_page_count;
+  ++arena.used_pool_page_count;
+  return page;
+}
+
+void MemoryAllocatorBinned2::FreePoolPage(int32 arena_index, void* page) {
+  CArena& arena = arenas_[arena_index];
+  fun_check(arena.used_pool_page_count > 0);
+  --arena.used_pool_page_count;
+  if (!use_chunks_) {
+    CachedOSPageAllocator.Free(page, PAGE_SIZE);
+    return;
+  }
+
+  // Chunks are never returned to the OS; a partly used chunk would lose
+  // its huge page anyway.
+  *(void**)page = arena.free_pool_pages;
+  arena.free_pool_pages = page;
+  ++arena.free_pool_page_count;
+}
+
+void MemoryAllocatorBinned2::GetAllocatorStats(GenericMemoryStats& out_stats) {
+  CScopedLock guard(Mutex);
+
+  for (int32 arena_index = 0; arena_index < arena_count_; ++arena_index) {
+    const CArena& arena = arenas_[arena_index];
+    const int32 node = MathBase::Max(arena.numa_node, 0);
+    char desc[64];
+
+    snprintf(desc, sizeof(desc), "binned2.node%d.chunk_bytes", node);
+    out_stats.Add(desc, (size_t)arena.chunk_bytes);
+    snprintf(desc, sizeof(desc), "binned2.node%d.used_pool_bytes", node);
+    out_stats.Add(desc, (size_t)(arena.used_pool_page_count * PAGE_SIZE));
+    snprintf(desc, sizeof(desc), "binned2.node%d.free_pool_bytes", node);
+    out_stats.Add(desc, (size_t)(arena.free_pool_page_count * PAGE_SIZE));
+  }
+}
+
 const char* MemoryAllocatorBinned2::GetDescriptiveName() {
   return TEXT("binned2");
 }
@@ -924,7 +1047,7 @@ void MemoryAllocatorBinned2::SetupTlsCachesOnCurrentThread() {
     MemoryAllocatorBinned2::Binned2TlsSlot = CPlatformTLS::AllocTlsSlot();
   }
   fun_check(MemoryAllocatorBinned2::Binned2TlsSlot);
-  CPerThreadFreeBlockLists::SetTLS();
+  CPerThreadFreeBlockLists::SetTLS(GetCurrentArenaIndex());
 }
 
 void MemoryAllocatorBinned2::ClearAndDisableTlsCachesOnCurrentThread() {
@@ -932,11 +1055,13 @@ void MemoryAllocatorBinned2::ClearAndDisableTlsCachesOnCurrentThread() {
   CPerThreadFreeBlockLists::ClearTLS();
 }
 
-bool MemoryAllocatorBinned2::CFreeBlockList::ObtainPartial(uint32 pool_index) {
+bool MemoryAllocatorBinned2::CFreeBlockList::ObtainPartial(
+    uint32 pool_index, uint32 arena_index) {
   if (!PartialBundle.Head) {
     PartialBundle.Count = 0;
     PartialBundle.Head =
-        MemoryAllocatorBinned2::Private::GGlobalRecycler.PopBundle(pool_index);
+        MemoryAllocatorBinned2::Private::GGlobalRecycler.PopBundle(
+            arena_index, pool_index);
     if (PartialBundle.Head) {
       PartialBundle.Count = PartialBundle.Head->Count;
       PartialBundle.Head->next_bundle = nullptr;
@@ -948,12 +1073,13 @@ bool MemoryAllocatorBinned2::CFreeBlockList::ObtainPartial(uint32 pool_index) {
 }
 
 MemoryAllocatorBinned2::CBundleNode*
-MemoryAllocatorBinned2::CFreeBlockList::RecyleFull(uint32 pool_index) {
+MemoryAllocatorBinned2::CFreeBlockList::RecyleFull(uint32 pool_index,
+                                                   uint32 arena_index) {
   MemoryAllocatorBinned2::CBundleNode* result = nullptr;
   if (FullBundle.Head) {
     FullBundle.Head->Count = FullBundle.Count;
     if (!MemoryAllocatorBinned2::Private::GGlobalRecycler.PushBundle(
-            pool_index, FullBundle.Head)) {
+            arena_index, pool_index, FullBundle.Head)) {
       result = FullBundle.Head;
       result->next_bundle = nullptr;
     }
@@ -986,7 +1112,8 @@ MemoryAllocatorBinned2::CFreeBlockList::PopBundles(uint32 pool_index) {
   return result;
 }
 
-void MemoryAllocatorBinned2::CPerThreadFreeBlockLists::SetTLS() {
+void MemoryAllocatorBinned2::CPerThreadFreeBlockLists::SetTLS(
+    uint32 arena_index) {
   fun_check(MemoryAllocatorBinned2::Binned2TlsSlot);
   CPerThreadFreeBlockLists* ThreadSingleton =
       (CPerThreadFreeBlockLists*)CPlatformTLS::GetTlsValue(
@@ -996,6 +1123,7 @@ void MemoryAllocatorBinned2::CPerThreadFreeBlockLists::SetTLS() {
         Align(sizeof(CPerThreadFreeBlockLists),
               MemoryAllocatorBinned2::OsAllocationGranularity)))
         CPerThreadFreeBlockLists();
+    ThreadSingleton->arena_index = arena_index;
     CPlatformTLS::SetTlsValue(MemoryAllocatorBinned2::Binned2TlsSlot,
                               ThreadSingleton);
   }
@@ -23,6 +23,10 @@ namespace fun {
   (32768 - 16)  // Maximum block size in GMallocBinned2SmallBlockSizes
 #define BINNED2_SMALL_POOL_COUNT 45
 
+// Pool pages of arenas are carved from chunks of this size.
+#define BINNED2_ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+#define BINNED2_MAX_ARENA_COUNT 8
+
 #define DEFAULT_GMallocBinned2PerThreadCaches 1
 #define DEFAULT_GMallocBinned2LockFreeCaches 0
 #define DEFAULT_GMallocBinned2BundleSize BINNED2_LARGE_ALLOC
@@ -52,8 +56,38 @@ extern FUN_BASE_API int32 GMallocBinned2AllocExtra =
 
 /**
  * Optimized virtual memory allocator.
+ *
+ * By default pool pages come from the OS one at a time. With huge pages or
+ * NUMA arenas enabled (see Options), they are carved instead from 2MB
+ * chunks that are backed by huge pages and placed on a NUMA node; small
+ * blocks are then served from the arena of the node the calling thread
+ * runs on. Chunks are kept for the lifetime of the allocator.
+ *
+ * The caches keep the arenas apart as well. The header of every pool page
+ * records its arena; a thread cache belongs to the arena of the thread
+ * that set it up, and takes only blocks of that arena. A block freed by
+ * a thread of another node goes straight back to its own arena's pool,
+ * under the lock. Bundles are recycled per arena.
  */
 class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
+ public:
+  struct Options {
+    /** How to back the pool pages of small blocks. */
+    PlatformMemory::HugePageMode huge_pages;
+
+    /**
+     * Keeps a separate set of pools per NUMA node (up to
+     * BINNED2_MAX_ARENA_COUNT), with pages placed on that node. Threads
+     * should stay on their node: a thread cache keeps serving the arena
+     * it was set up on.
+     */
+    bool numa_arenas;
+
+    Options()
+        : huge_pages(PlatformMemory::HugePageMode::None), numa_arenas(false) {}
+  };
+
+ private:
   struct Private;
 
   // Forward declares.
@@ -64,12 +98,15 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
   struct CFreeBlock {
     enum { CANARY_VALUE = 0xe3 };
 
-    inline CFreeBlock(uint32 InPageSize, uint32 block_size, uint32 pool_index)
+    inline CFreeBlock(uint32 InPageSize, uint32 block_size, uint32 pool_index,
+                      uint32 arena_index)
         : BlockSize(block_size),
           pool_index(pool_index),
           canary(CANARY_VALUE),
+          arena_index(arena_index),
           NextFreeBlock(nullptr) {
       fun_check(pool_index < uint8_MAX && block_size <= uint16_MAX);
+      fun_check(InPageSize / block_size <= uint16_MAX);
       free_block_count = InPageSize / block_size;
       if (free_block_count * block_size + BINNED2_MINIMUM_ALIGNMENT >
           InPageSize) {
@@ -105,8 +142,9 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
     uint16 BlockSize;         // size of the blocks that this list points to
     uint8 pool_index;         // index of this pool
     uint8 canary;             // Constant value of 0xe3
-    uint32 free_block_count;  // Number of consecutive free blocks here, at
+    uint16 free_block_count;  // Number of consecutive free blocks here, at
                               // least 1.
+    uint8 arena_index;        // Arena of the pool, valid in the pool header
     void* NextFreeBlock;      // Next free block in another pool
   };
 
@@ -121,7 +159,8 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
     void LinkToFront(CPoolInfo* pool);
 
     CPoolInfo& PushNewPoolToFront(MemoryAllocatorBinned2& Allocator,
-                                  uint32 InBytes, uint32 pool_index);
+                                  uint32 InBytes, uint32 pool_index,
+                                  int32 arena_index);
 
     void ValidateActivePools();
     void ValidateExhaustedPools();
@@ -191,8 +230,25 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
 
   CPtrToPoolMapping PtrToPoolMapping;
 
-  // pool tables for different pool sizes
-  CPoolTable SmallPoolTables[BINNED2_SMALL_POOL_COUNT];
+  /** Pools of one NUMA node, or all pools without NUMA arenas. */
+  struct CArena {
+    // pool tables for different pool sizes
+    CPoolTable SmallPoolTables[BINNED2_SMALL_POOL_COUNT];
+
+    /** Unused pool pages of the chunks, linked through their first word. */
+    void* free_pool_pages;
+    int32 numa_node;
+    uint64 chunk_bytes;
+    uint64 used_pool_page_count;
+    uint64 free_pool_page_count;
+
+    CArena();
+  };
+
+  CArena arenas_[BINNED2_MAX_ARENA_COUNT];
+  int32 arena_count_;
+  Options options_;
+  bool use_chunks_;
 
   PoolHashBucket* hash_buckets_;
   PoolHashBucket* hash_bucket_free_list_;
@@ -285,8 +341,8 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
 
     // tries to recycle the full bundle, if that fails, it is returned for
     // freeing
-    CBundleNode* RecyleFull(uint32 pool_index);
-    bool ObtainPartial(uint32 pool_index);
+    CBundleNode* RecyleFull(uint32 pool_index, uint32 arena_index);
+    bool ObtainPartial(uint32 pool_index, uint32 arena_index);
     CBundleNode* PopBundles(uint32 pool_index);
 
    private:
@@ -302,7 +358,7 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
                  : nullptr;
     }
 
-    static void SetTLS();
+    static void SetTLS(uint32 arena_index);
 
     static void ClearTLS();
 
@@ -310,6 +366,11 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
       return FreeLists[pool_index].PopFromFront(pool_index);
     }
 
+    // return true if the block belongs to the arena of this cache
+    inline bool IsOwnArena(const CFreeBlock* pool_header) const {
+      return pool_header->arena_index == arena_index;
+    }
+
     // return true if the pointer was pushed
     inline bool Free(void* ptr, uint32 pool_index, uint32 block_size) {
       return FreeLists[pool_index].PushToFront(ptr, pool_index, block_size);
@@ -322,18 +383,21 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
 
     // returns a bundle that needs to be freed if it can't be recycled
     CBundleNode* RecycleFullBundle(uint32 pool_index) {
-      return FreeLists[pool_index].RecyleFull(pool_index);
+      return FreeLists[pool_index].RecyleFull(pool_index, arena_index);
     }
 
     // returns true if we have anything to pop
     bool ObtainRecycledPartial(uint32 pool_index) {
-      return FreeLists[pool_index].ObtainPartial(pool_index);
+      return FreeLists[pool_index].ObtainPartial(pool_index, arena_index);
     }
 
     CBundleNode* PopBundles(uint32 pool_index) {
       return FreeLists[pool_index].PopBundles(pool_index);
     }
 
+    // Arena whose blocks this cache holds.
+    uint32 arena_index;
+
    private:
     CFreeBlockList FreeLists[BINNED2_SMALL_POOL_COUNT];
   };
@@ -343,7 +407,7 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
   }
 
  public:
-  MemoryAllocatorBinned2();
+  explicit MemoryAllocatorBinned2(const Options& options = Options());
   virtual ~MemoryAllocatorBinned2();
 
   // MemoryAllocator interface.
@@ -390,7 +454,8 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
                new_size > PoolIndexToBlockSize(pool_index - 1))) {
             return ptr;
           }
-          bCanFree = bCanFree && Lists->CanFree(pool_index, BlockSize);
+          bCanFree = bCanFree && Lists->IsOwnArena(Free) &&
+                     Lists->CanFree(pool_index, BlockSize);
         }
         if (bCanFree) {
           void* result = new_size
@@ -420,7 +485,7 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
                                             : nullptr;
       if (Lists != nullptr) {
         CFreeBlock* base_ptr = GetPoolHeaderFromPointer(ptr);
-        if (base_ptr->IsCanaryOk() &&
+        if (base_ptr->IsCanaryOk() && Lists->IsOwnArena(base_ptr) &&
             Lists->Free(ptr, base_ptr->pool_index, base_ptr->block_size)) {
           return;
         }
@@ -460,6 +525,7 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
 
   bool ValidateHeap() override;
   void Trim() override;
+  void GetAllocatorStats(GenericMemoryStats& out_stats) override;
   void SetupTlsCachesOnCurrentThread() override;
   void ClearAndDisableTlsCachesOnCurrentThread() override;
   const char* GetDescriptiveName() override;
@@ -471,6 +537,11 @@ class FUN_BASE_API MemoryAllocatorBinned2 final : public MemoryAllocator {
   void FreeExternal(void* ptr);
   bool GetAllocationSizeExternal(void* ptr, size_t& out_allocation_size);
 
+  /** Arena of the NUMA node the calling thread runs on. */
+  int32 GetCurrentArenaIndex() const;
+  void* AllocPoolPage(int32 arena_index);
+  void FreePoolPage(int32 arena_index, void* page);
+
   static uint16 SmallBlockSizesReversed
       [BINNED2_SMALL_POOL_COUNT];  // this is reversed to get the smallest
                                    // elements on our main cache line
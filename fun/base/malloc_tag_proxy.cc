@@ -0,0 +1,138 @@
+﻿#include "fun/base/malloc_tag_proxy.h"
+#include "fun/base/memory_tag.h"
+
+namespace fun {
+
+namespace {
+
+/**
+ * Precedes every block handed out by the proxy.
+ */
+struct TagHeader {
+  enum { CANARY_VALUE = 0x7a };
+
+  // Requested size.
+  uint64 size;
+  // From the start of the inner block to the user block.
+  uint32 offset;
+  uint16 tag;
+  uint8 sampled;
+  uint8 canary;
+};
+
+static_assert(sizeof(TagHeader) == 16, "TagHeader must keep 16 byte alignment");
+
+FUN_ALWAYS_INLINE uint32 GetHeaderOffset(uint32 alignment) {
+  return MathBase::Max<uint32>(alignment, sizeof(TagHeader));
+}
+
+FUN_ALWAYS_INLINE TagHeader* GetHeader(void* ptr) {
+  TagHeader* header = static_cast<TagHeader*>(ptr) - 1;
+  fun_check(header->canary == TagHeader::CANARY_VALUE);
+  return header;
+}
+
+}  // namespace
+
+MemoryAllocatorTagProxy::MemoryAllocatorTagProxy(MemoryAllocator* malloc)
+    : inner_malloc_(malloc) {
+  fun_check_ptr(inner_malloc_);
+}
+
+void* MemoryAllocatorTagProxy::Malloc(size_t count, uint32 alignment) {
+  const uint32 offset = GetHeaderOffset(alignment);
+  uint8* raw = static_cast<uint8*>(inner_malloc_->Malloc(count + offset, alignment));
+  if (raw == nullptr) {
+    return nullptr;
+  }
+
+  void* ptr = raw + offset;
+  TagHeader* header = static_cast<TagHeader*>(ptr) - 1;
+  header->size = count;
+  header->offset = offset;
+  header->tag = MemoryTags::GetCurrent();
+  header->canary = TagHeader::CANARY_VALUE;
+  header->sampled = internal::memory_tag::OnAlloc(header->tag, count);
+  if (header->sampled) {
+    internal::memory_tag::AddSample(ptr, header->tag, count);
+  }
+  return ptr;
+}
+
+void* MemoryAllocatorTagProxy::Realloc(void* ptr, size_t new_count,
+                                       uint32 alignment) {
+  if (ptr == nullptr) {
+    return Malloc(new_count, alignment);
+  }
+  if (new_count == 0) {
+    Free(ptr);
+    return nullptr;
+  }
+
+  TagHeader* header = GetHeader(ptr);
+  const uint16 tag = header->tag;
+  const uint32 offset = header->offset;
+
+  if (offset != GetHeaderOffset(alignment)) {
+    // The header size changes with the alignment; move the block.
+    void* new_ptr;
+    {
+      ScopedMemoryTag scoped_tag(tag);
+      new_ptr = Malloc(new_count, alignment);
+    }
+    if (new_ptr) {
+      UnsafeMemory::Memcpy(new_ptr, ptr,
+                           MathBase::Min<size_t>(new_count, header->size));
+      Free(ptr);
+    }
+    return new_ptr;
+  }
+
+  // Removed before the block is released, as another thread may get the
+  // same address and sample it right away.
+  if (header->sampled) {
+    internal::memory_tag::RemoveSample(ptr);
+    header->sampled = 0;
+  }
+
+  const size_t old_count = header->size;
+  uint8* raw = static_cast<uint8*>(inner_malloc_->Realloc(
+      static_cast<uint8*>(ptr) - offset, new_count + offset, alignment));
+  if (raw == nullptr) {
+    return nullptr;
+  }
+
+  internal::memory_tag::OnFree(tag, old_count);
+
+  void* new_ptr = raw + offset;
+  header = static_cast<TagHeader*>(new_ptr) - 1;
+  header->size = new_count;
+  header->sampled = internal::memory_tag::OnAlloc(tag, new_count);
+  if (header->sampled) {
+    internal::memory_tag::AddSample(new_ptr, tag, new_count);
+  }
+  return new_ptr;
+}
+
+void MemoryAllocatorTagProxy::Free(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+
+  TagHeader* header = GetHeader(ptr);
+  if (header->sampled) {
+    internal::memory_tag::RemoveSample(ptr);
+  }
+  internal::memory_tag::OnFree(header->tag, header->size);
+
+  // Catches double frees.
+  header->canary = 0;
+  inner_malloc_->Free(static_cast<uint8*>(ptr) - header->offset);
+}
+
+size_t MemoryAllocatorTagProxy::QuantizeSize(size_t count, uint32 alignment) {
+  const uint32 offset = GetHeaderOffset(alignment);
+  return inner_malloc_->QuantizeSize(count + offset, alignment) - offset;
+}
+
+}  // namespace fun
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/memory_base.h"
+
+namespace fun {
+
+/**
+ * MemoryAllocator proxy that charges every allocation to the memory tag
+ * of the calling thread (see MemoryTags) and samples allocation stacks.
+ *
+ * Each block gets a 16 byte header (more for alignments above 16) that
+ * holds its tag and size, so a free is charged back without a lookup.
+ * The counters are per thread and need no lock; a lock is only taken for
+ * sampled allocations. Realloc keeps the tag of the block.
+ *
+ * Every block freed through the proxy must have been allocated through
+ * it, so it must be installed before the first allocation.
+ */
+class FUN_BASE_API MemoryAllocatorTagProxy : public MemoryAllocator {
+ public:
+  explicit MemoryAllocatorTagProxy(MemoryAllocator* malloc);
+
+  // MemoryAllocator interface
+
+  void* Malloc(size_t count, uint32 alignment) override;
+  void* Realloc(void* ptr, size_t new_count, uint32 alignment) override;
+  void Free(void* ptr) override;
+  size_t QuantizeSize(size_t count, uint32 alignment) override;
+
+  void Trim() override { inner_malloc_->Trim(); }
+
+  void SetupTlsCachesOnCurrentThread() override {
+    inner_malloc_->SetupTlsCachesOnCurrentThread();
+  }
+
+  void ClearAndDisableTlsCachesOnCurrentThread() override {
+    inner_malloc_->ClearAndDisableTlsCachesOnCurrentThread();
+  }
+
+  bool IsInternallyThreadSafe() const override {
+    return inner_malloc_->IsInternallyThreadSafe();
+  }
+
+  bool ValidateHeap() override { return inner_malloc_->ValidateHeap(); }
+
+  const char* GetAllocatorName() const override {
+    return inner_malloc_->GetAllocatorName();
+  }
+
+ private:
+  MemoryAllocator* inner_malloc_;
+};
+
+}  // namespace fun
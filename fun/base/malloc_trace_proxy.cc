@@ -0,0 +1,262 @@
+﻿#include "fun/base/malloc_trace_proxy.h"
+#include "fun/base/exception.h"
+#include "fun/base/file_helper.h"
+#include "fun/base/scoped_lock.h"
+
+#include <stdlib.h>
+#include <chrono>
+
+namespace fun {
+
+struct MemoryAllocatorTraceProxy::Buffer {
+  enum { CAPACITY = 4096 };
+
+  Buffer* next;
+  // Events recorded; written by the owning thread only.
+  std::atomic<int32> count;
+  // Set by the owning thread once it has moved on to a new buffer.
+  std::atomic<bool> retired;
+  // Events written to the file; guarded by write_mutex_.
+  int32 written;
+  MallocTraceEvent events[CAPACITY];
+};
+
+namespace {
+
+// Buffers retired before they are written out.
+const int32 MAX_FULL_BUFFER_COUNT = 8;
+
+struct ThreadTraceState {
+  MemoryAllocatorTraceProxy* proxy;
+  void* buffer;
+  uint16 thread_index;
+  // Set while the thread records, so that calls made by the proxy itself
+  // are not recorded.
+  bool recording;
+};
+
+thread_local ThreadTraceState thread_state;
+
+}  // namespace
+
+MemoryAllocatorTraceProxy::MemoryAllocatorTraceProxy(MemoryAllocator* malloc,
+                                                     const char* path)
+    : inner_malloc_(malloc),
+      start_ns_(0),
+      tracing_(false),
+      thread_count_(0),
+      full_buffer_count_(0),
+      buffers_(nullptr),
+      file_(nullptr),
+      written_event_count_(0) {
+  fun_check_ptr(inner_malloc_);
+
+  file_ = ::fopen(path, "wb");
+  if (file_ == nullptr) {
+    throw CreateFileException(path);
+  }
+
+  MallocTraceHeader header;
+  header.magic = MallocTraceHeader::MAGIC;
+  header.version = MallocTraceHeader::VERSION;
+  header.event_size = sizeof(MallocTraceEvent);
+  if (::fwrite(&header, sizeof(header), 1, file_) != 1) {
+    ::fclose(file_);
+    throw WriteFileException(path);
+  }
+
+  start_ns_ = Now();
+  tracing_ = true;
+}
+
+MemoryAllocatorTraceProxy::~MemoryAllocatorTraceProxy() {
+  StopTracing();
+  ::fclose(file_);
+
+  Buffer* buffer = buffers_.load();
+  while (buffer) {
+    Buffer* next = buffer->next;
+    ::free(buffer);
+    buffer = next;
+  }
+}
+
+void* MemoryAllocatorTraceProxy::Malloc(size_t count, uint32 alignment) {
+  void* result = inner_malloc_->Malloc(count, alignment);
+  if (tracing_.load(std::memory_order_relaxed)) {
+    Record(MallocTraceEvent::OP_MALLOC, Now(), result, nullptr, count,
+           alignment);
+  }
+  return result;
+}
+
+void* MemoryAllocatorTraceProxy::Realloc(void* ptr, size_t new_count,
+                                         uint32 alignment) {
+  // Stamped afterwards, like an allocation. If another thread gets the
+  // old block before the stamp, the replay sees the old address reused
+  // early and drops one of the two.
+  void* result = inner_malloc_->Realloc(ptr, new_count, alignment);
+  if (tracing_.load(std::memory_order_relaxed)) {
+    Record(MallocTraceEvent::OP_REALLOC, Now(), result, ptr, new_count,
+           alignment);
+  }
+  return result;
+}
+
+void MemoryAllocatorTraceProxy::Free(void* ptr) {
+  if (FUN_LIKELY(ptr)) {
+    if (tracing_.load(std::memory_order_relaxed)) {
+      Record(MallocTraceEvent::OP_FREE, Now(), ptr, nullptr, 0, 0);
+    }
+    inner_malloc_->Free(ptr);
+  }
+}
+
+void MemoryAllocatorTraceProxy::StopTracing() {
+  tracing_ = false;
+
+  ScopedLock<FastMutex> guard(write_mutex_);
+  WriteBuffers(true);
+  ::fflush(file_);
+}
+
+void MemoryAllocatorTraceProxy::Record(MallocTraceEvent::Op op,
+                                       uint64 time_ns, const void* ptr,
+                                       const void* old_ptr, size_t size,
+                                       uint32 alignment) {
+  ThreadTraceState& state = thread_state;
+  if (state.recording) {
+    return;
+  }
+  state.recording = true;
+
+  Buffer* buffer = GetBuffer();
+  if (buffer) {
+    const int32 index = buffer->count.load(std::memory_order_relaxed);
+    MallocTraceEvent& event = buffer->events[index];
+    event.time_ns = time_ns;
+    event.ptr = reinterpret_cast<UPTRINT>(ptr);
+    event.old_ptr = reinterpret_cast<UPTRINT>(old_ptr);
+    event.size = size;
+    event.alignment = alignment;
+    event.thread_index = state.thread_index;
+    event.op = (uint8)op;
+    event.reserved = 0;
+    buffer->count.store(index + 1, std::memory_order_release);
+  }
+
+  state.recording = false;
+}
+
+MemoryAllocatorTraceProxy::Buffer* MemoryAllocatorTraceProxy::GetBuffer() {
+  ThreadTraceState& state = thread_state;
+
+  Buffer* buffer = nullptr;
+  if (state.proxy == this) {
+    // Null if the thread's first buffer could not be allocated.
+    buffer = static_cast<Buffer*>(state.buffer);
+    if (buffer &&
+        buffer->count.load(std::memory_order_relaxed) < Buffer::CAPACITY) {
+      return buffer;
+    }
+  } else {
+    state.proxy = this;
+    state.thread_index = (uint16)thread_count_++;
+  }
+
+  Buffer* new_buffer = static_cast<Buffer*>(::malloc(sizeof(Buffer)));
+  if (new_buffer == nullptr) {
+    // Keep the full buffer; the event is dropped.
+    state.buffer = buffer;
+    return nullptr;
+  }
+  new_buffer->count = 0;
+  new_buffer->retired = false;
+  new_buffer->written = 0;
+  new_buffer->next = buffers_.load(std::memory_order_relaxed);
+  while (!buffers_.compare_exchange_weak(new_buffer->next, new_buffer)) {
+  }
+  state.buffer = new_buffer;
+
+  if (buffer) {
+    buffer->retired.store(true, std::memory_order_release);
+    if (++full_buffer_count_ >= MAX_FULL_BUFFER_COUNT &&
+        write_mutex_.TryLock()) {
+      WriteBuffers(false);
+      write_mutex_.Unlock();
+    }
+  }
+  return new_buffer;
+}
+
+uint64 MemoryAllocatorTraceProxy::Now() const {
+  return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+             .count() -
+         start_ns_;
+}
+
+void MemoryAllocatorTraceProxy::WriteBuffers(bool all) {
+  Buffer* head = buffers_.load(std::memory_order_acquire);
+  Buffer* prev = nullptr;
+  Buffer* buffer = head;
+  while (buffer) {
+    const bool retired = buffer->retired.load(std::memory_order_acquire);
+    if (retired || all) {
+      const int32 count = buffer->count.load(std::memory_order_acquire);
+      if (count > buffer->written) {
+        const size_t written =
+            ::fwrite(buffer->events + buffer->written,
+                     sizeof(MallocTraceEvent), count - buffer->written, file_);
+        written_event_count_ += written;
+        buffer->written += (int32)written;
+      }
+    }
+
+    // Only this function unlinks buffers, and never the head, which
+    // concurrent pushes replace.
+    Buffer* next = buffer->next;
+    if (retired && buffer->written == Buffer::CAPACITY && buffer != head) {
+      prev->next = next;
+      ::free(buffer);
+      --full_buffer_count_;
+    } else {
+      prev = buffer;
+    }
+    buffer = next;
+  }
+}
+
+void MemoryAllocatorTraceProxy::LoadTrace(
+    const char* path, Array<MallocTraceEvent>& out_events) {
+  Array<uint8> bytes;
+  if (!FileHelper::ReadAllBytes(bytes, path)) {
+    throw FileNotFoundException(path);
+  }
+
+  MallocTraceHeader header;
+  if (bytes.Count() < (int32)sizeof(header)) {
+    throw DataFormatException("truncated malloc trace", path);
+  }
+  UnsafeMemory::Memcpy(&header, bytes.ConstData(), sizeof(header));
+  if (header.magic != MallocTraceHeader::MAGIC ||
+      header.version != MallocTraceHeader::VERSION ||
+      header.event_size != sizeof(MallocTraceEvent)) {
+    throw DataFormatException("not a malloc trace", path);
+  }
+
+  // A trace cut short by a crash ends in a partial event; drop it.
+  const int32 event_count =
+      (int32)((bytes.Count() - sizeof(header)) / sizeof(MallocTraceEvent));
+  out_events.Reset();
+  out_events.AddUninitialized(event_count);
+  UnsafeMemory::Memcpy(out_events.MutableData(),
+                       bytes.ConstData() + sizeof(header),
+                       event_count * sizeof(MallocTraceEvent));
+  out_events.StableSort([](const MallocTraceEvent& a,
+                           const MallocTraceEvent& b) {
+    return a.time_ns < b.time_ns;
+  });
+}
+
+}  // namespace fun
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/memory_base.h"
+#include "fun/base/mutex.h"
+
+#include <stdio.h>
+#include <atomic>
+
+namespace fun {
+
+/**
+ * One recorded allocator call. Traces are files of these, after a
+ * MallocTraceHeader, in no particular order; sort them by time_ns.
+ */
+struct MallocTraceEvent {
+  enum Op { OP_MALLOC = 1, OP_FREE = 2, OP_REALLOC = 3 };
+
+  // Nanoseconds since tracing started. Frees are stamped before the memory
+  // is released and allocations after it was obtained, so an address
+  // is never reused before the event that released it.
+  uint64 time_ns;
+  // Returned (Malloc, Realloc) or released (Free) address.
+  uint64 ptr;
+  // Address passed to Realloc.
+  uint64 old_ptr;
+  uint64 size;
+  uint32 alignment;
+  // Index of the calling thread, in order of its first traced call.
+  uint16 thread_index;
+  uint8 op;
+  uint8 reserved;
+};
+
+struct MallocTraceHeader {
+  enum : uint64 { MAGIC = 0x31435254434C4D46ULL };  // "FMLCTRC1"
+  enum : uint32 { VERSION = 1 };
+
+  uint64 magic;
+  uint32 version;
+  uint32 event_size;
+};
+
+/**
+ * MemoryAllocator proxy that records every call into a trace file, for
+ * replaying the allocation pattern of a real server against other
+ * allocators (see examples/malloc_bench).
+ *
+ * Each thread appends to a buffer of its own, so tracing adds no lock to
+ * the allocation path; full buffers are written out by whichever thread
+ * fills one while no other thread is writing. The buffers come from the
+ * C runtime, not from the traced allocator, and calls the proxy makes
+ * itself are not traced.
+ *
+ * The proxy must outlive all threads that allocate through it.
+ */
+class FUN_BASE_API MemoryAllocatorTraceProxy : public MemoryAllocator {
+ public:
+  /**
+   * Starts tracing into the file at path. Throws CreateFileException if
+   * the file cannot be created.
+   */
+  MemoryAllocatorTraceProxy(MemoryAllocator* malloc, const char* path);
+  ~MemoryAllocatorTraceProxy();
+
+  // MemoryAllocator interface
+
+  void* Malloc(size_t count, uint32 alignment) override;
+  void* Realloc(void* ptr, size_t new_count, uint32 alignment) override;
+  void Free(void* ptr) override;
+
+  size_t QuantizeSize(size_t count, uint32 alignment) override {
+    return inner_malloc_->QuantizeSize(count, alignment);
+  }
+
+  void Trim() override { inner_malloc_->Trim(); }
+
+  void SetupTlsCachesOnCurrentThread() override {
+    inner_malloc_->SetupTlsCachesOnCurrentThread();
+  }
+
+  void ClearAndDisableTlsCachesOnCurrentThread() override {
+    inner_malloc_->ClearAndDisableTlsCachesOnCurrentThread();
+  }
+
+  bool IsInternallyThreadSafe() const override {
+    return inner_malloc_->IsInternallyThreadSafe();
+  }
+
+  bool ValidateHeap() override { return inner_malloc_->ValidateHeap(); }
+
+  const char* GetAllocatorName() const override {
+    return inner_malloc_->GetAllocatorName();
+  }
+
+  /**
+   * Stops recording and writes all recorded events out. Calls made after
+   * this are passed through only.
+   */
+  void StopTracing();
+
+  /**
+   * Returns the number of events written to the file so far.
+   */
+  int64 GetWrittenEventCount() const { return written_event_count_; }
+
+  /**
+   * Reads the trace at path into out_events, sorted by time. Throws
+   * FileNotFoundException or DataFormatException.
+   */
+  static void LoadTrace(const char* path, Array<MallocTraceEvent>& out_events);
+
+ private:
+  struct Buffer;
+
+  void Record(MallocTraceEvent::Op op, uint64 time_ns, const void* ptr,
+              const void* old_ptr, size_t size, uint32 alignment);
+  Buffer* GetBuffer();
+  uint64 Now() const;
+  void WriteBuffers(bool all);
+
+  MemoryAllocator* inner_malloc_;
+  uint64 start_ns_;
+  std::atomic<bool> tracing_;
+  std::atomic<int32> thread_count_;
+  std::atomic<int32> full_buffer_count_;
+  // All buffers, newest first; pushed lock-free, trimmed under
+  // write_mutex_.
+  std::atomic<Buffer*> buffers_;
+
+  FastMutex write_mutex_;
+  FILE* file_;
+  int64 written_event_count_;
+};
+
+}  // namespace fun
@@ -14,8 +14,32 @@
 #include "fun/base/malloc_poison_proxy.h"
 #endif
 
+#if defined(FUN_MALLOC_TAGS)
+#include "fun/base/malloc_tag_proxy.h"
+#endif
+
+#if defined(FUN_MALLOC_TRACE)
+#include "fun/base/malloc_trace_proxy.h"
+#include <stdlib.h>
+#endif
+
 namespace fun {
 
+#if defined(FUN_MALLOC_TRACE)
+namespace {
+
+MemoryAllocatorTraceProxy* global_trace_proxy = nullptr;
+
+// Events still sitting in the per-thread buffers would be lost at exit.
+void StopGlobalMallocTrace() {
+  if (global_trace_proxy) {
+    global_trace_proxy->StopTracing();
+  }
+}
+
+}  // namespace
+#endif
+
 MemoryAllocator* MemoryAllocator::GetGlobalMalloc() {
   static MemoryAllocator* global_malloc_instance = nullptr;
 
@@ -50,6 +74,23 @@ MemoryAllocator* MemoryAllocator::GetGlobalMalloc() {
   global_malloc_instance =
       new MemoryAllocatorPoisonProxy(global_malloc_instance);
 #endif
+
+#if defined(FUN_MALLOC_TAGS)
+  // Per-subsystem accounting, see MemoryTags.
+  global_malloc_instance = new MemoryAllocatorTagProxy(global_malloc_instance);
+#endif
+
+#if defined(FUN_MALLOC_TRACE)
+  // Records the allocations of the whole process for
+  // examples/malloc_bench; the file is named by FUN_MALLOC_TRACE_FILE.
+  {
+    const char* trace_path = ::getenv("FUN_MALLOC_TRACE_FILE");
+    global_trace_proxy = new MemoryAllocatorTraceProxy(
+        global_malloc_instance, trace_path ? trace_path : "malloc.trace");
+    global_malloc_instance = global_trace_proxy;
+    ::atexit(&StopGlobalMallocTrace);
+  }
+#endif
 }
 
 //응급상황에서 사용하는??
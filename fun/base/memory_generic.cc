@@ -192,6 +192,12 @@ void* CGenericPlatformMemory::BinnedAllocFromOS(size_t Size) {
   return nullptr;
 }
 
+void* CGenericPlatformMemory::BinnedAllocHugeFromOS(size_t size,
+                                                   HugePageMode mode,
+                                                   int32 numa_node) {
+  return nullptr;
+}
+
 void CGenericPlatformMemory::BinnedFreeToOS(void* Ptr, size_t Size) {
   LOG(LogMemory, Error,
       TEXT("CGenericPlatformMemory::BinnedFreeToOS not implemented on this "
@@ -263,6 +263,34 @@ struct FUN_BASE_API CGenericPlatformMemory {
    */
   static void BinnedFreeToOS(void* Ptr, size_t size);
 
+  /** How BinnedAllocHugeFromOS backs its pages. */
+  enum class HugePageMode {
+    /** Regular pages. */
+    None,
+    /** Transparent huge pages, requested with madvise(). */
+    Transparent,
+    /**
+     * Pages of the hugetlbfs pool, which must have been reserved by the
+     * administrator; falls back to Transparent if none are free.
+     */
+    HugeTlb
+  };
+
+  enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+  /**
+   * Allocates pages from the OS, aligned to HUGE_PAGE_SIZE.
+   *
+   * @param size - size to allocate, a multiple of HUGE_PAGE_SIZE
+   * @param mode - how to back the pages
+   * @param numa_node - NUMA node to place the pages on if possible, or -1
+   *
+   * @return OS allocated pointer, to be freed with BinnedFreeToOS, or
+   * nullptr if the platform does not support this.
+   */
+  static void* BinnedAllocHugeFromOS(size_t size, HugePageMode mode,
+                                     int32 numa_node);
+
   // These alloc/free memory that is mapped to the GPU
   // Only for platforms with UMA (XB1/PS4/etc)
   static void* GPUMalloc(size_t Count, uint32 Alignment = 0) {
@@ -5,6 +5,7 @@
 #include <sys/sysinfo.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h> // sysconf
 
 namespace fun {
@@ -119,6 +120,57 @@ void* LinuxMemory::BinnedAllocFromOS(size_t Size) {
   return mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 }
 
+void* LinuxMemory::BinnedAllocHugeFromOS(size_t size, HugePageMode mode, int32 numa_node) {
+  fun_check(size % HUGE_PAGE_SIZE == 0);
+
+  void* ptr = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+  if (mode == HugePageMode::HugeTlb) {
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+  }
+#endif
+
+  if (ptr == MAP_FAILED) {
+    // Transparent huge pages only back aligned 2MB ranges, so map more and
+    // trim the range to a huge page boundary.
+    const size_t mapped_size = size + HUGE_PAGE_SIZE;
+    uint8* mapped = (uint8*)mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (mapped == MAP_FAILED) {
+      return nullptr;
+    }
+    uint8* aligned = Align(mapped, HUGE_PAGE_SIZE);
+    if (aligned != mapped) {
+      munmap(mapped, aligned - mapped);
+    }
+    const size_t tail_size = (mapped + mapped_size) - (aligned + size);
+    if (tail_size > 0) {
+      munmap(aligned + size, tail_size);
+    }
+    ptr = aligned;
+
+#if defined(MADV_HUGEPAGE)
+    if (mode != HugePageMode::None) {
+      // Fails harmlessly if THP is disabled.
+      madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+#if defined(SYS_mbind)
+  if (numa_node >= 0) {
+    // mbind() without libnuma. Preferred rather than bound, so that a full
+    // node falls back to the others instead of failing.
+    const int kMpolPreferred = 1;
+    unsigned long node_mask[4] = {0};
+    if (numa_node < (int32)(sizeof(node_mask) * 8)) {
+      node_mask[numa_node / (sizeof(unsigned long) * 8)] |= 1UL << (numa_node % (sizeof(unsigned long) * 8));
+      syscall(SYS_mbind, ptr, size, kMpolPreferred, node_mask, sizeof(node_mask) * 8, 0);
+    }
+  }
+#endif
+  return ptr;
+}
+
 void LinuxMemory::BinnedFreeToOS(void* ptr, size_t Size) {
   if (munmap(ptr, Size) != 0) {
     const int err = errno;
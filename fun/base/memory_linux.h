@@ -47,6 +47,7 @@ struct FUN_BASE_API LinuxMemory : public CGenericPlatformMemory {
   static bool PageProtect(void* const Ptr, const size_t Size, const bool can_read, const bool can_write);
   static void* BinnedAllocFromOS(size_t Size);
   static void BinnedFreeToOS(void* Ptr);
+  static void* BinnedAllocHugeFromOS(size_t size, HugePageMode mode, int32 numa_node);
   static CSharedMemoryRegion* MapNamedSharedMemoryRegion(const string& InName, bool bCreate, uint32 AccessMode, size_t Size);
   static bool UnmapNamedSharedMemoryRegion(CSharedMemoryRegion* MemoryRegion);
 };
@@ -0,0 +1,602 @@
+﻿#include "fun/base/memory_tag.h"
+#include "fun/base/clock.h"
+#include "fun/base/container/map.h"
+#include "fun/base/exception.h"
+#include "fun/base/metrics.h"
+#include "fun/base/mutex.h"
+#include "fun/base/scoped_lock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <cmath>
+
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+#include <execinfo.h>
+#endif
+
+namespace fun {
+
+namespace internal {
+namespace memory_tag {
+
+struct TagCounters {
+  std::atomic<int64> live_bytes;
+  std::atomic<int64> live_count;
+  std::atomic<int64> alloc_count;
+  std::atomic<int64> alloc_bytes;
+};
+
+/**
+ * Counters of one thread for all tags. The cell of an exited thread is
+ * handed to the next new thread; its counts stay part of the sums, so no
+ * thread's counts are ever lost or moved.
+ */
+struct ThreadCell {
+  TagCounters counters[MemoryTags::MAX_TAG_COUNT];
+  ThreadCell* next;
+  ThreadCell* next_free;
+};
+
+struct Sample {
+  uint16 tag;
+  int32 depth;
+  uint64 frames[MemoryTagSnapshot::StackStats::MAX_DEPTH];
+  // Bytes and blocks of live memory the sample stands for.
+  int64 weight_bytes;
+  int64 weight_count;
+};
+
+const int64 DEFAULT_SAMPLE_INTERVAL = 512 * 1024;
+
+// While sampling is disabled, threads look for it to be enabled again
+// after this many bytes.
+const int64 DISABLED_SAMPLE_RECHECK = 16 * 1024 * 1024;
+
+// Frames of the profiler itself at the top of a captured stack.
+const int32 SKIPPED_FRAME_COUNT = 3;
+
+struct Registry {
+  Registry() : tag_count(2), cells(nullptr), free_cells(nullptr) {
+    UnsafeMemory::Memzero(names, sizeof(names));
+    UnsafeMemory::Memzero(&orphan, sizeof(orphan));
+    ::strcpy(names[MemoryTags::UNTAGGED], "untagged");
+    ::strcpy(names[MemoryTags::PROFILER], "memory_profiler");
+    sample_interval = DEFAULT_SAMPLE_INTERVAL;
+  }
+
+  // Guards registration and the cell lists.
+  FastMutex mutex;
+  char names[MemoryTags::MAX_TAG_COUNT][MemoryTags::MAX_NAME_LENGTH + 1];
+  std::atomic<int32> tag_count;
+  ThreadCell* cells;
+  ThreadCell* free_cells;
+  // Counts of calls made while a thread exits, after its cell is gone.
+  TagCounters orphan;
+
+  std::atomic<int64> sample_interval;
+  FastMutex sample_mutex;
+  Map<const void*, Sample> samples;
+};
+
+Registry& GetRegistry() {
+  // Never destroyed: allocations are freed during static destruction too.
+  static Registry* registry = new (::malloc(sizeof(Registry))) Registry();
+  return *registry;
+}
+
+FUN_ALWAYS_INLINE void AddToOwnCell(std::atomic<int64>& cell, int64 n) {
+  cell.store(cell.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+thread_local uint16 current_tag = MemoryTags::UNTAGGED;
+
+struct ThreadState {
+  ThreadState()
+      : cell(nullptr),
+        exited(false),
+        in_profiler(false),
+        bytes_until_sample(0),
+        random_state(0) {}
+
+  ~ThreadState() {
+    if (cell) {
+      Registry& registry = GetRegistry();
+      ScopedLock<FastMutex> guard(registry.mutex);
+      cell->next_free = registry.free_cells;
+      registry.free_cells = cell;
+    }
+    cell = nullptr;
+    exited = true;
+  }
+
+  ThreadCell* AcquireCell() {
+    if (exited) {
+      return nullptr;
+    }
+
+    Registry& registry = GetRegistry();
+    {
+      ScopedLock<FastMutex> guard(registry.mutex);
+      if (registry.free_cells) {
+        cell = registry.free_cells;
+        registry.free_cells = cell->next_free;
+      } else {
+        // From the C runtime, as the cell must not be tagged itself.
+        cell = static_cast<ThreadCell*>(::calloc(1, sizeof(ThreadCell)));
+        if (cell == nullptr) {
+          return nullptr;
+        }
+        cell->next = registry.cells;
+        registry.cells = cell;
+      }
+    }
+
+    random_state = reinterpret_cast<UPTRINT>(this) ^
+                   static_cast<uint64>(Clock().Raw()) ^ 0x9E3779B97F4A7C15ULL;
+    bytes_until_sample = NextSampleDistance();
+    return cell;
+  }
+
+  /**
+   * Exponentially distributed with a mean of the sample interval, so that
+   * sampling does not fall into step with periodic allocation patterns.
+   */
+  int64 NextSampleDistance() {
+    const int64 interval =
+        GetRegistry().sample_interval.load(std::memory_order_relaxed);
+    if (interval <= 0) {
+      return DISABLED_SAMPLE_RECHECK;
+    }
+
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    const uint64 bits = (random_state * 0x2545F4914F6CDD1DULL) >> 11;
+    const double u = (bits + 1) * (1.0 / 9007199254740992.0);  // (0, 1]
+    return static_cast<int64>(-std::log(u) * interval) + 1;
+  }
+
+  ThreadCell* cell;
+  bool exited;
+  bool in_profiler;
+  int64 bytes_until_sample;
+  uint64 random_state;
+};
+
+thread_local ThreadState thread_state;
+
+/**
+ * Charges the allocations of the profiler to the PROFILER tag and keeps
+ * them from being sampled, which would recurse into the profiler.
+ */
+class ProfilerScope {
+ public:
+  ProfilerScope()
+      : previous_tag_(current_tag),
+        previous_in_profiler_(thread_state.in_profiler) {
+    current_tag = MemoryTags::PROFILER;
+    thread_state.in_profiler = true;
+  }
+
+  ~ProfilerScope() {
+    current_tag = previous_tag_;
+    thread_state.in_profiler = previous_in_profiler_;
+  }
+
+ private:
+  uint16 previous_tag_;
+  bool previous_in_profiler_;
+};
+
+bool OnAlloc(uint16 tag, size_t size) {
+  ThreadState& state = thread_state;
+  ThreadCell* cell = state.cell ? state.cell : state.AcquireCell();
+  if (cell == nullptr) {
+    TagCounters& orphan = GetRegistry().orphan;
+    orphan.live_bytes.fetch_add(size, std::memory_order_relaxed);
+    orphan.live_count.fetch_add(1, std::memory_order_relaxed);
+    orphan.alloc_count.fetch_add(1, std::memory_order_relaxed);
+    orphan.alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    return false;
+  }
+
+  TagCounters& counters = cell->counters[tag];
+  AddToOwnCell(counters.live_bytes, size);
+  AddToOwnCell(counters.live_count, 1);
+  AddToOwnCell(counters.alloc_count, 1);
+  AddToOwnCell(counters.alloc_bytes, size);
+
+  state.bytes_until_sample -= size;
+  if (state.bytes_until_sample > 0 || state.in_profiler) {
+    return false;
+  }
+  state.bytes_until_sample = state.NextSampleDistance();
+  return GetRegistry().sample_interval.load(std::memory_order_relaxed) > 0;
+}
+
+void OnFree(uint16 tag, size_t size) {
+  ThreadState& state = thread_state;
+  ThreadCell* cell = state.cell ? state.cell : state.AcquireCell();
+  if (cell == nullptr) {
+    TagCounters& orphan = GetRegistry().orphan;
+    orphan.live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    orphan.live_count.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+
+  TagCounters& counters = cell->counters[tag];
+  AddToOwnCell(counters.live_bytes, -static_cast<int64>(size));
+  AddToOwnCell(counters.live_count, -1);
+}
+
+void AddSample(const void* ptr, uint16 tag, size_t size) {
+  ProfilerScope profiler_scope;
+
+  Sample sample;
+  sample.tag = tag;
+  sample.depth = 0;
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  void* frames[MemoryTagSnapshot::StackStats::MAX_DEPTH + SKIPPED_FRAME_COUNT];
+  const int32 frame_count = ::backtrace(frames, countof(frames));
+  for (int32 i = SKIPPED_FRAME_COUNT; i < frame_count; ++i) {
+    sample.frames[sample.depth++] = reinterpret_cast<UPTRINT>(frames[i]);
+  }
+#endif
+
+  // An allocation of size bytes is sampled with a probability of
+  // 1 - exp(-size / interval); scale it by the inverse.
+  Registry& registry = GetRegistry();
+  const double interval = static_cast<double>(
+      MathBase::Max<int64>(registry.sample_interval.load(), 1));
+  const double bytes = static_cast<double>(MathBase::Max<size_t>(size, 1));
+  const double probability = 1.0 - std::exp(-bytes / interval);
+  sample.weight_bytes = static_cast<int64>(bytes / probability);
+  sample.weight_count = static_cast<int64>(1.0 / probability + 0.5);
+
+  ScopedLock<FastMutex> guard(registry.sample_mutex);
+  registry.samples.Add(ptr, sample);
+}
+
+void RemoveSample(const void* ptr) {
+  ProfilerScope profiler_scope;
+
+  Registry& registry = GetRegistry();
+  ScopedLock<FastMutex> guard(registry.sample_mutex);
+  registry.samples.Remove(ptr);
+}
+
+/**
+ * Sums the counters of tag over all threads. Called with the registry
+ * mutex held.
+ */
+void SumTag(Registry& registry, int32 tag,
+            MemoryTagSnapshot::TagStats& stats) {
+  stats.name = registry.names[tag];
+  stats.live_bytes = 0;
+  stats.live_count = 0;
+  stats.alloc_count = 0;
+  stats.alloc_bytes = 0;
+  for (ThreadCell* cell = registry.cells; cell; cell = cell->next) {
+    const TagCounters& counters = cell->counters[tag];
+    stats.live_bytes += counters.live_bytes.load(std::memory_order_relaxed);
+    stats.live_count += counters.live_count.load(std::memory_order_relaxed);
+    stats.alloc_count += counters.alloc_count.load(std::memory_order_relaxed);
+    stats.alloc_bytes += counters.alloc_bytes.load(std::memory_order_relaxed);
+  }
+
+  // Calls made on exiting threads are not attributed to a tag.
+  if (tag == MemoryTags::UNTAGGED) {
+    stats.live_bytes += registry.orphan.live_bytes.load();
+    stats.live_count += registry.orphan.live_count.load();
+    stats.alloc_count += registry.orphan.alloc_count.load();
+    stats.alloc_bytes += registry.orphan.alloc_bytes.load();
+  }
+}
+
+MemoryTagSnapshot::TagStats ReadTag(int32 tag) {
+  ProfilerScope profiler_scope;
+  Registry& registry = GetRegistry();
+  MemoryTagSnapshot::TagStats stats;
+  ScopedLock<FastMutex> guard(registry.mutex);
+  SumTag(registry, tag, stats);
+  return stats;
+}
+
+bool IsSameStack(const MemoryTagSnapshot::StackStats& a,
+                 const MemoryTagSnapshot::StackStats& b) {
+  return a.tag == b.tag && a.depth == b.depth &&
+         ::memcmp(a.frames, b.frames, a.depth * sizeof(uint64)) == 0;
+}
+
+bool IsStackLess(const MemoryTagSnapshot::StackStats& a,
+                 const MemoryTagSnapshot::StackStats& b) {
+  if (a.tag != b.tag) {
+    return a.tag < b.tag;
+  }
+  const int32 depth = MathBase::Min(a.depth, b.depth);
+  for (int32 i = 0; i < depth; ++i) {
+    if (a.frames[i] != b.frames[i]) {
+      return a.frames[i] < b.frames[i];
+    }
+  }
+  return a.depth < b.depth;
+}
+
+}  // namespace memory_tag
+}  // namespace internal
+
+using namespace internal::memory_tag;
+
+//
+// MemoryTags
+//
+
+uint16 MemoryTags::Register(const char* name) {
+  Registry& registry = GetRegistry();
+  ScopedLock<FastMutex> guard(registry.mutex);
+
+  const int32 count = registry.tag_count.load(std::memory_order_relaxed);
+  for (int32 tag = 0; tag < count; ++tag) {
+    if (::strncmp(registry.names[tag], name, MAX_NAME_LENGTH) == 0) {
+      return static_cast<uint16>(tag);
+    }
+  }
+
+  if (count == MAX_TAG_COUNT) {
+    throw OutOfMemoryException("too many memory tags");
+  }
+  ::strncpy(registry.names[count], name, MAX_NAME_LENGTH);
+  registry.tag_count.store(count + 1, std::memory_order_release);
+  return static_cast<uint16>(count);
+}
+
+const char* MemoryTags::GetName(uint16 tag) {
+  fun_check(tag < GetCount());
+  return GetRegistry().names[tag];
+}
+
+int32 MemoryTags::GetCount() {
+  return GetRegistry().tag_count.load(std::memory_order_acquire);
+}
+
+uint16 MemoryTags::GetCurrent() { return current_tag; }
+
+void MemoryTags::SetSampleInterval(int64 bytes) {
+  GetRegistry().sample_interval.store(MathBase::Max<int64>(bytes, 0));
+}
+
+int64 MemoryTags::GetSampleInterval() {
+  return GetRegistry().sample_interval.load();
+}
+
+void MemoryTags::RegisterMetrics(MetricsRegistry& metrics) {
+  const int32 count = GetCount();
+  for (int32 i = 0; i < count; ++i) {
+    const uint16 tag = static_cast<uint16>(i);
+    const String name = GetName(tag);
+    metrics.RegisterCallable(
+        "memory_tag_live_bytes_" + name,
+        "Bytes allocated with memory tag " + name + " and not yet freed",
+        [tag]() { return static_cast<double>(ReadTag(tag).live_bytes); });
+    metrics.RegisterCallable(
+        "memory_tag_allocated_bytes_" + name,
+        "Bytes allocated with memory tag " + name + " in total",
+        [tag]() { return static_cast<double>(ReadTag(tag).alloc_bytes); });
+  }
+}
+
+//
+// ScopedMemoryTag
+//
+
+ScopedMemoryTag::ScopedMemoryTag(uint16 tag) : previous_tag_(current_tag) {
+  fun_check(tag < MemoryTags::MAX_TAG_COUNT);
+  current_tag = tag;
+}
+
+ScopedMemoryTag::~ScopedMemoryTag() { current_tag = previous_tag_; }
+
+//
+// MemoryTagSnapshot
+//
+
+MemoryTagSnapshot::MemoryTagSnapshot()
+    : time_us_(0), interval_us_(0), sample_interval_(0) {}
+
+MemoryTagSnapshot MemoryTagSnapshot::Capture() {
+  ProfilerScope profiler_scope;
+  Registry& registry = GetRegistry();
+
+  MemoryTagSnapshot snapshot;
+  snapshot.time_us_ = Clock().Raw();
+  snapshot.sample_interval_ = registry.sample_interval.load();
+
+  // Indexed by tag; stacks refer to tags by index.
+  {
+    ScopedLock<FastMutex> guard(registry.mutex);
+
+    const int32 count = registry.tag_count.load(std::memory_order_relaxed);
+    snapshot.tags_.AddDefaulted(count);
+    for (int32 tag = 0; tag < count; ++tag) {
+      SumTag(registry, tag, snapshot.tags_[tag]);
+    }
+  }
+
+  Array<StackStats> stacks;
+  {
+    ScopedLock<FastMutex> guard(registry.sample_mutex);
+
+    stacks.Reserve(registry.samples.Count());
+    for (const auto& pair : registry.samples) {
+      const Sample& sample = pair.value;
+      StackStats& stack = stacks.AddUninitializedAndReturnRef();
+      stack.tag = sample.tag;
+      stack.depth = sample.depth;
+      UnsafeMemory::Memcpy(stack.frames, sample.frames,
+                           sample.depth * sizeof(uint64));
+      stack.live_bytes = sample.weight_bytes;
+      stack.live_count = sample.weight_count;
+      stack.sample_count = 1;
+    }
+  }
+
+  // Merge the samples per stack.
+  stacks.Sort(&IsStackLess);
+  for (int32 i = 0; i < stacks.Count(); ++i) {
+    if (snapshot.stacks_.Count() > 0 &&
+        IsSameStack(snapshot.stacks_.Last(), stacks[i])) {
+      StackStats& merged = snapshot.stacks_.Last();
+      merged.live_bytes += stacks[i].live_bytes;
+      merged.live_count += stacks[i].live_count;
+      merged.sample_count += stacks[i].sample_count;
+    } else {
+      snapshot.stacks_.Add(stacks[i]);
+    }
+  }
+  return snapshot;
+}
+
+MemoryTagSnapshot MemoryTagSnapshot::Diff(const MemoryTagSnapshot& before,
+                                          const MemoryTagSnapshot& after) {
+  MemoryTagSnapshot diff;
+  diff.time_us_ = after.time_us_;
+  diff.interval_us_ = after.time_us_ - before.time_us_;
+  diff.sample_interval_ = after.sample_interval_;
+
+  // Tags are never unregistered, so before has a prefix of the tags of
+  // after.
+  diff.tags_ = after.tags_;
+  for (int32 tag = 0; tag < before.tags_.Count(); ++tag) {
+    TagStats& stats = diff.tags_[tag];
+    stats.live_bytes -= before.tags_[tag].live_bytes;
+    stats.live_count -= before.tags_[tag].live_count;
+    stats.alloc_count -= before.tags_[tag].alloc_count;
+    stats.alloc_bytes -= before.tags_[tag].alloc_bytes;
+  }
+
+  // Both stack lists are sorted; merge them.
+  int32 b = 0;
+  int32 a = 0;
+  while (b < before.stacks_.Count() || a < after.stacks_.Count()) {
+    StackStats stack;
+    if (a == after.stacks_.Count() ||
+        (b < before.stacks_.Count() &&
+         IsStackLess(before.stacks_[b], after.stacks_[a]))) {
+      stack = before.stacks_[b++];
+      stack.live_bytes = -stack.live_bytes;
+      stack.live_count = -stack.live_count;
+      stack.sample_count = -stack.sample_count;
+    } else if (b == before.stacks_.Count() ||
+               IsStackLess(after.stacks_[a], before.stacks_[b])) {
+      stack = after.stacks_[a++];
+    } else {
+      stack = after.stacks_[a++];
+      stack.live_bytes -= before.stacks_[b].live_bytes;
+      stack.live_count -= before.stacks_[b].live_count;
+      stack.sample_count -= before.stacks_[b].sample_count;
+      ++b;
+    }
+    if (stack.sample_count != 0 || stack.live_bytes != 0) {
+      diff.stacks_.Add(stack);
+    }
+  }
+  return diff;
+}
+
+void MemoryTagSnapshot::WriteText(String& out, bool symbolize) const {
+  char line[1024];
+  int32 len;
+
+  len = ::snprintf(line, sizeof(line),
+                   "fun-memory-tags 1\n"
+                   "time_us %lld interval_us %lld\n"
+                   "sample_interval %lld\n",
+                   (long long)time_us_, (long long)interval_us_,
+                   (long long)sample_interval_);
+  out.Append(line, len);
+
+  // By name, so that dumps of different processes line up too.
+  Array<int32> order;
+  for (int32 i = 0; i < tags_.Count(); ++i) {
+    order.Add(i);
+  }
+  order.Sort([this](int32 a, int32 b) { return tags_[a].name < tags_[b].name; });
+  for (int32 i = 0; i < order.Count(); ++i) {
+    const TagStats& stats = tags_[order[i]];
+    len = ::snprintf(line, sizeof(line), "tag %s %lld %lld %lld %lld\n",
+                     stats.name.ConstData(), (long long)stats.live_bytes,
+                     (long long)stats.live_count, (long long)stats.alloc_count,
+                     (long long)stats.alloc_bytes);
+    out.Append(line, len);
+  }
+
+  Array<uint64> pcs;
+  for (int32 i = 0; i < stacks_.Count(); ++i) {
+    const StackStats& stack = stacks_[i];
+    len = ::snprintf(line, sizeof(line), "stack %s %lld %lld %lld",
+                     tags_[stack.tag].name.ConstData(),
+                     (long long)stack.live_bytes, (long long)stack.live_count,
+                     (long long)stack.sample_count);
+    for (int32 f = 0; f < stack.depth; ++f) {
+      len += ::snprintf(line + len, sizeof(line) - len, " %llx",
+                        (unsigned long long)stack.frames[f]);
+      pcs.Add(stack.frames[f]);
+    }
+    line[len++] = '\n';
+    out.Append(line, len);
+  }
+
+  if (!symbolize || pcs.IsEmpty()) {
+    return;
+  }
+
+  pcs.Sort();
+  int32 unique_count = 0;
+  for (int32 i = 0; i < pcs.Count(); ++i) {
+    if (unique_count == 0 || pcs[unique_count - 1] != pcs[i]) {
+      pcs[unique_count++] = pcs[i];
+    }
+  }
+  pcs.Resize(unique_count);
+
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  Array<void*> addresses;
+  for (int32 i = 0; i < pcs.Count(); ++i) {
+    addresses.Add(reinterpret_cast<void*>(static_cast<UPTRINT>(pcs[i])));
+  }
+  char** symbols = ::backtrace_symbols(addresses.MutableData(), addresses.Count());
+  for (int32 i = 0; i < pcs.Count(); ++i) {
+    len = ::snprintf(line, sizeof(line), "frame %llx %s\n",
+                     (unsigned long long)pcs[i], symbols ? symbols[i] : "?");
+    out.Append(line, MathBase::Min<int32>(len, sizeof(line) - 1));
+  }
+  ::free(symbols);
+#else
+  for (int32 i = 0; i < pcs.Count(); ++i) {
+    len = ::snprintf(line, sizeof(line), "frame %llx ?\n",
+                     (unsigned long long)pcs[i]);
+    out.Append(line, len);
+  }
+#endif
+}
+
+void MemoryTagSnapshot::WriteToFile(const char* path, bool symbolize) const {
+  String text;
+  WriteText(text, symbolize);
+
+  FILE* file = ::fopen(path, "wb");
+  if (file == nullptr) {
+    throw CreateFileException(path);
+  }
+  const size_t written = ::fwrite(text.ConstData(), 1, text.Len(), file);
+  ::fclose(file);
+  if (written != (size_t)text.Len()) {
+    throw WriteFileException(path);
+  }
+}
+
+}  // namespace fun
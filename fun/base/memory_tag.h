@@ -0,0 +1,199 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/string/string.h"
+
+namespace fun {
+
+class MetricsRegistry;
+
+/**
+ * Memory tags attribute heap allocations to subsystems, e.g. the send
+ * queues of the network engine or the record sets of the SQL layer, so
+ * that the growth of a process can be broken down.
+ *
+ * A tag is set for the calling thread with ScopedMemoryTag and applies to
+ * everything the thread allocates until the scope ends; scopes nest. The
+ * tag is stored with the allocation, so a block is charged to its tag
+ * until it is freed, whichever thread frees it.
+ *
+ * For every tag, live bytes and blocks and the total number and size of
+ * allocations are counted. In addition, roughly one allocation per
+ * sample interval bytes is sampled with its call stack; a sample stands
+ * for about that many bytes of live memory allocated from the same
+ * stack.
+ *
+ * Tags are only recorded when the global allocator is wrapped in a
+ * MemoryAllocatorTagProxy, which memory.cc does when built with
+ * FUN_MALLOC_TAGS; otherwise scopes cost a thread-local store and all
+ * counts stay zero.
+ *
+ *   static const uint16 TAG_SEND_QUEUE = MemoryTags::Register("net.send_queue");
+ *
+ *   ScopedMemoryTag tag(TAG_SEND_QUEUE);
+ *   queue.Add(message);
+ */
+class FUN_BASE_API MemoryTags {
+ public:
+  enum {
+    MAX_TAG_COUNT = 256,
+    MAX_NAME_LENGTH = 63,
+    /** Allocations made outside any scope. */
+    UNTAGGED = 0,
+    /** Allocations of the profiler itself. */
+    PROFILER = 1
+  };
+
+  /**
+   * Returns the tag with the given name, registering it on first use.
+   * Names longer than MAX_NAME_LENGTH are truncated. Throws
+   * OutOfMemoryException if MAX_TAG_COUNT tags exist already.
+   */
+  static uint16 Register(const char* name);
+
+  static const char* GetName(uint16 tag);
+
+  /**
+   * Returns the number of registered tags, including the built-in ones.
+   */
+  static int32 GetCount();
+
+  /**
+   * Returns the tag of the calling thread.
+   */
+  static uint16 GetCurrent();
+
+  /**
+   * Sets the average number of bytes allocated between two samples;
+   * 0 disables sampling. The default is 512 KB. Threads pick up the new
+   * interval at their next sample, or within 16 MB of allocations while
+   * sampling is disabled.
+   */
+  static void SetSampleInterval(int64 bytes);
+  static int64 GetSampleInterval();
+
+  /**
+   * Registers the live bytes and allocated bytes of every tag as callable
+   * gauges memory_tag_live_bytes_<tag> and memory_tag_allocated_bytes_<tag>
+   * (dots in tag names become underscores). Tags registered later are
+   * not exported.
+   */
+  static void RegisterMetrics(MetricsRegistry& registry);
+};
+
+/**
+ * Sets the memory tag of the calling thread for the lifetime of the
+ * object and restores the previous one afterwards.
+ */
+class FUN_BASE_API ScopedMemoryTag {
+ public:
+  explicit ScopedMemoryTag(uint16 tag);
+  ~ScopedMemoryTag();
+
+  ScopedMemoryTag(const ScopedMemoryTag&) = delete;
+  ScopedMemoryTag& operator=(const ScopedMemoryTag&) = delete;
+
+ private:
+  uint16 previous_tag_;
+};
+
+/**
+ * Counts of all memory tags at one point in time, or the difference
+ * between two such points.
+ *
+ * Snapshots are written as text with one record per line, sorted, so
+ * that two dumps can be compared with diff or read by a script:
+ *
+ *   fun-memory-tags 1
+ *   time_us <clock> interval_us <0, or the span of a difference>
+ *   sample_interval <bytes>
+ *   tag <name> <live bytes> <live blocks> <allocations> <allocated bytes>
+ *   stack <tag> <live bytes> <live blocks> <samples> <pc> <pc> ...
+ *   frame <pc> <symbol>
+ *
+ * stack lines give the estimated live memory per allocation stack, from
+ * the sampled allocations; frame lines resolve the addresses used.
+ */
+class FUN_BASE_API MemoryTagSnapshot {
+ public:
+  struct TagStats {
+    String name;
+    int64 live_bytes;
+    int64 live_count;
+    int64 alloc_count;
+    int64 alloc_bytes;
+  };
+
+  struct StackStats {
+    enum { MAX_DEPTH = 24 };
+
+    uint16 tag;
+    int32 depth;
+    uint64 frames[MAX_DEPTH];
+    // Estimates, scaled from the samples.
+    int64 live_bytes;
+    int64 live_count;
+    int64 sample_count;
+  };
+
+  MemoryTagSnapshot();
+
+  /**
+   * Takes a snapshot of the current counts and sampled allocations.
+   */
+  static MemoryTagSnapshot Capture();
+
+  /**
+   * Returns after minus before. Stacks that are gone in after show up
+   * with negative counts; stacks unchanged are left out.
+   */
+  static MemoryTagSnapshot Diff(const MemoryTagSnapshot& before,
+                                const MemoryTagSnapshot& after);
+
+  /** Indexed by tag. */
+  const Array<TagStats>& GetTags() const { return tags_; }
+  const Array<StackStats>& GetStacks() const { return stacks_; }
+
+  /**
+   * Appends the snapshot to out in the text format above. With
+   * symbolize, addresses are resolved into frame lines, which is slow.
+   */
+  void WriteText(String& out, bool symbolize = true) const;
+
+  /**
+   * Writes the snapshot to the file at path. Throws CreateFileException or
+   * WriteFileException.
+   */
+  void WriteToFile(const char* path, bool symbolize = true) const;
+
+ private:
+  int64 time_us_;
+  int64 interval_us_;
+  int64 sample_interval_;
+  Array<TagStats> tags_;
+  Array<StackStats> stacks_;
+};
+
+namespace internal {
+namespace memory_tag {
+
+/**
+ * Charges an allocation of size bytes to tag. Returns true if the
+ * allocation is to be sampled with AddSample().
+ */
+FUN_BASE_API bool OnAlloc(uint16 tag, size_t size);
+
+FUN_BASE_API void OnFree(uint16 tag, size_t size);
+
+/**
+ * Records the calling stack for the sampled allocation at ptr.
+ */
+FUN_BASE_API void AddSample(const void* ptr, uint16 tag, size_t size);
+
+FUN_BASE_API void RemoveSample(const void* ptr);
+
+}  // namespace memory_tag
+}  // namespace internal
+
+}  // namespace fun
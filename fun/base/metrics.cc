@@ -0,0 +1,543 @@
+﻿#include "fun/base/metrics.h"
+#include "fun/base/clock.h"
+#include "fun/base/error_handler.h"
+#include "fun/base/exception.h"
+
+#include <cmath>
+#include <limits>
+
+namespace fun {
+
+namespace internal {
+namespace metrics {
+
+enum MetricType {
+  METRIC_COUNTER,
+  METRIC_GAUGE,
+  METRIC_RATE,
+  METRIC_HISTOGRAM,
+  METRIC_CALLABLE,
+};
+
+// Histogram buckets: values below SUB_BUCKET_COUNT get a bucket each;
+// above that every power of two is split into SUB_BUCKET_COUNT / 2
+// buckets, the top SUB_BUCKET_BITS bits of the value selecting one.
+const int32 SUB_BUCKET_BITS = 5;
+const int32 SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+const int32 SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+const int32 BUCKET_COUNT =
+    SUB_BUCKET_COUNT + (63 - SUB_BUCKET_BITS) * SUB_BUCKET_HALF;
+
+FUN_ALWAYS_INLINE int32 GetBucketIndex(int64 value) {
+  if (value < SUB_BUCKET_COUNT) {
+    return static_cast<int32>(value);
+  }
+
+  int32 msb = 63;
+  while ((value >> msb) == 0) {
+    --msb;
+  }
+  const int32 shift = msb - SUB_BUCKET_BITS + 1;
+  const int32 top = static_cast<int32>(value >> shift);
+  return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF +
+         (top - SUB_BUCKET_HALF);
+}
+
+/**
+ * Highest value that falls into the bucket.
+ */
+int64 GetBucketUpperBound(int32 index) {
+  if (index < SUB_BUCKET_COUNT) {
+    return index;
+  }
+
+  const int32 k = index - SUB_BUCKET_COUNT;
+  const int32 shift = k / SUB_BUCKET_HALF + 1;
+  const int64 top = k % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+  return ((top + 1) << shift) - 1;
+}
+
+/**
+ * Adds n to a cell that only the calling thread writes. A plain load and
+ * store is enough; readers see either the old or the new value.
+ */
+FUN_ALWAYS_INLINE void AddToOwnCell(std::atomic<int64>& cell, int64 n) {
+  cell.store(cell.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+struct alignas(FUN_PLATFORM_CACHE_LINE_SIZE) CounterCell {
+  std::atomic<int64> value;
+};
+
+struct alignas(FUN_PLATFORM_CACHE_LINE_SIZE) HistogramCell {
+  std::atomic<int64> count;
+  std::atomic<int64> sum;
+  std::atomic<int64> min;
+  std::atomic<int64> max;
+  std::atomic<int64> buckets[BUCKET_COUNT];
+};
+
+// Source of Metric ids. Ids are never reused, so the per-thread cell table
+// can be indexed by id even across registries.
+std::atomic<int32> next_metric_id(0);
+
+// Cells of the calling thread, indexed by Metric id.
+thread_local Array<void*> thread_cells;
+
+class Metric : Noncopyable {
+ public:
+  Metric(const String& name, const String& help, int32 type)
+      : name(name),
+        help(help),
+        type(type),
+        id(next_metric_id.fetch_add(1, std::memory_order_relaxed)),
+        gauge_value(0.0),
+        last_total(0),
+        last_time(0),
+        last_rate(0.0) {}
+
+  ~Metric() {
+    for (int32 i = 0; i < cells_.Count(); ++i) {
+      UnsafeMemory::Free(cells_[i]);
+    }
+  }
+
+  /**
+   * Returns the cell of the calling thread, creating it on first use.
+   */
+  FUN_ALWAYS_INLINE void* GetThreadCell() {
+    if (id < thread_cells.Count()) {
+      void* cell = thread_cells[id];
+      if (cell) {
+        return cell;
+      }
+    }
+    return CreateThreadCell();
+  }
+
+  int64 SumCounterCells() {
+    ScopedLock<FastMutex> guard(cells_mutex_);
+
+    int64 total = 0;
+    for (int32 i = 0; i < cells_.Count(); ++i) {
+      total += static_cast<CounterCell*>(cells_[i])->value.load(
+          std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  void MergeHistogramCells(HistogramSnapshot& snapshot) {
+    snapshot.buckets_.Reset();
+    snapshot.buckets_.AddZeroed(BUCKET_COUNT);
+    snapshot.count_ = 0;
+    snapshot.sum_ = 0;
+    snapshot.min_ = std::numeric_limits<int64>::max();
+    snapshot.max_ = 0;
+
+    ScopedLock<FastMutex> guard(cells_mutex_);
+
+    for (int32 i = 0; i < cells_.Count(); ++i) {
+      HistogramCell* cell = static_cast<HistogramCell*>(cells_[i]);
+      for (int32 b = 0; b < BUCKET_COUNT; ++b) {
+        snapshot.buckets_[b] +=
+            cell->buckets[b].load(std::memory_order_relaxed);
+      }
+      snapshot.sum_ += cell->sum.load(std::memory_order_relaxed);
+      snapshot.min_ = MathBase::Min(
+          snapshot.min_, cell->min.load(std::memory_order_relaxed));
+      snapshot.max_ = MathBase::Max(
+          snapshot.max_, cell->max.load(std::memory_order_relaxed));
+    }
+
+    // Counted from the buckets, so percentiles always add up even while
+    // other threads are recording.
+    for (int32 b = 0; b < BUCKET_COUNT; ++b) {
+      snapshot.count_ += snapshot.buckets_[b];
+    }
+  }
+
+  const String name;
+  const String help;
+  const int32 type;
+  const int32 id;
+
+  // METRIC_GAUGE
+  std::atomic<double> gauge_value;
+
+  // METRIC_CALLABLE; guarded by the registry mutex.
+  MetricsRegistry::ValueCallback callback;
+
+  // METRIC_RATE; only touched while exporting.
+  int64 last_total;
+  int64 last_time;
+  double last_rate;
+
+ private:
+  void* CreateThreadCell() {
+    void* cell;
+    if (type == METRIC_HISTOGRAM) {
+      cell = UnsafeMemory::Malloc(sizeof(HistogramCell),
+                                  alignof(HistogramCell));
+      if (cell == nullptr) {
+        throw OutOfMemoryException("cannot allocate histogram cell");
+      }
+      UnsafeMemory::Memzero(cell, sizeof(HistogramCell));
+      static_cast<HistogramCell*>(cell)->min.store(
+          std::numeric_limits<int64>::max(), std::memory_order_relaxed);
+    } else {
+      cell = UnsafeMemory::Malloc(sizeof(CounterCell), alignof(CounterCell));
+      if (cell == nullptr) {
+        throw OutOfMemoryException("cannot allocate counter cell");
+      }
+      UnsafeMemory::Memzero(cell, sizeof(CounterCell));
+    }
+
+    {
+      ScopedLock<FastMutex> guard(cells_mutex_);
+      cells_.Add(cell);
+    }
+
+    if (thread_cells.Count() <= id) {
+      thread_cells.AddZeroed(id + 1 - thread_cells.Count());
+    }
+    thread_cells[id] = cell;
+    return cell;
+  }
+
+  // Cells of all threads that ever updated the metric. They outlive their
+  // threads, so nothing that was counted is lost.
+  FastMutex cells_mutex_;
+  Array<void*> cells_;
+};
+
+}  // namespace metrics
+}  // namespace internal
+
+using namespace internal::metrics;
+
+//
+// Counter
+//
+
+void Counter::Increment(int64 n) const {
+  AddToOwnCell(static_cast<CounterCell*>(metric_->GetThreadCell())->value, n);
+}
+
+int64 Counter::Read() const { return metric_->SumCounterCells(); }
+
+//
+// Gauge
+//
+
+void Gauge::Set(double value) const {
+  metric_->gauge_value.store(value, std::memory_order_relaxed);
+}
+
+void Gauge::Add(double delta) const {
+  double value = metric_->gauge_value.load(std::memory_order_relaxed);
+  while (!metric_->gauge_value.compare_exchange_weak(
+      value, value + delta, std::memory_order_relaxed)) {
+  }
+}
+
+double Gauge::Read() const {
+  return metric_->gauge_value.load(std::memory_order_relaxed);
+}
+
+//
+// Rate
+//
+
+void Rate::Mark(int64 n) const {
+  AddToOwnCell(static_cast<CounterCell*>(metric_->GetThreadCell())->value, n);
+}
+
+int64 Rate::ReadTotal() const { return metric_->SumCounterCells(); }
+
+//
+// Histogram
+//
+
+void Histogram::Record(int64 value) const {
+  HistogramCell* cell = static_cast<HistogramCell*>(metric_->GetThreadCell());
+
+  if (value < 0) {
+    value = 0;
+  }
+
+  AddToOwnCell(cell->buckets[GetBucketIndex(value)], 1);
+  AddToOwnCell(cell->count, 1);
+  AddToOwnCell(cell->sum, value);
+  if (value < cell->min.load(std::memory_order_relaxed)) {
+    cell->min.store(value, std::memory_order_relaxed);
+  }
+  if (value > cell->max.load(std::memory_order_relaxed)) {
+    cell->max.store(value, std::memory_order_relaxed);
+  }
+}
+
+HistogramSnapshot Histogram::Read() const {
+  HistogramSnapshot snapshot;
+  metric_->MergeHistogramCells(snapshot);
+  return snapshot;
+}
+
+//
+// HistogramSnapshot
+//
+
+HistogramSnapshot::HistogramSnapshot()
+    : count_(0), sum_(0), min_(0), max_(0) {}
+
+double HistogramSnapshot::GetMean() const {
+  return count_ > 0 ? static_cast<double>(sum_) / count_ : 0.0;
+}
+
+int64 HistogramSnapshot::GetPercentile(double fraction) const {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  fraction = MathBase::Min(MathBase::Max(fraction, 0.0), 1.0);
+  const int64 rank = MathBase::Max<int64>(
+      1, static_cast<int64>(std::ceil(fraction * count_)));
+
+  int64 seen = 0;
+  for (int32 b = 0; b < buckets_.Count(); ++b) {
+    seen += buckets_[b];
+    if (seen >= rank) {
+      return MathBase::Min(MathBase::Max(GetBucketUpperBound(b), min_), max_);
+    }
+  }
+  return max_;
+}
+
+//
+// MetricsRegistry
+//
+
+namespace {
+
+String SanitizeMetricName(const String& name) {
+  String result;
+  result.Reserve(name.Len());
+  for (int32 i = 0; i < name.Len(); ++i) {
+    const char c = name[i];
+    const bool valid = CharTraitsA::IsAlpha(c) || c == '_' || c == ':' ||
+                       (i > 0 && CharTraitsA::IsDigit(c));
+    result.Append(valid ? c : '_');
+  }
+  return result;
+}
+
+void AppendHelpText(String& out, const String& help) {
+  for (int32 i = 0; i < help.Len(); ++i) {
+    const char c = help[i];
+    if (c == '\\') {
+      out.Append("\\\\");
+    } else if (c == '\n') {
+      out.Append("\\n");
+    } else {
+      out.Append(c);
+    }
+  }
+}
+
+void AppendHeader(String& out, const String& name, const String& help,
+                  const char* type) {
+  if (!help.IsEmpty()) {
+    out << "# HELP " << name << ' ';
+    AppendHelpText(out, help);
+    out << '\n';
+  }
+  out << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void AppendValue(String& out, double value) {
+  if (std::isnan(value)) {
+    out.Append("NaN");
+  } else if (std::isinf(value)) {
+    out.Append(value > 0 ? "+Inf" : "-Inf");
+  } else {
+    out.AppendNumber(value, 'g', 15);
+  }
+}
+
+void AppendSample(String& out, const String& name, const char* suffix,
+                  double value) {
+  out << name << suffix << ' ';
+  AppendValue(out, value);
+  out << '\n';
+}
+
+void AppendSample(String& out, const String& name, const char* suffix,
+                  int64 value) {
+  out << name << suffix << ' ';
+  out.AppendNumber(value);
+  out << '\n';
+}
+
+const double EXPORTED_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+}  // namespace
+
+MetricsRegistry::MetricsRegistry() {}
+
+MetricsRegistry::~MetricsRegistry() {
+  for (int32 i = 0; i < metrics_.Count(); ++i) {
+    delete metrics_[i];
+  }
+}
+
+Counter MetricsRegistry::GetCounter(const String& name, const String& help) {
+  return Counter(FindOrAdd(name, help, METRIC_COUNTER));
+}
+
+Gauge MetricsRegistry::GetGauge(const String& name, const String& help) {
+  return Gauge(FindOrAdd(name, help, METRIC_GAUGE));
+}
+
+Rate MetricsRegistry::GetRate(const String& name, const String& help) {
+  return Rate(FindOrAdd(name, help, METRIC_RATE));
+}
+
+Histogram MetricsRegistry::GetHistogram(const String& name,
+                                        const String& help) {
+  return Histogram(FindOrAdd(name, help, METRIC_HISTOGRAM));
+}
+
+void MetricsRegistry::RegisterCallable(const String& name, const String& help,
+                                       const ValueCallback& callback) {
+  Metric* metric = FindOrAdd(name, help, METRIC_CALLABLE);
+
+  ScopedLock<FastMutex> guard(mutex_);
+  metric->callback = callback;
+}
+
+Metric* MetricsRegistry::FindOrAdd(const String& name, const String& help,
+                                   int32 type) {
+  const String sanitized_name = SanitizeMetricName(name);
+
+  ScopedLock<FastMutex> guard(mutex_);
+
+  if (Metric** found = metrics_by_name_.Find(sanitized_name)) {
+    if ((*found)->type != type) {
+      throw InvalidArgumentException(
+          String("metric is already registered with another type: ") +
+          sanitized_name);
+    }
+    return *found;
+  }
+
+  Metric* metric = new Metric(sanitized_name, help, type);
+  metrics_.Add(metric);
+  metrics_by_name_.Add(sanitized_name, metric);
+  return metric;
+}
+
+void MetricsRegistry::ExportPrometheus(String& out) {
+  // Serializes exports, which update the rate state. Callbacks run without
+  // mutex_, so they may use the registry themselves.
+  ScopedLock<FastMutex> export_guard(export_mutex_);
+
+  Array<Metric*> metrics;
+  {
+    ScopedLock<FastMutex> guard(mutex_);
+    metrics = metrics_;
+  }
+
+  const int64 now = Clock::Now().Microseconds();
+
+  for (int32 i = 0; i < metrics.Count(); ++i) {
+    Metric* metric = metrics[i];
+    const String& name = metric->name;
+
+    switch (metric->type) {
+      case METRIC_COUNTER:
+        AppendHeader(out, name, metric->help, "counter");
+        AppendSample(out, name, "", metric->SumCounterCells());
+        break;
+
+      case METRIC_GAUGE:
+        AppendHeader(out, name, metric->help, "gauge");
+        AppendSample(out, name, "",
+                     metric->gauge_value.load(std::memory_order_relaxed));
+        break;
+
+      case METRIC_RATE: {
+        const int64 total = metric->SumCounterCells();
+        if (metric->last_time != 0 && now > metric->last_time) {
+          metric->last_rate = (total - metric->last_total) * 1000000.0 /
+                              (now - metric->last_time);
+        }
+        metric->last_total = total;
+        metric->last_time = now;
+
+        const String total_name = name + "_total";
+        AppendHeader(out, total_name, metric->help, "counter");
+        AppendSample(out, total_name, "", total);
+        AppendHeader(out, name, metric->help, "gauge");
+        AppendSample(out, name, "", metric->last_rate);
+        break;
+      }
+
+      case METRIC_HISTOGRAM: {
+        HistogramSnapshot snapshot;
+        metric->MergeHistogramCells(snapshot);
+
+        AppendHeader(out, name, metric->help, "summary");
+        for (const double quantile : EXPORTED_QUANTILES) {
+          out << name << "{quantile=\"";
+          AppendValue(out, quantile);
+          out << "\"} ";
+          out.AppendNumber(snapshot.GetPercentile(quantile));
+          out << '\n';
+        }
+        AppendSample(out, name, "_sum", snapshot.GetSum());
+        AppendSample(out, name, "_count", snapshot.GetCount());
+
+        const String min_name = name + "_min";
+        const String max_name = name + "_max";
+        AppendHeader(out, min_name, String(), "gauge");
+        AppendSample(out, min_name, "", snapshot.GetMin());
+        AppendHeader(out, max_name, String(), "gauge");
+        AppendSample(out, max_name, "", snapshot.GetMax());
+        break;
+      }
+
+      case METRIC_CALLABLE: {
+        ValueCallback callback;
+        {
+          ScopedLock<FastMutex> guard(mutex_);
+          callback = metric->callback;
+        }
+
+        double value;
+        try {
+          value = callback();
+        } catch (Exception& e) {
+          ErrorHandler::Handle(e);
+          continue;
+        } catch (std::exception& e) {
+          ErrorHandler::Handle(e);
+          continue;
+        } catch (...) {
+          ErrorHandler::Handle();
+          continue;
+        }
+
+        AppendHeader(out, name, metric->help, "gauge");
+        AppendSample(out, name, "", value);
+        break;
+      }
+    }
+  }
+}
+
+MetricsRegistry& MetricsRegistry::Default() {
+  static MetricsRegistry* registry = new MetricsRegistry;
+  return *registry;
+}
+
+}  // namespace fun
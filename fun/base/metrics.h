@@ -0,0 +1,223 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/map.h"
+#include "fun/base/mutex.h"
+#include "fun/base/string/string.h"
+
+#include <atomic>
+
+namespace fun {
+
+class MetricsRegistry;
+
+namespace internal {
+namespace metrics {
+
+class Metric;
+
+}  // namespace metrics
+}  // namespace internal
+
+/**
+ * Monotonically increasing count, e.g. requests served or bytes sent.
+ *
+ * Every thread that updates a counter gets a cell of its own, so
+ * Increment() is a thread-local load and store: no lock, no locked
+ * instruction and no cache line shared with other updating threads. The
+ * cells are only summed when the counter is read or exported.
+ *
+ * Handles are cheap to copy and stay valid as long as the registry that
+ * returned them. Look them up once and keep them:
+ *
+ *   static Counter packets =
+ *       MetricsRegistry::Default().GetCounter("net_packets_received");
+ *   packets.Increment();
+ */
+class FUN_BASE_API Counter {
+ public:
+  Counter() : metric_(nullptr) {}
+
+  void Increment(int64 n = 1) const;
+
+  int64 Read() const;
+
+  bool IsValid() const { return metric_ != nullptr; }
+
+ private:
+  friend class MetricsRegistry;
+
+  explicit Counter(internal::metrics::Metric* metric) : metric_(metric) {}
+
+  internal::metrics::Metric* metric_;
+};
+
+/**
+ * Value that can go up and down, e.g. the size of a queue.
+ *
+ * A gauge is a single atomic value; prefer a Counter for values that many
+ * threads update at a high rate.
+ */
+class FUN_BASE_API Gauge {
+ public:
+  Gauge() : metric_(nullptr) {}
+
+  void Set(double value) const;
+
+  void Add(double delta) const;
+
+  double Read() const;
+
+  bool IsValid() const { return metric_ != nullptr; }
+
+ private:
+  friend class MetricsRegistry;
+
+  explicit Gauge(internal::metrics::Metric* metric) : metric_(metric) {}
+
+  internal::metrics::Metric* metric_;
+};
+
+/**
+ * Counter that is also exported as events per second, measured between
+ * two consecutive exports. Mark() costs the same as Counter::Increment().
+ */
+class FUN_BASE_API Rate {
+ public:
+  Rate() : metric_(nullptr) {}
+
+  void Mark(int64 n = 1) const;
+
+  int64 ReadTotal() const;
+
+  bool IsValid() const { return metric_ != nullptr; }
+
+ private:
+  friend class MetricsRegistry;
+
+  explicit Rate(internal::metrics::Metric* metric) : metric_(metric) {}
+
+  internal::metrics::Metric* metric_;
+};
+
+/**
+ * Merged view of a histogram at one point in time.
+ */
+class FUN_BASE_API HistogramSnapshot {
+ public:
+  HistogramSnapshot();
+
+  int64 GetCount() const { return count_; }
+  int64 GetSum() const { return sum_; }
+  int64 GetMin() const { return count_ > 0 ? min_ : 0; }
+  int64 GetMax() const { return count_ > 0 ? max_ : 0; }
+  double GetMean() const;
+
+  /**
+   * Value below which the given fraction (0.0 .. 1.0) of the recorded
+   * values lie, accurate to the bucket resolution of the histogram.
+   */
+  int64 GetPercentile(double fraction) const;
+
+ private:
+  friend class internal::metrics::Metric;
+
+  int64 count_;
+  int64 sum_;
+  int64 min_;
+  int64 max_;
+  Array<int64> buckets_;
+};
+
+/**
+ * Distribution of non-negative integer values, typically latencies in
+ * microseconds.
+ *
+ * Values are counted in HDR-style log-linear buckets: exact below 32, and
+ * above that 16 buckets per power of two, so every value is resolved to
+ * within about 6% over the whole int64 range with a fixed number of
+ * buckets. Like Counter, every recording thread writes to cells of its
+ * own; Record() takes no lock.
+ *
+ * Exported as a Prometheus summary with the 50th, 90th, 99th and 99.9th
+ * percentile, plus the minimum and maximum.
+ */
+class FUN_BASE_API Histogram {
+ public:
+  Histogram() : metric_(nullptr) {}
+
+  void Record(int64 value) const;
+
+  HistogramSnapshot Read() const;
+
+  bool IsValid() const { return metric_ != nullptr; }
+
+ private:
+  friend class MetricsRegistry;
+
+  explicit Histogram(internal::metrics::Metric* metric) : metric_(metric) {}
+
+  internal::metrics::Metric* metric_;
+};
+
+/**
+ * Named set of metrics, exported in the Prometheus text format.
+ *
+ * Registering (GetCounter() etc.) takes a lock and should be done once;
+ * updating through the returned handle does not. Asking twice for the same
+ * name returns the same metric. Metrics live as long as the registry.
+ *
+ * Names should follow the Prometheus conventions ([a-zA-Z_:][a-zA-Z0-9_:]*);
+ * other characters are replaced by '_'.
+ */
+class FUN_BASE_API MetricsRegistry : Noncopyable {
+ public:
+  /**
+   * Returns the value of a callable metric at export time.
+   */
+  typedef Function<double()> ValueCallback;
+
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  /**
+   * Throws InvalidArgumentException if name is registered with another
+   * type.
+   */
+  Counter GetCounter(const String& name, const String& help = String());
+  Gauge GetGauge(const String& name, const String& help = String());
+  Rate GetRate(const String& name, const String& help = String());
+  Histogram GetHistogram(const String& name, const String& help = String());
+
+  /**
+   * Registers a gauge whose value is obtained by calling callback each
+   * time the registry is exported. Registering the same name again
+   * replaces the callback.
+   */
+  void RegisterCallable(const String& name, const String& help,
+                        const ValueCallback& callback);
+
+  /**
+   * Appends all metrics to out in the Prometheus text exposition format
+   * (version 0.0.4).
+   */
+  void ExportPrometheus(String& out);
+
+  /**
+   * Process-wide registry, created on first use and never destroyed, so
+   * handles into it may be used during static destruction.
+   */
+  static MetricsRegistry& Default();
+
+ private:
+  internal::metrics::Metric* FindOrAdd(const String& name, const String& help,
+                                       int32 type);
+
+  FastMutex mutex_;
+  FastMutex export_mutex_;
+  Array<internal::metrics::Metric*> metrics_;
+  Map<String, internal::metrics::Metric*> metrics_by_name_;
+};
+
+}  // namespace fun
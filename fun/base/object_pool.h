@@ -148,7 +148,7 @@ class ObjectPool {
     }
     factory_.DestroyObject(object);
     used_count_--;
-    available_cond_.Signal();
+    available_cond_.NotifyOne();
   }
 
   size_t Capacity() const { return capacity_; }
@@ -0,0 +1,283 @@
+﻿#include "fun/base/serialization/baked_archive.h"
+#include "fun/base/crc.h"
+#include "fun/base/exception.h"
+#include "fun/base/file.h"
+
+namespace fun {
+
+namespace internal {
+namespace baked {
+
+uint32 ComputeChecksum(const char* data, uint64 size) {
+  const uint64 step = 1 << 30;
+  uint32 crc = 0;
+  for (uint64 done = 0; done < size; done += step) {
+    crc = Crc::Crc32(data + done, (int32)MathBase::Min(step, size - done), crc);
+  }
+  return crc;
+}
+
+}  // namespace baked
+}  // namespace internal
+
+using namespace internal::baked;
+
+//
+// BakedTable
+//
+
+BakedTable::BakedTable(const char* base, const TableHeader* header)
+    : base_(base),
+      header_(header),
+      columns_(
+          reinterpret_cast<const ColumnHeader*>(base + header->columns_offset)) {}
+
+StringView BakedTable::ToView(const StringRef& ref) const {
+  const FileHeader* file_header = reinterpret_cast<const FileHeader*>(base_);
+  if ((uint64)ref.offset + ref.length >= file_header->string_pool_size) {
+    throw DataFormatException("Baked string out of range");
+  }
+  return StringView(base_ + file_header->string_pool_offset + ref.offset,
+                    ref.length);
+}
+
+StringView BakedTable::GetName() const { return ToView(header_->name); }
+
+int32 BakedTable::FindColumn(const StringView& name) const {
+  for (uint32 column = 0; column < header_->column_count; ++column) {
+    if (ToView(columns_[column].name) == name) {
+      return (int32)column;
+    }
+  }
+  return -1;
+}
+
+StringView BakedTable::GetColumnName(int32 column) const {
+  fun_check(column >= 0 && column < (int32)header_->column_count);
+  return ToView(columns_[column].name);
+}
+
+BakedType BakedTable::GetColumnType(int32 column) const {
+  fun_check(column >= 0 && column < (int32)header_->column_count);
+  return (BakedType)columns_[column].type;
+}
+
+StringView BakedTable::GetString(int32 row, int32 column) const {
+  return ToView(
+      *reinterpret_cast<const StringRef*>(Cell(row, column, BakedType::String)));
+}
+
+int64 BakedTable::GetInteger(int32 row, int32 column) const {
+  return GetColumnType(column) == BakedType::Int32 ? GetInt32(row, column)
+                                                   : GetInt64(row, column);
+}
+
+int32 BakedTable::FindRows(int64 key, int32& out_first) const {
+  fun_check(header_->index_type == INDEX_SORTED);
+
+  const SortedIndexEntry* entries =
+      reinterpret_cast<const SortedIndexEntry*>(base_ + header_->index_offset);
+
+  // Lower bound.
+  int32 first = 0;
+  int32 count = (int32)header_->index_size;
+  while (count > 0) {
+    const int32 half = count / 2;
+    if (entries[first + half].key < key) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+
+  int32 last = first;
+  while (last < (int32)header_->index_size && entries[last].key == key) {
+    ++last;
+  }
+  out_first = first;
+  return last - first;
+}
+
+int32 BakedTable::FindRow(int64 key) const {
+  int32 first;
+  return FindRows(key, first) > 0 ? GetRowAt(first) : -1;
+}
+
+int32 BakedTable::GetRowAt(int32 index) const {
+  if (header_->index_type != INDEX_SORTED) {
+    return index;
+  }
+  fun_check(index >= 0 && index < (int32)header_->index_size);
+  return reinterpret_cast<const SortedIndexEntry*>(
+             base_ + header_->index_offset)[index]
+      .row;
+}
+
+int32 BakedTable::FindRow(const StringView& key) const {
+  fun_check(header_->index_type == INDEX_HASHED);
+
+  const HashIndexSlot* slots =
+      reinterpret_cast<const HashIndexSlot*>(base_ + header_->index_offset);
+  const uint32 mask = header_->index_size - 1;
+  const uint32 hash = Crc::Crc32(key.ConstData(), key.Len());
+  for (uint32 i = hash & mask;; i = (i + 1) & mask) {
+    const HashIndexSlot& slot = slots[i];
+    if (slot.row_plus_one == 0) {
+      return -1;
+    }
+    if (slot.hash == hash &&
+        GetString(slot.row_plus_one - 1, header_->key_column) == key) {
+      return slot.row_plus_one - 1;
+    }
+  }
+}
+
+//
+// BakedArchive
+//
+
+BakedArchive::BakedArchive() : base_(nullptr), header_(nullptr) {}
+
+BakedArchive::BakedArchive(const String& path)
+    : base_(nullptr), header_(nullptr) {
+  Open(path);
+}
+
+BakedArchive::~BakedArchive() {}
+
+void BakedArchive::Open(const String& path) {
+  Close();
+
+  File file(path);
+  if (file.GetSize() < sizeof(FileHeader)) {
+    throw DataFormatException("Not a baked archive", path);
+  }
+
+  SharedMemory memory(file, SharedMemory::AM_READ);
+  memory_.Swap(memory);
+  base_ = memory_.begin();
+  header_ = reinterpret_cast<const FileHeader*>(base_);
+
+  try {
+    Validate(path);
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+void BakedArchive::Close() {
+  SharedMemory empty;
+  memory_.Swap(empty);
+  base_ = nullptr;
+  header_ = nullptr;
+}
+
+// Checks every offset in the headers, so that a truncated or foreign file
+// fails here rather than faulting later. Touches only the header pages.
+void BakedArchive::Validate(const String& path) const {
+  const uint64 size = memory_.end() - memory_.begin();
+
+  if (header_->magic != MAGIC) {
+    throw DataFormatException("Not a baked archive", path);
+  }
+  if (header_->byte_order_mark != BYTE_ORDER_MARK) {
+    throw DataFormatException("Baked archive has the wrong byte order", path);
+  }
+  if (header_->version != VERSION) {
+    throw DataFormatException("Unsupported baked archive version", path);
+  }
+  if (header_->file_size != size) {
+    throw DataFormatException("Baked archive is truncated", path);
+  }
+
+  auto check_range = [&](uint64 offset, uint64 count, uint64 element_size) {
+    if (offset % 8 != 0 || offset > size ||
+        count > (size - offset) / MathBase::Max<uint64>(element_size, 1)) {
+      throw DataFormatException("Corrupt baked archive", path);
+    }
+  };
+
+  check_range(header_->string_pool_offset, header_->string_pool_size, 1);
+  if (header_->string_pool_size == 0 ||
+      base_[header_->string_pool_offset + header_->string_pool_size - 1] !=
+          '\0') {
+    throw DataFormatException("Corrupt baked archive", path);
+  }
+  check_range(header_->tables_offset, header_->table_count,
+              sizeof(TableHeader));
+
+  const TableHeader* tables =
+      reinterpret_cast<const TableHeader*>(base_ + header_->tables_offset);
+  for (uint32 t = 0; t < header_->table_count; ++t) {
+    const TableHeader& table = tables[t];
+    check_range(table.columns_offset, table.column_count,
+                sizeof(ColumnHeader));
+    check_range(table.rows_offset, table.row_count, table.row_size);
+
+    const ColumnHeader* columns =
+        reinterpret_cast<const ColumnHeader*>(base_ + table.columns_offset);
+    for (uint32 c = 0; c < table.column_count; ++c) {
+      const uint32 type_size = GetTypeSize((BakedType)columns[c].type);
+      if (type_size == 0 || columns[c].offset % type_size != 0 ||
+          columns[c].offset + type_size > table.row_size) {
+        throw DataFormatException("Corrupt baked archive", path);
+      }
+    }
+
+    switch (table.index_type) {
+      case INDEX_NONE:
+        break;
+      case INDEX_SORTED:
+        check_range(table.index_offset, table.index_size,
+                    sizeof(SortedIndexEntry));
+        if (table.index_size != table.row_count) {
+          throw DataFormatException("Corrupt baked archive", path);
+        }
+        break;
+      case INDEX_HASHED:
+        check_range(table.index_offset, table.index_size,
+                    sizeof(HashIndexSlot));
+        // Lookups stop at an empty slot, so there must be one.
+        if ((table.index_size & (table.index_size - 1)) != 0 ||
+            table.index_size <= table.row_count) {
+          throw DataFormatException("Corrupt baked archive", path);
+        }
+        break;
+      default:
+        throw DataFormatException("Corrupt baked archive", path);
+    }
+    if (table.index_type != INDEX_NONE &&
+        (table.key_column < 0 ||
+         (uint32)table.key_column >= table.column_count)) {
+      throw DataFormatException("Corrupt baked archive", path);
+    }
+  }
+}
+
+bool BakedArchive::VerifyChecksum() const {
+  fun_check(IsOpen());
+  return ComputeChecksum(base_ + sizeof(FileHeader),
+                         header_->file_size - sizeof(FileHeader)) ==
+         header_->checksum;
+}
+
+BakedTable BakedArchive::GetTable(int32 index) const {
+  fun_check(index >= 0 && index < (int32)header_->table_count);
+  return BakedTable(base_, reinterpret_cast<const TableHeader*>(
+                               base_ + header_->tables_offset) +
+                               index);
+}
+
+BakedTable BakedArchive::FindTable(const StringView& name) const {
+  for (int32 i = 0; i < (int32)header_->table_count; ++i) {
+    BakedTable table = GetTable(i);
+    if (table.GetName() == name) {
+      return table;
+    }
+  }
+  return BakedTable();
+}
+
+}  // namespace fun
@@ -0,0 +1,289 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/shared_memory.h"
+#include "fun/base/string/string.h"
+
+namespace fun {
+
+/**
+ * Column types of a baked table.
+ */
+enum class BakedType : uint32 {
+  None = 0,
+  Bool,
+  Int32,
+  Int64,
+  Float,
+  Double,
+  String,
+};
+
+namespace internal {
+namespace baked {
+
+// On-disk layout. All offsets are from the start of the file, every
+// section is 8-byte aligned and the file is in the byte order of the
+// machine that wrote it; a reader with the other byte order refuses it.
+
+const uint64 MAGIC = 0x31454B41424E5546ULL;  // "FUNBAKE1"
+const uint32 VERSION = 1;
+const uint32 BYTE_ORDER_MARK = 0x01020304;
+
+enum IndexType {
+  INDEX_NONE = 0,
+  // SortedIndexEntry[row_count], by key; duplicate keys allowed.
+  INDEX_SORTED = 1,
+  // HashIndexSlot[power of two], open addressing; unique keys.
+  INDEX_HASHED = 2,
+};
+
+// Strings live in the string pool, NUL-terminated.
+struct StringRef {
+  uint32 offset;
+  uint32 length;
+};
+
+struct FileHeader {
+  uint64 magic;
+  uint32 version;
+  uint32 byte_order_mark;
+  uint64 file_size;
+  uint32 table_count;
+  // Crc32 of everything after the header.
+  uint32 checksum;
+  uint64 tables_offset;
+  uint64 string_pool_offset;
+  uint64 string_pool_size;
+  uint64 reserved;
+};
+
+struct TableHeader {
+  StringRef name;
+  uint32 column_count;
+  uint32 row_count;
+  uint32 row_size;
+  int32 key_column;
+  uint32 index_type;
+  uint32 index_size;
+  uint64 columns_offset;
+  uint64 rows_offset;
+  uint64 index_offset;
+  uint64 reserved;
+};
+
+struct ColumnHeader {
+  StringRef name;
+  uint32 type;
+  // Offset of the cell within a row.
+  uint32 offset;
+};
+
+struct SortedIndexEntry {
+  int64 key;
+  uint32 row;
+  uint32 reserved;
+};
+
+struct HashIndexSlot {
+  uint32 hash;
+  // 0 for an empty slot.
+  uint32 row_plus_one;
+};
+
+inline uint32 GetTypeSize(BakedType type) {
+  switch (type) {
+    case BakedType::Bool:
+      return 1;
+    case BakedType::Int32:
+    case BakedType::Float:
+      return 4;
+    case BakedType::Int64:
+    case BakedType::Double:
+    case BakedType::String:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Crc32 of data, in steps that fit the int32 count of Crc::Crc32().
+ */
+FUN_BASE_API uint32 ComputeChecksum(const char* data, uint64 size);
+
+}  // namespace baked
+}  // namespace internal
+
+/**
+ * Read-only view of one table of a BakedArchive.
+ *
+ * Rows are fixed-size records read in place from the mapped file; nothing
+ * is parsed or copied, and strings are returned as views into the
+ * archive's string pool. A table is valid as long as its archive is open.
+ *
+ * Tables baked with a key column can be searched by key: integer keys
+ * through a sorted index (binary search, duplicates allowed), string keys
+ * through a hash index.
+ *
+ * Cell accessors check the column type and row number in debug builds
+ * only; look column numbers up once with FindColumn().
+ */
+class FUN_BASE_API BakedTable {
+ public:
+  BakedTable() : base_(nullptr), header_(nullptr), columns_(nullptr) {}
+
+  bool IsValid() const { return header_ != nullptr; }
+
+  StringView GetName() const;
+
+  int32 GetRowCount() const { return header_->row_count; }
+  int32 GetColumnCount() const { return header_->column_count; }
+
+  /**
+   * Returns the column number for name, or -1.
+   */
+  int32 FindColumn(const StringView& name) const;
+  StringView GetColumnName(int32 column) const;
+  BakedType GetColumnType(int32 column) const;
+
+  /**
+   * Returns the key column, or -1 if the table has no index.
+   */
+  int32 GetKeyColumn() const { return header_->key_column; }
+
+  /**
+   * Returns the first row with the given key, or -1. The key column must
+   * be an integer column.
+   */
+  int32 FindRow(int64 key) const;
+
+  /**
+   * Returns the row with the given key, or -1. The key column must be a
+   * string column.
+   */
+  int32 FindRow(const StringView& key) const;
+
+  /**
+   * Returns the number of rows with the given integer key; their row
+   * numbers are GetRowAt(first) .. GetRowAt(first + count - 1).
+   */
+  int32 FindRows(int64 key, int32& out_first) const;
+
+  /**
+   * Returns the row number of the index-th row in key order.
+   */
+  int32 GetRowAt(int32 index) const;
+
+  bool GetBool(int32 row, int32 column) const {
+    return *Cell(row, column, BakedType::Bool) != 0;
+  }
+  int32 GetInt32(int32 row, int32 column) const {
+    return *reinterpret_cast<const int32*>(Cell(row, column, BakedType::Int32));
+  }
+  int64 GetInt64(int32 row, int32 column) const {
+    return *reinterpret_cast<const int64*>(Cell(row, column, BakedType::Int64));
+  }
+  float GetFloat(int32 row, int32 column) const {
+    return *reinterpret_cast<const float*>(Cell(row, column, BakedType::Float));
+  }
+  double GetDouble(int32 row, int32 column) const {
+    return *reinterpret_cast<const double*>(
+        Cell(row, column, BakedType::Double));
+  }
+
+  /**
+   * The returned view is NUL-terminated.
+   */
+  StringView GetString(int32 row, int32 column) const;
+
+  /**
+   * Integer cell of either width, e.g. a key.
+   */
+  int64 GetInteger(int32 row, int32 column) const;
+
+ private:
+  friend class BakedArchive;
+
+  BakedTable(const char* base, const internal::baked::TableHeader* header);
+
+  const char* Cell(int32 row, int32 column, BakedType type) const {
+    fun_check(row >= 0 && row < (int32)header_->row_count);
+    fun_check(column >= 0 && column < (int32)header_->column_count);
+    fun_check(columns_[column].type == (uint32)type);
+    return base_ + header_->rows_offset + (uint64)row * header_->row_size +
+           columns_[column].offset;
+  }
+
+  StringView ToView(const internal::baked::StringRef& ref) const;
+
+  const char* base_;
+  const internal::baked::TableHeader* header_;
+  const internal::baked::ColumnHeader* columns_;
+};
+
+/**
+ * Memory-mapped archive of baked data tables, written by
+ * BakedArchiveWriter.
+ *
+ * Opening an archive maps the file read-only and checks its headers; the
+ * tables are used in place, so there is no load time to speak of and the
+ * pages are shared by every process on the host that maps the same file.
+ * Only the pages actually touched are read from disk.
+ *
+ * Replace an archive by writing a new file and renaming it over the old
+ * one (as BakedArchiveWriter::Save() does); rewriting a mapped file in
+ * place crashes the processes reading it.
+ *
+ *   BakedArchive archive("data/items.baked");
+ *   BakedTable items = archive.FindTable("items");
+ *   const int32 damage = items.FindColumn("damage");
+ *   const int32 row = items.FindRow(item_id);
+ *   if (row >= 0) {
+ *     total += items.GetInt32(row, damage);
+ *   }
+ */
+class FUN_BASE_API BakedArchive : Noncopyable {
+ public:
+  BakedArchive();
+
+  /**
+   * Opens path. Throws FileNotFoundException, OpenFileException or
+   * DataFormatException.
+   */
+  explicit BakedArchive(const String& path);
+
+  ~BakedArchive();
+
+  /**
+   * Opens path, closing the current archive. Throws like the constructor.
+   */
+  void Open(const String& path);
+
+  void Close();
+
+  bool IsOpen() const { return header_ != nullptr; }
+
+  /**
+   * Recomputes the checksum, which reads the whole file.
+   */
+  bool VerifyChecksum() const;
+
+  int32 GetTableCount() const { return header_->table_count; }
+
+  BakedTable GetTable(int32 index) const;
+
+  /**
+   * Returns the table with the given name, or an invalid table.
+   */
+  BakedTable FindTable(const StringView& name) const;
+
+ private:
+  void Validate(const String& path) const;
+
+  SharedMemory memory_;
+  const char* base_;
+  const internal::baked::FileHeader* header_;
+};
+
+}  // namespace fun
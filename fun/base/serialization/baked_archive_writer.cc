@@ -0,0 +1,299 @@
+﻿#include "fun/base/serialization/baked_archive_writer.h"
+#include "fun/base/crc.h"
+#include "fun/base/exception.h"
+#include "fun/base/file.h"
+#include "fun/base/file_helper.h"
+
+namespace fun {
+
+using namespace internal::baked;
+
+namespace {
+
+uint32 AlignUp(uint32 value, uint32 alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Appends zeroed, 8-byte aligned space and returns its offset.
+uint64 Allocate(Array<uint8>& out, uint64 size) {
+  const int32 offset = out.Count();
+  out.AddZeroed((int32)AlignUp((uint32)size, 8));
+  return (uint64)offset;
+}
+
+}  // namespace
+
+//
+// BakedTableWriter
+//
+
+BakedTableWriter::BakedTableWriter(BakedArchiveWriter& archive,
+                                   const String& name)
+    : archive_(archive),
+      name_(name),
+      key_column_(-1),
+      row_size_(0),
+      row_count_(0) {}
+
+int32 BakedTableWriter::AddColumn(const String& name, BakedType type) {
+  fun_check(row_count_ == 0);
+
+  const uint32 type_size = GetTypeSize(type);
+  if (type_size == 0) {
+    throw InvalidArgumentException("Invalid baked column type", name);
+  }
+  // Interned strings are unique, so equal names have equal offsets.
+  ColumnHeader column;
+  column.name = archive_.InternString(name);
+  for (int32 i = 0; i < columns_.Count(); ++i) {
+    if (columns_[i].name.offset == column.name.offset) {
+      throw ExistsException("Duplicate baked column", name);
+    }
+  }
+  column.type = (uint32)type;
+  column.offset = AlignUp(row_size_, type_size);
+  row_size_ = column.offset + type_size;
+  columns_.Add(column);
+  return columns_.Count() - 1;
+}
+
+void BakedTableWriter::SetKeyColumn(int32 column) {
+  fun_check(column >= 0 && column < columns_.Count());
+
+  const BakedType type = (BakedType)columns_[column].type;
+  if (type != BakedType::Int32 && type != BakedType::Int64 &&
+      type != BakedType::String) {
+    throw InvalidArgumentException(
+        "Baked key column must be an integer or string", name_);
+  }
+  key_column_ = column;
+}
+
+int32 BakedTableWriter::AddRow() {
+  if (row_count_ == 0) {
+    // The layout is fixed from here on.
+    row_size_ = AlignUp(MathBase::Max<uint32>(row_size_, 1), 8);
+  }
+  rows_.AddZeroed(row_size_);
+  return row_count_++;
+}
+
+uint8* BakedTableWriter::Cell(int32 row, int32 column, BakedType type) {
+  fun_check(row >= 0 && row < row_count_);
+  fun_check(column >= 0 && column < columns_.Count());
+  fun_check(columns_[column].type == (uint32)type);
+  return rows_.MutableData() + (int64)row * row_size_ + columns_[column].offset;
+}
+
+void BakedTableWriter::SetBool(int32 row, int32 column, bool value) {
+  *Cell(row, column, BakedType::Bool) = value ? 1 : 0;
+}
+
+void BakedTableWriter::SetInt32(int32 row, int32 column, int32 value) {
+  UnsafeMemory::Memcpy(Cell(row, column, BakedType::Int32), &value,
+                       sizeof(value));
+}
+
+void BakedTableWriter::SetInt64(int32 row, int32 column, int64 value) {
+  UnsafeMemory::Memcpy(Cell(row, column, BakedType::Int64), &value,
+                       sizeof(value));
+}
+
+void BakedTableWriter::SetFloat(int32 row, int32 column, float value) {
+  UnsafeMemory::Memcpy(Cell(row, column, BakedType::Float), &value,
+                       sizeof(value));
+}
+
+void BakedTableWriter::SetDouble(int32 row, int32 column, double value) {
+  UnsafeMemory::Memcpy(Cell(row, column, BakedType::Double), &value,
+                       sizeof(value));
+}
+
+void BakedTableWriter::SetString(int32 row, int32 column,
+                                 const String& value) {
+  const StringRef ref = archive_.InternString(value);
+  UnsafeMemory::Memcpy(Cell(row, column, BakedType::String), &ref,
+                       sizeof(ref));
+}
+
+//
+// BakedArchiveWriter
+//
+
+BakedArchiveWriter::BakedArchiveWriter() {
+  // Offset 0 is the empty string, so that zeroed cells read as "".
+  InternString(String());
+}
+
+BakedArchiveWriter::~BakedArchiveWriter() {
+  for (int32 i = 0; i < tables_.Count(); ++i) {
+    delete tables_[i];
+  }
+}
+
+BakedTableWriter& BakedArchiveWriter::AddTable(const String& name) {
+  for (int32 i = 0; i < tables_.Count(); ++i) {
+    if (tables_[i]->name_ == name) {
+      throw ExistsException("Duplicate baked table", name);
+    }
+  }
+  tables_.Add(new BakedTableWriter(*this, name));
+  return *tables_.Last();
+}
+
+StringRef BakedArchiveWriter::InternString(const String& value) {
+  StringRef ref;
+  ref.length = (uint32)value.Len();
+
+  if (const uint32* offset = string_offsets_.Find(value)) {
+    ref.offset = *offset;
+    return ref;
+  }
+
+  ref.offset = (uint32)string_pool_.Count();
+  string_pool_.Append(value.ConstData(), value.Len());
+  string_pool_.Add('\0');
+  string_offsets_.Add(value, ref.offset);
+  return ref;
+}
+
+void BakedArchiveWriter::Build(Array<uint8>& out) {
+  out.Reset();
+
+  Allocate(out, sizeof(FileHeader));
+  const uint64 tables_offset =
+      Allocate(out, (uint64)tables_.Count() * sizeof(TableHeader));
+
+  for (int32 t = 0; t < tables_.Count(); ++t) {
+    const BakedTableWriter& table = *tables_[t];
+
+    TableHeader header;
+    UnsafeMemory::Memzero(&header, sizeof(header));
+    header.name = InternString(table.name_);
+    header.column_count = table.columns_.Count();
+    header.row_count = table.row_count_;
+    header.row_size = AlignUp(MathBase::Max<uint32>(table.row_size_, 1), 8);
+    header.key_column = table.key_column_;
+
+    header.columns_offset =
+        Allocate(out, table.columns_.Count() * sizeof(ColumnHeader));
+    UnsafeMemory::Memcpy(out.MutableData() + header.columns_offset,
+                         table.columns_.ConstData(),
+                         table.columns_.Count() * sizeof(ColumnHeader));
+
+    header.rows_offset = Allocate(out, table.rows_.Count());
+    UnsafeMemory::Memcpy(out.MutableData() + header.rows_offset,
+                         table.rows_.ConstData(), table.rows_.Count());
+
+    if (table.key_column_ >= 0) {
+      const ColumnHeader& key = table.columns_[table.key_column_];
+      const uint8* cells = table.rows_.ConstData() + key.offset;
+
+      if ((BakedType)key.type == BakedType::String) {
+        uint32 slot_count = 2;
+        while (slot_count < (uint32)table.row_count_ * 2) {
+          slot_count *= 2;
+        }
+
+        Array<HashIndexSlot> slots;
+        slots.AddZeroed(slot_count);
+        for (int32 row = 0; row < table.row_count_; ++row) {
+          StringRef ref;
+          UnsafeMemory::Memcpy(&ref, cells + (int64)row * table.row_size_,
+                               sizeof(ref));
+          const char* str = string_pool_.ConstData() + ref.offset;
+          const uint32 hash = Crc::Crc32(str, ref.length);
+
+          uint32 i = hash & (slot_count - 1);
+          for (; slots[i].row_plus_one != 0; i = (i + 1) & (slot_count - 1)) {
+            if (slots[i].hash == hash) {
+              StringRef other;
+              UnsafeMemory::Memcpy(
+                  &other,
+                  cells + (int64)(slots[i].row_plus_one - 1) * table.row_size_,
+                  sizeof(other));
+              if (other.offset == ref.offset) {
+                throw DataException("Duplicate key in baked table",
+                                    table.name_ + ": " + String(str));
+              }
+            }
+          }
+          slots[i].hash = hash;
+          slots[i].row_plus_one = row + 1;
+        }
+
+        header.index_type = INDEX_HASHED;
+        header.index_size = slot_count;
+        header.index_offset =
+            Allocate(out, slot_count * sizeof(HashIndexSlot));
+        UnsafeMemory::Memcpy(out.MutableData() + header.index_offset,
+                             slots.ConstData(),
+                             slot_count * sizeof(HashIndexSlot));
+      } else {
+        Array<SortedIndexEntry> entries;
+        entries.AddZeroed(table.row_count_);
+        for (int32 row = 0; row < table.row_count_; ++row) {
+          const uint8* cell = cells + (int64)row * table.row_size_;
+          if ((BakedType)key.type == BakedType::Int32) {
+            int32 value;
+            UnsafeMemory::Memcpy(&value, cell, sizeof(value));
+            entries[row].key = value;
+          } else {
+            UnsafeMemory::Memcpy(&entries[row].key, cell, sizeof(int64));
+          }
+          entries[row].row = row;
+        }
+        // Stable, so rows with equal keys stay in the order they were added.
+        entries.StableSort(
+            [](const SortedIndexEntry& a, const SortedIndexEntry& b) {
+              return a.key < b.key;
+            });
+
+        header.index_type = INDEX_SORTED;
+        header.index_size = table.row_count_;
+        header.index_offset =
+            Allocate(out, entries.Count() * sizeof(SortedIndexEntry));
+        UnsafeMemory::Memcpy(out.MutableData() + header.index_offset,
+                             entries.ConstData(),
+                             entries.Count() * sizeof(SortedIndexEntry));
+      }
+    }
+
+    UnsafeMemory::Memcpy(out.MutableData() + tables_offset +
+                             t * sizeof(TableHeader),
+                         &header, sizeof(header));
+  }
+
+  // Last, since table names were interned above.
+  const uint64 string_pool_offset = Allocate(out, string_pool_.Count());
+  UnsafeMemory::Memcpy(out.MutableData() + string_pool_offset,
+                       string_pool_.ConstData(), string_pool_.Count());
+
+  FileHeader header;
+  UnsafeMemory::Memzero(&header, sizeof(header));
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.byte_order_mark = BYTE_ORDER_MARK;
+  header.file_size = out.Count();
+  header.table_count = tables_.Count();
+  header.tables_offset = tables_offset;
+  header.string_pool_offset = string_pool_offset;
+  header.string_pool_size = string_pool_.Count();
+  header.checksum =
+      ComputeChecksum((const char*)out.ConstData() + sizeof(FileHeader),
+                      out.Count() - sizeof(FileHeader));
+  UnsafeMemory::Memcpy(out.MutableData(), &header, sizeof(header));
+}
+
+void BakedArchiveWriter::Save(const String& path) {
+  Array<uint8> image;
+  Build(image);
+
+  const String temp_path = path + ".tmp";
+  if (!FileHelper::WriteAllBytes(image, temp_path.c_str())) {
+    throw WriteFileException(temp_path);
+  }
+  File(temp_path).RenameTo(path);
+}
+
+}  // namespace fun
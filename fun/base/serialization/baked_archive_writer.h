@@ -0,0 +1,110 @@
+﻿#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/map.h"
+#include "fun/base/serialization/baked_archive.h"
+#include "fun/base/string/string.h"
+
+namespace fun {
+
+class BakedArchiveWriter;
+
+/**
+ * Builds one table of a baked archive. Obtained from
+ * BakedArchiveWriter::AddTable().
+ *
+ * Columns must all be added before the first row. New cells are zero (or
+ * the empty string).
+ */
+class FUN_BASE_API BakedTableWriter : Noncopyable {
+ public:
+  int32 AddColumn(const String& name, BakedType type);
+
+  /**
+   * Makes the table searchable by the given Int32, Int64 or String column.
+   * String keys must be unique.
+   */
+  void SetKeyColumn(int32 column);
+
+  /**
+   * Returns the new row number.
+   */
+  int32 AddRow();
+
+  int32 GetRowCount() const { return row_count_; }
+
+  void SetBool(int32 row, int32 column, bool value);
+  void SetInt32(int32 row, int32 column, int32 value);
+  void SetInt64(int32 row, int32 column, int64 value);
+  void SetFloat(int32 row, int32 column, float value);
+  void SetDouble(int32 row, int32 column, double value);
+  void SetString(int32 row, int32 column, const String& value);
+
+ private:
+  friend class BakedArchiveWriter;
+
+  BakedTableWriter(BakedArchiveWriter& archive, const String& name);
+
+  uint8* Cell(int32 row, int32 column, BakedType type);
+
+  BakedArchiveWriter& archive_;
+  String name_;
+  Array<internal::baked::ColumnHeader> columns_;
+  int32 key_column_;
+  uint32 row_size_;
+  int32 row_count_;
+  Array<uint8> rows_;
+};
+
+/**
+ * Writes a BakedArchive, typically in a build step that converts the
+ * designers' JSON or INI tables:
+ *
+ *   BakedArchiveWriter writer;
+ *   BakedTableWriter& items = writer.AddTable("items");
+ *   const int32 id = items.AddColumn("id", BakedType::Int32);
+ *   const int32 name = items.AddColumn("name", BakedType::String);
+ *   items.SetKeyColumn(id);
+ *   for (...) {
+ *     const int32 row = items.AddRow();
+ *     items.SetInt32(row, id, ...);
+ *     items.SetString(row, name, ...);
+ *   }
+ *   writer.Save("data/items.baked");
+ *
+ * Identical strings are stored once for the whole archive.
+ */
+class FUN_BASE_API BakedArchiveWriter : Noncopyable {
+ public:
+  BakedArchiveWriter();
+  ~BakedArchiveWriter();
+
+  /**
+   * Throws ExistsException if a table with the name was added before.
+   */
+  BakedTableWriter& AddTable(const String& name);
+
+  /**
+   * Builds the archive image.
+   */
+  void Build(Array<uint8>& out);
+
+  /**
+   * Builds the archive and writes it to path through a temporary file
+   * that is renamed over path, so that processes that have the old file
+   * mapped keep reading the old contents. Throws WriteFileException.
+   */
+  void Save(const String& path);
+
+ private:
+  friend class BakedTableWriter;
+
+  internal::baked::StringRef InternString(const String& value);
+
+  Array<BakedTableWriter*> tables_;
+  Array<char> string_pool_;
+  Map<String, uint32> string_offsets_;
+};
+
+}  // namespace fun
@@ -4,6 +4,7 @@
 #include "fun/base/runnable.h"
 #include "fun/base/thread.h"
 #include "fun/base/thread_local.h"
+#include "fun/base/work_stealing_scheduler.h"
 
 #include <ctime>
 #include <sstream>
@@ -211,7 +212,8 @@ ThreadPool::ThreadPool(int32 min_capacity, int32 max_capacity, int32 idle_time,
       age_(0),
       stack_size_(stack_size),
       affinity_policy_(affinity_policy),
-      last_cpu_(0) {
+      last_cpu_(0),
+      scheduled_(nullptr) {
   fun_check(min_capacity >= 1 && max_capacity >= min_capacity && idle_time > 0);
 
   int32 cpu = -1;
@@ -239,7 +241,8 @@ ThreadPool::ThreadPool(const String& name, int32 min_capacity,
       age_(0),
       stack_size_(stack_size),
       affinity_policy_(affinity_policy),
-      last_cpu_(0) {
+      last_cpu_(0),
+      scheduled_(nullptr) {
   fun_check(min_capacity >= 1 && max_capacity >= min_capacity && idle_time > 0);
 
   int32 cpu = -1;
@@ -261,6 +264,17 @@ ThreadPool::~ThreadPool() {
   } catch (...) {
     fun_unexpected();
   }
+
+  delete scheduled_;
+}
+
+void ThreadPool::SetScheduler(WorkStealingScheduler& scheduler) {
+  ScopedLock<FastMutex> guard(mutex_);
+
+  if (scheduled_) {
+    throw IllegalStateException("ThreadPool already has a scheduler");
+  }
+  scheduled_ = new TaskGroup(scheduler);
 }
 
 void ThreadPool::AddCapacity(int32 n) {
@@ -327,6 +341,14 @@ int32 ThreadPool::GetAffinity(int32 cpu) {
 }
 
 void ThreadPool::Start(Runnable& target, int32 cpu) {
+  if (scheduled_ && cpu < 0) {
+    // The scheduler passes exceptions to ErrorHandler, as PooledThread
+    // does.
+    Runnable* runnable = &target;
+    scheduled_->Run([runnable]() { runnable->Run(); });
+    return;
+  }
+
   GetThread()->Start(Thread::PRIO_NORMAL, target, GetAffinity(cpu));
 }
 
@@ -345,6 +367,10 @@ void ThreadPool::StartWithPriority(Thread::Priority priority, Runnable& target,
 }
 
 void ThreadPool::StopAll() {
+  if (scheduled_) {
+    scheduled_->Wait();
+  }
+
   ScopedLock<FastMutex> guard(mutex_);
 
   for (auto& thread : threads_) {
@@ -354,6 +380,10 @@ void ThreadPool::StopAll() {
 }
 
 void ThreadPool::JoinAll() {
+  if (scheduled_) {
+    scheduled_->Wait();
+  }
+
   ScopedLock<FastMutex> guard(mutex_);
 
   for (auto& thread : threads_) {
@@ -11,6 +11,8 @@ namespace fun {
 
 class Runnable;
 class PooledThread;
+class TaskGroup;
+class WorkStealingScheduler;
 
 /**
  * A thread pool always keeps a number of threads running, ready
@@ -28,6 +30,10 @@ class PooledThread;
  * threads are created. Once the demand for threads sinks
  * again, no-longer used threads are stopped and removed
  * from the pool.
+ *
+ * With SetScheduler(), targets started without a name, priority or cpu
+ * run as tasks on a WorkStealingScheduler instead, which suits many short,
+ * CPU-bound targets better than one thread each.
  */
 class FUN_BASE_API ThreadPool {
  public:
@@ -117,8 +123,19 @@ class FUN_BASE_API ThreadPool {
    */
   int32 GetAvailableCount() const;
 
+  /**
+   * Runs the targets of Start(target) without a cpu as tasks on the given
+   * scheduler rather than on threads of the pool. Such targets share a few
+   * worker threads, so they must not block for long; GetUsedCount() and
+   * GetAvailableCount() do not count them. JoinAll() and StopAll() wait
+   * for them. Must be called before the first Start().
+   */
+  void SetScheduler(WorkStealingScheduler& scheduler);
+
   /**
    * Obtains a thread and starts the target on specified cpu.
+   * With a scheduler set and no cpu given, queues the target on the
+   * scheduler instead.
    *
    * Throws a NoThreadAvailableException if no more
    * threads are available.
@@ -224,6 +241,8 @@ class FUN_BASE_API ThreadPool {
   mutable FastMutex mutex_;
   ThreadAffinityPolicy affinity_policy_;
   AtomicCounter32 last_cpu_;
+  // Targets run on the scheduler set by SetScheduler(), if any.
+  TaskGroup* scheduled_;
 };
 
 //
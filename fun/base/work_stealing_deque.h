@@ -0,0 +1,160 @@
+#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/container/array.h"
+
+#include <atomic>
+
+namespace fun {
+
+/**
+ * Chase-Lev work-stealing deque of pointers.
+ *
+ * The owning thread pushes and pops at the bottom (LIFO, so the most
+ * recently spawned, cache-hot work runs first) without any locked
+ * instruction except when racing for the last element. Any other thread
+ * may steal from the top (FIFO, so thieves take the oldest and usually
+ * largest pieces of work).
+ *
+ * The ring grows on demand. Rings that have been replaced are kept until
+ * the deque is destroyed, because a thief may still be reading from one.
+ *
+ * Based on "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ */
+template <typename T>
+class WorkStealingDeque : Noncopyable {
+ public:
+  explicit WorkStealingDeque(int32 initial_capacity = 256)
+      : top_(0), bottom_(0) {
+    fun_check((initial_capacity & (initial_capacity - 1)) == 0);
+    ring_.store(Ring::Create(initial_capacity), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingDeque() {
+    Ring::Destroy(ring_.load(std::memory_order_relaxed));
+    for (int32 i = 0; i < retired_rings_.Count(); ++i) {
+      Ring::Destroy(retired_rings_[i]);
+    }
+  }
+
+  /**
+   * Owner only.
+   */
+  void Push(T* item) {
+    const int64 b = bottom_.load(std::memory_order_relaxed);
+    const int64 t = top_.load(std::memory_order_acquire);
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    if (b - t > ring->mask) {
+      ring = Grow(ring, t, b);
+    }
+    ring->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Owner only. Returns nullptr if the deque is empty.
+   */
+  T* Pop() {
+    const int64 b = bottom_.load(std::memory_order_relaxed) - 1;
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      // Empty.
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    T* item = ring->Get(b);
+    if (t == b) {
+      // Last element; race against thieves for it.
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /**
+   * Any thread. Returns nullptr if the deque is empty or another thread
+   * won the race for the top element.
+   */
+  T* Steal() {
+    int64 t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64 b = bottom_.load(std::memory_order_acquire);
+
+    if (t >= b) {
+      return nullptr;
+    }
+
+    Ring* ring = ring_.load(std::memory_order_acquire);
+    T* item = ring->Get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  /**
+   * Approximate when called concurrently with Push(), Pop() or Steal().
+   */
+  bool IsEmpty() const {
+    const int64 b = bottom_.load(std::memory_order_relaxed);
+    const int64 t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+ private:
+  struct Ring {
+    int64 mask;
+    std::atomic<T*> slots[1];
+
+    static Ring* Create(int64 capacity) {
+      void* mem = UnsafeMemory::Malloc(
+          sizeof(Ring) + sizeof(std::atomic<T*>) * (capacity - 1),
+          alignof(Ring));
+      if (mem == nullptr) {
+        throw OutOfMemoryException("cannot allocate work-stealing deque");
+      }
+      Ring* ring = static_cast<Ring*>(mem);
+      ring->mask = capacity - 1;
+      return ring;
+    }
+
+    static void Destroy(Ring* ring) { UnsafeMemory::Free(ring); }
+
+    T* Get(int64 index) const {
+      return slots[index & mask].load(std::memory_order_relaxed);
+    }
+
+    void Put(int64 index, T* item) {
+      slots[index & mask].store(item, std::memory_order_relaxed);
+    }
+  };
+
+  Ring* Grow(Ring* ring, int64 t, int64 b) {
+    Ring* new_ring = Ring::Create((ring->mask + 1) * 2);
+    for (int64 i = t; i < b; ++i) {
+      new_ring->Put(i, ring->Get(i));
+    }
+    retired_rings_.Add(ring);
+    ring_.store(new_ring, std::memory_order_release);
+    return new_ring;
+  }
+
+  // top_ and bottom_ are written by different threads.
+  alignas(64) std::atomic<int64> top_;
+  alignas(64) std::atomic<int64> bottom_;
+  std::atomic<Ring*> ring_;
+  Array<Ring*> retired_rings_;
+};
+
+}  // namespace fun
@@ -0,0 +1,470 @@
+#include "fun/base/work_stealing_scheduler.h"
+#include "fun/base/environment.h"
+#include "fun/base/error_handler.h"
+#include "fun/base/runnable.h"
+#include "fun/base/thread.h"
+
+#include <cstdio>
+
+namespace fun {
+
+namespace {
+
+// Failed FindWork() rounds before an idle worker goes to sleep.
+const int32 IDLE_SPIN_COUNT = 64;
+
+/**
+ * NUMA node of every cpu, or all zeros if unknown.
+ */
+void GetCpuNodes(int32 cpu_count, Array<int32>& out_nodes) {
+  out_nodes.Reset();
+  out_nodes.AddZeroed(cpu_count);
+
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  for (int32 node = 0; node < 256; ++node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+      if (node > 0) {
+        break;
+      }
+      continue;
+    }
+
+    // Format: "0-7,16-23"
+    int32 first, last;
+    while (fscanf(file, "%d", &first) == 1) {
+      last = first;
+      int ch = fgetc(file);
+      if (ch == '-') {
+        if (fscanf(file, "%d", &last) != 1) {
+          break;
+        }
+        ch = fgetc(file);
+      }
+      for (int32 cpu = first; cpu <= last && cpu < cpu_count; ++cpu) {
+        out_nodes[cpu] = node;
+      }
+      if (ch != ',') {
+        break;
+      }
+    }
+    fclose(file);
+  }
+#endif
+}
+
+}  // namespace
+
+class WorkStealingScheduler::Worker : public Runnable {
+ public:
+  Worker(WorkStealingScheduler* scheduler, int32 index, int32 cpu,
+         int32 node, const String& name)
+      : scheduler(scheduler),
+        index(index),
+        cpu(cpu),
+        node(node),
+        random_state(uint32(index) * 2654435761u + 1),
+        thread(name) {}
+
+  void Run() override { scheduler->WorkerLoop(this); }
+
+  uint32 NextRandom() {
+    // xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+  }
+
+  WorkStealingScheduler* scheduler;
+  int32 index;
+  int32 cpu;
+  int32 node;
+  uint32 random_state;
+  WorkStealingDeque<WorkItem> deque;
+  // Steal order: workers on the same NUMA node first.
+  Array<Worker*> near_victims;
+  Array<Worker*> far_victims;
+  Thread thread;
+};
+
+namespace {
+
+// Set on worker threads only.
+thread_local WorkStealingScheduler* current_scheduler_ = nullptr;
+thread_local int32 current_worker_index_ = -1;
+
+}  // namespace
+
+WorkStealingScheduler::WorkStealingScheduler(
+    int32 worker_count, ThreadPool::ThreadAffinityPolicy affinity_policy,
+    const String& name)
+    : name_(name),
+      injection_count_(0),
+      sleeping_count_(0),
+      stopping_(false) {
+  if (affinity_policy == ThreadPool::TAP_CUSTOM) {
+    throw InvalidArgumentException(
+        "TAP_CUSTOM requires a cpu list, use the cpus constructor");
+  }
+
+  const int32 cpu_count = Environment::GetProcessorCount();
+  if (worker_count <= 0) {
+    worker_count = cpu_count;
+  }
+
+  Array<int32> cpus;
+  for (int32 i = 0; i < worker_count; ++i) {
+    cpus.Add(affinity_policy == ThreadPool::TAP_UNIFORM_DISTRIBUTION
+                 ? i % cpu_count
+                 : -1);
+  }
+
+  Array<int32> nodes;
+  GetCpuNodes(cpu_count, nodes);
+  StartWorkers(cpus, nodes);
+}
+
+WorkStealingScheduler::WorkStealingScheduler(const Array<int32>& cpus,
+                                             const String& name)
+    : name_(name),
+      injection_count_(0),
+      sleeping_count_(0),
+      stopping_(false) {
+  const int32 cpu_count = Environment::GetProcessorCount();
+  for (int32 i = 0; i < cpus.Count(); ++i) {
+    if (cpus[i] < -1 || cpus[i] >= cpu_count) {
+      throw InvalidArgumentException("cpu argument is invalid");
+    }
+  }
+  if (cpus.Count() == 0) {
+    throw InvalidArgumentException("no workers");
+  }
+
+  Array<int32> nodes;
+  GetCpuNodes(cpu_count, nodes);
+  StartWorkers(cpus, nodes);
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+  stopping_.store(true);
+  {
+    ScopedLock<FastMutex> guard(sleep_mutex_);
+    sleep_cond_.NotifyAll();
+  }
+
+  for (int32 i = 0; i < workers_.Count(); ++i) {
+    workers_[i]->thread.Join();
+  }
+  for (int32 i = 0; i < workers_.Count(); ++i) {
+    delete workers_[i];
+  }
+  workers_.Reset();
+
+  // Submitted while the workers were shutting down.
+  while (WorkItem* item = TakeInjected()) {
+    Execute(item);
+  }
+}
+
+void WorkStealingScheduler::StartWorkers(const Array<int32>& cpus,
+                                         const Array<int32>& nodes) {
+  for (int32 i = 0; i < cpus.Count(); ++i) {
+    const int32 cpu = cpus[i];
+    const int32 node = cpu >= 0 ? nodes[cpu] : 0;
+
+    String thread_name;
+    thread_name << name_ << "[#" << (i + 1) << "]";
+    workers_.Add(new Worker(this, i, cpu, node, thread_name));
+  }
+
+  for (int32 i = 0; i < workers_.Count(); ++i) {
+    Worker* worker = workers_[i];
+    for (int32 j = 0; j < workers_.Count(); ++j) {
+      if (j == i) {
+        continue;
+      }
+      if (workers_[j]->node == worker->node) {
+        worker->near_victims.Add(workers_[j]);
+      } else {
+        worker->far_victims.Add(workers_[j]);
+      }
+    }
+  }
+
+  for (int32 i = 0; i < workers_.Count(); ++i) {
+    Worker* worker = workers_[i];
+    worker->thread.Start(*worker);
+    if (worker->cpu >= 0) {
+      worker->thread.SetAffinity(worker->cpu);
+    }
+  }
+}
+
+void WorkStealingScheduler::Submit(Runnable& target) {
+  Enqueue(new WorkItem{TaskFunc(), &target, nullptr});
+}
+
+void WorkStealingScheduler::Submit(const TaskFunc& func) {
+  Enqueue(new WorkItem{func, nullptr, nullptr});
+}
+
+int32 WorkStealingScheduler::GetCurrentWorkerIndex() const {
+  return current_scheduler_ == this ? current_worker_index_ : -1;
+}
+
+WorkStealingScheduler& WorkStealingScheduler::Default() {
+  static WorkStealingScheduler scheduler(0, ThreadPool::TAP_DEFAULT,
+                                         "WorkStealingScheduler");
+  return scheduler;
+}
+
+void WorkStealingScheduler::Enqueue(WorkItem* item) {
+  const int32 worker_index = GetCurrentWorkerIndex();
+  if (worker_index >= 0) {
+    workers_[worker_index]->deque.Push(item);
+  } else {
+    ScopedLock<FastMutex> guard(injection_mutex_);
+    injection_queue_.Append(item);
+    injection_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  WakeUpOne();
+}
+
+void WorkStealingScheduler::WakeUpOne() {
+  // Pairs with the fence in WorkerLoop(): either we see the sleeper, or
+  // the sleeper sees the work we just queued.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_count_.load(std::memory_order_relaxed) > 0) {
+    ScopedLock<FastMutex> guard(sleep_mutex_);
+    sleep_cond_.NotifyOne();
+  }
+}
+
+WorkStealingScheduler::WorkItem* WorkStealingScheduler::TakeInjected() {
+  if (injection_count_.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+
+  ScopedLock<FastMutex> guard(injection_mutex_);
+  if (injection_queue_.IsEmpty()) {
+    return nullptr;
+  }
+  injection_count_.fetch_sub(1, std::memory_order_relaxed);
+  return injection_queue_.CutFront();
+}
+
+WorkStealingScheduler::WorkItem* WorkStealingScheduler::FindWork(
+    Worker* worker) {
+  if (WorkItem* item = worker->deque.Pop()) {
+    return item;
+  }
+
+  if (WorkItem* item = TakeInjected()) {
+    return item;
+  }
+
+  // Start at a random victim so thieves spread over the victims.
+  const Array<Worker*>* groups[2] = {&worker->near_victims,
+                                     &worker->far_victims};
+  for (int32 g = 0; g < 2; ++g) {
+    const Array<Worker*>& victims = *groups[g];
+    const int32 count = victims.Count();
+    if (count == 0) {
+      continue;
+    }
+    const int32 start = int32(worker->NextRandom() % uint32(count));
+    for (int32 i = 0; i < count; ++i) {
+      if (WorkItem* item = victims[(start + i) % count]->deque.Steal()) {
+        return item;
+      }
+    }
+  }
+  return nullptr;
+}
+
+bool WorkStealingScheduler::HasQueuedWork() const {
+  if (injection_count_.load(std::memory_order_relaxed) > 0) {
+    return true;
+  }
+  for (int32 i = 0; i < workers_.Count(); ++i) {
+    if (!workers_[i]->deque.IsEmpty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkStealingScheduler::RunOneTask() {
+  WorkItem* item = nullptr;
+
+  const int32 worker_index = GetCurrentWorkerIndex();
+  if (worker_index >= 0) {
+    item = FindWork(workers_[worker_index]);
+  } else {
+    item = TakeInjected();
+    for (int32 i = 0; item == nullptr && i < workers_.Count(); ++i) {
+      item = workers_[i]->deque.Steal();
+    }
+  }
+
+  if (item == nullptr) {
+    return false;
+  }
+  Execute(item);
+  return true;
+}
+
+void WorkStealingScheduler::Execute(WorkItem* item) {
+  try {
+    if (item->target) {
+      item->target->Run();
+    } else {
+      item->func();
+    }
+  } catch (Exception& e) {
+    ErrorHandler::Handle(e);
+  } catch (std::exception& e) {
+    ErrorHandler::Handle(e);
+  } catch (...) {
+    ErrorHandler::Handle();
+  }
+
+  TaskGroup* group = item->group;
+  delete item;
+
+  // The group may be gone as soon as its count drops to zero; only the
+  // scheduler is touched afterwards.
+  if (group &&
+      group->pending_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    ScopedLock<FastMutex> guard(group_done_mutex_);
+    group_done_cond_.NotifyAll();
+  }
+}
+
+void WorkStealingScheduler::WorkerLoop(Worker* worker) {
+  current_scheduler_ = this;
+  current_worker_index_ = worker->index;
+
+  int32 idle_spins = 0;
+  for (;;) {
+    if (WorkItem* item = FindWork(worker)) {
+      Execute(item);
+      idle_spins = 0;
+      continue;
+    }
+
+    if (stopping_.load()) {
+      break;
+    }
+
+    if (++idle_spins < IDLE_SPIN_COUNT) {
+      Thread::Yield();
+      continue;
+    }
+
+    ScopedLock<FastMutex> guard(sleep_mutex_);
+    sleeping_count_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!stopping_.load() && !HasQueuedWork()) {
+      sleep_cond_.Wait(sleep_mutex_);
+    }
+    sleeping_count_.fetch_sub(1, std::memory_order_relaxed);
+    idle_spins = 0;
+  }
+
+  current_scheduler_ = nullptr;
+  current_worker_index_ = -1;
+}
+
+//
+// TaskGroup
+//
+
+TaskGroup::TaskGroup(WorkStealingScheduler& scheduler)
+    : scheduler_(scheduler), pending_count_(0) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Run(const WorkStealingScheduler::TaskFunc& func) {
+  pending_count_.fetch_add(1, std::memory_order_relaxed);
+  scheduler_.Enqueue(
+      new WorkStealingScheduler::WorkItem{func, nullptr, this});
+}
+
+void TaskGroup::Wait() {
+  const bool on_worker = scheduler_.GetCurrentWorkerIndex() >= 0;
+
+  while (pending_count_.load(std::memory_order_acquire) > 0) {
+    if (scheduler_.RunOneTask()) {
+      continue;
+    }
+
+    // A worker keeps looking for tasks, since the ones of the group may
+    // be queued behind it. Any other thread sleeps until the last task of
+    // the group is done.
+    if (on_worker) {
+      Thread::Yield();
+      continue;
+    }
+
+    ScopedLock<FastMutex> guard(scheduler_.group_done_mutex_);
+    if (pending_count_.load(std::memory_order_acquire) > 0) {
+      scheduler_.group_done_cond_.Wait(scheduler_.group_done_mutex_);
+    }
+  }
+}
+
+//
+// ParallelFor
+//
+
+namespace {
+
+struct ParallelForRange {
+  const Function<void(int32, int32)>* body;
+  TaskGroup* group;
+  int32 grain_size;
+
+  // Hands off the upper half until the rest is small enough to run here.
+  void Split(int32 begin, int32 end) const {
+    while (end - begin > grain_size) {
+      const int32 middle = begin + (end - begin) / 2;
+      const ParallelForRange self = *this;
+      group->Run([self, middle, end]() { self.Split(middle, end); });
+      end = middle;
+    }
+    (*body)(begin, end);
+  }
+};
+
+}  // namespace
+
+void ParallelFor(int32 begin, int32 end, int32 grain_size,
+                 const Function<void(int32, int32)>& body,
+                 WorkStealingScheduler& scheduler) {
+  if (end <= begin) {
+    return;
+  }
+
+  if (grain_size <= 0) {
+    grain_size = MathBase::Max(
+        1, (end - begin) / (scheduler.GetWorkerCount() * 8));
+  }
+
+  if (end - begin <= grain_size) {
+    body(begin, end);
+    return;
+  }
+
+  TaskGroup group(scheduler);
+  const ParallelForRange range = {&body, &group, grain_size};
+  range.Split(begin, end);
+  group.Wait();
+}
+
+}  // namespace fun
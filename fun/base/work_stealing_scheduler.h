@@ -0,0 +1,181 @@
+#pragma once
+
+#include "fun/base/base.h"
+#include "fun/base/condition.h"
+#include "fun/base/container/array.h"
+#include "fun/base/container/list.h"
+#include "fun/base/mutex.h"
+#include "fun/base/string/string.h"
+#include "fun/base/thread_pool.h"
+#include "fun/base/work_stealing_deque.h"
+
+#include <atomic>
+
+namespace fun {
+
+class Runnable;
+class TaskGroup;
+
+/**
+ * Fixed set of worker threads that balance short, CPU-bound tasks by
+ * work stealing.
+ *
+ * Each worker owns a WorkStealingDeque. Work spawned on a worker goes to
+ * the bottom of its own deque and is popped from there again, so nested
+ * work stays on the core that produced it; an idle worker steals from the
+ * top of another worker's deque. Work submitted from outside the workers
+ * goes through a shared injection queue. Idle workers spin briefly and
+ * then sleep until work arrives.
+ *
+ * With TAP_UNIFORM_DISTRIBUTION each worker is pinned to its own cpu, and
+ * on NUMA machines an idle worker tries the workers on its own node
+ * before stealing across nodes. TAP_CUSTOM pins worker i to cpus[i].
+ *
+ * Unlike ThreadPool, which hands every Runnable a thread of its own, the
+ * scheduler multiplexes many tasks on few threads, so tasks should not
+ * block for long. Use TaskGroup and ParallelFor() to wait for a batch of
+ * tasks; a waiting worker keeps executing other tasks meanwhile, which
+ * makes nested parallelism safe.
+ *
+ *   // AI tick: one task per 64 agents.
+ *   ParallelFor(0, agents.Count(), 64, [&agents](int32 begin, int32 end) {
+ *     for (int32 i = begin; i < end; ++i) {
+ *       agents[i]->Think();
+ *     }
+ *   });
+ */
+class FUN_BASE_API WorkStealingScheduler : Noncopyable {
+ public:
+  typedef Function<void()> TaskFunc;
+
+  /**
+   * Starts worker_count workers, or one per processor if worker_count
+   * is 0.
+   */
+  explicit WorkStealingScheduler(
+      int32 worker_count = 0,
+      ThreadPool::ThreadAffinityPolicy affinity_policy =
+          ThreadPool::TAP_DEFAULT,
+      const String& name = String());
+
+  /**
+   * Starts one worker per entry of cpus, pinned to that cpu.
+   */
+  WorkStealingScheduler(const Array<int32>& cpus,
+                        const String& name = String());
+
+  /**
+   * Runs all queued tasks to completion and stops the workers.
+   */
+  ~WorkStealingScheduler();
+
+  /**
+   * Schedules target to run once on a worker. target must stay valid
+   * until its Run() has returned. Exceptions thrown by Run() are passed
+   * to ErrorHandler.
+   */
+  void Submit(Runnable& target);
+
+  /**
+   * Schedules func to run once on a worker.
+   */
+  void Submit(const TaskFunc& func);
+
+  int32 GetWorkerCount() const { return workers_.Count(); }
+
+  /**
+   * Index of the calling worker of this scheduler, or -1 if the calling
+   * thread is not one of them.
+   */
+  int32 GetCurrentWorkerIndex() const;
+
+  const String& GetName() const { return name_; }
+
+  /**
+   * Process-wide scheduler with one worker per processor, created on
+   * first use.
+   */
+  static WorkStealingScheduler& Default();
+
+ private:
+  friend class TaskGroup;
+
+  struct WorkItem {
+    TaskFunc func;
+    Runnable* target;
+    TaskGroup* group;
+  };
+
+  class Worker;
+
+  void StartWorkers(const Array<int32>& cpus, const Array<int32>& nodes);
+  void Enqueue(WorkItem* item);
+  WorkItem* FindWork(Worker* worker);
+  WorkItem* TakeInjected();
+  bool HasQueuedWork() const;
+  bool RunOneTask();
+  void Execute(WorkItem* item);
+  void WakeUpOne();
+  void WorkerLoop(Worker* worker);
+
+  String name_;
+  Array<Worker*> workers_;
+
+  mutable FastMutex injection_mutex_;
+  List<WorkItem*> injection_queue_;
+  std::atomic<int32> injection_count_;
+
+  FastMutex sleep_mutex_;
+  Condition sleep_cond_;
+  std::atomic<int32> sleeping_count_;
+  std::atomic<bool> stopping_;
+
+  // Signalled whenever the last task of a TaskGroup is done.
+  FastMutex group_done_mutex_;
+  Condition group_done_cond_;
+};
+
+/**
+ * Set of tasks that can be waited for together.
+ *
+ *   TaskGroup group;
+ *   for (PathRequest* request : requests) {
+ *     group.Run([request]() { request->Solve(); });
+ *   }
+ *   group.Wait();
+ *
+ * Wait() executes queued tasks on the calling thread while there are
+ * any; a thread that is not a worker then sleeps until the group is done.
+ * The destructor waits for tasks that are still running.
+ */
+class FUN_BASE_API TaskGroup : Noncopyable {
+ public:
+  explicit TaskGroup(
+      WorkStealingScheduler& scheduler = WorkStealingScheduler::Default());
+  ~TaskGroup();
+
+  void Run(const WorkStealingScheduler::TaskFunc& func);
+
+  void Wait();
+
+ private:
+  friend class WorkStealingScheduler;
+
+  WorkStealingScheduler& scheduler_;
+  std::atomic<int32> pending_count_;
+};
+
+/**
+ * Calls body(range_begin, range_end) for consecutive subranges of
+ * [begin, end) of at most grain_size elements, in parallel, and returns
+ * when all of them are done. The range is split recursively, so idle
+ * workers steal large halves instead of single chunks.
+ *
+ * A grain_size of 0 picks one that yields about eight chunks per worker.
+ */
+FUN_BASE_API void ParallelFor(
+    int32 begin, int32 end, int32 grain_size,
+    const Function<void(int32, int32)>& body,
+    WorkStealingScheduler& scheduler = WorkStealingScheduler::Default());
+
+}  // namespace fun
@@ -0,0 +1,225 @@
+﻿#include "fun/base/filesys/layered_platform_fs.h"
+#include "fun/base/io/async_io_system_linux.h"
+#include "fun/base/random.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace fun;
+
+// Startup-load benchmark: many assets of random size read from one large
+// pack file with a cold page cache, first one blocking read at a time (the
+// base AsyncIoSystemBase path), then through AsyncIoSystemLinux on each
+// backend.
+//
+// The page cache is dropped for the pack with posix_fadvise() before every
+// run, which works without root since the pack is synced after writing.
+
+struct BenchConfig {
+  const char* path;
+  int64 pack_size;
+  int32 min_asset_size;
+  int32 max_asset_size;
+  int32 queue_depth;
+};
+
+struct Asset {
+  int64 offset;
+  int64 size;
+  AsyncIoPriority priority;
+};
+
+static void WritePack(const BenchConfig& config) {
+  const int fd = ::open(config.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open");
+    exit(1);
+  }
+
+  const int32 block_size = 4 * 1024 * 1024;
+  char* block = (char*)malloc(block_size);
+  for (int32 i = 0; i < block_size; ++i) {
+    block[i] = (char)(i * 31);
+  }
+  for (int64 written = 0; written < config.pack_size;) {
+    const ssize_t n = ::write(
+        fd, block, (size_t)MathBase::Min<int64>(block_size,
+                                                config.pack_size - written));
+    if (n <= 0) {
+      perror("write");
+      exit(1);
+    }
+    written += n;
+  }
+  ::fsync(fd);
+  ::close(fd);
+  free(block);
+}
+
+static void DropPageCache(const char* path) {
+  const int fd = ::open(path, O_RDONLY);
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+// Assets laid out back to back, as a cooker would, and requested in a
+// shuffled order with mixed priorities. Runs of neighbours (a package and
+// its dependencies) share a priority and stay together, so that there is
+// something to coalesce.
+static void MakeAssets(const BenchConfig& config, Array<Asset>& assets) {
+  const int32 run_length = 8;
+
+  Random random;
+  random.SetSeed(1234);
+
+  int64 offset = 0;
+  AsyncIoPriority priority = AsyncIoPriority::Normal;
+  for (;;) {
+    Asset asset;
+    asset.offset = offset;
+    asset.size = config.min_asset_size +
+                 random.Next(config.max_asset_size - config.min_asset_size);
+    if (assets.Count() % run_length == 0) {
+      priority = (AsyncIoPriority)random.Next((uint32)AsyncIoPriority::Max + 1);
+    }
+    asset.priority = priority;
+    if (offset + asset.size > config.pack_size) {
+      break;
+    }
+    assets.Add(asset);
+    offset += asset.size;
+  }
+
+  for (int32 i = 0; i + run_length < assets.Count(); i += run_length) {
+    const int32 j = (int32)random.Next((uint32)(assets.Count() / run_length)) *
+                    run_length;
+    for (int32 k = 0; k < run_length && j + k < assets.Count(); ++k) {
+      const Asset tmp = assets[i + k];
+      assets[i + k] = assets[j + k];
+      assets[j + k] = tmp;
+    }
+  }
+}
+
+static void Report(const char* name, int64 bytes, int32 count,
+                   double seconds) {
+  printf("  %-18s %8.3f s  %8.1f MB/s  %9.0f assets/s\n", name, seconds,
+         bytes / seconds / (1024.0 * 1024.0), count / seconds);
+}
+
+static void RunBlocking(const BenchConfig& config, const Array<Asset>& assets,
+                        char* buffer) {
+  DropPageCache(config.path);
+
+  Stopwatch watch;
+  watch.Start();
+  const int fd = ::open(config.path, O_RDONLY);
+  int64 bytes = 0;
+  for (int32 priority = (int32)AsyncIoPriority::Max;
+       priority >= (int32)AsyncIoPriority::Min; --priority) {
+    for (int32 i = 0; i < assets.Count(); ++i) {
+      const Asset& asset = assets[i];
+      if ((int32)asset.priority == priority) {
+        bytes += ::pread(fd, buffer + asset.offset, asset.size, asset.offset);
+      }
+    }
+  }
+  ::close(fd);
+  watch.Stop();
+
+  Report("blocking pread", bytes, assets.Count(), watch.ElapsedSeconds());
+}
+
+static void RunAsync(const BenchConfig& config, const Array<Asset>& assets,
+                     char* buffer, AsyncIoSystemLinux::Backend backend) {
+  AsyncIoSystemLinux* io_system;
+  try {
+    io_system = new AsyncIoSystemLinux(
+        LayeredPlatformFS::Get().GetPlatformFS(), backend,
+        config.queue_depth);
+  } catch (Exception& e) {
+    printf("  %-18s skipped: %s\n", "io_uring", e.what());
+    return;
+  }
+
+  Thread thread("AsyncIoSystem");
+  thread.StartFunc([io_system]() { io_system->Run(); });
+
+  DropPageCache(config.path);
+
+  Stopwatch watch;
+  watch.Start();
+  AtomicCounter32 counter;
+  counter = assets.Count();
+  int64 bytes = 0;
+  for (int32 i = 0; i < assets.Count(); ++i) {
+    const Asset& asset = assets[i];
+    io_system->LoadData(config.path, asset.offset, asset.size,
+                        buffer + asset.offset, &counter, asset.priority);
+    bytes += asset.size;
+  }
+  while (counter.Value() > 0) {
+    Thread::Sleep(1);
+  }
+  watch.Stop();
+
+  String name(io_system->GetBackendName());
+  Report(name.c_str(), bytes, assets.Count(), watch.ElapsedSeconds());
+  if (io_system->GetFailedReadCount() > 0) {
+    printf("  %d reads failed\n", io_system->GetFailedReadCount());
+  }
+
+  io_system->BlockTillAllRequestsFinishedAndFlushHandles();
+  io_system->Stop();
+  thread.Join();
+  delete io_system;
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {"/tmp/fun_async_io_bench.pak", 2LL << 30, 4 * 1024,
+                        1024 * 1024, 64};
+  bool keep = false;
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      config.path = argv[++i];
+    } else if (::strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      config.pack_size = (int64)(atof(argv[++i]) * (1LL << 30));
+    } else if (::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      config.queue_depth = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-k") == 0) {
+      keep = true;
+    } else {
+      printf("Usage: %s [-f pack file] [-g pack GB] [-d queue depth] [-k]\n",
+             argv[0]);
+      return 0;
+    }
+  }
+
+  Array<Asset> assets;
+  MakeAssets(config, assets);
+  printf("%s: %.2f GB, %d assets of %d..%d bytes, queue depth %d\n",
+         config.path, config.pack_size / double(1LL << 30), assets.Count(),
+         config.min_asset_size, config.max_asset_size, config.queue_depth);
+
+  WritePack(config);
+
+  // One destination the size of the pack, like a level loading into its
+  // final memory; touched once so page faults are not measured.
+  char* buffer = (char*)malloc((size_t)config.pack_size);
+  memset(buffer, 0, (size_t)config.pack_size);
+
+  RunBlocking(config, assets, buffer);
+  RunAsync(config, assets, buffer, AsyncIoSystemLinux::BACKEND_IO_URING);
+  RunAsync(config, assets, buffer, AsyncIoSystemLinux::BACKEND_PREAD_POOL);
+
+  free(buffer);
+  if (!keep) {
+    ::unlink(config.path);
+  }
+  return 0;
+}
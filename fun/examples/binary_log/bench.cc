@@ -0,0 +1,154 @@
+#include "fun/base/logging/async_sink.h"
+#include "fun/base/logging/binary_logger.h"
+#include "fun/base/logging/logger.h"
+#include "fun/base/logging/null_sink.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+
+// Compares the per-call cost of the classic Logger + AsyncSink path with
+// BinaryLogger, both writing to a NullSink so only the logging machinery
+// itself is measured.
+
+struct BenchConfig {
+  int threads;
+  int messages_per_thread;
+};
+
+class AsyncSinkWorker : public Runnable {
+ public:
+  AsyncSinkWorker(Logger& logger, int index, int count)
+      : logger_(logger), index_(index), count_(count), seconds_(0) {}
+
+  void Run() override {
+    const String name("player");
+    Stopwatch watch;
+    watch.Start();
+    for (int i = 0; i < count_; ++i) {
+      if (logger_.IsEnabledForInformation()) {
+        String text;
+        text << "thread " << index_ << " msg " << i << " name " << name;
+        logger_.LogInformation(text, __FILE__, __LINE__);
+      }
+    }
+    watch.Stop();
+    seconds_ = watch.ElapsedSeconds();
+  }
+
+  double GetSeconds() const { return seconds_; }
+
+ private:
+  Logger& logger_;
+  int index_;
+  int count_;
+  double seconds_;
+};
+
+class BinaryLoggerWorker : public Runnable {
+ public:
+  BinaryLoggerWorker(BinaryLogger& logger, int index, int count)
+      : logger_(logger), index_(index), count_(count), seconds_(0) {}
+
+  void Run() override {
+    const String name("player");
+    Stopwatch watch;
+    watch.Start();
+    for (int i = 0; i < count_; ++i) {
+      fun_fast_information(logger_, "thread %d msg %d name %s", index_, i,
+                           name);
+    }
+    watch.Stop();
+    seconds_ = watch.ElapsedSeconds();
+  }
+
+  double GetSeconds() const { return seconds_; }
+
+ private:
+  BinaryLogger& logger_;
+  int index_;
+  int count_;
+  double seconds_;
+};
+
+template <typename Worker, typename LoggerType>
+void RunWorkers(const char* name, LoggerType& logger,
+                const BenchConfig& config) {
+  Array<Worker*> workers;
+  Array<Thread*> threads;
+  for (int t = 0; t < config.threads; ++t) {
+    workers.Add(new Worker(logger, t, config.messages_per_thread));
+    threads.Add(new Thread("bench"));
+  }
+
+  Stopwatch wall;
+  wall.Start();
+  for (int t = 0; t < config.threads; ++t) {
+    threads[t]->Start(*workers[t]);
+  }
+  double call_seconds = 0;
+  for (int t = 0; t < config.threads; ++t) {
+    threads[t]->Join();
+    call_seconds += workers[t]->GetSeconds();
+  }
+  wall.Stop();
+
+  const double total = double(config.threads) * config.messages_per_thread;
+  printf("  %-14s %8.1f ns/call  %10.0f calls/s (wall %.3f s)\n", name,
+         call_seconds * 1e9 / total, total / wall.ElapsedSeconds(),
+         wall.ElapsedSeconds());
+
+  for (int t = 0; t < config.threads; ++t) {
+    delete threads[t];
+    delete workers[t];
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {16, 200000};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      config.threads = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.messages_per_thread = atoi(argv[++i]);
+    } else {
+      printf("Usage: %s [-t threads] [-n messages per thread]\n", argv[0]);
+      return 0;
+    }
+  }
+
+  printf("%d threads x %d messages\n", config.threads,
+         config.messages_per_thread);
+
+  {
+    AsyncSink::Ptr async_sink = new AsyncSink(new NullSink);
+    Logger& logger = Logger::Create("bench.async", async_sink,
+                                    LogLevel::Information);
+    RunWorkers<AsyncSinkWorker>("AsyncSink", logger, config);
+    async_sink->Close();
+  }
+
+  {
+    BinaryLogger::Ptr logger =
+        new BinaryLogger("bench.binary", new NullSink,
+                         BinaryLogger::DEFAULT_RING_CAPACITY,
+                         BinaryLogger::BLOCK_WHEN_FULL);
+    RunWorkers<BinaryLoggerWorker>("BinaryLogger", *logger, config);
+    logger->Flush();
+  }
+
+  {
+    BinaryLogger::Ptr logger =
+        new BinaryLogger("bench.binary", new NullSink,
+                         BinaryLogger::DEFAULT_RING_CAPACITY,
+                         BinaryLogger::DROP_WHEN_FULL);
+    RunWorkers<BinaryLoggerWorker>("Binary (drop)", *logger, config);
+    logger->Flush();
+    printf("  %lld messages dropped\n", (long long)logger->GetDroppedCount());
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+﻿#include "fun/base/container/flat_hash_map.h"
+#include "fun/base/container/flat_hash_set.h"
+#include "fun/base/container/map.h"
+#include "fun/base/container/set.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/string/string.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+
+// Compares Map and Set with FlatHashMap and FlatHashSet on the operations
+// servers do most: insert, lookup hits, lookup misses and erase, at sizes
+// from L1-resident to far beyond the last level cache.
+//
+// Two key types: 64-bit ids (like HostId or session ids) and strings of
+// 8 to 40 characters (like names or URLs). String lookups into the flat
+// containers go through a StringView, as they would when parsing a
+// request, while Set has to be given a String.
+
+struct BenchConfig {
+  int32 min_count;
+  int32 max_count;
+  int32 lookups;
+};
+
+struct BenchResult {
+  double insert_ns;
+  double hit_ns;
+  double miss_ns;
+  double erase_ns;
+};
+
+static uint64 XorShift(uint64& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static double NsPerOp(const Stopwatch& stopwatch, int64 ops) {
+  return stopwatch.ElapsedSeconds() * 1e9 / ops;
+}
+
+// Keeps the lookups from being optimized away.
+static volatile int64 g_sink;
+
+//
+// Integer keys
+//
+
+static void MakeIntKeys(int32 count, Array<uint64>& out_keys,
+                        Array<uint64>& out_misses) {
+  uint64 state = 0x2545F4914F6CDD1DULL;
+  out_keys.Reset();
+  out_misses.Reset();
+  for (int32 i = 0; i < count; ++i) {
+    // Odd keys are in the container, even keys are the misses.
+    out_keys.Add(XorShift(state) | 1);
+    out_misses.Add(XorShift(state) & ~uint64(1));
+  }
+}
+
+template <typename MapType>
+static BenchResult BenchIntMap(const Array<uint64>& keys,
+                               const Array<uint64>& misses, int32 lookups) {
+  BenchResult result;
+  Stopwatch stopwatch;
+  MapType map;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    map.Add(keys[i], keys[i]);
+  }
+  stopwatch.Stop();
+  result.insert_ns = NsPerOp(stopwatch, keys.Count());
+
+  int64 sum = 0;
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    const uint64* value = map.Find(keys[i % keys.Count()]);
+    sum += value ? (int64)*value : 0;
+  }
+  stopwatch.Stop();
+  result.hit_ns = NsPerOp(stopwatch, lookups);
+
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    sum += map.Find(misses[i % misses.Count()]) != nullptr;
+  }
+  stopwatch.Stop();
+  result.miss_ns = NsPerOp(stopwatch, lookups);
+  g_sink = sum;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    map.Remove(keys[i]);
+  }
+  stopwatch.Stop();
+  result.erase_ns = NsPerOp(stopwatch, keys.Count());
+  return result;
+}
+
+//
+// String keys
+//
+
+static void MakeStringKeys(int32 count, Array<String>& out_keys,
+                           Array<String>& out_misses) {
+  uint64 state = 0x9E3779B97F4A7C15ULL;
+  out_keys.Reset();
+  out_misses.Reset();
+  char buf[64];
+  for (int32 i = 0; i < count; ++i) {
+    const int32 pad = 8 + (int32)(XorShift(state) % 33);
+    int32 len = snprintf(buf, sizeof(buf), "key:%d:", i);
+    while (len < pad) {
+      buf[len++] = 'a' + (char)(XorShift(state) % 26);
+    }
+    out_keys.Add(String(buf, len));
+    buf[0] = 'K';
+    out_misses.Add(String(buf, len));
+  }
+}
+
+template <typename SetType>
+static BenchResult BenchStringSet(const Array<String>& keys,
+                                  const Array<String>& misses, int32 lookups) {
+  BenchResult result;
+  Stopwatch stopwatch;
+  SetType set;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    set.Add(keys[i]);
+  }
+  stopwatch.Stop();
+  result.insert_ns = NsPerOp(stopwatch, keys.Count());
+
+  int64 sum = 0;
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    sum += set.Contains(keys[i % keys.Count()]);
+  }
+  stopwatch.Stop();
+  result.hit_ns = NsPerOp(stopwatch, lookups);
+
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    sum += set.Contains(misses[i % misses.Count()]);
+  }
+  stopwatch.Stop();
+  result.miss_ns = NsPerOp(stopwatch, lookups);
+  g_sink = sum;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    set.Remove(keys[i]);
+  }
+  stopwatch.Stop();
+  result.erase_ns = NsPerOp(stopwatch, keys.Count());
+  return result;
+}
+
+// Lookups by StringView, which only the flat containers support.
+static BenchResult BenchStringViewFlatSet(const Array<String>& keys,
+                                          const Array<String>& misses,
+                                          int32 lookups) {
+  Array<StringView> key_views;
+  Array<StringView> miss_views;
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    key_views.Add(StringView(keys[i].ConstData(), keys[i].Len()));
+    miss_views.Add(StringView(misses[i].ConstData(), misses[i].Len()));
+  }
+
+  BenchResult result;
+  Stopwatch stopwatch;
+  FlatHashSet<String> set;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    set.Add(keys[i]);
+  }
+  stopwatch.Stop();
+  result.insert_ns = NsPerOp(stopwatch, keys.Count());
+
+  int64 sum = 0;
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    sum += set.Contains(key_views[i % key_views.Count()]);
+  }
+  stopwatch.Stop();
+  result.hit_ns = NsPerOp(stopwatch, lookups);
+
+  stopwatch.Start();
+  for (int32 i = 0; i < lookups; ++i) {
+    sum += set.Contains(miss_views[i % miss_views.Count()]);
+  }
+  stopwatch.Stop();
+  result.miss_ns = NsPerOp(stopwatch, lookups);
+  g_sink = sum;
+
+  stopwatch.Start();
+  for (int32 i = 0; i < keys.Count(); ++i) {
+    set.Remove(key_views[i]);
+  }
+  stopwatch.Stop();
+  result.erase_ns = NsPerOp(stopwatch, keys.Count());
+  return result;
+}
+
+static void PrintResult(const char* name, int32 count,
+                        const BenchResult& result) {
+  printf("  %-24s %9d  %8.1f  %8.1f  %8.1f  %8.1f\n", name, count,
+         result.insert_ns, result.hit_ns, result.miss_ns, result.erase_ns);
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {1000, 10000000, 2000000};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-min") == 0 && i + 1 < argc) {
+      config.min_count = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+      config.max_count = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      config.lookups = atoi(argv[++i]);
+    } else {
+      printf("Usage: %s [-min count] [-max count] [-l lookups]\n", argv[0]);
+      return 0;
+    }
+  }
+
+  printf("  %-24s %9s  %8s  %8s  %8s  %8s   (ns/op)\n", "container", "count",
+         "insert", "hit", "miss", "erase");
+
+  Array<uint64> int_keys;
+  Array<uint64> int_misses;
+  for (int32 count = config.min_count; count <= config.max_count;
+       count *= 10) {
+    MakeIntKeys(count, int_keys, int_misses);
+    PrintResult("Map<uint64>", count,
+                BenchIntMap<Map<uint64, uint64>>(int_keys, int_misses,
+                                                 config.lookups));
+    PrintResult("FlatHashMap<uint64>", count,
+                BenchIntMap<FlatHashMap<uint64, uint64>>(int_keys, int_misses,
+                                                         config.lookups));
+  }
+  int_keys.Reset();
+  int_misses.Reset();
+
+  Array<String> string_keys;
+  Array<String> string_misses;
+  for (int32 count = config.min_count; count <= config.max_count;
+       count *= 10) {
+    MakeStringKeys(count, string_keys, string_misses);
+    PrintResult("Set<String>", count,
+                BenchStringSet<Set<String>>(string_keys, string_misses,
+                                            config.lookups));
+    PrintResult("FlatHashSet<String>", count,
+                BenchStringSet<FlatHashSet<String>>(string_keys, string_misses,
+                                                    config.lookups));
+    PrintResult("FlatHashSet<StringView>", count,
+                BenchStringViewFlatSet(string_keys, string_misses,
+                                       config.lookups));
+  }
+  return 0;
+}
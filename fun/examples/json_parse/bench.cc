@@ -0,0 +1,147 @@
+#include "fun/base/stopwatch.h"
+#include "fun/json/document.h"
+#include "fun/json/on_demand.h"
+#include "fun/json/reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+using namespace fun::json;
+
+bool ReadFile(const char* path, String& out) {
+  FILE* fp = ::fopen(path, "rb");
+  if (fp == nullptr) {
+    return false;
+  }
+  ::fseek(fp, 0, SEEK_END);
+  const long size = ::ftell(fp);
+  ::fseek(fp, 0, SEEK_SET);
+  out.ResizeUninitialized((int32)size);
+  const size_t read = ::fread(out.MutableData(), 1, size, fp);
+  ::fclose(fp);
+  return read == (size_t)size;
+}
+
+// Touches every value so that the on-demand pass does comparable work.
+int64 Walk(const JCursor& cursor) {
+  int64 count = 1;
+  switch (cursor.GetType()) {
+    case ValueType::Object: {
+      JObjectCursor members(cursor);
+      StringView name;
+      JCursor value;
+      while (members.Next(name, value)) {
+        count += Walk(value);
+      }
+      break;
+    }
+    case ValueType::Array: {
+      JArrayCursor elements(cursor);
+      JCursor element;
+      while (elements.Next(element)) {
+        count += Walk(element);
+      }
+      break;
+    }
+    case ValueType::Double: {
+      double value;
+      cursor.GetDouble(value);
+      break;
+    }
+    case ValueType::Integer: {
+      int64 value;
+      cursor.GetInteger(value);
+      break;
+    }
+    default:
+      break;
+  }
+  return count;
+}
+
+void Report(const char* name, double seconds, int64 bytes, int iterations) {
+  printf("  %-10s %8.3f s  %8.1f MB/s\n", name, seconds,
+         (double)bytes * iterations / seconds / (1024.0 * 1024.0));
+}
+
+void Bench(const char* path, int iterations) {
+  String json;
+  if (!ReadFile(path, json)) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return;
+  }
+
+  printf("%s: %d bytes, stage 1: %s\n", path, json.Len(),
+         StructuralIndex::GetImplementationName());
+
+  Stopwatch watch;
+
+  watch.Restart();
+  for (int i = 0; i < iterations; ++i) {
+    Reader reader;
+    JValue root;
+    if (!reader.Parse(json, root, false)) {
+      fprintf(stderr, "Reader failed: %s\n",
+              *reader.GetFormattedErrorMessages());
+      return;
+    }
+  }
+  watch.Stop();
+  Report("reader", watch.ElapsedSeconds(), json.Len(), iterations);
+
+  StructuralIndex index;
+  watch.Restart();
+  for (int i = 0; i < iterations; ++i) {
+    index.Build(json.ConstData(), json.Len());
+  }
+  watch.Stop();
+  Report("stage1", watch.ElapsedSeconds(), json.Len(), iterations);
+
+  DocumentParser parser;
+  JDocument doc;
+  watch.Restart();
+  for (int i = 0; i < iterations; ++i) {
+    if (!parser.Parse(json, doc)) {
+      fprintf(stderr, "DocumentParser failed at %d: %s\n",
+              parser.GetErrorOffset(), *parser.GetErrorMessage());
+      return;
+    }
+  }
+  watch.Stop();
+  Report("document", watch.ElapsedSeconds(), json.Len(), iterations);
+
+  OnDemandParser on_demand;
+  int64 values = 0;
+  watch.Restart();
+  for (int i = 0; i < iterations; ++i) {
+    if (!on_demand.Iterate(json)) {
+      fprintf(stderr, "OnDemandParser failed: %s\n",
+              *on_demand.GetErrorMessage());
+      return;
+    }
+    values = Walk(on_demand.GetRoot());
+  }
+  watch.Stop();
+  Report("on-demand", watch.ElapsedSeconds(), json.Len(), iterations);
+  printf("  %lld values, document arena %lld bytes\n", (long long)values,
+         (long long)doc.GetAllocatedSize());
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s [-n iterations] file.json...\n", argv[0]);
+    return 0;
+  }
+
+  int iterations = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+      continue;
+    }
+    Bench(argv[i], iterations);
+  }
+  return 0;
+}
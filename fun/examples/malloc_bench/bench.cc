@@ -0,0 +1,692 @@
+﻿#include "fun/base/container/map.h"
+#include "fun/base/malloc_ansi.h"
+#include "fun/base/malloc_binned.h"
+#include "fun/base/malloc_binned2.h"
+#include "fun/base/malloc_jemalloc.h"
+#include "fun/base/malloc_tbb.h"
+#include "fun/base/malloc_thread_safe_proxy.h"
+#include "fun/base/malloc_trace_proxy.h"
+#include "fun/base/memory.h"
+#include "fun/base/metrics.h"
+#include "fun/base/random.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+#include <unistd.h>
+#endif
+
+using namespace fun;
+
+// Replays allocation traces against the MemoryAllocator backends and
+// reports throughput, malloc/free latency, RSS and fragmentation over time
+// and the share of cross-thread frees.
+//
+// Traces are either recorded from a running server with
+// MemoryAllocatorTraceProxy (-r trace) or generated for one of the
+// built-in server-like workloads:
+//
+//   request   each thread allocates a few dozen blocks per request and
+//             frees them when the request is done
+//   session   each thread keeps a window of long-lived objects and
+//             replaces random ones, which fragments the heap
+//   pipeline  producers allocate messages that consumers on other threads
+//             free
+//   growth    buffers grown by Realloc, next to small allocations
+//
+// Every recorded thread is replayed on a thread of its own, in the
+// recorded order; a thread that frees a block another thread has not
+// allocated yet waits for it. The backends run one after another in this
+// process, so RSS is reported relative to the start of each run; use -b
+// to measure one backend in a fresh process.
+
+struct BenchConfig {
+  int threads;
+  int ops_per_thread;
+  const char* workload;
+  const char* backend;
+  const char* trace_path;
+};
+
+//
+// Backends
+//
+
+static MemoryAllocator* CreateAnsi() { return new MemoryAllocatorAnsi(); }
+
+static MemoryAllocator* CreateBinned() {
+  return new MemoryAllocatorBinned(
+      (uint32)PlatformMemory::GetConstants().PageSize, 0x100000000);
+}
+
+static MemoryAllocator* CreateBinned2() { return new MemoryAllocatorBinned2(); }
+
+#if FUN_SUPPORTS_JEMALLOC
+static MemoryAllocator* CreateJemalloc() {
+  return new MemoryAllocatorJemalloc();
+}
+#endif
+
+#if FUN_PLATFORM_SUPPORTS_TBB && FUN_TBB_ALLOCATOR_ALLOWED
+static MemoryAllocator* CreateTbb() { return new MemoryAllocatorTBB(); }
+#endif
+
+struct Backend {
+  const char* name;
+  MemoryAllocator* (*create)();
+};
+
+static const Backend BACKENDS[] = {
+    {"ansi", CreateAnsi},
+    {"binned", CreateBinned},
+    {"binned2", CreateBinned2},
+#if FUN_SUPPORTS_JEMALLOC
+    {"jemalloc", CreateJemalloc},
+#endif
+#if FUN_PLATFORM_SUPPORTS_TBB && FUN_TBB_ALLOCATOR_ALLOWED
+    {"tbb", CreateTbb},
+#endif
+};
+
+//
+// Workloads
+//
+
+// Mostly small objects, some buffers, rarely a large one.
+static uint64 NextSize(Random& random) {
+  const uint32 bucket = random.Next(100);
+  if (bucket < 60) {
+    return 16 + random.Next(112);
+  } else if (bucket < 90) {
+    return 128 + random.Next(896);
+  } else if (bucket < 99) {
+    return 1024 + random.Next(15 * 1024);
+  } else {
+    return 16 * 1024 + random.Next(240 * 1024);
+  }
+}
+
+/**
+ * Builds a trace as if recorded. Step s of thread t happens at time
+ * s * thread_count + t, so steps of all threads interleave. Addresses are
+ * never reused.
+ */
+class TraceBuilder {
+ public:
+  TraceBuilder(Array<MallocTraceEvent>& events, int thread_count)
+      : events_(events), thread_count_(thread_count), next_ptr_(16) {}
+
+  uint64 Malloc(int thread, int64 step, uint64 size, uint32 alignment = 0) {
+    const uint64 ptr = next_ptr_;
+    next_ptr_ += 16;
+    Add(MallocTraceEvent::OP_MALLOC, thread, step, ptr, 0, size, alignment);
+    return ptr;
+  }
+
+  uint64 Realloc(int thread, int64 step, uint64 old_ptr, uint64 size) {
+    const uint64 ptr = next_ptr_;
+    next_ptr_ += 16;
+    Add(MallocTraceEvent::OP_REALLOC, thread, step, ptr, old_ptr, size, 0);
+    return ptr;
+  }
+
+  void Free(int thread, int64 step, uint64 ptr) {
+    Add(MallocTraceEvent::OP_FREE, thread, step, ptr, 0, 0, 0);
+  }
+
+  void Finish() {
+    events_.StableSort([](const MallocTraceEvent& a,
+                          const MallocTraceEvent& b) {
+      return a.time_ns < b.time_ns;
+    });
+  }
+
+ private:
+  void Add(MallocTraceEvent::Op op, int thread, int64 step, uint64 ptr,
+           uint64 old_ptr, uint64 size, uint32 alignment) {
+    MallocTraceEvent& event = events_.AddZeroedAndReturnRef();
+    event.time_ns = (uint64)step * thread_count_ + thread;
+    event.ptr = ptr;
+    event.old_ptr = old_ptr;
+    event.size = size;
+    event.alignment = alignment;
+    event.thread_index = (uint16)thread;
+    event.op = (uint8)op;
+  }
+
+  Array<MallocTraceEvent>& events_;
+  int thread_count_;
+  uint64 next_ptr_;
+};
+
+static void GenerateRequest(TraceBuilder& builder, const BenchConfig& config) {
+  for (int t = 0; t < config.threads; ++t) {
+    Random random;
+    random.SetSeed(t + 1);
+    Array<uint64> held;
+    int64 step = 0;
+    while (step < config.ops_per_thread) {
+      const int count = 4 + (int)random.Next(28);
+      for (int i = 0; i < count; ++i) {
+        held.Add(builder.Malloc(t, step++, NextSize(random)));
+      }
+      while (held.Count() > 0) {
+        const int32 index = (int32)random.Next(held.Count());
+        builder.Free(t, step++, held[index]);
+        held.RemoveAtSwap(index);
+      }
+    }
+  }
+}
+
+static void GenerateSession(TraceBuilder& builder, const BenchConfig& config) {
+  const int32 WINDOW = 4096;
+  for (int t = 0; t < config.threads; ++t) {
+    Random random;
+    random.SetSeed(t + 1);
+    Array<uint64> live;
+    int64 step = 0;
+    while (step < config.ops_per_thread) {
+      if (live.Count() == WINDOW) {
+        const int32 index = (int32)random.Next(live.Count());
+        builder.Free(t, step++, live[index]);
+        live.RemoveAtSwap(index);
+      }
+      // Some objects want a cache line of their own.
+      const uint32 alignment = random.Next(64) == 0 ? 64 : 0;
+      live.Add(builder.Malloc(t, step++, NextSize(random), alignment));
+    }
+    for (int32 i = 0; i < live.Count(); ++i) {
+      builder.Free(t, step++, live[i]);
+    }
+  }
+}
+
+static void GeneratePipeline(TraceBuilder& builder,
+                             const BenchConfig& config) {
+  // Thread t produces for thread t + 1, which frees the message this many
+  // steps later.
+  const int64 LAG = 64;
+  for (int t = 0; t < config.threads; ++t) {
+    Random random;
+    random.SetSeed(t + 1);
+    const int consumer = (t + 1) % config.threads;
+    for (int64 step = 0; step < config.ops_per_thread / 2; ++step) {
+      const uint64 message = builder.Malloc(t, step * 2, 64 + random.Next(960));
+      builder.Free(consumer, step * 2 + 1 + LAG * 2, message);
+    }
+  }
+}
+
+static void GenerateGrowth(TraceBuilder& builder, const BenchConfig& config) {
+  for (int t = 0; t < config.threads; ++t) {
+    Random random;
+    random.SetSeed(t + 1);
+    int64 step = 0;
+    while (step < config.ops_per_thread) {
+      uint64 size = 64;
+      uint64 buffer = builder.Malloc(t, step++, size);
+      const uint64 final_size = 1024 << random.Next(7);
+      while (size < final_size) {
+        size *= 2;
+        buffer = builder.Realloc(t, step++, buffer, size);
+        const uint64 small = builder.Malloc(t, step++, NextSize(random) % 256);
+        builder.Free(t, step++, small);
+      }
+      builder.Free(t, step++, buffer);
+    }
+  }
+}
+
+static bool GenerateTrace(const char* workload, const BenchConfig& config,
+                          Array<MallocTraceEvent>& events) {
+  TraceBuilder builder(events, config.threads);
+  if (::strcmp(workload, "request") == 0) {
+    GenerateRequest(builder, config);
+  } else if (::strcmp(workload, "session") == 0) {
+    GenerateSession(builder, config);
+  } else if (::strcmp(workload, "pipeline") == 0) {
+    GeneratePipeline(builder, config);
+  } else if (::strcmp(workload, "growth") == 0) {
+    GenerateGrowth(builder, config);
+  } else {
+    return false;
+  }
+  builder.Finish();
+  return true;
+}
+
+//
+// Replay
+//
+
+struct ReplayOp {
+  uint64 size;
+  // Block allocated (Malloc, Realloc) or freed (Free).
+  int32 slot;
+  // Block reallocated.
+  int32 old_slot;
+  uint32 alignment;
+  uint8 op;
+};
+
+/**
+ * A trace turned into per-thread operations on numbered blocks ("slots")
+ * instead of addresses.
+ */
+struct ReplayPlan {
+  Array<Array<ReplayOp>> threads;
+  Array<uint64> slot_sizes;
+  Array<uint16> slot_threads;
+  int64 op_count;
+  int64 free_count;
+  int64 cross_thread_free_count;
+  // Events on blocks allocated before the trace started.
+  int64 skipped_count;
+
+  ReplayPlan()
+      : op_count(0), free_count(0), cross_thread_free_count(0),
+        skipped_count(0) {}
+};
+
+static void BuildPlan(const Array<MallocTraceEvent>& events,
+                      ReplayPlan& plan) {
+  Map<uint64, int32> live;
+
+  for (int32 i = 0; i < events.Count(); ++i) {
+    const MallocTraceEvent& event = events[i];
+    while (plan.threads.Count() <= event.thread_index) {
+      plan.threads.AddDefaulted();
+    }
+
+    ReplayOp op;
+    op.size = event.size;
+    op.slot = -1;
+    op.old_slot = -1;
+    op.alignment = event.alignment;
+    op.op = event.op;
+
+    if (event.op == MallocTraceEvent::OP_FREE ||
+        event.op == MallocTraceEvent::OP_REALLOC) {
+      const uint64 old_ptr =
+          event.op == MallocTraceEvent::OP_FREE ? event.ptr : event.old_ptr;
+      if (old_ptr != 0) {
+        int32 slot;
+        if (!live.RemoveAndCopyValue(old_ptr, slot)) {
+          ++plan.skipped_count;
+          // A Realloc of an unknown block becomes a Malloc.
+          if (event.op == MallocTraceEvent::OP_FREE) {
+            continue;
+          }
+          op.op = MallocTraceEvent::OP_MALLOC;
+        } else {
+          ++plan.free_count;
+          if (plan.slot_threads[slot] != event.thread_index) {
+            ++plan.cross_thread_free_count;
+          }
+          if (event.op == MallocTraceEvent::OP_FREE) {
+            op.slot = slot;
+          } else {
+            op.old_slot = slot;
+          }
+        }
+      } else if (event.op == MallocTraceEvent::OP_REALLOC) {
+        op.op = MallocTraceEvent::OP_MALLOC;
+      } else {
+        continue;
+      }
+    }
+
+    if (op.op != MallocTraceEvent::OP_FREE) {
+      if (event.ptr == 0) {
+        if (op.old_slot >= 0 && event.size > 0) {
+          // A failed Realloc leaves the block alone.
+          live.Add(event.old_ptr, op.old_slot);
+          continue;
+        }
+        if (op.op == MallocTraceEvent::OP_MALLOC) {
+          // A failed allocation.
+          continue;
+        }
+        // Realloc to 0 bytes, a Free.
+        op.op = MallocTraceEvent::OP_FREE;
+        op.slot = op.old_slot;
+        op.old_slot = -1;
+      } else {
+        // An address that is still live was released without the proxy
+        // seeing it; forget the old block.
+        live.Remove(event.ptr);
+        op.slot = plan.slot_sizes.Count();
+        plan.slot_sizes.Add(event.size);
+        plan.slot_threads.Add(event.thread_index);
+        live.Add(event.ptr, op.slot);
+      }
+    }
+
+    plan.threads[event.thread_index].Add(op);
+    ++plan.op_count;
+  }
+}
+
+namespace {
+
+void* const PENDING = reinterpret_cast<void*>(~UPTRINT(0));
+
+// Latency is measured for every SAMPLE_INTERVAL-th call only, to keep the
+// clock reads out of the throughput.
+const int32 SAMPLE_INTERVAL = 8;
+
+struct alignas(FUN_PLATFORM_CACHE_LINE_SIZE) ThreadLiveBytes {
+  std::atomic<int64> value;
+};
+
+inline int64 NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+/**
+ * State shared by the replay threads of one run.
+ */
+struct ReplayRun {
+  MemoryAllocator* malloc;
+  const ReplayPlan* plan;
+  std::atomic<void*>* slots;
+  ThreadLiveBytes* live_bytes;
+  Histogram malloc_latency;
+  Histogram free_latency;
+  std::atomic<int32> finished_count;
+};
+
+class ReplayWorker : public Runnable {
+ public:
+  ReplayWorker(ReplayRun& run, int32 thread_index)
+      : run_(run), thread_index_(thread_index) {}
+
+  void Run() override {
+    const Array<ReplayOp>& ops = run_.plan->threads[thread_index_];
+    std::atomic<int64>& live_bytes = run_.live_bytes[thread_index_].value;
+    int64 live = 0;
+
+    for (int32 i = 0; i < ops.Count(); ++i) {
+      const ReplayOp& op = ops[i];
+      const bool sample = (i % SAMPLE_INTERVAL) == 0;
+
+      if (op.op == MallocTraceEvent::OP_MALLOC) {
+        const int64 start = sample ? NowNs() : 0;
+        void* ptr = run_.malloc->Malloc(op.size, op.alignment);
+        if (sample) {
+          run_.malloc_latency.Record(NowNs() - start);
+        }
+        Touch(ptr, op.size);
+        run_.slots[op.slot].store(ptr, std::memory_order_release);
+        live += op.size;
+      } else if (op.op == MallocTraceEvent::OP_FREE) {
+        void* ptr = WaitForSlot(op.slot);
+        const int64 start = sample ? NowNs() : 0;
+        run_.malloc->Free(ptr);
+        if (sample) {
+          run_.free_latency.Record(NowNs() - start);
+        }
+        live -= run_.plan->slot_sizes[op.slot];
+      } else {
+        void* old_ptr = WaitForSlot(op.old_slot);
+        void* ptr = run_.malloc->Realloc(old_ptr, op.size, op.alignment);
+        Touch(ptr, op.size);
+        run_.slots[op.slot].store(ptr, std::memory_order_release);
+        live += op.size - run_.plan->slot_sizes[op.old_slot];
+      }
+      live_bytes.store(live, std::memory_order_relaxed);
+    }
+
+    ++run_.finished_count;
+  }
+
+ private:
+  /**
+   * Writes a byte per page, as a server would fill the block, so that
+   * RSS reflects the allocator's layout.
+   */
+  static void Touch(void* ptr, uint64 size) {
+    char* bytes = static_cast<char*>(ptr);
+    for (uint64 offset = 0; offset < size; offset += 4096) {
+      bytes[offset] = 1;
+    }
+  }
+
+  void* WaitForSlot(int32 slot) {
+    void* ptr;
+    while ((ptr = run_.slots[slot].load(std::memory_order_acquire)) ==
+           PENDING) {
+      Thread::Yield();
+    }
+    // Allocated and freed at most once each.
+    run_.slots[slot].store(nullptr, std::memory_order_relaxed);
+    return ptr;
+  }
+
+  ReplayRun& run_;
+  int32 thread_index_;
+};
+
+static int64 ReadRss() {
+#if FUN_PLATFORM == FUN_PLATFORM_LINUX
+  int64 rss = 0;
+  FILE* file = ::fopen("/proc/self/statm", "r");
+  if (file) {
+    long long size = 0;
+    long long resident = 0;
+    if (::fscanf(file, "%lld %lld", &size, &resident) == 2) {
+      rss = resident * ::sysconf(_SC_PAGESIZE);
+    }
+    ::fclose(file);
+  }
+  return rss;
+#else
+  return 0;
+#endif
+}
+
+struct RssSample {
+  double seconds;
+  int64 rss;
+  int64 live;
+};
+
+static void Replay(const Backend& backend, const ReplayPlan& plan) {
+  MemoryAllocator* base_malloc = backend.create();
+  MemoryAllocator* malloc = base_malloc;
+  if (!malloc->IsInternallyThreadSafe()) {
+    malloc = new MemoryAllocatorThreadSafeProxy(base_malloc);
+  }
+
+  MetricsRegistry registry;
+  ReplayRun run;
+  run.malloc = malloc;
+  run.plan = &plan;
+  run.slots = new std::atomic<void*>[plan.slot_sizes.Count()];
+  for (int32 i = 0; i < plan.slot_sizes.Count(); ++i) {
+    run.slots[i].store(PENDING, std::memory_order_relaxed);
+  }
+  const int32 thread_count = plan.threads.Count();
+  run.live_bytes = new ThreadLiveBytes[thread_count];
+  for (int32 t = 0; t < thread_count; ++t) {
+    run.live_bytes[t].value = 0;
+  }
+  run.malloc_latency = registry.GetHistogram("malloc_ns");
+  run.free_latency = registry.GetHistogram("free_ns");
+  run.finished_count = 0;
+
+  Array<ReplayWorker*> workers;
+  Array<Thread*> threads;
+  for (int32 t = 0; t < thread_count; ++t) {
+    workers.Add(new ReplayWorker(run, t));
+    threads.Add(new Thread("replay"));
+  }
+
+  const int64 base_rss = ReadRss();
+  Array<RssSample> samples;
+  Stopwatch wall;
+  wall.Start();
+  for (int32 t = 0; t < thread_count; ++t) {
+    threads[t]->Start(*workers[t]);
+  }
+  while (run.finished_count.load() < thread_count) {
+    Thread::Sleep(10);
+    RssSample sample;
+    sample.seconds = wall.ElapsedSeconds();
+    sample.rss = ReadRss() - base_rss;
+    sample.live = 0;
+    for (int32 t = 0; t < thread_count; ++t) {
+      sample.live += run.live_bytes[t].value.load(std::memory_order_relaxed);
+    }
+    samples.Add(sample);
+  }
+  for (int32 t = 0; t < thread_count; ++t) {
+    threads[t]->Join();
+  }
+  wall.Stop();
+
+  const double seconds = wall.ElapsedSeconds();
+  printf("  %s\n", backend.name);
+  printf("    throughput   %8.2f Mops/s (wall %.3f s)\n",
+         plan.op_count / seconds / 1e6, seconds);
+
+  const HistogramSnapshot malloc_latency = run.malloc_latency.Read();
+  const HistogramSnapshot free_latency = run.free_latency.Read();
+  printf("    malloc       p50 %6lld ns  p99 %6lld ns  p99.9 %7lld ns\n",
+         (long long)malloc_latency.GetPercentile(0.5),
+         (long long)malloc_latency.GetPercentile(0.99),
+         (long long)malloc_latency.GetPercentile(0.999));
+  printf("    free         p50 %6lld ns  p99 %6lld ns  p99.9 %7lld ns\n",
+         (long long)free_latency.GetPercentile(0.5),
+         (long long)free_latency.GetPercentile(0.99),
+         (long long)free_latency.GetPercentile(0.999));
+
+  // About ten samples, including the peak.
+  int32 peak = 0;
+  for (int32 i = 1; i < samples.Count(); ++i) {
+    if (samples[i].rss > samples[peak].rss) {
+      peak = i;
+    }
+  }
+  const int32 stride = MathBase::Max(1, samples.Count() / 10);
+  printf("    %8s %10s %10s %10s\n", "time(s)", "rss(MB)", "live(MB)",
+         "rss/live");
+  for (int32 i = 0; i < samples.Count(); ++i) {
+    if (i % stride != 0 && i != peak && i != samples.Count() - 1) {
+      continue;
+    }
+    const RssSample& sample = samples[i];
+    printf("    %8.2f %10.1f %10.1f %10.2f%s\n", sample.seconds,
+           sample.rss / 1048576.0, sample.live / 1048576.0,
+           sample.live > 0 ? double(sample.rss) / sample.live : 0.0,
+           i == peak ? "  (peak)" : "");
+  }
+
+  // Blocks the trace never freed.
+  for (int32 i = 0; i < plan.slot_sizes.Count(); ++i) {
+    void* ptr = run.slots[i].load();
+    if (ptr != PENDING && ptr != nullptr) {
+      malloc->Free(ptr);
+    }
+  }
+  malloc->Trim();
+  printf("    rss after freeing everything and Trim(): %.1f MB\n",
+         (ReadRss() - base_rss) / 1048576.0);
+
+  for (int32 t = 0; t < thread_count; ++t) {
+    delete threads[t];
+    delete workers[t];
+  }
+  delete[] run.live_bytes;
+  delete[] run.slots;
+  if (malloc != base_malloc) {
+    delete malloc;
+  }
+  delete base_malloc;
+}
+
+static void RunBenchmark(const char* name,
+                         const Array<MallocTraceEvent>& events,
+                         const BenchConfig& config) {
+  ReplayPlan plan;
+  BuildPlan(events, plan);
+
+  printf("%s: %d thread(s), %lld ops, %.1f%% of frees cross-thread", name,
+         plan.threads.Count(), (long long)plan.op_count,
+         plan.free_count > 0
+             ? 100.0 * plan.cross_thread_free_count / plan.free_count
+             : 0.0);
+  if (plan.skipped_count > 0) {
+    printf(", %lld events on blocks from before the trace",
+           (long long)plan.skipped_count);
+  }
+  printf("\n");
+
+  for (size_t i = 0; i < sizeof(BACKENDS) / sizeof(BACKENDS[0]); ++i) {
+    if (::strcmp(config.backend, "all") == 0 ||
+        ::strcmp(config.backend, BACKENDS[i].name) == 0) {
+      Replay(BACKENDS[i], plan);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {8, 500000, "all", "all", nullptr};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      config.threads = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.ops_per_thread = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      config.workload = argv[++i];
+    } else if (::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      config.backend = argv[++i];
+    } else if (::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      config.trace_path = argv[++i];
+    } else {
+      printf(
+          "Usage: %s [-t threads] [-n ops per thread]\n"
+          "          [-w request|session|pipeline|growth|all]\n"
+          "          [-b ansi|binned|binned2|jemalloc|tbb|all]\n"
+          "          [-r trace recorded with MemoryAllocatorTraceProxy]\n",
+          argv[0]);
+      return 0;
+    }
+  }
+
+  if (config.trace_path) {
+    Array<MallocTraceEvent> events;
+    MemoryAllocatorTraceProxy::LoadTrace(config.trace_path, events);
+    RunBenchmark(config.trace_path, events, config);
+    return 0;
+  }
+
+  static const char* const WORKLOADS[] = {"request", "session", "pipeline",
+                                          "growth"};
+  bool found = false;
+  for (const char* workload : WORKLOADS) {
+    if (::strcmp(config.workload, "all") == 0 ||
+        ::strcmp(config.workload, workload) == 0) {
+      Array<MallocTraceEvent> events;
+      GenerateTrace(workload, config, events);
+      RunBenchmark(workload, events, config);
+      found = true;
+    }
+  }
+  if (!found) {
+    printf("unknown workload: %s\n", config.workload);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,172 @@
+﻿#include "fun/base/malloc_binned2.h"
+#include "fun/base/random.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+
+// Measures the latency of dependent loads over memory that comes from
+// MemoryAllocatorBinned2, to compare its huge page and NUMA arena options.
+//
+// Every thread allocates a list of small nodes and links them in a random
+// order, so that each hop is a cache miss and, once the list is larger
+// than the TLB reach, a TLB miss; huge pages cut the latter. With -N the
+// nodes come from the arena of the node the thread runs on; without it,
+// threads on other nodes may share pages placed on one node.
+//
+// MemoryAllocatorBinned2 is a process-wide singleton, so a process
+// measures one configuration; run it once per option set.
+
+struct ChaseConfig {
+  int threads;
+  int nodes_per_thread;
+  int node_size;
+  int rounds;
+  PlatformMemory::HugePageMode huge_pages;
+  bool numa_arenas;
+};
+
+struct ChaseNode {
+  ChaseNode* next;
+};
+
+class ChaseWorker : public Runnable {
+ public:
+  ChaseWorker(MemoryAllocator* malloc, const ChaseConfig& config, int seed)
+      : malloc_(malloc), config_(config), seed_(seed), ns_per_hop_(0.0) {}
+
+  void Run() override {
+    malloc_->SetupTlsCachesOnCurrentThread();
+
+    Array<ChaseNode*> nodes;
+    nodes.Reserve(config_.nodes_per_thread);
+    for (int i = 0; i < config_.nodes_per_thread; ++i) {
+      nodes.Add((ChaseNode*)malloc_->Malloc(config_.node_size));
+    }
+
+    // Link the nodes into one cycle in a random order.
+    Random random;
+    random.SetSeed(seed_);
+    for (int32 i = nodes.Count() - 1; i > 0; --i) {
+      const int32 j = (int32)random.Next(i + 1);
+      ChaseNode* tmp = nodes[i];
+      nodes[i] = nodes[j];
+      nodes[j] = tmp;
+    }
+    for (int32 i = 0; i < nodes.Count(); ++i) {
+      nodes[i]->next = nodes[(i + 1) % nodes.Count()];
+    }
+
+    // One round to warm the caches, then measure.
+    const int64 hops = (int64)nodes.Count() * config_.rounds;
+    ChaseNode* node = nodes[0];
+    for (int32 i = 0; i < nodes.Count(); ++i) {
+      node = node->next;
+    }
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    for (int64 i = 0; i < hops; ++i) {
+      node = node->next;
+    }
+    stopwatch.Stop();
+    // Keeps the loop from being optimized away.
+    sink_ = node;
+    ns_per_hop_ = stopwatch.ElapsedSeconds() * 1e9 / hops;
+
+    for (int32 i = 0; i < nodes.Count(); ++i) {
+      malloc_->Free(nodes[i]);
+    }
+    malloc_->ClearAndDisableTlsCachesOnCurrentThread();
+  }
+
+  double GetNsPerHop() const { return ns_per_hop_; }
+
+ private:
+  MemoryAllocator* malloc_;
+  const ChaseConfig& config_;
+  int seed_;
+  double ns_per_hop_;
+  ChaseNode* volatile sink_;
+};
+
+static const char* GetHugePageModeName(PlatformMemory::HugePageMode mode) {
+  switch (mode) {
+    case PlatformMemory::HugePageMode::None:
+      return "none";
+    case PlatformMemory::HugePageMode::Transparent:
+      return "thp";
+    case PlatformMemory::HugePageMode::HugeTlb:
+      return "hugetlb";
+  }
+  return "?";
+}
+
+int main(int argc, char* argv[]) {
+  ChaseConfig config = {4, 1 << 20, 64, 8,
+                        PlatformMemory::HugePageMode::None, false};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      config.threads = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.nodes_per_thread = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      config.node_size = MathBase::Max<int>(atoi(argv[++i]), sizeof(ChaseNode));
+    } else if (::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      config.rounds = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      const char* mode = argv[++i];
+      if (::strcmp(mode, "thp") == 0) {
+        config.huge_pages = PlatformMemory::HugePageMode::Transparent;
+      } else if (::strcmp(mode, "hugetlb") == 0) {
+        config.huge_pages = PlatformMemory::HugePageMode::HugeTlb;
+      } else {
+        config.huge_pages = PlatformMemory::HugePageMode::None;
+      }
+    } else if (::strcmp(argv[i], "-N") == 0) {
+      config.numa_arenas = true;
+    } else {
+      printf(
+          "Usage: %s [-t threads] [-n nodes per thread] [-s node size]\n"
+          "          [-r rounds] [-p none|thp|hugetlb] [-N]\n",
+          argv[0]);
+      return 0;
+    }
+  }
+
+  MemoryAllocatorBinned2::Options options;
+  options.huge_pages = config.huge_pages;
+  options.numa_arenas = config.numa_arenas;
+  MemoryAllocator* malloc = new MemoryAllocatorBinned2(options);
+
+  Array<ChaseWorker*> workers;
+  Array<Thread*> threads;
+  for (int t = 0; t < config.threads; ++t) {
+    workers.Add(new ChaseWorker(malloc, config, t + 1));
+    threads.Add(new Thread("chase"));
+  }
+  for (int t = 0; t < config.threads; ++t) {
+    threads[t]->Start(*workers[t]);
+  }
+  for (int t = 0; t < config.threads; ++t) {
+    threads[t]->Join();
+  }
+
+  printf("pointer chase: %d threads x %d nodes of %d bytes, huge pages %s, "
+         "NUMA arenas %s\n",
+         config.threads, config.nodes_per_thread, config.node_size,
+         GetHugePageModeName(config.huge_pages),
+         config.numa_arenas ? "on" : "off");
+  double total = 0.0;
+  for (int t = 0; t < config.threads; ++t) {
+    printf("  thread %2d  %7.2f ns/hop\n", t, workers[t]->GetNsPerHop());
+    total += workers[t]->GetNsPerHop();
+    delete threads[t];
+    delete workers[t];
+  }
+  printf("  mean       %7.2f ns/hop\n", total / config.threads);
+  return 0;
+}
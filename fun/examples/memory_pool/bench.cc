@@ -0,0 +1,162 @@
+﻿#include "fun/base/caching_memory_pool.h"
+#include "fun/base/caching_object_pool.h"
+#include "fun/base/memory_pool.h"
+#include "fun/base/object_pool.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+
+// Contention benchmark: every thread repeatedly gets a handful of blocks
+// (or borrows objects) and releases them again, at 1 to 64 threads, with
+// the locked MemoryPool/ObjectPool and their caching counterparts.
+
+struct BenchConfig {
+  int max_threads;
+  int ops_per_thread;
+  int block_size;
+};
+
+// Blocks held at once by each thread, so that every round trips a few
+// blocks rather than ping-ponging one.
+const int HELD_COUNT = 8;
+
+struct Message {
+  char payload[128];
+};
+
+template <typename Pool>
+class MemoryPoolWorker : public Runnable {
+ public:
+  MemoryPoolWorker(Pool& pool, int count) : pool_(pool), count_(count) {}
+
+  void Run() override {
+    void* held[HELD_COUNT];
+    for (int i = 0; i < count_; i += HELD_COUNT) {
+      for (int j = 0; j < HELD_COUNT; ++j) {
+        held[j] = pool_.Get();
+        *static_cast<char*>(held[j]) = (char)j;
+      }
+      for (int j = 0; j < HELD_COUNT; ++j) {
+        pool_.Release(held[j]);
+      }
+    }
+  }
+
+ private:
+  Pool& pool_;
+  int count_;
+};
+
+template <typename Pool>
+class ObjectPoolWorker : public Runnable {
+ public:
+  ObjectPoolWorker(Pool& pool, int count) : pool_(pool), count_(count) {}
+
+  void Run() override {
+    Message* held[HELD_COUNT];
+    for (int i = 0; i < count_; i += HELD_COUNT) {
+      for (int j = 0; j < HELD_COUNT; ++j) {
+        held[j] = pool_.BorrowObject();
+        if (held[j]) {
+          held[j]->payload[0] = (char)j;
+        }
+      }
+      for (int j = 0; j < HELD_COUNT; ++j) {
+        if (held[j]) {
+          pool_.ReturnObject(held[j]);
+        }
+      }
+    }
+  }
+
+ private:
+  Pool& pool_;
+  int count_;
+};
+
+template <typename Worker, typename Pool>
+void RunWorkers(const char* name, Pool& pool, int thread_count,
+                const BenchConfig& config) {
+  Array<Worker*> workers;
+  Array<Thread*> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    workers.Add(new Worker(pool, config.ops_per_thread));
+    threads.Add(new Thread("bench"));
+  }
+
+  Stopwatch wall;
+  wall.Start();
+  for (int t = 0; t < thread_count; ++t) {
+    threads[t]->Start(*workers[t]);
+  }
+  for (int t = 0; t < thread_count; ++t) {
+    threads[t]->Join();
+  }
+  wall.Stop();
+
+  // Each op is a get and a release.
+  const double total = double(thread_count) * config.ops_per_thread;
+  printf("  %-18s %8.1f ns/op  %12.0f ops/s\n", name,
+         wall.ElapsedSeconds() * 1e9 / total, total / wall.ElapsedSeconds());
+
+  for (int t = 0; t < thread_count; ++t) {
+    delete threads[t];
+    delete workers[t];
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {64, 1000000, 64};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      config.max_threads = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.ops_per_thread = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      config.block_size = atoi(argv[++i]);
+    } else {
+      printf(
+          "Usage: %s [-t max threads] [-n ops per thread] [-s block size]\n",
+          argv[0]);
+      return 0;
+    }
+  }
+
+  for (int threads = 1; threads <= config.max_threads; threads *= 2) {
+    printf("%d thread(s), %d ops each, %d byte blocks\n", threads,
+           config.ops_per_thread, config.block_size);
+    {
+      MemoryPool pool(config.block_size);
+      RunWorkers<MemoryPoolWorker<MemoryPool>>("MemoryPool", pool, threads,
+                                               config);
+    }
+    {
+      CachingMemoryPool pool(config.block_size);
+      RunWorkers<MemoryPoolWorker<CachingMemoryPool>>("CachingMemoryPool",
+                                                      pool, threads, config);
+    }
+    {
+      CachingMemoryPool pool(config.block_size, 0, 0, true);
+      RunWorkers<MemoryPoolWorker<CachingMemoryPool>>("  (numa_local)", pool,
+                                                      threads, config);
+    }
+
+    const size_t capacity = size_t(threads) * HELD_COUNT * 4;
+    {
+      ObjectPool<Message> pool(capacity, capacity);
+      RunWorkers<ObjectPoolWorker<ObjectPool<Message>>>("ObjectPool", pool,
+                                                        threads, config);
+    }
+    {
+      CachingObjectPool<Message> pool(capacity, capacity);
+      RunWorkers<ObjectPoolWorker<CachingObjectPool<Message>>>(
+          "CachingObjectPool", pool, threads, config);
+    }
+  }
+  return 0;
+}
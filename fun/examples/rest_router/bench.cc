@@ -0,0 +1,146 @@
+#include "fun/base/stopwatch.h"
+#include "fun/net/rest/radix_router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace fun;
+using namespace fun::rest;
+
+// Number of registered routes.
+const int kRouteCount = 500;
+
+struct LinearRoute {
+  http::Method method;
+  Array<String> fragments;
+  int32 id;
+};
+
+Array<LinearRoute> g_linear_routes;
+RadixRouter g_router;
+Array<http::Method> g_request_methods;
+Array<String> g_request_paths;
+
+void Split(const String& path, Array<String>& out) {
+  int32 pos = 0;
+  const int32 len = path.Len();
+  while (pos < len) {
+    while (pos < len && path[pos] == '/') {
+      ++pos;
+    }
+    int32 end = pos;
+    while (end < len && path[end] != '/') {
+      ++end;
+    }
+    if (end > pos) {
+      out.Add(path.Mid(pos, end - pos));
+    }
+    pos = end;
+  }
+}
+
+void AddRoute(http::Method method, const String& resource) {
+  const int32 id = g_linear_routes.Count();
+  g_router.Add(method, resource, id);
+
+  LinearRoute route;
+  route.method = method;
+  route.id = id;
+  Split(resource, route.fragments);
+  g_linear_routes.Add(MoveTemp(route));
+}
+
+void BuildRoutes() {
+  const http::Method methods[] = {http::Method::GET, http::Method::POST,
+                                  http::Method::PUT, http::Method::DELETE};
+  for (int i = 0; g_linear_routes.Count() < kRouteCount; ++i) {
+    const http::Method method = methods[i % 4];
+    const String resource = String::Format("/api/v1/res%d", i);
+    AddRoute(method, resource);
+    AddRoute(method, resource + "/:id");
+    AddRoute(method, resource + "/:id/items/:item");
+    AddRoute(method, String::Format("/static/%d/*", i));
+  }
+  g_router.Compile();
+}
+
+void BuildRequests(int count) {
+  srand(1234);
+  for (int i = 0; i < count; ++i) {
+    const LinearRoute& route = g_linear_routes[rand() % g_linear_routes.Count()];
+    String path;
+    for (const auto& fragment : route.fragments) {
+      path += "/";
+      if (fragment.StartsWith(":") || fragment == "*") {
+        path += String::FromNumber(rand());
+      } else {
+        path += fragment;
+      }
+    }
+    g_request_methods.Add(route.method);
+    g_request_paths.Add(path);
+  }
+}
+
+// Mirrors what Route::Match does today: walk every route, split the
+// request into fragments and copy captures into strings.
+int32 LinearFind(http::Method method, const String& path) {
+  Array<String> segments;
+  Split(path, segments);
+  for (const auto& route : g_linear_routes) {
+    if (route.method != method ||
+        route.fragments.Count() != segments.Count()) {
+      continue;
+    }
+    Array<String> params;
+    bool matched = true;
+    for (int32 i = 0; i < segments.Count(); ++i) {
+      const String& fragment = route.fragments[i];
+      if (fragment.StartsWith(":") || fragment == "*") {
+        params.Add(segments[i]);
+      } else if (fragment != segments[i]) {
+        matched = false;
+        break;
+      }
+    }
+    if (matched) {
+      return route.id;
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char* argv[]) {
+  const int request_count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  BuildRoutes();
+  BuildRequests(request_count);
+
+  int64 checksum = 0;
+  Stopwatch watch;
+
+  watch.Start();
+  RouteMatch match;
+  for (int i = 0; i < request_count; ++i) {
+    if (g_router.Find(g_request_methods[i], g_request_paths[i], match)) {
+      checksum += match.GetRouteId();
+    }
+  }
+  watch.Stop();
+  const double radix_seconds = watch.ElapsedSeconds();
+
+  watch.Restart();
+  for (int i = 0; i < request_count; ++i) {
+    checksum -= LinearFind(g_request_methods[i], g_request_paths[i]);
+  }
+  watch.Stop();
+  const double linear_seconds = watch.ElapsedSeconds();
+
+  printf("routes: %d, requests: %d\n", g_linear_routes.Count(), request_count);
+  printf("radix : %.3f s, %.1f ns/lookup\n", radix_seconds,
+         radix_seconds * 1e9 / request_count);
+  printf("linear: %.3f s, %.1f ns/lookup\n", linear_seconds,
+         linear_seconds * 1e9 / request_count);
+  printf("checksum: %lld (expected 0)\n", (long long)checksum);
+  return 0;
+}
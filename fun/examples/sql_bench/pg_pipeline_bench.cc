@@ -0,0 +1,129 @@
+﻿#include "fun/base/stopwatch.h"
+#include "fun/net/reactor/event_loop.h"
+#include "fun/sql/postgresql/async_connection.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+using namespace fun::sql::postgresql;
+
+// Runs a trivial prepared query many times on one AsyncConnection, keeping
+// 1, 8 and 64 queries outstanding. With one outstanding query every query
+// costs a full round trip, as with a blocking Session; with more the
+// queries are pipelined and throughput is bound by the server instead.
+//
+// Needs a running server, localhost by default; pass -s to use another.
+
+static const int32 DEPTHS[] = {1, 8, 64};
+
+struct BenchRun {
+  net::EventLoop* loop;
+  AsyncConnection* conn;
+  int32 queries;
+  int32 depth_index;
+  int32 depth;
+  int32 sent;
+  int32 completed;
+  int32 errors;
+  Stopwatch stopwatch;
+};
+
+static void StartDepth(BenchRun& run);
+
+static void SendNext(BenchRun& run) {
+  Array<String> params;
+  params.Add(Format("%d", run.sent));
+  ++run.sent;
+  run.conn->Execute("bench_select", params, [&run](AsyncResult& result) {
+    if (!result.IsOk()) {
+      if (run.errors++ == 0) {
+        printf("query failed: %s\n", *result.GetErrorMessage());
+      }
+    }
+
+    if (++run.completed == run.queries) {
+      run.stopwatch.Stop();
+      const double seconds = run.stopwatch.ElapsedSeconds();
+      printf("  %3d outstanding  %8.2f us/query  %10.0f queries/s  "
+             "errors %d\n",
+             run.depth, seconds * 1e6 / run.queries, run.queries / seconds,
+             run.errors);
+      ++run.depth_index;
+      StartDepth(run);
+    } else if (run.sent < run.queries) {
+      SendNext(run);
+    }
+  });
+}
+
+static void StartDepth(BenchRun& run) {
+  if (run.depth_index == countof(DEPTHS)) {
+    run.loop->Quit();
+    return;
+  }
+
+  run.depth = DEPTHS[run.depth_index];
+  run.sent = 0;
+  run.completed = 0;
+  run.errors = 0;
+  run.stopwatch.Reset();
+  run.stopwatch.Start();
+  for (int32 i = 0; i < run.depth && run.sent < run.queries; ++i) {
+    SendNext(run);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* connection_string = "host=localhost dbname=postgres";
+  int32 queries = 100000;
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      connection_string = argv[++i];
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      queries = atoi(argv[++i]);
+    } else {
+      printf("Usage: %s [-s connection string] [-n queries]\n", argv[0]);
+      return 0;
+    }
+  }
+
+  net::EventLoop loop;
+  AsyncConnection conn(&loop, connection_string);
+
+  BenchRun run;
+  run.loop = &loop;
+  run.conn = &conn;
+  run.queries = queries;
+  run.depth_index = 0;
+
+  int exit_code = 0;
+  conn.Connect([&](const String& error) {
+    if (!error.IsEmpty()) {
+      printf("connect failed: %s\n", *error);
+      exit_code = 1;
+      loop.Quit();
+      return;
+    }
+
+    printf("%d queries per run, %s\n", queries,
+           conn.IsPipelined() ? "pipelined"
+                              : "not pipelined (libpq older than 14)");
+    conn.Prepare("bench_select", "SELECT $1::int4 + 1",
+                 [&](AsyncResult& result) {
+                   if (!result.IsOk()) {
+                     printf("prepare failed: %s\n",
+                            *result.GetErrorMessage());
+                     exit_code = 1;
+                     loop.Quit();
+                     return;
+                   }
+                   StartDepth(run);
+                 });
+  });
+
+  loop.Loop();
+  conn.Close();
+  return exit_code;
+}
@@ -0,0 +1,185 @@
+﻿#include "fun/base/ftl/function.h"
+#include "fun/base/stopwatch.h"
+#include "fun/base/thread.h"
+#include "fun/sql/session.h"
+#include "fun/sql/session_pool.h"
+#include "fun/sql/sqlite/connector.h"
+#include "fun/sql/sqlite/wal_session_pool.h"
+#include "fun/sql/statement.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace fun;
+using namespace fun::sql;
+
+// Runs point reads and single-row updates on the same SQLite database file
+// from several threads at once, for a fixed time:
+//
+//   journal  a SessionPool with the default rollback journal; every write
+//            is a transaction of its own, and readers wait for it
+//   wal      a WalSessionPool: read-only connections, one writer that
+//            commits concurrent writes together, background checkpoints
+//
+// The database file is created next to the binary unless -f is given,
+// and deleted afterwards.
+
+struct BenchConfig {
+  const char* path;
+  int32 rows;
+  int32 readers;
+  int32 writers;
+  int32 seconds;
+};
+
+typedef Function<void(uint32 key)> Operation;
+
+static void CreateTable(const BenchConfig& config) {
+  Session session(sqlite::Connector::KEY, config.path);
+  String mode;
+  session << "PRAGMA journal_mode=DELETE", into(mode), now;
+  session << "DROP TABLE IF EXISTS bench_players", now;
+  session << "CREATE TABLE bench_players (id INTEGER PRIMARY KEY, "
+             "score INTEGER NOT NULL)",
+      now;
+
+  session.Begin();
+  for (int32 id = 0; id < config.rows; ++id) {
+    int32 score = 0;
+    session << "INSERT INTO bench_players (id, score) VALUES (?, ?)", use(id),
+        use(score), now;
+  }
+  session.Commit();
+}
+
+static void ReadScore(Session& session, uint32 key) {
+  int32 id = static_cast<int32>(key);
+  int64 score = 0;
+  session << "SELECT score FROM bench_players WHERE id = ?", into(score),
+      use(id), now;
+}
+
+static void AddScore(Session& session, uint32 key) {
+  int32 id = static_cast<int32>(key);
+  session << "UPDATE bench_players SET score = score + 1 WHERE id = ?",
+      use(id), now;
+}
+
+static void Run(const char* mode, const BenchConfig& config,
+                const Operation& read, const Operation& write) {
+  std::atomic<bool> stop(false);
+  std::atomic<int64> reads(0);
+  std::atomic<int64> writes(0);
+  std::atomic<int64> errors(0);
+
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int32 i = 0; i < config.readers + config.writers; ++i) {
+    const bool writer = i >= config.readers;
+    threads.emplace_back(new Thread());
+    threads.back()->StartFunc([&, writer, i] {
+      uint32 seed = 2166136261u ^ static_cast<uint32>(i);
+      while (!stop) {
+        seed = seed * 1664525u + 1013904223u;
+        const uint32 key = (seed >> 8) % static_cast<uint32>(config.rows);
+        try {
+          if (writer) {
+            write(key);
+            ++writes;
+          } else {
+            read(key);
+            ++reads;
+          }
+        } catch (Exception& e) {
+          if (errors++ == 0) {
+            printf("  %s failed: %s\n", writer ? "write" : "read",
+                   e.GetDisplayText().c_str());
+          }
+        }
+      }
+    });
+  }
+
+  Stopwatch stopwatch;
+  stopwatch.Start();
+  Thread::Sleep(config.seconds * 1000);
+  stop = true;
+  for (auto& thread : threads) {
+    thread->Join();
+  }
+  stopwatch.Stop();
+
+  const double seconds = stopwatch.ElapsedSeconds();
+  printf("  %-8s %10.0f reads/s  %10.0f writes/s  errors %lld\n", mode,
+         reads / seconds, writes / seconds, (long long)errors.load());
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {"sqlite_wal_bench.db", 100000, 8, 2, 5};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      config.path = argv[++i];
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.rows = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      config.readers = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      config.writers = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      config.seconds = atoi(argv[++i]);
+    } else {
+      printf(
+          "Usage: %s [-f database file] [-n rows] [-r reader threads] "
+          "[-w writer threads] [-d seconds]\n",
+          argv[0]);
+      return 0;
+    }
+  }
+
+  sqlite::Connector::RegisterConnector();
+  CreateTable(config);
+  printf("%d reader and %d writer threads on %d rows for %d s\n",
+         config.readers, config.writers, config.rows, config.seconds);
+
+  {
+    SessionPool pool(sqlite::Connector::KEY, config.path, 1,
+                     config.readers + config.writers);
+    Run("journal", config,
+        [&pool](uint32 key) {
+          Session session(pool.Get());
+          ReadScore(session, key);
+        },
+        [&pool](uint32 key) {
+          Session session(pool.Get());
+          session.Begin();
+          AddScore(session, key);
+          session.Commit();
+        });
+  }
+
+  {
+    sqlite::WalSessionPool::Options options;
+    options.readers = config.readers;
+    sqlite::WalSessionPool pool(config.path, options);
+    Run("wal", config,
+        [&pool](uint32 key) {
+          Session session(pool.GetReader());
+          ReadScore(session, key);
+        },
+        [&pool](uint32 key) {
+          pool.Write([key](Session& session) { AddScore(session, key); });
+        });
+    printf("  %lld writes in %lld transactions, %lld checkpoints\n",
+           (long long)pool.GetWriteCount(),
+           (long long)pool.GetWriteTransactionCount(),
+           (long long)pool.GetCheckpointCount());
+  }
+
+  ::remove(config.path);
+  ::remove((String(config.path) + "-wal").c_str());
+  ::remove((String(config.path) + "-shm").c_str());
+  return 0;
+}
@@ -0,0 +1,152 @@
+﻿#include "fun/base/stopwatch.h"
+#include "fun/sql/session.h"
+#include "fun/sql/session_pool.h"
+#include "fun/sql/sqlite/connector.h"
+#include "fun/sql/statement.h"
+
+#if defined(FUN_SQL_BENCH_MYSQL)
+#include "fun/sql/mysql/connector.h"
+#endif
+#if defined(FUN_SQL_BENCH_POSTGRESQL)
+#include "fun/sql/postgresql/connector.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fun;
+using namespace fun::sql;
+
+// Runs the same point query many times, each time through a new Statement
+// as a DAO would, with and without the per-session prepared statement
+// cache:
+//
+//   session  all queries on one Session
+//   pool     every query checks a Session out of a SessionPool and back in
+//
+// Defaults to an in-memory SQLite database. Build with
+// FUN_SQL_BENCH_MYSQL or FUN_SQL_BENCH_POSTGRESQL and pass -c and -s to
+// run against a server; the bench_users table is created and dropped.
+
+struct BenchConfig {
+  const char* connector;
+  const char* connection_string;
+  int32 rows;
+  int32 queries;
+};
+
+static const char* const QUERY =
+    "SELECT name FROM bench_users WHERE id = ?";
+
+static void CreateTable(Session& session, int32 rows) {
+  session << "DROP TABLE IF EXISTS bench_users", now;
+  session << "CREATE TABLE bench_users (id INTEGER PRIMARY KEY, "
+             "name VARCHAR(64))",
+      now;
+
+  session.Begin();
+  for (int32 id = 0; id < rows; ++id) {
+    String name = Format("user%d", id);
+    session << "INSERT INTO bench_users (id, name) VALUES (?, ?)", use(id),
+        use(name), now;
+  }
+  session.Commit();
+}
+
+static int64 RunQuery(Session& session, int32 id) {
+  String name;
+  session << QUERY, into(name), use(id), now;
+  return name.Len();
+}
+
+static double BenchSession(Session& session, const BenchConfig& config) {
+  int64 sum = 0;
+  Stopwatch stopwatch;
+  stopwatch.Start();
+  for (int32 i = 0; i < config.queries; ++i) {
+    sum += RunQuery(session, i % config.rows);
+  }
+  stopwatch.Stop();
+  fun_check(sum > 0);
+  return stopwatch.ElapsedSeconds() * 1e6 / config.queries;
+}
+
+static double BenchPool(SessionPool& pool, const BenchConfig& config) {
+  int64 sum = 0;
+  Stopwatch stopwatch;
+  stopwatch.Start();
+  for (int32 i = 0; i < config.queries; ++i) {
+    Session session = pool.Get();
+    sum += RunQuery(session, i % config.rows);
+  }
+  stopwatch.Stop();
+  fun_check(sum > 0);
+  return stopwatch.ElapsedSeconds() * 1e6 / config.queries;
+}
+
+static void PrintResult(const char* mode, size_t cache_size, double us,
+                        Session& session) {
+  printf("  %-8s cache %4d  %8.2f us/query  %10.0f queries/s  "
+         "hits %llu misses %llu\n",
+         mode, (int)cache_size, us, 1e6 / us,
+         (unsigned long long)AnyCast<uint64>(
+             session.GetProperty("statementCacheHits")),
+         (unsigned long long)AnyCast<uint64>(
+             session.GetProperty("statementCacheMisses")));
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config = {"SQLite", "file:bench?mode=memory&cache=shared", 10000,
+                        200000};
+  for (int i = 1; i < argc; ++i) {
+    if (::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      config.connector = argv[++i];
+    } else if (::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      config.connection_string = argv[++i];
+    } else if (::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      config.rows = atoi(argv[++i]);
+    } else if (::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      config.queries = atoi(argv[++i]);
+    } else {
+      printf(
+          "Usage: %s [-c connector] [-s connection string] [-r rows] "
+          "[-n queries]\n",
+          argv[0]);
+      return 0;
+    }
+  }
+
+  sqlite::Connector::RegisterConnector();
+#if defined(FUN_SQL_BENCH_MYSQL)
+  mysql::Connector::RegisterConnector();
+#endif
+#if defined(FUN_SQL_BENCH_POSTGRESQL)
+  postgresql::Connector::RegisterConnector();
+#endif
+
+  // Keeps a shared in-memory SQLite database alive between the sessions.
+  Session setup(config.connector, config.connection_string);
+  CreateTable(setup, config.rows);
+
+  printf("%s: %d point queries on %d rows\n", config.connector,
+         config.queries, config.rows);
+
+  const size_t cache_sizes[] = {0, StatementCacheBase::DEFAULT_CAPACITY};
+  for (size_t cache_size : cache_sizes) {
+    Session session(config.connector, config.connection_string);
+    session.SetProperty("statementCacheSize", cache_size);
+    PrintResult("session", cache_size, BenchSession(session, config), session);
+  }
+
+  for (size_t cache_size : cache_sizes) {
+    SessionPool pool(config.connector, config.connection_string, 1, 1);
+    pool.SetProperty("statementCacheSize", cache_size);
+    const double us = BenchPool(pool, config);
+    Session session = pool.Get();
+    PrintResult("pool", cache_size, us, session);
+  }
+
+  setup << "DROP TABLE bench_users", now;
+  return 0;
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "fun/json/json.h"
+#include "fun/json/value.h"
+
+namespace fun {
+namespace json {
+
+class JArenaValue;
+struct JArenaMember;
+
+/**
+ * An object key interned in a JArena.
+ *
+ * Every distinct name is stored once per arena, no matter how many
+ * objects use it, so building an array of a thousand records with the
+ * same five fields stores five keys.
+ */
+struct JKey {
+  uint32 hash;
+  int32 len;
+  char name[1];
+
+  StringView ToStringView() const { return StringView(name, len); }
+};
+
+/**
+ * Bump allocator that owns every string, key, array and object of a
+ * JArenaValue tree.
+ *
+ * Nothing is freed individually; Reset() or the destructor releases the
+ * whole document in one go. Reset() keeps the most recent block, so an
+ * arena reused for one response after another stops touching the system
+ * allocator once it has grown to the typical response size.
+ */
+class FUN_JSON_API JArena {
+ public:
+  enum {
+    DEFAULT_BLOCK_SIZE = 16 * 1024,
+    MAX_BLOCK_SIZE = 1024 * 1024,
+  };
+
+  explicit JArena(int32 block_size = DEFAULT_BLOCK_SIZE);
+  ~JArena();
+
+  /**
+   * Returns size bytes aligned to 8.
+   */
+  void* Allocate(int32 size);
+
+  /**
+   * Grows an allocation. If ptr is the most recent allocation and the
+   * block has room, it is extended in place; otherwise the contents are
+   * copied and the old space is wasted until Reset().
+   */
+  void* Reallocate(void* ptr, int32 old_size, int32 new_size);
+
+  const char* CopyString(const char* data, int32 len);
+
+  /**
+   * Returns the unique key for name, adding it on first use.
+   */
+  const JKey* InternKey(const StringView& name);
+
+  /**
+   * Releases every allocation. Values built from this arena must not be
+   * used afterwards.
+   */
+  void Reset();
+
+  /**
+   * Bytes currently obtained from the system allocator.
+   */
+  int64 GetAllocatedSize() const { return allocated_size_; }
+
+  int32 GetKeyCount() const { return key_count_; }
+
+ private:
+  struct Block {
+    Block* next;
+    int32 capacity;
+    int32 used;
+
+    char* Data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  Block* AddBlock(int32 min_size);
+  void GrowKeyTable();
+
+  Block* head_;
+  int32 block_size_;
+  int64 allocated_size_;
+
+  // Open addressing table of interned keys, power of two sized.
+  Array<const JKey*> keys_;
+  int32 key_count_;
+
+  FUN_DISALLOW_COPY_AND_ASSIGNMENT(JArena);
+};
+
+/**
+ * JSON value whose storage lives in a JArena.
+ *
+ * A JValue allocates a String, JArray or JObject per node and a String
+ * per key. JArenaValue is a 24 byte POD instead: numbers are stored
+ * inline, strings up to 16 bytes are stored inline, longer strings and
+ * container storage come from the arena, and object keys are interned.
+ * Building a response tree therefore costs a few bump allocations, and
+ * freeing it costs one JArena::Reset().
+ *
+ * Mutators that may allocate take the arena explicitly; all values of
+ * one tree must use the same arena.
+ *
+ *   JArena arena;
+ *   JArenaValue root;
+ *   root.SetObject();
+ *   root.AddField("id", arena).SetInteger(42);
+ *   JArenaValue& items = root.AddField("items", arena).SetArray();
+ *   items.Append(arena).SetString("sword", arena);
+ *
+ * Objects keep members in insertion order and look them up linearly,
+ * which is the right trade-off for the small objects of a typical
+ * message. Use JValue when a document needs heavy editing.
+ */
+class FUN_JSON_API JArenaValue {
+ public:
+  enum { SHORT_STRING_CAPACITY = 16 };
+
+  JArenaValue() : type_(uint8(ValueType::Null)), flags_(0), count_(0) {
+    unsigned_integer_value_ = 0;
+  }
+
+  ValueType GetType() const { return ValueType(type_); }
+
+  bool IsNull() const { return GetType() == ValueType::Null; }
+  bool IsBool() const { return GetType() == ValueType::Bool; }
+  bool IsString() const { return GetType() == ValueType::String; }
+  bool IsInteger() const { return GetType() == ValueType::Integer; }
+  bool IsUnsignedInteger() const {
+    return GetType() == ValueType::UnsignedInteger;
+  }
+  bool IsDouble() const { return GetType() == ValueType::Double; }
+  bool IsArray() const { return GetType() == ValueType::Array; }
+  bool IsObject() const { return GetType() == ValueType::Object; }
+
+  bool AsBool() const {
+    fun_check_msg(IsBool(), "JArenaValue is not a bool.");
+    return bool_value_;
+  }
+
+  int64 AsInteger() const;
+  uint64 AsUnsignedInteger() const;
+  double AsDouble() const;
+
+  /**
+   * The string is not '\0' terminated.
+   */
+  StringView AsString() const {
+    fun_check_msg(IsString(), "JArenaValue is not a string.");
+    return StringView(StringData(), count_);
+  }
+
+  /**
+   * Number of elements or members; 0 for scalars.
+   */
+  int32 Count() const { return IsArray() || IsObject() ? count_ : 0; }
+
+  const JArenaValue& operator[](int32 index) const {
+    fun_check_msg(IsArray(), "JArenaValue is not an array.");
+    fun_check(index >= 0 && index < count_);
+    return array_.elements[index];
+  }
+
+  JArenaValue& operator[](int32 index) {
+    fun_check_msg(IsArray(), "JArenaValue is not an array.");
+    fun_check(index >= 0 && index < count_);
+    return array_.elements[index];
+  }
+
+  const JArenaMember& GetMemberAt(int32 index) const;
+
+  const JArenaValue* Find(const StringView& field_name) const;
+  JArenaValue* Find(const StringView& field_name);
+
+  void SetNull() { Reset(ValueType::Null); }
+
+  void SetBool(bool value) {
+    Reset(ValueType::Bool);
+    bool_value_ = value;
+  }
+
+  void SetInteger(int64 value) {
+    Reset(ValueType::Integer);
+    integer_value_ = value;
+  }
+
+  void SetUnsignedInteger(uint64 value) {
+    Reset(ValueType::UnsignedInteger);
+    unsigned_integer_value_ = value;
+  }
+
+  void SetDouble(double value) {
+    Reset(ValueType::Double);
+    double_value_ = value;
+  }
+
+  /**
+   * Copies value into the value itself or into the arena.
+   */
+  void SetString(const StringView& value, JArena& arena);
+
+  /**
+   * References value without copying. The caller guarantees that value
+   * outlives the tree; meant for string literals and static tables.
+   */
+  void SetStaticString(const StringView& value);
+
+  JArenaValue& SetArray() {
+    Reset(ValueType::Array);
+    array_.elements = nullptr;
+    array_.capacity = 0;
+    return *this;
+  }
+
+  JArenaValue& SetObject() {
+    Reset(ValueType::Object);
+    object_.members = nullptr;
+    object_.capacity = 0;
+    return *this;
+  }
+
+  /**
+   * Preallocates room for capacity elements or members.
+   */
+  void Reserve(int32 capacity, JArena& arena);
+
+  /**
+   * Appends a null element to an array and returns it.
+   */
+  JArenaValue& Append(JArena& arena);
+
+  /**
+   * Appends a null member to an object and returns its value. Duplicate
+   * names are not checked.
+   */
+  JArenaValue& AddField(const StringView& field_name, JArena& arena);
+  JArenaValue& AddField(const JKey* key, JArena& arena);
+
+  /**
+   * Deep copies a JValue into this value. Comments are dropped.
+   */
+  void CopyFrom(const JValue& value, JArena& arena);
+
+  /**
+   * Deep copies this value into a JValue.
+   */
+  void ToJValue(JValue& out_value) const;
+
+ private:
+  enum { FLAG_SHORT_STRING = 1 };
+
+  void Reset(ValueType type) {
+    type_ = uint8(type);
+    flags_ = 0;
+    count_ = 0;
+  }
+
+  const char* StringData() const {
+    return (flags_ & FLAG_SHORT_STRING) ? short_string_ : string_;
+  }
+
+  void Grow(int32 min_capacity, JArena& arena);
+
+  struct ElementStorage {
+    JArenaValue* elements;
+    int32 capacity;
+  };
+
+  struct MemberStorage {
+    JArenaMember* members;
+    int32 capacity;
+  };
+
+  uint8 type_;
+  uint8 flags_;
+  // String length, element count or member count.
+  int32 count_;
+
+  union {
+    bool bool_value_;
+    int64 integer_value_;
+    uint64 unsigned_integer_value_;
+    double double_value_;
+    const char* string_;
+    char short_string_[SHORT_STRING_CAPACITY];
+    ElementStorage array_;
+    MemberStorage object_;
+  };
+};
+
+struct JArenaMember {
+  const JKey* key;
+  JArenaValue value;
+};
+
+FUN_ALWAYS_INLINE const JArenaMember& JArenaValue::GetMemberAt(
+    int32 index) const {
+  fun_check_msg(IsObject(), "JArenaValue is not an object.");
+  fun_check(index >= 0 && index < count_);
+  return object_.members[index];
+}
+
+}  // namespace json
+}  // namespace fun
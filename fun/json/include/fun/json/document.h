@@ -0,0 +1,256 @@
+#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/json/json.h"
+#include "fun/json/structural_index.h"
+#include "fun/json/value.h"
+
+namespace fun {
+namespace json {
+
+class JDocument;
+struct JMember;
+
+/**
+ * Read-only view of one value inside a JDocument.
+ *
+ * A JElement is two words and is meant to be passed by value. It stays
+ * valid as long as the document it came from is neither destroyed nor
+ * reparsed.
+ *
+ * Lookups on a missing field or out-of-range index return an invalid
+ * element (IsValid() == false) instead of throwing, so that chains like
+ * root["stats"]["hp"] can be checked once at the end.
+ */
+class FUN_JSON_API JElement {
+ public:
+  JElement() : doc_(nullptr), index_(0) {}
+
+  bool IsValid() const { return doc_ != nullptr; }
+
+  ValueType GetType() const;
+
+  bool IsNull() const { return GetType() == ValueType::Null; }
+  bool IsBool() const { return GetType() == ValueType::Bool; }
+  bool IsString() const { return GetType() == ValueType::String; }
+  bool IsInteger() const { return GetType() == ValueType::Integer; }
+  bool IsUnsignedInteger() const {
+    return GetType() == ValueType::UnsignedInteger;
+  }
+  bool IsDouble() const { return GetType() == ValueType::Double; }
+  bool IsNumeric() const;
+  bool IsArray() const { return GetType() == ValueType::Array; }
+  bool IsObject() const { return GetType() == ValueType::Object; }
+
+  /**
+   * Numeric accessors convert between the numeric types; any other
+   * type mismatch is a programming error (fun_check_msg).
+   */
+  bool AsBool() const;
+  int64 AsInteger() const;
+  uint64 AsUnsignedInteger() const;
+  double AsDouble() const;
+
+  /**
+   * Returns the decoded string. The view points into the document's
+   * string arena and is null-terminated.
+   */
+  StringView AsString() const;
+
+  /**
+   * Number of elements of an array or members of an object, 0 for
+   * scalars. This is O(1); counts are recorded while parsing.
+   */
+  int32 Count() const;
+
+  JElement operator[](int32 array_index) const;
+  JElement operator[](const StringView& field_name) const;
+
+  bool Find(const StringView& field_name, JElement& out_value) const;
+
+  /**
+   * Deep-copies this element into a regular JValue tree.
+   */
+  void ToJValue(JValue& out_value) const;
+
+  /**
+   * Iterates over array elements.
+   */
+  class ArrayIterator {
+   public:
+    JElement operator*() const { return JElement(doc_, index_); }
+    ArrayIterator& operator++();
+    bool operator!=(const ArrayIterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    friend class JElement;
+    ArrayIterator(const JDocument* doc, int32 index)
+        : doc_(doc), index_(index) {}
+
+    const JDocument* doc_;
+    int32 index_;
+  };
+
+  /**
+   * Iterates over object members in document order.
+   */
+  class ObjectIterator {
+   public:
+    JMember operator*() const;
+    ObjectIterator& operator++();
+    bool operator!=(const ObjectIterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    friend class JElement;
+    ObjectIterator(const JDocument* doc, int32 index)
+        : doc_(doc), index_(index) {}
+
+    const JDocument* doc_;
+    int32 index_;
+  };
+
+  template <typename IteratorType>
+  struct Range {
+    IteratorType first;
+    IteratorType last;
+
+    IteratorType begin() const { return first; }
+    IteratorType end() const { return last; }
+  };
+
+  /**
+   * for (JElement item : element.Elements()) { ... }
+   * Empty for non-arrays.
+   */
+  Range<ArrayIterator> Elements() const;
+
+  /**
+   * for (const JMember& member : element.Members()) { ... }
+   * Empty for non-objects.
+   */
+  Range<ObjectIterator> Members() const;
+
+ private:
+  friend class JDocument;
+
+  JElement(const JDocument* doc, int32 index) : doc_(doc), index_(index) {}
+
+  uint64 Word() const;
+  char Tag() const;
+
+  const JDocument* doc_;
+  int32 index_;
+};
+
+/**
+ * An object member as produced by JElement::Members().
+ */
+struct JMember {
+  StringView name;
+  JElement value;
+};
+
+/**
+ * A parsed JSON document laid out as a flat tape.
+ *
+ * Instead of one heap object per value, the whole tree lives in two
+ * arrays: a tape of 64-bit words describing values in document order,
+ * and a string arena holding every decoded key and string. Freeing a
+ * document is freeing those two buffers, and reparsing into the same
+ * JDocument reuses them.
+ *
+ * Use DocumentParser to fill a JDocument, JElement to read it, and
+ * JElement::ToJValue() where a mutable JValue is needed.
+ */
+class FUN_JSON_API JDocument {
+ public:
+  JDocument();
+
+  JElement GetRoot() const;
+
+  bool IsEmpty() const { return tape_.IsEmpty(); }
+
+  /**
+   * Drops the contents but keeps the allocated capacity.
+   */
+  void Clear();
+
+  /**
+   * Bytes held by the tape and string arena.
+   */
+  int64 GetAllocatedSize() const;
+
+ private:
+  friend class JElement;
+  friend class DocumentParser;
+
+  // Tape word layout: the tag char in the top 8 bits, a 56-bit payload
+  // below. Containers store the tape index past their closing word in
+  // the low 32 bits of the payload and the child count above it.
+  enum { TAG_SHIFT = 56 };
+  static const uint64 PAYLOAD_MASK = (uint64(1) << TAG_SHIFT) - 1;
+
+  static uint64 MakeWord(char tag, uint64 payload) {
+    return (uint64((uint8)tag) << TAG_SHIFT) | (payload & PAYLOAD_MASK);
+  }
+  static char TagOf(uint64 word) { return (char)(word >> TAG_SHIFT); }
+  static uint64 PayloadOf(uint64 word) { return word & PAYLOAD_MASK; }
+
+  int32 AfterValue(int32 index) const;
+  StringView StringAt(uint64 offset) const;
+
+  Array<uint64> tape_;
+  Array<char> strings_;
+};
+
+/**
+ * Two-stage JSON parser producing a JDocument.
+ *
+ * Stage 1 is StructuralIndex (SIMD). Stage 2 walks the structural
+ * offsets and writes the tape; it never looks at whitespace or string
+ * contents it does not need to decode.
+ *
+ * Only standard JSON is accepted (no comments, single quotes or special
+ * floats); use Reader for relaxed input. A DocumentParser keeps its
+ * buffers between calls, so keep one per thread and reuse it.
+ */
+class FUN_JSON_API DocumentParser {
+ public:
+  explicit DocumentParser(int32 max_depth = 1024);
+
+  bool Parse(const char* data, int32 len, JDocument& out_doc);
+  bool Parse(const String& json, JDocument& out_doc) {
+    return Parse(json.ConstData(), json.Len(), out_doc);
+  }
+
+  const String& GetErrorMessage() const { return error_message_; }
+
+  /**
+   * Input offset where parsing failed, or -1.
+   */
+  int32 GetErrorOffset() const { return error_offset_; }
+
+ private:
+  bool Fail(const char* message, int32 offset);
+  bool WriteString(JDocument& doc, const char* data, int32 len,
+                   uint32 offset);
+
+  struct OpenContainer {
+    int32 tape_index;
+    int32 count;
+    char tag;
+  };
+
+  StructuralIndex index_;
+  Array<OpenContainer> open_;
+  int32 max_depth_;
+  String error_message_;
+  int32 error_offset_;
+};
+
+}  // namespace json
+}  // namespace fun
@@ -16,6 +16,10 @@ class IWriter;
 class CondensedWriter;
 class PrettyWriter;
 class Features;
+class JArena;
+class JArenaValue;
+template <typename Output>
+class StreamWriter;
 
 }  // namespace json
 }  // namespace fun
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "fun/json/json.h"
+
+namespace fun {
+namespace json {
+
+/**
+ * Buffer sizes that are always large enough for the formatters below,
+ * including the sign. No terminating '\0' is written.
+ */
+enum {
+  MAX_INTEGER_CHARS = 20,
+  MAX_DOUBLE_CHARS = 32,
+};
+
+/**
+ * Writes the decimal representation of value into buffer and returns the
+ * number of characters written.
+ */
+FUN_JSON_API int32 FormatInteger(int64 value, char* buffer);
+FUN_JSON_API int32 FormatUnsignedInteger(uint64 value, char* buffer);
+
+/**
+ * Writes value using the Grisu2 algorithm and returns the number of
+ * characters written.
+ *
+ * The output always parses back (strtod) to exactly the same double and
+ * is the shortest such representation for all but a tiny fraction of
+ * inputs, where it is at most one digit longer. This replaces printf
+ * style "%.17g" conversion, which is both slower and produces noise
+ * digits ("0.10000000000000001" instead of "0.1").
+ *
+ * Integral values keep a ".0" suffix so that they read back as doubles.
+ * NaN and infinities are written as NaN, Infinity and -Infinity, which
+ * Reader accepts when Features::allow_special_floats is set.
+ */
+FUN_JSON_API int32 FormatDouble(double value, char* buffer);
+
+}  // namespace json
+}  // namespace fun
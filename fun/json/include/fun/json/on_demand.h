@@ -0,0 +1,192 @@
+#pragma once
+
+#include "fun/json/json.h"
+#include "fun/json/scalar_parser_internal.h"
+#include "fun/json/structural_index.h"
+#include "fun/json/value.h"
+
+namespace fun {
+namespace json {
+
+class OnDemandParser;
+
+/**
+ * Position of a value inside an indexed document.
+ *
+ * Nothing is decoded until an accessor asks for it, and only the
+ * requested value is validated. Skipping a sibling object or array only
+ * walks its structural offsets, never its bytes.
+ *
+ * Accessors return false on a type mismatch or malformed input, so that
+ * a missing or broken field in a config file can be reported without
+ * exceptions. A JCursor is valid as long as its parser and the input
+ * buffer are alive and the parser has not started another document.
+ */
+class FUN_JSON_API JCursor {
+ public:
+  JCursor() : parser_(nullptr), pos_(-1) {}
+
+  bool IsValid() const { return parser_ != nullptr && pos_ >= 0; }
+
+  /**
+   * Peeks at the type. Numbers are classified from their spelling: a
+   * fraction or exponent makes a Double, anything else an Integer.
+   */
+  ValueType GetType() const;
+
+  bool IsNull() const;
+
+  bool GetBool(bool& out_value) const;
+  bool GetInteger(int64& out_value) const;
+  bool GetUnsignedInteger(uint64& out_value) const;
+  bool GetDouble(double& out_value) const;
+
+  /**
+   * Decodes the string into out_value.
+   */
+  bool GetString(String& out_value) const;
+
+  /**
+   * Returns the raw string body between the quotes without copying.
+   * Escape sequences are left as they appear in the input; check
+   * out_has_escapes and fall back to GetString() if needed.
+   */
+  bool GetRawString(StringView& out_value, bool& out_has_escapes) const;
+
+  /**
+   * Finds a member of an object. Keys are compared in raw form, which
+   * is exact for keys without escapes (all keys in practice).
+   */
+  bool Find(const StringView& field_name, JCursor& out_value) const;
+
+  /**
+   * Convenience for Find(); returns an invalid cursor on a miss.
+   */
+  JCursor operator[](const StringView& field_name) const;
+
+  /**
+   * Counts the elements of an array or members of an object by
+   * skipping over them.
+   */
+  int32 Count() const;
+
+  /**
+   * Decodes this value and everything below it into a JValue.
+   */
+  bool ToJValue(JValue& out_value) const;
+
+ private:
+  friend class OnDemandParser;
+  friend class JArrayCursor;
+  friend class JObjectCursor;
+
+  JCursor(const OnDemandParser* parser, int32 pos)
+      : parser_(parser), pos_(pos) {}
+
+  char Peek() const;
+  const char* Begin() const;
+  bool DecodeNumber(internal::NumberValue& out_value) const;
+
+  const OnDemandParser* parser_;
+  // Index into the structural index of the value's first byte.
+  int32 pos_;
+};
+
+/**
+ * Forward iteration over the elements of an array.
+ *
+ *   JArrayCursor items(root["items"]);
+ *   JCursor item;
+ *   while (items.Next(item)) {
+ *     ...
+ *   }
+ */
+class FUN_JSON_API JArrayCursor {
+ public:
+  explicit JArrayCursor(const JCursor& array);
+
+  bool Next(JCursor& out_element);
+
+  /**
+   * False if the cursor did not point at an array or the array was
+   * malformed.
+   */
+  bool Good() const { return good_; }
+
+ private:
+  const OnDemandParser* parser_;
+  int32 pos_;
+  bool first_;
+  bool good_;
+};
+
+/**
+ * Forward iteration over the members of an object.
+ */
+class FUN_JSON_API JObjectCursor {
+ public:
+  explicit JObjectCursor(const JCursor& object);
+
+  /**
+   * out_raw_name is the raw key body (see JCursor::GetRawString()).
+   */
+  bool Next(StringView& out_raw_name, JCursor& out_value);
+
+  bool Good() const { return good_; }
+
+ private:
+  const OnDemandParser* parser_;
+  int32 pos_;
+  bool first_;
+  bool good_;
+};
+
+/**
+ * On-demand JSON reader.
+ *
+ * Iterate() runs only stage 1 (StructuralIndex) over the input; values
+ * are decoded lazily through JCursor. This is the cheapest way to pull a
+ * few fields out of a large payload, e.g. the "type" and "id" of each
+ * entry in a game data file, without building a tree.
+ *
+ * The input buffer must outlive every cursor obtained from it.
+ */
+class FUN_JSON_API OnDemandParser {
+ public:
+  OnDemandParser();
+
+  bool Iterate(const char* data, int32 len);
+  bool Iterate(const String& json) {
+    return Iterate(json.ConstData(), json.Len());
+  }
+
+  /**
+   * Root value of the last successfully indexed document.
+   */
+  JCursor GetRoot() const;
+
+  const String& GetErrorMessage() const { return error_message_; }
+
+ private:
+  friend class JCursor;
+  friend class JArrayCursor;
+  friend class JObjectCursor;
+
+  char CharAt(int32 pos) const {
+    return pos < index_.Count() ? data_[index_[pos]] : '\0';
+  }
+
+  /**
+   * Returns the structural position right after the value at pos, or -1
+   * if the document ends inside it.
+   */
+  int32 Skip(int32 pos) const;
+
+  const char* data_;
+  int32 len_;
+  StructuralIndex index_;
+  String error_message_;
+};
+
+}  // namespace json
+}  // namespace fun
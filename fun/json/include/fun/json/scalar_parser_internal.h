@@ -0,0 +1,80 @@
+#pragma once
+
+#include "fun/json/json.h"
+#include "fun/json/value.h"
+
+namespace fun {
+namespace json {
+namespace internal {
+
+/**
+ * A decoded JSON number.
+ *
+ * type is one of ValueType::Integer, ValueType::UnsignedInteger or
+ * ValueType::Double, following the same rules as Reader: integers that
+ * fit into int64 are Integer, larger positive integers are
+ * UnsignedInteger, everything else is Double.
+ */
+struct NumberValue {
+  ValueType type;
+  union {
+    int64 integer_value;
+    uint64 unsigned_integer_value;
+    double double_value;
+  };
+};
+
+/**
+ * Returns true if ch may follow a scalar (number or literal).
+ */
+FUN_ALWAYS_INLINE bool IsScalarTerminator(char ch) {
+  switch (ch) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case ',':
+    case ':':
+    case ']':
+    case '}':
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Parses a number starting at cur. On success out_end points to the
+ * first byte after the number.
+ */
+FUN_JSON_API bool ParseNumber(const char* cur, const char* end,
+                              NumberValue& out_value, const char*& out_end);
+
+/**
+ * Unescapes the string body starting right after the opening quote.
+ *
+ * dst must have room for at least (end - cur) bytes; the decoded form
+ * is never longer than the escaped one. Returns the number of bytes
+ * written, or -1 on a malformed escape or a missing closing quote.
+ * out_end points right after the closing quote.
+ */
+FUN_JSON_API int32 UnescapeString(const char* cur, const char* end, char* dst,
+                                  const char*& out_end);
+
+/**
+ * Finds the closing quote of a string body starting right after the
+ * opening quote, without decoding. Sets out_has_escapes if the body
+ * contains backslashes. Returns nullptr if the string is unterminated.
+ */
+FUN_JSON_API const char* FindStringEnd(const char* cur, const char* end,
+                                       bool& out_has_escapes);
+
+/**
+ * Checks for one of the literals true/false/null at cur.
+ */
+FUN_JSON_API bool MatchLiteral(const char* cur, const char* end,
+                               const char* literal, int32 literal_len);
+
+}  // namespace internal
+}  // namespace json
+}  // namespace fun
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "fun/json/arena_value.h"
+#include "fun/json/json.h"
+#include "fun/json/number_format.h"
+#include "fun/json/value.h"
+
+#include <cstring>
+
+namespace fun {
+namespace json {
+
+namespace internal {
+
+/**
+ * For each byte: 0 if it is written as is, otherwise the character that
+ * follows the backslash ('u' meaning \u00XX).
+ */
+FUN_JSON_API extern const char JSON_ESCAPE_TABLE[256];
+
+}  // namespace internal
+
+/**
+ * StreamWriter output into a caller-provided fixed buffer.
+ *
+ * Output that does not fit is dropped and IsOverflowed() turns true, so
+ * callers can retry with a bigger buffer or fall back to a growing one.
+ */
+class FixedBufferOutput {
+ public:
+  FixedBufferOutput(char* buffer, int32 capacity)
+      : buffer_(buffer), capacity_(capacity), len_(0), overflowed_(false) {}
+
+  void Append(const char* data, size_t len) {
+    size_t room = size_t(capacity_ - len_);
+    if (len > room) {
+      overflowed_ = true;
+      len = room;
+    }
+    ::memcpy(buffer_ + len_, data, len);
+    len_ += int32(len);
+  }
+
+  int32 Len() const { return len_; }
+  bool IsOverflowed() const { return overflowed_; }
+
+ private:
+  char* buffer_;
+  int32 capacity_;
+  int32 len_;
+  bool overflowed_;
+};
+
+/**
+ * StreamWriter output that appends to a String.
+ */
+class StringOutput {
+ public:
+  explicit StringOutput(String& str) : str_(str) {}
+
+  void Append(const char* data, size_t len) { str_.Append(data, int32(len)); }
+
+ private:
+  String& str_;
+};
+
+/**
+ * Condensed JSON writer that streams into an output sink.
+ *
+ * Output is any type with `void Append(const char* data, size_t len)`:
+ * net::Buffer can be used directly, so a response is serialized straight
+ * into the connection's output buffer, and FixedBufferOutput and
+ * StringOutput cover caller-owned memory.
+ *
+ * Tokens are staged in a small internal buffer and handed to the sink in
+ * chunks, so the sink sees a few large appends instead of one per token.
+ * Numbers are formatted with FormatInteger() and FormatDouble() and never
+ * go through a temporary String.
+ *
+ *   net::Buffer& out = connection->GetOutputBuffer();
+ *   StreamWriter<net::Buffer> writer(out);
+ *   writer.Write(root);
+ *   writer.Flush();
+ *
+ * Flush() is also called by the destructor.
+ */
+template <typename Output>
+class StreamWriter {
+ public:
+  enum { BUFFER_SIZE = 2048 };
+
+  explicit StreamWriter(Output& output)
+      : output_(output),
+        used_(0),
+        yaml_compatibility_enabled_(false),
+        drop_null_placeholders_(false) {}
+
+  ~StreamWriter() { Flush(); }
+
+  /**
+   * Writes ": " instead of ":" between keys and values.
+   */
+  void EnableYAMLCompatibility() { yaml_compatibility_enabled_ = true; }
+
+  /**
+   * Writes nothing for null values, like CondensedWriter.
+   */
+  void DropNullPlaceholders() { drop_null_placeholders_ = true; }
+
+  void Write(const JValue& value);
+  void Write(const JArenaValue& value);
+
+  /**
+   * Writes pre-serialized JSON (or anything else) verbatim.
+   */
+  void WriteRaw(const char* data, int32 len) { Put(data, len); }
+
+  /**
+   * Hands all staged output to the sink.
+   */
+  void Flush() {
+    if (used_ > 0) {
+      output_.Append(buffer_, size_t(used_));
+      used_ = 0;
+    }
+  }
+
+ private:
+  FUN_ALWAYS_INLINE char* Reserve(int32 len) {
+    if (used_ + len > BUFFER_SIZE) {
+      Flush();
+    }
+    return buffer_ + used_;
+  }
+
+  FUN_ALWAYS_INLINE void Put(char ch) {
+    *Reserve(1) = ch;
+    ++used_;
+  }
+
+  void Put(const char* data, int32 len) {
+    if (len > BUFFER_SIZE - used_) {
+      Flush();
+      if (len >= BUFFER_SIZE) {
+        output_.Append(data, size_t(len));
+        return;
+      }
+    }
+    ::memcpy(buffer_ + used_, data, len);
+    used_ += len;
+  }
+
+  void PutNull() {
+    if (!drop_null_placeholders_) {
+      Put("null", 4);
+    }
+  }
+
+  void PutBool(bool value) {
+    if (value) {
+      Put("true", 4);
+    } else {
+      Put("false", 5);
+    }
+  }
+
+  void PutInteger(int64 value) {
+    used_ += FormatInteger(value, Reserve(MAX_INTEGER_CHARS));
+  }
+
+  void PutUnsignedInteger(uint64 value) {
+    used_ += FormatUnsignedInteger(value, Reserve(MAX_INTEGER_CHARS));
+  }
+
+  void PutDouble(double value) {
+    used_ += FormatDouble(value, Reserve(MAX_DOUBLE_CHARS));
+  }
+
+  void PutString(const char* str, int32 len);
+
+  void PutNameSeparator() {
+    if (yaml_compatibility_enabled_) {
+      Put(": ", 2);
+    } else {
+      Put(':');
+    }
+  }
+
+  Output& output_;
+  int32 used_;
+  bool yaml_compatibility_enabled_;
+  bool drop_null_placeholders_;
+  char buffer_[BUFFER_SIZE];
+};
+
+//
+// inlines
+//
+
+template <typename Output>
+void StreamWriter<Output>::PutString(const char* str, int32 len) {
+  static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+  Put('"');
+  const char* end = str + len;
+  while (str < end) {
+    // Copy the longest run that needs no escaping in one go.
+    const char* run = str;
+    while (str < end && internal::JSON_ESCAPE_TABLE[uint8(*str)] == 0) {
+      ++str;
+    }
+    if (str > run) {
+      Put(run, int32(str - run));
+    }
+    if (str == end) {
+      break;
+    }
+
+    const uint8 ch = uint8(*str++);
+    const char escape = internal::JSON_ESCAPE_TABLE[ch];
+    char* out = Reserve(6);
+    out[0] = '\\';
+    out[1] = escape;
+    if (escape == 'u') {
+      out[2] = '0';
+      out[3] = '0';
+      out[4] = HEX_DIGITS[ch >> 4];
+      out[5] = HEX_DIGITS[ch & 0xF];
+      used_ += 6;
+    } else {
+      used_ += 2;
+    }
+  }
+  Put('"');
+}
+
+template <typename Output>
+void StreamWriter<Output>::Write(const JValue& value) {
+  switch (value.GetType()) {
+    case ValueType::Null:
+      PutNull();
+      break;
+
+    case ValueType::Bool:
+      PutBool(value.bool_value_);
+      break;
+
+    case ValueType::Integer:
+      PutInteger(value.integer_value_);
+      break;
+
+    case ValueType::UnsignedInteger:
+      PutUnsignedInteger(value.unsigned_integer_value_);
+      break;
+
+    case ValueType::Double:
+      PutDouble(value.double_value_);
+      break;
+
+    case ValueType::String:
+      PutString(value.string_value_->ConstData(), value.string_value_->Len());
+      break;
+
+    case ValueType::Array: {
+      Put('[');
+      const JArray& elements = *value.array_value_;
+      for (int32 i = 0; i < elements.Count(); ++i) {
+        if (i > 0) {
+          Put(',');
+        }
+        Write(elements[i]);
+      }
+      Put(']');
+      break;
+    }
+
+    case ValueType::Object: {
+      Put('{');
+      bool first = true;
+      for (const auto& pair : *value.object_value_) {
+        if (!first) {
+          Put(',');
+        }
+        first = false;
+        PutString(pair.key.ConstData(), pair.key.Len());
+        PutNameSeparator();
+        Write(pair.value);
+      }
+      Put('}');
+      break;
+    }
+
+    default:
+      fun_check(false);
+      break;
+  }
+}
+
+template <typename Output>
+void StreamWriter<Output>::Write(const JArenaValue& value) {
+  switch (value.GetType()) {
+    case ValueType::Null:
+      PutNull();
+      break;
+
+    case ValueType::Bool:
+      PutBool(value.AsBool());
+      break;
+
+    case ValueType::Integer:
+      PutInteger(value.AsInteger());
+      break;
+
+    case ValueType::UnsignedInteger:
+      PutUnsignedInteger(value.AsUnsignedInteger());
+      break;
+
+    case ValueType::Double:
+      PutDouble(value.AsDouble());
+      break;
+
+    case ValueType::String: {
+      const StringView str = value.AsString();
+      PutString(str.ConstData(), str.Len());
+      break;
+    }
+
+    case ValueType::Array: {
+      Put('[');
+      const int32 count = value.Count();
+      for (int32 i = 0; i < count; ++i) {
+        if (i > 0) {
+          Put(',');
+        }
+        Write(value[i]);
+      }
+      Put(']');
+      break;
+    }
+
+    case ValueType::Object: {
+      Put('{');
+      const int32 count = value.Count();
+      for (int32 i = 0; i < count; ++i) {
+        if (i > 0) {
+          Put(',');
+        }
+        const JArenaMember& member = value.GetMemberAt(i);
+        PutString(member.key->name, member.key->len);
+        PutNameSeparator();
+        Write(member.value);
+      }
+      Put('}');
+      break;
+    }
+
+    default:
+      fun_check(false);
+      break;
+  }
+}
+
+}  // namespace json
+}  // namespace fun
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/json/json.h"
+
+namespace fun {
+namespace json {
+
+/**
+ * Stage 1 of the fast JSON parsers.
+ *
+ * Scans the input 64 bytes at a time and records the offset of every
+ * structural character ({, }, [, ], :, ,) and the first byte of every
+ * scalar (strings, numbers, true/false/null) that is not inside a string.
+ * Stage 2 (DocumentParser, OnDemandParser) then only has to visit these
+ * offsets instead of every input byte.
+ *
+ * Character classification is done with AVX2 or SSE4.2 when the CPU
+ * supports it; the choice is made once at runtime. A portable scalar
+ * implementation is used everywhere else.
+ */
+class FUN_JSON_API StructuralIndex {
+ public:
+  enum class Implementation {
+    Scalar,
+    Sse42,
+    Avx2,
+  };
+
+  StructuralIndex();
+
+  /**
+   * Indexes the given buffer. Previous results are discarded, but the
+   * index storage is kept so that a StructuralIndex can be reused for
+   * many documents without reallocating.
+   *
+   * Returns false if the input has an unterminated string or an
+   * unescaped control character inside a string.
+   */
+  bool Build(const char* data, int32 len);
+
+  int32 Count() const { return indices_.Count(); }
+
+  /**
+   * Returns the input offset of the n-th structural.
+   */
+  uint32 operator[](int32 index) const { return indices_[index]; }
+
+  const uint32* ConstData() const { return indices_.ConstData(); }
+
+  /**
+   * Offset of the first invalid byte if Build() failed, -1 otherwise.
+   */
+  int32 GetErrorOffset() const { return error_offset_; }
+
+  /**
+   * Implementation selected for this process.
+   */
+  static Implementation GetImplementation();
+  static const char* GetImplementationName();
+
+ private:
+  Array<uint32> indices_;
+  int32 error_offset_;
+};
+
+}  // namespace json
+}  // namespace fun
@@ -329,6 +329,8 @@ class FUN_JSON_API JValue {
  private:
   friend class CondensedWriter;
   friend class PrettyWriter;
+  template <typename Output>
+  friend class StreamWriter;
 
   /**
    * value type
@@ -0,0 +1,431 @@
+#include "fun/json/arena_value.h"
+
+#include <cstring>
+#include <new>
+
+namespace fun {
+namespace json {
+
+static_assert(sizeof(JArenaValue) == 24, "JArenaValue should stay compact");
+
+namespace {
+
+FUN_ALWAYS_INLINE int32 AlignUp(int32 size) { return (size + 7) & ~7; }
+
+// FNV-1a; keys are short, so this beats anything with a setup cost.
+FUN_ALWAYS_INLINE uint32 HashKey(const char* name, int32 len) {
+  uint32 hash = 2166136261u;
+  for (int32 i = 0; i < len; ++i) {
+    hash = (hash ^ uint8(name[i])) * 16777619u;
+  }
+  return hash;
+}
+
+FUN_ALWAYS_INLINE bool KeyEquals(const JKey* key, uint32 hash,
+                                 const char* name, int32 len) {
+  return key->hash == hash && key->len == len &&
+         ::memcmp(key->name, name, len) == 0;
+}
+
+}  // namespace
+
+//
+// JArena
+//
+
+JArena::JArena(int32 block_size)
+    : head_(nullptr),
+      block_size_(block_size),
+      allocated_size_(0),
+      key_count_(0) {
+  fun_check(block_size > 0);
+}
+
+JArena::~JArena() {
+  while (head_) {
+    Block* next = head_->next;
+    UnsafeMemory::Free(head_);
+    head_ = next;
+  }
+}
+
+JArena::Block* JArena::AddBlock(int32 min_size) {
+  // Blocks double up to MAX_BLOCK_SIZE so that big documents need few
+  // blocks; oversized requests get a block of their own.
+  int32 capacity = head_ ? head_->capacity * 2 : block_size_;
+  if (capacity > MAX_BLOCK_SIZE) {
+    capacity = MAX_BLOCK_SIZE;
+  }
+  if (capacity < min_size) {
+    capacity = min_size;
+  }
+
+  Block* block = static_cast<Block*>(
+      UnsafeMemory::Malloc(sizeof(Block) + capacity, 8));
+  if (block == nullptr) {
+    throw OutOfMemoryException("cannot allocate JSON arena block");
+  }
+  block->next = head_;
+  block->capacity = capacity;
+  block->used = 0;
+  head_ = block;
+  allocated_size_ += sizeof(Block) + capacity;
+  return block;
+}
+
+void* JArena::Allocate(int32 size) {
+  size = AlignUp(size);
+  Block* block = head_;
+  if (block == nullptr || block->capacity - block->used < size) {
+    block = AddBlock(size);
+  }
+  void* ptr = block->Data() + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void* JArena::Reallocate(void* ptr, int32 old_size, int32 new_size) {
+  if (ptr == nullptr) {
+    return Allocate(new_size);
+  }
+
+  old_size = AlignUp(old_size);
+  new_size = AlignUp(new_size);
+  if (new_size <= old_size) {
+    return ptr;
+  }
+
+  // Extend in place when ptr is the last allocation of the current block,
+  // which is the common case while filling a single array.
+  Block* block = head_;
+  if (block &&
+      static_cast<char*>(ptr) + old_size == block->Data() + block->used &&
+      block->capacity - block->used >= new_size - old_size) {
+    block->used += new_size - old_size;
+    return ptr;
+  }
+
+  void* new_ptr = Allocate(new_size);
+  UnsafeMemory::Memcpy(new_ptr, ptr, old_size);
+  return new_ptr;
+}
+
+const char* JArena::CopyString(const char* data, int32 len) {
+  char* copy = static_cast<char*>(Allocate(len + 1));
+  UnsafeMemory::Memcpy(copy, data, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void JArena::GrowKeyTable() {
+  const int32 new_capacity = keys_.Count() ? keys_.Count() * 2 : 64;
+  Array<const JKey*> old_keys(MoveTemp(keys_));
+  keys_.Reset();
+  keys_.AddZeroed(new_capacity);
+
+  const int32 mask = new_capacity - 1;
+  for (const JKey* key : old_keys) {
+    if (key) {
+      int32 slot = int32(key->hash & mask);
+      while (keys_[slot]) {
+        slot = (slot + 1) & mask;
+      }
+      keys_[slot] = key;
+    }
+  }
+}
+
+const JKey* JArena::InternKey(const StringView& name) {
+  // Keep the load factor under 1/2.
+  if ((key_count_ + 1) * 2 > keys_.Count()) {
+    GrowKeyTable();
+  }
+
+  const char* data = name.ConstData();
+  const int32 len = name.Len();
+  const uint32 hash = HashKey(data, len);
+  const int32 mask = keys_.Count() - 1;
+  int32 slot = int32(hash & mask);
+  while (const JKey* key = keys_[slot]) {
+    if (KeyEquals(key, hash, data, len)) {
+      return key;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  JKey* key = static_cast<JKey*>(Allocate(int32(sizeof(JKey)) + len));
+  key->hash = hash;
+  key->len = len;
+  UnsafeMemory::Memcpy(key->name, data, len);
+  key->name[len] = '\0';
+  keys_[slot] = key;
+  ++key_count_;
+  return key;
+}
+
+void JArena::Reset() {
+  if (head_) {
+    Block* block = head_->next;
+    while (block) {
+      Block* next = block->next;
+      allocated_size_ -= sizeof(Block) + block->capacity;
+      UnsafeMemory::Free(block);
+      block = next;
+    }
+    head_->next = nullptr;
+    head_->used = 0;
+  }
+
+  if (key_count_ > 0) {
+    UnsafeMemory::Memzero(keys_.MutableData(), keys_.Count() * sizeof(JKey*));
+    key_count_ = 0;
+  }
+}
+
+//
+// JArenaValue
+//
+
+int64 JArenaValue::AsInteger() const {
+  switch (GetType()) {
+    case ValueType::Integer:
+      return integer_value_;
+    case ValueType::UnsignedInteger:
+      return int64(unsigned_integer_value_);
+    case ValueType::Double:
+      return int64(double_value_);
+    case ValueType::Bool:
+      return bool_value_ ? 1 : 0;
+    default:
+      fun_check_msg(false, "JArenaValue is not convertible to int64.");
+      return 0;
+  }
+}
+
+uint64 JArenaValue::AsUnsignedInteger() const {
+  switch (GetType()) {
+    case ValueType::Integer:
+      return uint64(integer_value_);
+    case ValueType::UnsignedInteger:
+      return unsigned_integer_value_;
+    case ValueType::Double:
+      return uint64(double_value_);
+    case ValueType::Bool:
+      return bool_value_ ? 1 : 0;
+    default:
+      fun_check_msg(false, "JArenaValue is not convertible to uint64.");
+      return 0;
+  }
+}
+
+double JArenaValue::AsDouble() const {
+  switch (GetType()) {
+    case ValueType::Integer:
+      return double(integer_value_);
+    case ValueType::UnsignedInteger:
+      return double(unsigned_integer_value_);
+    case ValueType::Double:
+      return double_value_;
+    case ValueType::Bool:
+      return bool_value_ ? 1.0 : 0.0;
+    default:
+      fun_check_msg(false, "JArenaValue is not convertible to double.");
+      return 0.0;
+  }
+}
+
+const JArenaValue* JArenaValue::Find(const StringView& field_name) const {
+  if (!IsObject()) {
+    return nullptr;
+  }
+
+  const char* name = field_name.ConstData();
+  const int32 len = field_name.Len();
+  const uint32 hash = HashKey(name, len);
+  for (int32 i = 0; i < count_; ++i) {
+    if (KeyEquals(object_.members[i].key, hash, name, len)) {
+      return &object_.members[i].value;
+    }
+  }
+  return nullptr;
+}
+
+JArenaValue* JArenaValue::Find(const StringView& field_name) {
+  return const_cast<JArenaValue*>(
+      static_cast<const JArenaValue*>(this)->Find(field_name));
+}
+
+void JArenaValue::SetString(const StringView& value, JArena& arena) {
+  Reset(ValueType::String);
+  count_ = value.Len();
+  if (count_ <= SHORT_STRING_CAPACITY) {
+    flags_ = FLAG_SHORT_STRING;
+    UnsafeMemory::Memcpy(short_string_, value.ConstData(), count_);
+  } else {
+    string_ = arena.CopyString(value.ConstData(), count_);
+  }
+}
+
+void JArenaValue::SetStaticString(const StringView& value) {
+  Reset(ValueType::String);
+  count_ = value.Len();
+  string_ = value.ConstData();
+}
+
+void JArenaValue::Grow(int32 min_capacity, JArena& arena) {
+  if (IsArray()) {
+    int32 capacity = array_.capacity ? array_.capacity * 2 : 4;
+    if (capacity < min_capacity) {
+      capacity = min_capacity;
+    }
+    array_.elements = static_cast<JArenaValue*>(arena.Reallocate(
+        array_.elements, array_.capacity * int32(sizeof(JArenaValue)),
+        capacity * int32(sizeof(JArenaValue))));
+    array_.capacity = capacity;
+  } else {
+    int32 capacity = object_.capacity ? object_.capacity * 2 : 4;
+    if (capacity < min_capacity) {
+      capacity = min_capacity;
+    }
+    object_.members = static_cast<JArenaMember*>(arena.Reallocate(
+        object_.members, object_.capacity * int32(sizeof(JArenaMember)),
+        capacity * int32(sizeof(JArenaMember))));
+    object_.capacity = capacity;
+  }
+}
+
+void JArenaValue::Reserve(int32 capacity, JArena& arena) {
+  if (IsNull()) {
+    SetArray();
+  }
+  fun_check_msg(IsArray() || IsObject(),
+                "JArenaValue is not an array or object.");
+  const int32 current = IsArray() ? array_.capacity : object_.capacity;
+  if (capacity > current) {
+    Grow(capacity, arena);
+  }
+}
+
+JArenaValue& JArenaValue::Append(JArena& arena) {
+  if (IsNull()) {
+    SetArray();
+  }
+  fun_check_msg(IsArray(), "JArenaValue is not an array.");
+
+  if (count_ == array_.capacity) {
+    Grow(count_ + 1, arena);
+  }
+  JArenaValue* element = new (&array_.elements[count_++]) JArenaValue();
+  return *element;
+}
+
+JArenaValue& JArenaValue::AddField(const JKey* key, JArena& arena) {
+  if (IsNull()) {
+    SetObject();
+  }
+  fun_check_msg(IsObject(), "JArenaValue is not an object.");
+
+  if (count_ == object_.capacity) {
+    Grow(count_ + 1, arena);
+  }
+  JArenaMember& member = object_.members[count_++];
+  member.key = key;
+  new (&member.value) JArenaValue();
+  return member.value;
+}
+
+JArenaValue& JArenaValue::AddField(const StringView& field_name,
+                                   JArena& arena) {
+  return AddField(arena.InternKey(field_name), arena);
+}
+
+void JArenaValue::CopyFrom(const JValue& value, JArena& arena) {
+  switch (value.GetType()) {
+    case ValueType::Null:
+      SetNull();
+      break;
+    case ValueType::Bool:
+      SetBool(value.AsBool());
+      break;
+    case ValueType::Integer:
+      SetInteger(value.AsInteger());
+      break;
+    case ValueType::UnsignedInteger:
+      SetUnsignedInteger(value.AsUnsignedInteger());
+      break;
+    case ValueType::Double:
+      SetDouble(value.AsDouble());
+      break;
+    case ValueType::String: {
+      const String str = value.AsString();
+      SetString(StringView(str.ConstData(), str.Len()), arena);
+      break;
+    }
+    case ValueType::Array: {
+      SetArray();
+      const int32 count = value.Count();
+      Reserve(count, arena);
+      for (int32 i = 0; i < count; ++i) {
+        Append(arena).CopyFrom(value[i], arena);
+      }
+      break;
+    }
+    case ValueType::Object: {
+      SetObject();
+      const JObject& object = value.AsObject();
+      Reserve(object.Count(), arena);
+      for (const auto& pair : object) {
+        AddField(StringView(pair.key.ConstData(), pair.key.Len()), arena)
+            .CopyFrom(pair.value, arena);
+      }
+      break;
+    }
+    default:
+      fun_check(false);
+      break;
+  }
+}
+
+void JArenaValue::ToJValue(JValue& out_value) const {
+  switch (GetType()) {
+    case ValueType::Null:
+      out_value.SetNull();
+      break;
+    case ValueType::Bool:
+      out_value.SetBool(bool_value_);
+      break;
+    case ValueType::Integer:
+      out_value.SetInteger(integer_value_);
+      break;
+    case ValueType::UnsignedInteger:
+      out_value.SetUnsignedInteger(unsigned_integer_value_);
+      break;
+    case ValueType::Double:
+      out_value.SetDouble(double_value_);
+      break;
+    case ValueType::String:
+      out_value.SetString(String(AsString()));
+      break;
+    case ValueType::Array:
+      out_value.SetArray();
+      for (int32 i = 0; i < count_; ++i) {
+        out_value.Append();
+        array_.elements[i].ToJValue(out_value[out_value.Count() - 1]);
+      }
+      break;
+    case ValueType::Object:
+      out_value.SetObject();
+      for (int32 i = 0; i < count_; ++i) {
+        const JArenaMember& member = object_.members[i];
+        member.value.ToJValue(
+            out_value[String(member.key->ToStringView())]);
+      }
+      break;
+    default:
+      fun_check(false);
+      break;
+  }
+}
+
+}  // namespace json
+}  // namespace fun
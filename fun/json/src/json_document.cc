@@ -0,0 +1,552 @@
+#include "fun/json/document.h"
+#include "fun/json/scalar_parser_internal.h"
+
+#include <cstring>
+
+namespace fun {
+namespace json {
+
+namespace {
+
+// Tape tags.
+const char TAG_ROOT = 'r';
+const char TAG_OBJECT_BEGIN = '{';
+const char TAG_OBJECT_END = '}';
+const char TAG_ARRAY_BEGIN = '[';
+const char TAG_ARRAY_END = ']';
+const char TAG_STRING = '"';
+const char TAG_INTEGER = 'l';
+const char TAG_UNSIGNED_INTEGER = 'u';
+const char TAG_DOUBLE = 'd';
+const char TAG_TRUE = 't';
+const char TAG_FALSE = 'f';
+const char TAG_NULL = 'n';
+
+const uint64 COUNT_SHIFT = 32;
+const uint64 MAX_COUNT = (uint64(1) << 24) - 1;
+
+FUN_ALWAYS_INLINE uint64 ContainerPayload(int32 end_index, int32 count) {
+  const uint64 saturated = (uint64)count > MAX_COUNT ? MAX_COUNT : count;
+  return (saturated << COUNT_SHIFT) | (uint32)end_index;
+}
+
+}  // namespace
+
+//
+// JDocument
+//
+
+JDocument::JDocument() {}
+
+JElement JDocument::GetRoot() const {
+  fun_check_msg(!tape_.IsEmpty(), "JDocument::GetRoot(): empty document");
+  // Index 0 is the root word, the value follows it.
+  return JElement(this, 1);
+}
+
+void JDocument::Clear() {
+  tape_.Reset();
+  strings_.Reset();
+}
+
+int64 JDocument::GetAllocatedSize() const {
+  return (int64)tape_.Capacity() * sizeof(uint64) +
+         (int64)strings_.Capacity() * sizeof(char);
+}
+
+int32 JDocument::AfterValue(int32 index) const {
+  const uint64 word = tape_[index];
+  switch (TagOf(word)) {
+    case TAG_OBJECT_BEGIN:
+    case TAG_ARRAY_BEGIN:
+      return (int32)(uint32)PayloadOf(word);
+    case TAG_INTEGER:
+    case TAG_UNSIGNED_INTEGER:
+    case TAG_DOUBLE:
+      return index + 2;
+    default:
+      return index + 1;
+  }
+}
+
+StringView JDocument::StringAt(uint64 offset) const {
+  const char* base = strings_.ConstData() + offset;
+  uint32 len;
+  ::memcpy(&len, base, sizeof(len));
+  return StringView(base + sizeof(len), (int32)len);
+}
+
+//
+// JElement
+//
+
+uint64 JElement::Word() const {
+  fun_check_msg(doc_, "JElement: invalid element");
+  return doc_->tape_[index_];
+}
+
+char JElement::Tag() const { return JDocument::TagOf(Word()); }
+
+ValueType JElement::GetType() const {
+  switch (Tag()) {
+    case TAG_OBJECT_BEGIN:
+      return ValueType::Object;
+    case TAG_ARRAY_BEGIN:
+      return ValueType::Array;
+    case TAG_STRING:
+      return ValueType::String;
+    case TAG_INTEGER:
+      return ValueType::Integer;
+    case TAG_UNSIGNED_INTEGER:
+      return ValueType::UnsignedInteger;
+    case TAG_DOUBLE:
+      return ValueType::Double;
+    case TAG_TRUE:
+    case TAG_FALSE:
+      return ValueType::Bool;
+    default:
+      return ValueType::Null;
+  }
+}
+
+bool JElement::IsNumeric() const {
+  const char tag = Tag();
+  return tag == TAG_INTEGER || tag == TAG_UNSIGNED_INTEGER ||
+         tag == TAG_DOUBLE;
+}
+
+bool JElement::AsBool() const {
+  const char tag = Tag();
+  fun_check_msg(tag == TAG_TRUE || tag == TAG_FALSE,
+                "in JElement::AsBool(): requires bool");
+  return tag == TAG_TRUE;
+}
+
+int64 JElement::AsInteger() const {
+  const uint64 raw = doc_ ? doc_->tape_[index_ + 1] : 0;
+  switch (Tag()) {
+    case TAG_INTEGER:
+      return (int64)raw;
+    case TAG_UNSIGNED_INTEGER:
+      fun_check_msg(raw <= (uint64)INT64_MAX,
+                    "in JElement::AsInteger(): out of range");
+      return (int64)raw;
+    case TAG_DOUBLE: {
+      double value;
+      ::memcpy(&value, &raw, sizeof(value));
+      return (int64)value;
+    }
+    default:
+      fun_check_msg(false, "in JElement::AsInteger(): requires numeric");
+      return 0;
+  }
+}
+
+uint64 JElement::AsUnsignedInteger() const {
+  const uint64 raw = doc_ ? doc_->tape_[index_ + 1] : 0;
+  switch (Tag()) {
+    case TAG_INTEGER:
+      fun_check_msg((int64)raw >= 0,
+                    "in JElement::AsUnsignedInteger(): out of range");
+      return raw;
+    case TAG_UNSIGNED_INTEGER:
+      return raw;
+    case TAG_DOUBLE: {
+      double value;
+      ::memcpy(&value, &raw, sizeof(value));
+      return (uint64)value;
+    }
+    default:
+      fun_check_msg(false,
+                    "in JElement::AsUnsignedInteger(): requires numeric");
+      return 0;
+  }
+}
+
+double JElement::AsDouble() const {
+  const uint64 raw = doc_ ? doc_->tape_[index_ + 1] : 0;
+  switch (Tag()) {
+    case TAG_INTEGER:
+      return (double)(int64)raw;
+    case TAG_UNSIGNED_INTEGER:
+      return (double)raw;
+    case TAG_DOUBLE: {
+      double value;
+      ::memcpy(&value, &raw, sizeof(value));
+      return value;
+    }
+    default:
+      fun_check_msg(false, "in JElement::AsDouble(): requires numeric");
+      return 0.0;
+  }
+}
+
+StringView JElement::AsString() const {
+  const uint64 word = Word();
+  fun_check_msg(JDocument::TagOf(word) == TAG_STRING,
+                "in JElement::AsString(): requires string");
+  return doc_->StringAt(JDocument::PayloadOf(word));
+}
+
+int32 JElement::Count() const {
+  const char tag = Tag();
+  if (tag != TAG_OBJECT_BEGIN && tag != TAG_ARRAY_BEGIN) {
+    return 0;
+  }
+  const uint64 count = JDocument::PayloadOf(Word()) >> COUNT_SHIFT;
+  if (count < MAX_COUNT) {
+    return (int32)count;
+  }
+
+  // Saturated; count the slow way.
+  int32 slow_count = 0;
+  if (tag == TAG_ARRAY_BEGIN) {
+    for (JElement element : Elements()) {
+      FUN_UNUSED(element);
+      ++slow_count;
+    }
+  } else {
+    for (const JMember& member : Members()) {
+      FUN_UNUSED(member);
+      ++slow_count;
+    }
+  }
+  return slow_count;
+}
+
+JElement JElement::operator[](int32 array_index) const {
+  if (!doc_ || Tag() != TAG_ARRAY_BEGIN || array_index < 0) {
+    return JElement();
+  }
+  int32 i = 0;
+  for (JElement element : Elements()) {
+    if (i++ == array_index) {
+      return element;
+    }
+  }
+  return JElement();
+}
+
+JElement JElement::operator[](const StringView& field_name) const {
+  JElement value;
+  Find(field_name, value);
+  return value;
+}
+
+bool JElement::Find(const StringView& field_name, JElement& out_value) const {
+  if (!doc_ || Tag() != TAG_OBJECT_BEGIN) {
+    return false;
+  }
+  for (const JMember& member : Members()) {
+    if (member.name == field_name) {
+      out_value = member.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+JElement::Range<JElement::ArrayIterator> JElement::Elements() const {
+  if (!doc_ || Tag() != TAG_ARRAY_BEGIN) {
+    return Range<ArrayIterator>{ArrayIterator(doc_, 0),
+                                ArrayIterator(doc_, 0)};
+  }
+  const int32 end = doc_->AfterValue(index_) - 1;  // closing ']'
+  return Range<ArrayIterator>{ArrayIterator(doc_, index_ + 1),
+                              ArrayIterator(doc_, end)};
+}
+
+JElement::Range<JElement::ObjectIterator> JElement::Members() const {
+  if (!doc_ || Tag() != TAG_OBJECT_BEGIN) {
+    return Range<ObjectIterator>{ObjectIterator(doc_, 0),
+                                 ObjectIterator(doc_, 0)};
+  }
+  const int32 end = doc_->AfterValue(index_) - 1;  // closing '}'
+  return Range<ObjectIterator>{ObjectIterator(doc_, index_ + 1),
+                               ObjectIterator(doc_, end)};
+}
+
+JElement::ArrayIterator& JElement::ArrayIterator::operator++() {
+  index_ = doc_->AfterValue(index_);
+  return *this;
+}
+
+JMember JElement::ObjectIterator::operator*() const {
+  JMember member;
+  member.name = doc_->StringAt(JDocument::PayloadOf(doc_->tape_[index_]));
+  member.value = JElement(doc_, index_ + 1);
+  return member;
+}
+
+JElement::ObjectIterator& JElement::ObjectIterator::operator++() {
+  // Skip the key, then the value.
+  index_ = doc_->AfterValue(index_ + 1);
+  return *this;
+}
+
+void JElement::ToJValue(JValue& out_value) const {
+  switch (Tag()) {
+    case TAG_OBJECT_BEGIN: {
+      out_value.SetObject();
+      for (const JMember& member : Members()) {
+        member.value.ToJValue(out_value[String(member.name)]);
+      }
+      break;
+    }
+    case TAG_ARRAY_BEGIN: {
+      out_value.SetArray();
+      for (JElement element : Elements()) {
+        out_value.Append();
+        element.ToJValue(out_value[out_value.Count() - 1]);
+      }
+      break;
+    }
+    case TAG_STRING:
+      out_value.SetString(String(AsString()));
+      break;
+    case TAG_INTEGER:
+      out_value.SetInteger(AsInteger());
+      break;
+    case TAG_UNSIGNED_INTEGER:
+      out_value.SetUnsignedInteger(AsUnsignedInteger());
+      break;
+    case TAG_DOUBLE:
+      out_value.SetDouble(AsDouble());
+      break;
+    case TAG_TRUE:
+      out_value.SetBool(true);
+      break;
+    case TAG_FALSE:
+      out_value.SetBool(false);
+      break;
+    default:
+      out_value.SetNull();
+      break;
+  }
+}
+
+//
+// DocumentParser
+//
+
+DocumentParser::DocumentParser(int32 max_depth)
+    : max_depth_(max_depth), error_offset_(-1) {}
+
+bool DocumentParser::Fail(const char* message, int32 offset) {
+  error_message_ = message;
+  error_offset_ = offset;
+  return false;
+}
+
+bool DocumentParser::WriteString(JDocument& doc, const char* data, int32 len,
+                                 uint32 offset) {
+  const char* body = data + offset + 1;
+  bool has_escapes;
+  const char* close = internal::FindStringEnd(body, data + len, has_escapes);
+  if (close == nullptr) {
+    return Fail("unterminated string", (int32)offset);
+  }
+  const int32 raw_len = int32(close - body);
+
+  // Layout in the arena: uint32 length, bytes, '\0'. The decoded form is
+  // never longer than the raw one.
+  const int32 start = doc.strings_.Count();
+  doc.strings_.AddUninitialized((int32)sizeof(uint32) + raw_len + 1);
+  char* dst = doc.strings_.MutableData() + start + sizeof(uint32);
+
+  int32 decoded_len = raw_len;
+  if (has_escapes) {
+    const char* end_of_string = nullptr;
+    decoded_len = internal::UnescapeString(body, close + 1, dst, end_of_string);
+    if (decoded_len < 0) {
+      return Fail("invalid escape sequence", (int32)offset);
+    }
+    doc.strings_.ResizeUninitialized(start + (int32)sizeof(uint32) +
+                                     decoded_len + 1);
+    dst = doc.strings_.MutableData() + start + sizeof(uint32);
+  } else {
+    ::memcpy(dst, body, raw_len);
+  }
+  dst[decoded_len] = '\0';
+
+  const uint32 stored_len = (uint32)decoded_len;
+  ::memcpy(doc.strings_.MutableData() + start, &stored_len,
+           sizeof(stored_len));
+
+  doc.tape_.Add(JDocument::MakeWord(TAG_STRING, (uint64)start));
+  return true;
+}
+
+bool DocumentParser::Parse(const char* data, int32 len, JDocument& out_doc) {
+  error_message_.Clear();
+  error_offset_ = -1;
+  out_doc.Clear();
+  open_.Reset();
+
+  if (!index_.Build(data, len)) {
+    return Fail("unterminated string or control character in string",
+                index_.GetErrorOffset());
+  }
+
+  const int32 count = index_.Count();
+  const uint32* indices = index_.ConstData();
+  if (count == 0) {
+    return Fail("empty document", 0);
+  }
+
+  // A tape word per structural is a good upper bound for most inputs
+  // (numbers take two words, but closing brackets and separators none).
+  out_doc.tape_.Reserve(count + 2);
+  out_doc.strings_.Reserve(len / 4);
+  out_doc.tape_.Add(0);  // root placeholder
+
+  Array<uint64>& tape = out_doc.tape_;
+  int32 pos = 0;
+  uint32 offset = 0;
+  char ch = 0;
+
+#define FUN_JSON_NEXT()                  \
+  do {                                   \
+    if (pos >= count) {                  \
+      return Fail("unexpected end", len); \
+    }                                    \
+    offset = indices[pos++];             \
+    ch = data[offset];                   \
+  } while (0)
+
+  // The parser is a small state machine: parse a value, then decide
+  // what may follow it from the innermost open container.
+parse_value:
+  FUN_JSON_NEXT();
+  switch (ch) {
+    case '{':
+    case '[': {
+      if (open_.Count() >= max_depth_) {
+        return Fail("exceeded maximum depth", (int32)offset);
+      }
+      OpenContainer container;
+      container.tape_index = tape.Count();
+      container.count = 0;
+      container.tag = ch;
+      open_.Add(container);
+      tape.Add(0);  // patched when the container closes
+
+      const char closing = ch == '{' ? '}' : ']';
+      if (pos < count && data[indices[pos]] == closing) {
+        ++pos;
+        goto close_container;
+      }
+      if (ch == '{') {
+        goto parse_key;
+      }
+      goto parse_value;
+    }
+
+    case '"':
+      if (!WriteString(out_doc, data, len, offset)) {
+        return false;
+      }
+      goto after_value;
+
+    case 't':
+      if (!internal::MatchLiteral(data + offset, data + len, "true", 4)) {
+        return Fail("invalid literal", (int32)offset);
+      }
+      tape.Add(JDocument::MakeWord(TAG_TRUE, 0));
+      goto after_value;
+
+    case 'f':
+      if (!internal::MatchLiteral(data + offset, data + len, "false", 5)) {
+        return Fail("invalid literal", (int32)offset);
+      }
+      tape.Add(JDocument::MakeWord(TAG_FALSE, 0));
+      goto after_value;
+
+    case 'n':
+      if (!internal::MatchLiteral(data + offset, data + len, "null", 4)) {
+        return Fail("invalid literal", (int32)offset);
+      }
+      tape.Add(JDocument::MakeWord(TAG_NULL, 0));
+      goto after_value;
+
+    default: {
+      internal::NumberValue number;
+      const char* number_end = nullptr;
+      if (!internal::ParseNumber(data + offset, data + len, number,
+                                 number_end)) {
+        return Fail("syntax error: value expected", (int32)offset);
+      }
+      switch (number.type) {
+        case ValueType::Integer:
+          tape.Add(JDocument::MakeWord(TAG_INTEGER, 0));
+          tape.Add((uint64)number.integer_value);
+          break;
+        case ValueType::UnsignedInteger:
+          tape.Add(JDocument::MakeWord(TAG_UNSIGNED_INTEGER, 0));
+          tape.Add(number.unsigned_integer_value);
+          break;
+        default: {
+          uint64 bits;
+          ::memcpy(&bits, &number.double_value, sizeof(bits));
+          tape.Add(JDocument::MakeWord(TAG_DOUBLE, 0));
+          tape.Add(bits);
+          break;
+        }
+      }
+      goto after_value;
+    }
+  }
+
+parse_key:
+  FUN_JSON_NEXT();
+  if (ch != '"') {
+    return Fail("syntax error: object key expected", (int32)offset);
+  }
+  if (!WriteString(out_doc, data, len, offset)) {
+    return false;
+  }
+  FUN_JSON_NEXT();
+  if (ch != ':') {
+    return Fail("syntax error: ':' expected", (int32)offset);
+  }
+  goto parse_value;
+
+after_value:
+  if (open_.IsEmpty()) {
+    if (pos != count) {
+      return Fail("extra non-whitespace after JSON value", indices[pos]);
+    }
+    tape[0] = JDocument::MakeWord(TAG_ROOT, (uint64)tape.Count());
+    return true;
+  }
+  ++open_.Last().count;
+  FUN_JSON_NEXT();
+  if (ch == ',') {
+    if (open_.Last().tag == '{') {
+      goto parse_key;
+    }
+    goto parse_value;
+  }
+  if (ch != (open_.Last().tag == '{' ? '}' : ']')) {
+    return Fail("syntax error: ',' or closing bracket expected",
+                (int32)offset);
+  }
+  // fall through
+
+close_container : {
+  const OpenContainer container = open_.Last();
+  open_.RemoveLast();
+  const bool is_object = container.tag == '{';
+  tape.Add(JDocument::MakeWord(is_object ? TAG_OBJECT_END : TAG_ARRAY_END,
+                               (uint64)container.tape_index));
+  tape[container.tape_index] = JDocument::MakeWord(
+      is_object ? TAG_OBJECT_BEGIN : TAG_ARRAY_BEGIN,
+      ContainerPayload(tape.Count(), container.count));
+  goto after_value;
+}
+
+#undef FUN_JSON_NEXT
+}
+
+}  // namespace json
+}  // namespace fun
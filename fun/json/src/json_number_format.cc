@@ -0,0 +1,437 @@
+#include "fun/json/number_format.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace fun {
+namespace json {
+
+namespace {
+
+const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+//
+// Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers", PLDI 2010).
+//
+
+const int32 DIY_SIGNIFICAND_SIZE = 64;
+const int32 DP_SIGNIFICAND_SIZE = 52;
+const int32 DP_EXPONENT_BIAS = 0x3FF + DP_SIGNIFICAND_SIZE;
+const int32 DP_MIN_EXPONENT = -DP_EXPONENT_BIAS;
+const uint64 DP_EXPONENT_MASK = UINT64_C(0x7FF0000000000000);
+const uint64 DP_SIGNIFICAND_MASK = UINT64_C(0x000FFFFFFFFFFFFF);
+const uint64 DP_HIDDEN_BIT = UINT64_C(0x0010000000000000);
+
+/**
+ * "Do it yourself" floating point: f * 2^e with a 64-bit significand.
+ */
+struct DiyFp {
+  uint64 f;
+  int32 e;
+
+  DiyFp() : f(0), e(0) {}
+  DiyFp(uint64 f, int32 e) : f(f), e(e) {}
+
+  explicit DiyFp(double value) {
+    uint64 bits;
+    ::memcpy(&bits, &value, sizeof(bits));
+    const int32 biased_e =
+        int32((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    const uint64 significand = bits & DP_SIGNIFICAND_MASK;
+    if (biased_e != 0) {
+      f = significand + DP_HIDDEN_BIT;
+      e = biased_e - DP_EXPONENT_BIAS;
+    } else {
+      f = significand;
+      e = DP_MIN_EXPONENT + 1;
+    }
+  }
+
+  DiyFp operator-(const DiyFp& rhs) const { return DiyFp(f - rhs.f, e); }
+
+  /**
+   * Upper 64 bits of the 128-bit product, rounded.
+   */
+  DiyFp operator*(const DiyFp& rhs) const {
+    const uint64 M32 = 0xFFFFFFFF;
+    const uint64 a = f >> 32;
+    const uint64 b = f & M32;
+    const uint64 c = rhs.f >> 32;
+    const uint64 d = rhs.f & M32;
+    const uint64 ac = a * c;
+    const uint64 bc = b * c;
+    const uint64 ad = a * d;
+    const uint64 bd = b * d;
+    uint64 tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += uint64(1) << 31;
+    return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+  }
+
+  DiyFp Normalize() const {
+    DiyFp result = *this;
+    while ((result.f & (uint64(1) << 63)) == 0) {
+      result.f <<= 1;
+      result.e--;
+    }
+    return result;
+  }
+
+  DiyFp NormalizeBoundary() const {
+    DiyFp result = *this;
+    while ((result.f & (DP_HIDDEN_BIT << 1)) == 0) {
+      result.f <<= 1;
+      result.e--;
+    }
+    const int32 shift = DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 2;
+    result.f <<= shift;
+    result.e -= shift;
+    return result;
+  }
+
+  /**
+   * Boundaries m- and m+ halfway to the neighbouring doubles, normalized
+   * to the same exponent.
+   */
+  void NormalizedBoundaries(DiyFp& out_minus, DiyFp& out_plus) const {
+    const DiyFp plus = DiyFp((f << 1) + 1, e - 1).NormalizeBoundary();
+    DiyFp minus = (f == DP_HIDDEN_BIT) ? DiyFp((f << 2) - 1, e - 2)
+                                       : DiyFp((f << 1) - 1, e - 1);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    out_minus = minus;
+    out_plus = plus;
+  }
+};
+
+/**
+ * Normalized 10^k for k = -348, -340, ..., 340.
+ */
+const uint64 CACHED_POWERS_F[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76),
+    UINT64_C(0x8b16fb203055ac76), UINT64_C(0xcf42894a5dce35ea),
+    UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f),
+    UINT64_C(0xbe5691ef416bd60c), UINT64_C(0x8dd01fad907ffc3c),
+    UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d),
+    UINT64_C(0x823c12795db6ce57), UINT64_C(0xc21094364dfb5637),
+    UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+    UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5),
+    UINT64_C(0xb23867fb2a35b28e), UINT64_C(0x84c8d4dfd2c63f3b),
+    UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+    UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6),
+    UINT64_C(0xf3e2f893dec3f126), UINT64_C(0xb5b5ada8aaff80b8),
+    UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd),
+    UINT64_C(0xa6dfbd9fb8e5b88f), UINT64_C(0xf8a95fcf88747d94),
+    UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac),
+    UINT64_C(0xe45c10c42a2b3b06), UINT64_C(0xaa242499697392d3),
+    UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+    UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c),
+    UINT64_C(0x9c40000000000000), UINT64_C(0xe8d4a51000000000),
+    UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70),
+    UINT64_C(0xd5d238a4abe98068), UINT64_C(0x9f4f2726179a2245),
+    UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a),
+    UINT64_C(0x924d692ca61be758), UINT64_C(0xda01ee641a708dea),
+    UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2),
+    UINT64_C(0xc83553c5c8965d3d), UINT64_C(0x952ab45cfa97a0b3),
+    UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+    UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece),
+    UINT64_C(0x88fcf317f22241e2), UINT64_C(0xcc20ce9bd35c78a5),
+    UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c),
+    UINT64_C(0xbb764c4ca7a44410), UINT64_C(0x8bab8eefb6409c1a),
+    UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429),
+    UINT64_C(0x80444b5e7aa7cf85), UINT64_C(0xbf21e44003acdd2d),
+    UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9),
+    UINT64_C(0xaf87023b9bf0ee6b),
+};
+
+const int16 CACHED_POWERS_E[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+DiyFp GetCachedPower(int32 e, int32& out_k) {
+  // Smallest k such that the product lands in the [-60, -32] window.
+  const double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int32 k = int32(dk);
+  if (dk - k > 0.0) {
+    k++;
+  }
+  const int32 index = (k >> 3) + 1;
+  out_k = -(-348 + index * 8);
+  return DiyFp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+}
+
+int32 CountDecimalDigit32(uint32 n) {
+  if (n < 10) return 1;
+  if (n < 100) return 2;
+  if (n < 1000) return 3;
+  if (n < 10000) return 4;
+  if (n < 100000) return 5;
+  if (n < 1000000) return 6;
+  if (n < 10000000) return 7;
+  if (n < 100000000) return 8;
+  // DigitGen() never sees 10 digits.
+  return 9;
+}
+
+void GrisuRound(char* buffer, int32 len, uint64 delta, uint64 rest,
+                uint64 ten_kappa, uint64 wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w ||
+          wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+const uint64 POW10[] = {
+    UINT64_C(1),
+    UINT64_C(10),
+    UINT64_C(100),
+    UINT64_C(1000),
+    UINT64_C(10000),
+    UINT64_C(100000),
+    UINT64_C(1000000),
+    UINT64_C(10000000),
+    UINT64_C(100000000),
+    UINT64_C(1000000000),
+    UINT64_C(10000000000),
+    UINT64_C(100000000000),
+    UINT64_C(1000000000000),
+    UINT64_C(10000000000000),
+    UINT64_C(100000000000000),
+    UINT64_C(1000000000000000),
+    UINT64_C(10000000000000000),
+    UINT64_C(100000000000000000),
+    UINT64_C(1000000000000000000),
+    UINT64_C(10000000000000000000),
+};
+
+void DigitGen(const DiyFp& w, const DiyFp& mp, uint64 delta, char* buffer,
+              int32& out_len, int32& inout_k) {
+  const DiyFp one(uint64(1) << -mp.e, mp.e);
+  const DiyFp wp_w = mp - w;
+  uint32 p1 = uint32(mp.f >> -one.e);
+  uint64 p2 = mp.f & (one.f - 1);
+  int32 kappa = CountDecimalDigit32(p1);
+  int32 len = 0;
+
+  // Integral part.
+  while (kappa > 0) {
+    uint32 d = 0;
+    switch (kappa) {
+      case 9: d = p1 / 100000000; p1 %= 100000000; break;
+      case 8: d = p1 / 10000000; p1 %= 10000000; break;
+      case 7: d = p1 / 1000000; p1 %= 1000000; break;
+      case 6: d = p1 / 100000; p1 %= 100000; break;
+      case 5: d = p1 / 10000; p1 %= 10000; break;
+      case 4: d = p1 / 1000; p1 %= 1000; break;
+      case 3: d = p1 / 100; p1 %= 100; break;
+      case 2: d = p1 / 10; p1 %= 10; break;
+      case 1: d = p1; p1 = 0; break;
+      default: break;
+    }
+    if (d != 0 || len != 0) {
+      buffer[len++] = char('0' + d);
+    }
+    kappa--;
+    const uint64 rest = (uint64(p1) << -one.e) + p2;
+    if (rest <= delta) {
+      inout_k += kappa;
+      GrisuRound(buffer, len, delta, rest, POW10[kappa] << -one.e, wp_w.f);
+      out_len = len;
+      return;
+    }
+  }
+
+  // Fractional part.
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    const char d = char(p2 >> -one.e);
+    if (d != 0 || len != 0) {
+      buffer[len++] = char('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      inout_k += kappa;
+      const int32 index = -kappa;
+      GrisuRound(buffer, len, delta, p2, one.f,
+                 wp_w.f * (index < 20 ? POW10[index] : 0));
+      out_len = len;
+      return;
+    }
+  }
+}
+
+/**
+ * Writes the shortest digit string of a positive, finite value into
+ * buffer; the value is buffer * 10^out_k.
+ */
+void Grisu2(double value, char* buffer, int32& out_len, int32& out_k) {
+  const DiyFp v(value);
+  DiyFp w_m, w_p;
+  v.NormalizedBoundaries(w_m, w_p);
+
+  const DiyFp c_mk = GetCachedPower(w_p.e, out_k);
+  const DiyFp w = v.Normalize() * c_mk;
+  DiyFp wp = w_p * c_mk;
+  DiyFp wm = w_m * c_mk;
+  wm.f++;
+  wp.f--;
+  DigitGen(w, wp, wp.f - wm.f, buffer, out_len, out_k);
+}
+
+char* WriteExponent(int32 k, char* buffer) {
+  if (k < 0) {
+    *buffer++ = '-';
+    k = -k;
+  }
+  if (k >= 100) {
+    *buffer++ = char('0' + k / 100);
+    k %= 100;
+    ::memcpy(buffer, &DIGIT_PAIRS[k * 2], 2);
+    buffer += 2;
+  } else if (k >= 10) {
+    ::memcpy(buffer, &DIGIT_PAIRS[k * 2], 2);
+    buffer += 2;
+  } else {
+    *buffer++ = char('0' + k);
+  }
+  return buffer;
+}
+
+/**
+ * Turns digits * 10^k into JavaScript style notation: plain decimals for
+ * exponents in [-7, 21), scientific notation otherwise.
+ */
+char* Prettify(char* buffer, int32 len, int32 k) {
+  // 10^(kk - 1) <= v < 10^kk
+  const int32 kk = len + k;
+
+  if (k >= 0 && kk <= 21) {
+    // 1234e7 -> 12340000000.0
+    for (int32 i = len; i < kk; ++i) {
+      buffer[i] = '0';
+    }
+    buffer[kk] = '.';
+    buffer[kk + 1] = '0';
+    return &buffer[kk + 2];
+  } else if (kk > 0 && kk <= 21) {
+    // 1234e-2 -> 12.34
+    ::memmove(&buffer[kk + 1], &buffer[kk], len - kk);
+    buffer[kk] = '.';
+    return &buffer[len + 1];
+  } else if (kk > -6 && kk <= 0) {
+    // 1234e-6 -> 0.001234
+    const int32 offset = 2 - kk;
+    ::memmove(&buffer[offset], &buffer[0], len);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (int32 i = 2; i < offset; ++i) {
+      buffer[i] = '0';
+    }
+    return &buffer[len + offset];
+  } else if (len == 1) {
+    // 1e30
+    buffer[1] = 'e';
+    return WriteExponent(kk - 1, &buffer[2]);
+  } else {
+    // 1234e30 -> 1.234e33
+    ::memmove(&buffer[2], &buffer[1], len - 1);
+    buffer[1] = '.';
+    buffer[len + 1] = 'e';
+    return WriteExponent(kk - 1, &buffer[len + 2]);
+  }
+}
+
+}  // namespace
+
+int32 FormatUnsignedInteger(uint64 value, char* buffer) {
+  char temp[MAX_INTEGER_CHARS];
+  char* cur = temp + MAX_INTEGER_CHARS;
+  while (value >= 100) {
+    const uint32 pair = uint32(value % 100) * 2;
+    value /= 100;
+    cur -= 2;
+    ::memcpy(cur, &DIGIT_PAIRS[pair], 2);
+  }
+  if (value >= 10) {
+    cur -= 2;
+    ::memcpy(cur, &DIGIT_PAIRS[value * 2], 2);
+  } else {
+    *--cur = char('0' + value);
+  }
+  const int32 len = int32(temp + MAX_INTEGER_CHARS - cur);
+  ::memcpy(buffer, cur, len);
+  return len;
+}
+
+int32 FormatInteger(int64 value, char* buffer) {
+  if (value < 0) {
+    buffer[0] = '-';
+    return 1 + FormatUnsignedInteger(0 - uint64(value), buffer + 1);
+  }
+  return FormatUnsignedInteger(uint64(value), buffer);
+}
+
+int32 FormatDouble(double value, char* buffer) {
+  if (std::isnan(value)) {
+    ::memcpy(buffer, "NaN", 3);
+    return 3;
+  }
+  if (std::isinf(value)) {
+    if (value < 0) {
+      ::memcpy(buffer, "-Infinity", 9);
+      return 9;
+    }
+    ::memcpy(buffer, "Infinity", 8);
+    return 8;
+  }
+
+  char* cur = buffer;
+  if (std::signbit(value)) {
+    *cur++ = '-';
+    value = -value;
+  }
+  if (value == 0.0) {
+    ::memcpy(cur, "0.0", 3);
+    return int32(cur + 3 - buffer);
+  }
+
+  int32 len;
+  int32 k;
+  Grisu2(value, cur, len, k);
+  return int32(Prettify(cur, len, k) - buffer);
+}
+
+}  // namespace json
+}  // namespace fun
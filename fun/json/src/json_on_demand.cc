@@ -0,0 +1,434 @@
+#include "fun/json/on_demand.h"
+
+#include <cstring>
+
+namespace fun {
+namespace json {
+
+//
+// OnDemandParser
+//
+
+OnDemandParser::OnDemandParser() : data_(nullptr), len_(0) {}
+
+bool OnDemandParser::Iterate(const char* data, int32 len) {
+  data_ = data;
+  len_ = len;
+  error_message_.Clear();
+
+  if (!index_.Build(data, len)) {
+    error_message_ = "unterminated string or control character in string";
+    return false;
+  }
+  if (index_.Count() == 0) {
+    error_message_ = "empty document";
+    return false;
+  }
+  return true;
+}
+
+JCursor OnDemandParser::GetRoot() const {
+  if (index_.Count() == 0) {
+    return JCursor();
+  }
+  return JCursor(this, 0);
+}
+
+int32 OnDemandParser::Skip(int32 pos) const {
+  const int32 count = index_.Count();
+  const char ch = CharAt(pos);
+  if (ch != '{' && ch != '[') {
+    return pos + 1;
+  }
+
+  // Strings are a single structural (their opening quote), so brackets
+  // inside them never show up here and plain depth counting works.
+  int32 depth = 1;
+  ++pos;
+  while (pos < count) {
+    switch (data_[index_[pos++]]) {
+      case '{':
+      case '[':
+        ++depth;
+        break;
+      case '}':
+      case ']':
+        if (--depth == 0) {
+          return pos;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  return -1;
+}
+
+//
+// JCursor
+//
+
+char JCursor::Peek() const {
+  return IsValid() ? parser_->CharAt(pos_) : '\0';
+}
+
+const char* JCursor::Begin() const {
+  return parser_->data_ + parser_->index_[pos_];
+}
+
+ValueType JCursor::GetType() const {
+  switch (Peek()) {
+    case '{':
+      return ValueType::Object;
+    case '[':
+      return ValueType::Array;
+    case '"':
+      return ValueType::String;
+    case 't':
+    case 'f':
+      return ValueType::Bool;
+    case 'n':
+    case '\0':
+      return ValueType::Null;
+    default: {
+      const char* end = parser_->data_ + parser_->len_;
+      for (const char* cur = Begin(); cur < end; ++cur) {
+        const char ch = *cur;
+        if (ch == '.' || ch == 'e' || ch == 'E') {
+          return ValueType::Double;
+        }
+        if (internal::IsScalarTerminator(ch)) {
+          break;
+        }
+      }
+      return ValueType::Integer;
+    }
+  }
+}
+
+bool JCursor::IsNull() const {
+  return Peek() == 'n' &&
+         internal::MatchLiteral(Begin(), parser_->data_ + parser_->len_,
+                                "null", 4);
+}
+
+bool JCursor::GetBool(bool& out_value) const {
+  const char* end = parser_ ? parser_->data_ + parser_->len_ : nullptr;
+  switch (Peek()) {
+    case 't':
+      if (internal::MatchLiteral(Begin(), end, "true", 4)) {
+        out_value = true;
+        return true;
+      }
+      return false;
+    case 'f':
+      if (internal::MatchLiteral(Begin(), end, "false", 5)) {
+        out_value = false;
+        return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+bool JCursor::DecodeNumber(internal::NumberValue& out_value) const {
+  const char ch = Peek();
+  if (ch != '-' && (ch < '0' || ch > '9')) {
+    return false;
+  }
+  const char* number_end = nullptr;
+  return internal::ParseNumber(Begin(), parser_->data_ + parser_->len_,
+                               out_value, number_end);
+}
+
+bool JCursor::GetInteger(int64& out_value) const {
+  internal::NumberValue number;
+  if (!DecodeNumber(number) || number.type != ValueType::Integer) {
+    return false;
+  }
+  out_value = number.integer_value;
+  return true;
+}
+
+bool JCursor::GetUnsignedInteger(uint64& out_value) const {
+  internal::NumberValue number;
+  if (!DecodeNumber(number)) {
+    return false;
+  }
+  if (number.type == ValueType::UnsignedInteger) {
+    out_value = number.unsigned_integer_value;
+    return true;
+  }
+  if (number.type == ValueType::Integer && number.integer_value >= 0) {
+    out_value = (uint64)number.integer_value;
+    return true;
+  }
+  return false;
+}
+
+bool JCursor::GetDouble(double& out_value) const {
+  internal::NumberValue number;
+  if (!DecodeNumber(number)) {
+    return false;
+  }
+  switch (number.type) {
+    case ValueType::Integer:
+      out_value = (double)number.integer_value;
+      return true;
+    case ValueType::UnsignedInteger:
+      out_value = (double)number.unsigned_integer_value;
+      return true;
+    default:
+      out_value = number.double_value;
+      return true;
+  }
+}
+
+bool JCursor::GetRawString(StringView& out_value,
+                           bool& out_has_escapes) const {
+  if (Peek() != '"') {
+    return false;
+  }
+  const char* body = Begin() + 1;
+  const char* close = internal::FindStringEnd(
+      body, parser_->data_ + parser_->len_, out_has_escapes);
+  if (close == nullptr) {
+    return false;
+  }
+  out_value = StringView(body, int32(close - body));
+  return true;
+}
+
+bool JCursor::GetString(String& out_value) const {
+  StringView raw;
+  bool has_escapes;
+  if (!GetRawString(raw, has_escapes)) {
+    return false;
+  }
+  if (!has_escapes) {
+    out_value = String(raw);
+    return true;
+  }
+
+  out_value.ResizeUninitialized(raw.Len());
+  const char* end_of_string = nullptr;
+  const int32 decoded_len =
+      internal::UnescapeString(raw.ConstData(), raw.ConstData() + raw.Len() + 1,
+                               out_value.MutableData(), end_of_string);
+  if (decoded_len < 0) {
+    return false;
+  }
+  out_value.Truncate(decoded_len);
+  return true;
+}
+
+bool JCursor::Find(const StringView& field_name, JCursor& out_value) const {
+  JObjectCursor members(*this);
+  StringView name;
+  JCursor value;
+  while (members.Next(name, value)) {
+    if (name == field_name) {
+      out_value = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+JCursor JCursor::operator[](const StringView& field_name) const {
+  JCursor value;
+  Find(field_name, value);
+  return value;
+}
+
+int32 JCursor::Count() const {
+  int32 count = 0;
+  if (Peek() == '[') {
+    JArrayCursor elements(*this);
+    JCursor element;
+    while (elements.Next(element)) {
+      ++count;
+    }
+  } else if (Peek() == '{') {
+    JObjectCursor members(*this);
+    StringView name;
+    JCursor value;
+    while (members.Next(name, value)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+bool JCursor::ToJValue(JValue& out_value) const {
+  switch (GetType()) {
+    case ValueType::Object: {
+      out_value.SetObject();
+      JObjectCursor members(*this);
+      StringView raw_name;
+      JCursor value;
+      while (members.Next(raw_name, value)) {
+        // Decode the key through a cursor so escapes are handled.
+        JCursor key(parser_, value.pos_ - 2);
+        String name;
+        if (!key.GetString(name) ||
+            !value.ToJValue(out_value[name])) {
+          return false;
+        }
+      }
+      return members.Good();
+    }
+    case ValueType::Array: {
+      out_value.SetArray();
+      JArrayCursor elements(*this);
+      JCursor element;
+      while (elements.Next(element)) {
+        out_value.Append();
+        if (!element.ToJValue(out_value[out_value.Count() - 1])) {
+          return false;
+        }
+      }
+      return elements.Good();
+    }
+    case ValueType::String: {
+      String str;
+      if (!GetString(str)) {
+        return false;
+      }
+      out_value.SetString(str);
+      return true;
+    }
+    case ValueType::Bool: {
+      bool flag;
+      if (!GetBool(flag)) {
+        return false;
+      }
+      out_value.SetBool(flag);
+      return true;
+    }
+    case ValueType::Null:
+      if (!IsNull()) {
+        return false;
+      }
+      out_value.SetNull();
+      return true;
+    default: {
+      internal::NumberValue number;
+      if (!DecodeNumber(number)) {
+        return false;
+      }
+      if (number.type == ValueType::Integer) {
+        out_value.SetInteger(number.integer_value);
+      } else if (number.type == ValueType::UnsignedInteger) {
+        out_value.SetUnsignedInteger(number.unsigned_integer_value);
+      } else {
+        out_value.SetDouble(number.double_value);
+      }
+      return true;
+    }
+  }
+}
+
+//
+// JArrayCursor
+//
+
+JArrayCursor::JArrayCursor(const JCursor& array)
+    : parser_(array.parser_), pos_(array.pos_), first_(true), good_(true) {
+  if (array.Peek() != '[') {
+    good_ = false;
+    parser_ = nullptr;
+  }
+}
+
+bool JArrayCursor::Next(JCursor& out_element) {
+  if (parser_ == nullptr) {
+    return false;
+  }
+
+  int32 pos;
+  if (first_) {
+    first_ = false;
+    pos = pos_ + 1;
+    if (parser_->CharAt(pos) == ']') {
+      parser_ = nullptr;
+      return false;
+    }
+  } else {
+    // pos_ is the last element; step over it and its separator.
+    pos = parser_->Skip(pos_);
+    const char separator = pos < 0 ? '\0' : parser_->CharAt(pos);
+    if (separator == ']') {
+      parser_ = nullptr;
+      return false;
+    }
+    if (separator != ',') {
+      good_ = false;
+      parser_ = nullptr;
+      return false;
+    }
+    ++pos;
+  }
+
+  pos_ = pos;
+  out_element = JCursor(parser_, pos);
+  return true;
+}
+
+//
+// JObjectCursor
+//
+
+JObjectCursor::JObjectCursor(const JCursor& object)
+    : parser_(object.parser_), pos_(object.pos_), first_(true), good_(true) {
+  if (object.Peek() != '{') {
+    good_ = false;
+    parser_ = nullptr;
+  }
+}
+
+bool JObjectCursor::Next(StringView& out_raw_name, JCursor& out_value) {
+  if (parser_ == nullptr) {
+    return false;
+  }
+
+  int32 pos;
+  if (first_) {
+    first_ = false;
+    pos = pos_ + 1;
+    if (parser_->CharAt(pos) == '}') {
+      parser_ = nullptr;
+      return false;
+    }
+  } else {
+    // pos_ is the last value; step over it and its separator.
+    pos = parser_->Skip(pos_);
+    const char separator = pos < 0 ? '\0' : parser_->CharAt(pos);
+    if (separator == '}') {
+      parser_ = nullptr;
+      return false;
+    }
+    if (separator != ',') {
+      good_ = false;
+      parser_ = nullptr;
+      return false;
+    }
+    ++pos;
+  }
+
+  bool has_escapes;
+  if (!JCursor(parser_, pos).GetRawString(out_raw_name, has_escapes) ||
+      parser_->CharAt(pos + 1) != ':') {
+    good_ = false;
+    parser_ = nullptr;
+    return false;
+  }
+
+  pos_ = pos + 2;
+  out_value = JCursor(parser_, pos_);
+  return true;
+}
+
+}  // namespace json
+}  // namespace fun
@@ -0,0 +1,258 @@
+#include "fun/json/scalar_parser_internal.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace fun {
+namespace json {
+namespace internal {
+
+namespace {
+
+FUN_ALWAYS_INLINE bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+FUN_ALWAYS_INLINE int32 HexValue(char ch) {
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+  return -1;
+}
+
+bool ReadHex4(const char* cur, const char* end, uint32& out_code) {
+  if (end - cur < 4) {
+    return false;
+  }
+  uint32 code = 0;
+  for (int32 i = 0; i < 4; ++i) {
+    const int32 digit = HexValue(cur[i]);
+    if (digit < 0) {
+      return false;
+    }
+    code = (code << 4) | (uint32)digit;
+  }
+  out_code = code;
+  return true;
+}
+
+FUN_ALWAYS_INLINE int32 EncodeUtf8(uint32 code, char* dst) {
+  if (code < 0x80) {
+    dst[0] = (char)code;
+    return 1;
+  } else if (code < 0x800) {
+    dst[0] = (char)(0xC0 | (code >> 6));
+    dst[1] = (char)(0x80 | (code & 0x3F));
+    return 2;
+  } else if (code < 0x10000) {
+    dst[0] = (char)(0xE0 | (code >> 12));
+    dst[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    dst[2] = (char)(0x80 | (code & 0x3F));
+    return 3;
+  } else {
+    dst[0] = (char)(0xF0 | (code >> 18));
+    dst[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+  }
+}
+
+}  // namespace
+
+bool ParseNumber(const char* cur, const char* end, NumberValue& out_value,
+                 const char*& out_end) {
+  const char* start = cur;
+  const bool negative = cur < end && *cur == '-';
+  if (negative) {
+    ++cur;
+  }
+
+  if (cur == end || !IsDigit(*cur)) {
+    return false;
+  }
+
+  // Integer part. A leading zero must not be followed by more digits.
+  uint64 mantissa = 0;
+  bool overflow = false;
+  if (*cur == '0') {
+    ++cur;
+    if (cur < end && IsDigit(*cur)) {
+      return false;
+    }
+  } else {
+    while (cur < end && IsDigit(*cur)) {
+      const uint64 digit = (uint64)(*cur - '0');
+      if (mantissa > (UINT64_MAX - digit) / 10) {
+        overflow = true;
+      }
+      mantissa = mantissa * 10 + digit;
+      ++cur;
+    }
+  }
+
+  bool is_integral = true;
+  if (cur < end && *cur == '.') {
+    is_integral = false;
+    ++cur;
+    if (cur == end || !IsDigit(*cur)) {
+      return false;
+    }
+    while (cur < end && IsDigit(*cur)) {
+      ++cur;
+    }
+  }
+
+  if (cur < end && (*cur == 'e' || *cur == 'E')) {
+    is_integral = false;
+    ++cur;
+    if (cur < end && (*cur == '+' || *cur == '-')) {
+      ++cur;
+    }
+    if (cur == end || !IsDigit(*cur)) {
+      return false;
+    }
+    while (cur < end && IsDigit(*cur)) {
+      ++cur;
+    }
+  }
+
+  if (cur < end && !IsScalarTerminator(*cur)) {
+    return false;
+  }
+  out_end = cur;
+
+  if (is_integral && !overflow) {
+    if (negative) {
+      if (mantissa <= (uint64)INT64_MAX + 1) {
+        out_value.type = ValueType::Integer;
+        out_value.integer_value = (int64)(0 - mantissa);
+        return true;
+      }
+    } else if (mantissa <= (uint64)INT64_MAX) {
+      out_value.type = ValueType::Integer;
+      out_value.integer_value = (int64)mantissa;
+      return true;
+    } else {
+      out_value.type = ValueType::UnsignedInteger;
+      out_value.unsigned_integer_value = mantissa;
+      return true;
+    }
+  }
+
+  // Slow path: fractions, exponents and out-of-range integers.
+  const int32 len = int32(cur - start);
+  char stack_buffer[64];
+  String heap_buffer;
+  char* buffer = stack_buffer;
+  if (len >= (int32)sizeof(stack_buffer)) {
+    heap_buffer = String(start, len);
+    buffer = heap_buffer.MutableData();
+  } else {
+    ::memcpy(stack_buffer, start, len);
+    stack_buffer[len] = '\0';
+  }
+
+  char* parsed_end = nullptr;
+  out_value.type = ValueType::Double;
+  out_value.double_value = ::strtod(buffer, &parsed_end);
+  return parsed_end == buffer + len;
+}
+
+const char* FindStringEnd(const char* cur, const char* end,
+                          bool& out_has_escapes) {
+  out_has_escapes = false;
+  while (cur < end) {
+    const char* hit = (const char*)::memchr(cur, '"', end - cur);
+    if (hit == nullptr) {
+      return nullptr;
+    }
+
+    // Count the backslashes right before the quote; an odd run escapes it.
+    const char* back = hit;
+    while (back > cur && back[-1] == '\\') {
+      --back;
+    }
+    if (!out_has_escapes && ::memchr(cur, '\\', hit - cur) != nullptr) {
+      out_has_escapes = true;
+    }
+    if (((hit - back) & 1) == 0) {
+      return hit;
+    }
+    cur = hit + 1;
+  }
+  return nullptr;
+}
+
+int32 UnescapeString(const char* cur, const char* end, char* dst,
+                     const char*& out_end) {
+  char* out = dst;
+  while (cur < end) {
+    // Copy the run up to the next quote or backslash in one go.
+    const char* run = cur;
+    while (cur < end && *cur != '"' && *cur != '\\') {
+      ++cur;
+    }
+    if (cur > run) {
+      ::memcpy(out, run, cur - run);
+      out += cur - run;
+    }
+    if (cur == end) {
+      return -1;
+    }
+
+    if (*cur == '"') {
+      out_end = cur + 1;
+      return int32(out - dst);
+    }
+
+    // Escape sequence.
+    if (++cur == end) {
+      return -1;
+    }
+    switch (*cur++) {
+      case '"': *out++ = '"'; break;
+      case '\\': *out++ = '\\'; break;
+      case '/': *out++ = '/'; break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'u': {
+        uint32 code;
+        if (!ReadHex4(cur, end, code)) {
+          return -1;
+        }
+        cur += 4;
+        if (code >= 0xD800 && code <= 0xDBFF) {
+          // High surrogate, must be followed by an escaped low surrogate.
+          uint32 low;
+          if (end - cur < 6 || cur[0] != '\\' || cur[1] != 'u' ||
+              !ReadHex4(cur + 2, end, low) || low < 0xDC00 || low > 0xDFFF) {
+            return -1;
+          }
+          cur += 6;
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        } else if (code >= 0xDC00 && code <= 0xDFFF) {
+          return -1;
+        }
+        out += EncodeUtf8(code, out);
+        break;
+      }
+      default:
+        return -1;
+    }
+  }
+  return -1;
+}
+
+bool MatchLiteral(const char* cur, const char* end, const char* literal,
+                  int32 literal_len) {
+  if (end - cur < literal_len || ::memcmp(cur, literal, literal_len) != 0) {
+    return false;
+  }
+  return cur + literal_len == end || IsScalarTerminator(cur[literal_len]);
+}
+
+}  // namespace internal
+}  // namespace json
+}  // namespace fun
@@ -0,0 +1,44 @@
+#include "fun/json/stream_writer.h"
+
+namespace fun {
+namespace json {
+namespace internal {
+
+const char JSON_ESCAPE_TABLE[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',  // 00
+    'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',  // 08
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',  // 10
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',  // 18
+    0, 0, '"', 0, 0, 0, 0, 0,  // 20
+    0, 0, 0, 0, 0, 0, 0, 0,  // 28
+    0, 0, 0, 0, 0, 0, 0, 0,  // 30
+    0, 0, 0, 0, 0, 0, 0, 0,  // 38
+    0, 0, 0, 0, 0, 0, 0, 0,  // 40
+    0, 0, 0, 0, 0, 0, 0, 0,  // 48
+    0, 0, 0, 0, 0, 0, 0, 0,  // 50
+    0, 0, 0, 0, '\\', 0, 0, 0,  // 58
+    0, 0, 0, 0, 0, 0, 0, 0,  // 60
+    0, 0, 0, 0, 0, 0, 0, 0,  // 68
+    0, 0, 0, 0, 0, 0, 0, 0,  // 70
+    0, 0, 0, 0, 0, 0, 0, 0,  // 78
+    0, 0, 0, 0, 0, 0, 0, 0,  // 80
+    0, 0, 0, 0, 0, 0, 0, 0,  // 88
+    0, 0, 0, 0, 0, 0, 0, 0,  // 90
+    0, 0, 0, 0, 0, 0, 0, 0,  // 98
+    0, 0, 0, 0, 0, 0, 0, 0,  // A0
+    0, 0, 0, 0, 0, 0, 0, 0,  // A8
+    0, 0, 0, 0, 0, 0, 0, 0,  // B0
+    0, 0, 0, 0, 0, 0, 0, 0,  // B8
+    0, 0, 0, 0, 0, 0, 0, 0,  // C0
+    0, 0, 0, 0, 0, 0, 0, 0,  // C8
+    0, 0, 0, 0, 0, 0, 0, 0,  // D0
+    0, 0, 0, 0, 0, 0, 0, 0,  // D8
+    0, 0, 0, 0, 0, 0, 0, 0,  // E0
+    0, 0, 0, 0, 0, 0, 0, 0,  // E8
+    0, 0, 0, 0, 0, 0, 0, 0,  // F0
+    0, 0, 0, 0, 0, 0, 0, 0,  // F8
+};
+
+}  // namespace internal
+}  // namespace json
+}  // namespace fun
@@ -0,0 +1,389 @@
+#include "fun/json/structural_index.h"
+
+#include <cstring>
+
+#if FUN_ARCH == FUN_ARCH_AMD64 || FUN_ARCH == FUN_ARCH_IA32
+#define FUN_JSON_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define FUN_JSON_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FUN_JSON_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FUN_JSON_TARGET(isa)
+#endif
+
+namespace fun {
+namespace json {
+
+namespace {
+
+/**
+ * Per-block character classes, one bit per input byte.
+ */
+struct BlockMasks {
+  uint64 op;         // { } [ ] : ,
+  uint64 ws;         // space, \t, \n, \r
+  uint64 quote;      // "
+  uint64 backslash;  // '\'
+  uint64 control;    // < 0x20
+};
+
+FUN_ALWAYS_INLINE uint32 CountTrailingZeros64(uint64 x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return (uint32)index;
+#else
+  return (uint32)__builtin_ctzll(x);
+#endif
+}
+
+/**
+ * Bit i of the result is the xor of bits 0..i of x, which turns the
+ * quote mask into an "inside a string" mask.
+ */
+FUN_ALWAYS_INLINE uint64 PrefixXor(uint64 x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/**
+ * Returns the mask of characters escaped by an odd-length run of
+ * backslashes. prev_escaped carries a pending escape into the next
+ * block.
+ */
+FUN_ALWAYS_INLINE uint64 FindEscaped(uint64 backslash, uint64& prev_escaped) {
+  const uint64 EVEN_BITS = 0x5555555555555555ULL;
+
+  backslash &= ~prev_escaped;
+  const uint64 follows_escape = (backslash << 1) | prev_escaped;
+  const uint64 odd_sequence_starts = backslash & ~EVEN_BITS & ~follows_escape;
+  const uint64 sequences_starting_on_even_bits =
+      odd_sequence_starts + backslash;
+  prev_escaped = sequences_starting_on_even_bits < odd_sequence_starts;
+  const uint64 invert_mask = sequences_starting_on_even_bits << 1;
+  return (EVEN_BITS ^ invert_mask) & follows_escape;
+}
+
+/**
+ * Lookup table for the scalar classifier.
+ */
+struct CharClassTable {
+  enum { OP = 1, WS = 2, QUOTE = 4, BACKSLASH = 8, CONTROL = 16 };
+
+  uint8 classes[256];
+
+  CharClassTable() {
+    ::memset(classes, 0, sizeof(classes));
+    for (int32 ch = 0; ch < 0x20; ++ch) {
+      classes[ch] = CONTROL;
+    }
+    classes[(uint8)'{'] = classes[(uint8)'}'] = OP;
+    classes[(uint8)'['] = classes[(uint8)']'] = OP;
+    classes[(uint8)':'] = classes[(uint8)','] = OP;
+    classes[(uint8)' '] = WS;
+    classes[(uint8)'\t'] |= WS;
+    classes[(uint8)'\n'] |= WS;
+    classes[(uint8)'\r'] |= WS;
+    classes[(uint8)'"'] = QUOTE;
+    classes[(uint8)'\\'] = BACKSLASH;
+  }
+};
+
+const CharClassTable g_char_classes;
+
+struct ScalarClassifier {
+  static FUN_ALWAYS_INLINE void Classify(const uint8* block, BlockMasks& m) {
+    m.op = m.ws = m.quote = m.backslash = m.control = 0;
+    for (int32 i = 0; i < 64; ++i) {
+      const uint64 bit = 1ULL << i;
+      const uint8 cls = g_char_classes.classes[block[i]];
+      if (cls == 0) {
+        continue;
+      }
+      if (cls & CharClassTable::OP) m.op |= bit;
+      if (cls & CharClassTable::WS) m.ws |= bit;
+      if (cls & CharClassTable::QUOTE) m.quote |= bit;
+      if (cls & CharClassTable::BACKSLASH) m.backslash |= bit;
+      if (cls & CharClassTable::CONTROL) m.control |= bit;
+    }
+  }
+};
+
+#if FUN_JSON_X86
+
+/**
+ * Uses PCMPESTRM to match each 16-byte lane against the structural and
+ * whitespace character sets in one instruction each.
+ */
+struct Sse42Classifier {
+  static FUN_JSON_TARGET("sse4.2") void Classify(
+      const uint8* block, BlockMasks& m) {
+    const __m128i op_set = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+    const __m128i ws_set = _mm_setr_epi8(' ', '\t', '\n', '\r', 0, 0, 0, 0, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+    const int MODE = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+
+    m.op = m.ws = m.quote = m.backslash = m.control = 0;
+    for (int32 i = 0; i < 4; ++i) {
+      const __m128i chunk =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 16));
+      const int32 shift = i * 16;
+      m.op |= uint64((uint32)_mm_cvtsi128_si32(
+                  _mm_cmpestrm(op_set, 6, chunk, 16, MODE)) & 0xFFFF)
+              << shift;
+      m.ws |= uint64((uint32)_mm_cvtsi128_si32(
+                  _mm_cmpestrm(ws_set, 4, chunk, 16, MODE)) & 0xFFFF)
+              << shift;
+      m.quote |= uint64((uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)))
+                 << shift;
+      m.backslash |=
+          uint64((uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)))
+          << shift;
+      m.control |= uint64((uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                       _mm_min_epu8(chunk, control_max), chunk)))
+                   << shift;
+    }
+  }
+};
+
+struct Avx2Classifier {
+  static FUN_JSON_TARGET("avx2") uint64
+      Movemask(__m256i lo, __m256i hi) {
+    return uint64((uint32)_mm256_movemask_epi8(lo)) |
+           (uint64((uint32)_mm256_movemask_epi8(hi)) << 32);
+  }
+
+  static FUN_JSON_TARGET("avx2") __m256i
+      MatchOp(__m256i chunk) {
+    __m256i r = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('{'));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('}')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('[')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(']')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(':')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(',')));
+    return r;
+  }
+
+  static FUN_JSON_TARGET("avx2") __m256i
+      MatchWs(__m256i chunk) {
+    __m256i r = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\t')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+    r = _mm256_or_si256(r, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\r')));
+    return r;
+  }
+
+  static FUN_JSON_TARGET("avx2") void Classify(
+      const uint8* block, BlockMasks& m) {
+    const __m256i lo =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i hi =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control_max = _mm256_set1_epi8(0x1F);
+
+    m.op = Movemask(MatchOp(lo), MatchOp(hi));
+    m.ws = Movemask(MatchWs(lo), MatchWs(hi));
+    m.quote = Movemask(_mm256_cmpeq_epi8(lo, quote),
+                       _mm256_cmpeq_epi8(hi, quote));
+    m.backslash = Movemask(_mm256_cmpeq_epi8(lo, backslash),
+                           _mm256_cmpeq_epi8(hi, backslash));
+    m.control = Movemask(
+        _mm256_cmpeq_epi8(_mm256_min_epu8(lo, control_max), lo),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(hi, control_max), hi));
+  }
+};
+
+#endif  // FUN_JSON_X86
+
+/**
+ * The block loop shared by all implementations. Only the classifier
+ * differs; the string/escape logic is plain 64-bit arithmetic.
+ */
+template <typename Classifier>
+FUN_ALWAYS_INLINE int32 IndexBlocks(const uint8* data, int32 len,
+                                    uint32* out, int32& out_count) {
+  uint64 prev_escaped = 0;
+  uint64 prev_in_string = 0;
+  uint64 prev_scalar = 0;
+  uint32* tail = out;
+  uint8 padded[64];
+
+  for (int32 base = 0; base < len; base += 64) {
+    const uint8* block = data + base;
+    if (len - base < 64) {
+      // Pad the tail with whitespace, which never produces structurals.
+      ::memset(padded, ' ', sizeof(padded));
+      ::memcpy(padded, block, len - base);
+      block = padded;
+    }
+
+    BlockMasks m;
+    Classifier::Classify(block, m);
+
+    const uint64 escaped = FindEscaped(m.backslash, prev_escaped);
+    const uint64 quote = m.quote & ~escaped;
+    const uint64 in_string = PrefixXor(quote) ^ prev_in_string;
+    prev_in_string = uint64(int64(in_string) >> 63);
+
+    const uint64 bad_control = m.control & in_string;
+    if (bad_control) {
+      out_count = int32(tail - out);
+      return base + (int32)CountTrailingZeros64(bad_control);
+    }
+
+    const uint64 scalar = ~(m.op | m.ws);
+    const uint64 nonquote_scalar = scalar & ~quote;
+    const uint64 follows_scalar = (nonquote_scalar << 1) | prev_scalar;
+    prev_scalar = nonquote_scalar >> 63;
+
+    // Everything inside a string except its opening quote.
+    const uint64 string_tail = in_string ^ quote;
+    uint64 structurals = (m.op | (scalar & ~follows_scalar)) & ~string_tail;
+
+    while (structurals) {
+      *tail++ = uint32(base) + CountTrailingZeros64(structurals);
+      structurals &= structurals - 1;
+    }
+  }
+
+  out_count = int32(tail - out);
+  return prev_in_string ? len : -1;
+}
+
+int32 IndexScalar(const uint8* data, int32 len, uint32* out,
+                  int32& out_count) {
+  return IndexBlocks<ScalarClassifier>(data, len, out, out_count);
+}
+
+#if FUN_JSON_X86
+
+FUN_JSON_TARGET("sse4.2")
+int32 IndexSse42(const uint8* data, int32 len, uint32* out,
+                 int32& out_count) {
+  return IndexBlocks<Sse42Classifier>(data, len, out, out_count);
+}
+
+FUN_JSON_TARGET("avx2")
+int32 IndexAvx2(const uint8* data, int32 len, uint32* out, int32& out_count) {
+  return IndexBlocks<Avx2Classifier>(data, len, out, out_count);
+}
+
+void CpuId(int32 leaf, int32 subleaf, uint32 regs[4]) {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuidex(info, leaf, subleaf);
+  for (int32 i = 0; i < 4; ++i) {
+    regs[i] = (uint32)info[i];
+  }
+#else
+  __asm__ __volatile__("cpuid"
+                       : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]),
+                         "=d"(regs[3])
+                       : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+bool OsSavesYmmState() {
+#if defined(_MSC_VER)
+  return (_xgetbv(0) & 0x6) == 0x6;
+#else
+  uint32 eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (eax & 0x6) == 0x6;
+#endif
+}
+
+#endif  // FUN_JSON_X86
+
+StructuralIndex::Implementation DetectImplementation() {
+#if FUN_JSON_X86
+  uint32 regs[4];
+  CpuId(0, 0, regs);
+  const uint32 max_leaf = regs[0];
+
+  CpuId(1, 0, regs);
+  const bool has_sse42 = (regs[2] & (1u << 20)) != 0;
+  const bool has_osxsave = (regs[2] & (1u << 27)) != 0;
+
+  if (max_leaf >= 7 && has_osxsave && OsSavesYmmState()) {
+    CpuId(7, 0, regs);
+    if (regs[1] & (1u << 5)) {
+      return StructuralIndex::Implementation::Avx2;
+    }
+  }
+  if (has_sse42) {
+    return StructuralIndex::Implementation::Sse42;
+  }
+#endif
+  return StructuralIndex::Implementation::Scalar;
+}
+
+typedef int32 (*IndexFunction)(const uint8*, int32, uint32*, int32&);
+
+IndexFunction SelectIndexFunction() {
+#if FUN_JSON_X86
+  switch (StructuralIndex::GetImplementation()) {
+    case StructuralIndex::Implementation::Avx2:
+      return &IndexAvx2;
+    case StructuralIndex::Implementation::Sse42:
+      return &IndexSse42;
+    default:
+      break;
+  }
+#endif
+  return &IndexScalar;
+}
+
+}  // namespace
+
+StructuralIndex::StructuralIndex() : error_offset_(-1) {}
+
+StructuralIndex::Implementation StructuralIndex::GetImplementation() {
+  static const Implementation implementation = DetectImplementation();
+  return implementation;
+}
+
+const char* StructuralIndex::GetImplementationName() {
+  switch (GetImplementation()) {
+    case Implementation::Avx2:
+      return "avx2";
+    case Implementation::Sse42:
+      return "sse4.2";
+    default:
+      return "scalar";
+  }
+}
+
+bool StructuralIndex::Build(const char* data, int32 len) {
+  static const IndexFunction index_function = SelectIndexFunction();
+
+  // Every byte could be a structural in the worst case.
+  indices_.ResizeUninitialized(len + 1);
+
+  int32 count = 0;
+  error_offset_ = index_function(reinterpret_cast<const uint8*>(data), len,
+                                 indices_.MutableData(), count);
+  indices_.ResizeUninitialized(count);
+  return error_offset_ < 0;
+}
+
+}  // namespace json
+}  // namespace fun
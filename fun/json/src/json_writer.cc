@@ -1,4 +1,5 @@
 ﻿#include "fun/json/writer.h"
+#include "fun/json/number_format.h"
 
 namespace fun {
 namespace json {
@@ -123,76 +124,14 @@ void CondensedWriter::DropNullPlaceholders() { drop_null_placeholders_ = true; }
 void CondensedWriter::OmitEndingLineFeed() { omit_ending_linefeed_ = true; }
 
 String CondensedWriter::Write(const JValue& root) {
-  document_ = AsciiString("");
-  WriteValue(root);
-  if (!omit_ending_linefeed_) {
-    document_ += AsciiString("\n");
-  }
-  return document_;
+  String document;
+  Write(root, document);
+  return document;
 }
 
-void CondensedWriter::WriteValue(const JValue& value) {
-  switch (value.GetType()) {
-    case ValueType::Null:
-      if (!drop_null_placeholders_) {
-        document_ += AsciiString("null");
-      }
-      break;
-
-    case ValueType::Integer:
-      document_ += String::FromNumber(value.integer_value_);
-      break;
-
-    case ValueType::UnsignedInteger:
-      document_ += String::FromNumber(value.unsigned_integer_value_);
-      break;
-
-    case ValueType::Double:
-      document_ += String::FromNumber(value.double_value_);  // TODO 정밀도
-                                                             // 지정.
-      break;
-
-    case ValueType::String:
-      document_ += ValueToQuotedStringN(**value.string_value_,
-                                        value.string_value_->Len());
-      break;
-
-    case ValueType::Bool:
-      document_ +=
-          value.bool_value_ ? AsciiString("true") : AsciiString("false");
-      break;
-
-    case ValueType::Array: {
-      document_ += AsciiString("[");
-
-      const int32 n = value.Count();
-      for (int32 i = 0; i < n; ++i) {
-        if (i > 0) {
-          document_ += AsciiString(",");
-        }
-        WriteValue(value[i]);
-      }
-
-      document_ += AsciiString("]");
-      break;
-    }
-
-    case ValueType::Object: {
-      document_ += AsciiString("{");
-      int32 count = 0;
-      for (const auto& pair : *value.object_value_) {
-        if (++count != 1) {
-          document_ += AsciiString(",");
-        }
-        document_ += ValueToQuotedString(*pair.Key);
-        document_ +=
-            yaml_compatibility_enabled_ ? AsciiString(": ") : AsciiString(":");
-        WriteValue(pair.value);
-      }
-      document_ += AsciiString('}');
-      break;
-    }
-  }
+void CondensedWriter::Write(const JValue& root, String& out_document) {
+  StringOutput output(out_document);
+  Write(root, output);
 }
 
 //
@@ -219,17 +158,24 @@ void PrettyWriter::WriteValue(const JValue& value) {
       PushValue(AsciiString("null"));
       break;
 
-    case ValueType::Integer:
-      PushValue(String::FromNumber(value.integer_value_));
+    case ValueType::Integer: {
+      char buffer[MAX_INTEGER_CHARS];
+      PushValue(String(buffer, FormatInteger(value.integer_value_, buffer)));
       break;
+    }
 
-    case ValueType::UnsignedInteger:
-      PushValue(String::FromNumber(value.unsigned_integer_value_));
+    case ValueType::UnsignedInteger: {
+      char buffer[MAX_INTEGER_CHARS];
+      PushValue(String(
+          buffer, FormatUnsignedInteger(value.unsigned_integer_value_, buffer)));
       break;
+    }
 
-    case ValueType::Double:
-      PushValue(String::FromNumber(value.double_value_));  // TODO 정밀도..
+    case ValueType::Double: {
+      char buffer[MAX_DOUBLE_CHARS];
+      PushValue(String(buffer, FormatDouble(value.double_value_, buffer)));
       break;
+    }
 
     case ValueType::String:
       PushValue(ValueToQuotedStringN(**value.string_value_,
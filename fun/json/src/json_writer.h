@@ -2,7 +2,9 @@
 
 #pragma once
 
+#include "fun/json/arena_value.h"
 #include "fun/json/json.h"
+#include "fun/json/stream_writer.h"
 #include "fun/json/value.h"
 
 namespace fun {
@@ -26,10 +28,41 @@ class FUN_JSON_API CondensedWriter : public IWriter {
   // IWriter interface
   String Write(const JValue& root) override;
 
+  /**
+   * Appends the document to out_document.
+   */
+  void Write(const JValue& root, String& out_document);
+
+  /**
+   * Streams the document into output, e.g. a net::Buffer or a
+   * FixedBufferOutput, without building an intermediate String.
+   */
+  template <typename Output>
+  void Write(const JValue& root, Output& output) {
+    WriteTo(root, output);
+  }
+
+  template <typename Output>
+  void Write(const JArenaValue& root, Output& output) {
+    WriteTo(root, output);
+  }
+
  private:
-  void WriteValue(const JValue& value);
+  template <typename Value, typename Output>
+  void WriteTo(const Value& root, Output& output) {
+    StreamWriter<Output> writer(output);
+    if (yaml_compatibility_enabled_) {
+      writer.EnableYAMLCompatibility();
+    }
+    if (drop_null_placeholders_) {
+      writer.DropNullPlaceholders();
+    }
+    writer.Write(root);
+    if (!omit_ending_linefeed_) {
+      writer.WriteRaw("\n", 1);
+    }
+  }
 
-  String document_;
   bool yaml_compatibility_enabled_;
   bool drop_null_placeholders_;
   bool omit_ending_linefeed_;
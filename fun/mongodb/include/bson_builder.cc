@@ -0,0 +1,180 @@
+﻿#include "fun/mongodb/bson_builder.h"
+
+#include <cstring>
+
+namespace fun {
+namespace mongodb {
+
+BsonBuilder::BsonBuilder(int32 initial_capacity)
+    : buffer_(initial_capacity) {
+  Reset();
+}
+
+void BsonBuilder::Reset() {
+  buffer_.SetLength(0);
+  levels_.clear();
+
+  Level root = {0, 0};
+  levels_.push_back(root);
+  WriteInt32(0);  // size, written by Close()
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name, double value) {
+  WriteName(BsonView::BSON_DOUBLE, name);
+  uint64 bits;
+  ::memcpy(&bits, &value, sizeof(bits));
+  WriteInt64((int64)bits);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name, int32 value) {
+  WriteName(BsonView::BSON_INT32, name);
+  WriteInt32(value);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name, int64 value) {
+  WriteName(BsonView::BSON_INT64, name);
+  WriteInt64(value);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name, bool value) {
+  WriteName(BsonView::BSON_BOOL, name);
+  buffer_.WriteFixed8(value ? 1 : 0);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name,
+                                 const StringView& value) {
+  WriteName(BsonView::BSON_STRING, name);
+  WriteInt32(value.Len() + 1);
+  buffer_.WriteRawBytes(value.ConstData(), value.Len());
+  buffer_.WriteFixed8(0x00);  // null-terminator
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Append(const StringView& name,
+                                 const BsonView& document, bool is_array) {
+  if (!document.IsValid()) {
+    throw InvalidArgumentException("BsonBuilder: invalid document");
+  }
+  WriteName(is_array ? BsonView::BSON_ARRAY : BsonView::BSON_DOCUMENT, name);
+  buffer_.WriteRawBytes(document.ConstData(), document.GetLength());
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::AppendNull(const StringView& name) {
+  WriteName(BsonView::BSON_NULL, name);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::AppendDateTime(const StringView& name,
+                                         int64 value) {
+  WriteName(BsonView::BSON_DATETIME, name);
+  WriteInt64(value);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::AppendObjectId(const StringView& name,
+                                         const uint8* value) {
+  WriteName(BsonView::BSON_OBJECT_ID, name);
+  buffer_.WriteRawBytes(value, 12);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::AppendBinary(const StringView& name,
+                                       const void* data, int32 length,
+                                       uint8 subtype) {
+  WriteName(BsonView::BSON_BINARY, name);
+  WriteInt32(length);
+  buffer_.WriteFixed8(subtype);
+  buffer_.WriteRawBytes(data, length);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::OpenDocument(const StringView& name) {
+  Open(BsonView::BSON_DOCUMENT, name);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::OpenArray(const StringView& name) {
+  Open(BsonView::BSON_ARRAY, name);
+  return *this;
+}
+
+BsonBuilder& BsonBuilder::Close() {
+  if (levels_.empty()) {
+    throw InvalidAccessException("BsonBuilder: nothing to close");
+  }
+
+  buffer_.WriteFixed8(0x00);  // null-terminator
+
+  const int32 offset = levels_.back().offset;
+  const uint32 size = (uint32)(buffer_.GetLength() - offset);
+  uint8* p = buffer_.MutableData() + offset;
+  p[0] = (uint8)size;
+  p[1] = (uint8)(size >> 8);
+  p[2] = (uint8)(size >> 16);
+  p[3] = (uint8)(size >> 24);
+
+  levels_.pop_back();
+  return *this;
+}
+
+BsonView BsonBuilder::Finish() {
+  if (levels_.size() != 1) {
+    throw InvalidAccessException(
+        levels_.empty() ? "BsonBuilder: already finished"
+                        : "BsonBuilder: a document or array is not closed");
+  }
+  Close();
+  return BsonView(buffer_.ConstData(), buffer_.GetLength());
+}
+
+void BsonBuilder::Open(uint8 type, const StringView& name) {
+  WriteName(type, name);
+  Level level = {buffer_.GetLength(), 0};
+  levels_.push_back(level);
+  WriteInt32(0);  // size, written by Close()
+}
+
+void BsonBuilder::WriteName(uint8 type, const StringView& name) {
+  if (levels_.empty()) {
+    throw InvalidAccessException("BsonBuilder: already finished");
+  }
+  buffer_.WriteFixed8(type);
+  buffer_.WriteRawBytes(name.ConstData(), name.Len());
+  buffer_.WriteFixed8(0x00);  // null-terminator
+  ++levels_.back().count;
+}
+
+void BsonBuilder::WriteInt32(int32 value) {
+  const uint32 v = (uint32)value;
+  const uint8 bytes[4] = {(uint8)v, (uint8)(v >> 8), (uint8)(v >> 16),
+                          (uint8)(v >> 24)};
+  buffer_.WriteRawBytes(bytes, 4);
+}
+
+void BsonBuilder::WriteInt64(int64 value) {
+  WriteInt32((int32)(uint32)(uint64)value);
+  WriteInt32((int32)(uint32)((uint64)value >> 32));
+}
+
+StringView BsonBuilder::GetIndexName() {
+  if (levels_.empty()) {
+    throw InvalidAccessException("BsonBuilder: already finished");
+  }
+  // The index of the next element, as a decimal string.
+  uint32 index = (uint32)levels_.back().count;
+  char* end = index_name_ + sizeof(index_name_);
+  char* p = end;
+  do {
+    *--p = (char)('0' + index % 10);
+    index /= 10;
+  } while (index != 0);
+  return StringView(p, end - p);
+}
+
+}  // namespace mongodb
+}  // namespace fun
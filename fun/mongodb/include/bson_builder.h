@@ -0,0 +1,122 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "fun/mongodb/bson_view.h"
+
+namespace fun {
+namespace mongodb {
+
+/**
+ * Writes a BSON document straight into a buffer, without building a
+ * Document of Elements first.
+ *
+ * The buffer is kept by Reset(), so a builder reused for every document
+ * of a batch allocates only while it grows to the largest one:
+ *
+ *   BsonBuilder builder;
+ *   for (...) {
+ *     builder.Reset();
+ *     builder.Append("player", player).Append("score", score);
+ *     builder.OpenArray("items");
+ *     for (int32 item : items) {
+ *       builder.Push(item);
+ *     }
+ *     builder.Close();
+ *     bulk_writer.Insert(builder.Finish());
+ *   }
+ *
+ * Nested documents and arrays are opened and closed like brackets; the
+ * elements of an array are added with Push(), which names them by their
+ * index.
+ */
+class FUN_MONGODB_API BsonBuilder {
+ public:
+  explicit BsonBuilder(int32 initial_capacity = 256);
+
+  /**
+   * Starts a new, empty document, keeping the buffer.
+   */
+  void Reset();
+
+  BsonBuilder& Append(const StringView& name, double value);
+  BsonBuilder& Append(const StringView& name, int32 value);
+  BsonBuilder& Append(const StringView& name, int64 value);
+  BsonBuilder& Append(const StringView& name, bool value);
+  BsonBuilder& Append(const StringView& name, const StringView& value);
+  BsonBuilder& Append(const StringView& name, const char* value) {
+    return Append(name, StringView(value));
+  }
+  BsonBuilder& Append(const StringView& name, const String& value) {
+    return Append(name, StringView(value));
+  }
+
+  /**
+   * Copies a whole document, or an array if is_array.
+   */
+  BsonBuilder& Append(const StringView& name, const BsonView& document,
+                      bool is_array = false);
+
+  BsonBuilder& AppendNull(const StringView& name);
+
+  /** Milliseconds since the epoch. */
+  BsonBuilder& AppendDateTime(const StringView& name, int64 value);
+
+  /** The 12 bytes of an ObjectId. */
+  BsonBuilder& AppendObjectId(const StringView& name, const uint8* value);
+
+  BsonBuilder& AppendBinary(const StringView& name, const void* data,
+                            int32 length, uint8 subtype = 0);
+
+  /**
+   * Appends an element to the array opened last, named by its index.
+   */
+  template <typename T>
+  BsonBuilder& Push(const T& value) {
+    return Append(GetIndexName(), value);
+  }
+
+  BsonBuilder& OpenDocument(const StringView& name);
+  BsonBuilder& OpenArray(const StringView& name);
+
+  /**
+   * Opens a document or an array as the next element of an array.
+   */
+  BsonBuilder& PushDocument() { return OpenDocument(GetIndexName()); }
+  BsonBuilder& PushArray() { return OpenArray(GetIndexName()); }
+
+  /**
+   * Closes the document or array opened last.
+   */
+  BsonBuilder& Close();
+
+  /**
+   * Closes the document and returns it. The view is valid until the
+   * builder is reset or destroyed.
+   */
+  BsonView Finish();
+
+  /**
+   * Returns the number of bytes written so far.
+   */
+  int32 GetLength() const { return buffer_.GetLength(); }
+
+ private:
+  struct Level {
+    int32 offset;
+    int32 count;
+  };
+
+  void Open(uint8 type, const StringView& name);
+  void WriteName(uint8 type, const StringView& name);
+  void WriteInt32(int32 value);
+  void WriteInt64(int64 value);
+  StringView GetIndexName();
+
+  MessageOut buffer_;
+  std::vector<Level> levels_;
+  char index_name_[12];
+};
+
+}  // namespace mongodb
+}  // namespace fun
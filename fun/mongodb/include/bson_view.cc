@@ -0,0 +1,301 @@
+﻿#include "fun/mongodb/bson_view.h"
+
+#include <cstring>
+
+namespace fun {
+namespace mongodb {
+
+namespace {
+
+// BSON is little endian whatever the host is.
+inline int32 ReadInt32(const uint8* p) {
+  return (int32)(uint32(p[0]) | (uint32(p[1]) << 8) | (uint32(p[2]) << 16) |
+                 (uint32(p[3]) << 24));
+}
+
+inline int64 ReadInt64(const uint8* p) {
+  return (int64)(uint64(uint32(ReadInt32(p))) |
+                 (uint64(uint32(ReadInt32(p + 4))) << 32));
+}
+
+void ThrowInvalid() { throw IoException("Invalid BSON document"); }
+
+int32 GetCStringSize(const uint8* p, int32 remaining) {
+  const void* terminator = ::memchr(p, 0, remaining);
+  if (!terminator) {
+    ThrowInvalid();
+  }
+  return (int32)(static_cast<const uint8*>(terminator) - p) + 1;
+}
+
+int32 GetLengthPrefixedSize(const uint8* p, int32 remaining, int32 extra,
+                            int32 min_length) {
+  if (remaining < 4) {
+    ThrowInvalid();
+  }
+  const int32 length = ReadInt32(p);
+  if (length < min_length || length > remaining - extra) {
+    ThrowInvalid();
+  }
+  return length + extra;
+}
+
+/**
+ * Returns the size of the value of the given type at p.
+ */
+int32 GetValueSize(uint8 type, const uint8* p, int32 remaining) {
+  int32 size;
+  switch (type) {
+    case BsonView::BSON_UNDEFINED:
+    case BsonView::BSON_NULL:
+    case BsonView::BSON_MIN_KEY:
+    case BsonView::BSON_MAX_KEY:
+      size = 0;
+      break;
+    case BsonView::BSON_BOOL:
+      size = 1;
+      break;
+    case BsonView::BSON_INT32:
+      size = 4;
+      break;
+    case BsonView::BSON_DOUBLE:
+    case BsonView::BSON_DATETIME:
+    case BsonView::BSON_TIMESTAMP:
+    case BsonView::BSON_INT64:
+      size = 8;
+      break;
+    case BsonView::BSON_OBJECT_ID:
+      size = 12;
+      break;
+    case BsonView::BSON_DECIMAL128:
+      size = 16;
+      break;
+    case BsonView::BSON_STRING:
+    case BsonView::BSON_JAVASCRIPT:
+    case BsonView::BSON_SYMBOL:
+      // int32 length, then the string and its terminator.
+      size = GetLengthPrefixedSize(p, remaining, 4, 1);
+      break;
+    case BsonView::BSON_DOCUMENT:
+    case BsonView::BSON_ARRAY:
+      size = GetLengthPrefixedSize(p, remaining, 0, 5);
+      break;
+    case BsonView::BSON_BINARY:
+      // int32 length, subtype, then the bytes.
+      size = GetLengthPrefixedSize(p, remaining, 5, 0);
+      break;
+    case BsonView::BSON_JAVASCRIPT_WITH_SCOPE:
+      size = GetLengthPrefixedSize(p, remaining, 0, 14);
+      break;
+    case BsonView::BSON_DB_POINTER:
+      size = GetLengthPrefixedSize(p, remaining, 4 + 12, 1);
+      break;
+    case BsonView::BSON_REGEX: {
+      // Pattern and options, two cstrings.
+      const int32 pattern = GetCStringSize(p, remaining);
+      size = pattern + GetCStringSize(p + pattern, remaining - pattern);
+      break;
+    }
+    default:
+      throw NotImplementedException(
+          String::Format("Unsupported BSON type 0x%x", (int32)type));
+  }
+
+  if (size > remaining) {
+    ThrowInvalid();
+  }
+  return size;
+}
+
+}  // namespace
+
+//
+// BsonView::Value
+//
+
+double BsonView::Value::AsDouble() const {
+  if (type_ != BSON_DOUBLE) {
+    throw BadCastException("invalid type mismatch");
+  }
+  const uint64 bits = (uint64)ReadInt64(data_);
+  double value;
+  ::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+int32 BsonView::Value::AsInt32() const {
+  if (type_ != BSON_INT32) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return ReadInt32(data_);
+}
+
+int64 BsonView::Value::AsInt64() const {
+  if (type_ != BSON_INT64) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return ReadInt64(data_);
+}
+
+bool BsonView::Value::AsBool() const {
+  if (type_ != BSON_BOOL) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return data_[0] != 0;
+}
+
+int64 BsonView::Value::AsDateTime() const {
+  if (type_ != BSON_DATETIME) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return ReadInt64(data_);
+}
+
+StringView BsonView::Value::AsString() const {
+  if (type_ != BSON_STRING && type_ != BSON_JAVASCRIPT &&
+      type_ != BSON_SYMBOL) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return StringView(reinterpret_cast<const char*>(data_ + 4),
+                    ReadInt32(data_) - 1);
+}
+
+BsonView BsonView::Value::AsDocument() const {
+  if (type_ != BSON_DOCUMENT && type_ != BSON_ARRAY) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return BsonView(data_, size_);
+}
+
+const uint8* BsonView::Value::AsObjectId() const {
+  if (type_ != BSON_OBJECT_ID) {
+    throw BadCastException("invalid type mismatch");
+  }
+  return data_;
+}
+
+StringView BsonView::Value::AsBinary(uint8* subtype) const {
+  if (type_ != BSON_BINARY) {
+    throw BadCastException("invalid type mismatch");
+  }
+  if (subtype) {
+    *subtype = data_[4];
+  }
+  return StringView(reinterpret_cast<const char*>(data_ + 5), size_ - 5);
+}
+
+int64 BsonView::Value::GetInteger() const {
+  switch (type_) {
+    case BSON_DOUBLE:
+      return static_cast<int64>(AsDouble());
+    case BSON_INT32:
+      return ReadInt32(data_);
+    case BSON_INT64:
+      return ReadInt64(data_);
+    case BSON_EOO:
+      throw NotFoundException(String(name_.ConstData(), name_.Len()));
+    default:
+      throw BadCastException("invalid type mismatch");
+  }
+}
+
+//
+// BsonView::Iterator
+//
+
+BsonView::Iterator::Iterator(const uint8* first, const uint8* end)
+    : next_(first), end_(end) {
+  Advance();
+}
+
+void BsonView::Iterator::Advance() {
+  if (next_ == nullptr || next_ >= end_ || *next_ == 0) {
+    next_ = nullptr;
+    value_ = Value();
+    return;
+  }
+
+  const uint8 type = *next_;
+  const uint8* name = next_ + 1;
+  const int32 name_size = GetCStringSize(name, (int32)(end_ - name));
+  const uint8* data = name + name_size;
+  const int32 size = GetValueSize(type, data, (int32)(end_ - data));
+
+  value_ = Value((Type)type,
+                 StringView(reinterpret_cast<const char*>(name), name_size - 1),
+                 data, size);
+  next_ = data + size;
+}
+
+//
+// BsonView
+//
+
+BsonView::BsonView(const void* data, int32 length)
+    : data_(static_cast<const uint8*>(data)), length_(0) {
+  if (data_ == nullptr || length < 5) {
+    ThrowInvalid();
+  }
+  const int32 declared = ReadInt32(data_);
+  if (declared < 5 || declared > length || data_[declared - 1] != 0) {
+    ThrowInvalid();
+  }
+  length_ = declared;
+}
+
+BsonView::Iterator BsonView::begin() const {
+  if (data_ == nullptr) {
+    return Iterator();
+  }
+  // The fields lie between the size prefix and the terminator.
+  return Iterator(data_ + 4, data_ + length_ - 1);
+}
+
+int32 BsonView::Count() const {
+  int32 count = 0;
+  for (Iterator it = begin(); it != end(); ++it) {
+    ++count;
+  }
+  return count;
+}
+
+BsonView::Value BsonView::Find(const StringView& name) const {
+  for (Iterator it = begin(); it != end(); ++it) {
+    if (it->GetName() == name) {
+      return *it;
+    }
+  }
+  return Value();
+}
+
+BsonView::Value BsonView::FindPath(const StringView& path) const {
+  BsonView document = *this;
+  StringView rest = path;
+  for (;;) {
+    const char* dot =
+        static_cast<const char*>(::memchr(rest.ConstData(), '.', rest.Len()));
+    if (!dot) {
+      return document.Find(rest);
+    }
+
+    const size_t name_length = dot - rest.ConstData();
+    const Value value = document.Find(rest.Mid(0, name_length));
+    if (value.GetType() != BSON_DOCUMENT && value.GetType() != BSON_ARRAY) {
+      return Value();
+    }
+    document = value.AsDocument();
+    rest = rest.Mid(name_length + 1);
+  }
+}
+
+DocumentPtr BsonView::ToDocument() const {
+  DocumentPtr document(new Document());
+  if (data_ != nullptr) {
+    MessageIn reader(ByteArray(reinterpret_cast<const char*>(data_), length_));
+    document->Read(reader);
+  }
+  return document;
+}
+
+}  // namespace mongodb
+}  // namespace fun
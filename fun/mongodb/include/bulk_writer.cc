@@ -0,0 +1,212 @@
+﻿#include "fun/mongodb/bulk_writer.h"
+
+namespace fun {
+namespace mongodb {
+
+BulkWriter::Options::Options()
+    : batch_size(1000), ordered(true), w(1), journal(false) {}
+
+BulkWriter::BulkWriter(PipelinedConnection& connection,
+                       const String& database, const String& collection,
+                       const Options& options)
+    : connection_(connection),
+      database_(database),
+      collection_(collection),
+      options_(options),
+      batch_kind_(NO_BATCH),
+      batch_first_index_(0),
+      batch_length_(0),
+      open_document_(nullptr),
+      operation_count_(0),
+      inserted_count_(0),
+      matched_count_(0),
+      modified_count_(0),
+      upserted_count_(0),
+      deleted_count_(0) {
+  if (options_.batch_size <= 0 || options_.batch_size > 100000) {
+    throw InvalidArgumentException("BulkWriter batch_size");
+  }
+}
+
+Document& BulkWriter::Insert() {
+  Document& document = GetBatch(INSERT_BATCH, -1).AddInsert();
+  open_document_ = &document;
+  return document;
+}
+
+void BulkWriter::Insert(const BsonView& document) {
+  GetBatch(BSON_INSERT_BATCH, document.GetLength()).AddInsert(document);
+}
+
+void BulkWriter::Update(DocumentPtr query, DocumentPtr update, bool upsert,
+                        bool multi) {
+  OpMsgRequest& batch = GetBatch(UPDATE_BATCH, -1);
+  batch.AddUpdate(query, update, upsert, multi);
+  open_document_ = batch.GetSequences()[0].documents.Last().Get();
+}
+
+void BulkWriter::Delete(DocumentPtr query, int32 limit) {
+  OpMsgRequest& batch = GetBatch(DELETE_BATCH, -1);
+  batch.AddDelete(query, limit);
+  open_document_ = batch.GetSequences()[0].documents.Last().Get();
+}
+
+BulkWriter::~BulkWriter() {
+  try {
+    Flush();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+void BulkWriter::Flush() {
+  SendBatch();
+  connection_.Flush();
+  connection_.WaitAll();
+}
+
+void BulkWriter::MeasureOpenDocument() {
+  if (open_document_ == nullptr) {
+    return;
+  }
+  scratch_.SetLength(0);
+  open_document_->Write(scratch_);
+  batch_length_ += scratch_.GetLength();
+  open_document_ = nullptr;
+}
+
+OpMsgRequest& BulkWriter::GetBatch(Kind kind, int32 length) {
+  MeasureOpenDocument();
+
+  // A Document of unknown size may still take the batch past the limit
+  // by one document, which maxMessageSizeBytes leaves room for.
+  const int32 max_length = connection_.GetMaxBsonObjectSize();
+  if (batch_.IsValid() &&
+      (batch_kind_ != kind ||
+       batch_->GetDocumentCount() >= options_.batch_size ||
+       batch_length_ >= max_length ||
+       (length > 0 && batch_length_ + length > max_length))) {
+    SendBatch();
+  }
+
+  if (!batch_.IsValid()) {
+    switch (kind) {
+      case INSERT_BATCH:
+      case BSON_INSERT_BATCH:
+        batch_ = OpMsgRequest::CreateInsert(database_, collection_,
+                                            options_.ordered);
+        break;
+      case UPDATE_BATCH:
+        batch_ = OpMsgRequest::CreateUpdate(database_, collection_,
+                                            options_.ordered);
+        break;
+      default:
+        batch_ = OpMsgRequest::CreateDelete(database_, collection_,
+                                            options_.ordered);
+        break;
+    }
+    if (options_.w != 1 || options_.journal) {
+      batch_->SetWriteConcern(options_.w, options_.journal);
+    }
+    batch_kind_ = kind;
+    batch_first_index_ = operation_count_;
+    batch_length_ = 0;
+  }
+
+  if (length > 0) {
+    batch_length_ += length;
+  }
+  ++operation_count_;
+  return *batch_;
+}
+
+void BulkWriter::SendBatch() {
+  if (!batch_.IsValid()) {
+    return;
+  }
+
+  const Kind kind = batch_kind_;
+  const int64 first_index = batch_first_index_;
+  if (batch_->IsMoreToCome()) {
+    connection_.Send(*batch_);
+  } else {
+    connection_.Send(*batch_,
+                     [this, kind, first_index](OpMsgResponse& response) {
+                       HandleReply(kind, first_index, response);
+                     });
+  }
+  batch_.Reset();
+  batch_kind_ = NO_BATCH;
+  batch_length_ = 0;
+  open_document_ = nullptr;
+}
+
+namespace {
+
+BulkWriter::WriteError MakeWriteError(int64 index, const BsonView& item) {
+  BulkWriter::WriteError error;
+  error.index = index;
+  const BsonView::Value code = item.Find("code");
+  error.code = code.IsValid() ? (int32)code.GetInteger() : 0;
+  const BsonView::Value message = item.Find("errmsg");
+  if (message.GetType() == BsonView::BSON_STRING) {
+    const StringView text = message.AsString();
+    error.message = String(text.ConstData(), text.Len());
+  }
+  return error;
+}
+
+}  // namespace
+
+void BulkWriter::HandleReply(Kind kind, int64 first_index,
+                             OpMsgResponse& response) {
+  // Read in place; a reply of a large batch is not worth decoding.
+  const BsonView& body = response.GetBodyView();
+  if (!response.IsOk()) {
+    write_errors_.Add(MakeWriteError(-1, body));
+    return;
+  }
+
+  const BsonView::Value n_value = body.Find("n");
+  const int64 n = n_value.IsValid() ? n_value.GetInteger() : 0;
+  switch (kind) {
+    case INSERT_BATCH:
+    case BSON_INSERT_BATCH:
+      inserted_count_ += n;
+      break;
+    case UPDATE_BATCH: {
+      const BsonView::Value upserted = body.Find("upserted");
+      const int64 upserted_count =
+          upserted.GetType() == BsonView::BSON_ARRAY
+              ? upserted.AsDocument().Count()
+              : 0;
+      upserted_count_ += upserted_count;
+      matched_count_ += n - upserted_count;
+      const BsonView::Value modified = body.Find("nModified");
+      if (modified.IsValid()) {
+        modified_count_ += modified.GetInteger();
+      }
+      break;
+    }
+    default:
+      deleted_count_ += n;
+      break;
+  }
+
+  const BsonView::Value errors = body.Find("writeErrors");
+  if (errors.GetType() == BsonView::BSON_ARRAY) {
+    for (const BsonView::Value& item : errors.AsDocument()) {
+      const BsonView error = item.AsDocument();
+      write_errors_.Add(MakeWriteError(
+          first_index + error.Find("index").GetInteger(), error));
+    }
+  }
+
+  const BsonView::Value concern_error = body.Find("writeConcernError");
+  if (concern_error.GetType() == BsonView::BSON_DOCUMENT) {
+    write_errors_.Add(MakeWriteError(-1, concern_error.AsDocument()));
+  }
+}
+
+}  // namespace mongodb
+}  // namespace fun
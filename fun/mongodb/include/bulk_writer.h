@@ -0,0 +1,149 @@
+﻿#pragma once
+
+#include "fun/mongodb/pipelined_connection.h"
+
+namespace fun {
+namespace mongodb {
+
+/**
+ * Batches inserts, updates and deletes into OP_MSG write commands and
+ * pipelines them over a PipelinedConnection.
+ *
+ * Each command carries up to Options::batch_size documents in a document
+ * sequence, and up to max_pending_requests of the connection are in
+ * flight at a time, so a large load costs a few round trips instead of
+ * one per document. A command is also cut once its documents reach the
+ * server's maxBsonObjectSize in bytes, which keeps the message well
+ * below maxMessageSizeBytes; call PipelinedConnection::Handshake() first
+ * to use the server's limits rather than the defaults:
+ *
+ *   BulkWriter writer(connection, "game", "events");
+ *   for (...) {
+ *     writer.Insert().Add("player", player).Add("score", score);
+ *   }
+ *   writer.Flush();
+ *   if (!writer.GetWriteErrors().IsEmpty()) { ... }
+ *
+ * Operations of one kind in a row go into the same command; a different
+ * kind starts a new one, so the server applies them in the order they
+ * were added. Write errors are collected from the replies; their index
+ * counts all operations added to the writer.
+ */
+class FUN_MONGODB_API BulkWriter {
+ public:
+  struct FUN_MONGODB_API Options {
+    Options();
+
+    /** Documents per command, at most 100000. */
+    int32 batch_size;
+
+    /**
+     * Stop a command at the first error. This only applies within one
+     * command: the commands already pipelined behind a failing one still
+     * run, so with several batches in flight, operations after the error
+     * may have been applied.
+     */
+    bool ordered;
+
+    /** Write concern; 0 for unacknowledged writes, which have no reply. */
+    int32 w;
+
+    /** Wait for the journal. */
+    bool journal;
+  };
+
+  struct WriteError {
+    /** Index of the operation, -1 for an error of a whole command. */
+    int64 index;
+    int32 code;
+    String message;
+  };
+
+  BulkWriter(PipelinedConnection& connection, const String& database,
+             const String& collection, const Options& options = Options());
+
+  /**
+   * Flushes what is left, so that no reply handler outlives the writer.
+   */
+  ~BulkWriter();
+
+  /**
+   * Returns a new document to insert; it is sent when its batch is full
+   * or on Flush().
+   */
+  Document& Insert();
+
+  /**
+   * Inserts an encoded document, for instance one made by a BsonBuilder.
+   * It is copied, so the builder can be reset right away.
+   */
+  void Insert(const BsonView& document);
+
+  void Update(DocumentPtr query, DocumentPtr update, bool upsert = false,
+              bool multi = false);
+
+  void Delete(DocumentPtr query, int32 limit = 0);
+
+  /**
+   * Sends the partial batch, writes out the connection's buffer and
+   * waits for every reply of the connection. With w 0 there are no
+   * replies, but the writes are only on the wire after this.
+   */
+  void Flush();
+
+  int64 GetInsertedCount() const { return inserted_count_; }
+  int64 GetMatchedCount() const { return matched_count_; }
+  int64 GetModifiedCount() const { return modified_count_; }
+  int64 GetUpsertedCount() const { return upserted_count_; }
+  int64 GetDeletedCount() const { return deleted_count_; }
+
+  const fun::Array<WriteError>& GetWriteErrors() const {
+    return write_errors_;
+  }
+
+ private:
+  // Inserts of Documents and of BSON go to different batches, which
+  // keeps them in the order they were added.
+  enum Kind {
+    NO_BATCH,
+    INSERT_BATCH,
+    BSON_INSERT_BATCH,
+    UPDATE_BATCH,
+    DELETE_BATCH
+  };
+
+  /**
+   * length is the encoded size of the operation, or -1 for a Document
+   * that is filled in after it is added; such a document is measured
+   * when the next operation comes.
+   */
+  OpMsgRequest& GetBatch(Kind kind, int32 length);
+  void MeasureOpenDocument();
+  void SendBatch();
+  void HandleReply(Kind kind, int64 first_index, OpMsgResponse& response);
+
+  PipelinedConnection& connection_;
+  String database_;
+  String collection_;
+  Options options_;
+
+  OpMsgRequestPtr batch_;
+  Kind batch_kind_;
+  int64 batch_first_index_;
+  int32 batch_length_;
+  // The last Document added to the batch, not yet counted in
+  // batch_length_.
+  Document* open_document_;
+  MessageOut scratch_;
+  int64 operation_count_;
+
+  int64 inserted_count_;
+  int64 matched_count_;
+  int64 modified_count_;
+  int64 upserted_count_;
+  int64 deleted_count_;
+  fun::Array<WriteError> write_errors_;
+};
+
+}  // namespace mongodb
+}  // namespace fun
@@ -0,0 +1,165 @@
+﻿#include "fun/mongodb/op_msg_cursor.h"
+#include "fun/mongodb/array.h"
+
+namespace fun {
+namespace mongodb {
+
+OpMsgCursor::OpMsgCursor(PipelinedConnection& connection,
+                         const String& database, const String& collection,
+                         DocumentPtr filter, int32 batch_size, bool exhaust)
+    : connection_(connection),
+      database_(database),
+      collection_(collection),
+      batch_size_(batch_size),
+      exhaust_(exhaust),
+      find_(new OpMsgRequest(database)),
+      started_(false),
+      request_id_(0),
+      cursor_id_(0) {
+  find_->GetBody().Add("find", collection);
+  if (filter.IsValid()) {
+    find_->GetBody().Add("filter", filter);
+  }
+  if (batch_size_ > 0) {
+    find_->GetBody().Add("batchSize", batch_size_);
+  }
+}
+
+OpMsgCursor::~OpMsgCursor() {
+  try {
+    Kill();
+  } catch (...) {
+  }
+}
+
+bool OpMsgCursor::Next(fun::Array<DocumentPtr>& batch) {
+  if (!NextBatch()) {
+    return false;
+  }
+
+  // Shares the body, so each document is decoded straight from it.
+  batch.Clear();
+  const uint8* base =
+      reinterpret_cast<const uint8*>(current_.body.ConstData());
+  const BsonView documents(base + current_.offset, current_.length);
+  for (const BsonView::Value& item : documents) {
+    const BsonView view = item.AsDocument();
+    MessageIn reader(current_.body, (int32)(view.ConstData() - base),
+                     view.GetLength());
+    DocumentPtr document(new Document());
+    document->Read(reader);
+    batch.Add(document);
+  }
+  return true;
+}
+
+bool OpMsgCursor::Next(fun::Array<BsonView>& batch) {
+  if (!NextBatch()) {
+    return false;
+  }
+
+  batch.Clear();
+  const BsonView documents(current_.body.ConstData() + current_.offset,
+                           current_.length);
+  for (const BsonView::Value& item : documents) {
+    batch.Add(item.AsDocument());
+  }
+  return true;
+}
+
+bool OpMsgCursor::NextBatch() {
+  if (!started_) {
+    started_ = true;
+    SendRequest(*find_);
+  }
+
+  while (batches_.empty()) {
+    if (!connection_.IsPending(request_id_)) {
+      if (cursor_id_ == 0) {
+        return false;
+      }
+
+      OpMsgRequest get_more(database_,
+                            exhaust_ ? OpMsgRequest::MSG_EXHAUST_ALLOWED
+                                     : OpMsgRequest::MSG_DEFAULT);
+      get_more.GetBody()
+          .Add("getMore", cursor_id_)
+          .Add("collection", collection_);
+      if (batch_size_ > 0) {
+        get_more.GetBody().Add("batchSize", batch_size_);
+      }
+      SendRequest(get_more);
+    }
+
+    connection_.Receive();
+    if (!error_.IsEmpty()) {
+      const String error = error_;
+      error_.Clear();
+      throw IoException(error);
+    }
+  }
+
+  current_ = batches_.front();
+  batches_.pop_front();
+  return true;
+}
+
+void OpMsgCursor::Kill() {
+  if (started_ && connection_.IsPending(request_id_)) {
+    connection_.Wait(request_id_);
+  }
+  batches_.clear();
+  current_.body.Clear();
+  if (cursor_id_ == 0) {
+    return;
+  }
+
+  ArrayPtr cursors(new Array());
+  cursors->Add("0", cursor_id_);
+  OpMsgRequest kill(database_);
+  kill.GetBody().Add("killCursors", collection_).Add("cursors", cursors);
+  cursor_id_ = 0;
+  connection_.Wait(connection_.Send(kill));
+}
+
+void OpMsgCursor::SendRequest(OpMsgRequest& request) {
+  request_id_ = connection_.Send(
+      request, [this](OpMsgResponse& response) { HandleReply(response); });
+  connection_.Flush();
+}
+
+void OpMsgCursor::HandleReply(OpMsgResponse& response) {
+  // Read in place; the documents are decoded, if at all, by Next().
+  const BsonView& body = response.GetBodyView();
+  if (!response.IsOk()) {
+    cursor_id_ = 0;
+    const BsonView::Value errmsg = body.Find("errmsg");
+    if (errmsg.GetType() == BsonView::BSON_STRING) {
+      const StringView message = errmsg.AsString();
+      error_ = String(message.ConstData(), message.Len());
+    } else {
+      error_ = "MongoDB cursor failed";
+    }
+    return;
+  }
+
+  // cursor: { id, ns, firstBatch | nextBatch }
+  const BsonView cursor = body.Find("cursor").AsDocument();
+  cursor_id_ = cursor.Find("id").GetInteger();
+  BsonView::Value documents = cursor.Find("firstBatch");
+  if (!documents.IsValid()) {
+    documents = cursor.Find("nextBatch");
+  }
+
+  const BsonView batch = documents.AsDocument();
+  if (!batch.IsEmpty()) {
+    Batch kept;
+    kept.body = response.GetBodyBytes();
+    kept.offset = (int32)(batch.ConstData() - body.ConstData());
+    kept.length = batch.GetLength();
+    batches_.push_back(kept);
+  }
+}
+
+}  // namespace mongodb
+}  // namespace fun
@@ -0,0 +1,110 @@
+﻿#pragma once
+
+#include <deque>
+
+#include "fun/mongodb/bson_view.h"
+#include "fun/mongodb/pipelined_connection.h"
+
+namespace fun {
+namespace mongodb {
+
+/**
+ * Reads the result of a find command batch by batch.
+ *
+ * The first batch comes with the reply to find; the others are fetched
+ * with getMore. With exhaust, a single getMore is sent with
+ * MSG_EXHAUST_ALLOWED and the server streams every remaining batch
+ * without waiting for another request, which saves a round trip per
+ * batch:
+ *
+ *   OpMsgCursor cursor(connection, "game", "events", filter);
+ *   fun::Array<DocumentPtr> batch;
+ *   while (cursor.Next(batch)) {
+ *     for (auto& document : batch) { ... }
+ *   }
+ *
+ * Each reply is kept encoded, and the documents are decoded only by the
+ * Next() returning them as Documents. The other Next() returns views
+ * into the reply instead, which decodes nothing:
+ *
+ *   fun::Array<BsonView> batch;
+ *   while (cursor.Next(batch)) {
+ *     for (auto& document : batch) {
+ *       total += document.Find("score").GetInteger();
+ *     }
+ *   }
+ *
+ * Sort, projection and the other find options are added to
+ * GetFindCommand() before the first call to Next().
+ */
+class FUN_MONGODB_API OpMsgCursor {
+ public:
+  OpMsgCursor(PipelinedConnection& connection, const String& database,
+              const String& collection, DocumentPtr filter = DocumentPtr(),
+              int32 batch_size = 0, bool exhaust = true);
+
+  /**
+   * Kills the cursor on the server if it is still open.
+   */
+  ~OpMsgCursor();
+
+  /**
+   * Returns the find command, to add options before the first Next().
+   */
+  Document& GetFindCommand() { return find_->GetBody(); }
+
+  /**
+   * Replaces batch with the next batch of documents. Returns false when
+   * the cursor is exhausted.
+   */
+  bool Next(fun::Array<DocumentPtr>& batch);
+
+  /**
+   * Replaces batch with views of the next batch of documents. Returns
+   * false when the cursor is exhausted. The views are valid until the
+   * next call to Next() or Kill(), or until the cursor is destroyed.
+   */
+  bool Next(fun::Array<BsonView>& batch);
+
+  /**
+   * Returns the ID of the cursor on the server, 0 once it is exhausted.
+   */
+  int64 GetCursorId() const { return cursor_id_; }
+
+  /**
+   * Closes the cursor on the server. An exhaust stream in progress cannot
+   * be interrupted; it is read to the end.
+   */
+  void Kill();
+
+ private:
+  /**
+   * The body of a reply, and where its array of documents lies in it.
+   */
+  struct Batch {
+    ByteArray body;
+    int32 offset;
+    int32 length;
+  };
+
+  bool NextBatch();
+  void SendRequest(OpMsgRequest& request);
+  void HandleReply(OpMsgResponse& response);
+
+  PipelinedConnection& connection_;
+  String database_;
+  String collection_;
+  int32 batch_size_;
+  bool exhaust_;
+
+  OpMsgRequestPtr find_;
+  bool started_;
+  int32 request_id_;
+  int64 cursor_id_;
+  std::deque<Batch> batches_;
+  Batch current_;
+  String error_;
+};
+
+}  // namespace mongodb
+}  // namespace fun
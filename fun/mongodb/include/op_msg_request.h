@@ -0,0 +1,228 @@
+﻿#pragma once
+
+#include "fun/mongodb/bson_view.h"
+#include "fun/mongodb/document.h"
+#include "fun/mongodb/request.h"
+
+namespace fun {
+namespace mongodb {
+
+typedef SharedPtr<class OpMsgRequest> OpMsgRequestPtr;
+
+/**
+ * A command sent with OP_MSG, the message that replaces OP_QUERY,
+ * OP_INSERT, OP_UPDATE, OP_DELETE and OP_GET_MORE since MongoDB 3.6.
+ *
+ * The command is the body document. Bulk writes put their documents in
+ * document sequences next to it instead of an array inside it, so that
+ * an insert of many documents is written as they are, without building
+ * one big document first:
+ *
+ *   OpMsgRequestPtr request = OpMsgRequest::CreateInsert("game", "events");
+ *   for (...) {
+ *     request->AddInsert().Add("type", type).Add("at", at);
+ *   }
+ *   connection.Send(*request, handler);
+ */
+class FUN_MONGODB_API OpMsgRequest : public Request {
+ public:
+  enum Flags {
+    MSG_DEFAULT = 0,
+    MSG_CHECKSUM_PRESENT = 1 << 0,
+    /** No reply is sent, for unacknowledged writes (w: 0). */
+    MSG_MORE_TO_COME = 1 << 1,
+    /** The reply may be streamed as several messages (exhaust cursor). */
+    MSG_EXHAUST_ALLOWED = 1 << 16
+  };
+
+  /**
+   * A named list of documents sent next to the body, such as the
+   * "documents" of an insert. Documents added as BSON are kept encoded in
+   * bson and written after the Document ones.
+   */
+  struct DocumentSequence {
+    String identifier;
+    fun::Array<DocumentPtr> documents;
+    MessageOut bson;
+  };
+
+  explicit OpMsgRequest(const String& database, int32 flags = MSG_DEFAULT)
+      : Request(MessageHeader::OP_MSG), database_(database), flags_(flags) {}
+
+  // virtual ~OpMsgRequest() {}
+
+  /**
+   * Returns an insert command; add the documents with AddInsert().
+   */
+  static OpMsgRequestPtr CreateInsert(const String& database,
+                                      const String& collection,
+                                      bool ordered = true) {
+    OpMsgRequestPtr request(new OpMsgRequest(database));
+    request->GetBody().Add("insert", collection).Add("ordered", ordered);
+    return request;
+  }
+
+  /**
+   * Returns an update command; add the statements with AddUpdate().
+   */
+  static OpMsgRequestPtr CreateUpdate(const String& database,
+                                      const String& collection,
+                                      bool ordered = true) {
+    OpMsgRequestPtr request(new OpMsgRequest(database));
+    request->GetBody().Add("update", collection).Add("ordered", ordered);
+    return request;
+  }
+
+  /**
+   * Returns a delete command; add the statements with AddDelete().
+   */
+  static OpMsgRequestPtr CreateDelete(const String& database,
+                                      const String& collection,
+                                      bool ordered = true) {
+    OpMsgRequestPtr request(new OpMsgRequest(database));
+    request->GetBody().Add("delete", collection).Add("ordered", ordered);
+    return request;
+  }
+
+  const String& GetDatabase() const { return database_; }
+
+  int32 GetFlags() const { return flags_; }
+  void SetFlags(int32 flags) { flags_ = flags; }
+
+  bool IsMoreToCome() const { return (flags_ & MSG_MORE_TO_COME) != 0; }
+
+  /**
+   * Returns the command document. The command name must be its first
+   * element; "$db" is added when the request is written.
+   */
+  Document& GetBody() { return body_; }
+
+  /**
+   * Adds an empty document to the sequence with the given identifier and
+   * returns it.
+   */
+  Document& AddDocument(const String& identifier) {
+    DocumentPtr document(new Document());
+    GetSequence(identifier).documents.Add(document);
+    ++document_count_;
+    return *document;
+  }
+
+  /**
+   * Copies an encoded document, for instance one made by a BsonBuilder,
+   * to the sequence with the given identifier.
+   */
+  void AddDocument(const String& identifier, const BsonView& document) {
+    GetSequence(identifier).bson.WriteRawBytes(document.ConstData(),
+                                               document.GetLength());
+    ++document_count_;
+  }
+
+  /**
+   * Adds a document to insert.
+   */
+  Document& AddInsert() { return AddDocument("documents"); }
+
+  void AddInsert(const BsonView& document) {
+    AddDocument("documents", document);
+  }
+
+  /**
+   * Adds an update statement: update is applied to the documents matching
+   * query.
+   */
+  void AddUpdate(DocumentPtr query, DocumentPtr update, bool upsert = false,
+                 bool multi = false) {
+    AddDocument("updates")
+        .Add("q", query)
+        .Add("u", update)
+        .Add("upsert", upsert)
+        .Add("multi", multi);
+  }
+
+  /**
+   * Adds a delete statement for the documents matching query; limit is 0
+   * for all of them or 1 for one.
+   */
+  void AddDelete(DocumentPtr query, int32 limit = 0) {
+    AddDocument("deletes").Add("q", query).Add("limit", limit);
+  }
+
+  /**
+   * Returns the number of documents in all sequences.
+   */
+  int32 GetDocumentCount() const { return document_count_; }
+
+  /**
+   * Sets the write concern of a write command. With w 0 the server sends
+   * no reply, and the request is flagged MSG_MORE_TO_COME.
+   */
+  void SetWriteConcern(int32 w, bool journal = false) {
+    Document& concern = body_.AddNewDocument("writeConcern");
+    concern.Add("w", w);
+    if (journal) {
+      concern.Add("j", true);
+    }
+    if (w == 0) {
+      flags_ |= MSG_MORE_TO_COME;
+    }
+  }
+
+  fun::Array<DocumentSequence>& GetSequences() { return sequences_; }
+
+ protected:
+  void BuildRequest(MessageOut& wirter) override {
+    // struct OP_MSG {
+    //  MsgHeader header;          // standard message header
+    //  uint32    flagBits;        // message flags
+    //  Sections[] sections;       // data sections
+    //  optional<uint32> checksum; // optional CRC-32C checksum
+    //}
+    if (!body_.Exists("$db")) {
+      body_.Add("$db", database_);
+    }
+
+    LiteFormat::Write(wirter, (int32)(flags_ & ~MSG_CHECKSUM_PRESENT));
+
+    // Kind 0: the body.
+    LiteFormat::Write(wirter, (uint8)0);
+    body_.Write(wirter);
+
+    // Kind 1: int32 size, cstring identifier, documents.
+    for (auto& sequence : sequences_) {
+      MessageOut section;
+      BsonWriter(section).WriteCString(sequence.identifier);
+      for (auto& document : sequence.documents) {
+        document->Write(section);
+      }
+      section.WriteRawBytes(sequence.bson.ConstData(),
+                            sequence.bson.GetLength());
+
+      LiteFormat::Write(wirter, (uint8)1);
+      LiteFormat::Write(wirter, (int32)(4 + section.GetLength()));
+      wirter.WriteRawBytes(section.ConstData(), section.GetLength());
+    }
+  }
+
+ private:
+  DocumentSequence& GetSequence(const String& identifier) {
+    for (auto& sequence : sequences_) {
+      if (sequence.identifier == identifier) {
+        return sequence;
+      }
+    }
+    DocumentSequence sequence;
+    sequence.identifier = identifier;
+    sequences_.Add(sequence);
+    return sequences_[sequences_.Count() - 1];
+  }
+
+  String database_;
+  int32 flags_;
+  Document body_;
+  fun::Array<DocumentSequence> sequences_;
+  int32 document_count_ = 0;
+};
+
+}  // namespace mongodb
+}  // namespace fun
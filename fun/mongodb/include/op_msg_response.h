@@ -0,0 +1,191 @@
+﻿#pragma once
+
+#include "fun/mongodb/bson_view.h"
+#include "fun/mongodb/document.h"
+#include "fun/mongodb/message.h"
+#include "fun/mongodb/op_msg_request.h"
+
+namespace fun {
+namespace mongodb {
+
+typedef SharedPtr<class OpMsgResponse> OpMsgResponsePtr;
+
+/**
+ * A reply to an OpMsgRequest (OP_MSG).
+ *
+ * The reply of a command is its body. It is kept encoded: GetBodyView()
+ * reads fields in place, and GetBody() decodes it into a Document the
+ * first time it is called. Document sequences are kept encoded as well,
+ * and decoded by the first GetSequence(). A server streaming an exhaust
+ * cursor sets MSG_MORE_TO_COME on every reply but the last one.
+ */
+class FUN_MONGODB_API OpMsgResponse : public Message {
+ public:
+  OpMsgResponse()
+      : Message(MessageHeader::OP_MSG), flags_(0), body_decoded_(false) {}
+
+  // virtual ~OpMsgResponse() {}
+
+  void Reset() {
+    flags_ = 0;
+    body_bytes_.Clear();
+    body_view_ = BsonView();
+    body_.Reset();
+    body_decoded_ = false;
+    sequences_.Clear();
+  }
+
+  int32 GetFlags() const { return flags_; }
+
+  bool IsMoreToCome() const {
+    return (flags_ & OpMsgRequest::MSG_MORE_TO_COME) != 0;
+  }
+
+  /**
+   * Returns the body without decoding it. The view is valid until the
+   * response is reset or destroyed.
+   */
+  const BsonView& GetBodyView() const { return body_view_; }
+
+  /**
+   * Returns the encoded body. The bytes are shared, not copied, so a
+   * reader can keep them past the response to read views into them.
+   */
+  const ByteArray& GetBodyBytes() const { return body_bytes_; }
+
+  Document& GetBody() {
+    if (!body_decoded_ && body_view_.IsValid()) {
+      MessageIn reader(body_bytes_);
+      body_.Read(reader);
+    }
+    body_decoded_ = true;
+    return body_;
+  }
+
+  /**
+   * Returns true if the command succeeded, that is the body has "ok": 1.
+   */
+  bool IsOk() const {
+    const BsonView::Value ok = body_view_.Find("ok");
+    return ok.IsValid() && ok.GetInteger() == 1;
+  }
+
+  /**
+   * Returns the documents of the sequence with the given identifier, or
+   * nullptr if the reply has none.
+   */
+  fun::Array<DocumentPtr>* GetSequence(const String& identifier) {
+    for (auto& sequence : sequences_) {
+      if (sequence.identifier == identifier) {
+        if (!sequence.decoded) {
+          MessageIn section(sequence.section);
+          while (section.ReadableLength() > 0) {
+            DocumentPtr document(new Document());
+            document->Read(section);
+            sequence.documents.Add(document);
+          }
+          sequence.decoded = true;
+        }
+        return &sequence.documents;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Replaces views with the documents of the sequence with the given
+   * identifier, without decoding them. Returns false if the reply has no
+   * such sequence. The views are valid until the response is reset or
+   * destroyed.
+   */
+  bool GetSequenceViews(const String& identifier,
+                        fun::Array<BsonView>& views) const {
+    for (const auto& sequence : sequences_) {
+      if (sequence.identifier == identifier) {
+        views.Clear();
+        const uint8* p = sequence.section.ReadablePtr();
+        int32 remaining = sequence.section.ReadableLength();
+        while (remaining > 0) {
+          const BsonView view(p, remaining);
+          views.Add(view);
+          p += view.GetLength();
+          remaining -= view.GetLength();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void SetHeader(const MessageHeader& header) { header_ = header; }
+
+  /**
+   * Reads the payload; reader must hold exactly the message after the
+   * header.
+   */
+  void Read(MessageIn& reader) {
+    Reset();
+
+    uint32 flags;
+    LiteFormat::Read(reader, flags);
+    flags_ = (int32)flags;
+
+    // A checksum, which is not verified, ends the message.
+    const int32 trailer =
+        (flags_ & OpMsgRequest::MSG_CHECKSUM_PRESENT) ? 4 : 0;
+
+    while (reader.ReadableLength() > trailer) {
+      uint8 kind;
+      LiteFormat::Read(reader, kind);
+      if (kind == 0) {
+        // Copied once, as it is, and decoded on demand.
+        if (reader.ReadableLength() < 4) {
+          throw IoException("Invalid OP_MSG body");
+        }
+        const uint8* p = reader.ReadablePtr();
+        const int32 size = (int32)(uint32(p[0]) | (uint32(p[1]) << 8) |
+                                   (uint32(p[2]) << 16) | (uint32(p[3]) << 24));
+        if (size < 5 || !reader.ReadAsCopy(body_bytes_, size)) {
+          throw IoException("Invalid OP_MSG body");
+        }
+        body_view_ = BsonView(body_bytes_.ConstData(), body_bytes_.Len());
+      } else if (kind == 1) {
+        int32 size;
+        LiteFormat::Read(reader, size);
+        MessageIn section;
+        if (size < 4 || !reader.ReadAsShared(section, size - 4)) {
+          throw IoException("Invalid OP_MSG document sequence");
+        }
+
+        // Shares the buffer; the documents are decoded on demand.
+        Sequence sequence;
+        sequence.identifier = BsonReader(section).ReadCString();
+        sequence.section = section;
+        sequence.decoded = false;
+        sequences_.Add(sequence);
+      } else {
+        throw IoException(
+            String::Format("Unknown OP_MSG section kind %d", (int32)kind));
+      }
+    }
+    reader.SkipRead(trailer);
+  }
+
+ private:
+  struct Sequence {
+    String identifier;
+    MessageIn section;
+    bool decoded;
+    fun::Array<DocumentPtr> documents;
+  };
+
+  int32 flags_;
+  ByteArray body_bytes_;
+  BsonView body_view_;
+  Document body_;
+  bool body_decoded_;
+  fun::Array<Sequence> sequences_;
+};
+
+}  // namespace mongodb
+}  // namespace fun
@@ -0,0 +1,302 @@
+﻿#include "fun/mongodb/pipelined_connection.h"
+#include "fun/mongodb/array.h"
+#include "fun/net/engine/compressor.h"
+
+namespace fun {
+namespace mongodb {
+
+namespace {
+
+// Defaults of maxBsonObjectSize and maxMessageSizeBytes, until hello
+// tells the actual limits.
+const int32 DEFAULT_MAX_BSON_OBJECT_SIZE = 16 * 1024 * 1024;
+const int32 DEFAULT_MAX_MESSAGE_SIZE = 48 * 1000 * 1000;
+
+}  // namespace
+
+PipelinedConnection::Options::Options()
+    : max_buffered_bytes(256 * 1024),
+      max_pending_requests(64),
+      compression(false),
+      min_compress_size(1024) {}
+
+PipelinedConnection::PipelinedConnection(const StreamSocket& socket,
+                                         const Options& options)
+    : socket_(socket),
+      options_(options),
+      compressing_(false),
+      max_bson_object_size_(DEFAULT_MAX_BSON_OBJECT_SIZE),
+      max_message_size_(DEFAULT_MAX_MESSAGE_SIZE),
+      next_request_id_(1) {}
+
+PipelinedConnection::~PipelinedConnection() {}
+
+bool PipelinedConnection::Handshake() {
+  OpMsgRequest hello("admin");
+  hello.GetBody().Add("hello", (int32)1);
+  if (options_.compression) {
+    ArrayPtr compressors(new Array());
+    compressors->Add("0", "zlib");
+    hello.GetBody().Add("compression", compressors);
+  }
+
+  bool agreed = false;
+  const int32 id = Send(hello, [this, &agreed](OpMsgResponse& response) {
+    const BsonView& body = response.GetBodyView();
+
+    const BsonView::Value max_bson_object_size =
+        body.Find("maxBsonObjectSize");
+    if (max_bson_object_size.IsValid()) {
+      max_bson_object_size_ = (int32)max_bson_object_size.GetInteger();
+    }
+    const BsonView::Value max_message_size = body.Find("maxMessageSizeBytes");
+    if (max_message_size.IsValid()) {
+      max_message_size_ = (int32)max_message_size.GetInteger();
+    }
+
+    const BsonView::Value accepted = body.Find("compression");
+    if (accepted.GetType() != BsonView::BSON_ARRAY) {
+      return;
+    }
+    for (const BsonView::Value& item : accepted.AsDocument()) {
+      if (item.GetType() == BsonView::BSON_STRING &&
+          item.AsString() == "zlib") {
+        agreed = true;
+      }
+    }
+  });
+  Wait(id);
+
+  compressing_ = agreed;
+  return agreed;
+}
+
+int32 PipelinedConnection::Send(OpMsgRequest& request,
+                                const ResponseHandler& handler) {
+  while (options_.max_pending_requests > 0 &&
+         GetPendingCount() >= options_.max_pending_requests) {
+    Receive();
+  }
+
+  // Skips the IDs an exhaust cursor waits on, so that a reply can always
+  // be told apart.
+  int32 request_id;
+  do {
+    request_id = next_request_id_++;
+    if (next_request_id_ <= 0) {
+      next_request_id_ = 1;
+    }
+  } while (exhaust_.find(request_id) != exhaust_.end());
+  request.GetHeader().SetRequestId(request_id);
+  Append(request);
+
+  if (!request.IsMoreToCome()) {
+    PendingRequest& pending = pending_[request_id];
+    pending.request_id = request_id;
+    pending.handler = handler;
+  }
+
+  if (send_buffer_.GetLength() >= options_.max_buffered_bytes) {
+    Flush();
+  }
+  return request_id;
+}
+
+void PipelinedConnection::Flush() {
+  const uint8* data = send_buffer_.ConstData();
+  const int32 length = send_buffer_.GetLength();
+  int32 sent = 0;
+  while (sent < length) {
+    const int32 n = socket_.SendBytes(data + sent, length - sent);
+    if (n <= 0) {
+      throw IoException("Failed to send to MongoDB");
+    }
+    sent += n;
+  }
+  send_buffer_.SetLength(0);
+}
+
+bool PipelinedConnection::Receive() {
+  if (pending_.empty() && exhaust_.empty()) {
+    return false;
+  }
+  Flush();
+
+  receive_buffer_.SetLength(0);
+  ReadFully(receive_buffer_.LockForWrite(MessageHeader::MSG_HEADER_SIZE),
+            MessageHeader::MSG_HEADER_SIZE);
+  receive_buffer_.Unlock(MessageHeader::MSG_HEADER_SIZE);
+
+  MessageHeader header(MessageHeader::OP_MSG);
+  MessageIn header_reader(receive_buffer_);
+  header.Read(header_reader);
+
+  const int32 payload_length =
+      header.GetMessageLength() - MessageHeader::MSG_HEADER_SIZE;
+  if (payload_length < 0 || header.GetMessageLength() > max_message_size_) {
+    throw IoException("Invalid MongoDB message length");
+  }
+  ReadFully(receive_buffer_.LockForWrite(payload_length), payload_length);
+  receive_buffer_.Unlock(payload_length);
+
+  MessageIn reader(receive_buffer_, MessageHeader::MSG_HEADER_SIZE,
+                   payload_length);
+  int32 opcode = (int32)header.GetOpcode();
+
+  MessageOut decompressed;
+  if (opcode == OP_COMPRESSED) {
+    // struct OP_COMPRESSED {
+    //  MsgHeader header;
+    //  int32  originalOpcode;
+    //  int32  uncompressedSize;
+    //  uint8  compressorId;
+    //  char*  compressedMessage;
+    //}
+    int32 uncompressed_size;
+    uint8 compressor_id;
+    LiteFormat::Read(reader, opcode);
+    LiteFormat::Read(reader, uncompressed_size);
+    LiteFormat::Read(reader, compressor_id);
+    if (compressor_id != COMPRESSOR_ZLIB) {
+      throw NotImplementedException(String::Format(
+          "MongoDB compressor %d is not supported", (int32)compressor_id));
+    }
+    if (uncompressed_size < 0 || uncompressed_size > max_message_size_) {
+      throw IoException("Invalid MongoDB message length");
+    }
+
+    int32 length = uncompressed_size;
+    String error;
+    if (!net::Compressor::Zip_Decompress(
+            decompressed.LockForWrite(length), &length, reader.ReadablePtr(),
+            reader.ReadableLength(), &error) ||
+        length != uncompressed_size) {
+      decompressed.Unlock(0);
+      throw IoException("Failed to decompress a MongoDB message: " + error);
+    }
+    decompressed.Unlock(length);
+    reader = MessageIn(decompressed);
+  }
+
+  if (opcode != MessageHeader::OP_MSG) {
+    throw IoException(
+        String::Format("Unexpected MongoDB reply opcode %d", opcode));
+  }
+
+  OpMsgResponse response;
+  response.SetHeader(header);
+  response.Read(reader);
+
+  PendingRequest pending;
+  auto it = exhaust_.find(header.GetResponseTo());
+  if (it != exhaust_.end()) {
+    pending = it->second;
+    exhaust_.erase(it);
+  } else {
+    it = pending_.find(header.GetResponseTo());
+    if (it == pending_.end()) {
+      throw IoException(String::Format("MongoDB reply to unknown request %d",
+                                       header.GetResponseTo()));
+    }
+    pending = it->second;
+    pending_.erase(it);
+  }
+
+  // The next reply of an exhaust cursor answers this one. The server picks
+  // its reply IDs on its own, so one may equal the ID of a request of ours
+  // that is still waiting; the two replies could not be told apart.
+  if (response.IsMoreToCome()) {
+    const int32 reply_id = header.GetRequestId();
+    if (pending_.find(reply_id) != pending_.end() ||
+        exhaust_.find(reply_id) != exhaust_.end()) {
+      throw IoException(String::Format(
+          "MongoDB exhaust reply ID %d collides with a pending request",
+          reply_id));
+    }
+    exhaust_[reply_id] = pending;
+  }
+
+  if (pending.handler) {
+    pending.handler(response);
+  }
+  return true;
+}
+
+void PipelinedConnection::Wait(int32 request_id) {
+  while (IsPending(request_id)) {
+    Receive();
+  }
+}
+
+void PipelinedConnection::WaitAll() {
+  // Unacknowledged writes leave nothing pending, but must still go out.
+  Flush();
+  while (Receive()) {
+  }
+}
+
+void PipelinedConnection::Append(Request& request) {
+  if (!compressing_) {
+    request.WriteTo(send_buffer_);
+    return;
+  }
+
+  MessageOut message;
+  request.WriteTo(message);
+  const int32 payload_length =
+      message.GetLength() - MessageHeader::MSG_HEADER_SIZE;
+  const uint8* payload = message.ConstData() + MessageHeader::MSG_HEADER_SIZE;
+
+  if (payload_length >= options_.min_compress_size) {
+    MessageOut compressed;
+    int32 length = net::Compressor::Zip_GetMaxCompressedlen(payload_length);
+    String error;
+    if (net::Compressor::Zip_Compress(compressed.LockForWrite(length),
+                                      &length, payload, payload_length,
+                                      &error)) {
+      compressed.Unlock(length);
+
+      const int32 header_size = MessageHeader::MSG_HEADER_SIZE + 9;
+      LiteFormat::Write(send_buffer_, header_size + length);
+      LiteFormat::Write(send_buffer_, request.GetHeader().GetRequestId());
+      LiteFormat::Write(send_buffer_, (int32)0);
+      LiteFormat::Write(send_buffer_, OP_COMPRESSED);
+      LiteFormat::Write(send_buffer_, (int32)request.GetHeader().GetOpcode());
+      LiteFormat::Write(send_buffer_, payload_length);
+      LiteFormat::Write(send_buffer_, COMPRESSOR_ZLIB);
+      send_buffer_.WriteRawBytes(compressed.ConstData(), length);
+      return;
+    }
+    // Sent as it is if it does not compress.
+    compressed.Unlock(0);
+  }
+
+  send_buffer_.WriteRawBytes(message.ConstData(), message.GetLength());
+}
+
+void PipelinedConnection::ReadFully(void* buffer, int32 length) {
+  uint8* p = static_cast<uint8*>(buffer);
+  while (length > 0) {
+    const int32 n = socket_.ReceiveBytes(p, length);
+    if (n <= 0) {
+      throw IoException("MongoDB connection closed");
+    }
+    p += n;
+    length -= n;
+  }
+}
+
+bool PipelinedConnection::IsPending(int32 request_id) const {
+  if (pending_.find(request_id) != pending_.end()) {
+    return true;
+  }
+  for (const auto& pair : exhaust_) {
+    if (pair.second.request_id == request_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace mongodb
+}  // namespace fun
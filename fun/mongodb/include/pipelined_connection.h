@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include <map>
+
+#include "fun/mongodb/op_msg_request.h"
+#include "fun/mongodb/op_msg_response.h"
+
+namespace fun {
+namespace mongodb {
+
+/**
+ * A connection that sends OP_MSG requests without waiting for the
+ * replies in between.
+ *
+ * Connection::Call() writes a request and blocks until its reply has
+ * arrived, so every request costs a round trip. Here requests are
+ * buffered and written together by Flush(); the replies are matched to
+ * their requests by the responseTo field of the header and handed to the
+ * handler given to Send():
+ *
+ *   PipelinedConnection connection(socket);
+ *   for (auto& request : requests) {
+ *     connection.Send(*request, [&](OpMsgResponse& response) { ... });
+ *   }
+ *   connection.WaitAll();
+ *
+ * A request sent with MSG_EXHAUST_ALLOWED may be answered by a stream of
+ * replies, each flagged MSG_MORE_TO_COME but the last; the handler is
+ * called for every one of them. A request flagged MSG_MORE_TO_COME
+ * itself (an unacknowledged write) gets no reply.
+ *
+ * With Options::compression the messages are sent as OP_COMPRESSED with
+ * zlib, once the server has agreed to it in Handshake().
+ *
+ * A PipelinedConnection is not thread safe.
+ */
+class FUN_MONGODB_API PipelinedConnection {
+ public:
+  typedef Function<void(OpMsgResponse&)> ResponseHandler;
+
+  struct FUN_MONGODB_API Options {
+    Options();
+
+    /** Flush() is called by Send() when this much is buffered. */
+    int32 max_buffered_bytes;
+
+    /** Send() waits for replies while this many requests are pending. */
+    int32 max_pending_requests;
+
+    /** Compress messages with zlib if the server supports it. */
+    bool compression;
+
+    /** Messages shorter than this are never compressed. */
+    int32 min_compress_size;
+  };
+
+  explicit PipelinedConnection(const StreamSocket& socket,
+                               const Options& options = Options());
+  ~PipelinedConnection();
+
+  /**
+   * Sends hello and waits for the reply. Records the server's size
+   * limits and, with Options::compression, offers zlib and enables
+   * compression if the server picked it. Returns true if it did.
+   */
+  bool Handshake();
+
+  bool IsCompressing() const { return compressing_; }
+
+  /**
+   * maxBsonObjectSize of the server, 16MB until Handshake() says otherwise.
+   */
+  int32 GetMaxBsonObjectSize() const { return max_bson_object_size_; }
+
+  /**
+   * maxMessageSizeBytes of the server, 48MB until Handshake() says
+   * otherwise.
+   */
+  int32 GetMaxMessageSize() const { return max_message_size_; }
+
+  /**
+   * Assigns a request ID to request and buffers it. handler is called
+   * from Receive(), Wait() or WaitAll() with the reply. Returns the
+   * request ID.
+   */
+  int32 Send(OpMsgRequest& request,
+             const ResponseHandler& handler = ResponseHandler());
+
+  /**
+   * Writes the buffered requests to the socket.
+   */
+  void Flush();
+
+  /**
+   * Reads one reply and calls its handler. Returns false if no reply is
+   * expected.
+   */
+  bool Receive();
+
+  /**
+   * Flushes and reads replies until the request with the given ID, and
+   * every reply it streams, has been handled.
+   */
+  void Wait(int32 request_id);
+
+  /**
+   * Flushes, even if no request is pending, and reads replies until
+   * none is.
+   */
+  void WaitAll();
+
+  /**
+   * Returns the number of requests whose replies have not been handled.
+   */
+  int32 GetPendingCount() const {
+    return (int32)(pending_.size() + exhaust_.size());
+  }
+
+  /**
+   * Returns true if the request with the given ID still expects a reply.
+   */
+  bool IsPending(int32 request_id) const;
+
+ private:
+  static const int32 OP_COMPRESSED = 2012;
+  static const uint8 COMPRESSOR_ZLIB = 2;
+
+  struct PendingRequest {
+    int32 request_id;
+    ResponseHandler handler;
+  };
+
+  void Append(Request& request);
+  void ReadFully(void* buffer, int32 length);
+
+  StreamSocket socket_;
+  Options options_;
+  bool compressing_;
+  int32 max_bson_object_size_;
+  int32 max_message_size_;
+  int32 next_request_id_;
+  MessageOut send_buffer_;
+  MessageOut receive_buffer_;
+  // By the ID of our request.
+  std::map<int32, PendingRequest> pending_;
+  // Exhaust cursors, by the ID of the previous reply, which the next reply
+  // will answer.
+  std::map<int32, PendingRequest> exhaust_;
+};
+
+}  // namespace mongodb
+}  // namespace fun
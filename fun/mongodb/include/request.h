@@ -15,6 +15,18 @@ class FUN_MONGODB_API Request : public Message {
   explicit Request(MessageHeader::OpCode opcode) : Message(opcode) {}
   // virtual ~Request() {}
 
+  /**
+   * Appends the whole message, header and payload, to writer. The
+   * request ID must have been set.
+   */
+  void WriteTo(MessageOut& writer) {
+    MessageOut payload;
+    BuildRequest(payload);
+    SetMessageLength(payload.GetLength());
+    header_.Write(writer);
+    writer.WriteRawBytes(payload.ConstData(), payload.GetLength());
+  }
+
   void WireSend(std::ostream& os) {
     // TODO
     // struct MsgHeader {
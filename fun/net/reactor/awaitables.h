@@ -0,0 +1,165 @@
+#pragma once
+
+#include "fun/base/async/task.h"
+#include "fun/net/reactor/event_loop.h"
+#include "fun/net/reactor/tcp_connection.h"
+
+#if FUN_WITH_COROUTINES
+
+namespace fun {
+namespace net {
+
+/**
+ * Awaitables for coroutines running on an EventLoop thread.
+ *
+ *   async::Task<> Echo(reactor::TcpConnectionPtr conn) {
+ *     while (Buffer* in = co_await AsyncRead(conn)) {
+ *       String data = in->RetrieveAllAsString();
+ *       if (!co_await AsyncWrite(conn, data)) {
+ *         break;
+ *       }
+ *     }
+ *   }
+ *
+ * All of them must be awaited on the loop thread that owns the connection
+ * (or, for Sleep(), on any loop thread), and the coroutine is resumed on
+ * that same thread, so no locking is needed between awaits.
+ */
+
+class SleepAwaiter {
+ public:
+  explicit SleepAwaiter(double seconds) : seconds_(seconds) {}
+
+  bool await_ready() const noexcept { return seconds_ <= 0.0; }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    EventLoop* loop = EventLoop::GetEventLoopOfCurrentThread();
+    fun_check_msg(loop, "Sleep() must be awaited on an EventLoop thread");
+    loop->ScheduleAfter(seconds_, [awaiting]() { awaiting.resume(); });
+  }
+
+  void await_resume() const noexcept {}
+
+ private:
+  double seconds_;
+};
+
+/**
+ * Suspends the coroutine for the given number of seconds using the
+ * current loop's timer queue.
+ */
+inline SleepAwaiter Sleep(double seconds) { return SleepAwaiter(seconds); }
+
+class ReadAwaiter {
+ public:
+  ReadAwaiter(const reactor::TcpConnectionPtr& conn, size_t min_bytes)
+      : conn_(conn), min_bytes_(min_bytes) {}
+
+  bool await_ready() const {
+    conn_->GetLoop()->AssertInLoopThread();
+    return !conn_->IsConnected() ||
+           conn_->GetInputBuffer()->GetReadableLength() >= min_bytes_;
+  }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    conn_->SetReadWaiter(min_bytes_, [awaiting]() { awaiting.resume(); });
+  }
+
+  Buffer* await_resume() const {
+    Buffer* input = conn_->GetInputBuffer();
+    if (input->GetReadableLength() >= min_bytes_) {
+      return input;
+    }
+    return nullptr;
+  }
+
+ private:
+  reactor::TcpConnectionPtr conn_;
+  size_t min_bytes_;
+};
+
+/**
+ * Waits until the connection's input buffer holds at least min_bytes.
+ *
+ * Yields the input buffer, which the coroutine consumes from as it would
+ * in a message callback, or nullptr once the connection is closed with
+ * fewer bytes buffered. While a read is awaited the connection's message
+ * callback is not called.
+ */
+inline ReadAwaiter AsyncRead(const reactor::TcpConnectionPtr& conn,
+                             size_t min_bytes = 1) {
+  return ReadAwaiter(conn, min_bytes);
+}
+
+class WriteAwaiter {
+ public:
+  WriteAwaiter(const reactor::TcpConnectionPtr& conn, const StringPiece& data)
+      : conn_(conn), data_(data) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> awaiting) {
+    conn_->GetLoop()->AssertInLoopThread();
+    if (!conn_->IsConnected()) {
+      return false;
+    }
+
+    conn_->Send(data_);
+    if (conn_->GetOutputBuffer()->GetReadableLength() == 0) {
+      // Written straight to the socket; carry on without suspending.
+      return false;
+    }
+
+    conn_->SetWriteWaiter([awaiting]() { awaiting.resume(); });
+    return true;
+  }
+
+  bool await_resume() const {
+    return conn_->IsConnected() &&
+           conn_->GetOutputBuffer()->GetReadableLength() == 0;
+  }
+
+ private:
+  reactor::TcpConnectionPtr conn_;
+  StringPiece data_;
+};
+
+/**
+ * Sends data and waits until it has been handed to the kernel.
+ *
+ * Yields false if the connection closed before everything was written.
+ * data only needs to stay valid until the co_await expression starts.
+ */
+inline WriteAwaiter AsyncWrite(const reactor::TcpConnectionPtr& conn,
+                               const StringPiece& data) {
+  return WriteAwaiter(conn, data);
+}
+
+class ResumeOnAwaiter {
+ public:
+  explicit ResumeOnAwaiter(EventLoop* loop) : loop_(loop) {}
+
+  bool await_ready() const { return loop_->IsInLoopThread(); }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    loop_->QueueInLoop([awaiting]() { awaiting.resume(); });
+  }
+
+  void await_resume() const noexcept {}
+
+ private:
+  EventLoop* loop_;
+};
+
+/**
+ * Continues the coroutine on the given loop's thread, e.g. to get back
+ * to the connection's loop after awaiting work done elsewhere.
+ */
+inline ResumeOnAwaiter ResumeOn(EventLoop* loop) {
+  return ResumeOnAwaiter(loop);
+}
+
+}  // namespace net
+}  // namespace fun
+
+#endif  // FUN_WITH_COROUTINES
@@ -17,13 +17,15 @@ EventLoop::EventLoop()
       timer_queue_(new TimerQueue(this)),
       wakeup_fd_(CreateEventfd()),
       wakeup_channel_(new Channel(this, wakeup_fd_)),
-      current_active_channel_(nullptr) {
+      current_active_channel_(nullptr),
+      frame_pool_(async::FramePool::Create()) {
   if (loop_in_this_thread_) {
     // event loop 객체는 thread당 하나만 있어야함.
     // 예외를 던지던지 panic.
   }
 
   loop_in_this_thread_ = this;
+  async::FramePool::SetCurrent(frame_pool_);
 
   wakeup_channel_->SetReadCallback([this]() { HandleRead(); });
   wakeup_channel_->EnableReading();
@@ -34,6 +36,7 @@ EventLoop::~EventLoop() {
   wakeup_channel_->Remove();
   close(wakeup_fd_);
   loop_in_this_thread_ = nullptr;
+  frame_pool_->Release();
 }
 
 void EventLoop::Loop() {
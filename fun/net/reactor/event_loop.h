@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include "fun/base/async/frame_pool.h"
 #include "fun/base/container/array.h"
 #include "fun/base/shared_ptr.h"
 #include "fun/base/timestamp.h"
@@ -70,6 +71,12 @@ class EventLoop : Noncopyable {
 
   static EventLoop* GetEventLoopOfCurrentThread();
 
+  /**
+   * Coroutine frames created on this loop's thread are recycled through
+   * this pool (see fun/base/async/task.h).
+   */
+  async::FramePool* GetFramePool() const { return frame_pool_; }
+
  private:
   void AbortNotInLoopThread();
   void HandleRead();  // for wakeup
@@ -98,6 +105,8 @@ class EventLoop : Noncopyable {
 
   Mutex mutex_;
   Array<Functor> pending_functors_;
+
+  async::FramePool* frame_pool_;
 };
 
 }  // namespace net
@@ -0,0 +1,42 @@
+﻿#include "fun/net/reactor/http/metrics_exporter.h"
+#include "fun/net/reactor/http/http_request.h"
+#include "fun/net/reactor/http/http_response.h"
+
+namespace fun {
+namespace net {
+
+MetricsExporter::MetricsExporter(HttpServer* server,
+                                 const String& path,
+                                 const HttpServer::HttpCallback& fallback,
+                                 MetricsRegistry& registry)
+  : path_(path)
+  , fallback_(fallback)
+  , registry_(registry) {
+  server->SetHttpCallback([this](const HttpRequest& req, HttpResponse* resp) {
+    OnRequest(req, resp);
+  });
+}
+
+void MetricsExporter::OnRequest(const HttpRequest& req, HttpResponse* resp) {
+  if (req.GetPath() != path_) {
+    if (fallback_) {
+      fallback_(req, resp);
+    } else {
+      resp->SetStatusCode(HttpResponse::k404NotFound);
+      resp->SetStatusMessage("Not Found");
+      resp->SetCloseConnection(true);
+    }
+    return;
+  }
+
+  String body;
+  registry_.ExportPrometheus(body);
+
+  resp->SetStatusCode(HttpResponse::k200Ok);
+  resp->SetStatusMessage("OK");
+  resp->SetContentType("text/plain; version=0.0.4; charset=utf-8");
+  resp->SetBody(body);
+}
+
+} // namespace net
+} // namespace fun
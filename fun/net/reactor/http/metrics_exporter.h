@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "fun/base/metrics.h"
+#include "fun/net/reactor/http/http_server.h"
+
+namespace fun {
+namespace net {
+
+/**
+ * Serves a MetricsRegistry in the Prometheus text format from an
+ * HttpServer.
+ *
+ *   HttpServer server(loop, InetAddress(9100), "metrics");
+ *   MetricsExporter exporter(&server);
+ *   server.Start();
+ *
+ * Requests for other paths go to fallback, or are answered with 404.
+ * The exporter installs itself as the http callback of the server and must
+ * outlive it.
+ */
+class MetricsExporter : Noncopyable {
+ public:
+  MetricsExporter(HttpServer* server,
+                  const String& path = "/metrics",
+                  const HttpServer::HttpCallback& fallback =
+                      HttpServer::HttpCallback(),
+                  MetricsRegistry& registry = MetricsRegistry::Default());
+
+ private:
+  void OnRequest(const HttpRequest& req, HttpResponse* resp);
+
+  String path_;
+  HttpServer::HttpCallback fallback_;
+  MetricsRegistry& registry_;
+};
+
+} // namespace net
+} // namespace fun
@@ -27,6 +27,7 @@ TcpConnection::TcpConnection(EventLoop* loop, const String& name, int sock_fd,
       channel_(new Channel(loop, sock_fd)),
       localAddr_(local_addr),
       peer_addr_(peer_addr),
+      read_waiter_min_bytes_(0),
       high_water_mark_(64 * 1024 * 1024) {
   channel_->SetReadCallback(boost::bind(&TcpConnection::HandleRead, this, _1));
   channel_->SetWriteCallback(boost::bind(&TcpConnection::HandleWrite, this));
@@ -258,6 +259,31 @@ void TcpConnection::StopReadInLoop() {
   }
 }
 
+void TcpConnection::SetReadWaiter(size_t min_bytes,
+                                  const WaiterCallback& waiter) {
+  loop_->AssertInLoopThread();
+  fun_check(!read_waiter_);
+
+  read_waiter_ = waiter;
+  read_waiter_min_bytes_ = min_bytes;
+}
+
+void TcpConnection::SetWriteWaiter(const WaiterCallback& waiter) {
+  loop_->AssertInLoopThread();
+  fun_check(!write_waiter_);
+
+  write_waiter_ = waiter;
+}
+
+void TcpConnection::FireWaiter(WaiterCallback& waiter) {
+  if (waiter) {
+    // The waiter usually resumes a coroutine that installs the next one.
+    WaiterCallback callback(MoveTemp(waiter));
+    waiter = WaiterCallback();
+    callback();
+  }
+}
+
 void TcpConnection::ConnectEstablished() {
   loop_->AssertInLoopThread();
 
@@ -289,6 +315,13 @@ void TcpConnection::HandleRead(const Timestamp& received_time) {
   int saved_errno = 0;
   ssize_t n = input_buffer_.ReadFd(channel_->fd(), &saved_errno);
   if (n > 0) {
+    if (read_waiter_) {
+      if (input_buffer_.GetReadableLength() >= read_waiter_min_bytes_) {
+        FireWaiter(read_waiter_);
+      }
+      return;
+    }
+
     // warning message_cb_에서는 받은 메시지만큼 제외해주어야함.
     message_cb_(SharedFromThis(), &input_buffer_, received_time);
 
@@ -323,6 +356,8 @@ void TcpConnection::HandleWrite() {
         if (state_ == kDisconnecting) {
           ShutdownInLoop();
         }
+
+        FireWaiter(write_waiter_);
       }
     } else {
       LOG_SYSERR << "TcpConnection::HandleWrite";
@@ -347,6 +382,8 @@ void TcpConnection::HandleClose() {
 
   TcpConnectionPtr guard_this(SharedFromThis());
   connection_cb_(guard_this);
+  FireWaiter(read_waiter_);
+  FireWaiter(write_waiter_);
   // must be the last line
   close_cb_(guard_this);
 }
@@ -85,6 +85,20 @@ class TcpConnection : Noncopyable, public EnableSharedFromThis<TcpConnection> {
     high_water_mark_ = high_water_mark;
   }
 
+  typedef Function<void()> WaiterCallback;
+
+  /**
+   * Coroutine support for the awaitables in fun/net/reactor/awaitables.h.
+   *
+   * A read waiter is called instead of the message callback as soon as
+   * the input buffer holds at least min_bytes. A write waiter is called
+   * once the output buffer has been flushed. Pending waiters are also
+   * called when the connection closes. Loop thread only, at most one of
+   * each at a time; a waiter is cleared before it is called.
+   */
+  void SetReadWaiter(size_t min_bytes, const WaiterCallback& waiter);
+  void SetWriteWaiter(const WaiterCallback& waiter);
+
   /// Advanced interface
   Buffer* GetInputBuffer() { return &input_buffer_; }
 
@@ -114,6 +128,7 @@ class TcpConnection : Noncopyable, public EnableSharedFromThis<TcpConnection> {
   const char* StateToString() const;
   void StartReadInLoop();
   void StopReadInLoop();
+  static void FireWaiter(WaiterCallback& waiter);
 
   EventLoop* loop_;
   const String name_;
@@ -129,6 +144,9 @@ class TcpConnection : Noncopyable, public EnableSharedFromThis<TcpConnection> {
   WriteCompleteCallback write_complete_cb_;
   HighWaterMarkCallback high_watermark_cb_;
   CloseCallback close_cb_;
+  WaiterCallback read_waiter_;
+  size_t read_waiter_min_bytes_;
+  WaiterCallback write_waiter_;
   size_t high_water_mark_;
   Buffer input_buffer_;
   Buffer output_buffer_;  // FIXME: use list<Buffer> as output buffer.
@@ -0,0 +1,405 @@
+#include "fun/net/rest/radix_router.h"
+#include "fun/base/exception.h"
+
+#include <cstring>
+
+namespace fun {
+namespace rest {
+
+namespace {
+
+struct BuildEdge {
+  String label;
+  int32 child;
+};
+
+struct BuildNode {
+  Array<BuildEdge> statics;
+  int32 param_child = -1;
+  int32 splat_child = -1;
+  int32 route = -1;
+};
+
+/**
+ * Orders segments by length first, then by bytes. Any total order
+ * works for the binary search; checking the length first rejects most
+ * candidates without touching the label bytes.
+ */
+inline int32 CompareSegment(const char* a, int32 a_len, const char* b,
+                            int32 b_len) {
+  if (a_len != b_len) {
+    return a_len < b_len ? -1 : 1;
+  }
+  return a_len == 0 ? 0 : ::memcmp(a, b, a_len);
+}
+
+inline int32 PathLength(const StringView& path) {
+  const char* data = path.ConstData();
+  const int32 len = path.Len();
+  for (int32 i = 0; i < len; ++i) {
+    if (data[i] == '?' || data[i] == '#') {
+      return i;
+    }
+  }
+  return len;
+}
+
+inline int32 SkipSlashes(const char* path, int32 pos, int32 len) {
+  while (pos < len && path[pos] == '/') {
+    ++pos;
+  }
+  return pos;
+}
+
+inline int32 SegmentEnd(const char* path, int32 pos, int32 len) {
+  while (pos < len && path[pos] != '/') {
+    ++pos;
+  }
+  return pos;
+}
+
+void SplitResource(const String& resource, Array<String>& out_segments) {
+  const char* data = resource.ConstData();
+  const int32 len = resource.Len();
+  int32 pos = SkipSlashes(data, 0, len);
+  while (pos < len) {
+    const int32 end = SegmentEnd(data, pos, len);
+    out_segments.Add(String(data + pos, end - pos));
+    pos = SkipSlashes(data, end, len);
+  }
+}
+
+}  // namespace
+
+bool RouteMatch::FindParam(const StringView& name,
+                           StringView& out_value) const {
+  for (int32 i = 0; i < param_count_; ++i) {
+    if (params_[i].name == name) {
+      out_value = params_[i].value;
+      return true;
+    }
+  }
+  return false;
+}
+
+RadixRouter::RadixRouter() : compiled_(false) {}
+
+void RadixRouter::Add(http::Method method, const String& resource,
+                      int32 route_id) {
+  const int32 method_index = (int32)method;
+  if (method_index <= (int32)http::Method::None ||
+      method_index >= (int32)http::Method::NumMethods) {
+    throw InvalidArgumentException("RadixRouter: invalid method");
+  }
+
+  // Validate and derive the route's shape up front, so that a rejected
+  // resource leaves the router untouched and Compile() cannot fail.
+  // The shape drops parameter names: /users/:id and /users/:name match
+  // exactly the same paths and therefore collide.
+  Array<String> segments;
+  SplitResource(resource, segments);
+
+  String shape = String::FromNumber(method_index);
+  String parent_shape;
+  bool optional = false;
+  int32 param_count = 0;
+  int32 splat_count = 0;
+  for (int32 i = 0; i < segments.Count(); ++i) {
+    const String& segment = segments[i];
+    shape += "/";
+    if (segment.StartsWith(":")) {
+      int32 name_len = segment.Len() - 1;
+      if (segment.EndsWith("?")) {
+        if (i != segments.Count() - 1) {
+          throw InvalidArgumentException(
+              "RadixRouter: only the last parameter can be optional: " +
+              resource);
+        }
+        // The route also terminates at the parent.
+        optional = true;
+        parent_shape = shape.Left(shape.Len() - 1);
+        --name_len;
+      }
+      if (name_len <= 0) {
+        throw InvalidArgumentException(
+            "RadixRouter: empty parameter name: " + resource);
+      }
+      if (++param_count > RouteMatch::MAX_PARAMS) {
+        throw InvalidArgumentException("RadixRouter: too many parameters: " +
+                                       resource);
+      }
+      shape += ":";
+    } else if (segment == "*") {
+      if (++splat_count > RouteMatch::MAX_SPLATS) {
+        throw InvalidArgumentException("RadixRouter: too many splats: " +
+                                       resource);
+      }
+      shape += "*";
+    } else {
+      shape += segment;
+    }
+  }
+
+  if (shapes_.Contains(shape) ||
+      (optional && shapes_.Contains(parent_shape))) {
+    throw ExistsException("RadixRouter: duplicate route: " + resource);
+  }
+  shapes_.Add(MoveTemp(shape));
+  if (optional) {
+    shapes_.Add(MoveTemp(parent_shape));
+  }
+
+  PendingRoute route;
+  route.method = method;
+  route.resource = resource;
+  route.route_id = route_id;
+  pending_.Add(MoveTemp(route));
+  compiled_ = false;
+}
+
+void RadixRouter::Clear() {
+  pending_.Clear();
+  shapes_.Clear();
+  for (auto& table : tables_) {
+    table.nodes.Clear();
+    table.edges.Clear();
+  }
+  routes_.Clear();
+  names_.Clear();
+  pool_.Clear();
+  compiled_ = false;
+}
+
+RadixRouter::Label RadixRouter::AddLabel(const StringView& str) {
+  Label label;
+  label.offset = pool_.Count();
+  label.len = str.Len();
+  if (label.len > 0) {
+    const int32 index = pool_.AddUninitialized(label.len);
+    ::memcpy(pool_.MutableData() + index, str.ConstData(), label.len);
+  }
+  return label;
+}
+
+void RadixRouter::Compile() {
+  for (auto& table : tables_) {
+    table.nodes.Clear();
+    table.edges.Clear();
+  }
+  routes_.Clear();
+  names_.Clear();
+  pool_.Clear();
+
+  for (int32 method_index = 0; method_index < (int32)http::Method::NumMethods;
+       ++method_index) {
+    CompileTable(method_index, tables_[method_index]);
+  }
+
+  compiled_ = true;
+}
+
+void RadixRouter::CompileTable(int32 method_index, Table& table) {
+  Array<BuildNode> build;
+  build.AddDefaulted();  // root
+
+  Array<String> segments;
+  for (const auto& pending : pending_) {
+    if ((int32)pending.method != method_index) {
+      continue;
+    }
+
+    segments.Clear();
+    SplitResource(pending.resource, segments);
+
+    CompiledRoute compiled;
+    compiled.route_id = pending.route_id;
+    compiled.first_name = names_.Count();
+    compiled.name_count = 0;
+
+    int32 node = 0;
+    for (int32 i = 0; i < segments.Count(); ++i) {
+      const String& segment = segments[i];
+      const bool is_last = i == segments.Count() - 1;
+
+      if (segment.StartsWith(":")) {
+        int32 name_len = segment.Len() - 1;
+        const bool optional = segment.EndsWith("?");
+        if (optional) {
+          // Add() has checked that the parameter is last and that the
+          // parent does not collide with another route.
+          fun_check(is_last && build[node].route == -1);
+          build[node].route = routes_.Count();
+          --name_len;
+        }
+
+        names_.Add(AddLabel(StringView(segment.ConstData() + 1, name_len)));
+        ++compiled.name_count;
+
+        if (build[node].param_child == -1) {
+          build[node].param_child = build.Count();
+          build.AddDefaulted();
+        }
+        node = build[node].param_child;
+      } else if (segment == "*") {
+        if (build[node].splat_child == -1) {
+          build[node].splat_child = build.Count();
+          build.AddDefaulted();
+        }
+        node = build[node].splat_child;
+      } else {
+        int32 child = -1;
+        for (const auto& edge : build[node].statics) {
+          if (edge.label == segment) {
+            child = edge.child;
+            break;
+          }
+        }
+        if (child == -1) {
+          child = build.Count();
+          BuildEdge edge;
+          edge.label = segment;
+          edge.child = child;
+          build[node].statics.Add(MoveTemp(edge));
+          build.AddDefaulted();
+        }
+        node = child;
+      }
+    }
+
+    fun_check(build[node].route == -1);
+    build[node].route = routes_.Count();
+    routes_.Add(compiled);
+  }
+
+  if (build.Count() == 1 && build[0].route == -1 &&
+      build[0].statics.IsEmpty()) {
+    // Nothing registered for this method; leave the table empty so that
+    // Find() can reject it without a lookup.
+    return;
+  }
+
+  // Flatten. Node indices are kept as-is, static edges of each node are
+  // laid out contiguously and sorted for binary search.
+  table.nodes.Reserve(build.Count());
+  for (auto& source : build) {
+    source.statics.Sort([](const BuildEdge& a, const BuildEdge& b) {
+      return CompareSegment(a.label.ConstData(), a.label.Len(),
+                            b.label.ConstData(), b.label.Len()) < 0;
+    });
+
+    Node node;
+    node.first_edge = table.edges.Count();
+    node.edge_count = source.statics.Count();
+    node.param_child = source.param_child;
+    node.splat_child = source.splat_child;
+    node.route = source.route;
+    table.nodes.Add(node);
+
+    for (const auto& edge : source.statics) {
+      Edge flat;
+      flat.label = AddLabel(edge.label);
+      flat.child = edge.child;
+      table.edges.Add(flat);
+    }
+  }
+}
+
+int32 RadixRouter::FindStaticChild(const Table& table, const Node& node,
+                                   const char* segment, int32 len) const {
+  int32 lo = node.first_edge;
+  int32 hi = node.first_edge + node.edge_count;
+  while (lo < hi) {
+    const int32 mid = lo + (hi - lo) / 2;
+    const Edge& edge = table.edges[mid];
+    const int32 cmp =
+        CompareSegment(pool_.ConstData() + edge.label.offset, edge.label.len,
+                       segment, len);
+    if (cmp == 0) {
+      return edge.child;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return -1;
+}
+
+bool RadixRouter::MatchNode(const Table& table, int32 node_index,
+                            const char* path, int32 pos, int32 len,
+                            RouteMatch& out_match) const {
+  const Node& node = table.nodes[node_index];
+
+  pos = SkipSlashes(path, pos, len);
+  if (pos == len) {
+    if (node.route == -1) {
+      return false;
+    }
+
+    const CompiledRoute& route = routes_[node.route];
+    fun_check(out_match.param_count_ <= route.name_count);
+    for (int32 i = 0; i < out_match.param_count_; ++i) {
+      out_match.params_[i].name = LabelOf(names_[route.first_name + i]);
+    }
+    out_match.route_id_ = route.route_id;
+    return true;
+  }
+
+  const int32 end = SegmentEnd(path, pos, len);
+  const int32 segment_len = end - pos;
+
+  if (node.edge_count > 0) {
+    const int32 child =
+        FindStaticChild(table, node, path + pos, segment_len);
+    if (child != -1 &&
+        MatchNode(table, child, path, end, len, out_match)) {
+      return true;
+    }
+  }
+
+  if (node.param_child != -1) {
+    const int32 slot = out_match.param_count_++;
+    out_match.params_[slot].value = StringView(path + pos, segment_len);
+    if (MatchNode(table, node.param_child, path, end, len, out_match)) {
+      return true;
+    }
+    --out_match.param_count_;
+  }
+
+  if (node.splat_child != -1) {
+    const int32 slot = out_match.splat_count_++;
+    out_match.splats_[slot] = StringView(path + pos, segment_len);
+    if (MatchNode(table, node.splat_child, path, end, len, out_match)) {
+      return true;
+    }
+    --out_match.splat_count_;
+  }
+
+  return false;
+}
+
+bool RadixRouter::Find(http::Method method, const StringView& path,
+                       RouteMatch& out_match) const {
+  if (!compiled_) {
+    throw IllegalStateException("RadixRouter: not compiled");
+  }
+
+  out_match.Reset();
+
+  const int32 method_index = (int32)method;
+  if (method_index <= (int32)http::Method::None ||
+      method_index >= (int32)http::Method::NumMethods) {
+    return false;
+  }
+
+  const Table& table = tables_[method_index];
+  if (table.nodes.IsEmpty()) {
+    return false;
+  }
+
+  return MatchNode(table, 0, path.ConstData(), 0, PathLength(path),
+                   out_match);
+}
+
+}  // namespace rest
+}  // namespace fun
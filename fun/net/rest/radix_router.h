@@ -0,0 +1,192 @@
+#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/base/container/flat_hash_set.h"
+#include "fun/base/string/string.h"
+#include "fun/net/http/method.h"
+#include "fun/net/net.h"
+
+namespace fun {
+namespace rest {
+
+/**
+ * A single captured path parameter.
+ *
+ * Both name and value are views; the name points into the router's
+ * string pool and the value points into the matched path, so neither
+ * must outlive its source.
+ */
+struct RouteParam {
+  StringView name;
+  StringView value;
+};
+
+/**
+ * The outcome of a RadixRouter lookup.
+ *
+ * Captures are stored inline so that a lookup never touches the heap.
+ */
+class RouteMatch {
+ public:
+  enum { MAX_PARAMS = 16, MAX_SPLATS = 8 };
+
+  RouteMatch() : route_id_(-1), param_count_(0), splat_count_(0) {}
+
+  int32 GetRouteId() const { return route_id_; }
+
+  int32 ParamCount() const { return param_count_; }
+  const RouteParam& GetParamAt(int32 index) const {
+    fun_check(index >= 0 && index < param_count_);
+    return params_[index];
+  }
+
+  /**
+   * Finds a parameter by name. Returns false if the matched
+   * route has no parameter with the given name.
+   */
+  bool FindParam(const StringView& name, StringView& out_value) const;
+
+  int32 SplatCount() const { return splat_count_; }
+  const StringView& GetSplatAt(int32 index) const {
+    fun_check(index >= 0 && index < splat_count_);
+    return splats_[index];
+  }
+
+  void Reset() {
+    route_id_ = -1;
+    param_count_ = 0;
+    splat_count_ = 0;
+  }
+
+ private:
+  friend class RadixRouter;
+
+  int32 route_id_;
+  int32 param_count_;
+  int32 splat_count_;
+  RouteParam params_[MAX_PARAMS];
+  StringView splats_[MAX_SPLATS];
+};
+
+/**
+ * Segment-level radix tree that maps (method, path) pairs to route ids.
+ *
+ * Resources use the same syntax as Route:
+ *
+ *   /users/:id          -> parameter segment, captured by name
+ *   /files/ * /raw      -> splat segment (written without spaces),
+ *                          matches exactly one segment
+ *   /static/index.html  -> static segments
+ *
+ * Routes are registered with Add() and turned into flat, per-method
+ * tables by Compile(). Static children of each node are kept sorted in
+ * a contiguous edge array so that a lookup is a handful of binary
+ * searches over a single string pool. When several children could
+ * match, static segments win over parameters, and parameters win over
+ * splats; the lookup backtracks if a more specific branch dead-ends.
+ *
+ * Find() does not allocate. The router must not be modified while
+ * lookups are running, but a compiled router may be shared freely
+ * between threads.
+ */
+class FUN_NET_API RadixRouter {
+ public:
+  RadixRouter();
+
+  /**
+   * Registers a resource for the given method.
+   *
+   * Throws ExistsException if a resource matching the same paths
+   * (parameter names aside) has already been added for the method, and
+   * InvalidArgumentException if the resource is malformed or uses more
+   * captures than RouteMatch can hold. The router is left unchanged
+   * when Add() throws.
+   */
+  void Add(http::Method method, const String& resource, int32 route_id);
+
+  /**
+   * Builds the lookup tables. Must be called after the last Add()
+   * and before the first Find(). Compiling is linear in the number of
+   * routes, so register everything first and compile once.
+   */
+  void Compile();
+
+  bool IsCompiled() const { return compiled_; }
+
+  /**
+   * Matches the given path (query string is ignored) and fills
+   * out_match with the route id and captured segments.
+   *
+   * Throws IllegalStateException if the router has not been compiled
+   * since the last Add().
+   */
+  bool Find(http::Method method, const StringView& path,
+            RouteMatch& out_match) const;
+
+  /**
+   * Number of registered routes, over all methods.
+   */
+  int32 RouteCount() const { return pending_.Count(); }
+
+  void Clear();
+
+ private:
+  struct Label {
+    int32 offset;
+    int32 len;
+  };
+
+  struct Edge {
+    Label label;
+    int32 child;
+  };
+
+  struct Node {
+    int32 first_edge;
+    int32 edge_count;
+    int32 param_child;
+    int32 splat_child;
+    // Index into routes_, or -1 if no route terminates here.
+    int32 route;
+  };
+
+  struct CompiledRoute {
+    int32 route_id;
+    // Slice of names_ holding the parameter names in capture order.
+    int32 first_name;
+    int32 name_count;
+  };
+
+  struct Table {
+    Array<Node> nodes;
+    Array<Edge> edges;
+  };
+
+  struct PendingRoute {
+    http::Method method;
+    String resource;
+    int32 route_id;
+  };
+
+  void CompileTable(int32 method_index, Table& table);
+  int32 FindStaticChild(const Table& table, const Node& node,
+                        const char* segment, int32 len) const;
+  bool MatchNode(const Table& table, int32 node_index, const char* path,
+                 int32 pos, int32 len, RouteMatch& out_match) const;
+  Label AddLabel(const StringView& str);
+  StringView LabelOf(const Label& label) const {
+    return StringView(pool_.ConstData() + label.offset, label.len);
+  }
+
+  Array<PendingRoute> pending_;
+  // Method-prefixed route shapes seen by Add(), for duplicate checks.
+  FlatHashSet<String> shapes_;
+  Table tables_[(int32)http::Method::NumMethods];
+  Array<CompiledRoute> routes_;
+  Array<Label> names_;
+  Array<char> pool_;
+  bool compiled_;
+};
+
+}  // namespace rest
+}  // namespace fun
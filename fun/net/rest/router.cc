@@ -185,13 +185,43 @@ void Router::InvokeNotFoundHandler(const http::Request& req, http::ResponseWrite
 
 Router::Status Router::Route(const http::Request& req, http::ResponseWriter& response)
 {
-  
+  RouteMatch match;
+  if (!radix_.Find(req.method, req.uri, match)) {
+    return Status::NotFound;
+  }
+
+  // Captures are views into req.uri; they are only copied out here,
+  // at the boundary of the legacy handler signature.
+  Array<TypedParam> params;
+  params.Reserve(match.ParamCount());
+  for (int32 i = 0; i < match.ParamCount(); ++i) {
+    const RouteParam& param = match.GetParamAt(i);
+    params.Emplace(String(param.name), String(param.value));
+  }
+
+  Array<TypedParam> splats;
+  splats.Reserve(match.SplatCount());
+  for (int32 i = 0; i < match.SplatCount(); ++i) {
+    splats.Emplace(String(), String(match.GetSplatAt(i)));
+  }
+
+  const rest::Request request(req, MoveTemp(params), MoveTemp(splats));
+  routes_[match.GetRouteId()].InvokeHandler(request, response);
+  return Status::Match;
 }
 
 
 void Router::AddRoute(http::Method method, String resource, Route::Handler handler)
 {
-  
+  const int32 route_id = routes_.Count();
+  radix_.Add(method, resource, route_id);
+  routes_.Emplace(MoveTemp(resource), method, MoveTemp(handler));
+}
+
+
+void Router::Compile()
+{
+  radix_.Compile();
 }
 
 
@@ -1,6 +1,7 @@
 ﻿#include "fun/base/flags.h"
 #include "fun/net/http/http_defs.h"
 #include "fun/net/net.h"
+#include "fun/net/rest/radix_router.h"
 
 namespace fun {
 namespace rest {
@@ -114,10 +115,20 @@ class Router {
 
   Status route(const Http::Request& request, Http::ResponseWriter response);
 
+  /**
+   * Builds the lookup tables for every route added so far. Must be
+   * called once, after the last route is added and before the first
+   * request is routed.
+   */
+  void Compile();
+
  private:
   void addRoute(Http::Method method, std::string resource,
                 Route::Handler handler);
-  std::unordered_map<Http::Method, std::vector<Route>> routes;
+
+  // Registered routes, indexed by the route id stored in radix_.
+  Array<Route> routes_;
+  RadixRouter radix_;
 
   std::vector<Route::Handler> customHandlers;
 
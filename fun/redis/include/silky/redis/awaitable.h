@@ -0,0 +1,58 @@
+#pragma once
+
+#include "fun/base/async/task.h"
+#include "fun/net/reactor/event_loop.h"
+#include "fun/redis/client.h"
+
+#if FUN_WITH_COROUTINES
+
+namespace fun {
+namespace redis {
+
+/// Awaiter returned by RedisCommand().
+class CommandAwaiter {
+ public:
+  CommandAwaiter(Client& client, const Array<String>& redis_cmd)
+      : client_(client), redis_cmd_(redis_cmd) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    // Replies arrive on the client's network thread; hop back to the loop
+    // the coroutine was suspended on, if any.
+    net::EventLoop* loop = net::EventLoop::GetEventLoopOfCurrentThread();
+    client_.Send(redis_cmd_, [this, loop, awaiting](Reply& reply) {
+      reply_ = reply;
+      if (loop) {
+        loop->QueueInLoop([awaiting]() { awaiting.resume(); });
+      } else {
+        awaiting.resume();
+      }
+    });
+    client_.Commit();
+  }
+
+  Reply await_resume() { return MoveTemp(reply_); }
+
+ private:
+  Client& client_;
+  Array<String> redis_cmd_;
+  Reply reply_;
+};
+
+/// Sends a single command and suspends until its reply arrives:
+///
+///   Reply reply = co_await RedisCommand(client, {"GET", key});
+///
+/// The command is committed right away. The coroutine is resumed on the
+/// EventLoop thread it awaited on, or on the client's network thread when
+/// it was not running on a loop.
+inline CommandAwaiter RedisCommand(Client& client,
+                                   const Array<String>& redis_cmd) {
+  return CommandAwaiter(client, redis_cmd);
+}
+
+}  // namespace redis
+}  // namespace fun
+
+#endif  // FUN_WITH_COROUTINES
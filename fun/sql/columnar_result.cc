@@ -0,0 +1,255 @@
+#include "fun/sql/columnar_result.h"
+#include "fun/base/date_time.h"
+#include "fun/base/timestamp.h"
+#include "fun/sql/date.h"
+#include "fun/sql/lob.h"
+#include "fun/sql/time.h"
+
+namespace fun {
+namespace sql {
+
+namespace {
+
+size_t GetTypeWidth(MetaColumn::ColumnDataType type) {
+  switch (type) {
+    case MetaColumn::FDT_BOOL:
+      return sizeof(bool);
+    case MetaColumn::FDT_INT8:
+    case MetaColumn::FDT_UINT8:
+      return sizeof(int8);
+    case MetaColumn::FDT_INT16:
+    case MetaColumn::FDT_UINT16:
+      return sizeof(int16);
+    case MetaColumn::FDT_INT32:
+    case MetaColumn::FDT_UINT32:
+    case MetaColumn::FDT_DATE:
+      return sizeof(int32);
+    case MetaColumn::FDT_INT64:
+    case MetaColumn::FDT_UINT64:
+    case MetaColumn::FDT_TIME:
+    case MetaColumn::FDT_TIMESTAMP:
+      return sizeof(int64);
+    case MetaColumn::FDT_FLOAT:
+      return sizeof(float);
+    case MetaColumn::FDT_DOUBLE:
+      return sizeof(double);
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Converts days since 1970-01-01 to a proleptic Gregorian date.
+ */
+Date DaysToDate(int32 days) {
+  const int64 z = static_cast<int64>(days) + 719468;
+  const int64 era = (z >= 0 ? z : z - 146096) / 146097;
+  const int64 doe = z - era * 146097;
+  const int64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64 mp = (5 * doy + 2) / 153;
+  const int32 day = static_cast<int32>(doy - (153 * mp + 2) / 5 + 1);
+  const int32 month = static_cast<int32>(mp < 10 ? mp + 3 : mp - 9);
+  const int32 year = static_cast<int32>(yoe + era * 400 + (month <= 2));
+  return Date(year, month, day);
+}
+
+}  // namespace
+
+//
+// ColumnBuffer
+//
+
+ColumnBuffer::ColumnBuffer(const String& name, MetaColumn::ColumnDataType type)
+    : name_(name),
+      type_(type),
+      width_(GetTypeWidth(type)),
+      row_count_(0),
+      null_count_(0) {
+  if (width_ == 0) {
+    offsets_.push_back(0);
+  }
+}
+
+StringView ColumnBuffer::GetString(size_t row) const {
+  if (width_ != 0) {
+    throw InvalidAccessException("Not a string column: " + name_);
+  }
+  return StringView(data_.data() + offsets_[row],
+                    offsets_[row + 1] - offsets_[row]);
+}
+
+fun::dynamic::Var ColumnBuffer::GetVar(size_t row) const {
+  if (row >= row_count_) {
+    throw RangeException("Row index out of range");
+  }
+  if (IsNull(row)) {
+    return fun::dynamic::Var();
+  }
+
+  switch (type_) {
+    case MetaColumn::FDT_BOOL:
+      return GetValue<bool>(row);
+    case MetaColumn::FDT_INT8:
+      return GetValue<int8>(row);
+    case MetaColumn::FDT_UINT8:
+      return GetValue<uint8>(row);
+    case MetaColumn::FDT_INT16:
+      return GetValue<int16>(row);
+    case MetaColumn::FDT_UINT16:
+      return GetValue<uint16>(row);
+    case MetaColumn::FDT_INT32:
+      return GetValue<int32>(row);
+    case MetaColumn::FDT_UINT32:
+      return GetValue<uint32>(row);
+    case MetaColumn::FDT_INT64:
+      return GetValue<int64>(row);
+    case MetaColumn::FDT_UINT64:
+      return GetValue<uint64>(row);
+    case MetaColumn::FDT_FLOAT:
+      return GetValue<float>(row);
+    case MetaColumn::FDT_DOUBLE:
+      return GetValue<double>(row);
+    case MetaColumn::FDT_DATE:
+      return DaysToDate(GetValue<int32>(row));
+    case MetaColumn::FDT_TIME: {
+      const int64 seconds = GetValue<int64>(row) / 1000000;
+      return Time(static_cast<int32>(seconds / 3600),
+                  static_cast<int32>(seconds / 60 % 60),
+                  static_cast<int32>(seconds % 60));
+    }
+    case MetaColumn::FDT_TIMESTAMP:
+      return DateTime(Timestamp(GetValue<int64>(row)));
+    case MetaColumn::FDT_BLOB: {
+      const StringView bytes = GetString(row);
+      return BLOB(reinterpret_cast<const unsigned char*>(bytes.ConstData()),
+                  bytes.Len());
+    }
+    case MetaColumn::FDT_CLOB: {
+      const StringView bytes = GetString(row);
+      return CLOB(bytes.ConstData(), bytes.Len());
+    }
+    default: {
+      const StringView bytes = GetString(row);
+      return String(bytes.ConstData(), bytes.Len());
+    }
+  }
+}
+
+void ColumnBuffer::Reserve(size_t rows, size_t bytes) {
+  if (width_ != 0) {
+    data_.reserve(rows * width_);
+  } else {
+    data_.reserve(bytes);
+    offsets_.reserve(rows + 1);
+  }
+  nulls_.reserve((rows + 63) / 64);
+}
+
+void ColumnBuffer::AppendNull() {
+  if (width_ != 0) {
+    data_.resize(data_.size() + width_);
+  }
+  AddRow(true);
+}
+
+void ColumnBuffer::AppendBytes(const void* data, size_t length) {
+  if (width_ != 0) {
+    throw InvalidAccessException("Not a string column: " + name_);
+  }
+  const char* bytes = static_cast<const char*>(data);
+  data_.insert(data_.end(), bytes, bytes + length);
+  AddRow(false);
+}
+
+void ColumnBuffer::Clear() {
+  data_.clear();
+  offsets_.clear();
+  if (width_ == 0) {
+    offsets_.push_back(0);
+  }
+  nulls_.clear();
+  row_count_ = 0;
+  null_count_ = 0;
+}
+
+void ColumnBuffer::AddRow(bool is_null) {
+  if ((row_count_ & 63) == 0) {
+    nulls_.push_back(0);
+  }
+  if (is_null) {
+    nulls_.back() |= uint64(1) << (row_count_ & 63);
+    ++null_count_;
+  }
+  if (width_ == 0) {
+    offsets_.push_back(data_.size());
+  }
+  ++row_count_;
+}
+
+void ColumnBuffer::CheckWidth(size_t width) const {
+  if (width != width_) {
+    throw InvalidAccessException("Wrong value type for column: " + name_);
+  }
+}
+
+//
+// ColumnarResult
+//
+
+ColumnarResult::ColumnarResult()
+    : names_(new Row::NameVec), affected_row_count_(0) {}
+
+const ColumnBuffer& ColumnarResult::ColumnAt(const String& name) const {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    if (columns_[i].GetName() == name) {
+      return columns_[i];
+    }
+  }
+  throw NotFoundException("Column not found: " + name);
+}
+
+Row ColumnarResult::RowAt(size_t row) const {
+  if (row >= RowCount()) {
+    throw RangeException("Row index out of range");
+  }
+
+  Row result(names_);
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    if (columns_[i].IsNull(row)) {
+      result.Get(i).Clear();
+    } else {
+      result.Set(i, columns_[i].GetVar(row));
+    }
+  }
+  return result;
+}
+
+ColumnBuffer& ColumnarResult::AddColumn(const String& name,
+                                        MetaColumn::ColumnDataType type) {
+  if (RowCount() > 0) {
+    throw InvalidAccessException("Columns must be added before the rows");
+  }
+  columns_.push_back(ColumnBuffer(name, type));
+  // Rows returned earlier share the old name vector.
+  Row::NameVecPtr names(new Row::NameVec(*names_));
+  names->push_back(name);
+  names_ = names;
+  return columns_.back();
+}
+
+void ColumnarResult::ClearRows() {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    columns_[i].Clear();
+  }
+  affected_row_count_ = 0;
+}
+
+void ColumnarResult::Clear() {
+  columns_.clear();
+  names_ = Row::NameVecPtr(new Row::NameVec);
+  affected_row_count_ = 0;
+}
+
+}  // namespace sql
+}  // namespace fun
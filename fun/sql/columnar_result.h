@@ -0,0 +1,244 @@
+#pragma once
+
+#include <vector>
+#include "fun/base/dynamic/var.h"
+#include "fun/base/exception.h"
+#include "fun/base/string.h"
+#include "fun/sql/meta_column.h"
+#include "fun/sql/row.h"
+#include "fun/sql/sql.h"
+
+namespace fun {
+namespace sql {
+
+/**
+ * One column of a ColumnarResult: the values of all rows in one
+ * contiguous buffer, and a bitmap of the rows that are NULL.
+ *
+ * Fixed-width types are stored as an array of:
+ *
+ *   FDT_BOOL                bool
+ *   FDT_INT8 .. FDT_UINT64  int8 .. uint64
+ *   FDT_FLOAT               float
+ *   FDT_DOUBLE              double
+ *   FDT_DATE                int32, days since 1970-01-01
+ *   FDT_TIME                int64, microseconds since midnight
+ *   FDT_TIMESTAMP           int64, microseconds since 1970-01-01 00:00:00
+ *
+ * Strings, CLOBs and BLOBs are stored back to back in one byte buffer,
+ * with an array of offsets. A NULL row holds 0 or an empty string.
+ */
+class FUN_SQL_API ColumnBuffer {
+ public:
+  ColumnBuffer(const String& name, MetaColumn::ColumnDataType type);
+
+  const String& GetName() const { return name_; }
+  MetaColumn::ColumnDataType GetType() const { return type_; }
+  size_t GetRowCount() const { return row_count_; }
+
+  /**
+   * Returns the size of a value of a fixed-width column, 0 for a
+   * variable-width one.
+   */
+  size_t GetWidth() const { return width_; }
+
+  bool IsNull(size_t row) const {
+    return ((nulls_[row >> 6] >> (row & 63)) & 1) != 0;
+  }
+
+  size_t GetNullCount() const { return null_count_; }
+
+  /**
+   * Returns the values of a fixed-width column as an array of
+   * GetRowCount() elements. T must be the type listed above for the
+   * column type.
+   */
+  template <typename T>
+  const T* GetData() const {
+    CheckWidth(sizeof(T));
+    return reinterpret_cast<const T*>(data_.data());
+  }
+
+  template <typename T>
+  T GetValue(size_t row) const {
+    return GetData<T>()[row];
+  }
+
+  /**
+   * Returns the bytes of a string or BLOB value. The view points into
+   * the column and is valid as long as the column is not modified.
+   */
+  StringView GetString(size_t row) const;
+
+  /**
+   * Returns the value at row as a Var, empty for NULL. Dates and times
+   * are converted to Date, Time and DateTime and BLOBs to BLOB, as
+   * RecordSet returns them.
+   */
+  fun::dynamic::Var GetVar(size_t row) const;
+
+  /**
+   * Reserves room for rows values of a fixed-width column, or for rows
+   * values and bytes bytes of a variable-width one.
+   */
+  void Reserve(size_t rows, size_t bytes = 0);
+
+  void AppendNull();
+
+  /**
+   * Appends a value to a fixed-width column.
+   */
+  template <typename T>
+  void Append(T value) {
+    CheckWidth(sizeof(T));
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    data_.insert(data_.end(), bytes, bytes + sizeof(T));
+    AddRow(false);
+  }
+
+  /**
+   * Appends a value to a variable-width column.
+   */
+  void AppendBytes(const void* data, size_t length);
+
+  void Clear();
+
+ private:
+  void AddRow(bool is_null);
+  void CheckWidth(size_t width) const;
+
+  String name_;
+  MetaColumn::ColumnDataType type_;
+  size_t width_;
+  size_t row_count_;
+  size_t null_count_;
+  std::vector<char> data_;
+  // Start of every value of a variable-width column, and the end of the
+  // last one.
+  std::vector<size_t> offsets_;
+  std::vector<uint64> nulls_;
+};
+
+/**
+ * Result of a query, stored column by column.
+ *
+ * RecordSet extracts every value into a container of its own and reads
+ * it back through Var; for large results most of the time is spent
+ * there rather than in the database. A ColumnarResult is filled by the
+ * connector straight from the binary wire format into typed, contiguous
+ * column buffers, which can be scanned without any conversion:
+ *
+ *   ColumnarResult result;
+ *   session.ExecuteColumnar(
+ *       "SELECT player_id, score FROM leaderboard WHERE season = $1",
+ *       {"42"}, result);
+ *   const int64* scores = result.ColumnAt("score").GetData<int64>();
+ *   for (size_t i = 0; i < result.RowCount(); ++i) {
+ *     total += scores[i];
+ *   }
+ *
+ * The RecordSet accessors ValueAt(), IsNull(), ColumnNameAt(),
+ * ColumnTypeAt() and RowAt() are available as well, converting single
+ * values on demand. For code written against RecordSet (row iterators,
+ * filters, RowFormatter output), RecordSet(session, result) is a view
+ * over the result.
+ */
+class FUN_SQL_API ColumnarResult {
+ public:
+  ColumnarResult();
+
+  size_t RowCount() const;
+  size_t ColumnCount() const;
+
+  /**
+   * Returns the number of rows changed by a statement that returns none.
+   */
+  size_t AffectedRowCount() const { return affected_row_count_; }
+  void SetAffectedRowCount(size_t count) { affected_row_count_ = count; }
+
+  const ColumnBuffer& ColumnAt(size_t pos) const;
+  ColumnBuffer& ColumnAt(size_t pos);
+
+  /**
+   * Returns the first column with the specified name. Throws a
+   * NotFoundException if there is none.
+   */
+  const ColumnBuffer& ColumnAt(const String& name) const;
+
+  const String& ColumnNameAt(size_t pos) const;
+  MetaColumn::ColumnDataType ColumnTypeAt(size_t pos) const;
+
+  bool IsNull(size_t col, size_t row) const;
+
+  fun::dynamic::Var ValueAt(size_t col, size_t row) const;
+  fun::dynamic::Var ValueAt(const String& name, size_t row) const;
+
+  /**
+   * Returns the values of a row as a Row.
+   */
+  Row RowAt(size_t row) const;
+
+  /**
+   * Adds a column. Called by connectors before the rows are appended.
+   */
+  ColumnBuffer& AddColumn(const String& name, MetaColumn::ColumnDataType type);
+
+  /**
+   * Removes all rows and keeps the columns.
+   */
+  void ClearRows();
+
+  /**
+   * Removes all columns and rows.
+   */
+  void Clear();
+
+ private:
+  std::vector<ColumnBuffer> columns_;
+  Row::NameVecPtr names_;
+  size_t affected_row_count_;
+};
+
+//
+// inlines
+//
+
+inline size_t ColumnarResult::RowCount() const {
+  return columns_.empty() ? 0 : columns_[0].GetRowCount();
+}
+
+inline size_t ColumnarResult::ColumnCount() const { return columns_.size(); }
+
+inline const ColumnBuffer& ColumnarResult::ColumnAt(size_t pos) const {
+  return columns_.at(pos);
+}
+
+inline ColumnBuffer& ColumnarResult::ColumnAt(size_t pos) {
+  return columns_.at(pos);
+}
+
+inline const String& ColumnarResult::ColumnNameAt(size_t pos) const {
+  return ColumnAt(pos).GetName();
+}
+
+inline MetaColumn::ColumnDataType ColumnarResult::ColumnTypeAt(
+    size_t pos) const {
+  return ColumnAt(pos).GetType();
+}
+
+inline bool ColumnarResult::IsNull(size_t col, size_t row) const {
+  return ColumnAt(col).IsNull(row);
+}
+
+inline fun::dynamic::Var ColumnarResult::ValueAt(size_t col,
+                                                 size_t row) const {
+  return ColumnAt(col).GetVar(row);
+}
+
+inline fun::dynamic::Var ColumnarResult::ValueAt(const String& name,
+                                                 size_t row) const {
+  return ColumnAt(name).GetVar(row);
+}
+
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,66 @@
+#include "fun/sql/csv_row_formatter.h"
+
+namespace fun {
+namespace sql {
+
+CsvRowFormatter::CsvRowFormatter(char delimiter, bool header)
+    : delimiter_(delimiter), header_(header) {}
+
+CsvRowFormatter::~CsvRowFormatter() {}
+
+String& CsvRowFormatter::FormatNames(const NameVecPtr names,
+                                     String& formatted_names) {
+  formatted_names.clear();
+  if (!header_ || !names) {
+    return formatted_names;
+  }
+
+  for (NameVec::const_iterator it = names->begin(); it != names->end();
+       ++it) {
+    if (it != names->begin()) {
+      formatted_names += delimiter_;
+    }
+    AppendField(*it, formatted_names);
+  }
+  formatted_names += "\r\n";
+  return formatted_names;
+}
+
+String& CsvRowFormatter::FormatValues(const ValueVec& vals,
+                                      String& formatted_values) {
+  formatted_values.clear();
+  for (ValueVec::const_iterator it = vals.begin(); it != vals.end(); ++it) {
+    if (it != vals.begin()) {
+      formatted_values += delimiter_;
+    }
+    if (!it->IsEmpty()) {
+      AppendField(it->convert<String>(), formatted_values);
+    }
+  }
+  formatted_values += "\r\n";
+  return formatted_values;
+}
+
+void CsvRowFormatter::AppendField(const String& field, String& line) const {
+  bool quote = false;
+  for (int32 i = 0; i < field.Len() && !quote; ++i) {
+    const char c = field[i];
+    quote = c == delimiter_ || c == '"' || c == '\r' || c == '\n';
+  }
+  if (!quote) {
+    line += field;
+    return;
+  }
+
+  line += '"';
+  for (int32 i = 0; i < field.Len(); ++i) {
+    if (field[i] == '"') {
+      line += '"';
+    }
+    line += field[i];
+  }
+  line += '"';
+}
+
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "fun/sql/row_formatter.h"
+#include "fun/sql/sql.h"
+
+namespace fun {
+namespace sql {
+
+/**
+ * Formats rows as CSV (RFC 4180): a header line with the column names,
+ * then one line per row, each ended by CRLF. Fields that contain the
+ * delimiter, a double quote or a line break are quoted; NULL is an empty
+ * field.
+ *
+ * Every row is formatted on its own, so the formatter can be used with
+ * Cursor::Export() to write tables of any size.
+ */
+class FUN_SQL_API CsvRowFormatter : public RowFormatter {
+ public:
+  /**
+   * Creates the CsvRowFormatter. If header is false, the column names are
+   * not written.
+   */
+  CsvRowFormatter(char delimiter = ',', bool header = true);
+
+  /**
+   * Destroys the CsvRowFormatter.
+   */
+  ~CsvRowFormatter();
+
+  /**
+   * Formats the header line.
+   */
+  String& FormatNames(const NameVecPtr names, String& formatted_names);
+
+  /**
+   * Formats a row.
+   */
+  String& FormatValues(const ValueVec& vals, String& formatted_values);
+
+  char GetDelimiter() const { return delimiter_; }
+
+ private:
+  void AppendField(const String& field, String& line) const;
+
+  char delimiter_;
+  bool header_;
+};
+
+}  // namespace sql
+}  // namespace fun
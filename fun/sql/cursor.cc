@@ -0,0 +1,156 @@
+#include "fun/sql/cursor.h"
+#include "fun/base/exception.h"
+
+namespace fun {
+namespace sql {
+
+const size_t Cursor::DEFAULT_BATCH_SIZE;
+
+Cursor::Cursor(Session& session, const String& sql,
+               const Array<String>& params, size_t batch_size)
+    : session_(session),
+      batch_size_(batch_size),
+      batch_row_(0),
+      row_count_(0),
+      positioned_(false),
+      done_(false) {
+  if (batch_size_ == 0) {
+    throw InvalidArgumentException("Cursor batch size must not be 0");
+  }
+
+  impl_ = session_.GetImpl()->OpenCursor(sql, params);
+  // The first batch also provides the columns.
+  if (!impl_->Fetch(batch_, batch_size_)) {
+    Close();
+  }
+}
+
+Cursor::~Cursor() {
+  try {
+    Close();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+bool Cursor::Next() {
+  if (done_) {
+    return false;
+  }
+
+  if (positioned_) {
+    ++batch_row_;
+  } else {
+    positioned_ = true;
+  }
+
+  while (batch_row_ >= batch_.RowCount()) {
+    if (!impl_->Fetch(batch_, batch_size_)) {
+      Close();
+      return false;
+    }
+    batch_row_ = 0;
+  }
+
+  ++row_count_;
+  return true;
+}
+
+bool Cursor::IsNull(size_t col) const {
+  CheckRow();
+  return batch_.IsNull(col, batch_row_);
+}
+
+fun::dynamic::Var Cursor::ValueAt(size_t col) const {
+  CheckRow();
+  return batch_.ValueAt(col, batch_row_);
+}
+
+fun::dynamic::Var Cursor::ValueAt(const String& name) const {
+  CheckRow();
+  return batch_.ValueAt(name, batch_row_);
+}
+
+size_t Cursor::ForEach(const RowCallback& callback) {
+  size_t count = 0;
+  while (Next()) {
+    ++count;
+    if (!callback(*this)) {
+      break;
+    }
+  }
+  return count;
+}
+
+size_t Cursor::Export(RowFormatter& formatter, const Sink& sink) {
+  // The prefix goes out before the first row is read, so a count in it
+  // would have to be known up front.
+  if (formatter.NeedsTotalRowCount() &&
+      formatter.GetTotalRowCount() == RowFormatter::INVALID_ROW_COUNT) {
+    throw InvalidArgumentException(
+        "Cursor::Export: the formatter prints the total row count, which a "
+        "cursor knows only at the end; set it with SetTotalRowCount()");
+  }
+
+  String formatted;
+  if (!formatter.GetPrefix().IsEmpty()) {
+    sink(formatter.GetPrefix());
+  }
+
+  RowFormatter::NameVecPtr names(new RowFormatter::NameVec);
+  for (size_t col = 0; col < ColumnCount(); ++col) {
+    names->push_back(ColumnNameAt(col));
+  }
+  if (!formatter.FormatNames(names, formatted).IsEmpty()) {
+    sink(formatted);
+  }
+
+  // Reused for every row; only the current row is ever converted.
+  RowFormatter::ValueVec values(ColumnCount());
+  size_t count = 0;
+  while (Next()) {
+    for (size_t col = 0; col < values.size(); ++col) {
+      values[col] = batch_.ValueAt(col, batch_row_);
+    }
+    if (!formatter.FormatValues(values, formatted).IsEmpty()) {
+      sink(formatted);
+    }
+    ++count;
+  }
+
+  if (!formatter.NeedsTotalRowCount()) {
+    formatter.SetTotalRowCount(static_cast<int32>(count));
+  }
+  if (!formatter.GetPostfix().IsEmpty()) {
+    sink(formatter.GetPostfix());
+  }
+  return count;
+}
+
+size_t Cursor::Export(RowFormatter& formatter, std::ostream& ostr) {
+  return Export(formatter, [&ostr](const String& formatted) {
+    ostr.write(formatted.c_str(), formatted.Len());
+    if (!ostr) {
+      throw IoException("Cursor export: write failed");
+    }
+  });
+}
+
+void Cursor::Close() {
+  if (done_) {
+    return;
+  }
+
+  done_ = true;
+  batch_.ClearRows();
+  impl_->Close();
+}
+
+void Cursor::CheckRow() const {
+  if (!positioned_ || done_) {
+    throw InvalidAccessException("Cursor is not on a row");
+  }
+}
+
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <ostream>
+#include "fun/base/container/array.h"
+#include "fun/base/ftl/function.h"
+#include "fun/sql/columnar_result.h"
+#include "fun/sql/cursor_impl.h"
+#include "fun/sql/row_formatter.h"
+#include "fun/sql/session.h"
+#include "fun/sql/sql.h"
+
+namespace fun {
+namespace sql {
+
+/**
+ * Forward-only cursor over the result of a query.
+ *
+ * Statement and RecordSet extract the whole result, or a whole Limit
+ * batch, into containers. A Cursor reads the rows from the server as they
+ * are consumed, holding at most one batch of them in memory, so that a
+ * table of any size can be scanned or exported:
+ *
+ *   Cursor cursor(session, "SELECT id, name, score FROM player");
+ *   while (cursor.Next()) {
+ *     total += cursor.ValueAt(2).convert<int64>();
+ *   }
+ *
+ * Each connector uses its own streaming mechanism: PostgreSQL single-row
+ * mode, unbuffered MySQL prepared statement fetches and SQLite stepping.
+ *
+ * The session is busy until the cursor is closed or destroyed and must
+ * not be used for other statements meanwhile.
+ */
+class FUN_SQL_API Cursor {
+ public:
+  static const size_t DEFAULT_BATCH_SIZE = 1000;
+
+  typedef Function<bool(const Cursor&)> RowCallback;
+  typedef Function<void(const String&)> Sink;
+
+  /**
+   * Executes sql and opens a cursor over its result. params are the
+   * values of the placeholders in the text format; batch_size is the
+   * number of rows read from the connector at a time.
+   */
+  Cursor(Session& session, const String& sql,
+         const Array<String>& params = Array<String>(),
+         size_t batch_size = DEFAULT_BATCH_SIZE);
+
+  /**
+   * Closes the cursor.
+   */
+  ~Cursor();
+
+  /**
+   * Moves to the next row. Returns false, and closes the cursor, at the
+   * end of the result.
+   */
+  bool Next();
+
+  /**
+   * Returns the number of rows moved to so far.
+   */
+  size_t GetRowCount() const { return row_count_; }
+
+  size_t ColumnCount() const;
+  const String& ColumnNameAt(size_t pos) const;
+  MetaColumn::ColumnDataType ColumnTypeAt(size_t pos) const;
+
+  /**
+   * Returns true if the value of column col in the current row is NULL.
+   */
+  bool IsNull(size_t col) const;
+
+  /**
+   * Returns the value of a column in the current row.
+   */
+  fun::dynamic::Var ValueAt(size_t col) const;
+  fun::dynamic::Var ValueAt(const String& name) const;
+
+  /**
+   * Returns a column of the current batch, for access without conversion;
+   * the current row is GetBatchRow() in it. The batch is replaced when
+   * Next() moves past its last row.
+   */
+  const ColumnBuffer& ColumnAt(size_t col) const;
+  size_t GetBatchRow() const { return batch_row_; }
+
+  /**
+   * Calls callback for every remaining row, until it returns false.
+   * Returns the number of rows it was called for.
+   */
+  size_t ForEach(const RowCallback& callback);
+
+  /**
+   * Formats the remaining rows with formatter and passes the output to
+   * sink piece by piece, as the rows are read: the prefix and the column
+   * names first, then every row, then the postfix. Returns the number of
+   * rows written.
+   *
+   * The sink can append to a file, a socket or a net::Buffer; nothing is
+   * accumulated in between.
+   *
+   * The total row count of the formatter is set to the number of rows
+   * written at the end. A formatter that prints the count in its prefix
+   * (see RowFormatter::NeedsTotalRowCount()) needs it before the first
+   * row; unless it has been set already, Export() throws
+   * InvalidArgumentException.
+   */
+  size_t Export(RowFormatter& formatter, const Sink& sink);
+
+  /**
+   * Formats the remaining rows with formatter and writes them to ostr.
+   */
+  size_t Export(RowFormatter& formatter, std::ostream& ostr);
+
+  /**
+   * Discards the rest of the result and frees the session.
+   */
+  void Close();
+
+  bool IsOpen() const { return !done_; }
+
+ private:
+  Cursor(const Cursor&) = delete;
+  Cursor& operator=(const Cursor&) = delete;
+
+  void CheckRow() const;
+
+  // Keeps a pooled session from going back to the pool while open.
+  Session session_;
+  CursorImpl::Ptr impl_;
+  ColumnarResult batch_;
+  size_t batch_size_;
+  size_t batch_row_;
+  size_t row_count_;
+  bool positioned_;
+  bool done_;
+};
+
+//
+// inlines
+//
+
+inline size_t Cursor::ColumnCount() const { return batch_.ColumnCount(); }
+
+inline const String& Cursor::ColumnNameAt(size_t pos) const {
+  return batch_.ColumnNameAt(pos);
+}
+
+inline MetaColumn::ColumnDataType Cursor::ColumnTypeAt(size_t pos) const {
+  return batch_.ColumnTypeAt(pos);
+}
+
+inline const ColumnBuffer& Cursor::ColumnAt(size_t col) const {
+  return batch_.ColumnAt(col);
+}
+
+}  // namespace sql
+}  // namespace fun
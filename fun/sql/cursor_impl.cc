@@ -0,0 +1,11 @@
+#include "fun/sql/cursor_impl.h"
+
+namespace fun {
+namespace sql {
+
+CursorImpl::CursorImpl() {}
+
+CursorImpl::~CursorImpl() {}
+
+}  // namespace sql
+}  // namespace fun
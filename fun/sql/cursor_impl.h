@@ -0,0 +1,43 @@
+#pragma once
+
+#include "fun/base/shared_ptr.h"
+#include "fun/sql/columnar_result.h"
+#include "fun/sql/sql.h"
+
+namespace fun {
+namespace sql {
+
+/**
+ * Connector side of a Cursor: reads the rows of a result in batches,
+ * without holding more than one batch in memory.
+ *
+ * While a cursor is open it owns the connection; the session must not
+ * run other statements until it is closed.
+ */
+class FUN_SQL_API CursorImpl {
+ public:
+  typedef fun::SharedPtr<CursorImpl> Ptr;
+
+  CursorImpl();
+  virtual ~CursorImpl();
+
+  /**
+   * Replaces the rows of batch with the next rows of the result, at most
+   * max_rows of them, adding the columns on the first call. Returns false
+   * if no rows were left.
+   */
+  virtual bool Fetch(ColumnarResult& batch, size_t max_rows) = 0;
+
+  /**
+   * Stops reading and discards the rest of the result. Called by the
+   * destructor of Cursor; must be safe to call more than once.
+   */
+  virtual void Close() = 0;
+
+ private:
+  CursorImpl(const CursorImpl&) = delete;
+  CursorImpl& operator=(const CursorImpl&) = delete;
+};
+
+}  // namespace sql
+}  // namespace fun
@@ -117,6 +117,11 @@ class FUN_SQL_API JsonRowFormatter : public fun::sql::RowFormatter {
    */
   bool IsFull();
 
+  /**
+   * Returns true if row count printing is enabled.
+   */
+  bool NeedsTotalRowCount() const override;
+
  private:
   void AdjustPrefix();
 
@@ -141,6 +146,10 @@ inline bool JsonRowFormatter::IsSmall() {
   return (mode_ & JSON_FMT_MODE_SMALL) != 0;
 }
 
+inline bool JsonRowFormatter::NeedsTotalRowCount() const {
+  return (mode_ & JSON_FMT_MODE_ROW_COUNT) != 0;
+}
+
 inline bool JsonRowFormatter::IsFull() {
   return (mode_ & JSON_FMT_MODE_FULL) != 0;
 }
@@ -0,0 +1,333 @@
+﻿#include "fun/sql/mysql/columnar_extractor.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "fun/sql/mysql/mysql_exception.h"
+
+namespace {
+
+using fun::sql::MetaColumn;
+
+// Initial size of string and BLOB buffers for unbuffered results, where
+// the longest value is not known in advance.
+const size_t INITIAL_VARIABLE_SIZE = 1024;
+
+/**
+ * Chooses the column type and the buffer type a field is fetched as.
+ */
+MetaColumn::ColumnDataType GetColumnType(const MYSQL_FIELD& field,
+                                         enum_field_types& buffer_type,
+                                         size_t& size) {
+  const bool unsig = (field.flags & UNSIGNED_FLAG) == UNSIGNED_FLAG;
+
+  switch (field.type) {
+    case MYSQL_TYPE_TINY:
+      buffer_type = MYSQL_TYPE_TINY;
+      size = sizeof(int8);
+      return unsig ? MetaColumn::FDT_UINT8 : MetaColumn::FDT_INT8;
+
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_YEAR:
+      buffer_type = MYSQL_TYPE_SHORT;
+      size = sizeof(int16);
+      return unsig ? MetaColumn::FDT_UINT16 : MetaColumn::FDT_INT16;
+
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONG:
+      buffer_type = MYSQL_TYPE_LONG;
+      size = sizeof(int32);
+      return unsig ? MetaColumn::FDT_UINT32 : MetaColumn::FDT_INT32;
+
+    case MYSQL_TYPE_LONGLONG:
+      buffer_type = MYSQL_TYPE_LONGLONG;
+      size = sizeof(int64);
+      return unsig ? MetaColumn::FDT_UINT64 : MetaColumn::FDT_INT64;
+
+    case MYSQL_TYPE_FLOAT:
+      buffer_type = MYSQL_TYPE_FLOAT;
+      size = sizeof(float);
+      return MetaColumn::FDT_FLOAT;
+
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+    case MYSQL_TYPE_DOUBLE:
+      // The client library converts DECIMAL values.
+      buffer_type = MYSQL_TYPE_DOUBLE;
+      size = sizeof(double);
+      return MetaColumn::FDT_DOUBLE;
+
+    case MYSQL_TYPE_DATE:
+      buffer_type = MYSQL_TYPE_DATE;
+      size = sizeof(MYSQL_TIME);
+      return MetaColumn::FDT_DATE;
+
+    case MYSQL_TYPE_TIME:
+      buffer_type = MYSQL_TYPE_TIME;
+      size = sizeof(MYSQL_TIME);
+      return MetaColumn::FDT_TIME;
+
+    case MYSQL_TYPE_DATETIME:
+    case MYSQL_TYPE_TIMESTAMP:
+      buffer_type = MYSQL_TYPE_DATETIME;
+      size = sizeof(MYSQL_TIME);
+      return MetaColumn::FDT_TIMESTAMP;
+
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
+      buffer_type = MYSQL_TYPE_BLOB;
+      size = field.max_length;
+      return MetaColumn::FDT_BLOB;
+
+    default:
+      // Everything else is fetched as text.
+      buffer_type = MYSQL_TYPE_STRING;
+      size = field.max_length;
+      return MetaColumn::FDT_STRING;
+  }
+}
+
+/**
+ * Returns the days since 1970-01-01 of a proleptic Gregorian date.
+ */
+int32 DaysFromCivil(int32 year, uint32 month, uint32 day) {
+  year -= month <= 2;
+  const int32 era = (year >= 0 ? year : year - 399) / 400;
+  const uint32 yoe = static_cast<uint32>(year - era * 400);
+  const uint32 mp = month > 2 ? month - 3 : month + 9;
+  const uint32 doy = (153 * mp + 2) / 5 + day - 1;
+  const uint32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int32>(doe) - 719468;
+}
+
+int64 TimeOfDay(const MYSQL_TIME& t) {
+  return ((int64(t.hour) * 60 + t.minute) * 60 + t.second) * 1000000 +
+         t.second_part;
+}
+
+void AppendValue(fun::sql::ColumnBuffer& column, const char* data,
+                 unsigned long length) {
+  switch (column.GetType()) {
+    case MetaColumn::FDT_DATE: {
+      const MYSQL_TIME& t = *reinterpret_cast<const MYSQL_TIME*>(data);
+      column.Append<int32>(DaysFromCivil(t.year, t.month, t.day));
+      break;
+    }
+    case MetaColumn::FDT_TIME: {
+      const MYSQL_TIME& t = *reinterpret_cast<const MYSQL_TIME*>(data);
+      column.Append<int64>(t.neg ? -TimeOfDay(t) : TimeOfDay(t));
+      break;
+    }
+    case MetaColumn::FDT_TIMESTAMP: {
+      const MYSQL_TIME& t = *reinterpret_cast<const MYSQL_TIME*>(data);
+      column.Append<int64>(int64(DaysFromCivil(t.year, t.month, t.day)) *
+                               86400000000LL +
+                           TimeOfDay(t));
+      break;
+    }
+    case MetaColumn::FDT_BLOB:
+    case MetaColumn::FDT_STRING:
+      column.AppendBytes(data, length);
+      break;
+    default:
+      // Fixed-width numbers, already in the layout of the column.
+      switch (column.GetWidth()) {
+        case 1:
+          column.Append<int8>(*reinterpret_cast<const int8*>(data));
+          break;
+        case 2:
+          column.Append<int16>(*reinterpret_cast<const int16*>(data));
+          break;
+        case 4:
+          column.Append<int32>(*reinterpret_cast<const int32*>(data));
+          break;
+        default:
+          column.Append<int64>(*reinterpret_cast<const int64*>(data));
+          break;
+      }
+      break;
+  }
+}
+
+}  // namespace
+
+namespace fun {
+namespace sql {
+namespace mysql {
+
+ColumnarExtractor::ColumnarExtractor(StatementExecutor& executor)
+    : executor_(executor),
+      metadata_(nullptr),
+      executed_(false),
+      buffered_(false),
+      done_(false) {}
+
+ColumnarExtractor::~ColumnarExtractor() { Close(); }
+
+bool ColumnarExtractor::Execute(const Array<String>& params, bool buffered) {
+  std::vector<MYSQL_BIND> binds(params.Count());
+  std::vector<unsigned long> lengths(params.Count());
+  for (int32 i = 0; i < params.Count(); ++i) {
+    lengths[i] = static_cast<unsigned long>(params[i].Len());
+    std::memset(&binds[i], 0, sizeof(MYSQL_BIND));
+    binds[i].buffer_type = MYSQL_TYPE_STRING;
+    binds[i].buffer = const_cast<char*>(params[i].c_str());
+    binds[i].buffer_length = lengths[i];
+    binds[i].length = &lengths[i];
+  }
+  executor_.BindParams(binds.empty() ? nullptr : &binds[0], binds.size());
+
+  MYSQL_STMT* stmt = executor_;
+  buffered_ = buffered;
+  if (buffered_) {
+    // Makes mysql_stmt_store_result() compute the longest value of every
+    // column, so that strings and BLOBs fit their buffers.
+    my_bool update_max_length = 1;
+    mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH,
+                        &update_max_length);
+  }
+
+  executed_ = true;
+  executor_.Execute();
+  if (buffered_ && mysql_stmt_store_result(stmt) != 0) {
+    throw StatementException("mysql_stmt_store_result error", stmt);
+  }
+
+  metadata_ = mysql_stmt_result_metadata(stmt);
+  if (!metadata_) {
+    // INSERT, UPDATE etc.
+    done_ = true;
+    return false;
+  }
+
+  const size_t count = mysql_num_fields(metadata_);
+  const MYSQL_FIELD* fields = mysql_fetch_fields(metadata_);
+  bindings_.resize(count);
+  row_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    enum_field_types buffer_type;
+    size_t size;
+    ColumnBinding& binding = bindings_[i];
+    binding.type = GetColumnType(fields[i], buffer_type, size);
+    if (!buffered_ && (binding.type == MetaColumn::FDT_STRING ||
+                       binding.type == MetaColumn::FDT_BLOB)) {
+      size = std::min<size_t>(fields[i].length, INITIAL_VARIABLE_SIZE);
+    }
+    binding.buffer.resize(size > 0 ? size : 1);
+
+    std::memset(&row_[i], 0, sizeof(MYSQL_BIND));
+    row_[i].buffer_type = buffer_type;
+    row_[i].buffer = binding.buffer.data();
+    row_[i].buffer_length = static_cast<unsigned long>(binding.buffer.size());
+    row_[i].length = &binding.length;
+    row_[i].is_null = &binding.is_null;
+    row_[i].error = &binding.error;
+    row_[i].is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+  }
+  executor_.BindResult(count > 0 ? &row_[0] : nullptr);
+  return true;
+}
+
+bool ColumnarExtractor::Fetch(ColumnarResult& result, size_t max_rows) {
+  if (!metadata_) {
+    return false;
+  }
+
+  const size_t count = bindings_.size();
+  if (result.ColumnCount() == 0) {
+    const MYSQL_FIELD* fields = mysql_fetch_fields(metadata_);
+    const size_t rows =
+        buffered_ ? static_cast<size_t>(mysql_stmt_num_rows(executor_)) : 0;
+    for (size_t i = 0; i < count; ++i) {
+      ColumnBuffer& column = result.AddColumn(fields[i].name, bindings_[i].type);
+      column.Reserve(std::min(rows, max_rows));
+    }
+  } else if (result.ColumnCount() != count) {
+    throw StatementException("Column count changed within a result");
+  }
+
+  size_t fetched = 0;
+  while (fetched < max_rows && !done_) {
+    if (!executor_.Fetch()) {
+      done_ = true;
+      break;
+    }
+    FetchTruncated();
+    for (size_t i = 0; i < count; ++i) {
+      if (bindings_[i].is_null) {
+        result.ColumnAt(i).AppendNull();
+      } else {
+        AppendValue(result.ColumnAt(i), bindings_[i].buffer.data(),
+                    bindings_[i].length);
+      }
+    }
+    ++fetched;
+  }
+  return fetched > 0;
+}
+
+void ColumnarExtractor::Close() {
+  if (!executed_) {
+    return;
+  }
+
+  executed_ = false;
+  done_ = true;
+  if (metadata_) {
+    mysql_free_result(metadata_);
+    metadata_ = nullptr;
+  }
+  // For an unbuffered result this reads the remaining rows off the
+  // connection, which is needed before it can be used again.
+  MYSQL_STMT* stmt = executor_;
+  mysql_stmt_free_result(stmt);
+  if (buffered_) {
+    // Turned off again before the statement goes back to the cache.
+    my_bool update_max_length = 0;
+    mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH,
+                        &update_max_length);
+  }
+}
+
+void ColumnarExtractor::FetchTruncated() {
+  bool rebind = false;
+  for (size_t i = 0; i < bindings_.size(); ++i) {
+    ColumnBinding& binding = bindings_[i];
+    if (binding.is_null || binding.length <= binding.buffer.size() ||
+        (binding.type != MetaColumn::FDT_STRING &&
+         binding.type != MetaColumn::FDT_BLOB)) {
+      continue;
+    }
+
+    // The buffer keeps its new size for the following rows.
+    binding.buffer.resize(binding.length);
+    row_[i].buffer = binding.buffer.data();
+    row_[i].buffer_length = binding.length;
+    executor_.FetchColumn(i, &row_[i]);
+    rebind = true;
+  }
+  if (rebind) {
+    executor_.BindResult(&row_[0]);
+  }
+}
+
+void ColumnarExtractor::Extract(StatementExecutor& executor,
+                                const Array<String>& params,
+                                ColumnarResult& result) {
+  result.Clear();
+
+  ColumnarExtractor extractor(executor);
+  if (!extractor.Execute(params, true)) {
+    result.SetAffectedRowCount(executor.AffectedRowCount());
+    return;
+  }
+
+  extractor.Fetch(result, std::numeric_limits<size_t>::max());
+  result.SetAffectedRowCount(result.RowCount());
+}
+
+}  // namespace mysql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include <mysql.h>
+#include <vector>
+#include "fun/base/container/array.h"
+#include "fun/sql/columnar_result.h"
+#include "fun/sql/mysql/mysql.h"
+#include "fun/sql/mysql/statement_executor.h"
+
+namespace fun {
+namespace sql {
+namespace mysql {
+
+/**
+ * Fills a ColumnarResult from a prepared statement.
+ *
+ * Prepared statements already use MySQL's binary protocol, so numbers,
+ * dates and times arrive as binary values. Each column is bound to a
+ * buffer of its own type, and every fetched row is appended to the
+ * column buffers without going through Var or a per-row container.
+ * DECIMAL is converted to double, as RecordSet does.
+ *
+ * The result is either buffered on the client first, which sizes the
+ * string buffers exactly, or fetched row by row from the connection,
+ * which keeps the memory use constant; string buffers then grow when a
+ * value does not fit.
+ */
+class FUN_MYSQL_API ColumnarExtractor {
+ public:
+  explicit ColumnarExtractor(StatementExecutor& executor);
+
+  /**
+   * Frees the result. Rows not fetched yet are read and discarded.
+   */
+  ~ColumnarExtractor();
+
+  /**
+   * Binds params as strings and executes the prepared statement. If
+   * buffered is true, the whole result is stored on the client. Returns
+   * false if the statement returns no rows.
+   */
+  bool Execute(const Array<String>& params, bool buffered);
+
+  /**
+   * Appends up to max_rows rows to result, adding the columns first if
+   * result has none. Returns false if no rows were left.
+   */
+  bool Fetch(ColumnarResult& result, size_t max_rows);
+
+  /**
+   * Frees the result; called by the destructor.
+   */
+  void Close();
+
+  /**
+   * Executes the prepared statement with a buffered result and replaces
+   * the contents of result with it.
+   */
+  static void Extract(StatementExecutor& executor, const Array<String>& params,
+                      ColumnarResult& result);
+
+ private:
+  /**
+   * Buffer a column is fetched into.
+   */
+  struct ColumnBinding {
+    MetaColumn::ColumnDataType type;
+    std::vector<char> buffer;
+    unsigned long length;
+    my_bool is_null;
+    my_bool error;
+  };
+
+  void FetchTruncated();
+
+  ColumnarExtractor(const ColumnarExtractor&) = delete;
+  ColumnarExtractor& operator=(const ColumnarExtractor&) = delete;
+
+  StatementExecutor& executor_;
+  MYSQL_RES* metadata_;
+  std::vector<ColumnBinding> bindings_;
+  std::vector<MYSQL_BIND> row_;
+  bool executed_;
+  bool buffered_;
+  bool done_;
+};
+
+}  // namespace mysql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,25 @@
+﻿#include "fun/sql/mysql/cursor_impl.h"
+
+namespace fun {
+namespace sql {
+namespace mysql {
+
+CursorImpl::CursorImpl(MYSQL* mysql, StatementExecutor::Cache* cache,
+                       const String& sql, const Array<String>& params)
+    : executor_(mysql, cache), extractor_(executor_) {
+  executor_.Prepare(sql);
+  extractor_.Execute(params, false);
+}
+
+CursorImpl::~CursorImpl() {}
+
+bool CursorImpl::Fetch(ColumnarResult& batch, size_t max_rows) {
+  batch.ClearRows();
+  return extractor_.Fetch(batch, max_rows);
+}
+
+void CursorImpl::Close() { extractor_.Close(); }
+
+}  // namespace mysql
+}  // namespace sql
+}  // namespace fun
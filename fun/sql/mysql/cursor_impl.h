@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <mysql.h>
+#include "fun/base/container/array.h"
+#include "fun/sql/cursor_impl.h"
+#include "fun/sql/mysql/columnar_extractor.h"
+#include "fun/sql/mysql/mysql.h"
+#include "fun/sql/mysql/statement_executor.h"
+
+namespace fun {
+namespace sql {
+namespace mysql {
+
+/**
+ * Cursor over a prepared statement whose result is not stored on the
+ * client: every mysql_stmt_fetch() reads the next row from the
+ * connection, the prepared statement counterpart of mysql_use_result().
+ */
+class FUN_MYSQL_API CursorImpl : public fun::sql::CursorImpl {
+ public:
+  CursorImpl(MYSQL* mysql, StatementExecutor::Cache* cache, const String& sql,
+             const Array<String>& params);
+
+  ~CursorImpl();
+
+  bool Fetch(ColumnarResult& batch, size_t max_rows);
+
+  /**
+   * Reads and discards the rows not fetched yet, as MySQL has no way to
+   * stop sending them, and returns the statement to the cache.
+   */
+  void Close();
+
+ private:
+  StatementExecutor executor_;
+  ColumnarExtractor extractor_;
+};
+
+}  // namespace mysql
+}  // namespace sql
+}  // namespace fun
@@ -6,7 +6,7 @@ namespace mysql {
 
 MySqlStatementImpl::MySqlStatementImpl(SessionImpl& h)
     : fun::sql::StatementImpl(h),
-      stmt_(h.handle()),
+      stmt_(h.handle(), h.GetStatementCache()),
       binder_(new Binder),
       extractor_(new Extractor(stmt_, metadata_)),
       has_next_(NEXT_DONTKNOW) {}
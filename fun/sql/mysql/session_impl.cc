@@ -1,9 +1,12 @@
 ﻿#include "fun/sql/mysql/session_impl.h"
 #include "fun/base/number_parser.h"
 #include "fun/base/string.h"
+#include "fun/sql/mysql/columnar_extractor.h"
+#include "fun/sql/mysql/cursor_impl.h"
 #include "fun/sql/mysql/mysql_statement_impl.h"
 #include "fun/sql/session.h"
 
+
 namespace {
 
 String CopyStripped(String::const_iterator from, String::const_iterator to) {
@@ -30,9 +33,14 @@ SessionImpl::SessionImpl(const String& connection_string, size_t login_timeout)
     : fun::sql::SessionImplBase<SessionImpl>(connection_string, login_timeout),
       connector_("MySQL"),
       handle_(0),
+      statement_cache_(
+          [](MYSQL_STMT*& stmt) { mysql_stmt_close(stmt); }),
       connected_(false),
-      in_transaction_(false) {
+      in_transaction_(false),
+      keep_statements_on_reset_(false) {
   AddProperty("insertId", &SessionImpl::SetInsertId, &SessionImpl::GetInsertId);
+  AddFeature("keepStatementsOnReset", &SessionImpl::SetKeepStatementsOnReset,
+             &SessionImpl::GetKeepStatementsOnReset);
   SetProperty("handle", static_cast<MYSQL*>(handle_));
   Open();
 }
@@ -236,17 +244,55 @@ bool SessionImpl::HasTransactionIsolation(uint32 ti) const {
 
 void SessionImpl::Close() {
   if (connected_) {
+    statement_cache_.Clear();
     handle_.Close();
     connected_ = false;
   }
 }
 
 void SessionImpl::Reset() {
-  if (connected_) {
+  if (!connected_) {
+    return;
+  }
+
+  if (keep_statements_on_reset_ && statement_cache_.Count() > 0) {
+    // Resetting the connection would drop the cached statements on the
+    // server. Only end any open transaction; SessionPool re-applies its
+    // settings when the session is put back.
+    handle_.Rollback();
+    in_transaction_ = false;
+  } else {
+    // mysql_reset_connection() deallocates the statements on the server.
+    statement_cache_.Clear();
     handle_.Reset();
   }
 }
 
+bool SessionImpl::IsGood() const {
+  return connected_ && mysql_ping(handle_) == 0;
+}
+
+void SessionImpl::ExecuteColumnar(const String& sql,
+                                  const Array<String>& params,
+                                  ColumnarResult& result) {
+  if (!connected_) {
+    throw NotConnectedException(GetConnectionString());
+  }
+
+  StatementExecutor executor(handle_, &statement_cache_);
+  executor.Prepare(sql);
+  ColumnarExtractor::Extract(executor, params, result);
+}
+
+SharedPtr<fun::sql::CursorImpl> SessionImpl::OpenCursor(
+    const String& sql, const Array<String>& params) {
+  if (!connected_) {
+    throw NotConnectedException(GetConnectionString());
+  }
+
+  return new CursorImpl(handle_, &statement_cache_, sql, params);
+}
+
 void SessionImpl::SetConnectionTimeout(size_t timeout) {
   handle_.SetOptions(MYSQL_OPT_READ_TIMEOUT,
                      static_cast<unsigned int>(timeout));
@@ -60,7 +60,12 @@ class FUN_MYSQL_API SessionImpl
 
   /**
    * Reset connection with dababase and clears session state, but without
-   * disconnecting
+   * disconnecting. The reset drops the cached prepared statements.
+   *
+   * With the "keepStatementsOnReset" feature, only rolls back the open
+   * transaction while statements are cached, so that they survive. Session
+   * variables, temporary tables, user locks and LAST_INSERT_ID() then carry
+   * over to the next user of a pooled session.
    */
   void Reset();
 
@@ -69,6 +74,25 @@ class FUN_MYSQL_API SessionImpl
    */
   bool IsConnected() const;
 
+  /**
+   * Returns true if connected and the server answers a ping.
+   */
+  bool IsGood() const;
+
+  /**
+   * Executes sql as a prepared statement, binding params as strings, and
+   * fetches the result with ColumnarExtractor.
+   */
+  void ExecuteColumnar(const String& sql, const Array<String>& params,
+                       ColumnarResult& result);
+
+  /**
+   * Returns a cursor that fetches the result of sql row by row, without
+   * buffering it on the client.
+   */
+  SharedPtr<fun::sql::CursorImpl> OpenCursor(const String& sql,
+                                             const Array<String>& params);
+
   /**
    * Sets the session connection timeout value.
    */
@@ -137,6 +161,17 @@ class FUN_MYSQL_API SessionImpl
    */
   bool IsAutoCommit(const String& name = "") const;
 
+  /**
+   * Sets whether Reset() keeps the cached prepared statements instead of
+   * resetting the connection. Off by default.
+   */
+  void SetKeepStatementsOnReset(const String&, bool val);
+
+  /**
+   * Returns whether Reset() keeps the cached prepared statements.
+   */
+  bool GetKeepStatementsOnReset(const String& name = "") const;
+
   /**
    * Try to set insert id - do nothing.
    */
@@ -157,6 +192,12 @@ class FUN_MYSQL_API SessionImpl
    */
   const String& GetConnectorName() const;
 
+  /**
+   * Returns the prepared statements kept for reuse by the statements of
+   * this session.
+   */
+  StatementExecutor::Cache* GetStatementCache() override;
+
  private:
   template <typename T>
   static inline T& GetValue(MYSQL_BIND* result, T& val) {
@@ -189,8 +230,10 @@ class FUN_MYSQL_API SessionImpl
 
   String connector_;
   mutable SessionHandle handle_;
+  StatementExecutor::Cache statement_cache_;
   bool connected_;
   bool in_transaction_;
+  bool keep_statements_on_reset_;
   size_t timeout_;
   fun::FastMutex mutex_;
 };
@@ -209,6 +252,18 @@ inline fun::Any SessionImpl::GetInsertId(const String&) const {
 
 inline SessionHandle& SessionImpl::GetHandle() { return handle_; }
 
+inline void SessionImpl::SetKeepStatementsOnReset(const String&, bool val) {
+  keep_statements_on_reset_ = val;
+}
+
+inline bool SessionImpl::GetKeepStatementsOnReset(const String&) const {
+  return keep_statements_on_reset_;
+}
+
+inline StatementExecutor::Cache* SessionImpl::GetStatementCache() {
+  return &statement_cache_;
+}
+
 inline const String& SessionImpl::GetConnectorName() const {
   return connector_;
 }
@@ -6,16 +6,55 @@ namespace fun {
 namespace sql {
 namespace mysql {
 
-StatementExecutor::StatementExecutor(MYSQL* mysql)
-    : session_handle_(mysql), affected_row_count_(0) {
-  if ((handle_ = mysql_stmt_init(mysql)) == 0) {
-    throw StatementException("mysql_stmt_init error");
+StatementExecutor::StatementExecutor(MYSQL* mysql, Cache* cache)
+    : session_handle_(mysql),
+      handle_(nullptr),
+      state_(STMT_INITED),
+      affected_row_count_(0),
+      cache_(cache),
+      reusable_(true) {
+  // A cached statement may make a new one unnecessary.
+  if (cache_ == nullptr) {
+    Init();
+  }
+}
+
+StatementExecutor::~StatementExecutor() {
+  if (handle_ == nullptr) {
+    return;
   }
 
-  state_ = STMT_INITED;
+  if (cache_ && state_ >= STMT_COMPILED && reusable_) {
+    // Reads and drops the rest of the result, so the connection is ready
+    // for the next command.
+    mysql_stmt_free_result(handle_);
+    cache_->Put(cache_key_, handle_);
+  } else {
+    mysql_stmt_close(handle_);
+  }
+}
+
+void StatementExecutor::Init() {
+  if ((handle_ = mysql_stmt_init(session_handle_)) == 0) {
+    throw StatementException("mysql_stmt_init error");
+  }
 }
 
-StatementExecutor::~StatementExecutor() { mysql_stmt_close(handle_); }
+void StatementExecutor::OnStatementError() {
+  // Any failed prepare, execute or fetch may leave the handle in a state
+  // that a later user cannot recover from (for instance 1243,
+  // ER_UNKNOWN_STMT_HANDLER), so the handle is closed rather than cached.
+  reusable_ = false;
+
+  int err = mysql_errno(session_handle_);
+  if (err == 2006 /* CR_SERVER_GONE_ERROR */ ||
+      err == 2013 /* CR_SERVER_LOST */) {
+    // The server has dropped all statements of the connection.
+    if (cache_) {
+      cache_->Clear();
+    }
+  }
+}
 
 int StatementExecutor::GetState() const { return state_; }
 
@@ -25,6 +64,24 @@ void StatementExecutor::Prepare(const String& query) {
     return;
   }
 
+  if (cache_) {
+    cache_key_ = StatementCacheBase::NormalizeSql(query);
+    MYSQL_STMT* cached;
+    if (cache_->Take(cache_key_, cached)) {
+      if (handle_) {
+        mysql_stmt_close(handle_);
+      }
+      handle_ = cached;
+      query_ = query;
+      state_ = STMT_COMPILED;
+      return;
+    }
+  }
+
+  if (handle_ == nullptr) {
+    Init();
+  }
+
   int rc = mysql_stmt_prepare(handle_, query.c_str(),
                               static_cast<unsigned int>(query.length()));
   if (rc != 0) {
@@ -37,6 +94,7 @@ void StatementExecutor::Prepare(const String& query) {
     }
   }
   if (rc != 0) {
+    OnStatementError();
     throw StatementException("mysql_stmt_prepare error", handle_, query);
   }
 
@@ -78,6 +136,7 @@ void StatementExecutor::Execute() {
   }
 
   if (mysql_stmt_execute(handle_) != 0) {
+    OnStatementError();
     throw StatementException("mysql_stmt_execute error", handle_, query_);
   }
 
@@ -100,6 +159,7 @@ bool StatementExecutor::Fetch() {
   // we have specified zero buffers for BLOBs, so DATA_TRUNCATED is normal in
   // this case
   if ((res != 0) && (res != MYSQL_NO_DATA) && (res != MYSQL_DATA_TRUNCATED)) {
+    OnStatementError();
     throw StatementException("mysql_stmt_fetch error", handle_, query_);
   }
 
@@ -2,6 +2,7 @@
 
 #include <mysql.h>
 #include "fun/sql/mysql/mysql_exception.h"
+#include "fun/sql/statement_cache.h"
 
 namespace fun {
 namespace sql {
@@ -14,10 +15,14 @@ class StatementExecutor {
  public:
   enum State { STMT_INITED, STMT_COMPILED, STMT_EXECUTED };
 
+  typedef StatementCache<MYSQL_STMT*> Cache;
+
   /**
-   * Creates the StatementExecutor.
+   * Creates the StatementExecutor. With a cache, Prepare() reuses a
+   * statement prepared earlier for the same SQL, and the destructor
+   * returns the statement to the cache instead of closing it.
    */
-  explicit StatementExecutor(MYSQL* mysql);
+  explicit StatementExecutor(MYSQL* mysql, Cache* cache = nullptr);
 
   /**
    * Destroys the StatementExecutor.
@@ -70,11 +75,18 @@ class StatementExecutor {
   operator MYSQL_STMT*();
 
  private:
+  void Init();
+  void OnStatementError();
+
   MYSQL* session_handle_;
   MYSQL_STMT* handle_;
   int state_;
   int affected_row_count_;
   String query_;
+  Cache* cache_;
+  String cache_key_;
+  // Cleared when an error may have left the statement unusable.
+  bool reusable_;
 
  public:
   StatementExecutor(const StatementExecutor&) = delete;
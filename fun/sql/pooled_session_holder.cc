@@ -5,7 +5,7 @@ namespace sql {
 
 PooledSessionHolder::PooledSessionHolder(SessionPool& owner,
                                          SessionImpl::Ptr session_impl)
-    : onwer_(owner), impl_(session_impl) {}
+    : onwer_(owner), impl_(session_impl), pool_slot_(INVALID_INDEX) {}
 
 PooledSessionHolder::~PooledSessionHolder() {}
 
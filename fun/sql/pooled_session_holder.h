@@ -48,10 +48,18 @@ class FUN_SQL_API PooledSessionHolder : public fun::RefCountedObject {
    */
   int32 Idle() const;
 
+  /**
+   * Index of the session in a lock-free SessionPool, or INVALID_INDEX.
+   */
+  int32 GetPoolSlot() const;
+
+  void SetPoolSlot(int32 slot);
+
  private:
   SessionPool& onwer_;
   SessionImpl::Ptr impl_;
   fun::Timestamp last_used_;
+  int32 pool_slot_;
   mutable fun::FastMutex mutex_;
 };
 
@@ -75,5 +83,9 @@ inline int32 PooledSessionHolder::Idle() const {
   return (int32)(last_used_.Elapsed() / fun::Timestamp::Resolution());
 }
 
+inline int32 PooledSessionHolder::GetPoolSlot() const { return pool_slot_; }
+
+inline void PooledSessionHolder::SetPoolSlot(int32 slot) { pool_slot_ = slot; }
+
 }  // namespace sql
 }  // namespace fun
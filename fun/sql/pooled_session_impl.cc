@@ -1,4 +1,5 @@
 #include "fun/sql/pooled_session_impl.h"
+#include "fun/sql/cursor_impl.h"
 #include "fun/sql/session_pool.h"
 #include "fun/sql/sql_exception.h"
 
@@ -28,6 +29,19 @@ void PooledSessionImpl::Commit() { return Access()->Commit(); }
 
 bool PooledSessionImpl::IsConnected() const { return Access()->IsConnected(); }
 
+bool PooledSessionImpl::IsGood() const { return Access()->IsGood(); }
+
+void PooledSessionImpl::ExecuteColumnar(const String& sql,
+                                        const Array<String>& params,
+                                        ColumnarResult& result) {
+  Access()->ExecuteColumnar(sql, params, result);
+}
+
+SharedPtr<CursorImpl> PooledSessionImpl::OpenCursor(
+    const String& sql, const Array<String>& params) {
+  return Access()->OpenCursor(sql, params);
+}
+
 void PooledSessionImpl::SetConnectionTimeout(size_t timeout) {
   return Access()->SetConnectionTimeout(timeout);
 }
@@ -37,6 +37,11 @@ class FUN_SQL_API PooledSessionImpl : public SessionImpl {
   void Close();
   void Reset();
   bool IsConnected() const;
+  bool IsGood() const;
+  void ExecuteColumnar(const String& sql, const Array<String>& params,
+                       ColumnarResult& result);
+  SharedPtr<CursorImpl> OpenCursor(const String& sql,
+                                   const Array<String>& params);
   void SetConnectionTimeout(size_t timeout);
   size_t GetConnectionTimeout() const;
   bool CanTransact() const;
@@ -0,0 +1,439 @@
+#include "fun/sql/postgresql/async_connection.h"
+
+#include <stdlib.h>
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+//
+// AsyncResult
+//
+
+AsyncResult::AsyncResult() : result_(nullptr) {}
+
+AsyncResult::AsyncResult(PGresult* result) : result_(result) {}
+
+AsyncResult::AsyncResult(const String& error_message)
+    : result_(nullptr), error_message_(error_message) {}
+
+AsyncResult::AsyncResult(AsyncResult&& other)
+    : result_(other.result_), error_message_(MoveTemp(other.error_message_)) {
+  other.result_ = nullptr;
+}
+
+AsyncResult& AsyncResult::operator=(AsyncResult&& other) {
+  if (this != &other) {
+    if (result_) {
+      PQclear(result_);
+    }
+    result_ = other.result_;
+    error_message_ = MoveTemp(other.error_message_);
+    other.result_ = nullptr;
+  }
+  return *this;
+}
+
+AsyncResult::~AsyncResult() {
+  if (result_) {
+    PQclear(result_);
+  }
+}
+
+bool AsyncResult::IsOk() const {
+  const ExecStatusType status = GetStatus();
+  return status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK ||
+         status == PGRES_SINGLE_TUPLE;
+}
+
+ExecStatusType AsyncResult::GetStatus() const {
+  return result_ ? PQresultStatus(result_) : PGRES_FATAL_ERROR;
+}
+
+String AsyncResult::GetErrorMessage() const {
+  if (result_ == nullptr) {
+    return error_message_;
+  }
+#if FUN_POSTGRESQL_HAS_PIPELINING
+  if (PQresultStatus(result_) == PGRES_PIPELINE_ABORTED) {
+    return "pipeline aborted by an earlier error";
+  }
+#endif
+  return PQresultErrorMessage(result_);
+}
+
+int32 AsyncResult::GetRowCount() const {
+  return result_ ? PQntuples(result_) : 0;
+}
+
+int32 AsyncResult::GetColumnCount() const {
+  return result_ ? PQnfields(result_) : 0;
+}
+
+const char* AsyncResult::GetColumnName(int32 column) const {
+  return result_ ? PQfname(result_, column) : nullptr;
+}
+
+bool AsyncResult::IsNull(int32 row, int32 column) const {
+  return result_ == nullptr || PQgetisnull(result_, row, column) == 1;
+}
+
+const char* AsyncResult::GetValue(int32 row, int32 column) const {
+  return result_ ? PQgetvalue(result_, row, column) : "";
+}
+
+int32 AsyncResult::GetLength(int32 row, int32 column) const {
+  return result_ ? PQgetlength(result_, row, column) : 0;
+}
+
+int64 AsyncResult::GetAffectedRowCount() const {
+  if (result_ == nullptr) {
+    return 0;
+  }
+  const char* tuples = PQcmdTuples(result_);
+  return tuples && tuples[0] ? ::strtoll(tuples, nullptr, 10) : 0;
+}
+
+//
+// AsyncConnection
+//
+
+AsyncConnection::AsyncConnection(net::EventLoop* loop,
+                                 const String& connection_string)
+    : loop_(loop),
+      connection_string_(connection_string),
+      conn_(nullptr),
+      state_(DISCONNECTED),
+      pipelined_(false),
+      pending_count_(0) {}
+
+AsyncConnection::~AsyncConnection() { Close(); }
+
+void AsyncConnection::Connect(const ConnectCallback& callback) {
+  loop_->AssertInLoopThread();
+  fun_check(state_ == DISCONNECTED);
+
+  connect_callback_ = callback;
+  conn_ = PQconnectStart(connection_string_.c_str());
+  if (conn_ == nullptr) {
+    ConnectFailed("out of memory");
+    return;
+  }
+  if (PQstatus(conn_) == CONNECTION_BAD) {
+    ConnectFailed(PQerrorMessage(conn_));
+    return;
+  }
+
+  state_ = CONNECTING;
+  SetChannel();
+  // PQconnectStart() behaves as if PQconnectPoll() returned
+  // PGRES_POLLING_WRITING.
+  UpdateInterest(true);
+}
+
+void AsyncConnection::ContinueConnect() {
+  const PostgresPollingStatusType status = PQconnectPoll(conn_);
+  if (status == PGRES_POLLING_FAILED) {
+    ConnectFailed(PQerrorMessage(conn_));
+    return;
+  }
+
+  // libpq opens a new socket when it moves on to the next host.
+  if (PQsocket(conn_) != channel_->GetFd()) {
+    RemoveChannel();
+    SetChannel();
+  }
+
+  if (status == PGRES_POLLING_READING) {
+    UpdateInterest(false);
+    return;
+  }
+  if (status == PGRES_POLLING_WRITING) {
+    UpdateInterest(true);
+    return;
+  }
+
+  // PGRES_POLLING_OK
+  if (PQsetnonblocking(conn_, 1) != 0) {
+    ConnectFailed(PQerrorMessage(conn_));
+    return;
+  }
+#if FUN_POSTGRESQL_HAS_PIPELINING
+  pipelined_ = PQenterPipelineMode(conn_) == 1;
+#endif
+  state_ = CONNECTED;
+  UpdateInterest(false);
+  SendQueued();
+
+  ConnectCallback callback = MoveTemp(connect_callback_);
+  if (callback) {
+    callback(String());
+  }
+}
+
+void AsyncConnection::ConnectFailed(const String& error) {
+  ConnectCallback callback = MoveTemp(connect_callback_);
+  FailAll(error);
+  if (callback) {
+    callback(error);
+  }
+}
+
+void AsyncConnection::Close() {
+  loop_->AssertInLoopThread();
+  FailAll("connection closed");
+}
+
+void AsyncConnection::SetChannel() {
+  fun_check(!channel_);
+  channel_.Reset(new net::reactor::Channel(loop_, PQsocket(conn_)));
+  channel_->SetReadCallback(
+      [this](const Timestamp& received_time) { HandleRead(received_time); });
+  channel_->SetWriteCallback([this]() { HandleWrite(); });
+}
+
+void AsyncConnection::RemoveChannel() {
+  if (!channel_) {
+    return;
+  }
+  channel_->DisableAll();
+  channel_->Remove();
+  // May be called from the channel's own callback; keep it alive until
+  // the event has been handled.
+  SharedPtr<net::reactor::Channel> channel = channel_;
+  loop_->QueueInLoop([channel]() {});
+  channel_.Reset();
+}
+
+void AsyncConnection::UpdateInterest(bool want_write) {
+  if (!channel_->IsReading()) {
+    channel_->EnableReading();
+  }
+  if (want_write && !channel_->IsWriting()) {
+    channel_->EnableWriting();
+  } else if (!want_write && channel_->IsWriting()) {
+    channel_->DisableWriting();
+  }
+}
+
+void AsyncConnection::Query(const String& sql, const Array<String>& params,
+                            const ResultCallback& callback) {
+  Command* command = new Command;
+  command->type = QUERY;
+  command->sql = sql;
+  command->params = params;
+  command->callback = callback;
+  Enqueue(command);
+}
+
+void AsyncConnection::Prepare(const String& name, const String& sql,
+                              const ResultCallback& callback) {
+  Command* command = new Command;
+  command->type = PREPARE;
+  command->name = name;
+  command->sql = sql;
+  command->callback = callback;
+  Enqueue(command);
+}
+
+void AsyncConnection::Execute(const String& name, const Array<String>& params,
+                              const ResultCallback& callback) {
+  Command* command = new Command;
+  command->type = EXECUTE;
+  command->name = name;
+  command->params = params;
+  command->callback = callback;
+  Enqueue(command);
+}
+
+void AsyncConnection::Enqueue(Command* command) {
+  if (loop_->IsInLoopThread()) {
+    EnqueueInLoop(command);
+  } else {
+    loop_->RunInLoop([this, command]() { EnqueueInLoop(command); });
+  }
+}
+
+void AsyncConnection::EnqueueInLoop(Command* command) {
+  ++pending_count_;
+  queued_.push_back(command);
+  SendQueued();
+}
+
+bool AsyncConnection::SendCommand(Command& command) {
+  Array<const char*> values;
+  values.Reserve(command.params.Count());
+  for (const String& param : command.params) {
+    values.Add(param.c_str());
+  }
+  const char* const* value_ptrs =
+      values.Count() > 0 ? values.ConstData() : nullptr;
+
+  int sent = 0;
+  switch (command.type) {
+    case QUERY:
+      sent = PQsendQueryParams(conn_, command.sql.c_str(), values.Count(),
+                               nullptr, value_ptrs, nullptr, nullptr, 0);
+      break;
+    case PREPARE:
+      sent = PQsendPrepare(conn_, command.name.c_str(), command.sql.c_str(), 0,
+                           nullptr);
+      break;
+    case EXECUTE:
+      sent = PQsendQueryPrepared(conn_, command.name.c_str(), values.Count(),
+                                 value_ptrs, nullptr, nullptr, 0);
+      break;
+  }
+  if (sent == 0) {
+    return false;
+  }
+
+#if FUN_POSTGRESQL_HAS_PIPELINING
+  // A sync point per query gives every query its own implicit
+  // transaction, so that an error does not abort the queries behind it.
+  if (pipelined_ && PQpipelineSync(conn_) == 0) {
+    return false;
+  }
+#endif
+  return true;
+}
+
+void AsyncConnection::SendQueued() {
+  if (state_ != CONNECTED) {
+    return;
+  }
+
+  bool sent_any = false;
+  while (!queued_.empty() && (pipelined_ || in_flight_.empty())) {
+    Command* command = queued_.front();
+    queued_.pop_front();
+    if (!SendCommand(*command)) {
+      // The connection is broken; everything behind fails the same way.
+      queued_.push_front(command);
+      FailAll(PQerrorMessage(conn_));
+      return;
+    }
+    in_flight_.push_back(command);
+    sent_any = true;
+  }
+
+  if (sent_any) {
+    Flush();
+  }
+}
+
+void AsyncConnection::Flush() {
+  const int result = PQflush(conn_);
+  if (result < 0) {
+    FailAll(PQerrorMessage(conn_));
+    return;
+  }
+  // 1 means the socket buffer is full; continue when it is writable.
+  UpdateInterest(result == 1);
+}
+
+void AsyncConnection::HandleRead(const Timestamp& received_time) {
+  if (state_ == CONNECTING) {
+    ContinueConnect();
+    return;
+  }
+  if (state_ != CONNECTED) {
+    return;
+  }
+
+  if (PQconsumeInput(conn_) == 0) {
+    FailAll(PQerrorMessage(conn_));
+    return;
+  }
+  ReadResults();
+
+  // Reading may have made room for pending output.
+  if (state_ == CONNECTED && channel_->IsWriting()) {
+    Flush();
+  }
+}
+
+void AsyncConnection::HandleWrite() {
+  if (state_ == CONNECTING) {
+    ContinueConnect();
+  } else if (state_ == CONNECTED) {
+    Flush();
+  }
+}
+
+void AsyncConnection::ReadResults() {
+  // Each query yields its result(s) followed by a nullptr, and in
+  // pipeline mode then the PGRES_PIPELINE_SYNC of its sync point. A
+  // second nullptr in a row means libpq has nothing more to return.
+  bool last_was_null = false;
+  while (state_ == CONNECTED && !in_flight_.empty() && !PQisBusy(conn_)) {
+    PGresult* result = PQgetResult(conn_);
+    if (result == nullptr) {
+      if (last_was_null) {
+        break;
+      }
+      last_was_null = true;
+      if (!pipelined_) {
+        CompleteFront();
+        SendQueued();
+      }
+      continue;
+    }
+    last_was_null = false;
+
+#if FUN_POSTGRESQL_HAS_PIPELINING
+    if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+      PQclear(result);
+      CompleteFront();
+      continue;
+    }
+#endif
+
+    // Keep the first error, or else the last result.
+    AsyncResult& front = in_flight_.front()->result;
+    if (front.GetHandle() == nullptr || front.IsOk()) {
+      front = AsyncResult(result);
+    } else {
+      PQclear(result);
+    }
+  }
+}
+
+void AsyncConnection::CompleteFront() {
+  Command* command = in_flight_.front();
+  in_flight_.pop_front();
+  --pending_count_;
+  if (command->callback) {
+    command->callback(command->result);
+  }
+  delete command;
+}
+
+void AsyncConnection::FailAll(const String& error) {
+  RemoveChannel();
+  if (conn_) {
+    PQfinish(conn_);
+    conn_ = nullptr;
+  }
+  state_ = DISCONNECTED;
+  pipelined_ = false;
+
+  // Callbacks may queue new queries; those wait for the next Connect().
+  std::deque<Command*> failed;
+  failed.swap(in_flight_);
+  failed.insert(failed.end(), queued_.begin(), queued_.end());
+  queued_.clear();
+
+  for (Command* command : failed) {
+    --pending_count_;
+    command->result = AsyncResult(error);
+    if (command->callback) {
+      command->callback(command->result);
+    }
+    delete command;
+  }
+}
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/base/ftl/function.h"
+#include "fun/base/shared_ptr.h"
+#include "fun/net/reactor/channel.h"
+#include "fun/net/reactor/event_loop.h"
+#include "fun/sql/postgresql/postgresql.h"
+
+#include <libpq-fe.h>
+
+#include <deque>
+
+#if FUN_WITH_COROUTINES
+#include "fun/base/async/task.h"
+#endif
+
+// Pipeline mode needs libpq 14 or later, which defines LIBPQ_HAS_PIPELINING.
+#if defined(LIBPQ_HAS_PIPELINING)
+#define FUN_POSTGRESQL_HAS_PIPELINING 1
+#else
+#define FUN_POSTGRESQL_HAS_PIPELINING 0
+#endif
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+/**
+ * Result of one query run by an AsyncConnection. Owns the PGresult.
+ *
+ * Values are returned in the text format, as the server sent them.
+ */
+class FUN_POSTGRESQL_API AsyncResult {
+ public:
+  AsyncResult();
+
+  /**
+   * Takes ownership of result, which may be nullptr.
+   */
+  explicit AsyncResult(PGresult* result);
+
+  /**
+   * Creates a failed result without a PGresult, e.g. when the
+   * connection was lost before the query completed.
+   */
+  explicit AsyncResult(const String& error_message);
+
+  AsyncResult(AsyncResult&& other);
+  AsyncResult& operator=(AsyncResult&& other);
+
+  AsyncResult(const AsyncResult&) = delete;
+  AsyncResult& operator=(const AsyncResult&) = delete;
+
+  ~AsyncResult();
+
+  /**
+   * Returns true if the query succeeded.
+   */
+  bool IsOk() const;
+
+  /**
+   * Returns the status of the PGresult, or PGRES_FATAL_ERROR if there is
+   * none.
+   */
+  ExecStatusType GetStatus() const;
+
+  /**
+   * Returns the error message, empty if the query succeeded.
+   */
+  String GetErrorMessage() const;
+
+  int32 GetRowCount() const;
+  int32 GetColumnCount() const;
+  const char* GetColumnName(int32 column) const;
+
+  bool IsNull(int32 row, int32 column) const;
+
+  /**
+   * Returns the value at row and column, an empty string for NULL.
+   */
+  const char* GetValue(int32 row, int32 column) const;
+  int32 GetLength(int32 row, int32 column) const;
+
+  /**
+   * Returns the number of rows affected by an INSERT, UPDATE, DELETE
+   * etc., 0 for other commands.
+   */
+  int64 GetAffectedRowCount() const;
+
+  /**
+   * Returns the underlying PGresult, still owned by this object.
+   */
+  PGresult* GetHandle() const { return result_; }
+
+ private:
+  PGresult* result_;
+  String error_message_;
+};
+
+/**
+ * Non-blocking PostgreSQL connection driven by a reactor EventLoop.
+ *
+ * Unlike a Session, which waits for every statement to finish, queries
+ * are only written to the socket, and results are delivered to a
+ * callback on the loop thread when they arrive. With libpq 14 or later
+ * the connection runs in pipeline mode, so any number of queries can be
+ * in flight at once and a batch of N queries costs one round trip
+ * instead of N. Each query is followed by its own sync point, so it runs
+ * in its own implicit transaction and an error fails only that query.
+ * Older libpq versions send one query at a time and queue the rest.
+ *
+ * Results are delivered in the order the queries were sent.
+ *
+ *   AsyncConnection conn(loop, "host=localhost dbname=test");
+ *   conn.Connect([&](const String& error) { ... });
+ *   conn.Query("SELECT name FROM users WHERE id = $1", {"42"},
+ *              [](AsyncResult& result) { ... });
+ *
+ * Query(), Prepare() and Execute() may be called from any thread; they
+ * are forwarded to the loop thread. Everything else, including the
+ * destructor, must run on the loop thread. Close() and the destructor
+ * fail the pending queries before they return; a callback must not
+ * destroy the connection itself, but may queue that with QueueInLoop().
+ */
+class FUN_POSTGRESQL_API AsyncConnection : Noncopyable {
+ public:
+  /**
+   * Called with an empty string when the connection is established,
+   * with the error message otherwise.
+   */
+  typedef Function<void(const String& error)> ConnectCallback;
+
+  typedef Function<void(AsyncResult& result)> ResultCallback;
+
+  /**
+   * Creates the connection. connection_string is in the format of
+   * PQconnectdb(), e.g. "host=localhost dbname=test user=me".
+   */
+  AsyncConnection(net::EventLoop* loop, const String& connection_string);
+
+  /**
+   * Closes the connection.
+   */
+  ~AsyncConnection();
+
+  /**
+   * Starts connecting without blocking the loop. Calling a query method
+   * before the connection is established is allowed; the queries are
+   * sent once it is.
+   */
+  void Connect(const ConnectCallback& callback);
+
+  /**
+   * Closes the connection. Queries that have not completed are failed.
+   */
+  void Close();
+
+  bool IsConnected() const { return state_ == CONNECTED; }
+
+  /**
+   * Returns true if queries are pipelined.
+   */
+  bool IsPipelined() const { return pipelined_; }
+
+  /**
+   * Returns the number of queries that were queued and have not
+   * completed yet.
+   */
+  int32 GetPendingCount() const { return pending_count_; }
+
+  /**
+   * Runs sql with the parameters $1, $2, ... given in the text format.
+   */
+  void Query(const String& sql, const Array<String>& params,
+             const ResultCallback& callback);
+
+  void Query(const String& sql, const ResultCallback& callback) {
+    Query(sql, Array<String>(), callback);
+  }
+
+  /**
+   * Prepares sql as the named statement for Execute().
+   */
+  void Prepare(const String& name, const String& sql,
+               const ResultCallback& callback);
+
+  /**
+   * Runs the statement prepared as name.
+   */
+  void Execute(const String& name, const Array<String>& params,
+               const ResultCallback& callback);
+
+  net::EventLoop* GetLoop() const { return loop_; }
+
+ private:
+  enum State { DISCONNECTED, CONNECTING, CONNECTED };
+
+  enum CommandType { QUERY, PREPARE, EXECUTE };
+
+  struct Command {
+    CommandType type;
+    String name;
+    String sql;
+    Array<String> params;
+    ResultCallback callback;
+    AsyncResult result;
+  };
+
+  void Enqueue(Command* command);
+  void EnqueueInLoop(Command* command);
+
+  void ContinueConnect();
+  void ConnectFailed(const String& error);
+  void SetChannel();
+  void RemoveChannel();
+  void UpdateInterest(bool want_write);
+
+  bool SendCommand(Command& command);
+  void SendQueued();
+  void Flush();
+
+  void HandleRead(const Timestamp& received_time);
+  void HandleWrite();
+  void ReadResults();
+  void CompleteFront();
+  void FailAll(const String& error);
+
+  net::EventLoop* loop_;
+  String connection_string_;
+  PGconn* conn_;
+  State state_;
+  bool pipelined_;
+  SharedPtr<net::reactor::Channel> channel_;
+  ConnectCallback connect_callback_;
+
+  // Queries waiting to be sent, and queries sent whose results have not
+  // all arrived yet, in order.
+  std::deque<Command*> queued_;
+  std::deque<Command*> in_flight_;
+  int32 pending_count_;
+};
+
+#if FUN_WITH_COROUTINES
+
+/// Awaiter returned by AsyncQuery() and AsyncExecute().
+class QueryAwaiter {
+ public:
+  QueryAwaiter(AsyncConnection& conn, bool prepared, const String& sql,
+               const Array<String>& params)
+      : conn_(conn), prepared_(prepared), sql_(sql), params_(params) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    // Results are delivered on the connection's loop thread; hop back to
+    // the loop the coroutine was suspended on, if it is another one.
+    net::EventLoop* loop = net::EventLoop::GetEventLoopOfCurrentThread();
+    AsyncConnection::ResultCallback callback =
+        [this, loop, awaiting](AsyncResult& result) {
+          result_ = MoveTemp(result);
+          if (loop && !loop->IsInLoopThread()) {
+            loop->QueueInLoop([awaiting]() { awaiting.resume(); });
+          } else {
+            awaiting.resume();
+          }
+        };
+    if (prepared_) {
+      conn_.Execute(sql_, params_, callback);
+    } else {
+      conn_.Query(sql_, params_, callback);
+    }
+  }
+
+  AsyncResult await_resume() { return MoveTemp(result_); }
+
+ private:
+  AsyncConnection& conn_;
+  bool prepared_;
+  String sql_;
+  Array<String> params_;
+  AsyncResult result_;
+};
+
+/// Sends a query and suspends until its result arrives:
+///
+///   AsyncResult result = co_await AsyncQuery(conn, "SELECT 1");
+///
+/// Coroutines on the same loop can await queries on one connection at
+/// the same time; they are pipelined.
+inline QueryAwaiter AsyncQuery(AsyncConnection& conn, const String& sql,
+                               const Array<String>& params = Array<String>()) {
+  return QueryAwaiter(conn, false, sql, params);
+}
+
+/// Like AsyncQuery(), for a statement prepared with
+/// AsyncConnection::Prepare().
+inline QueryAwaiter AsyncExecute(AsyncConnection& conn, const String& name,
+                                 const Array<String>& params) {
+  return QueryAwaiter(conn, true, name, params);
+}
+
+#endif  // FUN_WITH_COROUTINES
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,242 @@
+#include "fun/sql/postgresql/columnar_extractor.h"
+#include "fun/sql/postgresql/postgresql_types.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+namespace {
+
+const Oid NAMEOID = 19;
+const Oid JSONOID = 114;
+const Oid JSONBOID = 3802;
+
+// PostgreSQL counts dates and timestamps from 2000-01-01.
+const int32 EPOCH_OFFSET_DAYS = 10957;
+const int64 EPOCH_OFFSET_MICROSECONDS = 946684800000000LL;
+
+const uint16 NUMERIC_NEG = 0x4000;
+const uint16 NUMERIC_NAN = 0xC000;
+const uint16 NUMERIC_PINF = 0xD000;
+const uint16 NUMERIC_NINF = 0xF000;
+
+inline uint16 ReadUInt16(const char* p) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return static_cast<uint16>((b[0] << 8) | b[1]);
+}
+
+inline uint32 ReadUInt32(const char* p) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return (uint32(b[0]) << 24) | (uint32(b[1]) << 16) | (uint32(b[2]) << 8) |
+         uint32(b[3]);
+}
+
+inline uint64 ReadUInt64(const char* p) {
+  return (uint64(ReadUInt32(p)) << 32) | ReadUInt32(p + 4);
+}
+
+MetaColumn::ColumnDataType GetColumnType(Oid oid) {
+  switch (oid) {
+    case FLOAT4OID:
+      // Stored as float; unlike RecordSet, nothing needs to widen it.
+      return MetaColumn::FDT_FLOAT;
+    case TIMETZOID:
+      return MetaColumn::FDT_TIME;
+    case TIMESTAMPZOID:
+      return MetaColumn::FDT_TIMESTAMP;
+    case NAMEOID:
+    case JSONOID:
+    case JSONBOID:
+      return MetaColumn::FDT_STRING;
+    case BOOLOID:
+    case INT2OID:
+    case INT4OID:
+    case INT8OID:
+    case FLOAT8OID:
+    case NUMERICOID:
+    case CHAROID:
+    case BPCHAROID:
+    case VARCHAROID:
+    case BYTEAOID:
+    case TEXTOID:
+    case DATEOID:
+    case TIMEOID:
+    case TIMESTAMPOID:
+      return OidToColumnDataType(oid);
+    default:
+      // Kept in the binary format, which is not text for most types.
+      return MetaColumn::FDT_UNKNOWN;
+  }
+}
+
+double DecodeNumeric(const char* value, int length) {
+  if (length < 8) {
+    throw StatementException("Invalid binary NUMERIC value");
+  }
+  const int16 ndigits = static_cast<int16>(ReadUInt16(value));
+  const int16 weight = static_cast<int16>(ReadUInt16(value + 2));
+  const uint16 sign = ReadUInt16(value + 4);
+  if (sign == NUMERIC_NAN) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (sign == NUMERIC_PINF) {
+    return std::numeric_limits<double>::infinity();
+  }
+  if (sign == NUMERIC_NINF) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  if (length < 8 + 2 * ndigits) {
+    throw StatementException("Invalid binary NUMERIC value");
+  }
+
+  // Base 10000 digits, the first one weighted 10000^weight.
+  double result = 0;
+  for (int16 i = 0; i < ndigits; ++i) {
+    result = result * 10000 + ReadUInt16(value + 8 + 2 * i);
+  }
+  result *= std::pow(10000.0, weight - ndigits + 1);
+  return sign == NUMERIC_NEG ? -result : result;
+}
+
+void CheckLength(int length, int expected) {
+  if (length != expected) {
+    throw StatementException("Unexpected length of a binary value");
+  }
+}
+
+void AppendValue(ColumnBuffer& column, Oid oid, const char* value,
+                 int length) {
+  switch (oid) {
+    case BOOLOID:
+      CheckLength(length, 1);
+      column.Append<bool>(value[0] != 0);
+      break;
+    case INT2OID:
+      CheckLength(length, 2);
+      column.Append<int16>(static_cast<int16>(ReadUInt16(value)));
+      break;
+    case INT4OID:
+      CheckLength(length, 4);
+      column.Append<int32>(static_cast<int32>(ReadUInt32(value)));
+      break;
+    case INT8OID:
+      CheckLength(length, 8);
+      column.Append<int64>(static_cast<int64>(ReadUInt64(value)));
+      break;
+    case FLOAT4OID: {
+      CheckLength(length, 4);
+      const uint32 bits = ReadUInt32(value);
+      float f;
+      ::memcpy(&f, &bits, sizeof(f));
+      column.Append<float>(f);
+      break;
+    }
+    case FLOAT8OID: {
+      CheckLength(length, 8);
+      const uint64 bits = ReadUInt64(value);
+      double d;
+      ::memcpy(&d, &bits, sizeof(d));
+      column.Append<double>(d);
+      break;
+    }
+    case NUMERICOID:
+      column.Append<double>(DecodeNumeric(value, length));
+      break;
+    case DATEOID: {
+      CheckLength(length, 4);
+      int32 days = static_cast<int32>(ReadUInt32(value));
+      // Leave 'infinity' and '-infinity' alone.
+      if (days != std::numeric_limits<int32>::max() &&
+          days != std::numeric_limits<int32>::min()) {
+        days += EPOCH_OFFSET_DAYS;
+      }
+      column.Append<int32>(days);
+      break;
+    }
+    case TIMEOID:
+      CheckLength(length, 8);
+      column.Append<int64>(static_cast<int64>(ReadUInt64(value)));
+      break;
+    case TIMETZOID:
+      CheckLength(length, 12);
+      column.Append<int64>(static_cast<int64>(ReadUInt64(value)));
+      break;
+    case TIMESTAMPOID:
+    case TIMESTAMPZOID: {
+      CheckLength(length, 8);
+      int64 us = static_cast<int64>(ReadUInt64(value));
+      if (us != std::numeric_limits<int64>::max() &&
+          us != std::numeric_limits<int64>::min()) {
+        us += EPOCH_OFFSET_MICROSECONDS;
+      }
+      column.Append<int64>(us);
+      break;
+    }
+    case JSONBOID:
+      // A version byte, then the text.
+      if (length < 1) {
+        throw StatementException("Invalid binary JSONB value");
+      }
+      column.AppendBytes(value + 1, length - 1);
+      break;
+    default:
+      column.AppendBytes(value, length);
+      break;
+  }
+}
+
+}  // namespace
+
+void ColumnarExtractor::Extract(PGresult* pg_result, ColumnarResult& result) {
+  result.Clear();
+
+  if (PQresultStatus(pg_result) != PGRES_TUPLES_OK) {
+    const char* affected = PQcmdTuples(pg_result);
+    result.SetAffectedRowCount(
+        affected && affected[0] ? ::strtoul(affected, nullptr, 10) : 0);
+    return;
+  }
+
+  Append(pg_result, result);
+  result.SetAffectedRowCount(result.RowCount());
+}
+
+void ColumnarExtractor::Append(PGresult* pg_result, ColumnarResult& result) {
+  const int rows = PQntuples(pg_result);
+  const int columns = PQnfields(pg_result);
+  if (result.ColumnCount() == 0) {
+    for (int col = 0; col < columns; ++col) {
+      if (PQfformat(pg_result, col) != 1) {
+        throw StatementException("Columnar results need the binary format");
+      }
+      ColumnBuffer& column = result.AddColumn(
+          PQfname(pg_result, col), GetColumnType(PQftype(pg_result, col)));
+      column.Reserve(rows);
+    }
+  } else if (result.ColumnCount() != static_cast<size_t>(columns)) {
+    throw StatementException("Column count changed within a result");
+  }
+
+  // Column by column, so that each buffer is written sequentially.
+  for (int col = 0; col < columns; ++col) {
+    ColumnBuffer& column = result.ColumnAt(col);
+    const Oid oid = PQftype(pg_result, col);
+    for (int row = 0; row < rows; ++row) {
+      if (PQgetisnull(pg_result, row, col)) {
+        column.AppendNull();
+      } else {
+        AppendValue(column, oid, PQgetvalue(pg_result, row, col),
+                    PQgetlength(pg_result, row, col));
+      }
+    }
+  }
+}
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "fun/sql/columnar_result.h"
+#include "fun/sql/postgresql/postgresql.h"
+
+#include <libpq-fe.h>
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+/**
+ * Fills a ColumnarResult from a PGresult in the binary format.
+ *
+ * Integers, floating point numbers, booleans, dates, times and
+ * timestamps are decoded from their network byte order representation
+ * straight into the column buffers; NUMERIC is converted to double, as
+ * RecordSet does. Character types, JSON and JSONB are stored as strings
+ * and BYTEA as BLOB. Values of other types are stored as they were sent,
+ * in PostgreSQL's binary format, with the type FDT_UNKNOWN.
+ *
+ * Timestamps with time zone are stored in UTC; the zone of TIMETZ is
+ * dropped.
+ */
+class FUN_POSTGRESQL_API ColumnarExtractor {
+ public:
+  /**
+   * Replaces the contents of result with the rows of pg_result, which
+   * must have been requested in the binary format (resultFormat 1).
+   */
+  static void Extract(PGresult* pg_result, ColumnarResult& result);
+
+  /**
+   * Appends the rows of pg_result to result, adding the columns first if
+   * result has none. Used with single-row mode, where every row arrives
+   * in a PGresult of its own.
+   */
+  static void Append(PGresult* pg_result, ColumnarResult& result);
+};
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
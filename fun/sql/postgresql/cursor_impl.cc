@@ -0,0 +1,106 @@
+#include "fun/sql/postgresql/cursor_impl.h"
+#include "fun/sql/postgresql/columnar_extractor.h"
+#include "fun/sql/postgresql/postgresql_exception.h"
+#include "fun/sql/postgresql/postgresql_types.h"
+#include "fun/sql/sql_exception.h"
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+CursorImpl::CursorImpl(SessionHandle& session_handle, const String& sql,
+                       const Array<String>& params)
+    : session_handle_(session_handle), done_(false) {
+  if (!session_handle_.IsConnected()) {
+    throw NotConnectedException();
+  }
+
+  Array<const char*> values;
+  values.Reserve(params.Count());
+  for (const String& param : params) {
+    values.Add(param.c_str());
+  }
+
+  fun::FastMutex::ScopedLock guard(session_handle_.GetMutex());
+  // resultFormat 1: all columns in the binary format.
+  if (!PQsendQueryParams(session_handle_, sql.c_str(), values.Count(),
+                         nullptr,
+                         values.Count() > 0 ? values.ConstData() : nullptr,
+                         nullptr, nullptr, 1)) {
+    done_ = true;
+    throw StatementException(String("postgresql cursor error: ") +
+                             PQerrorMessage(session_handle_) + " " + sql);
+  }
+  if (!PQsetSingleRowMode(session_handle_)) {
+    Drain();
+    done_ = true;
+    throw StatementException("postgresql cursor error: single-row mode " +
+                             sql);
+  }
+}
+
+CursorImpl::~CursorImpl() {
+  try {
+    Close();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+bool CursorImpl::Fetch(ColumnarResult& batch, size_t max_rows) {
+  batch.ClearRows();
+  if (done_) {
+    return false;
+  }
+
+  fun::FastMutex::ScopedLock guard(session_handle_.GetMutex());
+  while (batch.RowCount() < max_rows) {
+    PGresult* pg_result = PQgetResult(session_handle_);
+    if (!pg_result) {
+      done_ = true;
+      break;
+    }
+
+    PQResultClear result_clearer(pg_result);
+    switch (PQresultStatus(pg_result)) {
+      case PGRES_SINGLE_TUPLE:
+        ColumnarExtractor::Append(pg_result, batch);
+        break;
+      case PGRES_TUPLES_OK:
+        // End of the rows; adds the columns of an empty result.
+        ColumnarExtractor::Append(pg_result, batch);
+        break;
+      case PGRES_COMMAND_OK:
+        break;
+      default: {
+        const String message = PQresultErrorMessage(pg_result);
+        Drain();
+        done_ = true;
+        throw StatementException("postgresql cursor error: " + message);
+      }
+    }
+  }
+  return batch.RowCount() > 0;
+}
+
+void CursorImpl::Close() {
+  if (done_) {
+    return;
+  }
+
+  done_ = true;
+  // Cancel() takes the session mutex itself.
+  session_handle_.Cancel();
+  fun::FastMutex::ScopedLock guard(session_handle_.GetMutex());
+  Drain();
+}
+
+void CursorImpl::Drain() {
+  while (PGresult* pg_result = PQgetResult(session_handle_)) {
+    PQclear(pg_result);
+  }
+}
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/sql/cursor_impl.h"
+#include "fun/sql/postgresql/postgresql.h"
+#include "fun/sql/postgresql/session_handle.h"
+
+#include <libpq-fe.h>
+
+namespace fun {
+namespace sql {
+namespace postgresql {
+
+/**
+ * Cursor over a query sent with PQsendQueryParams() in single-row mode:
+ * the server streams the rows and libpq hands them over one PGresult at
+ * a time instead of collecting the whole result first. Unlike DECLARE
+ * CURSOR, this needs no transaction and no round trip per batch.
+ *
+ * Values are requested in the binary format and decoded by
+ * ColumnarExtractor.
+ */
+class FUN_POSTGRESQL_API CursorImpl : public fun::sql::CursorImpl {
+ public:
+  CursorImpl(SessionHandle& session_handle, const String& sql,
+             const Array<String>& params);
+
+  ~CursorImpl();
+
+  bool Fetch(ColumnarResult& batch, size_t max_rows);
+
+  /**
+   * Cancels the query if it is still running and discards the rows that
+   * were already sent.
+   */
+  void Close();
+
+ private:
+  void Drain();
+
+  SessionHandle& session_handle_;
+  bool done_;
+};
+
+}  // namespace postgresql
+}  // namespace sql
+}  // namespace fun
@@ -6,7 +6,8 @@ namespace postgresql {
 
 PostgreSqlStatementImpl::PostgreSqlStatementImpl(SessionImpl& session_impl)
     : fun::sql::StatementImpl(session_impl),
-      statement_executor_(session_impl.GetHandle()),
+      statement_executor_(session_impl.GetHandle(),
+                          session_impl.GetStatementCache()),
       binder_(new Binder),
       bulk_binder_(new Binder),
       extractor_(new Extractor(statement_executor_)),
@@ -37,6 +37,19 @@ bool SessionHandle::IsConnected() const {
   return IsConnectedNoLock();
 }
 
+bool SessionHandle::Ping() const {
+  fun::FastMutex::ScopedLock guard(session_mutex_);
+
+  if (!IsConnectedNoLock()) {
+    return false;
+  }
+
+  PGresult* pq_result = PQexec(connection_ptr_, "");
+  const bool answered = PQresultStatus(pq_result) == PGRES_EMPTY_QUERY;
+  PQclear(pq_result);
+  return answered && IsConnectedNoLock();
+}
+
 bool SessionHandle::IsConnectedNoLock() const {
   // DO NOT ACQUIRE THE MUTEX IN PRIVATE METHODS
 
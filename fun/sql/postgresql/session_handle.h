@@ -82,6 +82,11 @@ class SessionHandle {
    */
   bool IsConnected() const;
 
+  /**
+   * Sends an empty query; returns true if the server answered.
+   */
+  bool Ping() const;
+
   /**
    * Close connection
    */
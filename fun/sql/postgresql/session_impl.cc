@@ -1,6 +1,8 @@
 ﻿#include "fun/sql/postgresql/session_impl.h"
 #include "fun/base/number_parser.h"
 #include "fun/base/string.h"
+#include "fun/sql/postgresql/columnar_extractor.h"
+#include "fun/sql/postgresql/cursor_impl.h"
 #include "fun/sql/postgresql/postgresql_exception.h"
 #include "fun/sql/postgresql/postgresql_statement_impl.h"
 #include "fun/sql/postgresql/postgresql_types.h"
@@ -44,7 +46,10 @@ namespace sql {
 namespace postgresql {
 
 SessionImpl::SessionImpl(const String& connection_string, size_t login_timeout)
-    : fun::sql::SessionImplBase<SessionImpl>(connection_string, login_timeout) {
+    : fun::sql::SessionImplBase<SessionImpl>(connection_string, login_timeout),
+      statement_cache_([this](StatementExecutor::PreparedStatement& stmt) {
+        DeallocateCachedStatement(stmt);
+      }) {
   SetFeature("bulk", true);
   SetProperty("handle", static_cast<SessionHandle*>(&session_handle_));
   SetConnectionTimeout(CONNECTION_TIMEOUT_DEFAULT);
@@ -120,12 +125,67 @@ void SessionImpl::Close() {
   if (IsConnected()) {
     session_handle_.Disconnect();
   }
+
+  // The server has dropped the statements with the connection.
+  statement_cache_.Clear();
+}
+
+void SessionImpl::DeallocateCachedStatement(
+    StatementExecutor::PreparedStatement& stmt) {
+  try {
+    if (session_handle_.IsConnected()) {
+      session_handle_.DeallocatePreparedStatement(stmt.name);
+    }
+  } catch (...) {
+  }
 }
 
 void SessionImpl::Reset() {}
 
 bool SessionImpl::IsConnected() const { return session_handle_.IsConnected(); }
 
+bool SessionImpl::IsGood() const { return session_handle_.Ping(); }
+
+void SessionImpl::ExecuteColumnar(const String& sql,
+                                  const Array<String>& params,
+                                  ColumnarResult& result) {
+  if (!IsConnected()) {
+    throw NotConnectedException();
+  }
+
+  Array<const char*> values;
+  values.Reserve(params.Count());
+  for (const String& param : params) {
+    values.Add(param.c_str());
+  }
+
+  PGresult* pg_result = nullptr;
+  {
+    fun::FastMutex::ScopedLock guard(session_handle_.GetMutex());
+    // resultFormat 1: all columns in the binary format.
+    pg_result = PQexecParams(session_handle_, sql.c_str(), values.Count(),
+                             nullptr,
+                             values.Count() > 0 ? values.ConstData() : nullptr,
+                             nullptr, nullptr, 1);
+  }
+
+  PQResultClear result_clearer(pg_result);
+  if (!pg_result || (PQresultStatus(pg_result) != PGRES_TUPLES_OK &&
+                     PQresultStatus(pg_result) != PGRES_COMMAND_OK)) {
+    throw StatementException(String("postgresql columnar execute error: ") +
+                             (pg_result ? PQresultErrorMessage(pg_result)
+                                        : "out of memory") +
+                             " " + sql);
+  }
+
+  ColumnarExtractor::Extract(pg_result, result);
+}
+
+SharedPtr<fun::sql::CursorImpl> SessionImpl::OpenCursor(
+    const String& sql, const Array<String>& params) {
+  return new CursorImpl(session_handle_, sql, params);
+}
+
 StatementImpl::Ptr SessionImpl::CreateStatementImpl() {
   return new PostgreSqlStatementImpl(*this);
 }
@@ -2,6 +2,7 @@
 
 #include "fun/sql/postgresql/postgresql.h"
 #include "fun/sql/postgresql/session_handle.h"
+#include "fun/sql/postgresql/statement_executor.h"
 #include "fun/sql/session_impl_base.h"
 #include "fun/sql/statement_impl.h"
 
@@ -66,6 +67,24 @@ class FUN_POSTGRESQL_API SessionImpl
    */
   bool IsConnected() const;
 
+  /**
+   * Returns true if connected and the server answers an empty query.
+   */
+  bool IsGood() const;
+
+  /**
+   * Executes sql with PQexecParams(), requesting the result in the binary
+   * format, and decodes it with ColumnarExtractor.
+   */
+  void ExecuteColumnar(const String& sql, const Array<String>& params,
+                       ColumnarResult& result);
+
+  /**
+   * Returns a cursor that streams the result of sql in single-row mode.
+   */
+  SharedPtr<fun::sql::CursorImpl> OpenCursor(const String& sql,
+                                             const Array<String>& params);
+
   /**
    * Returns an PostgreSQL StatementImpl
    */
@@ -149,9 +168,18 @@ class FUN_POSTGRESQL_API SessionImpl
    */
   const String& GetConnectorName() const;
 
+  /**
+   * Returns the prepared statements kept for reuse by the statements of
+   * this session.
+   */
+  StatementExecutor::Cache* GetStatementCache() override;
+
  private:
+  void DeallocateCachedStatement(StatementExecutor::PreparedStatement& stmt);
+
   String connector_name_;
   mutable SessionHandle session_handle_;
+  StatementExecutor::Cache statement_cache_;
   size_t timeout_;
 };
 
@@ -163,6 +191,10 @@ inline bool SessionImpl::CanTransact() const { return true; }
 
 inline SessionHandle& SessionImpl::GetHandle() { return session_handle_; }
 
+inline StatementExecutor::Cache* SessionImpl::GetStatementCache() {
+  return &statement_cache_;
+}
+
 inline const String& SessionImpl::GetConnectorName() const {
   return connector_name_;
 }
@@ -70,18 +70,28 @@ namespace fun {
 namespace sql {
 namespace postgresql {
 
-StatementExecutor::StatementExecutor(SessionHandle& handle)
+StatementExecutor::StatementExecutor(SessionHandle& handle, Cache* cache)
     : session_handle_(handle),
       state_(STMT_INITED),
       result_handle_(0),
       count_placeholders_in_sql_statement_(0),
       current_row_(0),
-      affected_row_count_(0) {}
+      affected_row_count_(0),
+      cache_(cache),
+      reusable_(true) {}
 
 StatementExecutor::~StatementExecutor() {
   try {
-    // remove the prepared statement from the session
-    if (session_handle_.IsConnected() && state_ >= STMT_COMPILED) {
+    if (cache_ && reusable_ && session_handle_.IsConnected() &&
+        state_ >= STMT_COMPILED) {
+      // keep the prepared statement for the next statement with this sql
+      PreparedStatement prepared;
+      prepared.name = prepared_statement_name_;
+      prepared.placeholder_count = count_placeholders_in_sql_statement_;
+      prepared.result_columns.swap(result_columns_);
+      cache_->Put(cache_key_, prepared);
+    } else if (session_handle_.IsConnected() && state_ >= STMT_COMPILED) {
+      // remove the prepared statement from the session
       session_handle_.DeallocatePreparedStatement(prepared_statement_name_);
     }
 
@@ -105,6 +115,19 @@ void StatementExecutor::Prepare(const String& aSQLStatement) {
   // clear out any result data.  One way or another it is now obsolete.
   clearResults();
 
+  if (cache_) {
+    cache_key_ = StatementCacheBase::NormalizeSql(aSQLStatement);
+    PreparedStatement prepared;
+    if (cache_->Take(cache_key_, prepared)) {
+      sql_statement_ = aSQLStatement;
+      prepared_statement_name_ = prepared.name;
+      count_placeholders_in_sql_statement_ = prepared.placeholder_count;
+      result_columns_.swap(prepared.result_columns);
+      state_ = STMT_COMPILED;
+      return;
+    }
+  }
+
   // prepare parameters for the call to PQprepare
   const char* ptrCSQLStatement = aSQLStatement.c_str();
   size_t countPlaceholdersInSQLStatement =
@@ -290,6 +313,11 @@ void StatementExecutor::Execute() {
                        PQresultStatus(ptrPGResult) != PGRES_COPY_IN)) {
     PQResultClear result_clearer(ptrPGResult);
 
+    // The statement may have gone stale, for instance "cached plan must not
+    // change result type" after a schema change, so it is deallocated
+    // rather than cached.
+    reusable_ = false;
+
     const char* pSeverity = PQresultErrorField(ptrPGResult, PG_DIAG_SEVERITY);
     const char* pSQLState = PQresultErrorField(ptrPGResult, PG_DIAG_SQLSTATE);
     const char* pDetail =
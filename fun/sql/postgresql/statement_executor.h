@@ -4,6 +4,7 @@
 #include "fun/sql/postgresql/postgresql_exception.h"
 #include "fun/sql/postgresql/postgresql_types.h"
 #include "fun/sql/postgresql/session_handle.h"
+#include "fun/sql/statement_cache.h"
 
 #include <libpq-fe.h>
 
@@ -22,9 +23,24 @@ class StatementExecutor {
   enum State { STMT_INITED, STMT_COMPILED, STMT_EXECUTED };
 
   /**
-   * Creates the StatementExecutor.
+   * A statement prepared on the server, with what Prepare() learned
+   * about it.
    */
-  explicit StatementExecutor(SessionHandle& handle);
+  struct PreparedStatement {
+    String name;
+    size_t placeholder_count;
+    std::vector<MetaColumn> result_columns;
+  };
+
+  typedef StatementCache<PreparedStatement> Cache;
+
+  /**
+   * Creates the StatementExecutor. With a cache, Prepare() reuses a
+   * statement prepared earlier for the same SQL, and the destructor
+   * returns the statement to the cache instead of deallocating it,
+   * unless executing it has failed.
+   */
+  explicit StatementExecutor(SessionHandle& handle, Cache* cache = nullptr);
 
   /**
    * Destroys the StatementExecutor.
@@ -114,6 +130,11 @@ class StatementExecutor {
   OutputParameterVector output_parameter_vector_;
   size_t current_row_;  // current row of the result
   size_t affected_row_count_;
+
+  Cache* cache_;
+  String cache_key_;
+  // Cleared when an execute has failed.
+  bool reusable_;
 };
 
 //
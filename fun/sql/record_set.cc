@@ -15,6 +15,7 @@ namespace sql {
 RecordSet::RecordSet(const Statement& statement,
                      RowFormatter::Ptr row_formatter)
     : Statement(statement),
+      columnar_(nullptr),
       current_row_(0),
       begin_(new RowIterator(this, 0 == ExtractedRowCount())),
       end_(new RowIterator(this, true)) {
@@ -26,6 +27,7 @@ RecordSet::RecordSet(const Statement& statement,
 RecordSet::RecordSet(Session& session, const String& query,
                      RowFormatter::Ptr row_formatter)
     : Statement((session << query, now)),
+      columnar_(nullptr),
       current_row_(0),
       begin_(new RowIterator(this, 0 == ExtractedRowCount())),
       end_(new RowIterator(this, true)) {
@@ -34,8 +36,21 @@ RecordSet::RecordSet(Session& session, const String& query,
   }
 }
 
+RecordSet::RecordSet(Session& session, const ColumnarResult& result,
+                     RowFormatter::Ptr row_formatter)
+    : Statement(session),
+      columnar_(&result),
+      current_row_(0),
+      begin_(new RowIterator(this, 0 == result.RowCount())),
+      end_(new RowIterator(this, true)) {
+  if (row_formatter) {
+    SetRowFormatter(row_formatter);
+  }
+}
+
 RecordSet::RecordSet(const RecordSet& other)
     : Statement(other),
+      columnar_(other.columnar_),
       current_row_(other.current_row_),
       begin_(new RowIterator(this, 0 == ExtractedRowCount())),
       end_(new RowIterator(this, true)),
@@ -52,6 +67,8 @@ RecordSet::RecordSet(RecordSet&& other) : Statement(MoveTemp(other)) {
   other.filter_ = nullptr;
   row_map_ = MoveTemp(other.row_map_);
   other.row_map_.clear();
+  columnar_ = other.columnar_;
+  other.columnar_ = nullptr;
 }
 
 RecordSet::~RecordSet() {
@@ -83,6 +100,7 @@ RecordSet& RecordSet::Reset(const Statement& stmt) {
   row_map_.clear();
 
   Statement::operator=(stmt);
+  columnar_ = nullptr;
 
   begin_ = new RowIterator(this, 0 == ExtractedRowCount());
   end_ = new RowIterator(this, true);
@@ -96,6 +114,10 @@ fun::dynamic::Var RecordSet::value(size_t col, size_t data_row,
     throw InvalidAccessException("Row not allowed");
   }
 
+  if (columnar_) {
+    return columnar_->ValueAt(col, data_row);
+  }
+
   if (IsNull(col, data_row)) {
     return fun::dynamic::Var();
   }
@@ -148,6 +170,10 @@ fun::dynamic::Var RecordSet::value(const String& name, size_t data_row,
     throw InvalidAccessException("Row not allowed");
   }
 
+  if (columnar_) {
+    return columnar_->ValueAt(name, data_row);
+  }
+
   if (IsNull(metaColumn(name).Position(), data_row)) {
     return fun::dynamic::Var();
   }
@@ -215,8 +241,7 @@ Row& RecordSet::row(size_t pos) {
       row_ptr = new Row;
       row_ptr->SetFormatter(GetRowFormatter());
       for (size_t col = 0; col < columns; ++col) {
-        row_ptr->append(metaColumn(static_cast<uint32>(col)).name(),
-                        value(col, pos));
+        row_ptr->append(ColumnNameAt(col), value(col, pos));
       }
     }
 
@@ -230,11 +255,14 @@ Row& RecordSet::row(size_t pos) {
 }
 
 size_t RecordSet::RowCount() const {
-  if (0 == extractions().size() && 0 == ExtractedColumnCount()) {
-    return 0;
+  if (!columnar_) {
+    if (0 == extractions().size() && 0 == ExtractedColumnCount()) {
+      return 0;
+    }
+
+    fun_check(extractions().size());
   }
 
-  fun_check(extractions().size());
   size_t rc = StorageRowCount();
   if (!IsFiltered()) {
     return rc;
@@ -307,7 +335,8 @@ bool RecordSet::MovePrevious() {
 
 bool RecordSet::MoveLast() {
   if (StorageRowCount() > 0) {
-    size_t current_row = SubTotalRowCount() - 1;
+    size_t current_row =
+        (columnar_ ? columnar_->RowCount() : SubTotalRowCount()) - 1;
     if (!IsFiltered()) {
       current_row_ = current_row;
       return true;
@@ -330,7 +359,8 @@ bool RecordSet::MoveLast() {
 void RecordSet::SetRowFormatter(RowFormatter::Ptr row_formatter) {
   if (row_formatter) {
     if (row_formatter->GetTotalRowCount() == RowFormatter::INVALID_ROW_COUNT) {
-      row_formatter->SetTotalRowCount(static_cast<int>(GetTotalRowCount()));
+      row_formatter->SetTotalRowCount(
+          static_cast<int>(GetFormatterRowCount()));
     }
 
     Statement::SetRowFormatter(row_formatter);
@@ -378,7 +408,7 @@ std::ostream& RecordSet::Copy(std::ostream& os, size_t offset,
   }
 
   RowFormatter& rf = const_cast<RowFormatter&>((*begin_)->GetFormatter());
-  rf.SetTotalRowCount(static_cast<int>(GetTotalRowCount()));
+  rf.SetTotalRowCount(static_cast<int>(GetFormatterRowCount()));
   if (RowFormatter::FORMAT_PROGRESSIVE == rf.GetMode()) {
     os << rf.prefix();
     CopyNames(os);
@@ -399,5 +429,12 @@ void RecordSet::Filter(const fun::RefCountedPtr<RowFilter>& filter) {
 
 bool RecordSet::IsFiltered() const { return filter_ && !filter_->IsEmpty(); }
 
+void RecordSet::CheckNotColumnar() const {
+  if (columnar_) {
+    throw InvalidAccessException(
+        "Typed access to a RecordSet over a ColumnarResult");
+  }
+}
+
 }  // namespace sql
 }  // namespace fun
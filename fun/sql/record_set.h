@@ -6,6 +6,7 @@
 #include "fun/base/exception.h"
 #include "fun/base/string.h"
 #include "fun/sql/bulk_extraction.h"
+#include "fun/sql/columnar_result.h"
 #include "fun/sql/extraction.h"
 #include "fun/sql/lob.h"
 #include "fun/sql/row_filter.h"
@@ -43,6 +44,18 @@ namespace sql {
  *
  * The number of rows in the RecordSet can be limited by specifying
  * a limit for the Statement.
+ *
+ * A RecordSet can also be a view over a ColumnarResult, so that rows,
+ * iterators, filters and RowFormatters work on columnar results:
+ *
+ *     ColumnarResult result;
+ *     session.ExecuteColumnar("SELECT * FROM Person", result);
+ *     RecordSet rs(session, result, new SimpleRowFormatter);
+ *
+ * Values are then read from the column buffers on demand. The typed
+ * ValueAt<T>() and ColumnAt<C>() accessors return references into
+ * extraction containers, which a columnar result does not have; they
+ * throw InvalidAccessException on such a view.
  */
 class FUN_SQL_API RecordSet : private Statement {
  public:
@@ -50,7 +63,6 @@ class FUN_SQL_API RecordSet : private Statement {
   typedef const RowIterator ConstIterator;
   typedef RowIterator Iterator;
 
-  using Statement::IsNull;
   using Statement::SubTotalRowCount;
   using Statement::TotalRowCount;
 
@@ -78,12 +90,20 @@ class FUN_SQL_API RecordSet : private Statement {
   template <typename RF>
   RecordSet(Session& session, const String& query, const RF& row_formatter)
       : Statement((session << query, Keywords::now)),
+        columnar_(nullptr),
         current_row_(0),
         begin_(new RowIterator(this, 0 == ExtractedRowCount())),
         end_(new RowIterator(this, true)) {
     SetRowFormatter(Keywords::format(row_formatter));
   }
 
+  /**
+   * Creates a RecordSet that reads its rows from result, which must
+   * outlive it and must not be modified meanwhile.
+   */
+  RecordSet(Session& session, const ColumnarResult& result,
+            RowFormatter::Ptr row_formatter = nullptr);
+
   /**
    * Copy-creates the recordset.
    */
@@ -136,6 +156,7 @@ class FUN_SQL_API RecordSet : private Statement {
    */
   template <typename C>
   const Column<C>& ColumnAt(const String& name) const {
+    CheckNotColumnar();
     if (IsBulkExtraction()) {
       typedef InternalBulkExtraction<C> E;
       return ColumnAtImpl<C, E>(name);
@@ -150,6 +171,7 @@ class FUN_SQL_API RecordSet : private Statement {
    */
   template <typename C>
   const Column<C>& ColumnAt(size_t pos) const {
+    CheckNotColumnar();
     if (IsBulkExtraction()) {
       typedef InternalBulkExtraction<C> E;
       return ColumnAtImpl<C, E>(pos);
@@ -391,6 +413,11 @@ class FUN_SQL_API RecordSet : private Statement {
    */
   size_t ColumnPrecisionAt(const String& name) const;
 
+  /**
+   * Returns true if the value at the given column and row is null.
+   */
+  bool IsNull(size_t col, size_t row) const;
+
   /**
    * Returns true if column value of the current row is null.
    */
@@ -525,6 +552,16 @@ class FUN_SQL_API RecordSet : private Statement {
 
   size_t StorageRowCount() const;
 
+  /**
+   * Total row count handed to the RowFormatter.
+   */
+  size_t GetFormatterRowCount() const;
+
+  /**
+   * Throws InvalidAccessException for a view over a ColumnarResult.
+   */
+  void CheckNotColumnar() const;
+
   /**
    * Returns true if the specified row is allowed by the
    * currently active filter.
@@ -541,6 +578,8 @@ class FUN_SQL_API RecordSet : private Statement {
    */
   const fun::RefCountedPtr<RowFilter>& GetFilter() const;
 
+  // The result viewed, or nullptr if the rows come from the statement.
+  const ColumnarResult* columnar_;
   size_t current_row_;
   RowIterator* begin_;
   RowIterator* end_;
@@ -561,11 +600,12 @@ inline FUN_SQL_API std::ostream& operator<<(std::ostream& os,
 }
 
 inline size_t RecordSet::ExtractedRowCount() const {
-  return ExtractedRowCount();
+  return columnar_ ? columnar_->RowCount() : Statement::ExtractedRowCount();
 }
 
 inline size_t RecordSet::ColumnCount() const {
-  return static_cast<size_t>(extractions().size());
+  return columnar_ ? columnar_->ColumnCount()
+                   : static_cast<size_t>(extractions().size());
 }
 
 inline Statement& RecordSet::operator=(const Statement& stmt) {
@@ -595,15 +635,24 @@ inline const T& RecordSet::ValueAt(size_t col) const {
 }
 
 inline MetaColumn::ColumnDataType RecordSet::ColumnTypeAt(size_t pos) const {
+  if (columnar_) {
+    return columnar_->ColumnTypeAt(pos);
+  }
   return MetaColumnAt(static_cast<uint32>(pos)).Type();
 }
 
 inline MetaColumn::ColumnDataType RecordSet::ColumnTypeAt(
     const String& name) const {
+  if (columnar_) {
+    return columnar_->ColumnAt(name).GetType();
+  }
   return MetaColumnAt(name).Type();
 }
 
 inline const String& RecordSet::ColumnNameAt(size_t pos) const {
+  if (columnar_) {
+    return columnar_->ColumnNameAt(pos);
+  }
   return MetaColumnAt(static_cast<uint32>(pos)).name();
 }
 
@@ -623,7 +672,14 @@ inline size_t RecordSet::columnPrecision(const String& name) const {
   return MetaColumnAt(name).precision();
 }
 
+inline bool RecordSet::IsNull(size_t col, size_t row) const {
+  return columnar_ ? columnar_->IsNull(col, row) : Statement::IsNull(col, row);
+}
+
 inline bool RecordSet::IsNull(const String& name) const {
+  if (columnar_) {
+    return columnar_->ColumnAt(name).IsNull(current_row_);
+  }
   return IsNull(MetaColumnAt(name).position(), current_row_);
 }
 
@@ -646,7 +702,11 @@ inline const fun::RefCountedPtr<RowFilter>& RecordSet::GetFilter() const {
 inline void RecordSet::FormatNames() const { (*begin_)->FormatNames(); }
 
 inline size_t RecordSet::StorageRowCount() const {
-  return GetImpl()->ExtractedRowCount();
+  return columnar_ ? columnar_->RowCount() : GetImpl()->ExtractedRowCount();
+}
+
+inline size_t RecordSet::GetFormatterRowCount() const {
+  return columnar_ ? columnar_->RowCount() : GetTotalRowCount();
 }
 
 }  // namespace sql
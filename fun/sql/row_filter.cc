@@ -46,8 +46,7 @@ bool RowFilter::IsAllowed(size_t row) const {
   ComparisonMap::const_iterator end = comparison_map_.end();
   for (; it != end; ++it) {
     for (size_t col = 0; col < columns; ++col) {
-      const String name =
-          toUpper(rs.MetaColumnAt(static_cast<uint32>(col)).name());
+      const String name = toUpper(rs.ColumnNameAt(col));
       if (comparison_map_.find(name) == comparison_map_.end()) {
         continue;
       }
@@ -121,6 +121,12 @@ class FUN_SQL_API RowFormatter {
    */
   void SetTotalRowCount(int32 count);
 
+  /**
+   * Returns true if the prefix shows the total row count, which must then
+   * be set before the first row is formatted. False here.
+   */
+  virtual bool NeedsTotalRowCount() const;
+
   /**
    * Returns prefix string;
    */
@@ -186,6 +192,8 @@ inline void RowFormatter::SetTotalRowCount(int32 count) {
   AdjustPrefix();
 }
 
+inline bool RowFormatter::NeedsTotalRowCount() const { return false; }
+
 inline void RowFormatter::SetPrefix(const String& prefix) { prefix_ = prefix; }
 
 inline void RowFormatter::SetPostfix(const String& postfix) {
@@ -278,6 +278,19 @@ class FUN_SQL_API Session {
    */
   void Rollback();
 
+  /**
+   * Executes sql and stores its result in result, column by column; see
+   * ColumnarResult. params are the values of the placeholders ($1, $2,
+   * ... for PostgreSQL, ? for MySQL) in the text format.
+   */
+  void ExecuteColumnar(const String& sql, const Array<String>& params,
+                       ColumnarResult& result);
+
+  /**
+   * Executes sql without parameters and stores its result in result.
+   */
+  void ExecuteColumnar(const String& sql, ColumnarResult& result);
+
   /**
    * Returns true if session has transaction capabilities.
    */
@@ -422,6 +435,17 @@ inline void Session::Commit() { return impl_->Commit(); }
 
 inline void Session::Rollback() { return impl_->Rollback(); }
 
+inline void Session::ExecuteColumnar(const String& sql,
+                                     const Array<String>& params,
+                                     ColumnarResult& result) {
+  impl_->ExecuteColumnar(sql, params, result);
+}
+
+inline void Session::ExecuteColumnar(const String& sql,
+                                     ColumnarResult& result) {
+  impl_->ExecuteColumnar(sql, Array<String>(), result);
+}
+
 inline bool Session::CanTransact() { return impl_->CanTransact(); }
 
 inline bool Session::IsInTransaction() { return impl_->IsInTransaction(); }
@@ -1,5 +1,6 @@
 #include "fun/sql/session_impl.h"
 #include "fun/base/exception.h"
+#include "fun/sql/cursor_impl.h"
 
 namespace fun {
 namespace sql {
@@ -9,6 +10,18 @@ SessionImpl::SessionImpl(const String& connection_string, size_t timeout)
 
 SessionImpl::~SessionImpl() {}
 
+bool SessionImpl::IsGood() const { return IsConnected(); }
+
+void SessionImpl::ExecuteColumnar(const String&, const Array<String>&,
+                                  ColumnarResult&) {
+  throw NotImplementedException("Columnar results: " + GetConnectorName());
+}
+
+SharedPtr<CursorImpl> SessionImpl::OpenCursor(const String&,
+                                              const Array<String>&) {
+  throw NotImplementedException("Cursors: " + GetConnectorName());
+}
+
 void SessionImpl::Reconnect() {
   Close();
 
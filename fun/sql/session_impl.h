@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fun/base/any.h"
+#include "fun/base/container/array.h"
 #include "fun/base/format.h"
 #include "fun/base/string.h"
 #include "fun/ref_counted_object.h"
@@ -11,6 +12,8 @@
 namespace fun {
 namespace sql {
 
+class ColumnarResult;
+class CursorImpl;
 class StatementImpl;
 
 /**
@@ -83,6 +86,31 @@ virtual void Reset() = 0;
  */
 virtual bool IsConnected() const = 0;
 
+/**
+ * Returns true if the session is connected and the server answers.
+ * Connectors may check this with a round trip to the server, so it is
+ * meant for background health checks, not for every use. The default
+ * implementation returns IsConnected().
+ */
+virtual bool IsGood() const;
+
+/**
+ * Executes sql and stores its result in result, column by column, see
+ * ColumnarResult. params are the values of the placeholders, in the text
+ * format. Throws a NotImplementedException if the connector does not
+ * support columnar results.
+ */
+virtual void ExecuteColumnar(const String& sql, const Array<String>& params,
+                             ColumnarResult& result);
+
+/**
+ * Executes sql and returns a cursor that reads its result in batches,
+ * without buffering the whole result on the client. Throws a
+ * NotImplementedException if the connector does not support cursors.
+ */
+virtual SharedPtr<CursorImpl> OpenCursor(const String& sql,
+                                         const Array<String>& params);
+
 /**
  * Sets the session login timeout value.
  */
@@ -4,6 +4,7 @@
 #include "fun/sql/session_impl.h"
 #include "fun/sql/sql.h"
 #include "fun/sql/sql_exception.h"
+#include "fun/sql/statement_cache.h"
 
 namespace fun {
 namespace sql {
@@ -65,6 +66,10 @@ class SessionImplBase : public SessionImpl {
    * The "empty_string_is_null" and "force_empty_string" features are mutually
    * exclusive. While these features can not both be true at the same time, they
    * can both be false, resulting in default underlying database behavior.
+   *
+   * Adds the "statementCacheSize" property and the read-only
+   * "statementCacheHits" and "statementCacheMisses" properties, for
+   * connectors that return a cache from GetStatementCache().
    */
   SessionImplBase(const String& connection_string,
                   size_t timeout = LOGIN_TIMEOUT_DEFAULT)
@@ -88,6 +93,15 @@ class SessionImplBase : public SessionImpl {
 
     AddFeature("force_empty_string", &SessionImplBase<C>::SetForceEmptyString,
                &SessionImplBase<C>::GetForceEmptyString);
+
+    AddProperty("statementCacheSize", &SessionImplBase<C>::SetStatementCacheSize,
+                &SessionImplBase<C>::GetStatementCacheSize);
+
+    AddProperty("statementCacheHits", nullptr,
+                &SessionImplBase<C>::GetStatementCacheHits);
+
+    AddProperty("statementCacheMisses", nullptr,
+                &SessionImplBase<C>::GetStatementCacheMisses);
   }
 
   /**
@@ -249,6 +263,44 @@ class SessionImplBase : public SessionImpl {
     return force_empty_string_;
   }
 
+  /**
+   * Returns the prepared statement cache of the session, or nullptr if the
+   * connector does not cache statements.
+   */
+  virtual StatementCacheBase* GetStatementCache() { return nullptr; }
+
+  const StatementCacheBase* GetStatementCache() const {
+    return const_cast<SessionImplBase*>(this)->GetStatementCache();
+  }
+
+  /**
+   * Sets the number of prepared statements the session keeps for reuse;
+   * 0 disables the cache.
+   */
+  void SetStatementCacheSize(const String& name, const fun::Any& value) {
+    StatementCacheBase* cache = GetStatementCache();
+    if (cache == nullptr) {
+      throw NotSupportedException(name);
+    }
+
+    cache->SetCapacity(fun::RefAnyCast<size_t>(value));
+  }
+
+  fun::Any GetStatementCacheSize(const String& /*name*/ = "") const {
+    const StatementCacheBase* cache = GetStatementCache();
+    return cache ? cache->GetCapacity() : size_t(0);
+  }
+
+  fun::Any GetStatementCacheHits(const String& /*name*/ = "") const {
+    const StatementCacheBase* cache = GetStatementCache();
+    return cache ? cache->GetHitCount() : uint64(0);
+  }
+
+  fun::Any GetStatementCacheMisses(const String& /*name*/ = "") const {
+    const StatementCacheBase* cache = GetStatementCache();
+    return cache ? cache->GetMissCount() : uint64(0);
+  }
+
  protected:
   /**
    * Adds a feature to the map of supported features.
@@ -1,11 +1,437 @@
 #include "fun/sql/session_pool.h"
 #include <algorithm>
+#include "fun/base/caching_memory_pool.h"
+#include "fun/base/condition.h"
+#include "fun/base/event.h"
+#include "fun/base/metrics.h"
+#include "fun/base/thread.h"
+#include "fun/base/timestamp.h"
 #include "fun/sql/session_factory.h"
 #include "fun/sql/sql_exception.h"
 
 namespace fun {
 namespace sql {
 
+namespace {
+
+enum SlotState {
+  SLOT_FREE,
+  SLOT_IDLE,
+  SLOT_PARKED,
+  SLOT_UNLISTED,
+  SLOT_ACTIVE,
+  SLOT_CHECKING
+};
+
+}  // namespace
+
+/**
+ * Sessions of a pool in lock-free mode. Every session lives in one of
+ * max_sessions slots, and every slot is in exactly one of these places:
+ *
+ *   SLOT_FREE      on free_slots, without a session
+ *   SLOT_IDLE      on idle_slots
+ *   SLOT_PARKED    idle, in the thread cache of the thread that put it back
+ *   SLOT_UNLISTED  idle, taken off idle_slots by the health check until it
+ *                  has been looked at
+ *   SLOT_ACTIVE    checked out
+ *   SLOT_CHECKING  taken by the health check
+ *
+ * A slot popped from a stack belongs to the popping thread alone. Parked
+ * and unlisted slots can be claimed by several threads at once (their
+ * thread, a thread that found no idle session, the health check), so
+ * they are claimed by compare-and-swap.
+ */
+struct SessionPool::LockFreeState : internal::pool::ThreadCacheOwner {
+  struct Slot {
+    Slot* next;
+    std::atomic<int32> state;
+    PooledSessionHolderPtr holder;
+  };
+
+  LockFreeState(SessionPool& pool, const LockFreeOptions& options)
+      : pool(pool),
+        options(options),
+        slots(new Slot[options.max_sessions]),
+        allocated_count(0),
+        active_count(0),
+        idle_count(0),
+        unlisted_count(0),
+        waiter_count(0),
+        started(false) {
+    for (int32 i = options.max_sessions - 1; i >= 0; --i) {
+      slots[i].next = nullptr;
+      slots[i].state.store(SLOT_FREE, std::memory_order_relaxed);
+      free_slots.Push(&slots[i]);
+    }
+    if (options.thread_affinity) {
+      key = internal::pool::RegisterThreadCacheOwner(this);
+    }
+    if (!options.metrics_prefix.IsEmpty()) {
+      MetricsRegistry& registry = MetricsRegistry::Default();
+      wait_histogram = registry.GetHistogram(
+          options.metrics_prefix + "_wait_us", "Time to get a session");
+      exhausted_counter = registry.GetCounter(
+          options.metrics_prefix + "_exhausted", "Get() without a session");
+    }
+  }
+
+  ~LockFreeState() {
+    if (options.thread_affinity) {
+      internal::pool::UnregisterThreadCacheOwner(key);
+    }
+    delete[] slots;
+  }
+
+  void Start() {
+    bool expected = false;
+    if (options.health_check_interval > 0 &&
+        started.compare_exchange_strong(expected, true)) {
+      health_thread.StartFunc([this]() { RunHealthChecks(); });
+    }
+  }
+
+  void Stop() {
+    if (started.load()) {
+      stop_event.Set();
+      health_thread.Join();
+    }
+  }
+
+  Session Get() {
+    Start();
+
+    Timestamp start;
+    Slot* slot = Acquire();
+    if (slot == nullptr && options.max_wait > 0) {
+      slot = WaitForSlot(start);
+    }
+    if (wait_histogram.IsValid()) {
+      wait_histogram.Record(start.Elapsed());
+    }
+    if (slot == nullptr) {
+      if (exhausted_counter.IsValid()) {
+        exhausted_counter.Increment();
+      }
+      throw SessionPoolExhaustedException(pool.connector_);
+    }
+
+    active_count.fetch_add(1, std::memory_order_relaxed);
+    return Session(new PooledSessionImpl(slot->holder));
+  }
+
+  void PutBack(PooledSessionHolderPtr holder) {
+    Slot* slot = &slots[holder->GetPoolSlot()];
+    active_count.fetch_sub(1, std::memory_order_relaxed);
+
+    SessionImpl::Ptr impl = holder->GetSession();
+    try {
+      if (!impl->IsConnected()) {
+        Drop(slot);
+        return;
+      }
+      impl->Reset();
+      if (pool.has_overrides_.load(std::memory_order_relaxed)) {
+        fun::Mutex::ScopedLock guard(pool.mutex_);
+        pool.RevertOverrides(impl);
+      }
+      pool.ApplySettings(impl);
+    } catch (...) {
+      Drop(slot);
+      return;
+    }
+    holder->Access();
+
+    if (options.thread_affinity) {
+      Slot* parked = static_cast<Slot*>(internal::pool::FindThreadCache(key));
+      if (parked == nullptr ||
+          parked->state.load(std::memory_order_relaxed) != SLOT_PARKED) {
+        idle_count.fetch_add(1);
+        slot->state.store(SLOT_PARKED, std::memory_order_release);
+        internal::pool::SetThreadCache(key, slot);
+        NotifyWaiter();
+        return;
+      }
+    }
+    PushIdle(slot);
+  }
+
+  /**
+   * Returns a session without waiting, or nullptr.
+   */
+  Slot* Acquire() {
+    if (options.thread_affinity) {
+      Slot* parked = static_cast<Slot*>(internal::pool::FindThreadCache(key));
+      if (parked) {
+        internal::pool::SetThreadCache(key, nullptr);
+        if (Claim(parked)) {
+          return parked;
+        }
+      }
+    }
+
+    if (Slot* slot = PopIdle()) {
+      return slot;
+    }
+
+    if (options.thread_affinity || unlisted_count.load() > 0) {
+      for (int32 i = 0; i < options.max_sessions; ++i) {
+        const int32 state = slots[i].state.load(std::memory_order_relaxed);
+        if ((state == SLOT_PARKED || state == SLOT_UNLISTED) &&
+            Claim(&slots[i], state)) {
+          return &slots[i];
+        }
+      }
+    }
+
+    return Open();
+  }
+
+  Slot* WaitForSlot(const Timestamp& start) {
+    // Put back and Drop() notify only while waiter_count is non-zero; the
+    // counts are rechecked under wait_mutex after waiter_count has been
+    // raised, so a session that comes back in between is not missed.
+    waiter_count.fetch_add(1);
+    Slot* slot = nullptr;
+    for (;;) {
+      slot = Acquire();
+      if (slot) {
+        break;
+      }
+
+      const int32 remaining =
+          options.max_wait - static_cast<int32>(start.Elapsed() / 1000);
+      if (remaining <= 0) {
+        break;
+      }
+
+      FastMutex::ScopedLock guard(wait_mutex);
+      if (idle_count.load() == 0 &&
+          allocated_count.load() == options.max_sessions) {
+        session_returned.TryWait(wait_mutex, remaining);
+      }
+    }
+    waiter_count.fetch_sub(1);
+    return slot;
+  }
+
+  void NotifyWaiter() {
+    if (waiter_count.load() > 0) {
+      FastMutex::ScopedLock guard(wait_mutex);
+      session_returned.NotifyOne();
+    }
+  }
+
+  bool Claim(Slot* slot, int32 from_state = SLOT_PARKED,
+             int32 to_state = SLOT_ACTIVE) {
+    int32 expected = from_state;
+    if (slot->state.compare_exchange_strong(expected, to_state,
+                                            std::memory_order_acquire)) {
+      idle_count.fetch_sub(1);
+      if (from_state == SLOT_UNLISTED) {
+        unlisted_count.fetch_sub(1);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  Slot* PopIdle() {
+    Slot* slot = idle_slots.Pop();
+    if (slot) {
+      idle_count.fetch_sub(1);
+      slot->state.store(SLOT_ACTIVE, std::memory_order_relaxed);
+    }
+    return slot;
+  }
+
+  void PushIdle(Slot* slot) {
+    idle_count.fetch_add(1);
+    slot->state.store(SLOT_IDLE, std::memory_order_relaxed);
+    idle_slots.Push(slot);
+    NotifyWaiter();
+  }
+
+  /**
+   * Creates a session in a free slot. Returns nullptr if max_sessions
+   * are allocated; throws if the session cannot be created.
+   */
+  Slot* Open() {
+    Slot* slot = free_slots.Pop();
+    if (slot == nullptr) {
+      return nullptr;
+    }
+    allocated_count.fetch_add(1);
+
+    try {
+      Session session(SessionFactory::Instance().Create(
+          pool.connector_, pool.connection_string_));
+      pool.ApplySettings(session.GetImpl());
+      pool.CustomizeSession(session);
+
+      slot->holder = new PooledSessionHolder(pool, session.GetImpl());
+      slot->holder->SetPoolSlot(static_cast<int32>(slot - slots));
+    } catch (...) {
+      slot->holder = nullptr;
+      free_slots.Push(slot);
+      allocated_count.fetch_sub(1);
+      NotifyWaiter();
+      throw;
+    }
+
+    slot->state.store(SLOT_ACTIVE, std::memory_order_relaxed);
+    return slot;
+  }
+
+  /**
+   * Closes the session of a slot owned by the caller and frees the slot.
+   */
+  void Drop(Slot* slot) {
+    try {
+      slot->holder->GetSession()->Close();
+    } catch (...) {
+    }
+    slot->holder = nullptr;
+    slot->state.store(SLOT_FREE, std::memory_order_relaxed);
+    free_slots.Push(slot);
+    allocated_count.fetch_sub(1);
+    NotifyWaiter();
+  }
+
+  void Prewarm() {
+    while (!pool.shutdown_ && idle_count.load() < options.min_idle) {
+      Slot* slot = nullptr;
+      try {
+        slot = Open();
+      } catch (...) {
+        // The server may be down; the health check tries again.
+      }
+      if (slot == nullptr) {
+        break;
+      }
+      PushIdle(slot);
+    }
+  }
+
+  void RunHealthChecks() {
+    while (!stop_event.TryWait(options.health_check_interval)) {
+      CheckSessions();
+      Prewarm();
+    }
+  }
+
+  bool NeedsCheck(Slot* slot, int32 check_age) {
+    // A session that was used recently has just shown that it works.
+    const int32 idle = slot->holder->Idle();
+    return idle >= check_age || idle > pool.idle_time_;
+  }
+
+  /**
+   * Returns false if the session of a slot owned by the caller is dead or
+   * has been idle for too long.
+   */
+  bool Check(Slot* slot) {
+    if (slot->holder->Idle() > pool.idle_time_ &&
+        allocated_count.load() > options.min_sessions) {
+      return false;
+    }
+    return slot->holder->GetSession()->IsGood();
+  }
+
+  void CheckSessions() {
+    const int32 check_age = options.health_check_interval / 1000;
+
+    // Takes the idle sessions off the stack, so that no Get() returns one
+    // while it is pinged, but leaves them claimable: a Get() that finds
+    // the stack empty claims an unlisted session instead of failing. The
+    // health check then claims them back one at a time, so at most one
+    // session is out of reach while it is pinged.
+    Array<Slot*> recent;
+    Array<Slot*> to_check;
+    while (Slot* slot = idle_slots.Pop()) {
+      // Still counted in idle_count, which Claim() takes it off.
+      if (NeedsCheck(slot, check_age)) {
+        to_check.Add(slot);
+      } else {
+        recent.Add(slot);
+      }
+      unlisted_count.fetch_add(1);
+      slot->state.store(SLOT_UNLISTED, std::memory_order_release);
+    }
+    // Those used recently go back right away.
+    for (Slot* slot : recent) {
+      if (Claim(slot, SLOT_UNLISTED, SLOT_CHECKING)) {
+        PushIdle(slot);
+      }
+    }
+    for (Slot* slot : to_check) {
+      if (!Claim(slot, SLOT_UNLISTED, SLOT_CHECKING)) {
+        // Taken by a Get() in the meantime.
+        continue;
+      }
+      if (Check(slot)) {
+        PushIdle(slot);
+      } else {
+        Drop(slot);
+      }
+    }
+
+    if (!options.thread_affinity) {
+      return;
+    }
+    for (int32 i = 0; i < options.max_sessions; ++i) {
+      Slot* slot = &slots[i];
+      int32 expected = SLOT_PARKED;
+      if (slot->state.load(std::memory_order_relaxed) != SLOT_PARKED ||
+          !slot->state.compare_exchange_strong(expected, SLOT_CHECKING,
+                                               std::memory_order_acquire)) {
+        continue;
+      }
+      idle_count.fetch_sub(1);
+      if (!NeedsCheck(slot, check_age) || Check(slot)) {
+        idle_count.fetch_add(1);
+        slot->state.store(SLOT_PARKED, std::memory_order_release);
+        NotifyWaiter();
+      } else {
+        Drop(slot);
+      }
+    }
+  }
+
+  SessionPool& pool;
+  const LockFreeOptions options;
+  Slot* slots;
+  internal::pool::TaggedStack<Slot> free_slots;
+  internal::pool::TaggedStack<Slot> idle_slots;
+  internal::pool::ThreadCacheKey key;
+
+  std::atomic<int32> allocated_count;
+  std::atomic<int32> active_count;
+  // Idle, parked and unlisted sessions.
+  std::atomic<int32> idle_count;
+  std::atomic<int32> unlisted_count;
+  std::atomic<int32> waiter_count;
+
+  FastMutex wait_mutex;
+  Condition session_returned;
+
+  std::atomic<bool> started;
+  Thread health_thread;
+  Event stop_event;
+
+  Histogram wait_histogram;
+  Counter exhausted_counter;
+};
+
+SessionPool::LockFreeOptions::LockFreeOptions()
+    : min_sessions(1),
+      max_sessions(32),
+      idle_time(60),
+      min_idle(0),
+      thread_affinity(false),
+      health_check_interval(5000),
+      max_wait(0) {}
+
 SessionPool::SessionPool(const String& connector,
                          const String& connection_string, int32 min_sessions,
                          int32 max_sessions, int32 idle_time)
@@ -16,23 +442,50 @@ SessionPool::SessionPool(const String& connector,
       idle_time_(idle_time),
       session_count_(0),
       janitor_timer_(1000 * idle_time, 1000 * idle_time / 4),
-      shutdown_(false) {
+      shutdown_(false),
+      has_overrides_(false),
+      lock_free_(nullptr) {
   fun::TimerCallback<SessionPool> callback(*this, &SessionPool::OnJanitorTimer);
   janitor_timer_.Start(callback);
 }
 
+SessionPool::SessionPool(const String& connector,
+                         const String& connection_string,
+                         const LockFreeOptions& options)
+    : connector_(connector),
+      connection_string_(connection_string),
+      min_sessions_(options.min_sessions),
+      max_sessions_(options.max_sessions),
+      idle_time_(options.idle_time),
+      session_count_(0),
+      janitor_timer_(1000 * options.idle_time, 1000 * options.idle_time / 4),
+      shutdown_(false),
+      has_overrides_(false),
+      lock_free_(nullptr) {
+  if (options.max_sessions <= 0 || options.min_idle > options.max_sessions) {
+    throw InvalidArgumentException("SessionPool lock-free options");
+  }
+  // The janitor timer is not started; the health checks replace it.
+  lock_free_ = new LockFreeState(*this, options);
+}
+
 SessionPool::~SessionPool() {
   try {
     Shutdown();
   } catch (...) {
     fun_unexpected();
   }
+  delete lock_free_;
 }
 
 Session SessionPool::Get(const String& name, bool value) {
   Session s = Get();
-  add_feature_map_.insert(AddFeatureMap::value_type(
-      s.GetImpl(), std::make_pair(name, s.GetFeature(name))));
+  {
+    fun::Mutex::ScopedLock guard(mutex_);
+    has_overrides_ = true;
+    add_feature_map_.insert(AddFeatureMap::value_type(
+        s.GetImpl(), std::make_pair(name, s.GetFeature(name))));
+  }
   s.SetFeature(name, value);
 
   return s;
@@ -43,6 +496,10 @@ Session SessionPool::Get() {
     throw InvalidAccessException("Session pool has been shut down.");
   }
 
+  if (lock_free_) {
+    return lock_free_->Get();
+  }
+
   PurgeDeadSessions();
 
   fun::Mutex::ScopedLock guard(mutex_);
@@ -71,7 +528,7 @@ Session SessionPool::Get() {
 }
 
 void SessionPool::PurgeDeadSessions() {
-  if (shutdown_) {
+  if (shutdown_ || lock_free_) {
     return;
   }
 
@@ -91,11 +548,19 @@ void SessionPool::PurgeDeadSessions() {
 int32 SessionPool::Capacity() const { return max_sessions_; }
 
 int32 SessionPool::UsedCount() const {
+  if (lock_free_) {
+    return lock_free_->active_count.load();
+  }
+
   fun::Mutex::ScopedLock guard(mutex_);
   return (int32)active_sessions_.size();
 }
 
 int32 SessionPool::IdleCount() const {
+  if (lock_free_) {
+    return lock_free_->idle_count.load();
+  }
+
   fun::Mutex::ScopedLock guard(mutex_);
   return (int32)idle_sessions_.size();
 }
@@ -103,6 +568,10 @@ int32 SessionPool::IdleCount() const {
 int32 SessionPool::DeadCount() {
   int32 count = 0;
 
+  if (lock_free_) {
+    return count;
+  }
+
   fun::Mutex::ScopedLock guard(mutex_);
   SessionList::iterator it = active_sessions_.begin();
   SessionList::iterator itEnd = active_sessions_.end();
@@ -117,6 +586,10 @@ int32 SessionPool::DeadCount() {
 }
 
 int32 SessionPool::AllocatedCount() const {
+  if (lock_free_) {
+    return lock_free_->allocated_count.load();
+  }
+
   fun::Mutex::ScopedLock guard(mutex_);
   return session_count_;
 }
@@ -134,7 +607,8 @@ void SessionPool::SetFeature(const String& name, bool state) {
   }
 
   fun::Mutex::ScopedLock guard(mutex_);
-  if (session_count_ > 0) {
+  if (session_count_ > 0 ||
+      (lock_free_ && lock_free_->allocated_count.load() > 0)) {
     throw InvalidAccessException(
         "Features can not be set after the first session was created.");
   }
@@ -161,7 +635,8 @@ void SessionPool::SetProperty(const String& name, const fun::Any& value) {
   }
 
   fun::Mutex::ScopedLock guard(mutex_);
-  if (session_count_ > 0) {
+  if (session_count_ > 0 ||
+      (lock_free_ && lock_free_->allocated_count.load() > 0)) {
     throw InvalidAccessException(
         "Properties can not be set after first session was created.");
   }
@@ -201,6 +676,11 @@ void SessionPool::PutBack(PooledSessionHolderPtr holder) {
     return;
   }
 
+  if (lock_free_) {
+    lock_free_->PutBack(holder);
+    return;
+  }
+
   fun::Mutex::ScopedLock guard(mutex_);
 
   PooledSessionHolder* psh = holder.Get();
@@ -210,17 +690,7 @@ void SessionPool::PutBack(PooledSessionHolderPtr holder) {
       holder->GetSession()->Reset();
 
       // reverse settings applied at acquisition time, if any
-      AddPropertyMap::iterator pIt =
-          add_property_map_.find(holder->GetSession());
-      if (pIt != add_property_map_.end()) {
-        holder->GetSession()->SetProperty(pIt->second.first,
-                                          pIt->second.second);
-      }
-
-      AddFeatureMap::iterator fIt = add_feature_map_.find(holder->GetSession());
-      if (fIt != add_feature_map_.end()) {
-        holder->GetSession()->SetFeature(fIt->second.first, fIt->second.second);
-      }
+      RevertOverrides(holder->GetSession());
 
       // re-apply the default pool settings
       ApplySettings(holder->GetSession());
@@ -241,6 +711,25 @@ void SessionPool::PutBack(PooledSessionHolderPtr holder) {
   }
 }
 
+void SessionPool::RevertOverrides(SessionImpl::Ptr impl) {
+  AddPropertyMap::iterator pIt = add_property_map_.find(impl);
+  if (pIt != add_property_map_.end()) {
+    impl->SetProperty(pIt->second.first, pIt->second.second);
+  }
+
+  AddFeatureMap::iterator fIt = add_feature_map_.find(impl);
+  if (fIt != add_feature_map_.end()) {
+    impl->SetFeature(fIt->second.first, fIt->second.second);
+  }
+}
+
+void SessionPool::Prewarm() {
+  if (lock_free_ && !shutdown_) {
+    lock_free_->Start();
+    lock_free_->Prewarm();
+  }
+}
+
 void SessionPool::OnJanitorTimer(fun::Timer&) {
   if (shutdown_) {
     return;
@@ -275,6 +764,19 @@ void SessionPool::Shutdown() {
   janitor_timer_.Stop();
   CloseAll(idle_sessions_);
   CloseAll(active_sessions_);
+
+  if (lock_free_) {
+    lock_free_->Stop();
+    for (int32 i = 0; i < max_sessions_; ++i) {
+      PooledSessionHolderPtr holder = lock_free_->slots[i].holder;
+      if (holder) {
+        try {
+          holder->GetSession()->Close();
+        } catch (...) {
+        }
+      }
+    }
+  }
 }
 
 void SessionPool::CloseAll(SessionList& session_list) {
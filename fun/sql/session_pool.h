@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <map>
 #include "fun/base/any.h"
 #include "fun/base/mutex.h"
@@ -45,11 +46,75 @@ namespace sql {
  *     ...
  *     Session sess(pool.Get());
  *     ...
+ *
+ * A pool created with LockFreeOptions takes no lock on Get() and
+ * PutBack(): idle sessions are kept on a lock-free stack, and dead and
+ * expired sessions are found by a background health check instead of on
+ * every Get().
  */
 class FUN_SQL_API SessionPool : public RefCountedObject {
  public:
   typedef fun::RefCountedPtr<SessionPool> Ptr;
 
+  /**
+   * Settings of a pool in lock-free mode.
+   */
+  struct FUN_SQL_API LockFreeOptions {
+    LockFreeOptions();
+
+    /**
+     * Sessions that are kept even when they have been idle for longer
+     * than idle_time. Defaults to 1.
+     */
+    int32 min_sessions;
+
+    /**
+     * Defaults to 32.
+     */
+    int32 max_sessions;
+
+    /**
+     * Seconds after which an idle session is closed. Defaults to 60.
+     */
+    int32 idle_time;
+
+    /**
+     * Idle sessions that Prewarm() creates and the health check keeps
+     * available. Defaults to 0.
+     */
+    int32 min_idle;
+
+    /**
+     * If true, a session put back is kept for the thread that used it,
+     * and the thread's next Get() returns it again, warm caches and all.
+     * Other threads take such a session only when no other is idle.
+     * Defaults to false.
+     */
+    bool thread_affinity;
+
+    /**
+     * Milliseconds between health checks, which ping the sessions that
+     * have been idle for that long (see SessionImpl::IsGood()), close
+     * dead and expired ones and create sessions up to min_idle. 0
+     * disables them. Defaults to 5000.
+     */
+    int32 health_check_interval;
+
+    /**
+     * Milliseconds Get() waits for a session when max_sessions are in
+     * use, before it throws SessionPoolExhaustedException. Defaults to 0.
+     */
+    int32 max_wait;
+
+    /**
+     * If not empty, the time Get() takes is exported through
+     * MetricsRegistry::Default() as the histogram <prefix>_wait_us, and
+     * Get() calls that failed for lack of a session as the counter
+     * <prefix>_exhausted.
+     */
+    String metrics_prefix;
+  };
+
   /**
    * Creates the SessionPool for sessions with the given connector
    * and connection_string.
@@ -63,6 +128,12 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
               int32 min_sessions = 1, int32 max_sessions = 32,
               int32 idle_time = 60);
 
+  /**
+   * Creates a SessionPool in lock-free mode.
+   */
+  SessionPool(const String& connector, const String& connection_string,
+              const LockFreeOptions& options);
+
   /**
    * Destroys the SessionPool.
    */
@@ -90,8 +161,12 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
   template <typename T>
   Session Get(const String& name, const T& value) {
     Session s = Get();
-    add_property_map_.insert(AddPropertyMap::value_type(
-        s.GetImpl(), std::make_pair(name, s.GetProperty(name))));
+    {
+      fun::Mutex::ScopedLock guard(mutex_);
+      has_overrides_ = true;
+      add_property_map_.insert(AddPropertyMap::value_type(
+          s.GetImpl(), std::make_pair(name, s.GetProperty(name))));
+    }
     s.SetProperty(name, value);
 
     return s;
@@ -121,7 +196,9 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
   int32 IdleCount() const;
 
   /**
-   * Returns the number of not connected active sessions.
+   * Returns the number of not connected active sessions. Always 0 in
+   * lock-free mode, where dead sessions are dropped when they are put
+   * back or health checked.
    */
   int32 DeadCount();
 
@@ -177,6 +254,14 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
    */
   bool IsActive() const;
 
+  /**
+   * In lock-free mode, creates sessions until LockFreeOptions::min_idle
+   * are idle, and starts the health checks. Call it after setting the
+   * features and properties, before the pool is used. Does nothing in
+   * the default mode.
+   */
+  void Prewarm();
+
  protected:
   /**
    * Can be overridden by subclass to perform custom initialization
@@ -204,8 +289,16 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
   typedef std::map<SessionImpl::Ptr, PropertyPair> AddPropertyMap;
   typedef std::map<SessionImpl::Ptr, FeaturePair> AddFeatureMap;
 
+  struct LockFreeState;
+  friend struct LockFreeState;
+
   void CloseAll(SessionList& session_list);
 
+  /**
+   * Reverses the settings applied by Get(name, value). mutex_ is held.
+   */
+  void RevertOverrides(SessionImpl::Ptr impl);
+
   String connector_;
   String connection_string_;
   int32 min_sessions_;
@@ -220,7 +313,9 @@ class FUN_SQL_API SessionPool : public RefCountedObject {
   std::atomic<bool> shutdown_;
   AddPropertyMap add_property_map_;
   AddFeatureMap add_feature_map_;
+  std::atomic<bool> has_overrides_;
   mutable fun::Mutex mutex_;
+  LockFreeState* lock_free_;
 
   friend class PooledSessionImpl;
 
@@ -0,0 +1,198 @@
+﻿#include "fun/sql/sqlite/cursor_impl.h"
+#include "fun/base/string.h"
+#include "fun/sql/sqlite/sqlite-exception.h"
+#include "fun/sql/sqlite/utility.h"
+
+#if defined(FUN_UNBUNDLED)
+#include <sqlite3.h>
+#else
+#include "sqlite3.h"
+#endif
+
+namespace fun {
+namespace sql {
+namespace sqlite {
+
+namespace {
+
+MetaColumn::ColumnDataType GetCursorColumnType(sqlite3_stmt* stmt, int pos,
+                                               bool has_row) {
+  if (!sqlite3_column_decltype(stmt, pos)) {
+    switch (has_row ? sqlite3_column_type(stmt, pos) : SQLITE_NULL) {
+      case SQLITE_INTEGER:
+        return MetaColumn::FDT_INT64;
+      case SQLITE_FLOAT:
+        return MetaColumn::FDT_DOUBLE;
+      case SQLITE_BLOB:
+        return MetaColumn::FDT_BLOB;
+      default:
+        return MetaColumn::FDT_STRING;
+    }
+  }
+
+  const MetaColumn::ColumnDataType type = Utility::GetColumnType(stmt, pos);
+  switch (type) {
+    case MetaColumn::FDT_BOOL:
+    case MetaColumn::FDT_INT8:
+    case MetaColumn::FDT_UINT8:
+    case MetaColumn::FDT_INT16:
+    case MetaColumn::FDT_UINT16:
+    case MetaColumn::FDT_INT32:
+    case MetaColumn::FDT_UINT32:
+    case MetaColumn::FDT_INT64:
+    case MetaColumn::FDT_UINT64:
+    case MetaColumn::FDT_FLOAT:
+    case MetaColumn::FDT_DOUBLE:
+    case MetaColumn::FDT_BLOB:
+      return type;
+    default:
+      return MetaColumn::FDT_STRING;
+  }
+}
+
+}  // namespace
+
+CursorImpl::CursorImpl(sqlite3* db, SessionImpl::Cache* cache,
+                       const String& sql, const Array<String>& params)
+    : db_(db), cache_(cache), stmt_(0), done_(false) {
+  const String cache_key = StatementCacheBase::NormalizeSql(sql);
+  if (!cache_ || !cache_->Take(cache_key, stmt_)) {
+    const char* leftover = 0;
+    const int rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt_, &leftover);
+    if (rc != SQLITE_OK) {
+      if (stmt_) sqlite3_finalize(stmt_);
+      stmt_ = 0;
+      Utility::ThrowException(db_, rc, sqlite3_errmsg(db_));
+    }
+    String rest(leftover ? leftover : "");
+    if (!stmt_ || !trimInPlace(rest).IsEmpty()) {
+      if (stmt_) sqlite3_finalize(stmt_);
+      stmt_ = 0;
+      throw InvalidSQLStatementException(
+          "A cursor takes exactly one statement", sql);
+    }
+  }
+  cache_key_ = cache_key;
+
+  for (int32 i = 0; i < params.Count(); ++i) {
+    const int rc = sqlite3_bind_text(stmt_, i + 1, params[i].c_str(),
+                                     static_cast<int>(params[i].Len()),
+                                     SQLITE_TRANSIENT);
+    if (rc != SQLITE_OK) {
+      Close();
+      Utility::ThrowException(db_, rc, sqlite3_errmsg(db_));
+    }
+  }
+}
+
+CursorImpl::~CursorImpl() {
+  try {
+    Close();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+bool CursorImpl::Fetch(ColumnarResult& batch, size_t max_rows) {
+  batch.ClearRows();
+  while (!done_ && batch.RowCount() < max_rows) {
+    const int rc = sqlite3_step(stmt_);
+    if (rc == SQLITE_ROW) {
+      if (batch.ColumnCount() == 0) {
+        AddColumns(batch, true);
+      }
+      AppendRow(batch);
+    } else if (rc == SQLITE_DONE) {
+      if (batch.ColumnCount() == 0) {
+        AddColumns(batch, false);
+      }
+      Close();
+    } else {
+      const String message = sqlite3_errmsg(db_);
+      Close();
+      Utility::ThrowException(db_, rc, message);
+    }
+  }
+  return batch.RowCount() > 0;
+}
+
+void CursorImpl::Close() {
+  done_ = true;
+  if (!stmt_) {
+    return;
+  }
+
+  sqlite3_reset(stmt_);
+  sqlite3_clear_bindings(stmt_);
+  if (cache_) {
+    cache_->Put(cache_key_, stmt_);
+  } else {
+    sqlite3_finalize(stmt_);
+  }
+  stmt_ = 0;
+}
+
+void CursorImpl::AddColumns(ColumnarResult& batch, bool has_row) {
+  const int count = sqlite3_column_count(stmt_);
+  for (int i = 0; i < count; ++i) {
+    batch.AddColumn(sqlite3_column_name(stmt_, i),
+                    GetCursorColumnType(stmt_, i, has_row));
+  }
+}
+
+void CursorImpl::AppendRow(ColumnarResult& batch) {
+  for (size_t i = 0; i < batch.ColumnCount(); ++i) {
+    ColumnBuffer& column = batch.ColumnAt(i);
+    const int pos = static_cast<int>(i);
+    if (sqlite3_column_type(stmt_, pos) == SQLITE_NULL) {
+      column.AppendNull();
+      continue;
+    }
+
+    switch (column.GetType()) {
+      case MetaColumn::FDT_BOOL:
+        column.Append<bool>(sqlite3_column_int64(stmt_, pos) != 0);
+        break;
+      case MetaColumn::FDT_INT8:
+      case MetaColumn::FDT_UINT8:
+        column.Append<int8>(static_cast<int8>(sqlite3_column_int(stmt_, pos)));
+        break;
+      case MetaColumn::FDT_INT16:
+      case MetaColumn::FDT_UINT16:
+        column.Append<int16>(
+            static_cast<int16>(sqlite3_column_int(stmt_, pos)));
+        break;
+      case MetaColumn::FDT_INT32:
+      case MetaColumn::FDT_UINT32:
+        column.Append<int32>(
+            static_cast<int32>(sqlite3_column_int64(stmt_, pos)));
+        break;
+      case MetaColumn::FDT_INT64:
+      case MetaColumn::FDT_UINT64:
+        column.Append<int64>(sqlite3_column_int64(stmt_, pos));
+        break;
+      case MetaColumn::FDT_FLOAT:
+        column.Append<float>(
+            static_cast<float>(sqlite3_column_double(stmt_, pos)));
+        break;
+      case MetaColumn::FDT_DOUBLE:
+        column.Append<double>(sqlite3_column_double(stmt_, pos));
+        break;
+      case MetaColumn::FDT_BLOB: {
+        // sqlite3_column_bytes() must follow the call that converts.
+        const void* data = sqlite3_column_blob(stmt_, pos);
+        column.AppendBytes(data, sqlite3_column_bytes(stmt_, pos));
+        break;
+      }
+      default: {
+        const unsigned char* text = sqlite3_column_text(stmt_, pos);
+        column.AppendBytes(text, sqlite3_column_bytes(stmt_, pos));
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace sqlite
+}  // namespace sql
+}  // namespace fun
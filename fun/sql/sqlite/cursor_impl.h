@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "fun/base/container/array.h"
+#include "fun/sql/cursor_impl.h"
+#include "fun/sql/sqlite/session_impl.h"
+#include "fun/sql/sqlite/sqlite.h"
+
+namespace fun {
+namespace sql {
+namespace sqlite {
+
+/**
+ * Cursor over a single SQLite statement. SQLite computes every row when
+ * sqlite3_step() asks for it, so the cursor keeps nothing but the
+ * current batch.
+ *
+ * Integer, floating point and BLOB columns keep their types; everything
+ * else, including dates and times, is returned as text, the way SQLite
+ * stores it. The type of a column without a declared type, such as an
+ * expression, is taken from its value in the first row.
+ */
+class FUN_SQLITE_API CursorImpl : public fun::sql::CursorImpl {
+ public:
+  CursorImpl(sqlite3* db, SessionImpl::Cache* cache, const String& sql,
+             const Array<String>& params);
+
+  ~CursorImpl();
+
+  bool Fetch(ColumnarResult& batch, size_t max_rows);
+
+  /**
+   * Resets the statement and returns it to the statement cache.
+   */
+  void Close();
+
+ private:
+  void AddColumns(ColumnarResult& batch, bool has_row);
+  void AppendRow(ColumnarResult& batch);
+
+  sqlite3* db_;
+  SessionImpl::Cache* cache_;
+  String cache_key_;
+  sqlite3_stmt* stmt_;
+  bool done_;
+};
+
+}  // namespace sqlite
+}  // namespace sql
+}  // namespace fun
@@ -4,6 +4,7 @@
 #include "fun/base/string.h"
 #include "fun/sql/session.h"
 #include "fun/sql/sql_exception.h"
+#include "fun/sql/sqlite/cursor_impl.h"
 #include "fun/sql/sqlite/sqlite-exception.h"
 #include "fun/sql/sqlite/sqlite_statement_impl.h"
 #include "fun/sql/sqlite/utility.h"
@@ -33,6 +34,7 @@ SessionImpl::SessionImpl(const String& filename, size_t login_timeout)
     : fun::sql::SessionImplBase<SessionImpl>(filename, login_timeout),
       connector_(Connector::KEY),
       db_(0),
+      statement_cache_([](sqlite3_stmt*& stmt) { sqlite3_finalize(stmt); }),
       connected_(false),
       is_transaction_(false) {
   Open();
@@ -54,12 +56,18 @@ SessionImpl::~SessionImpl() {
 
 StatementImpl::Ptr SessionImpl::CreateStatementImpl() {
   fun_check_ptr(db_);
-  return new SQLiteStatementImpl(*this, db_);
+  return new SQLiteStatementImpl(*this, db_, &statement_cache_);
+}
+
+SharedPtr<fun::sql::CursorImpl> SessionImpl::OpenCursor(
+    const String& sql, const Array<String>& params) {
+  fun_check_ptr(db_);
+  return new CursorImpl(db_, &statement_cache_, sql, params);
 }
 
 void SessionImpl::Begin() {
   fun::Mutex::ScopedLock l(mutex_);
-  SQLiteStatementImpl tmp(*this, db_);
+  SQLiteStatementImpl tmp(*this, db_, &statement_cache_);
   tmp.Add(DEFERRED_BEGIN_TRANSACTION);
   tmp.Execute();
   is_transaction_ = true;
@@ -67,7 +75,7 @@ void SessionImpl::Begin() {
 
 void SessionImpl::Commit() {
   fun::Mutex::ScopedLock l(mutex_);
-  SQLiteStatementImpl tmp(*this, db_);
+  SQLiteStatementImpl tmp(*this, db_, &statement_cache_);
   tmp.Add(COMMIT_TRANSACTION);
   tmp.Execute();
   is_transaction_ = false;
@@ -75,7 +83,7 @@ void SessionImpl::Commit() {
 
 void SessionImpl::Rollback() {
   fun::Mutex::ScopedLock l(mutex_);
-  SQLiteStatementImpl tmp(*this, db_);
+  SQLiteStatementImpl tmp(*this, db_, &statement_cache_);
   tmp.Add(ABORT_TRANSACTION);
   tmp.Execute();
   is_transaction_ = false;
@@ -151,6 +159,9 @@ void SessionImpl::Open(const String& connect) {
 }
 
 void SessionImpl::Close() {
+  // Cached statements would keep the database from closing.
+  statement_cache_.Clear();
+
   if (db_) {
     int result = 0;
     int times = 10;
@@ -6,10 +6,12 @@
 #include "fun/sql/sqlite/binder.h"
 #include "fun/sql/sqlite/connector.h"
 #include "fun/sql/sqlite/sqlite.h"
+#include "fun/sql/statement_cache.h"
 #include "fun/sql/statement_impl.h"
 
 extern "C" {
 typedef struct sqlite3 sqlite3;
+typedef struct sqlite3_stmt sqlite3_stmt;
 }
 
 namespace fun {
@@ -22,6 +24,8 @@ namespace sqlite {
 class FUN_SQLITE_API SessionImpl
     : public fun::sql::SessionImplBase<SessionImpl> {
  public:
+  typedef StatementCache<sqlite3_stmt*> Cache;
+
   /**
    * Creates the SessionImpl. Opens a connection to the database.
    */
@@ -38,6 +42,13 @@ class FUN_SQLITE_API SessionImpl
    */
   StatementImpl::Ptr CreateStatementImpl();
 
+  /**
+   * Returns a cursor that steps through the result of sql, which must be
+   * a single statement.
+   */
+  SharedPtr<fun::sql::CursorImpl> OpenCursor(const String& sql,
+                                             const Array<String>& params);
+
   /**
    * Opens a connection to the Database.
    *
@@ -145,6 +156,12 @@ class FUN_SQLITE_API SessionImpl
    */
   const String& GetConnectorName() const;
 
+  /**
+   * Returns the prepared statements kept for reuse by the statements of
+   * this session.
+   */
+  Cache* GetStatementCache() override;
+
  protected:
   void SetConnectionTimeout(const String& prop, const fun::Any& value);
   fun::Any GetConnectionTimeout(const String& prop) const;
@@ -152,6 +169,7 @@ class FUN_SQLITE_API SessionImpl
  private:
   String connector_;
   sqlite3* db_;
+  Cache statement_cache_;
   bool connected_;
   bool is_transaction_;
   int timeout_;
@@ -170,6 +188,10 @@ inline bool SessionImpl::CanTransact() const { return true; }
 
 inline bool SessionImpl::IsInTransaction() const { return is_transaction_; }
 
+inline SessionImpl::Cache* SessionImpl::GetStatementCache() {
+  return &statement_cache_;
+}
+
 inline const String& SessionImpl::connectorName() const { return connector_; }
 
 inline size_t SessionImpl::GetConnectionTimeout() const {
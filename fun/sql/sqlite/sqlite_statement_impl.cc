@@ -18,10 +18,12 @@ namespace sqlite {
 const int SQLiteStatementImpl::FUN_SQLITE_INV_ROW_CNT = -1;
 
 SQLiteStatementImpl::SQLiteStatementImpl(fun::sql::SessionImpl& session,
-                                         sqlite3* db)
+                                         sqlite3* db, Cache* cache)
     : StatementImpl(session),
       db_(db),
       stmt_(0),
+      cache_(cache),
+      stmt_cacheable_(false),
       step_called_(false),
       next_response_(0),
       affected_row_count_(FUN_SQLITE_INV_ROW_CNT),
@@ -57,7 +59,18 @@ void SQLiteStatementImpl::CompileImpl() {
   const char* pLeftover = 0;
   bool queryFound = false;
 
-  do {
+  // Only the first statement of the sql can be cached; whether it is the
+  // only one is known after it has been compiled.
+  String cache_key;
+  if (cache_ && !leftover_) {
+    cache_key = StatementCacheBase::NormalizeSql(statement);
+    if (cache_->Take(cache_key, stmt)) {
+      pLeftover = "";
+      queryFound = true;
+    }
+  }
+
+  while (!queryFound) {
     rc = sqlite3_prepare_v2(db_, pSql, -1, &stmt, &pLeftover);
     if (rc != SQLITE_OK) {
       if (stmt) sqlite3_finalize(stmt);
@@ -74,7 +87,7 @@ void SQLiteStatementImpl::CompileImpl() {
         queryFound = true;
       }
     }
-  } while (rc == SQLITE_OK && !stmt && !queryFound);
+  }
 
   // Finalization call in Clear() invalidates the pointer, so the value is
   // remembered here. For last statement in a batch (or a single statement),
@@ -83,8 +96,13 @@ void SQLiteStatementImpl::CompileImpl() {
   // statements left.
   String leftOver(pLeftover);
   trimInPlace(leftOver);
+  const bool cacheable = !cache_key.IsEmpty() && leftOver.IsEmpty() && stmt;
   Clear();
   stmt_ = stmt;
+  if (cacheable) {
+    cache_key_ = cache_key;
+    stmt_cacheable_ = true;
+  }
   if (!leftOver.IsEmpty()) {
     leftover_ = new String(leftOver);
     can_compile_ = true;
@@ -193,9 +211,16 @@ void SQLiteStatementImpl::Clear() {
   affected_row_count_ = FUN_SQLITE_INV_ROW_CNT;
 
   if (stmt_) {
-    sqlite3_finalize(stmt_);
+    if (stmt_cacheable_) {
+      sqlite3_reset(stmt_);
+      sqlite3_clear_bindings(stmt_);
+      cache_->Put(cache_key_, stmt_);
+    } else {
+      sqlite3_finalize(stmt_);
+    }
     stmt_ = 0;
   }
+  stmt_cacheable_ = false;
   leftover_ = 0;
 }
 
@@ -5,6 +5,7 @@
 #include "fun/sql/sqlite/binder.h"
 #include "fun/sql/sqlite/extractor.h"
 #include "fun/sql/sqlite/sqlite.h"
+#include "fun/sql/statement_cache.h"
 #include "fun/sql/statement_impl.h"
 
 extern "C" {
@@ -21,10 +22,15 @@ namespace sqlite {
  */
 class FUN_SQLITE_API SQLiteStatementImpl : public fun::sql::StatementImpl {
  public:
+  typedef StatementCache<sqlite3_stmt*> Cache;
+
   /**
-   * Creates the SQLiteStatementImpl.
+   * Creates the SQLiteStatementImpl. With a cache, a single statement
+   * (not a batch) reuses a statement compiled earlier for the same SQL and
+   * is returned to the cache instead of being finalized.
    */
-  SQLiteStatementImpl(fun::sql::SessionImpl& session, sqlite3* db);
+  SQLiteStatementImpl(fun::sql::SessionImpl& session, sqlite3* db,
+                      Cache* cache = nullptr);
 
   /**
    * Destroys the SQLiteStatementImpl.
@@ -114,6 +120,10 @@ class FUN_SQLITE_API SQLiteStatementImpl : public fun::sql::StatementImpl {
 
   sqlite3* db_;
   sqlite3_stmt* stmt_;
+  Cache* cache_;
+  String cache_key_;
+  // True if stmt_ goes back to the cache under cache_key_.
+  bool stmt_cacheable_;
   bool step_called_;
   int next_response_;
   BinderPtr binder_;
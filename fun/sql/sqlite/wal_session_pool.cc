@@ -0,0 +1,309 @@
+﻿#include "fun/sql/sqlite/wal_session_pool.h"
+#include <memory>
+#include "fun/base/number_formatter.h"
+#include "fun/base/scoped_unlock.h"
+#include "fun/base/string.h"
+#include "fun/sql/sqlite/connector.h"
+#include "fun/sql/sqlite/sqlite-exception.h"
+#include "fun/sql/sqlite/utility.h"
+
+#if defined(FUN_UNBUNDLED)
+#include <sqlite3.h>
+#else
+#include "sqlite3.h"
+#endif
+
+namespace fun {
+namespace sql {
+namespace sqlite {
+
+namespace {
+
+void Exec(sqlite3* db, const String& sql) {
+  char* error = nullptr;
+  const int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error);
+  if (rc != SQLITE_OK) {
+    const String message = error ? error : sql;
+    sqlite3_free(error);
+    Utility::ThrowException(db, rc, message);
+  }
+}
+
+/**
+ * Runs a PRAGMA and returns the first column of its first row.
+ */
+String QueryPragma(sqlite3* db, const String& sql) {
+  String value;
+  char* error = nullptr;
+  const int rc = sqlite3_exec(
+      db, sql.c_str(),
+      [](void* out, int columns, char** values, char**) {
+        if (columns > 0 && values[0]) {
+          *static_cast<String*>(out) = values[0];
+        }
+        return 0;
+      },
+      &value, &error);
+  if (rc != SQLITE_OK) {
+    const String message = error ? error : sql;
+    sqlite3_free(error);
+    Utility::ThrowException(db, rc, message);
+  }
+  return value;
+}
+
+int ToSqliteMode(WalSessionPool::CheckpointMode mode) {
+  switch (mode) {
+    case WalSessionPool::CHECKPOINT_FULL:
+      return SQLITE_CHECKPOINT_FULL;
+    case WalSessionPool::CHECKPOINT_RESTART:
+      return SQLITE_CHECKPOINT_RESTART;
+    case WalSessionPool::CHECKPOINT_TRUNCATE:
+      return SQLITE_CHECKPOINT_TRUNCATE;
+    default:
+      return SQLITE_CHECKPOINT_PASSIVE;
+  }
+}
+
+/**
+ * Returns a copy of the exception being handled.
+ */
+Exception* CurrentException() {
+  try {
+    throw;
+  } catch (Exception& e) {
+    return e.Clone();
+  } catch (std::exception& e) {
+    return new Exception(e.what());
+  } catch (...) {
+    return new Exception("Unknown exception");
+  }
+}
+
+}  // namespace
+
+/**
+ * Session pool that configures new SQLite connections as the writer or
+ * as a reader.
+ */
+class WalSessionPool::ConnectionPool : public SessionPool {
+ public:
+  ConnectionPool(const String& path, const LockFreeOptions& pool_options,
+                 const WalSessionPool::Options& options, bool writer)
+      : SessionPool(Connector::KEY, path, pool_options),
+        options_(options),
+        writer_(writer) {}
+
+ protected:
+  void CustomizeSession(Session& session) override {
+    sqlite3* db = Utility::GetDbHandle(session);
+    if (writer_) {
+      // Stored in the database file, so readers opened later use it too.
+      const String mode = QueryPragma(db, "PRAGMA journal_mode=WAL");
+      if (icompare(mode, "wal") != 0) {
+        throw InvalidLibraryUseException("Cannot use WAL mode", mode);
+      }
+      if (options_.checkpoint_interval > 0) {
+        Exec(db, "PRAGMA wal_autocheckpoint=0");
+      }
+    } else {
+      Exec(db, "PRAGMA query_only=ON");
+    }
+    Exec(db, "PRAGMA synchronous=" + options_.synchronous);
+    QueryPragma(db, "PRAGMA mmap_size=" +
+                        NumberFormatter::Format(options_.mmap_size));
+  }
+
+ private:
+  const WalSessionPool::Options& options_;
+  const bool writer_;
+};
+
+/**
+ * A Write() call waiting for its transaction.
+ */
+struct WalSessionPool::WriteRequest {
+  explicit WriteRequest(const WriteWork& work)
+      : work(work), done(false), error(nullptr) {}
+
+  const WriteWork& work;
+  bool done;
+  Exception* error;
+};
+
+WalSessionPool::Options::Options()
+    : readers(4),
+      mmap_size(256 * 1024 * 1024),
+      synchronous("NORMAL"),
+      max_wait(10000),
+      write_batch_size(1000),
+      checkpoint_interval(1000),
+      checkpoint_mode(CHECKPOINT_PASSIVE),
+      truncate_frames(10000) {}
+
+WalSessionPool::WalSessionPool(const String& path, const Options& options)
+    : path_(path),
+      options_(options),
+      checkpoint_session_(Connector::KEY, path),
+      checkpoint_thread_("WalCheckpoint"),
+      writing_(false),
+      write_transactions_(0),
+      writes_(0),
+      checkpoints_(0) {
+  if (options_.readers <= 0 || options_.write_batch_size <= 0 ||
+      options_.checkpoint_interval < 0) {
+    throw InvalidArgumentException("WalSessionPool options");
+  }
+
+  SessionPool::LockFreeOptions writer_options;
+  writer_options.min_sessions = 1;
+  writer_options.max_sessions = 1;
+  writer_options.min_idle = 1;
+  writer_options.max_wait = options_.max_wait;
+  writer_pool_ = new ConnectionPool(path_, writer_options, options_, true);
+  // The writer comes first, as it switches the database to WAL mode.
+  writer_pool_->Prewarm();
+
+  SessionPool::LockFreeOptions reader_options;
+  reader_options.min_sessions = options_.readers;
+  reader_options.max_sessions = options_.readers;
+  reader_options.min_idle = options_.readers;
+  reader_options.thread_affinity = true;
+  reader_options.max_wait = options_.max_wait;
+  reader_pool_ = new ConnectionPool(path_, reader_options, options_, false);
+  reader_pool_->Prewarm();
+
+  if (options_.checkpoint_interval > 0) {
+    checkpoint_thread_.Start(*this);
+  }
+}
+
+WalSessionPool::~WalSessionPool() {
+  try {
+    if (options_.checkpoint_interval > 0) {
+      stop_.Set();
+      checkpoint_thread_.Join();
+    }
+    reader_pool_->Shutdown();
+    writer_pool_->Shutdown();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+Session WalSessionPool::GetReader() { return reader_pool_->Get(); }
+
+Session WalSessionPool::GetWriter() { return writer_pool_->Get(); }
+
+void WalSessionPool::Write(const WriteWork& work) {
+  WriteRequest request(work);
+
+  FastMutex::ScopedLock guard(write_mutex_);
+  write_queue_.push_back(&request);
+  while (!request.done) {
+    if (writing_) {
+      write_done_.Wait(write_mutex_);
+      continue;
+    }
+
+    // No transaction is running: this thread writes the queued requests,
+    // its own and those that arrived while the last transaction ran.
+    writing_ = true;
+    std::deque<WriteRequest*> batch;
+    while (!write_queue_.empty() &&
+           static_cast<int32>(batch.size()) < options_.write_batch_size) {
+      batch.push_back(write_queue_.front());
+      write_queue_.pop_front();
+    }
+    {
+      ScopedUnlock<FastMutex> unlock(write_mutex_);
+      WriteBatch(batch);
+    }
+    for (WriteRequest* done : batch) {
+      done->done = true;
+    }
+    writing_ = false;
+    write_done_.NotifyAll();
+  }
+
+  if (request.error) {
+    std::unique_ptr<Exception> error(request.error);
+    error->Rethrow();
+  }
+}
+
+void WalSessionPool::WriteBatch(std::deque<WriteRequest*>& batch) {
+  try {
+    Session session(writer_pool_->Get());
+    // IMMEDIATE takes the write lock up front, so that a transaction that
+    // started reading does not fail with SQLITE_BUSY when it writes.
+    session << "BEGIN IMMEDIATE", now;
+
+    int64 committed = 0;
+    try {
+      for (WriteRequest* request : batch) {
+        session << "SAVEPOINT write_request", now;
+        try {
+          request->work(session);
+          session << "RELEASE write_request", now;
+          ++committed;
+        } catch (...) {
+          request->error = CurrentException();
+          session << "ROLLBACK TO write_request", now;
+          session << "RELEASE write_request", now;
+        }
+      }
+      session << "COMMIT", now;
+    } catch (...) {
+      try {
+        session << "ROLLBACK", now;
+      } catch (...) {
+      }
+      throw;
+    }
+    ++write_transactions_;
+    writes_ += committed;
+  } catch (...) {
+    // The transaction failed as a whole.
+    std::unique_ptr<Exception> error(CurrentException());
+    for (WriteRequest* request : batch) {
+      if (!request->error) {
+        request->error = error->Clone();
+      }
+    }
+  }
+}
+
+int32 WalSessionPool::Checkpoint(CheckpointMode mode) {
+  FastMutex::ScopedLock guard(checkpoint_mutex_);
+  sqlite3* db = Utility::GetDbHandle(checkpoint_session_);
+  int wal_frames = 0;
+  int checkpointed_frames = 0;
+  const int rc = sqlite3_wal_checkpoint_v2(db, nullptr, ToSqliteMode(mode),
+                                           &wal_frames, &checkpointed_frames);
+  // SQLITE_BUSY: readers or the writer kept it from completing, which is
+  // expected for the blocking modes; the rest is copied next time.
+  if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+    Utility::ThrowException(db, rc, sqlite3_errmsg(db));
+  }
+  ++checkpoints_;
+  return wal_frames;
+}
+
+void WalSessionPool::Run() {
+  while (!stop_.TryWait(options_.checkpoint_interval)) {
+    try {
+      const int32 wal_frames = Checkpoint(options_.checkpoint_mode);
+      if (options_.truncate_frames > 0 &&
+          wal_frames >= options_.truncate_frames) {
+        Checkpoint(CHECKPOINT_TRUNCATE);
+      }
+    } catch (Exception&) {
+      // Tried again after the next interval.
+    }
+  }
+}
+
+}  // namespace sqlite
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,225 @@
+﻿#pragma once
+
+#include <atomic>
+#include <deque>
+#include "fun/base/condition.h"
+#include "fun/base/event.h"
+#include "fun/base/exception.h"
+#include "fun/base/ftl/function.h"
+#include "fun/base/mutex.h"
+#include "fun/base/runnable.h"
+#include "fun/base/thread.h"
+#include "fun/sql/session.h"
+#include "fun/sql/session_pool.h"
+#include "fun/sql/sqlite/sqlite.h"
+
+namespace fun {
+namespace sql {
+namespace sqlite {
+
+/**
+ * Sessions for one SQLite database under concurrent use: a single writer
+ * connection and a pool of read-only connections, all in WAL mode.
+ *
+ * With the default rollback journal, readers wait while a transaction
+ * writes, and every Session is a connection of its own. In WAL mode
+ * readers see the last committed state and never block the writer or
+ * each other. As SQLite allows only one writer at a time anyway, all
+ * writes go through one connection, and concurrent Write() calls are
+ * committed together in one transaction, which saves an fsync per
+ * write.
+ *
+ *   WalSessionPool db("/var/lib/game/state.db");
+ *
+ *   // Any thread:
+ *   Session reader(db.GetReader());
+ *   reader << "SELECT state FROM player WHERE id = ?", into(state),
+ *       use(id), now;
+ *
+ *   db.Write([&](Session& session) {
+ *     session << "UPDATE player SET state = ? WHERE id = ?", use(state),
+ *         use(id), now;
+ *   });
+ *
+ * Checkpoints, which copy the WAL back into the database file, run on a
+ * background thread instead of inside the commit that crosses SQLite's
+ * automatic checkpoint threshold.
+ *
+ * Prepared statements belong to the connection that prepared them, so
+ * each connection has its own statement cache; reader sessions keep
+ * their affinity to the thread that used them last, which returns a
+ * thread to the connection whose cache it has warmed.
+ */
+class FUN_SQLITE_API WalSessionPool : protected Runnable {
+ public:
+  enum CheckpointMode {
+    /** Copies what it can without waiting for readers or the writer. */
+    CHECKPOINT_PASSIVE,
+    /** Waits for the writer, then copies the whole WAL. */
+    CHECKPOINT_FULL,
+    /** As FULL, then waits until readers are done with the WAL. */
+    CHECKPOINT_RESTART,
+    /** As RESTART, then truncates the WAL file to zero bytes. */
+    CHECKPOINT_TRUNCATE
+  };
+
+  struct FUN_SQLITE_API Options {
+    Options();
+
+    /**
+     * Read-only connections. Defaults to 4.
+     */
+    int32 readers;
+
+    /**
+     * Bytes of the database file accessed through memory-mapped I/O,
+     * which saves a copy per page read. 0 disables it. Defaults to
+     * 256 MiB.
+     */
+    int64 mmap_size;
+
+    /**
+     * PRAGMA synchronous of all connections. NORMAL is durable across
+     * application crashes, and in WAL mode consistent across power loss.
+     * Defaults to "NORMAL".
+     */
+    String synchronous;
+
+    /**
+     * Milliseconds GetReader() and GetWriter() wait for a connection when
+     * all are in use. Defaults to 10000.
+     */
+    int32 max_wait;
+
+    /**
+     * Most Write() calls committed in one transaction. Defaults to 1000.
+     */
+    int32 write_batch_size;
+
+    /**
+     * Milliseconds between checkpoints on the background thread. 0 leaves
+     * checkpoints to SQLite, which runs them in the committing thread.
+     * Defaults to 1000.
+     */
+    int32 checkpoint_interval;
+
+    /**
+     * Mode of the periodic checkpoints. Defaults to CHECKPOINT_PASSIVE.
+     */
+    CheckpointMode checkpoint_mode;
+
+    /**
+     * Frames the WAL may grow to before a checkpoint truncates it, which
+     * may wait for readers. 0 never truncates. Defaults to 10000, about
+     * 40 MB with 4 KiB pages.
+     */
+    int32 truncate_frames;
+  };
+
+  /**
+   * Work done by Write() in the write transaction.
+   */
+  typedef Function<void(Session&)> WriteWork;
+
+  /**
+   * Opens the connections to the database file at path, creating it if
+   * needed, switches it to WAL mode and starts the checkpoint thread.
+   */
+  explicit WalSessionPool(const String& path,
+                          const Options& options = Options());
+
+  /**
+   * Stops the checkpoint thread and closes the connections.
+   */
+  ~WalSessionPool();
+
+  /**
+   * Returns a read-only session. Throws a SessionPoolExhaustedException
+   * if none became free within Options::max_wait.
+   */
+  Session GetReader();
+
+  /**
+   * Returns the writer session, waiting up to Options::max_wait while
+   * another thread uses it. Prefer Write(), which shares transactions
+   * between threads.
+   */
+  Session GetWriter();
+
+  /**
+   * Returns the pool of the writer session, for a WriteBehindQueue.
+   */
+  SessionPool& GetWriterPool() { return *writer_pool_; }
+
+  /**
+   * Runs work on the writer session and returns when its transaction is
+   * committed. Calls from other threads made meanwhile share the
+   * transaction, each in a savepoint of its own: if work throws, only
+   * its changes are rolled back, and the exception is rethrown here.
+   *
+   * work must not call Write() or GetWriter().
+   */
+  void Write(const WriteWork& work);
+
+  /**
+   * Runs a checkpoint now, in the specified mode. Returns the number of
+   * frames left in the WAL.
+   */
+  int32 Checkpoint(CheckpointMode mode = CHECKPOINT_PASSIVE);
+
+  /**
+   * Returns the number of write transactions committed by Write().
+   */
+  int64 GetWriteTransactionCount() const { return write_transactions_; }
+
+  /**
+   * Returns the number of Write() calls committed.
+   */
+  int64 GetWriteCount() const { return writes_; }
+
+  /**
+   * Returns the number of checkpoints run.
+   */
+  int64 GetCheckpointCount() const { return checkpoints_; }
+
+  const String& GetPath() const { return path_; }
+  const Options& GetOptions() const { return options_; }
+
+ protected:
+  void Run() override;
+
+ private:
+  class ConnectionPool;
+  struct WriteRequest;
+
+  void WriteBatch(std::deque<WriteRequest*>& batch);
+
+  const String path_;
+  const Options options_;
+  SessionPool::Ptr writer_pool_;
+  SessionPool::Ptr reader_pool_;
+
+  // Connection of the checkpoint thread. Checkpoints do not need the
+  // write lock, so it is not the writer.
+  Session checkpoint_session_;
+  fun::FastMutex checkpoint_mutex_;
+  Thread checkpoint_thread_;
+  Event stop_;
+
+  fun::FastMutex write_mutex_;
+  Condition write_done_;
+  std::deque<WriteRequest*> write_queue_;
+  bool writing_;
+
+  std::atomic<int64> write_transactions_;
+  std::atomic<int64> writes_;
+  std::atomic<int64> checkpoints_;
+
+ public:
+  WalSessionPool(const WalSessionPool&) = delete;
+  WalSessionPool& operator=(const WalSessionPool&) = delete;
+};
+
+}  // namespace sqlite
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "fun/base/async/task.h"
+#include "fun/base/runnable.h"
+#include "fun/base/thread_pool.h"
+#include "fun/net/reactor/event_loop.h"
+#include "fun/sql/statement.h"
+
+#if FUN_WITH_COROUTINES
+
+namespace fun {
+namespace sql {
+
+/**
+ * Awaiter returned by ExecuteOn(); runs the statement as a pool task.
+ */
+class StatementAwaiter : public Runnable {
+ public:
+  StatementAwaiter(ThreadPool& pool, Statement& statement, bool reset)
+      : pool_(pool),
+        statement_(statement),
+        reset_(reset),
+        loop_(nullptr),
+        result_(0) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    awaiting_ = awaiting;
+    loop_ = net::EventLoop::GetEventLoopOfCurrentThread();
+    pool_.Start(*this);
+  }
+
+  size_t await_resume() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+    return result_;
+  }
+
+  // Runnable
+  void Run() override {
+    try {
+      result_ = statement_.Execute(reset_);
+    } catch (...) {
+      exception_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> awaiting = awaiting_;
+    if (loop_) {
+      loop_->QueueInLoop([awaiting]() { awaiting.resume(); });
+    } else {
+      awaiting.resume();
+    }
+  }
+
+ private:
+  ThreadPool& pool_;
+  Statement& statement_;
+  bool reset_;
+  net::EventLoop* loop_;
+  std::coroutine_handle<> awaiting_;
+  size_t result_;
+  std::exception_ptr exception_;
+};
+
+/**
+ * Executes a blocking statement on a thread pool and suspends the awaiting
+ * coroutine until it is done, so a loop thread never blocks on the
+ * database:
+ *
+ *   size_t rows = co_await ExecuteOn(db_pool, statement);
+ *
+ * Yields what Statement::Execute() returns; exceptions thrown by it are
+ * rethrown in the coroutine. The coroutine is resumed on the EventLoop
+ * thread it awaited on, or on the pool thread when it was not running on
+ * a loop. The statement must not be used elsewhere until then.
+ */
+inline StatementAwaiter ExecuteOn(ThreadPool& pool, Statement& statement,
+                                  bool reset = true) {
+  return StatementAwaiter(pool, statement, reset);
+}
+
+}  // namespace sql
+}  // namespace fun
+
+#endif  // FUN_WITH_COROUTINES
@@ -0,0 +1,18 @@
+#include "fun/sql/statement_cache.h"
+
+namespace fun {
+namespace sql {
+
+const size_t StatementCacheBase::DEFAULT_CAPACITY;
+
+StatementCacheBase::StatementCacheBase(size_t capacity)
+    : capacity_(capacity), hits_(0), misses_(0), evictions_(0) {}
+
+StatementCacheBase::~StatementCacheBase() {}
+
+String StatementCacheBase::NormalizeSql(const String& sql) {
+  return sql.Trimmed();
+}
+
+}  // namespace sql
+}  // namespace fun
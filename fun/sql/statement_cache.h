@@ -0,0 +1,240 @@
+#pragma once
+
+#include "fun/base/ftl/function.h"
+#include "fun/base/mutex.h"
+#include "fun/base/string.h"
+#include "fun/sql/sql.h"
+
+#include <list>
+#include <map>
+
+namespace fun {
+namespace sql {
+
+/**
+ * Size and counters of a StatementCache, independent of the connector's
+ * statement handle type. SessionImplBase exposes them as the
+ * "statementCacheSize", "statementCacheHits" and "statementCacheMisses"
+ * properties.
+ */
+class FUN_SQL_API StatementCacheBase {
+ public:
+  /**
+   * Statements kept per session unless the "statementCacheSize" property
+   * is set.
+   */
+  static const size_t DEFAULT_CAPACITY = 256;
+
+  explicit StatementCacheBase(size_t capacity);
+  virtual ~StatementCacheBase();
+
+  /**
+   * Returns the cache key of an SQL statement: the text with leading and
+   * trailing whitespace removed. Whitespace inside is kept as it is;
+   * where it is significant depends on the dialect (dollar quoting,
+   * quotes in comments, standard_conforming_strings), and statements
+   * that differ in it must not share a prepared handle.
+   */
+  static String NormalizeSql(const String& sql);
+
+  /**
+   * Sets the number of statements kept. 0 disables the cache and
+   * closes the cached statements.
+   */
+  virtual void SetCapacity(size_t capacity) = 0;
+
+  size_t GetCapacity() const;
+
+  /**
+   * Returns the number of statements that are cached and not in use.
+   */
+  virtual size_t Count() const = 0;
+
+  /**
+   * Number of statements that were found in the cache.
+   */
+  uint64 GetHitCount() const;
+
+  /**
+   * Number of statements that had to be prepared while the cache was
+   * enabled.
+   */
+  uint64 GetMissCount() const;
+
+  /**
+   * Number of statements closed to make room for others.
+   */
+  uint64 GetEvictionCount() const;
+
+ protected:
+  mutable FastMutex mutex_;
+  size_t capacity_;
+  uint64 hits_;
+  uint64 misses_;
+  uint64 evictions_;
+};
+
+/**
+ * Bounded LRU cache of prepared statements of one session, keyed by the
+ * normalized SQL text.
+ *
+ * A statement is checked out with Take() for as long as a Statement uses
+ * it, so two Statements with the same SQL never share a handle, and
+ * returned with Put() when the Statement is done with it. When the cache
+ * is full, Put() closes the least recently used statement.
+ *
+ * Handle is the connector's prepared statement (e.g. MYSQL_STMT*), which
+ * the closer function releases.
+ */
+template <typename Handle>
+class StatementCache : public StatementCacheBase {
+ public:
+  typedef Function<void(Handle&)> Closer;
+
+  StatementCache(const Closer& closer, size_t capacity = DEFAULT_CAPACITY)
+      : StatementCacheBase(capacity), closer_(closer) {}
+
+  ~StatementCache() { Clear(); }
+
+  StatementCache(const StatementCache&) = delete;
+  StatementCache& operator=(const StatementCache&) = delete;
+
+  /**
+   * Returns true and moves the statement cached for key to out_handle,
+   * or returns false.
+   */
+  bool Take(const String& key, Handle& out_handle) {
+    FastMutex::ScopedLock guard(mutex_);
+
+    if (capacity_ == 0) {
+      return false;
+    }
+
+    typename Index::iterator it = index_.find(key);
+    if (it == index_.end()) {
+      ++misses_;
+      return false;
+    }
+
+    out_handle = it->second->handle;
+    entries_.erase(it->second);
+    index_.erase(it);
+    ++hits_;
+    return true;
+  }
+
+  /**
+   * Returns a statement prepared for key to the cache, or closes it if
+   * the cache is disabled or already holds a statement for key.
+   */
+  void Put(const String& key, Handle handle) {
+    Handle evicted;
+    bool has_evicted = false;
+    {
+      FastMutex::ScopedLock guard(mutex_);
+
+      if (capacity_ > 0 && index_.find(key) == index_.end()) {
+        entries_.push_front(Entry(key, handle));
+        index_[key] = entries_.begin();
+        if (entries_.size() <= capacity_) {
+          return;
+        }
+
+        evicted = entries_.back().handle;
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+        ++evictions_;
+      } else {
+        evicted = handle;
+      }
+      has_evicted = true;
+    }
+
+    // Closing may talk to the server; not under the lock.
+    if (has_evicted) {
+      closer_(evicted);
+    }
+  }
+
+  /**
+   * Closes all cached statements.
+   */
+  void Clear() {
+    std::list<Entry> entries;
+    {
+      FastMutex::ScopedLock guard(mutex_);
+      entries.swap(entries_);
+      index_.clear();
+    }
+
+    for (typename std::list<Entry>::iterator it = entries.begin();
+         it != entries.end(); ++it) {
+      closer_(it->handle);
+    }
+  }
+
+  void SetCapacity(size_t capacity) override {
+    std::list<Entry> evicted;
+    {
+      FastMutex::ScopedLock guard(mutex_);
+      capacity_ = capacity;
+      while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().key);
+        evicted.splice(evicted.end(), entries_, --entries_.end());
+      }
+    }
+
+    for (typename std::list<Entry>::iterator it = evicted.begin();
+         it != evicted.end(); ++it) {
+      closer_(it->handle);
+    }
+  }
+
+  size_t Count() const override {
+    FastMutex::ScopedLock guard(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    Entry(const String& key, const Handle& handle)
+        : key(key), handle(handle) {}
+
+    String key;
+    Handle handle;
+  };
+
+  typedef std::map<String, typename std::list<Entry>::iterator> Index;
+
+  Closer closer_;
+  // Most recently returned first.
+  std::list<Entry> entries_;
+  Index index_;
+};
+
+//
+// inlines
+//
+
+inline size_t StatementCacheBase::GetCapacity() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return capacity_;
+}
+
+inline uint64 StatementCacheBase::GetHitCount() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return hits_;
+}
+
+inline uint64 StatementCacheBase::GetMissCount() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return misses_;
+}
+
+inline uint64 StatementCacheBase::GetEvictionCount() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return evictions_;
+}
+
+}  // namespace sql
+}  // namespace fun
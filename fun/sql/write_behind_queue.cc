@@ -0,0 +1,393 @@
+#include "fun/sql/write_behind_queue.h"
+#include "fun/base/scoped_unlock.h"
+#include "fun/base/stopwatch.h"
+
+namespace fun {
+namespace sql {
+
+namespace {
+
+/**
+ * Returns a copy of the exception being handled.
+ */
+Exception* CurrentException() {
+  try {
+    throw;
+  } catch (Exception& e) {
+    return e.Clone();
+  } catch (std::exception& e) {
+    return new Exception(e.what());
+  } catch (...) {
+    return new Exception("Unknown exception");
+  }
+}
+
+}  // namespace
+
+WriteBehindQueueBase::Options::Options()
+    : flush_interval_ms(100),
+      max_batch_size(1000),
+      rows_per_statement(100),
+      max_pending(100000),
+      bulk(false),
+      max_row_attempts(3) {}
+
+WriteBehindQueueBase::WriteBehindQueueBase(SessionPool& pool,
+                                           const String& sql_prefix,
+                                           const String& row_values,
+                                           const String& sql_suffix,
+                                           const Options& options)
+    : options_(options),
+      put_sequence_(0),
+      pool_(pool),
+      sql_prefix_(sql_prefix),
+      row_values_(row_values),
+      sql_suffix_(sql_suffix),
+      thread_("WriteBehindQueue"),
+      running_(false),
+      batch_size_(0),
+      flush_sequence_(0),
+      failed_sequence_(0),
+      committed_rows_(0),
+      error_count_(0),
+      last_commit_latency_(0),
+      max_commit_latency_(0) {
+  if (options_.flush_interval_ms <= 0 || options_.max_batch_size <= 0 ||
+      options_.rows_per_statement <= 0 || options_.max_pending <= 0 ||
+      options_.max_row_attempts <= 0) {
+    throw InvalidArgumentException("WriteBehindQueue options");
+  }
+
+  full_sql_ = GetSql(options_.rows_per_statement);
+
+  if (!options_.metrics_prefix.IsEmpty()) {
+    MetricsRegistry& registry = MetricsRegistry::Default();
+    const String& prefix = options_.metrics_prefix;
+    depth_gauge_ = registry.GetGauge(prefix + "_queue_depth",
+                                     "Rows waiting to be written");
+    commit_latency_histogram_ = registry.GetHistogram(
+        prefix + "_commit_latency_us", "Time to write and commit a batch");
+    committed_rows_counter_ =
+        registry.GetCounter(prefix + "_rows_committed", "Rows committed");
+    error_counter_ =
+        registry.GetCounter(prefix + "_batch_errors", "Batches that failed");
+  }
+}
+
+WriteBehindQueueBase::~WriteBehindQueueBase() { fun_check(!running_); }
+
+void WriteBehindQueueBase::Start() {
+  FastMutex::ScopedLock guard(mutex_);
+  fun_check(!running_);
+  running_ = true;
+  thread_.Start(*this);
+}
+
+void WriteBehindQueueBase::Stop() {
+  {
+    FastMutex::ScopedLock guard(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+    wake_writer_.NotifyAll();
+    room_available_.NotifyAll();
+  }
+  thread_.Join();
+}
+
+bool WriteBehindQueueBase::Flush() {
+  FastMutex::ScopedLock guard(mutex_);
+  if (!running_) {
+    return GetPendingCount() == 0;
+  }
+
+  // Done once every row numbered up to here has been committed, however
+  // many batches that takes and whatever was put in the meantime.
+  const int64 sequence = put_sequence_;
+  const int64 error_count = error_count_;
+  if (sequence > flush_sequence_) {
+    flush_sequence_ = sequence;
+  }
+  wake_writer_.NotifyAll();
+  for (;;) {
+    if (error_count_ != error_count && failed_sequence_ <= sequence) {
+      return false;
+    }
+    if (GetOldestSequence() > sequence) {
+      return true;
+    }
+    flushed_.Wait(mutex_);
+  }
+}
+
+void WriteBehindQueueBase::SetErrorCallback(const ErrorCallback& callback) {
+  FastMutex::ScopedLock guard(mutex_);
+  fun_check(!running_);
+  error_callback_ = callback;
+}
+
+int32 WriteBehindQueueBase::GetQueueDepth() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return GetPendingCount() + batch_size_;
+}
+
+int64 WriteBehindQueueBase::GetCommittedRowCount() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return committed_rows_;
+}
+
+int64 WriteBehindQueueBase::GetErrorCount() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return error_count_;
+}
+
+int64 WriteBehindQueueBase::GetLastCommitLatency() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return last_commit_latency_;
+}
+
+int64 WriteBehindQueueBase::GetMaxCommitLatency() const {
+  FastMutex::ScopedLock guard(mutex_);
+  return max_commit_latency_;
+}
+
+bool WriteBehindQueueBase::WaitForRoom(int32 timeout_ms) {
+  while (running_ &&
+         GetPendingCount() + batch_size_ >= options_.max_pending) {
+    wake_writer_.NotifyOne();
+    if (timeout_ms < 0) {
+      room_available_.Wait(mutex_);
+    } else if (!room_available_.TryWait(mutex_, timeout_ms)) {
+      return false;
+    } else if (GetPendingCount() + batch_size_ >= options_.max_pending) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void WriteBehindQueueBase::RowAdded() {
+  UpdateDepthGauge();
+  if (GetPendingCount() >= options_.max_batch_size) {
+    wake_writer_.NotifyOne();
+  }
+}
+
+String WriteBehindQueueBase::GetSql(int32 row_count) const {
+  if (row_count == options_.rows_per_statement && !full_sql_.IsEmpty()) {
+    return full_sql_;
+  }
+
+  String sql;
+  sql.Reserve(sql_prefix_.Len() + sql_suffix_.Len() +
+              row_count * (row_values_.Len() + 2) + 2);
+  sql += sql_prefix_;
+  sql += ' ';
+  for (int32 i = 0; i < row_count; ++i) {
+    if (i > 0) {
+      sql += ", ";
+    }
+    sql += row_values_;
+  }
+  if (!sql_suffix_.IsEmpty()) {
+    sql += ' ';
+    sql += sql_suffix_;
+  }
+  return sql;
+}
+
+void WriteBehindQueueBase::Run() {
+  FastMutex::ScopedLock guard(mutex_);
+  for (;;) {
+    // Wait for a full batch, Flush(), Stop() or the end of the interval.
+    if (running_ && GetPendingCount() < options_.max_batch_size &&
+        GetOldestSequence() > flush_sequence_) {
+      wake_writer_.TryWait(mutex_, options_.flush_interval_ms);
+    }
+
+    if (GetPendingCount() == 0) {
+      if (!running_) {
+        break;
+      }
+      continue;
+    }
+
+    TakeBatch(options_.max_batch_size);
+    batch_size_ = GetBatchCount();
+    batch_done_.assign(batch_size_, false);
+    const int64 batch_sequence = GetOldestSequence();
+
+    int64 latency = 0;
+    int32 committed = 0;
+    WriteResult result;
+    {
+      ScopedUnlock<FastMutex> unlock(mutex_);
+      result = WriteOut(latency, committed);
+    }
+
+    committed_rows_ += committed;
+    if (result == WRITE_COMMITTED) {
+      last_commit_latency_ = latency;
+      if (latency > max_commit_latency_) {
+        max_commit_latency_ = latency;
+      }
+      ClearBatch();
+    } else {
+      ++error_count_;
+      failed_sequence_ = batch_sequence;
+      // Rejected rows have been committed or dropped by now.
+      if (result == WRITE_LOST && running_) {
+        RequeueBatch();
+      } else {
+        ClearBatch();
+      }
+    }
+    batch_done_.clear();
+    batch_size_ = 0;
+    UpdateDepthGauge();
+    room_available_.NotifyAll();
+    flushed_.NotifyAll();
+
+    if (result == WRITE_LOST && running_) {
+      // Give the database a moment before the rows are retried.
+      wake_writer_.TryWait(mutex_, options_.flush_interval_ms);
+    }
+  }
+  flushed_.NotifyAll();
+}
+
+WriteBehindQueueBase::WriteResult WriteBehindQueueBase::WriteOut(
+    int64& latency, int32& committed) {
+  std::unique_ptr<Exception> error;
+  WriteResult result = WriteRows(0, batch_size_, latency, error);
+  if (result != WRITE_COMMITTED && error_counter_.IsValid()) {
+    error_counter_.Increment();
+  }
+  if (result != WRITE_REJECTED) {
+    if (result == WRITE_COMMITTED) {
+      committed = batch_size_;
+      batch_done_.assign(batch_size_, true);
+      if (commit_latency_histogram_.IsValid()) {
+        commit_latency_histogram_.Record(latency);
+      }
+    } else {
+      ReportError(*error, batch_size_);
+    }
+    if (committed_rows_counter_.IsValid()) {
+      committed_rows_counter_.Increment(committed);
+    }
+    return result;
+  }
+
+  // Bisect the batch, the first half first, down to the rows that fail on
+  // their own. Each range commits or fails as a whole.
+  std::vector<std::pair<int32, int32>> ranges;
+  if (batch_size_ > 1) {
+    const int32 half = batch_size_ / 2;
+    ranges.push_back(std::make_pair(half, batch_size_ - half));
+    ranges.push_back(std::make_pair(0, half));
+  } else {
+    ranges.push_back(std::make_pair(0, batch_size_));
+  }
+  int64 range_latency = 0;
+  while (!ranges.empty()) {
+    const int32 first = ranges.back().first;
+    const int32 count = ranges.back().second;
+    ranges.pop_back();
+
+    // A row alone gets a few attempts, in case the error was transient. A
+    // batch of one row has had its first attempt already.
+    const int32 attempts = count == 1 ? options_.max_row_attempts : 1;
+    for (int32 attempt = count == batch_size_ ? 1 : 0; attempt < attempts;
+         ++attempt) {
+      result = WriteRows(first, count, range_latency, error);
+      if (result != WRITE_REJECTED) {
+        break;
+      }
+    }
+
+    if (result == WRITE_LOST) {
+      // The rows not done yet are queued again.
+      ReportError(*error, static_cast<int32>(std::count(
+                              batch_done_.begin(), batch_done_.end(), false)));
+      break;
+    }
+    if (result == WRITE_COMMITTED) {
+      committed += count;
+      for (int32 i = first; i < first + count; ++i) {
+        batch_done_[i] = true;
+      }
+    } else if (count > 1) {
+      const int32 half = count / 2;
+      ranges.push_back(std::make_pair(first + half, count - half));
+      ranges.push_back(std::make_pair(first, half));
+    } else {
+      batch_done_[first] = true;
+      ReportError(*error, 1);
+      RejectRow(first, *error);
+    }
+  }
+
+  if (committed_rows_counter_.IsValid()) {
+    committed_rows_counter_.Increment(committed);
+  }
+  return result == WRITE_LOST ? WRITE_LOST : WRITE_REJECTED;
+}
+
+WriteBehindQueueBase::WriteResult WriteBehindQueueBase::WriteRows(
+    int32 first, int32 count, int64& latency,
+    std::unique_ptr<Exception>& error) {
+  // Anything escaping would end the writer thread, and Stop() and Flush()
+  // would wait for it forever.
+  try {
+    Session session(pool_.Get());
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    session.Begin();
+    try {
+      WriteBatch(session, first, count);
+      session.Commit();
+    } catch (...) {
+      error.reset(CurrentException());
+      try {
+        session.Rollback();
+      } catch (...) {
+      }
+      // Connector exceptions differ; a session that is no longer
+      // connected tells a lost connection from a rejected row.
+      bool still_connected = false;
+      try {
+        still_connected = session.IsConnected();
+      } catch (...) {
+      }
+      return still_connected ? WRITE_REJECTED : WRITE_LOST;
+    }
+    stopwatch.Stop();
+    latency = stopwatch.Elapsed();
+    return WRITE_COMMITTED;
+  } catch (...) {
+    // No session, or Begin() failed; the rows are not to blame.
+    error.reset(CurrentException());
+    return WRITE_LOST;
+  }
+}
+
+void WriteBehindQueueBase::ReportError(const Exception& e, int32 row_count) {
+  if (error_callback_) {
+    try {
+      error_callback_(e, row_count);
+    } catch (...) {
+      fun_unexpected();
+    }
+  }
+}
+
+void WriteBehindQueueBase::UpdateDepthGauge() {
+  if (depth_gauge_.IsValid()) {
+    depth_gauge_.Set(GetPendingCount() + batch_size_);
+  }
+}
+
+}  // namespace sql
+}  // namespace fun
@@ -0,0 +1,520 @@
+#pragma once
+
+#include "fun/base/condition.h"
+#include "fun/base/exception.h"
+#include "fun/base/ftl/function.h"
+#include "fun/base/metrics.h"
+#include "fun/base/mutex.h"
+#include "fun/base/runnable.h"
+#include "fun/base/string.h"
+#include "fun/base/thread.h"
+#include "fun/sql/bulk.h"
+#include "fun/sql/bulk_binding.h"
+#include "fun/sql/session_pool.h"
+#include "fun/sql/sql.h"
+#include "fun/sql/statement.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace fun {
+namespace sql {
+
+/**
+ * Thread, batching and counters of a WriteBehindQueue, independent of its
+ * key and row types.
+ */
+class FUN_SQL_API WriteBehindQueueBase : protected Runnable {
+ public:
+  struct FUN_SQL_API Options {
+    Options();
+
+    /**
+     * Longest time a row waits before it is written, in milliseconds.
+     * Defaults to 100.
+     */
+    int32 flush_interval_ms;
+
+    /**
+     * Most rows written in one transaction. A batch is written as soon
+     * as this many rows are pending. Defaults to 1000.
+     */
+    int32 max_batch_size;
+
+    /**
+     * Rows per multi-row INSERT statement. Defaults to 100.
+     */
+    int32 rows_per_statement;
+
+    /**
+     * Put() blocks while this many rows are pending. Defaults to 100000.
+     */
+    int32 max_pending;
+
+    /**
+     * Binds a batch as one bulk binding (see Bulk) instead of building
+     * multi-row statements, for connectors that support bulk binding,
+     * such as ODBC. Defaults to false.
+     */
+    bool bulk;
+
+    /**
+     * Times a row the database rejects on its own is written before it is
+     * dropped. Defaults to 3.
+     */
+    int32 max_row_attempts;
+
+    /**
+     * If not empty, the queue depth, commit latency and row and error
+     * counts are also exported through MetricsRegistry::Default() as
+     * <prefix>_queue_depth, <prefix>_commit_latency_us,
+     * <prefix>_rows_committed and <prefix>_batch_errors.
+     */
+    String metrics_prefix;
+  };
+
+  /**
+   * Called on the writer thread when writing rows failed.
+   *
+   * If the connection failed or was lost, the rows of the batch are queued
+   * again and retried with the next batch, unless they have been replaced
+   * in the meantime or the queue is stopping; row_count is the size of
+   * the batch. Any other error is taken to be caused by some of the rows:
+   * the batch is written again in halves, each in a transaction of its
+   * own, until the rows the database rejects are found. Such a row is
+   * written on its own up to Options::max_row_attempts times, then
+   * dropped and reported with a row_count of 1 (see
+   * WriteBehindQueue::SetDeadLetterCallback() for its key and contents).
+   * A single bad row thus cannot hold up the queue.
+   */
+  typedef Function<void(const Exception& e, int32 row_count)> ErrorCallback;
+
+  /**
+   * Creates the queue. Statements are built as
+   *
+   *   sql_prefix row_values[, row_values ...] sql_suffix
+   *
+   * e.g. "INSERT INTO player (id, state) VALUES", "(?, ?)" and
+   * "ON CONFLICT (id) DO UPDATE SET state = excluded.state".
+   */
+  WriteBehindQueueBase(SessionPool& pool, const String& sql_prefix,
+                       const String& row_values, const String& sql_suffix,
+                       const Options& options);
+
+  virtual ~WriteBehindQueueBase();
+
+  /**
+   * Starts the writer thread.
+   */
+  void Start();
+
+  /**
+   * Writes all pending rows and stops the writer thread. A batch that
+   * fails while stopping is reported to the error callback and dropped.
+   */
+  void Stop();
+
+  /**
+   * Writes all rows put before the call without waiting for the flush
+   * interval, and waits until they are committed. Returns false if
+   * writing a batch holding any of them failed, whether its rows were
+   * queued again or some were dropped.
+   */
+  bool Flush();
+
+  /**
+   * Sets the error callback. Must be called before Start().
+   */
+  void SetErrorCallback(const ErrorCallback& callback);
+
+  /**
+   * Returns the number of rows waiting to be written, including the
+   * batch being written.
+   */
+  int32 GetQueueDepth() const;
+
+  /**
+   * Returns the number of rows committed.
+   */
+  int64 GetCommittedRowCount() const;
+
+  /**
+   * Returns the number of batches that failed.
+   */
+  int64 GetErrorCount() const;
+
+  /**
+   * Returns the time the last commit took, from Begin() to Commit(), in
+   * microseconds.
+   */
+  int64 GetLastCommitLatency() const;
+
+  /**
+   * Returns the longest time a commit took, in microseconds.
+   */
+  int64 GetMaxCommitLatency() const;
+
+ protected:
+  /**
+   * Called by Put() with mutex_ held, before a row is added. Blocks while
+   * the queue is full; returns false if it still is after timeout_ms
+   * (negative: wait forever).
+   */
+  bool WaitForRoom(int32 timeout_ms);
+
+  /**
+   * Called by Put() with mutex_ held, after a row has been added.
+   */
+  void RowAdded();
+
+  /**
+   * Returns the statement for row_count rows.
+   */
+  String GetSql(int32 row_count) const;
+
+  /**
+   * Number of rows in the map of pending rows. mutex_ is held.
+   */
+  virtual int32 GetPendingCount() const = 0;
+
+  /**
+   * Returns the lowest sequence number of the rows not yet committed,
+   * pending or in the batch, or INT64_MAX if there are none. mutex_ is
+   * held.
+   */
+  virtual int64 GetOldestSequence() const = 0;
+
+  /**
+   * Moves up to max_rows pending rows into the batch, the ones put first
+   * first. mutex_ is held.
+   */
+  virtual void TakeBatch(int32 max_rows) = 0;
+
+  /**
+   * Queues the rows of a failed batch again, except those that are done
+   * (see batch_done_) and those that have been replaced since. mutex_ is
+   * held.
+   */
+  virtual void RequeueBatch() = 0;
+
+  /**
+   * Discards the batch. mutex_ is held.
+   */
+  virtual void ClearBatch() = 0;
+
+  /**
+   * Returns the number of rows in the batch. mutex_ is held.
+   */
+  virtual int32 GetBatchCount() const = 0;
+
+  /**
+   * Binds and executes count rows of the batch, from first on, in
+   * session's transaction. Runs on the writer thread without mutex_.
+   */
+  virtual void WriteBatch(Session& session, int32 first, int32 count) = 0;
+
+  /**
+   * Called on the writer thread, without mutex_, for a row of the batch
+   * that is dropped because the database keeps rejecting it.
+   */
+  virtual void RejectRow(int32 index, const Exception& e) = 0;
+
+  const Options options_;
+  mutable FastMutex mutex_;
+
+  // Sequence number of the last row put. A row is numbered when it is
+  // first put and keeps the number when it is replaced. mutex_ is held.
+  int64 put_sequence_;
+
+  // Rows of the batch that need not be queued again, because they were
+  // committed or dropped. Written by the writer thread only.
+  std::vector<bool> batch_done_;
+
+ private:
+  enum WriteResult {
+    // Committed.
+    WRITE_COMMITTED,
+    // Failed because of some of the rows.
+    WRITE_REJECTED,
+    // Failed because of the connection; worth retrying as it is.
+    WRITE_LOST
+  };
+
+  void Run() override;
+
+  /**
+   * Writes the batch, looking for the rejected rows if it fails. Sets
+   * committed to the number of rows committed.
+   */
+  WriteResult WriteOut(int64& latency, int32& committed);
+
+  /**
+   * Writes count rows of the batch in a transaction of its own. On
+   * failure, error is set to the exception.
+   */
+  WriteResult WriteRows(int32 first, int32 count, int64& latency,
+                        std::unique_ptr<Exception>& error);
+
+  void ReportError(const Exception& e, int32 row_count);
+
+  void UpdateDepthGauge();
+
+  SessionPool& pool_;
+  String sql_prefix_;
+  String row_values_;
+  String sql_suffix_;
+  String full_sql_;
+  ErrorCallback error_callback_;
+
+  Thread thread_;
+  bool running_;
+  Condition wake_writer_;
+  Condition room_available_;
+  Condition flushed_;
+
+  // Rows in the batch being written.
+  int32 batch_size_;
+
+  // Highest sequence number a Flush() waits for, and the lowest one of
+  // the last batch that failed.
+  int64 flush_sequence_;
+  int64 failed_sequence_;
+
+  int64 committed_rows_;
+  int64 error_count_;
+  int64 last_commit_latency_;
+  int64 max_commit_latency_;
+
+  Gauge depth_gauge_;
+  Histogram commit_latency_histogram_;
+  Counter committed_rows_counter_;
+  Counter error_counter_;
+};
+
+/**
+ * Write-behind queue that coalesces rows by key and writes them in
+ * batches, one transaction per batch, on a thread of its own.
+ *
+ * Putting a row for a key that is still pending replaces the pending row
+ * (last write wins), so a key that is saved often is written at most once
+ * per flush interval. Rows are taken into batches in the order their keys
+ * were first put, so no key waits behind a steady stream of others; each
+ * batch is then written in key order, which keeps concurrent upserts from
+ * deadlocking on each other. Instead of one
+ * autocommitted statement per row, a batch costs a handful of multi-row
+ * statements and a single commit.
+ *
+ * Row is bound with TypeHandler<Row>, so it can be a Tuple or a type with
+ * a TypeHandler specialization of its own:
+ *
+ *   typedef Tuple<int32, String> PlayerRow;
+ *   WriteBehindQueue<int32, PlayerRow> saves(
+ *       pool, "INSERT INTO player (id, state) VALUES", "(?, ?)",
+ *       "ON CONFLICT (id) DO UPDATE SET state = excluded.state");
+ *   saves.Start();
+ *   saves.Put(player_id, PlayerRow(player_id, state));
+ *
+ * Put() is thread safe. It blocks while Options::max_pending rows are
+ * pending, so producers slow down to the rate the database keeps up with
+ * instead of growing the queue without bound; replacing a pending row
+ * never blocks.
+ */
+template <typename Key, typename Row>
+class WriteBehindQueue : public WriteBehindQueueBase {
+ public:
+  /**
+   * Called on the writer thread with a row that is dropped because the
+   * database keeps rejecting it, e.g. to keep it in a table or a file of
+   * its own for later inspection.
+   */
+  typedef Function<void(const Exception& e, const Key& key, const Row& row)>
+      DeadLetterCallback;
+  WriteBehindQueue(SessionPool& pool, const String& sql_prefix,
+                   const String& row_values, const String& sql_suffix,
+                   const Options& options = Options())
+      : WriteBehindQueueBase(pool, sql_prefix, row_values, sql_suffix,
+                             options) {}
+
+  /**
+   * Stops the queue, writing all pending rows.
+   */
+  ~WriteBehindQueue() { Stop(); }
+
+  /**
+   * Queues row for key, replacing a pending row for the same key. Blocks
+   * while the queue is full.
+   */
+  void Put(const Key& key, const Row& row) { TryPut(key, row, -1); }
+
+  /**
+   * Like Put(), but gives up and returns false if the queue is still
+   * full after timeout_ms milliseconds.
+   */
+  /**
+   * Sets the dead-letter callback. Must be called before Start().
+   */
+  void SetDeadLetterCallback(const DeadLetterCallback& callback) {
+    FastMutex::ScopedLock guard(mutex_);
+    dead_letter_callback_ = callback;
+  }
+
+  bool TryPut(const Key& key, const Row& row, int32 timeout_ms) {
+    FastMutex::ScopedLock guard(mutex_);
+    typename PendingMap::iterator it = pending_.find(key);
+    if (it == pending_.end()) {
+      if (!WaitForRoom(timeout_ms)) {
+        return false;
+      }
+      // Another thread may have put the key while we waited.
+      it = pending_.find(key);
+    }
+    if (it != pending_.end()) {
+      it->second.row = row;
+      return true;
+    }
+
+    PendingRow pending;
+    pending.row = row;
+    pending.sequence = ++put_sequence_;
+    pending_.insert(typename PendingMap::value_type(key, pending));
+    put_order_.insert(
+        typename PutOrder::value_type(pending.sequence, key));
+    RowAdded();
+    return true;
+  }
+
+ protected:
+  int32 GetPendingCount() const override {
+    return static_cast<int32>(pending_.size());
+  }
+
+  int64 GetOldestSequence() const override {
+    int64 oldest = INT64_MAX;
+    if (!put_order_.empty()) {
+      oldest = put_order_.begin()->first;
+    }
+    for (size_t i = 0; i < batch_sequences_.size(); ++i) {
+      if (batch_sequences_[i] < oldest) {
+        oldest = batch_sequences_[i];
+      }
+    }
+    return oldest;
+  }
+
+  void TakeBatch(int32 max_rows) override {
+    std::vector<Key> keys;
+    typename PutOrder::iterator order = put_order_.begin();
+    for (int32 i = 0; i < max_rows && order != put_order_.end(); ++i) {
+      keys.push_back(order->second);
+      order = put_order_.erase(order);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+      typename PendingMap::iterator it = pending_.find(keys[i]);
+      batch_keys_.push_back(it->first);
+      batch_rows_.push_back(it->second.row);
+      batch_sequences_.push_back(it->second.sequence);
+      pending_.erase(it);
+    }
+  }
+
+  void RequeueBatch() override {
+    for (size_t i = 0; i < batch_keys_.size(); ++i) {
+      if (batch_done_[i]) {
+        continue;
+      }
+      typename PendingMap::iterator it = pending_.find(batch_keys_[i]);
+      if (it == pending_.end()) {
+        PendingRow pending;
+        pending.row = batch_rows_[i];
+        pending.sequence = batch_sequences_[i];
+        pending_.insert(
+            typename PendingMap::value_type(batch_keys_[i], pending));
+      } else {
+        // Keep the row put after the batch was taken, but in the place of
+        // the failed one, which a Flush() may be waiting for.
+        put_order_.erase(it->second.sequence);
+        it->second.sequence = batch_sequences_[i];
+      }
+      put_order_.insert(
+          typename PutOrder::value_type(batch_sequences_[i], batch_keys_[i]));
+    }
+    ClearBatch();
+  }
+
+  void ClearBatch() override {
+    batch_keys_.clear();
+    batch_rows_.clear();
+    batch_sequences_.clear();
+  }
+
+  int32 GetBatchCount() const override {
+    return static_cast<int32>(batch_rows_.size());
+  }
+
+  void WriteBatch(Session& session, int32 first, int32 count) override {
+    using Keywords::bulk;
+    using Keywords::use;
+    using Keywords::useRef;
+
+    if (options_.bulk) {
+      Statement statement(session);
+      if (count == GetBatchCount()) {
+        statement << GetSql(1), use(batch_rows_, bulk);
+        statement.Execute();
+      } else {
+        std::vector<Row> rows(batch_rows_.begin() + first,
+                              batch_rows_.begin() + first + count);
+        statement << GetSql(1), use(rows, bulk);
+        statement.Execute();
+      }
+      return;
+    }
+
+    const int32 end = first + count;
+    for (int32 row = first; row < end; row += options_.rows_per_statement) {
+      const int32 rows = end - row < options_.rows_per_statement
+                             ? end - row
+                             : options_.rows_per_statement;
+      Statement statement(session);
+      statement << GetSql(rows);
+      for (int32 i = 0; i < rows; ++i) {
+        statement, useRef(batch_rows_[row + i]);
+      }
+      statement.Execute();
+    }
+  }
+
+  void RejectRow(int32 index, const Exception& e) override {
+    if (dead_letter_callback_) {
+      try {
+        dead_letter_callback_(e, batch_keys_[index], batch_rows_[index]);
+      } catch (...) {
+        fun_unexpected();
+      }
+    }
+  }
+
+ private:
+  struct PendingRow {
+    Row row;
+    int64 sequence;
+  };
+
+  typedef std::map<Key, PendingRow> PendingMap;
+  // Keys of the pending rows by sequence number.
+  typedef std::map<int64, Key> PutOrder;
+
+  PendingMap pending_;
+  PutOrder put_order_;
+  std::vector<Key> batch_keys_;
+  std::vector<Row> batch_rows_;
+  std::vector<int64> batch_sequences_;
+  DeadLetterCallback dead_letter_callback_;
+};
+
+}  // namespace sql
+}  // namespace fun
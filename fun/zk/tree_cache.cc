@@ -0,0 +1,468 @@
+﻿#include "fun/zk/tree_cache.h"
+
+#include <cstring>
+
+#include "fun/base/scoped_unlock.h"
+#include "fun/base/stopwatch.h"
+
+namespace fun {
+namespace zookeeper {
+
+namespace {
+
+std::atomic<uint64> NEXT_CACHE_ID(1);
+
+String GetChildPath(const String& parent, const ByteArray& child) {
+  String path(parent);
+  if (path.IsEmpty() || path[path.Len() - 1] != '/') {
+    path += '/';
+  }
+  path += child;
+  return path;
+}
+
+String GetParentPath(const String& path) {
+  const int32 slash = path.LastIndexOf('/');
+  return slash <= 0 ? String("/") : path.Mid(0, slash);
+}
+
+}  // namespace
+
+TreeCache::Options::Options()
+    : resync_jitter_ms(5000), retry_interval_ms(1000) {}
+
+TreeCache::TreeCache(Client& client, const ByteArray& root,
+                     IWatcher* next_watcher, const Options& options)
+    : client_(client),
+      root_(root),
+      next_watcher_(next_watcher),
+      options_(options),
+      id_(NEXT_CACHE_ID++),
+      thread_("TreeCache"),
+      running_(false),
+      connected_(client.IsConnected()),
+      expired_(false),
+      resync_requested_(true),
+      resync_jitter_(false),
+      snapshot_(new Snapshot()),
+      version_(0),
+      synced_(false) {
+  if (root_.IsEmpty() || root_[0] != '/') {
+    throw InvalidArgumentException("TreeCache root must be an absolute path");
+  }
+  if (root_.Len() > 1 && root_[root_.Len() - 1] == '/') {
+    root_ = root_.Mid(0, root_.Len() - 1);
+  }
+  random_.Randomize();
+}
+
+TreeCache::~TreeCache() {
+  try {
+    Stop();
+  } catch (...) {
+    fun_unexpected();
+  }
+}
+
+void TreeCache::Start() {
+  FastMutex::ScopedLock guard(mutex_);
+  fun_check(!running_);
+  running_ = true;
+  thread_.Start(*this);
+}
+
+void TreeCache::Stop() {
+  {
+    FastMutex::ScopedLock guard(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+    wake_.NotifyAll();
+  }
+  thread_.Join();
+}
+
+void TreeCache::SetChangeCallback(const ChangeCallback& callback) {
+  FastMutex::ScopedLock guard(mutex_);
+  change_callback_ = callback;
+}
+
+TreeCache::SnapshotPtr TreeCache::GetSnapshot() const {
+  FastMutex::ScopedLock guard(snapshot_mutex_);
+  return snapshot_;
+}
+
+bool TreeCache::WaitForSync(int32 timeout_ms) {
+  Stopwatch stopwatch;
+  stopwatch.Start();
+  FastMutex::ScopedLock guard(mutex_);
+  while (!IsSynced()) {
+    const int32 remaining =
+        timeout_ms - (int32)(stopwatch.Elapsed() / 1000);
+    if (remaining <= 0 || !synced_changed_.TryWait(mutex_, remaining)) {
+      return IsSynced();
+    }
+  }
+  return true;
+}
+
+bool TreeCache::Exists(const StringView& path) const {
+  return GetLocalSnapshot().nodes_.Contains(path);
+}
+
+bool TreeCache::Get(const StringView& path, ByteArray& out_value,
+                    CNodeStat* out_stat) const {
+  const NodePtr* node = GetLocalSnapshot().nodes_.Find(path);
+  if (!node) {
+    return false;
+  }
+  out_value = (*node)->data;
+  if (out_stat) {
+    *out_stat = (*node)->stat;
+  }
+  return true;
+}
+
+bool TreeCache::GetChildren(const StringView& path,
+                            Array<ByteArray>& out_children) const {
+  const NodePtr* node = GetLocalSnapshot().nodes_.Find(path);
+  if (!node) {
+    return false;
+  }
+  out_children = (*node)->children;
+  return true;
+}
+
+const TreeCache::Snapshot& TreeCache::GetLocalSnapshot() const {
+  // The snapshot this thread read last. Only when the version moved is
+  // the new one fetched under the mutex.
+  struct LocalSnapshot {
+    uint64 cache_id = 0;
+    int64 version = -1;
+    SnapshotPtr snapshot;
+  };
+  static thread_local LocalSnapshot local;
+
+  if (local.cache_id != id_ ||
+      local.version != version_.load(std::memory_order_acquire)) {
+    FastMutex::ScopedLock guard(snapshot_mutex_);
+    local.snapshot = snapshot_;
+    local.cache_id = id_;
+    local.version = local.snapshot->GetVersion();
+  }
+  return *local.snapshot;
+}
+
+//
+// IWatcher
+//
+
+void TreeCache::OnConnected() {
+  if (next_watcher_) {
+    next_watcher_->OnConnected();
+  }
+
+  FastMutex::ScopedLock guard(mutex_);
+  connected_ = true;
+  // Within the same session the watches survived the disconnection;
+  // only a new session needs the tree to be read again.
+  if (!resync_requested_ && !expired_) {
+    synced_.store(true, std::memory_order_release);
+    synced_changed_.NotifyAll();
+  }
+  wake_.NotifyAll();
+}
+
+void TreeCache::OnConnecting() {
+  if (next_watcher_) {
+    next_watcher_->OnConnecting();
+  }
+
+  FastMutex::ScopedLock guard(mutex_);
+  connected_ = false;
+  synced_.store(false, std::memory_order_release);
+}
+
+void TreeCache::OnSessionExpired() {
+  if (next_watcher_) {
+    next_watcher_->OnSessionExpired();
+  }
+
+  FastMutex::ScopedLock guard(mutex_);
+  connected_ = false;
+  expired_ = true;
+  resync_requested_ = true;
+  resync_jitter_ = true;
+  dirty_.Clear();
+  synced_.store(false, std::memory_order_release);
+  wake_.NotifyAll();
+}
+
+void TreeCache::OnCreated(const char* path) {
+  if (next_watcher_) {
+    next_watcher_->OnCreated(path);
+  }
+  MarkDirty(path, REFRESH_NODE);
+}
+
+void TreeCache::OnDeleted(const char* path) {
+  if (next_watcher_) {
+    next_watcher_->OnDeleted(path);
+  }
+  MarkDirty(path, REFRESH_NODE);
+}
+
+void TreeCache::OnChanged(const char* path) {
+  if (next_watcher_) {
+    next_watcher_->OnChanged(path);
+  }
+  MarkDirty(path, REFRESH_DATA);
+}
+
+void TreeCache::OnChildChanged(const char* path) {
+  if (next_watcher_) {
+    next_watcher_->OnChildChanged(path);
+  }
+  MarkDirty(path, REFRESH_CHILDREN);
+}
+
+void TreeCache::OnNotWatching(const char* path) {
+  if (next_watcher_) {
+    next_watcher_->OnNotWatching(path);
+  }
+  MarkDirty(path, REFRESH_NODE);
+}
+
+bool TreeCache::IsInTree(const char* path) const {
+  if (path == nullptr) {
+    return false;
+  }
+  const int32 length = (int32)::strlen(path);
+  if (root_.Len() == 1) {
+    return length > 0 && path[0] == '/';
+  }
+  return length >= root_.Len() &&
+         ::memcmp(path, root_.ConstData(), root_.Len()) == 0 &&
+         (length == root_.Len() || path[root_.Len()] == '/');
+}
+
+void TreeCache::MarkDirty(const char* path, int32 refresh) {
+  if (!IsInTree(path)) {
+    return;
+  }
+
+  FastMutex::ScopedLock guard(mutex_);
+  dirty_.FindOrAdd(String(path)) |= refresh;
+  wake_.NotifyOne();
+}
+
+//
+// Cache thread
+//
+
+void TreeCache::Run() {
+  FastMutex::ScopedLock guard(mutex_);
+  while (running_) {
+    const bool has_work =
+        expired_ ||
+        (connected_ && (resync_requested_ || !dirty_.IsEmpty()));
+    if (!has_work) {
+      wake_.TryWait(mutex_, options_.retry_interval_ms);
+      continue;
+    }
+
+    try {
+      if (expired_) {
+        // Spread the new sessions, and the reads of the whole tree that
+        // follow them, of caches that expired together.
+        if (resync_jitter_ && options_.resync_jitter_ms > 0) {
+          resync_jitter_ = false;
+          wake_.TryWait(mutex_,
+                        (int32)random_.Next(options_.resync_jitter_ms));
+          continue;
+        }
+        resync_jitter_ = false;
+
+        // The handle of an expired session is dead; open a new one,
+        // unless another user of the client already has.
+        expired_ = false;
+        try {
+          ScopedUnlock<FastMutex> unlock(mutex_);
+          client_.ReconnectIfExpired();
+        } catch (...) {
+          expired_ = true;
+          throw;
+        }
+      } else if (resync_requested_) {
+        resync_requested_ = false;
+        // The full read covers whatever was pending.
+        dirty_.Clear();
+        try {
+          ScopedUnlock<FastMutex> unlock(mutex_);
+          Resync();
+        } catch (...) {
+          resync_requested_ = true;
+          throw;
+        }
+        if (!resync_requested_ && !expired_ && connected_) {
+          synced_.store(true, std::memory_order_release);
+          synced_changed_.NotifyAll();
+        }
+      } else {
+        FlatHashMap<String, int32> dirty;
+        Swap(dirty, dirty_);
+        try {
+          ScopedUnlock<FastMutex> unlock(mutex_);
+          Update(dirty);
+        } catch (...) {
+          // Retried once connected again.
+          for (const auto& pair : dirty) {
+            dirty_.FindOrAdd(pair.key) |= pair.value;
+          }
+          throw;
+        }
+      }
+    } catch (Exception& e) {
+      LOG(LogZookeeper, Warning, "TreeCache {}: {}", *root_,
+          *e.GetDisplayText());
+      if (running_ && !expired_ && client_.IsExpired()) {
+        expired_ = true;
+        resync_requested_ = true;
+      }
+      wake_.TryWait(mutex_, options_.retry_interval_ms);
+    }
+  }
+}
+
+void TreeCache::Resync() {
+  NodeMap nodes;
+  nodes.Reserve(snapshot_->Count());
+
+  Array<String> pending;
+  pending.Add(root_);
+  for (int32 i = 0; i < pending.Count(); ++i) {
+    const String path = pending[i];
+    RefreshNode(nodes, path, REFRESH_NODE, pending);
+  }
+  Publish(nodes);
+}
+
+void TreeCache::Update(const FlatHashMap<String, int32>& dirty) {
+  NodeMap nodes = snapshot_->nodes_;
+
+  Array<String> added;
+  for (const auto& pair : dirty) {
+    // A node is only followed from its parent; a stray notification for
+    // a node outside the cached tree is ignored.
+    if (pair.key != root_ && !nodes.Contains(pair.key) &&
+        !nodes.Contains(GetParentPath(pair.key))) {
+      continue;
+    }
+    RefreshNode(nodes, pair.key, pair.value, added);
+  }
+  for (int32 i = 0; i < added.Count(); ++i) {
+    const String path = added[i];
+    RefreshNode(nodes, path, REFRESH_NODE, added);
+  }
+  Publish(nodes);
+}
+
+bool TreeCache::RefreshNode(NodeMap& nodes, const String& path,
+                            int32 refresh, Array<String>& added) {
+  // Sets the data watch, and tells whether the data changed.
+  CNodeStat stat;
+  if (!client_.Exists(path, true, &stat)) {
+    RemoveSubtree(nodes, path);
+    return false;
+  }
+
+  const NodePtr* current = nodes.Find(path);
+  // During a resync the node of the previous snapshot saves the download
+  // of unchanged data.
+  const NodePtr previous = current ? *current : snapshot_->Find(path);
+
+  Node* node = previous.IsValid() ? new Node(*previous) : new Node();
+  NodePtr node_ptr(node);
+
+  try {
+    if (!previous.IsValid() || previous->stat.mzxid != stat.mzxid) {
+      if (!client_.Get(path, node->data, false)) {
+        // Deleted since Exists(); its parent's watch reports it.
+        RemoveSubtree(nodes, path);
+        return false;
+      }
+    }
+    node->stat = stat;
+
+    if (!current || (refresh & REFRESH_CHILDREN) != 0) {
+      Array<ByteArray> children;
+      CNodeStat children_stat;
+      client_.GetChildren2(path, children, children_stat, true);
+
+      if (current) {
+        for (const ByteArray& child : node->children) {
+          if (children.Find(child) == INVALID_INDEX) {
+            RemoveSubtree(nodes, GetChildPath(path, child));
+          }
+        }
+      }
+      for (const ByteArray& child : children) {
+        const String child_path = GetChildPath(path, child);
+        if (!nodes.Contains(child_path)) {
+          added.Add(child_path);
+        }
+      }
+      node->children = children;
+    }
+  } catch (ZookeeperException&) {
+    if (!client_.IsConnected()) {
+      throw;
+    }
+    // Deleted in between; its parent's watch reports it.
+    RemoveSubtree(nodes, path);
+    return false;
+  }
+
+  nodes.Add(path, node_ptr);
+  return true;
+}
+
+void TreeCache::RemoveSubtree(NodeMap& nodes, const String& path) {
+  NodePtr node;
+  if (!nodes.RemoveAndCopyValue(path, node)) {
+    return;
+  }
+  for (const ByteArray& child : node->children) {
+    RemoveSubtree(nodes, GetChildPath(path, child));
+  }
+}
+
+void TreeCache::Publish(NodeMap& nodes) {
+  Snapshot* snapshot = new Snapshot();
+  snapshot->version_ = snapshot_->version_ + 1;
+  for (const auto& pair : nodes) {
+    const CNodeStat& stat = pair.value->stat;
+    snapshot->zxid_ = Math::Max(snapshot->zxid_, stat.mzxid, stat.pzxid);
+  }
+  snapshot->nodes_ = MoveTemp(nodes);
+
+  SnapshotPtr published(snapshot);
+  {
+    FastMutex::ScopedLock guard(snapshot_mutex_);
+    snapshot_ = published;
+  }
+  version_.store(published->GetVersion(), std::memory_order_release);
+
+  ChangeCallback callback;
+  {
+    FastMutex::ScopedLock guard(mutex_);
+    callback = change_callback_;
+  }
+  if (callback) {
+    callback(published);
+  }
+}
+
+}  // namespace zookeeper
+}  // namespace fun
@@ -0,0 +1,209 @@
+﻿#pragma once
+
+#include <atomic>
+#include "fun/base/condition.h"
+#include "fun/base/container/flat_hash_map.h"
+#include "fun/base/ftl/function.h"
+#include "fun/base/mutex.h"
+#include "fun/base/random.h"
+#include "fun/base/runnable.h"
+#include "fun/base/shared_ptr.h"
+#include "fun/base/thread.h"
+#include "fun/zk/zk_client.h"
+
+namespace fun {
+namespace zookeeper {
+
+/**
+ * A local copy of a ZooKeeper subtree, kept up to date by watches.
+ *
+ * Service discovery and configuration read the same few nodes over and
+ * over; going to the ensemble for each read costs a round trip and, when
+ * a whole fleet restarts, loads the ensemble with identical requests.
+ * The cache reads the subtree once, sets a watch on every node, and on
+ * each notification refetches only what changed. Reads are served from
+ * memory:
+ *
+ *   Client client;
+ *   TreeCache cache(client, "/services");
+ *   client.Connect(hosts, &cache);
+ *   cache.Start();
+ *   ...
+ *   ByteArray endpoint;
+ *   if (cache.Get("/services/match/endpoint", endpoint)) { ... }
+ *
+ * The cache must be the global watcher of the client; it passes every
+ * event on to the watcher given to its constructor.
+ *
+ * The tree is published as immutable, versioned Snapshots. A reader
+ * keeps a reference to the current snapshot per thread, and only looks
+ * for a new one (under a mutex) after the version counter moved, so
+ * reads of an unchanged tree take no lock. Several reads from one
+ * GetSnapshot() see the same consistent state.
+ *
+ * Notifications are handled by a thread of the cache, which coalesces
+ * the ones that arrive together into one new snapshot. After the session
+ * has expired it opens a new one and reads the whole tree again,
+ * downloading only the nodes whose data changed. Until then reads return
+ * the last snapshot and IsSynced() returns false.
+ *
+ * The cache owns reconnecting the client: it calls
+ * Client::ReconnectIfExpired(), so other users of the client that do the
+ * same after an expiry share the one new session instead of replacing
+ * it.
+ */
+class FUN_ZOOKEEPER_API TreeCache : public IWatcher, protected Runnable {
+ public:
+  struct Node {
+    ByteArray data;
+    CNodeStat stat;
+    /** Names of the children, not their paths. */
+    Array<ByteArray> children;
+  };
+
+  typedef SharedPtr<const Node, SPMode::ThreadSafe> NodePtr;
+
+  class FUN_ZOOKEEPER_API Snapshot {
+   public:
+    int64 GetVersion() const { return version_; }
+
+    /** The largest zxid of a change the snapshot reflects. */
+    int64 GetZxid() const { return zxid_; }
+
+    int32 Count() const { return nodes_.Count(); }
+
+    /** Returns the node at path, or null. */
+    NodePtr Find(const StringView& path) const {
+      const NodePtr* node = nodes_.Find(path);
+      return node ? *node : NodePtr();
+    }
+
+   private:
+    friend class TreeCache;
+
+    int64 version_ = 0;
+    int64 zxid_ = 0;
+    FlatHashMap<String, NodePtr> nodes_;
+  };
+
+  typedef SharedPtr<const Snapshot, SPMode::ThreadSafe> SnapshotPtr;
+
+  /** Called by the cache thread after a new snapshot is published. */
+  typedef Function<void(const SnapshotPtr&)> ChangeCallback;
+
+  struct FUN_ZOOKEEPER_API Options {
+    Options();
+
+    /**
+     * Upper bound of a random delay before the tree is read again after
+     * an expiry, so that a fleet losing its sessions together does not
+     * resync all at once.
+     */
+    int32 resync_jitter_ms;
+
+    /** Delay between attempts while the ensemble is unreachable. */
+    int32 retry_interval_ms;
+  };
+
+  TreeCache(Client& client, const ByteArray& root,
+            IWatcher* next_watcher = nullptr,
+            const Options& options = Options());
+  ~TreeCache();
+
+  /**
+   * Starts the cache thread, which reads the tree once the client is
+   * connected.
+   */
+  void Start();
+
+  void Stop();
+
+  void SetChangeCallback(const ChangeCallback& callback);
+
+  /**
+   * Returns the current snapshot.
+   */
+  SnapshotPtr GetSnapshot() const;
+
+  int64 GetVersion() const { return version_.load(std::memory_order_acquire); }
+
+  /**
+   * Returns true if the cache holds the whole tree of the current
+   * session.
+   */
+  bool IsSynced() const { return synced_.load(std::memory_order_acquire); }
+
+  /**
+   * Waits until the cache is synced. Returns false on timeout.
+   */
+  bool WaitForSync(int32 timeout_ms);
+
+  bool Exists(const StringView& path) const;
+
+  bool Get(const StringView& path, ByteArray& out_value,
+           CNodeStat* out_stat = nullptr) const;
+
+  bool GetChildren(const StringView& path,
+                   Array<ByteArray>& out_children) const;
+
+  // IWatcher
+  void OnConnected() override;
+  void OnConnecting() override;
+  void OnSessionExpired() override;
+  void OnCreated(const char* path) override;
+  void OnDeleted(const char* path) override;
+  void OnChanged(const char* path) override;
+  void OnChildChanged(const char* path) override;
+  void OnNotWatching(const char* path) override;
+
+ protected:
+  void Run() override;
+
+ private:
+  enum Refresh {
+    REFRESH_DATA = 1,
+    REFRESH_CHILDREN = 2,
+    REFRESH_NODE = REFRESH_DATA | REFRESH_CHILDREN
+  };
+
+  typedef FlatHashMap<String, NodePtr> NodeMap;
+
+  const Snapshot& GetLocalSnapshot() const;
+  bool IsInTree(const char* path) const;
+  void MarkDirty(const char* path, int32 refresh);
+
+  void Resync();
+  void Update(const FlatHashMap<String, int32>& dirty);
+  bool RefreshNode(NodeMap& nodes, const String& path, int32 refresh,
+                   Array<String>& added);
+  void RemoveSubtree(NodeMap& nodes, const String& path);
+  void Publish(NodeMap& nodes);
+
+  Client& client_;
+  String root_;
+  IWatcher* next_watcher_;
+  Options options_;
+  const uint64 id_;
+
+  Thread thread_;
+  mutable FastMutex mutex_;
+  Condition wake_;
+  Condition synced_changed_;
+  bool running_;
+  bool connected_;
+  bool expired_;
+  bool resync_requested_;
+  bool resync_jitter_;
+  Random random_;
+  FlatHashMap<String, int32> dirty_;
+  ChangeCallback change_callback_;
+
+  // Written by the cache thread only.
+  SnapshotPtr snapshot_;
+  mutable FastMutex snapshot_mutex_;
+  std::atomic<int64> version_;
+  std::atomic<bool> synced_;
+};
+
+}  // namespace zookeeper
+}  // namespace fun
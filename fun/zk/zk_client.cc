@@ -13,6 +13,7 @@
 #endif
 
 #include <mutex>  // once_flag
+#include <vector>
 
 // TODO context Pooling...
 
@@ -110,6 +111,15 @@ inline int NodesTypeToZkFlags(NodeTypes node_types) {
   return flags;
 }
 
+/**
+ * Returns true for the errors of zoo_multi() caused by one of the
+ * operations rather than by the session.
+ */
+inline bool IsOpFailure(int rc) {
+  return rc == ZNONODE || rc == ZNODEEXISTS || rc == ZBADVERSION ||
+         rc == ZNOTEMPTY || rc == ZNOCHILDRENFOREPHEMERALS;
+}
+
 // TODO rc(resultcode)가 ZOK가 아니면 로그를 남기도록 하자.
 
 struct VoidCompletionContext {
@@ -283,11 +293,41 @@ void LogCallback(const char* message) {
 
 }  // namespace
 
-Client::Client() : zk_handle_(nullptr), global_watcher_(nullptr) {}
+/**
+ * Owns a zhandle_t. Calls hold a reference for their duration, so a
+ * handle replaced by Reconnect() is closed only after the last call
+ * using it has returned.
+ */
+struct Client::Handle {
+  explicit Handle(zhandle_t* zh) : zh(zh) {}
+
+  ~Handle() { Close(); }
+
+  int Close() {
+    if (zh == nullptr) {
+      return ZOK;
+    }
+    const int rc = zookeeper_close(zh);
+    zh = nullptr;
+    return rc;
+  }
+
+  zhandle_t* zh;
+};
+
+namespace {
+
+inline zhandle_t* ZhOf(const Client::HandlePtr& handle) {
+  return handle.IsValid() ? handle->zh : nullptr;
+}
+
+}  // namespace
+
+Client::Client() : global_watcher_(nullptr) {}
 
 Client::Client(const ByteArray& server_host, IWatcher* global_watcher,
                const Timespan& timeout)
-    : zk_handle_(nullptr), global_watcher_(nullptr) {
+    : global_watcher_(nullptr) {
   Connect(server_host, global_watcher, timeout);
 }
 
@@ -303,38 +343,83 @@ Client::~Client() {
 
 void Client::Connect(const ByteArray& server_host, IWatcher* global_watcher,
                      const Timespan& timeout) {
-  Disconnect();
+  FastMutex::ScopedLock guard(connect_mutex_);
+  Open(server_host, global_watcher, timeout);
+}
+
+void Client::Disconnect() {
+  FastMutex::ScopedLock guard(connect_mutex_);
+  Close();
+}
+
+void Client::Reconnect() {
+  FastMutex::ScopedLock guard(connect_mutex_);
+  fun_check(!server_host_list_.IsEmpty());
+  Open(server_host_list_, global_watcher_, timeout_);
+}
+
+bool Client::ReconnectIfExpired() {
+  FastMutex::ScopedLock guard(connect_mutex_);
+  // Another user may have opened the new session already.
+  if (!IsExpired()) {
+    return false;
+  }
+  Open(server_host_list_, global_watcher_, timeout_);
+  return true;
+}
+
+void Client::Open(const ByteArray& server_host, IWatcher* global_watcher,
+                  const Timespan& timeout) {
+  Close();
 
   global_watcher_ = global_watcher;
+  server_host_list_ = server_host;
+  timeout_ = timeout;
 
   set_default_debug_level();
 
-  zk_handle_ =
+  zhandle_t* zh =
       zookeeper_init(server_host.ConstData(), GlobalWatchFunc,
                      (int32)timeout.TotalMilliseconds(), nullptr, this, 0);
-  if (zk_handle_ == nullptr) {
+  if (zh == nullptr) {
     char error[1024];
     strerror_s(error, errno);
     throw ZookeeperException(String(error));
   }
 
-  zoo_set_log_callback((zhandle_t*)zk_handle_, &LogCallback);
+  zoo_set_log_callback(zh, &LogCallback);
+
+  FastMutex::ScopedLock guard(handle_mutex_);
+  handle_ = HandlePtr(new Handle(zh));
 }
 
-void Client::Disconnect() {
-  if (zk_handle_) {
-    auto rc = zookeeper_close((zhandle_t*)zk_handle_);
+void Client::Close() {
+  HandlePtr handle;
+  {
+    FastMutex::ScopedLock guard(handle_mutex_);
+    Swap(handle, handle_);
+  }
+  // Otherwise the last call still using it closes it on return.
+  if (handle.IsValid() && handle.IsUnique()) {
+    auto rc = handle->Close();
     THROW_IF_FAILED(rc);
   }
 }
 
+Client::HandlePtr Client::GetHandle() const {
+  FastMutex::ScopedLock guard(handle_mutex_);
+  return handle_;
+}
+
 bool Client::IsConnected() {
-  return zk_handle_ && zoo_state((zhandle_t*)zk_handle_) == ZOO_CONNECTED_STATE;
+  const HandlePtr handle = GetHandle();
+  return handle.IsValid() && zoo_state(handle->zh) == ZOO_CONNECTED_STATE;
 }
 
 bool Client::IsExpired() {
-  return zk_handle_ &&
-         zoo_state((zhandle_t*)zk_handle_) == ZOO_EXPIRED_SESSION_STATE;
+  const HandlePtr handle = GetHandle();
+  return handle.IsValid() &&
+         zoo_state(handle->zh) == ZOO_EXPIRED_SESSION_STATE;
 }
 
 void Client::WatchHandler_INTERNAL(int type, int state, const char* path) {
@@ -376,7 +461,7 @@ ByteArray Client::Create(const ByteArray& path, const ByteArray& value,
                          const NodeTypes node_types) {
   ByteArray path_buf(path.Len() + 64, NoInit);
 
-  auto zc = zoo_create((zhandle_t*)zk_handle_, path.ConstData(),
+  auto zc = zoo_create(ZhOf(GetHandle()), path.ConstData(),
                        value.ConstData(), value.Len(), &ZOO_OPEN_ACL_UNSAFE,
                        NodesTypeToZkFlags(node_types), path_buf.MutableData(),
                        path_buf.Len());
@@ -390,7 +475,7 @@ bool Client::CreateAsync(const ByteArray& path,
                          const Function<void(bool, const ByteArray&)>& callback,
                          const ByteArray& value, const NodeTypes node_types) {
   auto zc = zoo_acreate(
-      (zhandle_t*)zk_handle_, path.ConstData(), value.ConstData(), value.Len(),
+      ZhOf(GetHandle()), path.ConstData(), value.ConstData(), value.Len(),
       &ZOO_OPEN_ACL_UNSAFE, NodesTypeToZkFlags(node_types),
       StringCompletionCallback, new StringCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -402,7 +487,7 @@ ByteArray Client::Create2(NodeStat& out_stat, const ByteArray& path,
   ByteArray path_buf(path.Len() + 64, NoInit);
 
   Stat zoo_stat;
-  auto zc = zoo_create2((zhandle_t*)zk_handle_, path.ConstData(),
+  auto zc = zoo_create2(ZhOf(GetHandle()), path.ConstData(),
                         value.ConstData(), value.Len(), &ZOO_OPEN_ACL_UNSAFE,
                         NodesTypeToZkFlags(node_types), path_buf.MutableData(),
                         path_buf.Len(), &zoo_stat);
@@ -420,7 +505,7 @@ bool Client::Create2Async(
     const Function<void(bool, const ByteArray&, const NodeStat&)>& callback,
     const ByteArray& value, const NodeTypes node_types) {
   auto zc = zoo_acreate2(
-      (zhandle_t*)zk_handle_, path.ConstData(), value.ConstData(), value.Len(),
+      ZhOf(GetHandle()), path.ConstData(), value.ConstData(), value.Len(),
       &ZOO_OPEN_ACL_UNSAFE, NodesTypeToZkFlags(node_types),
       StringStatCompletionCallback, new StringStatCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -432,7 +517,7 @@ ByteArray Client::CreateIfNotExists(const ByteArray& path,
                                     const NodeTypes node_types) {
   ByteArray path_buf(path.Len() + 64, NoInit);
 
-  auto zc = zoo_create((zhandle_t*)zk_handle_, path.ConstData(),
+  auto zc = zoo_create(ZhOf(GetHandle()), path.ConstData(),
                        value.ConstData(), value.Len(), &ZOO_OPEN_ACL_UNSAFE,
                        NodesTypeToZkFlags(node_types), path_buf.MutableData(),
                        path_buf.Len());
@@ -455,7 +540,7 @@ bool Client::Delete(const ByteArray& path) {
   }
 
   auto zc =
-      zoo_delete((zhandle_t*)zk_handle_, path.ConstData(), NodeStat.version);
+      zoo_delete(ZhOf(GetHandle()), path.ConstData(), NodeStat.version);
   THROW_IF_FAILED(zc);
   return true;
 }
@@ -468,7 +553,7 @@ bool Client::DeleteAsync(const ByteArray& path,
   }
 
   auto zc =
-      zoo_adelete((zhandle_t*)zk_handle_, path.ConstData(), node_stat.version,
+      zoo_adelete(ZhOf(GetHandle()), path.ConstData(), node_stat.version,
                   VoidCompletionCallback, new VoidCompletionContext(callback));
   THROW_IF_FAILED(zc);
   return true;
@@ -481,7 +566,7 @@ bool Client::DeleteIfExists(const ByteArray& path) {
   }
 
   auto zc =
-      zoo_delete((zhandle_t*)zk_handle_, path.ConstData(), node_stat.version);
+      zoo_delete(ZhOf(GetHandle()), path.ConstData(), node_stat.version);
   if (zc == ZNONODE) {
     return false;
   }
@@ -494,7 +579,7 @@ bool Client::DeleteIfExists(const ByteArray& path) {
 bool Client::Exists(const ByteArray& path, bool watch,
                     NodeStat* out_node_stat) {
   Stat zoo_stat;
-  auto zc = zoo_exists((zhandle_t*)zk_handle_, path.ConstData(), watch,
+  auto zc = zoo_exists(ZhOf(GetHandle()), path.ConstData(), watch,
                        out_node_stat != nullptr ? (&zoo_stat) : nullptr);
   if (zc == ZNONODE) {
     return false;
@@ -513,7 +598,7 @@ bool Client::ExistsAsync(const ByteArray& path,
                          const Function<void(bool, const NodeStat&)>& callback,
                          bool watch) {
   auto zc =
-      zoo_aexists((zhandle_t*)zk_handle_, path.ConstData(), watch,
+      zoo_aexists(ZhOf(GetHandle()), path.ConstData(), watch,
                   StatCompletionCallback, new StatCompletionContext(callback));
 
   if (zc == ZNONODE) {
@@ -528,7 +613,7 @@ bool Client::ExistsAsync(const ByteArray& path,
 bool Client::GetStat(const ByteArray& path, NodeStat& out_node_stat) {
   Stat zoo_stat;
   auto zc =
-      zoo_exists((zhandle_t*)zk_handle_, path.ConstData(), false, &zoo_stat);
+      zoo_exists(ZhOf(GetHandle()), path.ConstData(), false, &zoo_stat);
 
   THROW_IF_FAILED(zc);
 
@@ -540,7 +625,7 @@ bool Client::GetStatAsync(
     const ByteArray& path,
     const Function<void(bool, const NodeStat&)>& callback) {
   auto zc =
-      zoo_aexists((zhandle_t*)zk_handle_, path.ConstData(), false,
+      zoo_aexists(ZhOf(GetHandle()), path.ConstData(), false,
                   StatCompletionCallback, new StatCompletionContext(callback));
   THROW_IF_FAILED(zc);
   return true;
@@ -552,7 +637,7 @@ bool Client::Set(const ByteArray& path, const ByteArray& value) {
     return false;
   }
 
-  auto zc = zoo_set((zhandle_t*)zk_handle_, path.ConstData(), value.ConstData(),
+  auto zc = zoo_set(ZhOf(GetHandle()), path.ConstData(), value.ConstData(),
                     value.Len(), NodeStat.version);
   THROW_IF_FAILED(zc);
   return true;
@@ -566,7 +651,7 @@ bool Client::SetAsync(const ByteArray& path, const ByteArray& value,
   }
 
   auto zc =
-      zoo_aset((zhandle_t*)zk_handle_, path.ConstData(), value.ConstData(),
+      zoo_aset(ZhOf(GetHandle()), path.ConstData(), value.ConstData(),
                value.Len(), NodeStat.version, StatCompletionCallback,
                new StatCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -584,7 +669,7 @@ bool Client::Get(const ByteArray& path, ByteArray& out_value, bool watch) {
 
   int buffer_len = out_value.Len();
   auto zoo_stat = ToZooStat(node_stat);
-  auto zc = zoo_get((zhandle_t*)zk_handle_, path.ConstData(), watch,
+  auto zc = zoo_get(ZhOf(GetHandle()), path.ConstData(), watch,
                     out_value.MutableData(), &buffer_len, &zoo_stat);
 
   THROW_IF_FAILED(zc);
@@ -597,7 +682,7 @@ bool Client::GetAsync(
     const ByteArray& path,
     const Function<void(bool, const ByteArray&, const NodeStat&)>& callback,
     bool watch) {
-  auto zc = zoo_aget((zhandle_t*)zk_handle_, path.ConstData(), watch,
+  auto zc = zoo_aget(ZhOf(GetHandle()), path.ConstData(), watch,
                      DataAsStringCompletionCallback,
                      new DataAsStringCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -607,7 +692,7 @@ bool Client::GetAsync(
 bool Client::GetChildren(const ByteArray& parent_path,
                          Array<ByteArray>& out_children, bool watch) {
   struct String_vector ChildrenVec;
-  auto zc = zoo_get_children((zhandle_t*)zk_handle_, parent_path.ConstData(),
+  auto zc = zoo_get_children(ZhOf(GetHandle()), parent_path.ConstData(),
                              watch, &ChildrenVec);
 
   THROW_IF_FAILED(zc);
@@ -623,7 +708,7 @@ bool Client::GetChildren(const ByteArray& parent_path,
 bool Client::GetChildrenAsync(
     const ByteArray& parent_path,
     const Function<void(bool, const Array<ByteArray>&)>& callback, bool watch) {
-  auto zc = zoo_aget_children((zhandle_t*)zk_handle_, parent_path.ConstData(),
+  auto zc = zoo_aget_children(ZhOf(GetHandle()), parent_path.ConstData(),
                               watch, StringsCompletionCallback,
                               new StringsCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -635,7 +720,7 @@ bool Client::GetChildren2(const ByteArray& parent_path,
                           bool watch) {
   struct String_vector ChildrenVec;
   Stat zoo_stat;
-  auto zc = zoo_get_children2((zhandle_t*)zk_handle_, parent_path.ConstData(),
+  auto zc = zoo_get_children2(ZhOf(GetHandle()), parent_path.ConstData(),
                               watch, &ChildrenVec, &zoo_stat);
 
   THROW_IF_FAILED(zc);
@@ -655,7 +740,7 @@ bool Client::GetChildren2Async(
     const Function<void(bool, const Array<ByteArray>&, const NodeStat&)>&
         callback,
     bool watch) {
-  auto zc = zoo_aget_children2((zhandle_t*)zk_handle_, parent_path.ConstData(),
+  auto zc = zoo_aget_children2(ZhOf(GetHandle()), parent_path.ConstData(),
                                watch, StringsStatCompletionCallback,
                                new StringsStatCompletionContext(callback));
   THROW_IF_FAILED(zc);
@@ -680,12 +765,119 @@ ByteArray Client::RecursiveCreate(const ByteArray& path, const ByteArray& value,
 
 bool Client::SyncAsync(const ByteArray& path,
                        const Function<void(bool, const ByteArray&)>& callback) {
-  auto zc = zoo_async((zhandle_t*)zk_handle_, path.ConstData(),
+  auto zc = zoo_async(ZhOf(GetHandle()), path.ConstData(),
                       StringCompletionCallback,
                       new StringCompletionContext(callback));
   THROW_IF_FAILED(zc);
   return true;
 }
 
+bool Client::Multi(const MultiOps& ops, Array<MultiResult>* out_results) {
+#ifdef ZOO_CREATE_OP
+  const int32 count = ops.Count();
+  if (out_results) {
+    out_results->Clear();
+  }
+  if (count == 0) {
+    return true;
+  }
+
+  std::vector<zoo_op_t> zoo_ops(count);
+  std::vector<zoo_op_result_t> zoo_results(count);
+  std::vector<Stat> zoo_stats(count);
+  std::vector<ByteArray> path_bufs(count);
+
+  for (int32 i = 0; i < count; ++i) {
+    const MultiOps::Op& op = ops.GetOps()[i];
+    switch (op.type) {
+      case MultiOps::OpType::Create:
+        path_bufs[i] = ByteArray(op.path.Len() + 64, NoInit);
+        zoo_create_op_init(&zoo_ops[i], op.path.ConstData(),
+                           op.value.ConstData(), op.value.Len(),
+                           &ZOO_OPEN_ACL_UNSAFE,
+                           NodesTypeToZkFlags(op.node_types),
+                           path_bufs[i].MutableData(), path_bufs[i].Len());
+        break;
+      case MultiOps::OpType::Delete:
+        zoo_delete_op_init(&zoo_ops[i], op.path.ConstData(), op.version);
+        break;
+      case MultiOps::OpType::Set:
+        zoo_set_op_init(&zoo_ops[i], op.path.ConstData(), op.value.ConstData(),
+                        op.value.Len(), op.version, &zoo_stats[i]);
+        break;
+      case MultiOps::OpType::Check:
+        zoo_check_op_init(&zoo_ops[i], op.path.ConstData(), op.version);
+        break;
+    }
+  }
+
+  auto zc = zoo_multi(ZhOf(GetHandle()), count, zoo_ops.data(),
+                      zoo_results.data());
+
+  if (out_results && (ZK_SUCCEEDED(zc) || IsOpFailure(zc))) {
+    out_results->Reserve(count);
+    for (int32 i = 0; i < count; ++i) {
+      MultiResult result;
+      result.rc = zoo_results[i].err;
+      if (ZK_SUCCEEDED(result.rc)) {
+        const MultiOps::OpType type = ops.GetOps()[i].type;
+        if (type == MultiOps::OpType::Create) {
+          path_bufs[i].TrimToNulTerminator();
+          result.created_path = path_bufs[i];
+        } else if (type == MultiOps::OpType::Set) {
+          result.stat = FromZooStat(zoo_stats[i]);
+        }
+      }
+      out_results->Add(result);
+    }
+  }
+
+  if (IsOpFailure(zc)) {
+    return false;
+  }
+
+  THROW_IF_FAILED(zc);
+  return true;
+#else
+  // zoo_multi() came with the 3.4 C client.
+  throw NotImplementedException("zookeeper multi needs the 3.4 C client");
+#endif
+}
+
+//
+// MultiOps
+//
+
+MultiOps& MultiOps::Create(const ByteArray& path, const ByteArray& value,
+                           const NodeTypes node_types) {
+  return Add(OpType::Create, path, value, node_types, -1);
+}
+
+MultiOps& MultiOps::Delete(const ByteArray& path, int32 version) {
+  return Add(OpType::Delete, path, ByteArray(), NodeType::Persistent, version);
+}
+
+MultiOps& MultiOps::Set(const ByteArray& path, const ByteArray& value,
+                        int32 version) {
+  return Add(OpType::Set, path, value, NodeType::Persistent, version);
+}
+
+MultiOps& MultiOps::Check(const ByteArray& path, int32 version) {
+  return Add(OpType::Check, path, ByteArray(), NodeType::Persistent, version);
+}
+
+MultiOps& MultiOps::Add(OpType type, const ByteArray& path,
+                        const ByteArray& value, const NodeTypes node_types,
+                        int32 version) {
+  Op op;
+  op.type = type;
+  op.path = path;
+  op.value = value;
+  op.node_types = node_types;
+  op.version = version;
+  ops_.Add(op);
+  return *this;
+}
+
 }  // namespace zookeeper
 }  // namespace fun
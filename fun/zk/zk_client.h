@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "fun/base/flags.h"
+#include "fun/base/mutex.h"
+#include "fun/base/shared_ptr.h"
 #include "fun/zk/zk.h"
 
 struct NodeStat;
@@ -84,14 +86,81 @@ enum class NodeType {
 DECLARE_FLAGS(NodeTypes, NodeType);
 DECLARE_OPERATORS_FOR_FLAGS(NodeTypes);
 
+/**
+ * Operations applied atomically by Client::Multi(): either all of them
+ * succeed or none does.
+ */
+class FUN_ZOOKEEPER_API MultiOps {
+ public:
+  enum class OpType {
+    Create,
+    Delete,
+    Set,
+    Check,
+  };
+
+  struct Op {
+    OpType type;
+    ByteArray path;
+    ByteArray value;
+    NodeTypes node_types;
+    /** Expected version of the node, -1 for any. */
+    int32 version;
+  };
+
+  MultiOps& Create(const ByteArray& path, const ByteArray& value = ByteArray(),
+                   const NodeTypes node_types = NodeType::Persistent);
+
+  MultiOps& Delete(const ByteArray& path, int32 version = -1);
+
+  MultiOps& Set(const ByteArray& path, const ByteArray& value,
+                int32 version = -1);
+
+  /** Fails the whole batch unless the node has the given version. */
+  MultiOps& Check(const ByteArray& path, int32 version);
+
+  int32 Count() const { return ops_.Count(); }
+
+  const Array<Op>& GetOps() const { return ops_; }
+
+  void Clear() { ops_.Clear(); }
+
+ private:
+  MultiOps& Add(OpType type, const ByteArray& path, const ByteArray& value,
+                const NodeTypes node_types, int32 version);
+
+  Array<Op> ops_;
+};
+
+/**
+ * Result of one operation of Client::Multi().
+ */
+struct MultiResult {
+  /** ZooKeeper result code; 0 if the operation succeeded. */
+  int32 rc;
+
+  /** Name of the node made by a create. */
+  ByteArray created_path;
+
+  /** Stat of the node after a set. */
+  CNodeStat stat;
+};
+
 // TODO 예외는 던지지 말도록 하자. 로깅만 처리하고, 결과를 반환하는 형태로
 // 처리하도록 하자.
 
 /**
  * Zookeeper session.
+ *
+ * The client may be shared between threads. Connect(), Reconnect() and
+ * Disconnect() may replace the session while other threads are calling
+ * it; a call in progress keeps the old handle open until it returns.
  */
 class FUN_ZOOKEEPER_API Client : public Noncopyable {
  public:
+  struct Handle;
+  typedef SharedPtr<Handle, SPMode::ThreadSafe> HandlePtr;
+
   Client();
 
   /**
@@ -119,6 +188,20 @@ class FUN_ZOOKEEPER_API Client : public Noncopyable {
 
   bool IsExpired();
 
+  /**
+   * Opens a new session with the hosts, watcher and timeout of the last
+   * Connect(); needed once a session has expired.
+   */
+  void Reconnect();
+
+  /**
+   * Like Reconnect(), but only if the current session has expired.
+   * Users sharing the client that each notice the expiry call this, and
+   * only the first opens a new session; the others return false and
+   * use the new one.
+   */
+  bool ReconnectIfExpired();
+
   // typedef Function<void(int32 RC, const ByteArray& CreatedNodeName)>
   // CCreateCallback; typedef Function<void(int32 RC, const ByteArray&
   // CreatedNodeName, const CNodeStat& NodeStat)> CCreate2Callback; typedef
@@ -201,17 +284,37 @@ class FUN_ZOOKEEPER_API Client : public Noncopyable {
   bool SyncAsync(const ByteArray& path,
                  const Function<void(bool, const ByteArray&)>& callback);
 
+  /**
+   * Applies ops in one transaction (zoo_multi). Returns false if one of
+   * them failed, for instance on a version mismatch, in which case none
+   * was applied and the result of the failed one tells why.
+   */
+  bool Multi(const MultiOps& ops, Array<MultiResult>* out_results = nullptr);
+
   /**
    * \warning Do not call this funciton directly(internal usage only)
    */
   void WatchHandler_INTERNAL(int type, int state, const char* path);
 
  private:
-  /** Zookeep handle */
-  void* zoo_handle_;
+  void Open(const ByteArray& server_host_list, IWatcher* global_watcher,
+            const Timespan& timeout);
+  void Close();
+  HandlePtr GetHandle() const;
+
+  /** Serializes Connect(), Reconnect() and Disconnect(). */
+  FastMutex connect_mutex_;
+
+  /** Zookeep handle; swapped under handle_mutex_. */
+  mutable FastMutex handle_mutex_;
+  HandlePtr handle_;
 
   /** Global watcher object */
   IWatcher* global_watcher_;
+
+  /** Parameters of the last Connect(), for Reconnect(). */
+  ByteArray server_host_list_;
+  Timespan timeout_;
 };
 
 }  // namespace zookeeper